@@ -52,6 +52,8 @@
         'heaps/large_block_heap.h',
         'heaps/simple_block_heap.cc',
         'heaps/simple_block_heap.h',
+        'heaps/size_class_block_heap.cc',
+        'heaps/size_class_block_heap.h',
         'heaps/win_heap.cc',
         'heaps/win_heap.h',
         'heaps/zebra_block_heap.cc',
@@ -72,6 +74,8 @@
         'page_protection_helpers.cc',
         'page_protection_helpers.h',
         'quarantine.h',
+        'quarantines/lock_free_quarantine.h',
+        'quarantines/lock_free_quarantine_impl.h',
         'quarantines/sharded_quarantine.h',
         'quarantines/sharded_quarantine_impl.h',
         'quarantines/size_limited_quarantine.h',
@@ -91,6 +95,8 @@
         'shadow_impl.h',
         'shadow_marker.cc',
         'shadow_marker.h',
+        'shadow_scan.cc',
+        'shadow_scan.h',
         'stack_capture_cache.cc',
         'stack_capture_cache.h',
         'system_interceptors.cc',
@@ -207,6 +213,7 @@
         'page_protection_helpers_unittest.cc',
         'registry_cache_unittest.cc',
         'shadow_marker_unittest.cc',
+        'shadow_scan_unittest.cc',
         'shadow_unittest.cc',
         'stack_capture_cache_unittest.cc',
         'timed_try_unittest.cc',
@@ -215,10 +222,12 @@
         'heaps/internal_heap_unittest.cc',
         'heaps/large_block_heap_unittest.cc',
         'heaps/simple_block_heap_unittest.cc',
+        'heaps/size_class_block_heap_unittest.cc',
         'heaps/win_heap_unittest.cc',
         'heaps/zebra_block_heap_unittest.cc',
         'heap_managers/block_heap_manager_unittest.cc',
         'memory_notifiers/shadow_memory_notifier_unittest.cc',
+        'quarantines/lock_free_quarantine_unittest.cc',
         'quarantines/sharded_quarantine_unittest.cc',
         'quarantines/size_limited_quarantine_unittest.cc',
         '<(src)/base/test/run_all_unittests.cc',
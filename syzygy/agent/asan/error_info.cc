@@ -27,18 +27,19 @@ namespace asan {
 namespace {
 
 // Copy a stack capture object into an array.
+// @param stack_cache The stack cache that owns the stack capture.
 // @param stack_capture The stack capture that we want to copy.
 // @param dst Will receive the stack frames.
 // @param dst_size Will receive the number of frames that has been copied.
-void CopyStackCaptureToArray(const common::StackCapture* stack_capture,
-                             void* dst, uint8* dst_size) {
+void CopyStackCaptureToArray(const StackCaptureCache* stack_cache,
+                             const common::StackCapture* stack_capture,
+                             void** dst, uint8* dst_size) {
+  DCHECK_NE(static_cast<StackCaptureCache*>(nullptr), stack_cache);
   DCHECK_NE(static_cast<common::StackCapture*>(nullptr), stack_capture);
-  DCHECK_NE(static_cast<void*>(nullptr), dst);
+  DCHECK_NE(static_cast<void**>(nullptr), dst);
   DCHECK_NE(static_cast<uint8*>(nullptr), dst_size);
-  ::memcpy(dst,
-           stack_capture->frames(),
-           stack_capture->num_frames() * sizeof(void*));
-  *dst_size = stack_capture->num_frames();
+  *dst_size = static_cast<uint8>(stack_cache->GetFrames(
+      stack_capture, dst, common::StackCapture::kMaxNumFrames));
 }
 
 // Get the information about an address relative to a block.
@@ -250,14 +251,16 @@ void ErrorInfoGetAsanBlockInfo(const Shadow* shadow,
   //                once, rather than recalculating this.
   if (stack_cache->StackCapturePointerIsValid(
           block_info.header->alloc_stack)) {
-    CopyStackCaptureToArray(block_info.header->alloc_stack,
+    CopyStackCaptureToArray(stack_cache,
+                            block_info.header->alloc_stack,
                             asan_block_info->alloc_stack,
                             &asan_block_info->alloc_stack_size);
   }
   if (block_info.header->state != ALLOCATED_BLOCK &&
       stack_cache->StackCapturePointerIsValid(
           block_info.header->free_stack)) {
-    CopyStackCaptureToArray(block_info.header->free_stack,
+    CopyStackCaptureToArray(stack_cache,
+                            block_info.header->free_stack,
                             asan_block_info->free_stack,
                             &asan_block_info->free_stack_size);
   }
@@ -498,7 +501,7 @@ void PopulateAsanParameters(const AsanErrorInfo& error_info,
 
   // Any new parameter added to the parameters structure should also be added
   // here.
-  static_assert(12 == ::common::kAsanParametersVersion,
+  static_assert(16 == ::common::kAsanParametersVersion,
                 "Pointers in the params must be linked up here.");
   crashdata::Dictionary* param_dict = crashdata::DictAddDict("asan-parameters",
                                                              dict);
@@ -541,6 +544,18 @@ void PopulateAsanParameters(const AsanErrorInfo& error_info,
   crashdata::LeafSetReal(
       error_info.asan_parameters.quarantine_flood_fill_rate,
       crashdata::DictAddLeaf("quarantine-flood-fill-rate", param_dict));
+  crashdata::LeafSetUInt(error_info.asan_parameters.enable_stack_trie,
+                         crashdata::DictAddLeaf("enable-stack-trie",
+                                                param_dict));
+  crashdata::LeafSetUInt(error_info.asan_parameters.enable_thread_caches,
+                         crashdata::DictAddLeaf("enable-thread-caches",
+                                                param_dict));
+  crashdata::LeafSetUInt(
+      error_info.asan_parameters.enable_lock_free_quarantine,
+      crashdata::DictAddLeaf("enable-lock-free-quarantine", param_dict));
+  crashdata::LeafSetUInt(error_info.asan_parameters.enable_size_class_heap,
+                         crashdata::DictAddLeaf("enable-size-class-heap",
+                                                param_dict));
 }
 
 }  // namespace
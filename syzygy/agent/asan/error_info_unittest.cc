@@ -613,7 +613,11 @@ TEST_F(AsanErrorInfoTest, PopulateErrorInfo) {
       "    \"zebra-block-heap-size\": 16777216,\n"
       "    \"zebra-block-heap-quarantine-ratio\": 2.5000000000000000E-001,\n"
       "    \"large-allocation-threshold\": 20480,\n"
-      "    \"quarantine-flood-fill-rate\": 5.0000000000000000E-001\n"
+      "    \"quarantine-flood-fill-rate\": 5.0000000000000000E-001,\n"
+      "    \"enable-stack-trie\": 0,\n"
+      "    \"enable-thread-caches\": 0,\n"
+      "    \"enable-lock-free-quarantine\": 0,\n"
+      "    \"enable-size-class-heap\": 0\n"
       "  }\n"
       "}";
   std::string expected = base::StringPrintf(kExpected,
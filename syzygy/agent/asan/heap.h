@@ -38,6 +38,7 @@ enum HeapType {
   kCtMallocHeap,
   kLargeBlockHeap,
   kZebraBlockHeap,
+  kSizeClassBlockHeap,
 
   // This must be last.
   kHeapTypeMax,
@@ -15,6 +15,7 @@
 #include "syzygy/agent/asan/heap_managers/block_heap_manager.h"
 
 #include <algorithm>
+#include <new>
 #include <utility>
 
 #include "base/bind.h"
@@ -27,6 +28,7 @@
 #include "syzygy/agent/asan/heaps/internal_heap.h"
 #include "syzygy/agent/asan/heaps/large_block_heap.h"
 #include "syzygy/agent/asan/heaps/simple_block_heap.h"
+#include "syzygy/agent/asan/heaps/size_class_block_heap.h"
 #include "syzygy/agent/asan/heaps/win_heap.h"
 #include "syzygy/agent/asan/heaps/zebra_block_heap.h"
 #include "syzygy/common/asan_parameters.h"
@@ -39,6 +41,7 @@ namespace {
 
 typedef HeapManagerInterface::HeapId HeapId;
 using heaps::LargeBlockHeap;
+using heaps::SizeClassBlockHeap;
 using heaps::ZebraBlockHeap;
 
 // Return the position of the most significant bit in a 32 bit unsigned value.
@@ -71,12 +74,15 @@ BlockHeapManager::BlockHeapManager(Shadow* shadow,
       stack_cache_(stack_cache),
       memory_notifier_(memory_notifier),
       initialized_(false),
+      shared_quarantine_(&sharded_quarantine_),
       process_heap_(nullptr),
       process_heap_underlying_heap_(nullptr),
       process_heap_id_(0),
       zebra_block_heap_(nullptr),
       zebra_block_heap_id_(0),
       large_block_heap_id_(0),
+      size_class_block_heap_id_(0),
+      thread_caches_(nullptr),
       locked_heaps_(nullptr),
       enable_page_protections_(true),
       corrupt_block_registry_cache_(L"SyzyAsanCorruptBlocks") {
@@ -90,6 +96,10 @@ BlockHeapManager::BlockHeapManager(Shadow* shadow,
   CHECK_NE(TLS_OUT_OF_INDEXES, allocation_filter_flag_tls_);
   // And disable it by default.
   set_allocation_filter_flag(false);
+
+  // The thread caches are created lazily.
+  thread_cache_tls_ = ::TlsAlloc();
+  CHECK_NE(TLS_OUT_OF_INDEXES, thread_cache_tls_);
 }
 
 BlockHeapManager::~BlockHeapManager() {
@@ -103,6 +113,9 @@ void BlockHeapManager::Init() {
     base::AutoLock lock(lock_);
     InitInternalHeap();
     corrupt_block_registry_cache_.Init();
+
+    if (parameters_.enable_lock_free_quarantine)
+      shared_quarantine_ = &lock_free_quarantine_;
   }
 
   // This takes care of its own locking, as its reentrant.
@@ -132,7 +145,7 @@ HeapId BlockHeapManager::CreateHeap() {
 
   base::AutoLock lock(lock_);
   underlying_heaps_map_.insert(std::make_pair(heap, underlying_heap));
-  HeapMetadata metadata = { &shared_quarantine_, false };
+  HeapMetadata metadata = { shared_quarantine_, false };
   auto result = heaps_.insert(std::make_pair(heap, metadata));
   return GetHeapId(result);
 }
@@ -154,6 +167,8 @@ bool BlockHeapManager::DestroyHeap(HeapId heap_id) {
   // Destroy the heap and flush its quarantine. This is done outside of the
   // lock to both reduce contention and to ensure that we can re-enter the
   // block heap manager if corruption is found during the heap tear down.
+  // The blocks of this heap held by the thread caches are flushed first.
+  FlushThreadCaches(heap_id);
   DestroyHeapContents(heap, quarantine);
 
   // Free up any resources associated with the heap. This modifies block
@@ -193,8 +208,13 @@ void* BlockHeapManager::Allocate(HeapId heap_id, size_t bytes) {
   // inserted.
 
   // We can always use the heap that was passed in.
-  HeapId heaps[3] = { heap_id, 0, 0 };
+  HeapId heaps[4] = { heap_id, 0, 0, 0 };
   size_t heap_count = 1;
+  if (MayUseSizeClassBlockHeap(bytes)) {
+    DCHECK_LT(heap_count, arraysize(heaps));
+    heaps[heap_count++] = size_class_block_heap_id_;
+  }
+
   if (MayUseLargeBlockHeap(bytes)) {
     DCHECK_LT(heap_count, arraysize(heaps));
     heaps[heap_count++] = large_block_heap_id_;
@@ -205,10 +225,22 @@ void* BlockHeapManager::Allocate(HeapId heap_id, size_t bytes) {
     heaps[heap_count++] = zebra_block_heap_id_;
   }
 
-  // Use the selected heaps to try to satisfy the allocation.
+  // Use the selected heaps to try to satisfy the allocation. Blocks cached by
+  // this thread can only be used if no specialized heap other than the
+  // size-class heap was selected.
   void* alloc = nullptr;
   BlockLayout block_layout = {};
-  for (int i = static_cast<int>(heap_count) - 1; i >= 0; --i) {
+  if (parameters_.enable_thread_caches) {
+    if (heap_count == 1) {
+      alloc = AllocateFromThreadCache(heap_id, bytes, &block_layout);
+    } else if (heap_count == 2 && heaps[1] == size_class_block_heap_id_) {
+      alloc = AllocateFromThreadCache(heaps[1], bytes, &block_layout);
+      if (alloc != nullptr)
+        heap_id = heaps[1];
+    }
+  }
+  for (int i = static_cast<int>(heap_count) - 1; alloc == nullptr && i >= 0;
+       --i) {
     BlockHeapInterface* heap = GetHeapFromId(heaps[i]);
     alloc = heap->AllocateBlock(
         bytes,
@@ -317,21 +349,15 @@ bool BlockHeapManager::Free(HeapId heap_id, void* alloc) {
   CompactBlockInfo compact = {};
   ConvertBlockInfo(block_info, &compact);
 
-  {
-    BlockQuarantineInterface::AutoQuarantineLock quarantine_lock(
-        quarantine, compact);
-    if (!quarantine->Push(compact))
-      return FreePristineBlock(&block_info);
-
-    if (enable_page_protections_) {
-      // The recently pushed block can be popped out in TrimQuarantine if the
-      // quarantine size is 0, in that case TrimQuarantine takes care of
-      // properly unprotecting and freeing the block. If the protection is set
-      // blindly after TrimQuarantine we could end up protecting a free (not
-      // quarantined, not allocated) block.
-      BlockProtectAll(block_info);
-    }
+  // Blocks that don't need page protection can go through the thread cache.
+  if (parameters_.enable_thread_caches && quarantine == shared_quarantine_ &&
+      heap_id != large_block_heap_id_) {
+    DeferQuarantine(heap_id, compact);
+    return true;
   }
+
+  if (!PushIntoQuarantine(quarantine, block_info, compact))
+    return FreePristineBlock(&block_info);
   TrimQuarantine(quarantine);
   return true;
 }
@@ -409,6 +435,11 @@ void BlockHeapManager::set_parameters(
   // internal heap and process heap would have to be reinitialized.
   DCHECK(!initialized_ ||
          parameters_.enable_ctmalloc == parameters.enable_ctmalloc);
+  // Similarly the shared quarantine can't be swapped once blocks have been
+  // placed in it.
+  DCHECK(!initialized_ ||
+         parameters_.enable_lock_free_quarantine ==
+             parameters.enable_lock_free_quarantine);
 
   {
     base::AutoLock lock(lock_);
@@ -420,7 +451,23 @@ void BlockHeapManager::set_parameters(
     PropagateParameters();
 }
 
+void BlockHeapManager::ReleaseThreadCache() {
+  ThreadCache* cache = reinterpret_cast<ThreadCache*>(
+      ::TlsGetValue(thread_cache_tls_));
+  if (cache == nullptr)
+    return;
+
+  FlushThreadCache(cache, 0);
+  ::TlsSetValue(thread_cache_tls_, nullptr);
+
+  base::AutoLock lock(lock_);
+  cache->in_use = false;
+}
+
 void BlockHeapManager::TearDownHeapManager() {
+  // Return the blocks held by the thread caches before tearing down the heaps.
+  FlushThreadCaches(0);
+
   base::AutoLock lock(lock_);
 
   // This would indicate that we have outstanding heap locks being
@@ -441,6 +488,14 @@ void BlockHeapManager::TearDownHeapManager() {
   // Clear the active heap list.
   heaps_.clear();
 
+  // Free the thread caches. These live in the internal heap.
+  while (thread_caches_ != nullptr) {
+    ThreadCache* cache = thread_caches_;
+    thread_caches_ = cache->next;
+    cache->~ThreadCache();
+    internal_heap_->Free(cache);
+  }
+
   // Clear the specialized heap references since they were deleted.
   process_heap_ = nullptr;
   process_heap_underlying_heap_ = nullptr;
@@ -448,12 +503,19 @@ void BlockHeapManager::TearDownHeapManager() {
   zebra_block_heap_ = nullptr;
   zebra_block_heap_id_ = 0;
   large_block_heap_id_ = 0;
+  size_class_block_heap_id_ = 0;
 
   // Free the allocation-filter flag (TLS).
   if (allocation_filter_flag_tls_ != TLS_OUT_OF_INDEXES) {
     ::TlsFree(allocation_filter_flag_tls_);
     allocation_filter_flag_tls_ = TLS_OUT_OF_INDEXES;
   }
+
+  // Free the thread cache TLS slot.
+  if (thread_cache_tls_ != TLS_OUT_OF_INDEXES) {
+    ::TlsFree(thread_cache_tls_);
+    thread_cache_tls_ = TLS_OUT_OF_INDEXES;
+  }
 }
 
 HeapId BlockHeapManager::GetHeapId(
@@ -567,13 +629,17 @@ void BlockHeapManager::PropagateParameters() {
   // The internal heap should already be setup.
   DCHECK_NE(static_cast<HeapInterface*>(nullptr), internal_heap_.get());
 
-  size_t quarantine_size = shared_quarantine_.max_quarantine_size();
-  shared_quarantine_.set_max_quarantine_size(parameters_.quarantine_size);
-  shared_quarantine_.set_max_object_size(parameters_.quarantine_block_size);
+  size_t quarantine_size = shared_quarantine_->max_quarantine_size();
+  shared_quarantine_->set_max_quarantine_size(parameters_.quarantine_size);
+  shared_quarantine_->set_max_object_size(parameters_.quarantine_block_size);
 
   // Trim the quarantine if its maximum size has decreased.
   if (initialized_ && quarantine_size > parameters_.quarantine_size)
-    TrimQuarantine(&shared_quarantine_);
+    TrimQuarantine(shared_quarantine_);
+
+  // Return the blocks held by the thread caches if they have been disabled.
+  if (initialized_ && !parameters_.enable_thread_caches)
+    FlushThreadCaches(0);
 
   if (parameters_.enable_zebra_block_heap && zebra_block_heap_ == nullptr) {
     // Initialize the zebra heap only if it isn't already initialized.
@@ -601,11 +667,21 @@ void BlockHeapManager::PropagateParameters() {
     base::AutoLock lock(lock_);
     BlockHeapInterface* heap = new LargeBlockHeap(
         memory_notifier_, internal_heap_.get());
-    HeapMetadata metadata = { &shared_quarantine_, false };
+    HeapMetadata metadata = { shared_quarantine_, false };
     auto result = heaps_.insert(std::make_pair(heap, metadata));
     large_block_heap_id_ = GetHeapId(result);
   }
 
+  // Create the SizeClassBlockHeap if need be.
+  if (parameters_.enable_size_class_heap && size_class_block_heap_id_ == 0) {
+    base::AutoLock lock(lock_);
+    BlockHeapInterface* heap = new SizeClassBlockHeap(
+        memory_notifier_, internal_heap_.get());
+    HeapMetadata metadata = { shared_quarantine_, false };
+    auto result = heaps_.insert(std::make_pair(heap, metadata));
+    size_class_block_heap_id_ = GetHeapId(result);
+  }
+
   // TODO(chrisha|sebmarchand): Clean up existing blocks that exceed the
   //     maximum block size? This will require an entirely new TrimQuarantine
   //     function. Since this is never changed at runtime except in our
@@ -669,17 +745,10 @@ bool BlockHeapManager::DestroyHeapContents(
     BlockInfo expanded = {};
     ConvertBlockInfo(iter_block, &expanded);
 
-    BlockQuarantineInterface::AutoQuarantineLock quarantine_lock(quarantine,
-                                                                 iter_block);
-    if (quarantine->Push(iter_block)) {
-      if (enable_page_protections_) {
-        // Restore protection to quarantined block.
-        BlockProtectAll(expanded);
-      }
-    } else {
-      // Avoid memory leak.
+    // This restores the protection of the block. Refused blocks are freed to
+    // avoid a memory leak.
+    if (!PushIntoQuarantine(quarantine, expanded, iter_block))
       blocks_to_free.push_back(iter_block);
-    }
   }
 
   FreeBlockVector(blocks_to_free);
@@ -713,9 +782,16 @@ void BlockHeapManager::TrimQuarantine(BlockQuarantineInterface* quarantine) {
   if (parameters_.quarantine_size == 0) {
     quarantine->Empty(&blocks_to_free);
   } else {
-    CompactBlockInfo compact = {};
-    while (quarantine->Pop(&compact))
-      blocks_to_free.push_back(compact);
+    // Pop the blocks in batches so that the quarantine's synchronization
+    // costs are paid once per batch rather than once per block.
+    while (quarantine->PopBatch(kQuarantineTrimBatchSize, &blocks_to_free) ==
+               kQuarantineTrimBatchSize) {
+    }
+
+    // Hold on to some of the expired blocks so that this thread can reuse
+    // them directly.
+    if (parameters_.enable_thread_caches && quarantine == shared_quarantine_)
+      CacheExpiredBlocks(&blocks_to_free);
   }
 
   FreeBlockVector(blocks_to_free);
@@ -730,6 +806,37 @@ void BlockHeapManager::FreeBlockVector(
   }
 }
 
+bool BlockHeapManager::PushIntoQuarantine(
+    BlockQuarantineInterface* quarantine,
+    const BlockInfo& block_info,
+    const CompactBlockInfo& compact) {
+  DCHECK_NE(static_cast<BlockQuarantineInterface*>(nullptr), quarantine);
+
+  // The lock-free quarantine doesn't serialize pushes with pops, so the block
+  // could be popped and freed as soon as it is pushed. Protect it beforehand
+  // instead. A refused block is freed by the caller, which unprotects it.
+  if (quarantine == &lock_free_quarantine_) {
+    if (enable_page_protections_)
+      BlockProtectAll(block_info);
+    return quarantine->Push(compact);
+  }
+
+  BlockQuarantineInterface::AutoQuarantineLock quarantine_lock(
+      quarantine, compact);
+  if (!quarantine->Push(compact))
+    return false;
+
+  if (enable_page_protections_) {
+    // The recently pushed block can be popped out in TrimQuarantine if the
+    // quarantine size is 0, in that case TrimQuarantine takes care of
+    // properly unprotecting and freeing the block. If the protection is set
+    // blindly after TrimQuarantine we could end up protecting a free (not
+    // quarantined, not allocated) block.
+    BlockProtectAll(block_info);
+  }
+  return true;
+}
+
 namespace {
 
 // A tiny helper function that checks if a quarantined filled block has a valid
@@ -742,8 +849,225 @@ bool BlockBodyIsValid(const BlockInfo& block_info) {
   return false;
 }
 
+// Checks if a quarantined block has been left untouched since it was freed.
+bool QuarantinedBlockIsPristine(const BlockInfo& block_info) {
+  return block_info.header->magic == kBlockHeaderMagic &&
+      BlockChecksumIsValid(block_info) && BlockBodyIsValid(block_info);
+}
+
+// Returns the size class of a block in a thread cache.
+size_t GetThreadCacheSizeClass(size_t block_size) {
+  DCHECK_LT(0u, block_size);
+  DCHECK_EQ(0u, block_size % kShadowRatio);
+  return block_size / kShadowRatio - 1;
+}
+
 }  // namespace
 
+BlockHeapManager::ThreadCache* BlockHeapManager::GetThreadCache() {
+  ThreadCache* cache = reinterpret_cast<ThreadCache*>(
+      ::TlsGetValue(thread_cache_tls_));
+  if (cache != nullptr)
+    return cache;
+
+  base::AutoLock lock(lock_);
+
+  // Reuse the cache of a thread that has exited, if there is one.
+  for (cache = thread_caches_; cache != nullptr; cache = cache->next) {
+    if (!cache->in_use)
+      break;
+  }
+
+  if (cache == nullptr) {
+    void* memory = internal_heap_->Allocate(sizeof(ThreadCache));
+    CHECK_NE(static_cast<void*>(nullptr), memory);
+    cache = new(memory) ThreadCache();
+    cache->pending_free_count = 0;
+    ::memset(cache->block_counts, 0, sizeof(cache->block_counts));
+    cache->next = thread_caches_;
+    thread_caches_ = cache;
+  }
+
+  cache->in_use = true;
+  ::TlsSetValue(thread_cache_tls_, cache);
+  return cache;
+}
+
+void* BlockHeapManager::AllocateFromThreadCache(HeapId heap_id,
+                                                size_t bytes,
+                                                BlockLayout* layout) {
+  DCHECK(initialized_);
+  DCHECK_NE(static_cast<BlockLayout*>(nullptr), layout);
+
+  // Plan the layout the same way the heaps do. Any cached block of the same
+  // size can then hold this allocation.
+  size_t min_right_redzone_size =
+      parameters_.trailer_padding_size + sizeof(BlockTrailer);
+  if (heap_id == size_class_block_heap_id_) {
+    if (!SizeClassBlockHeap::PlanLayout(bytes, 0, min_right_redzone_size,
+                                        layout)) {
+      return nullptr;
+    }
+  } else if (!BlockPlanLayout(kShadowRatio, kShadowRatio, bytes, 0,
+                              min_right_redzone_size, layout)) {
+    return nullptr;
+  }
+  if (layout->block_size > kThreadCacheMaxBlockSize)
+    return nullptr;
+
+  ThreadCache* cache = GetThreadCache();
+  size_t size_class = GetThreadCacheSizeClass(layout->block_size);
+  CompactBlockInfo compact = {};
+  {
+    base::AutoLock lock(cache->lock);
+    CachedBlock* blocks = cache->blocks[size_class];
+    size_t& count = cache->block_counts[size_class];
+    for (size_t i = count; i > 0; --i) {
+      if (blocks[i - 1].heap_id != heap_id)
+        continue;
+      compact = blocks[i - 1].block;
+      blocks[i - 1] = blocks[--count];
+      break;
+    }
+  }
+  if (compact.header == nullptr)
+    return nullptr;
+
+  BlockInfo block_info = {};
+  ConvertBlockInfo(compact, &block_info);
+  if (enable_page_protections_)
+    BlockProtectNone(block_info);
+
+  // The block was still in the quarantined state while it was cached, so a
+  // use after free may have corrupted it. If so, let the usual machinery
+  // report and free it, and fall back to the heap.
+  if (!QuarantinedBlockIsPristine(block_info)) {
+    CHECK(FreePotentiallyCorruptBlock(&block_info));
+    return nullptr;
+  }
+
+  // Release the stack traces of the previous allocation.
+  if (block_info.header->alloc_stack != nullptr)
+    stack_cache_->ReleaseStackTrace(block_info.header->alloc_stack);
+  if (block_info.header->free_stack != nullptr)
+    stack_cache_->ReleaseStackTrace(block_info.header->free_stack);
+
+  return block_info.header;
+}
+
+void BlockHeapManager::DeferQuarantine(HeapId heap_id,
+                                       const CompactBlockInfo& compact) {
+  DCHECK(initialized_);
+
+  ThreadCache* cache = GetThreadCache();
+  CachedBlock batch[kThreadCacheFreeBatchSize];
+  {
+    base::AutoLock lock(cache->lock);
+    DCHECK_LT(cache->pending_free_count, kThreadCacheFreeBatchSize);
+    CachedBlock& pending = cache->pending_frees[cache->pending_free_count++];
+    pending.block = compact;
+    pending.heap_id = heap_id;
+    if (cache->pending_free_count < kThreadCacheFreeBatchSize)
+      return;
+    ::memcpy(batch, cache->pending_frees, sizeof(batch));
+    cache->pending_free_count = 0;
+  }
+
+  // Hand off the whole batch and trim the quarantine once.
+  for (size_t i = 0; i < kThreadCacheFreeBatchSize; ++i) {
+    BlockInfo block_info = {};
+    ConvertBlockInfo(batch[i].block, &block_info);
+    if (!PushIntoQuarantine(shared_quarantine_, block_info, batch[i].block))
+      FreePristineBlock(&block_info);
+  }
+  TrimQuarantine(shared_quarantine_);
+}
+
+void BlockHeapManager::CacheExpiredBlocks(
+    BlockQuarantineInterface::ObjectVector* blocks) {
+  DCHECK_NE(static_cast<BlockQuarantineInterface::ObjectVector*>(nullptr),
+            blocks);
+  if (blocks->empty())
+    return;
+
+  ThreadCache* cache = GetThreadCache();
+  base::AutoLock lock(cache->lock);
+  size_t blocks_to_free = 0;
+  for (size_t i = 0; i < blocks->size(); ++i) {
+    const CompactBlockInfo& compact = (*blocks)[i];
+    if (compact.block_size <= kThreadCacheMaxBlockSize && !compact.is_nested) {
+      size_t size_class = GetThreadCacheSizeClass(compact.block_size);
+      size_t& count = cache->block_counts[size_class];
+      if (count < kThreadCacheBlocksPerSizeClass) {
+        const BlockTrailer* trailer = reinterpret_cast<const BlockTrailer*>(
+            reinterpret_cast<const uint8*>(compact.header) +
+                compact.block_size) - 1;
+        CachedBlock& cached = cache->blocks[size_class][count++];
+        cached.block = compact;
+        cached.heap_id = trailer->heap_id;
+        continue;
+      }
+    }
+    (*blocks)[blocks_to_free++] = compact;
+  }
+  blocks->resize(blocks_to_free);
+}
+
+void BlockHeapManager::FlushThreadCache(ThreadCache* cache, HeapId heap_id) {
+  DCHECK_NE(static_cast<ThreadCache*>(nullptr), cache);
+
+  BlockQuarantineInterface::ObjectVector blocks_to_quarantine;
+  BlockQuarantineInterface::ObjectVector blocks_to_free;
+  {
+    base::AutoLock lock(cache->lock);
+
+    size_t pending_count = 0;
+    for (size_t i = 0; i < cache->pending_free_count; ++i) {
+      const CachedBlock& pending = cache->pending_frees[i];
+      if (heap_id == 0 || pending.heap_id == heap_id)
+        blocks_to_quarantine.push_back(pending.block);
+      else
+        cache->pending_frees[pending_count++] = pending;
+    }
+    cache->pending_free_count = pending_count;
+
+    for (size_t size_class = 0; size_class < kThreadCacheSizeClassCount;
+         ++size_class) {
+      CachedBlock* blocks = cache->blocks[size_class];
+      size_t& count = cache->block_counts[size_class];
+      size_t cached_count = 0;
+      for (size_t i = 0; i < count; ++i) {
+        if (heap_id == 0 || blocks[i].heap_id == heap_id)
+          blocks_to_free.push_back(blocks[i].block);
+        else
+          blocks[cached_count++] = blocks[i];
+      }
+      count = cached_count;
+    }
+  }
+
+  for (const auto& compact : blocks_to_quarantine) {
+    BlockInfo block_info = {};
+    ConvertBlockInfo(compact, &block_info);
+    if (!PushIntoQuarantine(shared_quarantine_, block_info, compact))
+      FreePristineBlock(&block_info);
+  }
+  FreeBlockVector(blocks_to_free);
+}
+
+void BlockHeapManager::FlushThreadCaches(HeapId heap_id) {
+  ThreadCache* caches = nullptr;
+  {
+    base::AutoLock lock(lock_);
+    caches = thread_caches_;
+  }
+
+  // The list can be walked without the lock as caches are only ever prepended
+  // to it.
+  for (ThreadCache* cache = caches; cache != nullptr; cache = cache->next)
+    FlushThreadCache(cache, heap_id);
+}
+
 bool BlockHeapManager::FreePotentiallyCorruptBlock(BlockInfo* block_info) {
   DCHECK(initialized_);
   DCHECK_NE(static_cast<BlockInfo*>(nullptr), block_info);
@@ -751,9 +1075,7 @@ bool BlockHeapManager::FreePotentiallyCorruptBlock(BlockInfo* block_info) {
   if (enable_page_protections_)
     BlockProtectNone(*block_info);
 
-  if (block_info->header->magic != kBlockHeaderMagic ||
-      !BlockChecksumIsValid(*block_info) ||
-      !BlockBodyIsValid(*block_info)) {
+  if (!QuarantinedBlockIsPristine(*block_info)) {
     if (ShouldReportCorruptBlock(block_info))
       ReportHeapError(block_info->header, CORRUPT_BLOCK);
     return FreeCorruptBlock(block_info);
@@ -895,7 +1217,7 @@ void BlockHeapManager::InitProcessHeap() {
   process_heap_ = new heaps::SimpleBlockHeap(process_heap_underlying_heap_);
   underlying_heaps_map_.insert(std::make_pair(process_heap_,
                                               process_heap_underlying_heap_));
-  HeapMetadata heap_metadata = { &shared_quarantine_, false };
+  HeapMetadata heap_metadata = { shared_quarantine_, false };
   auto result = heaps_.insert(std::make_pair(process_heap_, heap_metadata));
   process_heap_id_ = GetHeapId(result);
 }
@@ -931,16 +1253,32 @@ bool BlockHeapManager::MayUseZebraBlockHeap(size_t bytes) const {
   return true;
 }
 
+bool BlockHeapManager::MayUseSizeClassBlockHeap(size_t bytes) const {
+  DCHECK(initialized_);
+  if (!parameters_.enable_size_class_heap)
+    return false;
+  return bytes <= SizeClassBlockHeap::kMaximumAllocationSize;
+}
+
 bool BlockHeapManager::ShouldReportCorruptBlock(const BlockInfo* block_info) {
   DCHECK_NE(static_cast<const BlockInfo*>(nullptr), block_info);
 
   if (!parameters_.prevent_duplicate_corruption_crashes)
     return true;
 
+  // The frames of the allocation stack may live in the stack cache's frame
+  // trie, so expand them before computing the relative stack ID.
   const common::StackCapture* alloc_stack = block_info->header->alloc_stack;
+  void* frames[common::StackCapture::kMaxNumFrames] = {};
+  size_t num_frames = stack_cache_->GetFrames(alloc_stack, frames,
+                                              arraysize(frames));
+  common::StackCapture expanded_alloc_stack;
+  expanded_alloc_stack.InitFromBuffer(alloc_stack->stack_id(), frames,
+                                      num_frames);
   // TODO(sebmarchand|chrisha): Use a cache to improve the RelativeStackID
   // computations.
-  StackId relative_alloc_stack_id = alloc_stack->ComputeRelativeStackId();
+  StackId relative_alloc_stack_id =
+      expanded_alloc_stack.ComputeRelativeStackId();
 
   // Look at the registry cache to see if an error has already been reported
   // for this allocation stack trace, if so prevent from reporting another one.
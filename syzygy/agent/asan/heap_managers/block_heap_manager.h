@@ -32,6 +32,7 @@
 #include "syzygy/agent/asan/registry_cache.h"
 #include "syzygy/agent/asan/stack_capture_cache.h"
 #include "syzygy/agent/asan/memory_notifiers/shadow_memory_notifier.h"
+#include "syzygy/agent/asan/quarantines/lock_free_quarantine.h"
 #include "syzygy/agent/asan/quarantines/sharded_quarantine.h"
 #include "syzygy/agent/common/stack_capture.h"
 #include "syzygy/common/asan_parameters.h"
@@ -64,6 +65,17 @@ namespace heap_managers {
 // The zebra heap is created once, when enabled for the first time, with a
 // specified size. It can't be resized after creation. Disabling the zebra
 // heap only disables allocations on it, deallocations will continue to work.
+//
+// The size-class heap is shared by all the heaps of the manager. When enabled
+// it serves the small allocations that aren't taken by the zebra or the large
+// block heap, whatever heap they were requested from.
+//
+// When thread caches are enabled each thread gets a front-end to the shared
+// quarantine. Freed blocks are handed off to the quarantine in batches, and
+// the quarantine is only trimmed once per batch. The small blocks that expire
+// from the quarantine during the trimming are kept by the trimming thread,
+// still in the quarantined state, and are recycled by its next allocations of
+// the same size without going through the heap.
 class BlockHeapManager : public HeapManagerInterface {
  public:
   // Constructor.
@@ -126,6 +138,10 @@ class BlockHeapManager : public HeapManagerInterface {
   //     share the same flag.
   void set_allocation_filter_flag(bool value);
 
+  // Flushes the thread cache of the calling thread, if it has one, and makes
+  // it available to other threads. This must be called when a thread exits.
+  void ReleaseThreadCache();
+
  protected:
   // This allows the runtime access to our internals, necessary for crash
   // processing.
@@ -137,12 +153,25 @@ class BlockHeapManager : public HeapManagerInterface {
   HeapType GetHeapTypeUnlocked(HeapId heap_id);
   // @}
 
-  // The type of quarantine that we use internally.
+  // The types of quarantine that we use internally. They share a common
+  // size-limited base, through which the shared quarantine is used.
+  using SizeLimitedBlockQuarantine =
+      quarantines::SizeLimitedQuarantineImpl<CompactBlockInfo,
+                                             GetTotalBlockSizeFunctor>;
   using ShardedBlockQuarantine =
       quarantines::ShardedQuarantine<CompactBlockInfo,
                                      GetTotalBlockSizeFunctor,
                                      GetBlockHashFunctor,
                                      kQuarantineDefaultShardingFactor>;
+  using LockFreeBlockQuarantine =
+      quarantines::LockFreeQuarantine<CompactBlockInfo,
+                                      GetTotalBlockSizeFunctor,
+                                      GetBlockHashFunctor,
+                                      kQuarantineDefaultShardingFactor>;
+
+  // The number of blocks that are popped from a quarantine at once when
+  // trimming it.
+  static const size_t kQuarantineTrimBatchSize = 32;
 
   // A map associating a block heap with its underlying heap.
   using UnderlyingHeapMap =
@@ -161,6 +190,50 @@ class BlockHeapManager : public HeapManagerInterface {
 
   using StackId = agent::common::StackCapture::StackId;
 
+  // @name Thread cache configuration.
+  // @{
+  // The number of freed blocks that are handed off to the quarantine at once.
+  static const size_t kThreadCacheFreeBatchSize = 16;
+  // The size of the largest block that is kept by a thread cache. This is
+  // smaller than a page so that cached blocks are never page protected.
+  static const size_t kThreadCacheMaxBlockSize = 256;
+  // The number of block sizes that are kept by a thread cache. Block sizes
+  // are multiples of kShadowRatio.
+  static const size_t kThreadCacheSizeClassCount =
+      kThreadCacheMaxBlockSize / kShadowRatio;
+  // The number of blocks of each size that are kept by a thread cache.
+  static const size_t kThreadCacheBlocksPerSizeClass = 8;
+  // @}
+
+  // A block held by a thread cache.
+  struct CachedBlock {
+    CompactBlockInfo block;
+    HeapId heap_id;
+  };
+
+  // The per-thread front-end to the shared quarantine. These are allocated
+  // from the internal heap and are never freed before the heap manager is
+  // torn down. The cache of a thread that has exited is reused by the next
+  // thread that needs one.
+  struct ThreadCache {
+    // Protects the contents of the cache. This is only contended when
+    // another thread flushes the cache.
+    base::Lock lock;
+    // The freed blocks that have yet to be handed off to the quarantine.
+    CachedBlock pending_frees[kThreadCacheFreeBatchSize];  // Under lock.
+    size_t pending_free_count;  // Under lock.
+    // The blocks that expired from the quarantine, by size class. Size class
+    // i holds blocks of (i + 1) * kShadowRatio bytes.
+    CachedBlock blocks[kThreadCacheSizeClassCount]
+                      [kThreadCacheBlocksPerSizeClass];  // Under lock.
+    size_t block_counts[kThreadCacheSizeClassCount];  // Under lock.
+    // Indicates if this cache is owned by a live thread.
+    bool in_use;  // Under BlockHeapManager::lock_.
+    // The next cache in BlockHeapManager::thread_caches_. This doesn't
+    // change once the cache has been linked in.
+    ThreadCache* next;
+  };
+
   // Causes the heap manager to tear itself down. If the heap manager
   // encounters corrupt blocks while tearing itself dow it will report an
   // error. This will in turn cause the asan runtime to call back into itself
@@ -250,6 +323,57 @@ class BlockHeapManager : public HeapManagerInterface {
   // @param vec The vector of blocks to be freed.
   void FreeBlockVector(BlockQuarantineInterface::ObjectVector& vec);
 
+  // Pushes a freed block into a quarantine and protects it.
+  // @param quarantine The quarantine to use.
+  // @param block_info The information about this block.
+  // @param compact The compact information about this block.
+  // @returns true if the block has been quarantined, false if the quarantine
+  //     refused it. In the latter case the block should be freed.
+  bool PushIntoQuarantine(BlockQuarantineInterface* quarantine,
+                          const BlockInfo& block_info,
+                          const CompactBlockInfo& compact);
+
+  // @name Thread cache functions.
+  // @{
+  // Returns the thread cache of the calling thread, creating it if necessary.
+  ThreadCache* GetThreadCache();
+
+  // Tries to recycle a cached block for an allocation.
+  // @param heap_id The heap that should serve the allocation.
+  // @param bytes The size of the allocation.
+  // @param layout Will receive the layout of the recycled block.
+  // @returns a pointer to the recycled block, or nullptr if there is none.
+  void* AllocateFromThreadCache(HeapId heap_id,
+                                size_t bytes,
+                                BlockLayout* layout);
+
+  // Defers the hand-off of a freed block to the shared quarantine. The
+  // pending blocks are handed off and the quarantine is trimmed once a full
+  // batch has been accumulated.
+  // @param heap_id The heap owning the block.
+  // @param compact The block, which must already be in the quarantined state.
+  void DeferQuarantine(HeapId heap_id, const CompactBlockInfo& compact);
+
+  // Moves some of the blocks that expired from the shared quarantine to the
+  // thread cache of the calling thread.
+  // @param blocks The expired blocks. The blocks that have been cached are
+  //     removed from this vector.
+  void CacheExpiredBlocks(BlockQuarantineInterface::ObjectVector* blocks);
+
+  // Empties a thread cache. Its pending blocks are pushed into the shared
+  // quarantine and its cached blocks are freed.
+  // @param cache The cache to flush.
+  // @param heap_id If non-zero, only the blocks belonging to this heap are
+  //     removed from the cache.
+  void FlushThreadCache(ThreadCache* cache, HeapId heap_id);
+
+  // Empties all the thread caches.
+  // @param heap_id If non-zero, only the blocks belonging to this heap are
+  //     removed from the caches.
+  // @note This must not be called under lock_.
+  void FlushThreadCaches(HeapId heap_id);
+  // @}
+
   // Free a block that might be corrupt. If the block is corrupt first reports
   // an error before safely releasing the block.
   // @param block_info The information about this block.
@@ -315,6 +439,13 @@ class BlockHeapManager : public HeapManagerInterface {
   //     otherwise.
   bool MayUseZebraBlockHeap(size_t bytes) const;
 
+  // Determines if the size-class heap should be used for an allocation of
+  // the given size.
+  // @param bytes The allocation size.
+  // @returns true if the size-class heap should be used for this allocation,
+  //     false otherwise.
+  bool MayUseSizeClassBlockHeap(size_t bytes) const;
+
   // Indicates if a corrupt block error should be reported.
   // @param block_info The corrupt block.
   // @returns true if an error should be reported, false otherwise.
@@ -338,9 +469,14 @@ class BlockHeapManager : public HeapManagerInterface {
   // Contains the heaps owned by this manager.
   HeapQuarantineMap heaps_;  // Under lock_.
 
+  // The implementations of the shared quarantine. Only one of them is used,
+  // as selected by parameters_.enable_lock_free_quarantine at initialization.
+  ShardedBlockQuarantine sharded_quarantine_;
+  LockFreeBlockQuarantine lock_free_quarantine_;
+
   // The quarantine shared by the heaps created by this manager. This is also
-  // used by the LargeBlockHeap.
-  ShardedBlockQuarantine shared_quarantine_;
+  // used by the LargeBlockHeap. This points to one of the above.
+  SizeLimitedBlockQuarantine* shared_quarantine_;
 
   // Map the block heaps to their underlying heap.
   UnderlyingHeapMap underlying_heaps_map_;  // Under lock_.
@@ -376,9 +512,19 @@ class BlockHeapManager : public HeapManagerInterface {
   // The ID of the large block heap. Allows accessing it directly.
   HeapId large_block_heap_id_;
 
+  // The ID of the size-class heap. Allows accessing it directly.
+  HeapId size_class_block_heap_id_;
+
   // Stores the AllocationFilterFlag TLS slot.
   DWORD allocation_filter_flag_tls_;
 
+  // Stores the TLS slot holding the ThreadCache of each thread.
+  DWORD thread_cache_tls_;
+
+  // The list of all the thread caches, linked through ThreadCache::next.
+  // New caches are only ever prepended to this list.
+  ThreadCache* thread_caches_;  // Under lock_.
+
   // A list of all heaps whose locks were acquired by the last call to
   // BestEffortLockAll. This uses the internal heap, otherwise the default
   // allocator makes use of the process heap. The process heap may itself
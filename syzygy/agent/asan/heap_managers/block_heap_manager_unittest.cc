@@ -14,6 +14,7 @@
 
 #include "syzygy/agent/asan/heap_managers/block_heap_manager.h"
 
+#include <set>
 #include <vector>
 
 #include "base/bind.h"
@@ -21,6 +22,8 @@
 #include "base/rand_util.h"
 #include "base/sha1.h"
 #include "base/debug/alias.h"
+#include "base/memory/scoped_vector.h"
+#include "base/strings/stringprintf.h"
 #include "base/synchronization/condition_variable.h"
 #include "base/synchronization/lock.h"
 #include "base/test/test_reg_util_win.h"
@@ -38,12 +41,14 @@
 #include "syzygy/agent/asan/heaps/internal_heap.h"
 #include "syzygy/agent/asan/heaps/large_block_heap.h"
 #include "syzygy/agent/asan/heaps/simple_block_heap.h"
+#include "syzygy/agent/asan/heaps/size_class_block_heap.h"
 #include "syzygy/agent/asan/heaps/win_heap.h"
 #include "syzygy/agent/asan/heaps/zebra_block_heap.h"
 #include "syzygy/agent/asan/memory_notifiers/null_memory_notifier.h"
 #include "syzygy/assm/assembler.h"
 #include "syzygy/assm/buffer_serializer.h"
 #include "syzygy/common/asan_parameters.h"
+#include "syzygy/testing/metrics.h"
 
 namespace agent {
 namespace asan {
@@ -223,11 +228,16 @@ class TestBlockHeapManager : public BlockHeapManager {
   using BlockHeapManager::ShardedBlockQuarantine;
   using BlockHeapManager::TrimQuarantine;
 
+  using BlockHeapManager::kThreadCacheBlocksPerSizeClass;
+  using BlockHeapManager::kThreadCacheFreeBatchSize;
+  using BlockHeapManager::kThreadCacheMaxBlockSize;
+
   using BlockHeapManager::allocation_filter_flag_tls_;
   using BlockHeapManager::heaps_;
   using BlockHeapManager::large_block_heap_id_;
   using BlockHeapManager::locked_heaps_;
   using BlockHeapManager::parameters_;
+  using BlockHeapManager::size_class_block_heap_id_;
   using BlockHeapManager::zebra_block_heap_;
   using BlockHeapManager::zebra_block_heap_id_;
 
@@ -275,12 +285,14 @@ class TestBlockHeapManager : public BlockHeapManager {
 
     // Reinitialize the internal and special heaps if necessary.
     if (ctmalloc_changed) {
-      // Since the zebra and large block heaps use the internal heap they
-      // must also be reset.
+      // Since the zebra, large block and size-class heaps use the internal
+      // heap they must also be reset.
       RemoveHeapById(large_block_heap_id_);
       RemoveHeapById(zebra_block_heap_id_);
+      RemoveHeapById(size_class_block_heap_id_);
       large_block_heap_id_ = 0;
       zebra_block_heap_id_ = 0;
+      size_class_block_heap_id_ = 0;
 
       internal_heap_.reset();
       internal_win_heap_.reset();
@@ -1556,6 +1568,37 @@ TEST_P(BlockHeapManagerTest, LargeBlockHeapUsedForLargeAllocations) {
   EXPECT_TRUE(heap.Free(alloc));
 }
 
+// Ensures that the SizeClassBlockHeap serves the small allocations, and only
+// those.
+TEST_P(BlockHeapManagerTest, SizeClassBlockHeapUsedForSmallAllocations) {
+  ::common::AsanParameters params = heap_manager_->parameters();
+  params.enable_size_class_heap = true;
+  heap_manager_->set_parameters(params);
+  ASSERT_NE(0u, heap_manager_->size_class_block_heap_id_);
+
+  ScopedHeap heap(heap_manager_);
+
+  const size_t kSizes[] = {
+      1, 0x100, heaps::SizeClassBlockHeap::kMaximumAllocationSize + 1 };
+  for (size_t i = 0; i < arraysize(kSizes); ++i) {
+    void* alloc = heap.Allocate(kSizes[i]);
+    EXPECT_NE(static_cast<void*>(nullptr), alloc);
+    ASSERT_NO_FATAL_FAILURE(VerifyAllocAccess(alloc, kSizes[i]));
+
+    BlockInfo block_info = {};
+    EXPECT_TRUE(runtime_->shadow()->BlockInfoFromShadow(alloc, &block_info));
+    {
+      ScopedBlockAccess block_access(block_info);
+      bool is_small =
+          kSizes[i] <= heaps::SizeClassBlockHeap::kMaximumAllocationSize;
+      EXPECT_EQ(is_small, heap_manager_->size_class_block_heap_id_ ==
+                              block_info.trailer->heap_id);
+    }
+
+    EXPECT_TRUE(heap.Free(alloc));
+  }
+}
+
 // Ensures that the LargeBlockHeap is not used for a small allocation.
 TEST_P(BlockHeapManagerTest, LargeBlockHeapNotUsedForSmallAllocations) {
   EnableLargeBlockHeap(GetPageSize());
@@ -1714,6 +1757,156 @@ TEST_P(BlockHeapManagerTest, GetHeapTypeUnlocked) {
   }
 }
 
+TEST_P(BlockHeapManagerTest, ThreadCacheBatchesFrees) {
+  const size_t kAllocSize = 13;
+  const size_t kBatchSize = TestBlockHeapManager::kThreadCacheFreeBatchSize;
+  ::common::AsanParameters parameters = heap_manager_->parameters();
+  parameters.quarantine_size = GetAllocSize(kAllocSize) * kBatchSize;
+  parameters.enable_thread_caches = true;
+  heap_manager_->set_parameters(parameters);
+
+  ScopedHeap heap(heap_manager_);
+  std::vector<void*> blocks;
+  for (size_t i = 0; i < kBatchSize; ++i) {
+    void* mem = heap.Allocate(kAllocSize);
+    ASSERT_NE(static_cast<void*>(nullptr), mem);
+    blocks.push_back(mem);
+  }
+
+  // The freed blocks are poisoned right away, but they only make it into the
+  // quarantine once a full batch has been freed.
+  for (size_t i = 0; i + 1 < kBatchSize; ++i) {
+    ASSERT_TRUE(heap.Free(blocks[i]));
+    ASSERT_NO_FATAL_FAILURE(VerifyFreedAccess(blocks[i], kAllocSize));
+    EXPECT_FALSE(heap.InQuarantine(blocks[i]));
+  }
+
+  // Double frees of pending blocks are still detected.
+  EXPECT_FALSE(heap.Free(blocks[0]));
+  EXPECT_EQ(1u, errors_.size());
+  EXPECT_EQ(DOUBLE_FREE, errors_[0].error_type);
+  EXPECT_EQ(blocks[0], errors_[0].location);
+
+  ASSERT_TRUE(heap.Free(blocks.back()));
+  for (size_t i = 0; i < kBatchSize; ++i)
+    EXPECT_TRUE(heap.InQuarantine(blocks[i]));
+}
+
+TEST_P(BlockHeapManagerTest, ThreadCacheIsReleased) {
+  const size_t kAllocSize = 13;
+  ::common::AsanParameters parameters = heap_manager_->parameters();
+  parameters.quarantine_size = GetAllocSize(kAllocSize);
+  parameters.enable_thread_caches = true;
+  heap_manager_->set_parameters(parameters);
+
+  ScopedHeap heap(heap_manager_);
+  void* mem = heap.Allocate(kAllocSize);
+  ASSERT_NE(static_cast<void*>(nullptr), mem);
+  ASSERT_TRUE(heap.Free(mem));
+  EXPECT_FALSE(heap.InQuarantine(mem));
+
+  // Releasing the thread cache hands off the pending blocks.
+  heap_manager_->ReleaseThreadCache();
+  EXPECT_TRUE(heap.InQuarantine(mem));
+
+  // Releasing a thread cache more than once is harmless.
+  heap_manager_->ReleaseThreadCache();
+}
+
+TEST_P(BlockHeapManagerTest, ThreadCacheRecyclesExpiredBlocks) {
+  const size_t kAllocSize = 13;
+  const size_t kBatchSize = TestBlockHeapManager::kThreadCacheFreeBatchSize;
+  const size_t kCachedBlocks =
+      TestBlockHeapManager::kThreadCacheBlocksPerSizeClass;
+  ASSERT_LE(GetAllocSize(kAllocSize),
+            TestBlockHeapManager::kThreadCacheMaxBlockSize);
+
+  // The quarantine can only hold a single block, so a full batch of frees
+  // causes most of them to expire.
+  ::common::AsanParameters parameters = heap_manager_->parameters();
+  parameters.quarantine_size = GetAllocSize(kAllocSize);
+  parameters.enable_thread_caches = true;
+  heap_manager_->set_parameters(parameters);
+
+  ScopedHeap heap(heap_manager_);
+  std::set<void*> freed_blocks;
+  for (size_t i = 0; i < kBatchSize; ++i) {
+    void* mem = heap.Allocate(kAllocSize);
+    ASSERT_NE(static_cast<void*>(nullptr), mem);
+    freed_blocks.insert(mem);
+  }
+  for (void* mem : freed_blocks)
+    ASSERT_TRUE(heap.Free(mem));
+
+  // The next allocations of the same size are served by the expired blocks
+  // held in the thread cache, which are properly reinitialized.
+  std::set<void*> recycled_blocks;
+  for (size_t i = 0; i < kCachedBlocks; ++i) {
+    void* mem = heap.Allocate(kAllocSize);
+    ASSERT_NE(static_cast<void*>(nullptr), mem);
+    EXPECT_EQ(1u, freed_blocks.count(mem));
+    EXPECT_TRUE(recycled_blocks.insert(mem).second);
+    EXPECT_FALSE(heap.InQuarantine(mem));
+    ASSERT_NO_FATAL_FAILURE(VerifyAllocAccess(mem, kAllocSize));
+
+    BlockInfo block_info = {};
+    EXPECT_TRUE(GetBlockInfo(reinterpret_cast<BlockBody*>(mem), &block_info));
+    EXPECT_EQ(ALLOCATED_BLOCK, static_cast<BlockState>(
+        block_info.header->state));
+    EXPECT_EQ(heap.Id(), block_info.trailer->heap_id);
+    EXPECT_EQ(static_cast<const common::StackCapture*>(nullptr),
+              block_info.header->free_stack);
+    EXPECT_TRUE(BlockChecksumIsValid(block_info));
+  }
+
+  for (void* mem : recycled_blocks)
+    ASSERT_TRUE(heap.Free(mem));
+  EXPECT_TRUE(errors_.empty());
+}
+
+TEST_P(BlockHeapManagerTest, ThreadCacheDetectsUseAfterFree) {
+  const size_t kAllocSize = 13;
+  const size_t kLargeAllocSize = 1000;
+  const size_t kBatchSize = TestBlockHeapManager::kThreadCacheFreeBatchSize;
+  ASSERT_LT(TestBlockHeapManager::kThreadCacheMaxBlockSize,
+            GetAllocSize(kLargeAllocSize));
+  // Flood-fill the freed blocks so that the corruption is always detected.
+  ::common::AsanParameters parameters = heap_manager_->parameters();
+  parameters.quarantine_size = GetAllocSize(kAllocSize);
+  parameters.quarantine_flood_fill_rate = 1.0;
+  parameters.enable_thread_caches = true;
+  heap_manager_->set_parameters(parameters);
+
+  ScopedHeap heap(heap_manager_);
+  std::vector<void*> blocks;
+  for (size_t i = 0; i + 1 < kBatchSize; ++i) {
+    void* mem = heap.Allocate(kAllocSize);
+    ASSERT_NE(static_cast<void*>(nullptr), mem);
+    blocks.push_back(mem);
+  }
+  void* large_mem = heap.Allocate(kLargeAllocSize);
+  ASSERT_NE(static_cast<void*>(nullptr), large_mem);
+
+  // Write to the small blocks while their hand-off to the quarantine is
+  // pending. Freeing the large block completes the batch, after which all of
+  // the small blocks expire.
+  for (size_t i = 0; i < blocks.size(); ++i) {
+    ASSERT_TRUE(heap.Free(blocks[i]));
+    reinterpret_cast<uint8*>(blocks[i])[0] ^= 0xFF;
+  }
+  ASSERT_TRUE(heap.Free(large_mem));
+
+  // The expired blocks that were too many to be cached were freed, and the
+  // corruption was reported. The cached ones are checked when they are about
+  // to be recycled.
+  size_t error_count = errors_.size();
+  void* mem = heap.Allocate(kAllocSize);
+  ASSERT_NE(static_cast<void*>(nullptr), mem);
+  EXPECT_EQ(error_count + 1, errors_.size());
+  EXPECT_EQ(CORRUPT_BLOCK, errors_.back().error_type);
+  ASSERT_TRUE(heap.Free(mem));
+}
+
 namespace {
 
 bool ShadowIsConsistentPostAlloc(
@@ -1756,6 +1949,82 @@ bool ShadowIsConsistentPostFree(
   return true;
 }
 
+// Repeatedly allocates and frees small blocks, keeping a few of them alive at
+// any time.
+class AllocFreeRunner : public base::DelegateSimpleThread::Delegate {
+ public:
+  static const size_t kLiveAllocs = 32;
+  static const size_t kMaxAllocSize = 128;
+
+  AllocFreeRunner(BlockHeapManager* heap_manager,
+                  BlockHeapManager::HeapId heap_id,
+                  size_t iterations)
+      : heap_manager_(heap_manager), heap_id_(heap_id),
+        iterations_(iterations), errors_(0) {
+  }
+
+  void Run() override {
+    void* allocs[kLiveAllocs] = {};
+    for (size_t i = 0; i < iterations_; ++i) {
+      size_t slot = (i * 7) % kLiveAllocs;
+      if (allocs[slot] != nullptr && !heap_manager_->Free(heap_id_,
+                                                          allocs[slot])) {
+        ++errors_;
+      }
+      allocs[slot] = heap_manager_->Allocate(heap_id_,
+                                             1 + (i * 31) % kMaxAllocSize);
+      if (allocs[slot] == nullptr)
+        ++errors_;
+    }
+
+    for (size_t i = 0; i < kLiveAllocs; ++i) {
+      if (allocs[i] != nullptr && !heap_manager_->Free(heap_id_, allocs[i]))
+        ++errors_;
+    }
+
+    // This is normally done when the thread detaches from the runtime.
+    heap_manager_->ReleaseThreadCache();
+  }
+
+  size_t errors() const { return errors_; }
+
+ private:
+  BlockHeapManager* heap_manager_;
+  BlockHeapManager::HeapId heap_id_;
+  size_t iterations_;
+  size_t errors_;
+};
+
+// Runs AllocFreeRunners on @p num_threads threads concurrently.
+// @returns the number of cycles it took for all of them to finish.
+uint64 RunAllocFreeThreads(BlockHeapManager* heap_manager,
+                           BlockHeapManager::HeapId heap_id,
+                           size_t num_threads,
+                           size_t iterations,
+                           size_t* errors) {
+  ScopedVector<AllocFreeRunner> runners;
+  ScopedVector<base::DelegateSimpleThread> threads;
+  for (size_t i = 0; i < num_threads; ++i) {
+    runners.push_back(new AllocFreeRunner(heap_manager, heap_id, iterations));
+    threads.push_back(new base::DelegateSimpleThread(
+        runners.back(),
+        base::StringPrintf("AllocFreeRunner%d", static_cast<int>(i))));
+  }
+
+  uint64 t0 = ::__rdtsc();
+  for (size_t i = 0; i < num_threads; ++i)
+    threads[i]->Start();
+  for (size_t i = 0; i < num_threads; ++i)
+    threads[i]->Join();
+  uint64 t1 = ::__rdtsc();
+
+  *errors = 0;
+  for (size_t i = 0; i < num_threads; ++i)
+    *errors += runners[i]->errors();
+
+  return t1 - t0;
+}
+
 class BlockHeapManagerIntegrationTest : public testing::Test {
  public:
   BlockHeapManagerIntegrationTest()
@@ -1886,6 +2155,142 @@ TEST_F(BlockHeapManagerIntegrationTest, CtMallocStressTest) {
   scc.reset();
 }
 
+// A stress test of the size-class heap, with and without thread caches.
+TEST_F(BlockHeapManagerIntegrationTest, SizeClassHeapStressTest) {
+  static const size_t kThreadCount = 4;
+  static const size_t kIterations = 50000;
+
+  for (size_t i = 0; i < 2; ++i) {
+    ::common::AsanParameters p;
+    ::common::SetDefaultAsanParameters(&p);
+    p.check_heap_on_failure = false;
+    p.enable_zebra_block_heap = false;
+    p.enable_large_block_heap = false;
+    p.enable_allocation_filter = false;
+    p.quarantine_size = 64 * 1024;
+    p.enable_size_class_heap = true;
+    p.enable_thread_caches = i == 1;
+
+    AsanLogger al;
+    memory_notifiers::ShadowMemoryNotifier shadow_memory_notifier(&shadow_);
+    scoped_ptr<StackCaptureCache> scc(
+        new StackCaptureCache(&al, &shadow_memory_notifier));
+    scoped_ptr<TestBlockHeapManager> bhm(
+        new TestBlockHeapManager(&shadow_, scc.get(),
+                                 &shadow_memory_notifier));
+    bhm->set_parameters(p);
+    bhm->Init();
+    BlockHeapManager::HeapId hid = bhm->CreateHeap();
+
+    size_t errors = 0;
+    RunAllocFreeThreads(bhm.get(), hid, kThreadCount, kIterations, &errors);
+    EXPECT_EQ(0u, errors);
+
+    EXPECT_TRUE(bhm->DestroyHeap(hid));
+    bhm.reset();
+    scc.reset();
+  }
+}
+
+// Measures the throughput of concurrent allocations and frees, with and
+// without thread caches.
+TEST_F(BlockHeapManagerIntegrationTest, ThreadCacheThroughputPerfTest) {
+  static const size_t kThreadCounts[] = { 1, 2, 4, 8 };
+  static const size_t kIterations = 100000;
+
+  for (size_t i = 0; i < 2; ++i) {
+    bool enable_thread_caches = i == 1;
+    for (size_t j = 0; j < arraysize(kThreadCounts); ++j) {
+      ::common::AsanParameters p;
+      ::common::SetDefaultAsanParameters(&p);
+      p.check_heap_on_failure = false;
+      p.enable_zebra_block_heap = false;
+      p.enable_large_block_heap = false;
+      p.enable_allocation_filter = false;
+      p.quarantine_size = 64 * 1024;
+      p.quarantine_flood_fill_rate = 0.0;
+      p.enable_thread_caches = enable_thread_caches;
+
+      AsanLogger al;
+      memory_notifiers::ShadowMemoryNotifier shadow_memory_notifier(&shadow_);
+      scoped_ptr<StackCaptureCache> scc(
+          new StackCaptureCache(&al, &shadow_memory_notifier));
+      scoped_ptr<TestBlockHeapManager> bhm(
+          new TestBlockHeapManager(&shadow_, scc.get(),
+                                   &shadow_memory_notifier));
+      bhm->set_parameters(p);
+      bhm->Init();
+      BlockHeapManager::HeapId hid = bhm->CreateHeap();
+
+      size_t errors = 0;
+      uint64 tnet = RunAllocFreeThreads(bhm.get(), hid, kThreadCounts[j],
+                                        kIterations, &errors);
+      EXPECT_EQ(0u, errors);
+
+      testing::EmitMetric(
+          base::StringPrintf("Syzygy.Asan.BlockHeapManager.AllocFree.%s.%d",
+                             enable_thread_caches ? "ThreadCaches" : "Shared",
+                             static_cast<int>(kThreadCounts[j])),
+          tnet);
+
+      EXPECT_TRUE(bhm->DestroyHeap(hid));
+      bhm.reset();
+      scc.reset();
+    }
+  }
+}
+
+// Measures the throughput of concurrent allocations and frees with each of
+// the shared quarantine implementations, and makes sure that the lock-free
+// one loses no block.
+TEST_F(BlockHeapManagerIntegrationTest, LockFreeQuarantinePerfTest) {
+  static const size_t kThreadCounts[] = { 1, 2, 4, 8 };
+  static const size_t kIterations = 100000;
+
+  for (size_t i = 0; i < 2; ++i) {
+    bool enable_lock_free_quarantine = i == 1;
+    for (size_t j = 0; j < arraysize(kThreadCounts); ++j) {
+      ::common::AsanParameters p;
+      ::common::SetDefaultAsanParameters(&p);
+      p.check_heap_on_failure = false;
+      p.enable_zebra_block_heap = false;
+      p.enable_large_block_heap = false;
+      p.enable_allocation_filter = false;
+      p.quarantine_size = 64 * 1024;
+      p.quarantine_flood_fill_rate = 0.0;
+      p.enable_lock_free_quarantine = enable_lock_free_quarantine;
+
+      AsanLogger al;
+      memory_notifiers::ShadowMemoryNotifier shadow_memory_notifier(&shadow_);
+      scoped_ptr<StackCaptureCache> scc(
+          new StackCaptureCache(&al, &shadow_memory_notifier));
+      scoped_ptr<TestBlockHeapManager> bhm(
+          new TestBlockHeapManager(&shadow_, scc.get(),
+                                   &shadow_memory_notifier));
+      bhm->set_parameters(p);
+      bhm->Init();
+      BlockHeapManager::HeapId hid = bhm->CreateHeap();
+
+      size_t errors = 0;
+      uint64 tnet = RunAllocFreeThreads(bhm.get(), hid, kThreadCounts[j],
+                                        kIterations, &errors);
+      EXPECT_EQ(0u, errors);
+
+      testing::EmitMetric(
+          base::StringPrintf("Syzygy.Asan.BlockHeapManager.Quarantine.%s.%d",
+                             enable_lock_free_quarantine ? "LockFree" :
+                                                           "Sharded",
+                             static_cast<int>(kThreadCounts[j])),
+          tnet);
+
+      // Destroying the heap must find all of its blocks in the quarantine.
+      EXPECT_TRUE(bhm->DestroyHeap(hid));
+      bhm.reset();
+      scc.reset();
+    }
+  }
+}
+
 }  // namespace heap_managers
 }  // namespace asan
 }  // namespace agent
@@ -0,0 +1,354 @@
+// Copyright 2015 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "syzygy/agent/asan/heaps/size_class_block_heap.h"
+
+#include <windows.h>
+#include <intrin.h>
+
+#include <algorithm>
+#include <vector>
+
+#include "base/logging.h"
+#include "syzygy/agent/asan/memory_notifier.h"
+#include "syzygy/common/align.h"
+
+namespace agent {
+namespace asan {
+namespace heaps {
+
+namespace {
+
+// The number of size classes spaced by kMinimumSlotSize.
+const size_t kSmallSizeClassCount = 8;
+
+// The largest slot size of the small size classes.
+const size_t kSmallSizeClassLimit =
+    kSmallSizeClassCount * SizeClassBlockHeap::kMinimumSlotSize;
+
+// Log2(kSmallSizeClassLimit).
+const size_t kSmallSizeClassLimitBits = 7;
+
+// The number of size classes per power of 2 past kSmallSizeClassLimit.
+const size_t kSizeClassesPerPowerOf2 = 4;
+
+}  // namespace
+
+SizeClassBlockHeap::SizeClassBlockHeap(MemoryNotifierInterface* memory_notifier,
+                                       HeapInterface* internal_heap)
+    : slabs_(0,
+             std::hash<const uint8*>(),
+             std::equal_to<const uint8*>(),
+             HeapAllocator<std::pair<const uint8* const, Slab>>(
+                 internal_heap)),
+      memory_notifier_(memory_notifier) {
+  DCHECK_NE(static_cast<MemoryNotifierInterface*>(nullptr), memory_notifier);
+  COMPILE_ASSERT(kSmallSizeClassLimit == 1 << kSmallSizeClassLimitBits,
+                 invalid_small_size_class_limit);
+  DCHECK_EQ(kMaximumAllocationSize, GetSlotSize(kSizeClassCount - 1));
+  ::memset(partial_slabs_, 0, sizeof(partial_slabs_));
+}
+
+SizeClassBlockHeap::~SizeClassBlockHeap() {
+  // No need to lock here, as concurrent access to an object under destruction
+  // is a programming error.
+
+  // Ideally there shouldn't be any allocations left in the heap, but it's not
+  // always the case in Chrome so all the slabs are released regardless.
+  std::vector<Slab*> slabs;
+  for (auto& entry : slabs_)
+    slabs.push_back(&entry.second);
+  for (Slab* slab : slabs) {
+    if (slab->free_count != 0)
+      UnlinkSlab(slab);
+    ReleaseSlab(slab);
+  }
+
+  CHECK(slabs_.empty());
+}
+
+HeapType SizeClassBlockHeap::GetHeapType() const {
+  return kSizeClassBlockHeap;
+}
+
+uint32 SizeClassBlockHeap::GetHeapFeatures() const {
+  return kHeapSupportsIsAllocated | kHeapSupportsGetAllocationSize |
+      kHeapGetAllocationSizeIsUpperBound | kHeapReportsReservations;
+}
+
+void* SizeClassBlockHeap::Allocate(size_t bytes) {
+  // Always allocate some memory so as to guarantee that zero-sized
+  // allocations get an actual distinct address each time.
+  size_t size_class = GetSizeClass(std::max(bytes, 1u));
+  if (size_class == kInvalidSizeClass)
+    return nullptr;
+
+  ::common::AutoRecursiveLock lock(lock_);
+
+  Slab* slab = partial_slabs_[size_class];
+  if (slab == nullptr) {
+    slab = CreateSlab(size_class);
+    if (slab == nullptr)
+      return nullptr;
+  }
+  DCHECK_LT(0u, slab->free_count);
+
+  // Find the first free slot. The bits past the last slot are set, so there
+  // is no need to check for the end of the bitmap.
+  size_t word = slab->first_free_word;
+  while (slab->bitmap[word] == ~0U)
+    ++word;
+  DCHECK_LT(word, arraysize(slab->bitmap));
+  unsigned long bit = 0;
+  _BitScanForward(&bit, ~slab->bitmap[word]);
+  slab->bitmap[word] |= 1U << bit;
+  slab->first_free_word = word;
+
+  size_t slot = word * 32 + bit;
+  DCHECK_LT(slot, slab->slot_count);
+  if (--slab->free_count == 0)
+    UnlinkSlab(slab);
+
+  return slab->address + slot * slab->slot_size;
+}
+
+bool SizeClassBlockHeap::Free(void* alloc) {
+  ::common::AutoRecursiveLock lock(lock_);
+
+  size_t slot = 0;
+  Slab* slab = FindAllocatedSlot(alloc, &slot);
+  if (slab == nullptr)
+    return false;
+
+  size_t word = slot / 32;
+  slab->bitmap[word] &= ~(1U << (slot % 32));
+  slab->first_free_word = std::min(slab->first_free_word, word);
+  if (slab->free_count++ == 0)
+    LinkSlab(slab);
+
+  // Return the slab to the OS once it is empty, unless it's the only slab
+  // with free slots in its size class. This keeps a single slab around for
+  // workloads that repeatedly allocate and free a few blocks.
+  if (slab->free_count == slab->slot_count &&
+      (slab->prev != nullptr || slab->next != nullptr)) {
+    UnlinkSlab(slab);
+    ReleaseSlab(slab);
+  }
+
+  return true;
+}
+
+bool SizeClassBlockHeap::IsAllocated(const void* alloc) {
+  ::common::AutoRecursiveLock lock(lock_);
+  size_t slot = 0;
+  return FindAllocatedSlot(alloc, &slot) != nullptr;
+}
+
+size_t SizeClassBlockHeap::GetAllocationSize(const void* alloc) {
+  ::common::AutoRecursiveLock lock(lock_);
+  size_t slot = 0;
+  Slab* slab = FindAllocatedSlot(alloc, &slot);
+  if (slab == nullptr)
+    return kUnknownSize;
+  return slab->slot_size;
+}
+
+void SizeClassBlockHeap::Lock() {
+  lock_.Acquire();
+}
+
+void SizeClassBlockHeap::Unlock() {
+  lock_.Release();
+}
+
+bool SizeClassBlockHeap::TryLock() {
+  return lock_.Try();
+}
+
+void* SizeClassBlockHeap::AllocateBlock(size_t size,
+                                        size_t min_left_redzone_size,
+                                        size_t min_right_redzone_size,
+                                        BlockLayout* layout) {
+  DCHECK_NE(static_cast<BlockLayout*>(nullptr), layout);
+
+  if (!PlanLayout(size, min_left_redzone_size, min_right_redzone_size, layout))
+    return nullptr;
+
+  void* alloc = Allocate(layout->block_size);
+  DCHECK_EQ(0u, reinterpret_cast<uintptr_t>(alloc) % kShadowRatio);
+  return alloc;
+}
+
+bool SizeClassBlockHeap::FreeBlock(const BlockInfo& block_info) {
+  DCHECK_NE(static_cast<BlockHeader*>(nullptr), block_info.header);
+  return Free(block_info.header);
+}
+
+bool SizeClassBlockHeap::PlanLayout(size_t size,
+                                    size_t min_left_redzone_size,
+                                    size_t min_right_redzone_size,
+                                    BlockLayout* layout) {
+  DCHECK_NE(static_cast<BlockLayout*>(nullptr), layout);
+
+  if (!BlockPlanLayout(kShadowRatio, kShadowRatio, size, min_left_redzone_size,
+                       min_right_redzone_size, layout)) {
+    return false;
+  }
+  size_t size_class = GetSizeClass(layout->block_size);
+  if (size_class == kInvalidSizeClass)
+    return false;
+
+  // Grow the right redzone so that the block fills its entire slot. This
+  // leaves no unaccounted for memory between the blocks of a slab.
+  size_t slot_size = GetSlotSize(size_class);
+  if (layout->block_size != slot_size) {
+    size_t slack = slot_size - layout->block_size;
+    if (!BlockPlanLayout(kShadowRatio, kShadowRatio, size,
+                         min_left_redzone_size, min_right_redzone_size + slack,
+                         layout)) {
+      return false;
+    }
+    DCHECK_EQ(slot_size, layout->block_size);
+  }
+
+  return true;
+}
+
+size_t SizeClassBlockHeap::GetSizeClass(size_t bytes) {
+  if (bytes == 0)
+    return 0;
+  if (bytes > kMaximumAllocationSize)
+    return kInvalidSizeClass;
+  if (bytes <= kSmallSizeClassLimit)
+    return (bytes - 1) / kMinimumSlotSize;
+
+  // Past the small size classes, the slot sizes of the power of 2 range
+  // (2^n, 2^(n+1)] are spaced by 2^(n-2).
+  unsigned long n = 0;
+  _BitScanReverse(&n, static_cast<unsigned long>(bytes - 1));
+  size_t sub_class = ((bytes - 1) >> (n - 2)) - kSizeClassesPerPowerOf2;
+  return kSmallSizeClassCount +
+      (n - kSmallSizeClassLimitBits) * kSizeClassesPerPowerOf2 + sub_class;
+}
+
+size_t SizeClassBlockHeap::GetSlotSize(size_t size_class) {
+  DCHECK_LT(size_class, kSizeClassCount);
+  if (size_class < kSmallSizeClassCount)
+    return (size_class + 1) * kMinimumSlotSize;
+
+  size_t index = size_class - kSmallSizeClassCount;
+  size_t n = kSmallSizeClassLimitBits + index / kSizeClassesPerPowerOf2;
+  size_t sub_class = index % kSizeClassesPerPowerOf2;
+  return (kSizeClassesPerPowerOf2 + sub_class + 1) << (n - 2);
+}
+
+SizeClassBlockHeap::Slab* SizeClassBlockHeap::CreateSlab(size_t size_class) {
+  DCHECK_LT(size_class, kSizeClassCount);
+
+  uint8* address = reinterpret_cast<uint8*>(
+      ::VirtualAlloc(NULL, kSlabSize, MEM_RESERVE | MEM_COMMIT,
+                     PAGE_READWRITE));
+  if (address == nullptr)
+    return nullptr;
+  DCHECK(::common::IsAligned(address, kSlabSize));
+  memory_notifier_->NotifyFutureHeapUse(address, kSlabSize);
+
+  auto result = slabs_.insert(std::make_pair(address, Slab()));
+  DCHECK(result.second);
+  Slab* slab = &result.first->second;
+  slab->address = address;
+  slab->size_class = size_class;
+  slab->slot_size = GetSlotSize(size_class);
+  slab->slot_count = kSlabSize / slab->slot_size;
+  slab->free_count = slab->slot_count;
+  slab->first_free_word = 0;
+  slab->prev = nullptr;
+  slab->next = nullptr;
+
+  // Mark the slots as free, and the bits past the last slot as allocated.
+  ::memset(slab->bitmap, 0xFF, sizeof(slab->bitmap));
+  ::memset(slab->bitmap, 0, (slab->slot_count / 32) * sizeof(uint32));
+  if (slab->slot_count % 32 != 0)
+    slab->bitmap[slab->slot_count / 32] = ~0U << (slab->slot_count % 32);
+
+  LinkSlab(slab);
+  return slab;
+}
+
+void SizeClassBlockHeap::ReleaseSlab(Slab* slab) {
+  DCHECK_NE(static_cast<Slab*>(nullptr), slab);
+  DCHECK_EQ(static_cast<Slab*>(nullptr), slab->prev);
+  DCHECK_EQ(static_cast<Slab*>(nullptr), slab->next);
+  DCHECK_NE(slab, partial_slabs_[slab->size_class]);
+
+  uint8* address = slab->address;
+  memory_notifier_->NotifyReturnedToOS(address, kSlabSize);
+  CHECK_NE(FALSE, ::VirtualFree(address, 0, MEM_RELEASE));
+  slabs_.erase(address);
+}
+
+void SizeClassBlockHeap::LinkSlab(Slab* slab) {
+  DCHECK_NE(static_cast<Slab*>(nullptr), slab);
+  DCHECK_EQ(static_cast<Slab*>(nullptr), slab->prev);
+  DCHECK_EQ(static_cast<Slab*>(nullptr), slab->next);
+
+  Slab*& head = partial_slabs_[slab->size_class];
+  slab->next = head;
+  if (head != nullptr)
+    head->prev = slab;
+  head = slab;
+}
+
+void SizeClassBlockHeap::UnlinkSlab(Slab* slab) {
+  DCHECK_NE(static_cast<Slab*>(nullptr), slab);
+
+  if (slab->prev != nullptr) {
+    slab->prev->next = slab->next;
+  } else {
+    DCHECK_EQ(slab, partial_slabs_[slab->size_class]);
+    partial_slabs_[slab->size_class] = slab->next;
+  }
+  if (slab->next != nullptr)
+    slab->next->prev = slab->prev;
+  slab->prev = nullptr;
+  slab->next = nullptr;
+}
+
+SizeClassBlockHeap::Slab* SizeClassBlockHeap::FindAllocatedSlot(
+    const void* alloc, size_t* slot) {
+  DCHECK_NE(static_cast<size_t*>(nullptr), slot);
+
+  const uint8* address = reinterpret_cast<const uint8*>(alloc);
+  const uint8* slab_address = ::common::AlignDown(address, kSlabSize);
+  SlabMap::iterator it = slabs_.find(slab_address);
+  if (it == slabs_.end())
+    return nullptr;
+
+  Slab* slab = &it->second;
+  size_t offset = address - slab_address;
+  if (offset % slab->slot_size != 0)
+    return nullptr;
+  size_t index = offset / slab->slot_size;
+  if (index >= slab->slot_count)
+    return nullptr;
+  if ((slab->bitmap[index / 32] & (1U << (index % 32))) == 0)
+    return nullptr;
+
+  *slot = index;
+  return slab;
+}
+
+}  // namespace heaps
+}  // namespace asan
+}  // namespace agent
@@ -0,0 +1,198 @@
+// Copyright 2015 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// Declares SizeClassBlockHeap, a heap that serves small blocks from slabs of
+// memory that are each dedicated to a single size class.
+//
+// Every slab is a 64KB chunk of memory obtained directly from the OS, and
+// divided into equally sized slots. A block occupies an entire slot, its
+// right redzone being grown to fill any slack, so the blocks of a slab (with
+// their headers and trailers) are laid out back to back. The state of the
+// slots is tracked by a bitmap kept outside of the slab. This removes the
+// per-allocation overhead and the fragmentation of a general purpose heap for
+// workloads dominated by small allocations.
+//
+// Size classes are 16 bytes apart up to 128 bytes, and there are then 4 size
+// classes per power of 2, up to 4KB. Larger blocks are refused.
+
+#ifndef SYZYGY_AGENT_ASAN_HEAPS_SIZE_CLASS_BLOCK_HEAP_H_
+#define SYZYGY_AGENT_ASAN_HEAPS_SIZE_CLASS_BLOCK_HEAP_H_
+
+#include <functional>
+#include <unordered_map>
+
+#include "syzygy/agent/asan/allocators.h"
+#include "syzygy/agent/asan/heap.h"
+#include "syzygy/common/recursive_lock.h"
+
+namespace agent {
+namespace asan {
+
+class MemoryNotifierInterface;
+
+namespace heaps {
+
+class SizeClassBlockHeap : public BlockHeapInterface {
+ public:
+  // The size of a slab. This is the allocation granularity of the OS, so
+  // slabs are aligned on their size.
+  static const size_t kSlabSize = 64 * 1024;
+
+  // The largest allocation served by this heap.
+  static const size_t kMaximumAllocationSize = 4096;
+
+  // The number of size classes.
+  static const size_t kSizeClassCount = 28;
+
+  // The size of the smallest size class. This is also the spacing of the
+  // small size classes.
+  static const size_t kMinimumSlotSize = 16;
+
+  // The maximum number of slots in a slab.
+  static const size_t kMaximumSlotCount = kSlabSize / kMinimumSlotSize;
+
+  // Returned by GetSizeClass for allocations that are too large.
+  static const size_t kInvalidSizeClass = ~0U;
+
+  // Constructor.
+  // @param memory_notifier The memory notifier to use.
+  // @param internal_heap The heap to use for making internal allocations.
+  SizeClassBlockHeap(MemoryNotifierInterface* memory_notifier,
+                     HeapInterface* internal_heap);
+
+  // Virtual destructor. Returns all the slabs to the OS.
+  virtual ~SizeClassBlockHeap();
+
+  // @name HeapInterface implementation.
+  // @{
+  virtual HeapType GetHeapType() const;
+  virtual uint32 GetHeapFeatures() const;
+  virtual void* Allocate(size_t bytes);
+  virtual bool Free(void* alloc);
+  virtual bool IsAllocated(const void* alloc);
+  virtual size_t GetAllocationSize(const void* alloc);
+  virtual void Lock();
+  virtual void Unlock();
+  virtual bool TryLock();
+  // @}
+
+  // @name BlockHeapInterface implementation.
+  // @{
+  virtual void* AllocateBlock(size_t size,
+                              size_t min_left_redzone_size,
+                              size_t min_right_redzone_size,
+                              BlockLayout* layout);
+  virtual bool FreeBlock(const BlockInfo& block_info);
+  // @}
+
+  // Finds the size class of an allocation.
+  // @param bytes The size of the allocation.
+  // @returns the index of the smallest size class that can hold @p bytes, or
+  //     kInvalidSizeClass if the allocation is too large.
+  static size_t GetSizeClass(size_t bytes);
+
+  // @param size_class The index of a size class.
+  // @returns the size of the slots of the given size class.
+  static size_t GetSlotSize(size_t size_class);
+
+  // Plans the layout of a block the way AllocateBlock does, the block
+  // filling an entire slot.
+  // @param size The size of the body of the block.
+  // @param min_left_redzone_size The minimum size of the left redzone.
+  // @param min_right_redzone_size The minimum size of the right redzone.
+  // @param layout Receives the layout of the block.
+  // @returns true on success, false if the block is too large for this heap.
+  static bool PlanLayout(size_t size,
+                         size_t min_left_redzone_size,
+                         size_t min_right_redzone_size,
+                         BlockLayout* layout);
+
+  // @returns the number of slabs currently owned by this heap.
+  size_t slab_count() const { return slabs_.size(); }
+
+ protected:
+  // Describes a slab.
+  struct Slab {
+    // The address of the slab.
+    uint8* address;
+    // The size class of the slab, and the corresponding slot size.
+    size_t size_class;
+    size_t slot_size;
+    // The number of slots in the slab, and how many of them are free.
+    size_t slot_count;
+    size_t free_count;
+    // The index of the first bitmap word that may contain a free slot.
+    size_t first_free_word;
+    // Links the slabs of a same size class that have free slots.
+    Slab* prev;
+    Slab* next;
+    // One bit per slot, set if the slot is allocated. The bits past
+    // slot_count are always set.
+    uint32 bitmap[kMaximumSlotCount / 32];
+  };
+
+  // The slabs, indexed by address.
+  typedef std::unordered_map<
+      const uint8*,
+      Slab,
+      std::hash<const uint8*>,
+      std::equal_to<const uint8*>,
+      HeapAllocator<std::pair<const uint8* const, Slab>>> SlabMap;
+
+  // Creates a slab and makes it available to a size class. Must be called
+  // under lock_.
+  // @param size_class The size class of the slab.
+  // @returns the new slab, or nullptr if the OS is out of memory.
+  Slab* CreateSlab(size_t size_class);
+
+  // Returns an empty slab to the OS. Must be called under lock_.
+  // @param slab The slab to release. It must not be linked into
+  //     partial_slabs_.
+  void ReleaseSlab(Slab* slab);
+
+  // Adds a slab to the list of slabs with free slots of its size class, or
+  // removes it from that list. Must be called under lock_.
+  // @param slab The slab to add or remove.
+  void LinkSlab(Slab* slab);
+  void UnlinkSlab(Slab* slab);
+
+  // Finds the allocated slot starting at a given address. Must be called
+  // under lock_.
+  // @param alloc The address to look up.
+  // @param slot Receives the index of the slot in the slab.
+  // @returns the slab containing the slot, or nullptr if @p alloc isn't the
+  //     address of an allocated slot of this heap.
+  Slab* FindAllocatedSlot(const void* alloc, size_t* slot);
+
+  // The slabs owned by this heap.
+  SlabMap slabs_;  // Under lock_.
+
+  // For each size class, the list of the slabs that have free slots.
+  Slab* partial_slabs_[kSizeClassCount];  // Under lock_.
+
+  // The global lock for this heap.
+  ::common::RecursiveLock lock_;
+
+  // The memory notifier in use.
+  MemoryNotifierInterface* memory_notifier_;
+
+ private:
+  DISALLOW_COPY_AND_ASSIGN(SizeClassBlockHeap);
+};
+
+}  // namespace heaps
+}  // namespace asan
+}  // namespace agent
+
+#endif  // SYZYGY_AGENT_ASAN_HEAPS_SIZE_CLASS_BLOCK_HEAP_H_
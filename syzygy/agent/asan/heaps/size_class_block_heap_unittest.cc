@@ -0,0 +1,225 @@
+// Copyright 2015 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "syzygy/agent/asan/heaps/size_class_block_heap.h"
+
+#include <set>
+#include <vector>
+
+#include "syzygy/agent/asan/unittest_util.h"
+#include "syzygy/agent/asan/memory_notifiers/null_memory_notifier.h"
+
+namespace agent {
+namespace asan {
+namespace heaps {
+
+namespace {
+
+testing::DummyHeap dummy_heap;
+agent::asan::memory_notifiers::NullMemoryNotifier dummy_notifier;
+
+// A SizeClassBlockHeap that uses a null memory notifier.
+class TestSizeClassBlockHeap : public SizeClassBlockHeap {
+ public:
+  using SizeClassBlockHeap::partial_slabs_;
+
+  TestSizeClassBlockHeap() : SizeClassBlockHeap(&dummy_notifier, &dummy_heap) {
+  }
+};
+
+}  // namespace
+
+TEST(SizeClassBlockHeapTest, GetHeapTypeIsValid) {
+  TestSizeClassBlockHeap h;
+  EXPECT_EQ(kSizeClassBlockHeap, h.GetHeapType());
+}
+
+TEST(SizeClassBlockHeapTest, FeaturesAreValid) {
+  TestSizeClassBlockHeap h;
+  EXPECT_EQ(HeapInterface::kHeapSupportsIsAllocated |
+                HeapInterface::kHeapSupportsGetAllocationSize |
+                HeapInterface::kHeapGetAllocationSizeIsUpperBound |
+                HeapInterface::kHeapReportsReservations,
+            h.GetHeapFeatures());
+}
+
+TEST(SizeClassBlockHeapTest, SizeClasses) {
+  EXPECT_EQ(16u, TestSizeClassBlockHeap::GetSlotSize(0));
+  EXPECT_EQ(128u, TestSizeClassBlockHeap::GetSlotSize(7));
+  EXPECT_EQ(160u, TestSizeClassBlockHeap::GetSlotSize(8));
+  EXPECT_EQ(256u, TestSizeClassBlockHeap::GetSlotSize(11));
+  EXPECT_EQ(320u, TestSizeClassBlockHeap::GetSlotSize(12));
+  EXPECT_EQ(TestSizeClassBlockHeap::kMaximumAllocationSize,
+            TestSizeClassBlockHeap::GetSlotSize(
+                TestSizeClassBlockHeap::kSizeClassCount - 1));
+
+  // Every size maps to the smallest size class that can hold it.
+  for (size_t i = 1; i <= TestSizeClassBlockHeap::kMaximumAllocationSize;
+       ++i) {
+    size_t size_class = TestSizeClassBlockHeap::GetSizeClass(i);
+    ASSERT_LT(size_class, TestSizeClassBlockHeap::kSizeClassCount);
+    EXPECT_LE(i, TestSizeClassBlockHeap::GetSlotSize(size_class));
+    EXPECT_EQ(0u, TestSizeClassBlockHeap::GetSlotSize(size_class) %
+                      kShadowRatio);
+    if (size_class > 0)
+      EXPECT_GT(i, TestSizeClassBlockHeap::GetSlotSize(size_class - 1));
+  }
+
+  EXPECT_EQ(TestSizeClassBlockHeap::kInvalidSizeClass,
+            TestSizeClassBlockHeap::GetSizeClass(
+                TestSizeClassBlockHeap::kMaximumAllocationSize + 1));
+}
+
+TEST(SizeClassBlockHeapTest, EndToEnd) {
+  TestSizeClassBlockHeap h;
+
+  BlockLayout layout = {};
+  BlockInfo block = {};
+
+  // Allocate and free a zero-sized allocation. This should succeed by
+  // definition.
+  void* alloc = h.AllocateBlock(0, 0, 0, &layout);
+  ASSERT_TRUE(alloc != NULL);
+  BlockInitialize(layout, alloc, false, &block);
+  EXPECT_TRUE(h.FreeBlock(block));
+
+  // Make a bunch of different sized allocations. Each block exactly fills a
+  // slot.
+  std::vector<BlockInfo> blocks;
+  for (size_t i = 1; i < 4096; i = i * 3 / 2 + 1) {
+    void* alloc = h.AllocateBlock(i, 0, 0, &layout);
+    if (alloc == NULL) {
+      // Only blocks that don't fit in the largest slot are refused.
+      EXPECT_LT(TestSizeClassBlockHeap::kMaximumAllocationSize,
+                i + sizeof(BlockHeader) + sizeof(BlockTrailer));
+      continue;
+    }
+    EXPECT_EQ(0u, reinterpret_cast<uintptr_t>(alloc) % kShadowRatio);
+    EXPECT_EQ(i, layout.body_size);
+    size_t size_class = TestSizeClassBlockHeap::GetSizeClass(
+        layout.block_size);
+    EXPECT_EQ(TestSizeClassBlockHeap::GetSlotSize(size_class),
+              layout.block_size);
+    EXPECT_EQ(layout.block_size, h.GetAllocationSize(alloc));
+    BlockInitialize(layout, alloc, false, &block);
+    blocks.push_back(block);
+  }
+
+  // Now free them.
+  for (size_t i = 0; i < blocks.size(); ++i)
+    EXPECT_TRUE(h.FreeBlock(blocks[i]));
+}
+
+TEST(SizeClassBlockHeapTest, TooLargeAllocationsAreRefused) {
+  TestSizeClassBlockHeap h;
+  BlockLayout layout = {};
+  const size_t kMaxSize = TestSizeClassBlockHeap::kMaximumAllocationSize;
+  EXPECT_EQ(static_cast<void*>(nullptr), h.Allocate(kMaxSize + 1));
+  EXPECT_EQ(static_cast<void*>(nullptr),
+            h.AllocateBlock(kMaxSize, 0, 0, &layout));
+  EXPECT_EQ(0u, h.slab_count());
+}
+
+TEST(SizeClassBlockHeapTest, ZeroSizedAllocationsHaveDistinctAddresses) {
+  TestSizeClassBlockHeap h;
+
+  void* a1 = h.Allocate(0);
+  EXPECT_TRUE(a1 != NULL);
+  void* a2 = h.Allocate(0);
+  EXPECT_TRUE(a2 != NULL);
+  EXPECT_NE(a1, a2);
+  EXPECT_TRUE(h.Free(a1));
+  EXPECT_TRUE(h.Free(a2));
+}
+
+TEST(SizeClassBlockHeapTest, IsAllocated) {
+  TestSizeClassBlockHeap h;
+
+  EXPECT_FALSE(h.IsAllocated(NULL));
+
+  void* a = h.Allocate(100);
+  EXPECT_TRUE(h.IsAllocated(a));
+  EXPECT_FALSE(h.IsAllocated(reinterpret_cast<uint8*>(a) - 1));
+  EXPECT_FALSE(h.IsAllocated(reinterpret_cast<uint8*>(a) + 1));
+  EXPECT_FALSE(h.IsAllocated(reinterpret_cast<uint8*>(a) + 112));
+
+  EXPECT_TRUE(h.Free(a));
+  EXPECT_FALSE(h.IsAllocated(a));
+  EXPECT_FALSE(h.Free(a));
+}
+
+TEST(SizeClassBlockHeapTest, GetAllocationSize) {
+  TestSizeClassBlockHeap h;
+
+  void* alloc = h.Allocate(67);
+  ASSERT_TRUE(alloc != NULL);
+  EXPECT_EQ(80u, h.GetAllocationSize(alloc));
+  EXPECT_TRUE(h.Free(alloc));
+  EXPECT_EQ(HeapInterface::kUnknownSize, h.GetAllocationSize(alloc));
+}
+
+TEST(SizeClassBlockHeapTest, SlabsAreSharedAndReleased) {
+  TestSizeClassBlockHeap h;
+  const size_t kSlotsPerSlab = TestSizeClassBlockHeap::kSlabSize / 64;
+
+  // Fill two slabs and a bit of a third one.
+  std::vector<void*> allocs;
+  std::set<void*> unique_allocs;
+  for (size_t i = 0; i < 2 * kSlotsPerSlab + 1; ++i) {
+    void* alloc = h.Allocate(64);
+    ASSERT_TRUE(alloc != NULL);
+    allocs.push_back(alloc);
+    EXPECT_TRUE(unique_allocs.insert(alloc).second);
+  }
+  EXPECT_EQ(3u, h.slab_count());
+
+  // Allocations of another size class get their own slab.
+  void* other = h.Allocate(32);
+  EXPECT_EQ(4u, h.slab_count());
+  EXPECT_TRUE(h.Free(other));
+  EXPECT_EQ(4u, h.slab_count());
+
+  // A freed slot is reused right away.
+  EXPECT_TRUE(h.Free(allocs[5]));
+  void* alloc = h.Allocate(60);
+  EXPECT_EQ(allocs[5], alloc);
+
+  // Slabs are returned to the OS as they become empty, but the last one with
+  // free slots is kept.
+  for (size_t i = 0; i < allocs.size(); ++i)
+    EXPECT_TRUE(h.Free(allocs[i]));
+  EXPECT_EQ(2u, h.slab_count());
+  EXPECT_TRUE(h.partial_slabs_[TestSizeClassBlockHeap::GetSizeClass(64)] !=
+              NULL);
+}
+
+TEST(SizeClassBlockHeapTest, Lock) {
+  TestSizeClassBlockHeap h;
+
+  h.Lock();
+  EXPECT_TRUE(h.TryLock());
+  h.Unlock();
+  h.Unlock();
+}
+
+TEST(SizeClassBlockHeapTest, DestructionWithOutstandingAllocationsSucceeds) {
+  TestSizeClassBlockHeap h;
+  for (size_t i = 0; i < 1000; ++i)
+    EXPECT_TRUE(h.Allocate(i) != NULL);
+  EXPECT_LT(0u, h.slab_count());
+}
+
+}  // namespace heaps
+}  // namespace asan
+}  // namespace agent
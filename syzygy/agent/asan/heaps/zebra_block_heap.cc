@@ -246,6 +246,25 @@ bool ZebraBlockHeap::Pop(CompactBlockInfo* info) {
   return true;
 }
 
+size_t ZebraBlockHeap::PopBatch(size_t max_count, ObjectVector* infos) {
+  DCHECK_NE(static_cast<ObjectVector*>(nullptr), infos);
+  ::common::AutoRecursiveLock lock(lock_);
+
+  size_t count = 0;
+  while (count < max_count && !QuarantineInvariantIsSatisfied()) {
+    size_t slab_index = quarantine_.front();
+    DCHECK_NE(kInvalidSlabIndex, slab_index);
+    quarantine_.pop();
+
+    DCHECK_EQ(kQuarantinedSlab, slab_info_[slab_index].state);
+    slab_info_[slab_index].state = kAllocatedSlab;
+    infos->push_back(slab_info_[slab_index].info);
+    ++count;
+  }
+
+  return count;
+}
+
 void ZebraBlockHeap::Empty(ObjectVector* infos) {
   ::common::AutoRecursiveLock lock(lock_);
   while (!quarantine_.empty()) {
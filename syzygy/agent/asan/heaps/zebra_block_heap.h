@@ -119,6 +119,8 @@ class ZebraBlockHeap : public BlockHeapInterface,
   // @{
   virtual bool Push(const CompactBlockInfo& info);
   virtual bool Pop(CompactBlockInfo* info);
+  virtual size_t PopBatch(size_t max_count,
+                          std::vector<CompactBlockInfo>* infos);
   virtual void Empty(std::vector<CompactBlockInfo>* infos);
   virtual size_t GetCount();
   virtual size_t GetLockId(const CompactBlockInfo& info) {
@@ -444,6 +444,46 @@ TEST(ZebraBlockHeapTest, PushPopInvariant) {
     EXPECT_TRUE(h.FreeBlock(blocks[i]));
 }
 
+TEST(ZebraBlockHeapTest, PushPopBatchInvariant) {
+  TestZebraBlockHeap h;
+  BlockLayout layout = {};
+  BlockInfo block = {};
+
+  // Fill the heap.
+  std::vector<BlockInfo> blocks;
+  for (size_t i = 0; i < h.slab_count_; i++) {
+    void* alloc = h.AllocateBlock(0xFF, 0, 0, &layout);
+    EXPECT_NE(reinterpret_cast<void*>(NULL), alloc);
+    BlockInitialize(layout, alloc, false, &block);
+    blocks.push_back(block);
+    CompactBlockInfo compact = {};
+    ConvertBlockInfo(block, &compact);
+    EXPECT_TRUE(h.Push(compact));
+  }
+  EXPECT_FALSE(h.QuarantineInvariantIsSatisfied());
+
+  // Pop in small batches until the invariant is restored. Only the last batch
+  // can be partial.
+  std::vector<CompactBlockInfo> popped;
+  while (true) {
+    size_t count = h.PopBatch(3, &popped);
+    EXPECT_LE(count, 3u);
+    if (count < 3)
+      break;
+  }
+  EXPECT_TRUE(h.QuarantineInvariantIsSatisfied());
+  EXPECT_EQ(0u, h.PopBatch(3, &popped));
+  EXPECT_EQ(h.slab_count_, popped.size() + h.GetCount());
+
+  // Clear the quarantine.
+  std::vector<CompactBlockInfo> objects;
+  h.Empty(&objects);
+
+  // Blocks can be freed now.
+  for (size_t i = 0; i < blocks.size(); i++)
+    EXPECT_TRUE(h.FreeBlock(blocks[i]));
+}
+
 TEST(ZebraBlockHeapTest, MemoryNotifierIsCalled) {
   testing::MockMemoryNotifier mock_notifier;
 
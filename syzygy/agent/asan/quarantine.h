@@ -62,6 +62,16 @@ class QuarantineInterface {
   //     false then the cache invariant is satisfied.
   virtual bool Pop(Object* object) = 0;
 
+  // Potentially removes several objects from the quarantine to maintain the
+  // invariant. This is equivalent to calling 'Pop' repeatedly, but lets the
+  // implementation amortize its synchronization costs over the whole batch.
+  // This routine must be thread-safe, and implement its own locking.
+  // @param max_count The maximum number of objects to remove.
+  // @param objects The removed objects are appended to this vector.
+  // @returns the number of objects that were removed. If this is less than
+  //     @p max_count then the cache invariant is satisfied.
+  virtual size_t PopBatch(size_t max_count, ObjectVector* objects) = 0;
+
   // Removes all objects from the quarantine, placing them in the provided
   // vector. This routine must be thread-safe, and implement its own locking.
   virtual void Empty(ObjectVector* objects) = 0;
@@ -0,0 +1,173 @@
+// Copyright 2015 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// Implements a sharded quarantine whose shards are lock-free queues.
+
+#ifndef SYZYGY_AGENT_ASAN_QUARANTINES_LOCK_FREE_QUARANTINE_H_
+#define SYZYGY_AGENT_ASAN_QUARANTINES_LOCK_FREE_QUARANTINE_H_
+
+#include <windows.h>
+
+#include "base/synchronization/lock.h"
+#include "syzygy/agent/asan/page_allocator.h"
+#include "syzygy/agent/asan/quarantines/sharded_quarantine.h"
+#include "syzygy/agent/asan/quarantines/size_limited_quarantine.h"
+
+namespace agent {
+namespace asan {
+namespace quarantines {
+
+// A sharded quarantine where each shard is an intrusive multiple-producer
+// single-consumer queue. Pushing an object takes no lock at all: a node is
+// taken from a lock-free free list and linked at the tail of its shard with a
+// single atomic exchange. Consumers of a shard are serialized by a per-shard
+// lock, which is only taken when popping. Popping is expected to be done in
+// batches with PopBatch, so that the lock is taken once per batch rather than
+// once per object.
+//
+// As pushes don't need any lock the AutoQuarantineLock is a no-op for this
+// quarantine.
+//
+// @tparam ObjectType The type of object being stored in the cache.
+// @tparam SizeFunctorType A functor for extracting the size associated with
+//     an object.
+// @tparam HashFunctorType A functor for calculating a hash value associated
+//     with an object. See ShardedQuarantine for details.
+// @tparam ShardingFactor The sharding factor. Must be greater than 1.
+template<typename ObjectType,
+         typename SizeFunctorType,
+         typename HashFunctorType,
+         size_t ShardingFactor>
+class LockFreeQuarantine
+    : public SizeLimitedQuarantineImpl<ObjectType, SizeFunctorType> {
+ public:
+  typedef HashFunctorType HashFunctor;
+
+  static const size_t kShardingFactor = ShardingFactor;
+
+  // The number of nodes that are carved out of the node cache at once when
+  // the free list runs dry.
+  static const size_t kNodeBatchSize = 64;
+
+  // Constructor. The hash functor must have a default constructor.
+  LockFreeQuarantine();
+
+  // Constructor with explicit hash functor. The hash functor must have
+  // a copy constructor.
+  explicit LockFreeQuarantine(const HashFunctor& hash_functor);
+
+  // Virtual destructor.
+  virtual ~LockFreeQuarantine() { }
+
+ protected:
+  // @name SizeLimitedQuarantineImpl implementation.
+  // @{
+  bool PushImpl(const Object& object) override;
+  bool PopImpl(Object* object) override;
+  size_t PopBatchImpl(size_t max_count,
+                      size_t max_size,
+                      ObjectVector* objects) override;
+  void EmptyImpl(ObjectVector* objects) override;
+  size_t GetLockIdImpl(const Object& object) override;
+  void LockImpl(size_t id) override;
+  void UnlockImpl(size_t id) override;
+  // @}
+
+  // The internal type used for storing objects. The alignment is required by
+  // the interlocked singly linked list functions.
+  struct DECLSPEC_ALIGN(MEMORY_ALLOCATION_ALIGNMENT) Node {
+    // Links the node into free_nodes_ while it is unused. This must be the
+    // first field.
+    SLIST_ENTRY free_entry;
+    // The next node in the shard. Written by producers, read by the consumer.
+    Node* volatile next;
+    Object object;
+  };
+
+  // A queue of quarantined objects. Objects are inserted at the tail by any
+  // number of producers, and removed from the head by the consumer holding
+  // consumer_lock. The queue always contains at least the stub node or one
+  // object node, so that producers never need to touch the head.
+  struct Shard {
+    // The oldest node of the queue. Under consumer_lock.
+    Node* head;
+    // The most recently pushed node of the queue. Modified atomically.
+    Node* volatile tail;
+    // The placeholder node that is in the queue when it is otherwise empty.
+    Node stub;
+    // Serializes the consumers of this shard.
+    base::Lock consumer_lock;
+  };
+
+  // The page allocator backing the nodes. This is only used to refill
+  // free_nodes_, kNodeBatchSize nodes at a time.
+  typedef TypedPageAllocator<Node, kNodeBatchSize, 32 * 1024, false> NodeCache;
+
+  // Links @p node at the tail of @p shard. This is lock-free.
+  void Enqueue(Shard* shard, Node* node);
+
+  // Unlinks the node at the head of @p shard. This must be called with the
+  // shard's consumer_lock held.
+  // @returns the unlinked node, or NULL if the shard is empty or if the only
+  //     remaining node is still being linked in by a producer.
+  Node* Dequeue(Shard* shard);
+
+  // Pops nodes from @p shard until either limit is hit. This must be called
+  // with the shard's consumer_lock held.
+  // @param shard The shard to pop from.
+  // @param max_count The maximum number of objects to pop.
+  // @param max_size The size after which to stop popping.
+  // @param count Incremented by the number of objects popped.
+  // @param size Incremented by the size of the objects popped.
+  // @param objects The popped objects are appended to this vector.
+  void DrainShard(Shard* shard, size_t max_count, size_t max_size,
+                  size_t* count, size_t* size, ObjectVector* objects);
+
+  // Gets a node from the free list, refilling it if necessary.
+  // @returns an unused node, or NULL if no memory is available.
+  Node* AllocateNode();
+
+  // Returns a node to the free list.
+  void FreeNode(Node* node);
+
+  // Returns the shard an object belongs to.
+  size_t GetShard(const Object& object);
+
+  // The shards of the quarantine.
+  Shard shards_[kShardingFactor];
+
+  // The unused nodes. This is accessed with the interlocked singly linked
+  // list functions.
+  SLIST_HEADER free_nodes_;
+
+  // Storage for the nodes. This has its own internal lock.
+  NodeCache node_cache_;
+
+  // The hash functor that will be used to assign objects to shards.
+  HashFunctor hash_functor_;
+
+ private:
+  // Initializes the shards and the free list.
+  void Init();
+
+  DISALLOW_COPY_AND_ASSIGN(LockFreeQuarantine);
+};
+
+}  // namespace quarantines
+}  // namespace asan
+}  // namespace agent
+
+#include "syzygy/agent/asan/quarantines/lock_free_quarantine_impl.h"
+
+#endif  // SYZYGY_AGENT_ASAN_QUARANTINES_LOCK_FREE_QUARANTINE_H_
@@ -0,0 +1,276 @@
+// Copyright 2015 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// Internal implementation of a lock-free quarantine. This file is not
+// meant to be included directly.
+
+#ifndef SYZYGY_AGENT_ASAN_QUARANTINES_LOCK_FREE_QUARANTINE_IMPL_H_
+#define SYZYGY_AGENT_ASAN_QUARANTINES_LOCK_FREE_QUARANTINE_IMPL_H_
+
+namespace agent {
+namespace asan {
+namespace quarantines {
+
+template<typename OT, typename SFT, typename HFT, size_t SF>
+LockFreeQuarantine<OT, SFT, HFT, SF>::LockFreeQuarantine() {
+  Init();
+}
+
+template<typename OT, typename SFT, typename HFT, size_t SF>
+LockFreeQuarantine<OT, SFT, HFT, SF>::LockFreeQuarantine(
+    const HashFunctor& hash_functor)
+    : hash_functor_(hash_functor) {
+  Init();
+}
+
+template<typename OT, typename SFT, typename HFT, size_t SF>
+void LockFreeQuarantine<OT, SFT, HFT, SF>::Init() {
+  COMPILE_ASSERT(kShardingFactor > 1, invalid_sharding_factor);
+  for (size_t i = 0; i < kShardingFactor; ++i) {
+    Shard* shard = &shards_[i];
+    shard->stub.next = NULL;
+    shard->head = &shard->stub;
+    shard->tail = &shard->stub;
+  }
+  ::InitializeSListHead(&free_nodes_);
+}
+
+template<typename OT, typename SFT, typename HFT, size_t SF>
+bool LockFreeQuarantine<OT, SFT, HFT, SF>::PushImpl(const Object& object) {
+  Node* node = AllocateNode();
+  if (node == NULL)
+    return false;
+  node->object = object;
+  Enqueue(&shards_[GetShard(object)], node);
+  return true;
+}
+
+template<typename OT, typename SFT, typename HFT, size_t SF>
+bool LockFreeQuarantine<OT, SFT, HFT, SF>::PopImpl(Object* object) {
+  DCHECK_NE(static_cast<Object*>(NULL), object);
+
+  // Look for a non-empty shard, starting from a random one. Shards that are
+  // being popped by another thread are only waited for if all the others are
+  // empty, as returning false promises that the quarantine is within its
+  // limit.
+  size_t first_shard = rand() % kShardingFactor;
+  bool busy[kShardingFactor] = {};
+  Node* node = NULL;
+  for (size_t i = 0; i < kShardingFactor && node == NULL; ++i) {
+    size_t shard = (first_shard + i) % kShardingFactor;
+    Shard* s = &shards_[shard];
+    if (!s->consumer_lock.Try()) {
+      busy[shard] = true;
+      continue;
+    }
+    node = Dequeue(s);
+    s->consumer_lock.Release();
+  }
+  for (size_t i = 0; i < kShardingFactor && node == NULL; ++i) {
+    size_t shard = (first_shard + i) % kShardingFactor;
+    if (!busy[shard])
+      continue;
+    base::AutoLock lock(shards_[shard].consumer_lock);
+    node = Dequeue(&shards_[shard]);
+  }
+
+  if (node == NULL)
+    return false;
+  *object = node->object;
+  FreeNode(node);
+  return true;
+}
+
+template<typename OT, typename SFT, typename HFT, size_t SF>
+size_t LockFreeQuarantine<OT, SFT, HFT, SF>::PopBatchImpl(
+    size_t max_count, size_t max_size, ObjectVector* objects) {
+  DCHECK_NE(static_cast<ObjectVector*>(NULL), objects);
+
+  size_t count = 0;
+  size_t size = 0;
+  size_t first_shard = rand() % kShardingFactor;
+
+  // Start with the shards that no other thread is popping from, starting from
+  // a random one.
+  bool busy[kShardingFactor] = {};
+  for (size_t i = 0; i < kShardingFactor; ++i) {
+    if (count == max_count || size >= max_size)
+      return count;
+
+    size_t shard = (first_shard + i) % kShardingFactor;
+    Shard* s = &shards_[shard];
+    if (!s->consumer_lock.Try()) {
+      busy[shard] = true;
+      continue;
+    }
+    DrainShard(s, max_count, max_size, &count, &size, objects);
+    s->consumer_lock.Release();
+  }
+
+  // Then wait for the busy ones. Returning fewer than |max_count| objects
+  // promises the caller that the quarantine is back within its limit, which
+  // can't be known without looking at every shard.
+  for (size_t i = 0; i < kShardingFactor; ++i) {
+    if (count == max_count || size >= max_size)
+      break;
+
+    size_t shard = (first_shard + i) % kShardingFactor;
+    if (!busy[shard])
+      continue;
+    base::AutoLock lock(shards_[shard].consumer_lock);
+    DrainShard(&shards_[shard], max_count, max_size, &count, &size, objects);
+  }
+
+  return count;
+}
+
+template<typename OT, typename SFT, typename HFT, size_t SF>
+void LockFreeQuarantine<OT, SFT, HFT, SF>::EmptyImpl(ObjectVector* objects) {
+  DCHECK_NE(static_cast<ObjectVector*>(NULL), objects);
+
+  size_t count = 0;
+  size_t size = 0;
+  for (size_t i = 0; i < kShardingFactor; ++i) {
+    base::AutoLock lock(shards_[i].consumer_lock);
+    DrainShard(&shards_[i], SIZE_MAX, SIZE_MAX, &count, &size, objects);
+  }
+}
+
+template<typename OT, typename SFT, typename HFT, size_t SF>
+size_t LockFreeQuarantine<OT, SFT, HFT, SF>::GetLockIdImpl(
+    const Object& object) {
+  return GetShard(object);
+}
+
+template<typename OT, typename SFT, typename HFT, size_t SF>
+void LockFreeQuarantine<OT, SFT, HFT, SF>::LockImpl(size_t id) {
+  // Pushes are lock-free, so there is nothing to do.
+  DCHECK_LT(id, kShardingFactor);
+}
+
+template<typename OT, typename SFT, typename HFT, size_t SF>
+void LockFreeQuarantine<OT, SFT, HFT, SF>::UnlockImpl(size_t id) {
+  DCHECK_LT(id, kShardingFactor);
+}
+
+template<typename OT, typename SFT, typename HFT, size_t SF>
+void LockFreeQuarantine<OT, SFT, HFT, SF>::Enqueue(Shard* shard, Node* node) {
+  DCHECK_NE(static_cast<Shard*>(NULL), shard);
+  DCHECK_NE(static_cast<Node*>(NULL), node);
+
+  node->next = NULL;
+  Node* prev = reinterpret_cast<Node*>(::InterlockedExchangePointer(
+      reinterpret_cast<PVOID volatile*>(&shard->tail), node));
+
+  // Until this store is made the node is invisible to the consumer, which
+  // will wait for it rather than see a broken chain.
+  prev->next = node;
+}
+
+template<typename OT, typename SFT, typename HFT, size_t SF>
+typename LockFreeQuarantine<OT, SFT, HFT, SF>::Node*
+LockFreeQuarantine<OT, SFT, HFT, SF>::Dequeue(Shard* shard) {
+  DCHECK_NE(static_cast<Shard*>(NULL), shard);
+  shard->consumer_lock.AssertAcquired();
+
+  Node* head = shard->head;
+  Node* next = head->next;
+
+  // Skip over the stub node.
+  if (head == &shard->stub) {
+    if (next == NULL)
+      return NULL;
+    shard->head = next;
+    head = next;
+    next = next->next;
+  }
+
+  if (next != NULL) {
+    shard->head = next;
+    return head;
+  }
+
+  // |head| is the last linked node. If it isn't the tail then a producer is
+  // in the middle of linking in a new node, which will be picked up by a
+  // later call.
+  if (head != shard->tail)
+    return NULL;
+
+  // Put the stub back in the queue so that the last node can be unlinked.
+  Enqueue(shard, &shard->stub);
+  next = head->next;
+  if (next != NULL) {
+    shard->head = next;
+    return head;
+  }
+
+  return NULL;
+}
+
+template<typename OT, typename SFT, typename HFT, size_t SF>
+void LockFreeQuarantine<OT, SFT, HFT, SF>::DrainShard(
+    Shard* shard, size_t max_count, size_t max_size,
+    size_t* count, size_t* size, ObjectVector* objects) {
+  DCHECK_NE(static_cast<Shard*>(NULL), shard);
+  DCHECK_NE(static_cast<size_t*>(NULL), count);
+  DCHECK_NE(static_cast<size_t*>(NULL), size);
+  DCHECK_NE(static_cast<ObjectVector*>(NULL), objects);
+
+  while (*count < max_count && *size < max_size) {
+    Node* node = Dequeue(shard);
+    if (node == NULL)
+      return;
+    objects->push_back(node->object);
+    *size += size_functor_(node->object);
+    ++(*count);
+    FreeNode(node);
+  }
+}
+
+template<typename OT, typename SFT, typename HFT, size_t SF>
+typename LockFreeQuarantine<OT, SFT, HFT, SF>::Node*
+LockFreeQuarantine<OT, SFT, HFT, SF>::AllocateNode() {
+  Node* node = reinterpret_cast<Node*>(::InterlockedPopEntrySList(
+      &free_nodes_));
+  if (node != NULL)
+    return node;
+
+  // The free list is empty, so carve out a new batch of nodes. Keep the first
+  // one and make the others available to everyone.
+  node = node_cache_.Allocate(kNodeBatchSize);
+  if (node == NULL)
+    return NULL;
+  for (size_t i = 1; i < kNodeBatchSize; ++i)
+    FreeNode(node + i);
+
+  return node;
+}
+
+template<typename OT, typename SFT, typename HFT, size_t SF>
+void LockFreeQuarantine<OT, SFT, HFT, SF>::FreeNode(Node* node) {
+  DCHECK_NE(static_cast<Node*>(NULL), node);
+  ::InterlockedPushEntrySList(&free_nodes_, &node->free_entry);
+}
+
+template<typename OT, typename SFT, typename HFT, size_t SF>
+size_t LockFreeQuarantine<OT, SFT, HFT, SF>::GetShard(const Object& object) {
+  size_t hash = hash_functor_(object);
+  return detail::ShardedQuarantineHash<kShardingFactor>(hash);
+}
+
+}  // namespace quarantines
+}  // namespace asan
+}  // namespace agent
+
+#endif  // SYZYGY_AGENT_ASAN_QUARANTINES_LOCK_FREE_QUARANTINE_IMPL_H_
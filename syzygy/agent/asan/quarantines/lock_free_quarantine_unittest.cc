@@ -0,0 +1,310 @@
+// Copyright 2015 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "syzygy/agent/asan/quarantines/lock_free_quarantine.h"
+
+#include <set>
+
+#include "base/memory/scoped_vector.h"
+#include "base/threading/platform_thread.h"
+#include "base/threading/simple_thread.h"
+#include "gtest/gtest.h"
+
+namespace agent {
+namespace asan {
+namespace quarantines {
+
+namespace {
+
+struct DummyObject {
+  size_t size;
+  size_t hash;
+
+  DummyObject() : size(0), hash(0) { }
+  explicit DummyObject(size_t size) : size(size), hash(0) { }
+  DummyObject(const DummyObject& o)
+      : size(o.size),
+        hash(o.hash) {
+  }
+  DummyObject& operator=(const DummyObject& o) {
+    size = o.size;
+    hash = o.hash;
+    return *this;
+  }
+};
+
+struct DummyObjectSizeFunctor {
+  size_t operator()(const DummyObject& o) {
+    return o.size;
+  }
+};
+
+struct DummyObjectHashFunctor {
+  uint32 operator()(const DummyObject& o) {
+    return o.hash;
+  }
+};
+
+typedef LockFreeQuarantine<DummyObject,
+                           DummyObjectSizeFunctor,
+                           DummyObjectHashFunctor,
+                           8> TestLockFreeQuarantine;
+
+// Pushes uniquely identified objects into a quarantine, trimming it as it
+// goes like the heap manager does.
+class PushPopRunner : public base::DelegateSimpleThread::Delegate {
+ public:
+  PushPopRunner(TestLockFreeQuarantine* quarantine,
+                size_t first_id,
+                size_t count)
+      : quarantine_(quarantine), first_id_(first_id), count_(count),
+        push_failures_(0) {
+  }
+
+  void Run() override {
+    for (size_t i = 0; i < count_; ++i) {
+      DummyObject d(1);
+      d.hash = first_id_ + i;
+      {
+        TestLockFreeQuarantine::AutoQuarantineLock lock(quarantine_, d);
+        if (!quarantine_->Push(d))
+          ++push_failures_;
+      }
+      while (quarantine_->PopBatch(16, &popped_) == 16) {
+      }
+    }
+  }
+
+  const TestLockFreeQuarantine::ObjectVector& popped() const {
+    return popped_;
+  }
+  size_t push_failures() const { return push_failures_; }
+
+ private:
+  TestLockFreeQuarantine* quarantine_;
+  size_t first_id_;
+  size_t count_;
+  size_t push_failures_;
+  TestLockFreeQuarantine::ObjectVector popped_;
+
+  DISALLOW_COPY_AND_ASSIGN(PushPopRunner);
+};
+
+// Exposes the consumer lock of the shards.
+class TestLockFreeQuarantineWithShardLocks : public TestLockFreeQuarantine {
+ public:
+  base::Lock* consumer_lock(size_t shard) {
+    return &shards_[shard].consumer_lock;
+  }
+};
+
+// Trims a quarantine with PopBatch.
+class PopBatchRunner : public base::DelegateSimpleThread::Delegate {
+ public:
+  explicit PopBatchRunner(TestLockFreeQuarantine* quarantine)
+      : quarantine_(quarantine) {
+  }
+
+  void Run() override {
+    while (quarantine_->PopBatch(16, &popped_) == 16) {
+    }
+  }
+
+  const TestLockFreeQuarantine::ObjectVector& popped() const {
+    return popped_;
+  }
+
+ private:
+  TestLockFreeQuarantine* quarantine_;
+  TestLockFreeQuarantine::ObjectVector popped_;
+
+  DISALLOW_COPY_AND_ASSIGN(PopBatchRunner);
+};
+
+}  // namespace
+
+TEST(LockFreeQuarantineTest, PushPop) {
+  TestLockFreeQuarantine q;
+  DummyObject d(1);
+  DummyObject popped;
+
+  q.set_max_quarantine_size(1000);
+
+  for (size_t i = 0; i < 1000; ++i) {
+    {
+      TestLockFreeQuarantine::AutoQuarantineLock lock(&q, d);
+      EXPECT_TRUE(q.Push(d));
+    }
+    d.hash++;
+    EXPECT_EQ(i + 1, q.size());
+    EXPECT_EQ(i + 1, q.GetCount());
+    EXPECT_FALSE(q.Pop(&popped));
+  }
+
+  {
+    TestLockFreeQuarantine::AutoQuarantineLock lock(&q, d);
+    EXPECT_TRUE(q.Push(d));
+  }
+  EXPECT_TRUE(q.Pop(&popped));
+  EXPECT_EQ(1000u, q.size());
+  EXPECT_FALSE(q.Pop(&popped));
+
+  TestLockFreeQuarantine::ObjectVector os;
+  q.Empty(&os);
+  EXPECT_EQ(1000u, os.size());
+  EXPECT_EQ(0u, q.size());
+  EXPECT_EQ(0u, q.GetCount());
+  EXPECT_FALSE(q.Pop(&popped));
+}
+
+TEST(LockFreeQuarantineTest, StressTest) {
+  TestLockFreeQuarantine q;
+
+  // Doesn't allow the largest of objects we generate.
+  q.set_max_object_size((1 << 10) - 1);
+
+  // Is only 4 times as big as the largest element we generate.
+  q.set_max_quarantine_size(4 * (1 << 10));
+
+  TestLockFreeQuarantine::ObjectVector os;
+  for (size_t i = 0; i < 1000000; ++i) {
+    // Generates a logarithmic distribution of element sizes.
+    size_t logsize = (1 << rand() % 11);
+    size_t size = (rand() & (logsize - 1)) | logsize;
+    DummyObject d(size);
+    d.hash = i;
+
+    size_t old_size = q.size();
+    size_t old_count = q.GetCount();
+    {
+      TestLockFreeQuarantine::AutoQuarantineLock lock(&q, d);
+      EXPECT_EQ(size <= q.max_object_size(), q.Push(d));
+    }
+    if (size > q.max_object_size()) {
+      EXPECT_EQ(old_size, q.size());
+      EXPECT_EQ(old_count, q.GetCount());
+      continue;
+    }
+    EXPECT_EQ(old_size + size, q.size());
+    EXPECT_EQ(old_count + 1, q.GetCount());
+
+    // Trim in batches. Only the last batch can be partial.
+    while (true) {
+      old_size = q.size();
+      old_count = q.GetCount();
+      os.clear();
+      size_t count = q.PopBatch(3, &os);
+      EXPECT_EQ(count, os.size());
+      size_t popped_size = 0;
+      for (size_t j = 0; j < os.size(); ++j)
+        popped_size += os[j].size;
+      EXPECT_EQ(old_size - popped_size, q.size());
+      EXPECT_EQ(old_count - count, q.GetCount());
+      if (count < 3)
+        break;
+    }
+    EXPECT_GE(q.max_quarantine_size(), q.size());
+  }
+
+  size_t old_size = q.size();
+  size_t old_count = q.GetCount();
+  os.clear();
+  q.Empty(&os);
+  EXPECT_EQ(0u, q.size());
+  EXPECT_EQ(0u, q.GetCount());
+  EXPECT_EQ(old_count, os.size());
+  size_t emptied_size = 0;
+  for (size_t i = 0; i < os.size(); ++i)
+    emptied_size += os[i].size;
+  EXPECT_EQ(old_size, emptied_size);
+}
+
+TEST(LockFreeQuarantineTest, ConcurrentPushPop) {
+  static const size_t kThreadCount = 4;
+  static const size_t kObjectsPerThread = 50000;
+
+  TestLockFreeQuarantine q;
+  q.set_max_quarantine_size(1000);
+
+  ScopedVector<PushPopRunner> runners;
+  ScopedVector<base::DelegateSimpleThread> threads;
+  for (size_t i = 0; i < kThreadCount; ++i) {
+    runners.push_back(new PushPopRunner(&q, i * kObjectsPerThread,
+                                        kObjectsPerThread));
+    threads.push_back(new base::DelegateSimpleThread(runners.back(),
+                                                     "push_pop"));
+  }
+  for (size_t i = 0; i < kThreadCount; ++i)
+    threads[i]->Start();
+  for (size_t i = 0; i < kThreadCount; ++i)
+    threads[i]->Join();
+
+  TestLockFreeQuarantine::ObjectVector os;
+  q.Empty(&os);
+  EXPECT_EQ(0u, q.size());
+  EXPECT_EQ(0u, q.GetCount());
+
+  // Every object must have come out of the quarantine exactly once.
+  std::set<size_t> ids;
+  for (size_t i = 0; i < os.size(); ++i)
+    EXPECT_TRUE(ids.insert(os[i].hash).second);
+  for (size_t i = 0; i < kThreadCount; ++i) {
+    EXPECT_EQ(0u, runners[i]->push_failures());
+    const TestLockFreeQuarantine::ObjectVector& popped = runners[i]->popped();
+    for (size_t j = 0; j < popped.size(); ++j)
+      EXPECT_TRUE(ids.insert(popped[j].hash).second);
+  }
+  EXPECT_EQ(kThreadCount * kObjectsPerThread, ids.size());
+}
+
+TEST(LockFreeQuarantineTest, PopBatchWaitsForBusyShards) {
+  TestLockFreeQuarantineWithShardLocks q;
+  q.set_max_quarantine_size(10);
+
+  // Put all of the objects in a single shard.
+  DummyObject d(1);
+  size_t shard = q.GetLockId(d);
+  for (size_t i = 0; i < 100; ++i) {
+    TestLockFreeQuarantine::AutoQuarantineLock lock(&q, d);
+    EXPECT_TRUE(q.Push(d));
+  }
+
+  // Trim the quarantine while another consumer holds that shard. The trim
+  // must not give up on the shard, as that would leave the quarantine over
+  // its limit.
+  PopBatchRunner runner(&q);
+  base::DelegateSimpleThread thread(&runner, "pop_batch");
+  q.consumer_lock(shard)->Acquire();
+  thread.Start();
+  base::PlatformThread::Sleep(base::TimeDelta::FromMilliseconds(50));
+  q.consumer_lock(shard)->Release();
+  thread.Join();
+
+  EXPECT_EQ(90u, runner.popped().size());
+  EXPECT_EQ(10u, q.size());
+  EXPECT_EQ(10u, q.GetCount());
+}
+
+TEST(LockFreeQuarantineTest, LockIdIsShard) {
+  TestLockFreeQuarantine q;
+  DummyObject d;
+  for (size_t i = 0; i < 100; ++i) {
+    d.hash = i;
+    EXPECT_GT(TestLockFreeQuarantine::kShardingFactor, q.GetLockId(d));
+  }
+}
+
+}  // namespace quarantines
+}  // namespace asan
+}  // namespace agent
@@ -64,6 +64,9 @@ class ShardedQuarantine
   // @{
   bool PushImpl(const Object& object) override;
   bool PopImpl(Object* object) override;
+  size_t PopBatchImpl(size_t max_count,
+                      size_t max_size,
+                      ObjectVector* objects) override;
   void EmptyImpl(ObjectVector* objects) override;
   size_t GetLockIdImpl(const Object& object) override;
   void LockImpl(size_t id) override;
@@ -124,6 +124,38 @@ bool ShardedQuarantine<OT, SFT, HFT, SF>::PopImpl(Object* object) {
   return true;
 }
 
+template<typename OT, typename SFT, typename HFT, size_t SF>
+size_t ShardedQuarantine<OT, SFT, HFT, SF>::PopBatchImpl(
+    size_t max_count, size_t max_size, ObjectVector* objects) {
+  DCHECK_NE(static_cast<ObjectVector*>(NULL), objects);
+
+  // Drain shards one at a time, starting from a random one, so that the lock
+  // of each shard is acquired at most once per batch.
+  size_t count = 0;
+  size_t size = 0;
+  size_t shard = rand() % kShardingFactor;
+  for (size_t i = 0; i < kShardingFactor; ++i) {
+    if (count == max_count || size >= max_size)
+      break;
+
+    base::AutoLock lock(locks_[shard]);
+    while (heads_[shard] != NULL && count < max_count && size < max_size) {
+      Node* node = heads_[shard];
+      heads_[shard] = node->next;
+      objects->push_back(node->object);
+      size += size_functor_(node->object);
+      ++count;
+      node_caches_[shard].Free(node, 1);
+    }
+    if (heads_[shard] == NULL)
+      tails_[shard] = NULL;
+
+    shard = (shard + 1) % kShardingFactor;
+  }
+
+  return count;
+}
+
 template<typename OT, typename SFT, typename HFT, size_t SF>
 void ShardedQuarantine<OT, SFT, HFT, SF>::EmptyImpl(ObjectVector* objects) {
   DCHECK_NE(static_cast<ObjectVector*>(NULL), objects);
@@ -194,6 +194,39 @@ TEST(ShardedQuarantineTest, StressTest) {
   EXPECT_EQ(old_size, emptied_size);
 }
 
+TEST(ShardedQuarantineTest, PopBatch) {
+  TestShardedQuarantine q;
+  DummyObject d(1);
+
+  q.set_max_object_size(TestShardedQuarantine::kUnboundedSize);
+  q.set_max_quarantine_size(1000);
+
+  // Overfill the quarantine, spreading the objects over all of the shards.
+  for (size_t i = 0; i < 1500; ++i) {
+    {
+      TestShardedQuarantine::AutoQuarantineLock lock(&q, d);
+      EXPECT_TRUE(q.Push(d));
+    }
+    d.hash++;
+  }
+
+  // Full batches are returned until the invariant is satisfied. Batches may
+  // span several shards.
+  TestShardedQuarantine::ObjectVector os;
+  for (size_t i = 0; i < 7; ++i)
+    EXPECT_EQ(64u, q.PopBatch(64, &os));
+  EXPECT_EQ(52u, q.PopBatch(64, &os));
+  EXPECT_EQ(500u, os.size());
+  EXPECT_EQ(1000u, q.size());
+  EXPECT_EQ(1000u, q.GetCount());
+  EXPECT_EQ(0u, q.PopBatch(64, &os));
+
+  size_t count = 0;
+  for (size_t i = 0; i < q.kShardingFactor; ++i)
+    count += q.ShardCount(i);
+  EXPECT_EQ(1000u, count);
+}
+
 TEST(ShardedQuarantineTest, LockUnlock) {
   TestShardedQuarantine q;
   DummyObject dummy;
@@ -37,6 +37,9 @@ namespace quarantines {
 //   bool PopImpl(ObjectType* object);
 //   void EmptyImpl(ObjectVector* object);
 //
+// The derived class may also override PopBatchImpl if it is able to remove
+// several objects more cheaply than with repeated calls to PopImpl.
+//
 // Calculates the sizes of objects using the provided SizeFunctor. This
 // must satisfy the following interface:
 //
@@ -107,6 +110,7 @@ class SizeLimitedQuarantineImpl : public QuarantineInterface<ObjectType> {
   // @{
   virtual bool Push(const Object& object);
   virtual bool Pop(Object* object);
+  virtual size_t PopBatch(size_t max_count, ObjectVector* objects);
   virtual void Empty(ObjectVector* objects);
   virtual size_t GetCount();
   virtual size_t GetLockId(const Object& object);
@@ -125,6 +129,17 @@ class SizeLimitedQuarantineImpl : public QuarantineInterface<ObjectType> {
   virtual void UnlockImpl(size_t id) = 0;
   // @}
 
+  // Removes objects from the quarantine until either @p max_count objects or
+  // at least @p max_size bytes worth of objects have been removed. The
+  // default implementation calls PopImpl repeatedly.
+  // @param max_count The maximum number of objects to remove.
+  // @param max_size The number of bytes after which to stop removing objects.
+  // @param objects The removed objects are appended to this vector.
+  // @returns the number of objects that were removed.
+  virtual size_t PopBatchImpl(size_t max_count,
+                              size_t max_size,
+                              ObjectVector* objects);
+
   // Parameters controlling the quarantine invariant.
   size_t max_object_size_;
   size_t max_quarantine_size_;
@@ -51,6 +51,34 @@ bool SizeLimitedQuarantineImpl<OT, SFT>::Pop(
   return true;
 }
 
+template<typename OT, typename SFT>
+size_t SizeLimitedQuarantineImpl<OT, SFT>::PopBatch(
+    size_t max_count, ObjectVector* objects) {
+  DCHECK_NE(static_cast<ObjectVector*>(NULL), objects);
+  if (max_quarantine_size_ == kUnboundedSize)
+    return 0;
+
+  // Work from a single snapshot of the size, as other threads may be pushing
+  // and popping concurrently. At worst this removes a little too much or too
+  // little, which later calls will correct.
+  int32 size = size_;
+  if (size <= 0 || static_cast<size_t>(size) <= max_quarantine_size_)
+    return 0;
+  size_t excess = static_cast<size_t>(size) - max_quarantine_size_;
+
+  size_t first = objects->size();
+  size_t count = PopBatchImpl(max_count, excess, objects);
+  DCHECK_EQ(first + count, objects->size());
+
+  int32 net_size = 0;
+  for (size_t i = first; i < objects->size(); ++i)
+    net_size += static_cast<int32>(size_functor_(objects->at(i)));
+  base::subtle::NoBarrier_AtomicIncrement(&size_, -net_size);
+  base::subtle::NoBarrier_AtomicIncrement(&count_,
+                                          -static_cast<int32>(count));
+  return count;
+}
+
 template<typename OT, typename SFT>
 void SizeLimitedQuarantineImpl<OT, SFT>::Empty(
     ObjectVector* objects) {
@@ -78,6 +106,23 @@ size_t SizeLimitedQuarantineImpl<OT, SFT>::GetCount() {
   return count_;
 }
 
+template<typename OT, typename SFT>
+size_t SizeLimitedQuarantineImpl<OT, SFT>::PopBatchImpl(
+    size_t max_count, size_t max_size, ObjectVector* objects) {
+  DCHECK_NE(static_cast<ObjectVector*>(NULL), objects);
+  size_t count = 0;
+  size_t size = 0;
+  Object object;
+  while (count < max_count && size < max_size) {
+    if (!PopImpl(&object))
+      break;
+    objects->push_back(object);
+    size += size_functor_(object);
+    ++count;
+  }
+  return count;
+}
+
 template<typename OT, typename SFT>
 size_t SizeLimitedQuarantineImpl<OT, SFT>::GetLockId(
     const Object& object) {
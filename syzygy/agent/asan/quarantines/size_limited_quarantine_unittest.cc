@@ -150,6 +150,39 @@ TEST(SizeLimitedQuarantineTest, InvariantEnforced) {
   EXPECT_EQ(1u, q.GetCount());
 }
 
+TEST(SizeLimitedQuarantineTest, PopBatchWorks) {
+  TestQuarantine q;
+  DummyObject o(10);
+  DummyObjectVector os;
+
+  q.set_max_quarantine_size(15);
+
+  EXPECT_TRUE(q.Push(o));
+  EXPECT_EQ(0u, q.PopBatch(10, &os));
+  EXPECT_TRUE(os.empty());
+
+  // Only as many objects as are needed to restore the invariant are removed.
+  EXPECT_TRUE(q.Push(o));
+  EXPECT_TRUE(q.Push(o));
+  EXPECT_TRUE(q.Push(o));
+  EXPECT_EQ(40u, q.size());
+  EXPECT_EQ(3u, q.PopBatch(10, &os));
+  EXPECT_EQ(3u, os.size());
+  EXPECT_EQ(10u, q.size());
+  EXPECT_EQ(1u, q.GetCount());
+
+  // The batch size is respected.
+  EXPECT_TRUE(q.Push(o));
+  EXPECT_TRUE(q.Push(o));
+  EXPECT_EQ(1u, q.PopBatch(1, &os));
+  EXPECT_EQ(4u, os.size());
+  EXPECT_EQ(20u, q.size());
+  EXPECT_EQ(1u, q.PopBatch(1, &os));
+  EXPECT_EQ(10u, q.size());
+  EXPECT_EQ(0u, q.PopBatch(1, &os));
+  EXPECT_EQ(5u, os.size());
+}
+
 TEST(SizeLimitedQuarantineTest, EmptyWorks) {
   TestQuarantine q;
   DummyObject o(10);
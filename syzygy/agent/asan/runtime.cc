@@ -508,13 +508,18 @@ void AsanRuntime::SetUp(const std::wstring& flags_command_line) {
   StackCaptureCache::Init();
   SetUpMemoryNotifier();
   SetUpLogger();
-  SetUpStackCache();
+
+  // Parse any flags set via the environment variable. This logs failure for
+  // us. This is done before setting up the stack cache, as the way in which it
+  // stores stack traces can't change once the heaps start saving them.
+  bool params_parsed =
+      ::common::ParseAsanParameters(flags_command_line, &params_);
+
+  SetUpStackCache(params_parsed && params_.enable_stack_trie);
   SetUpHeapManager();
   WindowsHeapAdapter::SetUp(heap_manager_.get());
 
-  // Parse and propagate any flags set via the environment variable. This logs
-  // failure for us.
-  if (!::common::ParseAsanParameters(flags_command_line, &params_))
+  if (!params_parsed)
     return;
 
   if (params_.enable_feature_randomization)
@@ -661,13 +666,16 @@ void AsanRuntime::TearDownLogger() {
   logger_.reset();
 }
 
-void AsanRuntime::SetUpStackCache() {
+void AsanRuntime::SetUpStackCache(bool enable_stack_trie) {
   DCHECK_NE(static_cast<MemoryNotifierInterface*>(nullptr),
             memory_notifier_.get());
   DCHECK_NE(static_cast<AsanLogger*>(nullptr), logger_.get());
   DCHECK_EQ(static_cast<StackCaptureCache*>(nullptr), stack_cache_.get());
   stack_cache_.reset(new StackCaptureCache(
-      logger_.get(), memory_notifier_.get()));
+      logger_.get(), memory_notifier_.get(),
+      common::StackCapture::kMaxNumFrames,
+      enable_stack_trie ? StackCaptureCache::kFrameTrieStorage
+                        : StackCaptureCache::kFlatFrameStorage));
   memory_notifier_->NotifyInternalUse(
       stack_cache_.get(), sizeof(*stack_cache_.get()));
 }
@@ -742,7 +750,7 @@ void AsanRuntime::PropagateParams() {
   // checks will ensure that this is the case.
   static_assert(sizeof(::common::AsanParameters) == 60,
                 "Must propagate parameters.");
-  static_assert(::common::kAsanParametersVersion == 12,
+  static_assert(::common::kAsanParametersVersion == 16,
                 "Must update parameters version.");
 
   // Push the configured parameter values to the appropriate endpoints.
@@ -752,6 +760,7 @@ void AsanRuntime::PropagateParams() {
   common::StackCapture::set_bottom_frames_to_skip(
       params_.bottom_frames_to_skip);
   stack_cache_->set_max_num_frames(params_.max_num_frames);
+  // enable_stack_trie is consumed when the stack cache is set up.
   // ignored_stack_ids is used locally by AsanRuntime.
   logger_->set_log_as_text(params_.log_as_text);
   // exit_on_failure is used locally by AsanRuntime.
@@ -956,6 +965,11 @@ void AsanRuntime::AddThreadId(uint32 thread_id) {
   thread_ids_.insert(thread_id);
 }
 
+void AsanRuntime::OnThreadExit() {
+  heap_manager_->ReleaseThreadCache();
+  stack_cache_->ReleaseThreadChunk();
+}
+
 bool AsanRuntime::ThreadIdIsValid(uint32 thread_id) {
   base::AutoLock lock(thread_ids_lock_);
   return thread_ids_.count(thread_id) > 0;
@@ -146,6 +146,10 @@ class AsanRuntime {
   // @param thread_id The thread ID that has been observed.
   void AddThreadId(uint32 thread_id);
 
+  // Releases the resources held on behalf of the calling thread. This must be
+  // called when a thread exits.
+  void OnThreadExit();
+
   // Determines if a thread ID has already been seen.
   // @param thread_id The thread ID to be queried.
   // @returns true if a given thread ID is valid for this process.
@@ -231,7 +235,9 @@ class AsanRuntime {
   void TearDownLogger();
 
   // Set up the stack cache.
-  void SetUpStackCache();
+  // @param enable_stack_trie If true, the stack cache stores the frames of
+  //     stack traces in a shared prefix tree.
+  void SetUpStackCache(bool enable_stack_trie);
 
   // Tear down the stack cache.
   void TearDownStackCache();
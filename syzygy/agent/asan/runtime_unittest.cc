@@ -159,6 +159,25 @@ TEST_F(AsanRuntimeTest, SetBottomFramesToSkip) {
   ASSERT_NO_FATAL_FAILURE(asan_runtime_.TearDown());
 }
 
+TEST_F(AsanRuntimeTest, SetEnableStackTrie) {
+  current_command_line_.AppendSwitch(::common::kParamEnableStackTrie);
+
+  ASSERT_NO_FATAL_FAILURE(
+      asan_runtime_.SetUp(current_command_line_.GetCommandLineString()));
+  EXPECT_TRUE(asan_runtime_.params().enable_stack_trie);
+  // The stack cache is created in the right mode, rather than switched to it
+  // after the heaps may have saved stack traces.
+  EXPECT_TRUE(asan_runtime_.stack_cache()->frame_trie_enabled());
+  ASSERT_NO_FATAL_FAILURE(asan_runtime_.TearDown());
+}
+
+TEST_F(AsanRuntimeTest, StackTrieIsDisabledByDefault) {
+  ASSERT_NO_FATAL_FAILURE(
+      asan_runtime_.SetUp(current_command_line_.GetCommandLineString()));
+  EXPECT_FALSE(asan_runtime_.stack_cache()->frame_trie_enabled());
+  ASSERT_NO_FATAL_FAILURE(asan_runtime_.TearDown());
+}
+
 TEST_F(AsanRuntimeTest, SetDisableBreakpad) {
   current_command_line_.AppendSwitch(::common::kParamDisableBreakpadReporting);
 
@@ -19,6 +19,7 @@
 
 #include "base/strings/stringprintf.h"
 #include "base/win/pe_image.h"
+#include "syzygy/agent/asan/shadow_scan.h"
 #include "syzygy/common/align.h"
 
 namespace agent {
@@ -28,6 +29,35 @@ namespace {
 
 static const size_t kPageSize = GetPageSize();
 
+// Ranges of shadow bytes at least this long are filled with memset. Shorter
+// ranges, which are the common case when poisoning heap blocks, are cheaper
+// to fill inline.
+static const size_t kMemsetThreshold = 256;
+
+// Fills @p count shadow bytes starting at @p cursor with @p marker. Short
+// ranges are written with aligned 64-bit stores of a precomputed marker word,
+// with byte stores for the unaligned head and tail.
+inline void FillShadow(uint8* cursor, size_t count, uint8 marker) {
+  if (count >= kMemsetThreshold) {
+    ::memset(cursor, marker, count);
+    return;
+  }
+
+  uint8* end = cursor + count;
+  for (; cursor < end && !::common::IsAligned(cursor, sizeof(uint64));
+       ++cursor) {
+    *cursor = marker;
+  }
+
+  uint64 marker64 = static_cast<uint64>(marker) * 0x0101010101010101ULL;
+  uint8* aligned_end = ::common::AlignDown(end, sizeof(uint64));
+  for (; cursor < aligned_end; cursor += sizeof(uint64))
+    *reinterpret_cast<uint64*>(cursor) = marker64;
+
+  for (; cursor < end; ++cursor)
+    *cursor = marker;
+}
+
 // Converts an address to a page index and bit mask.
 inline void AddressToPageMask(const void* address,
                               size_t* index,
@@ -137,22 +167,42 @@ bool Shadow::IsClean() const {
       (reinterpret_cast<uintptr_t>(self) + self_size + kShadowRatio - 1) >>
           kShadowRatioLog;
 
-  size_t i = 0;
-  for (; i < innac_end; ++i) {
-    if (shadow_[i] != kInvalidAddressMarker)
-      return false;
+  const size_t inaccessible_end = std::min(innac_end, length_);
+  if (ScanRightForMismatch(shadow_, shadow_ + inaccessible_end,
+                           kInvalidAddressMarker) !=
+          shadow_ + inaccessible_end) {
+    return false;
   }
 
-  for (; i < length_; ++i) {
-    if ((i >= shadow_begin && i < shadow_end) ||
-        (i >= page_bits_begin && i < page_bits_end) ||
-        (i >= this_begin && i < this_end)) {
-      if (shadow_[i] != kAsanMemoryMarker)
-        return false;
-    } else {
-      if (shadow_[i] != kHeapAddressableMarker)
-        return false;
+  // The remainder of the shadow is checked one run at a time, where each run
+  // is either entirely inside or entirely outside of the memory used by the
+  // shadow itself.
+  const size_t asan_ranges[][2] = {
+      { shadow_begin, shadow_end },
+      { page_bits_begin, page_bits_end },
+      { this_begin, this_end } };
+  size_t i = inaccessible_end;
+  while (i < length_) {
+    bool is_asan_memory = false;
+    size_t run_end = length_;
+    for (size_t j = 0; j < arraysize(asan_ranges); ++j) {
+      size_t range_begin = asan_ranges[j][0];
+      size_t range_end = asan_ranges[j][1];
+      if (i >= range_begin && i < range_end) {
+        is_asan_memory = true;
+        run_end = std::min(run_end, range_end);
+      } else if (i < range_begin) {
+        run_end = std::min(run_end, range_begin);
+      }
     }
+
+    uint8 expected_marker =
+        is_asan_memory ? kAsanMemoryMarker : kHeapAddressableMarker;
+    if (ScanRightForMismatch(shadow_ + i, shadow_ + run_end,
+                             expected_marker) != shadow_ + run_end) {
+      return false;
+    }
+    i = run_end;
   }
 
   return true;
@@ -232,7 +282,7 @@ void Shadow::Poison(const void* addr, size_t size, ShadowMarker shadow_val) {
 
   size >>= kShadowRatioLog;
   DCHECK_GT(length_, index + size);
-  ::memset(shadow_ + index, shadow_val, size);
+  FillShadow(shadow_ + index, size, shadow_val);
 }
 
 void Shadow::Unpoison(const void* addr, size_t size) {
@@ -245,7 +295,7 @@ void Shadow::Unpoison(const void* addr, size_t size) {
   index >>= kShadowRatioLog;
   size >>= kShadowRatioLog;
   DCHECK_GT(length_, index + size);
-  ::memset(shadow_ + index, kHeapAddressableMarker, size);
+  FillShadow(shadow_ + index, size, kHeapAddressableMarker);
 
   if (remainder != 0)
     shadow_[index + size] = remainder;
@@ -253,8 +303,8 @@ void Shadow::Unpoison(const void* addr, size_t size) {
 
 namespace {
 
-// An array of kFreedMarkers. This is used for constructing uint16, uint32 and
-// uint64 byte variants of kHeapFreedMarker.
+// An array of kFreedMarkers. This is used for constructing a uint64 variant of
+// kHeapFreedMarker.
 static const uint8 kFreedMarkers[] = {
     kHeapFreedMarker, kHeapFreedMarker, kHeapFreedMarker, kHeapFreedMarker,
     kHeapFreedMarker, kHeapFreedMarker, kHeapFreedMarker, kHeapFreedMarker };
@@ -262,12 +312,6 @@ COMPILE_ASSERT(sizeof(kFreedMarkers) == sizeof(uint64),
                 wrong_number_of_freed_markers);
 static const uint64& kFreedMarker64 =
     *reinterpret_cast<const uint64*>(kFreedMarkers);
-static const uint32& kFreedMarker32 =
-    *reinterpret_cast<const uint32*>(kFreedMarkers);
-static const uint16& kFreedMarker16 =
-    *reinterpret_cast<const uint16*>(kFreedMarkers);
-static const uint8& kFreedMarker8 =
-    *reinterpret_cast<const uint8*>(kFreedMarkers);
 
 // Marks the given range of shadow bytes as freed, preserving left and right
 // redzone bytes.
@@ -292,11 +336,12 @@ inline void MarkAsFreedImplAligned64(uint64* cursor, uint64* cursor_end) {
   DCHECK(::common::IsAligned(cursor_end, sizeof(uint64)));
 
   for (; cursor != cursor_end; ++cursor) {
-    // If the block of shadow memory is entirely green then mark as freed.
-    // Otherwise go check its contents byte by byte.
+    // If the block of shadow memory is entirely green then mark as freed. If
+    // it is already entirely freed then leave it be. Otherwise go check its
+    // contents byte by byte.
     if (*cursor == 0) {
       *cursor = kFreedMarker64;
-    } else {
+    } else if (*cursor != kFreedMarker64) {
       MarkAsFreedImpl8(reinterpret_cast<uint8*>(cursor),
                        reinterpret_cast<uint8*>(cursor + 1));
     }
@@ -444,19 +489,20 @@ void Shadow::PoisonAllocatedBlock(const BlockInfo& info) {
   uint8 trailer_marker = ShadowMarkerHelper::BuildBlockEnd(
       true, info.header->is_nested);
 
-  // Poison the header and left padding.
+  // The block is written as three runs of wide stores, one for each of the
+  // left redzone, the body and the right redzone. The markers at either end
+  // of the block and the partially addressable body byte are patched in
+  // afterwards.
   uint8* cursor = shadow_ + index;
-  ::memset(cursor, header_marker, 1);
-  ::memset(cursor + 1, kHeapLeftPaddingMarker, left_redzone_bytes - 1);
+  FillShadow(cursor, left_redzone_bytes, kHeapLeftPaddingMarker);
+  cursor[0] = header_marker;
   cursor += left_redzone_bytes;
-  ::memset(cursor, kHeapAddressableMarker, body_bytes);
+  FillShadow(cursor, body_bytes, kHeapAddressableMarker);
   cursor += body_bytes;
-
-  // Poison the right padding and the trailer.
   if (body_size_mod > 0)
     cursor[-1] = body_size_mod;
-  ::memset(cursor, kHeapRightPaddingMarker, right_redzone_bytes - 1);
-  ::memset(cursor + right_redzone_bytes - 1, trailer_marker, 1);
+  FillShadow(cursor, right_redzone_bytes, kHeapRightPaddingMarker);
+  cursor[right_redzone_bytes - 1] = trailer_marker;
 
   SetShadowMemory(info.header,
                   info.TotalHeaderSize(),
@@ -667,6 +713,14 @@ bool Shadow::ScanLeftForBracketingBlockStart(
   if (ShadowMarkerHelper::IsBlockEnd(shadow_[left]))
     --nesting_depth;
   while (true) {
+    // Skip directly to the nearest block marker, as nothing else affects the
+    // nesting depth.
+    const uint8* marker = ScanLeftForBlockMarker(
+        shadow_ + std::min(kLowerBound, left), shadow_ + left + 1);
+    if (marker == nullptr)
+      return false;
+    left = marker - shadow_;
+
     if (ShadowMarkerHelper::IsBlockStart(shadow_[left])) {
       if (nesting_depth == 0) {
         *location = left;
@@ -695,87 +749,6 @@ bool Shadow::ScanLeftForBracketingBlockStart(
   NOTREACHED();
 }
 
-namespace {
-
-// This handles an unaligned input cursor. It can potentially read up to 7
-// bytes past the end of the cursor, but only up to an 8 byte boundary. Thus
-// this out of bounds access is safe.
-inline const uint8* ScanRightForPotentialHeaderBytes(
-    const uint8* pos, const uint8* end) {
-  DCHECK(::common::IsAligned(end, 8));
-
-  // Handle the first few bytes that aren't aligned. If pos == end then
-  // it is already 8-byte aligned and we'll simply fall through to the end.
-  // This is a kind of Duffy's device that takes bytes 'as large as possible'
-  // until we reach an 8 byte alignment.
-  switch (reinterpret_cast<uintptr_t>(pos) & 0x7) {
-    case 1:
-      if (*pos != 0 && *pos != kFreedMarker8)
-        return pos;
-      pos += 1;
-    case 2:
-      if (*reinterpret_cast<const uint16*>(pos) != 0 &&
-          *reinterpret_cast<const uint16*>(pos) != kFreedMarker16) {
-        return pos;
-      }
-      pos += 2;
-    case 4:
-      if (*reinterpret_cast<const uint32*>(pos) != 0 &&
-          *reinterpret_cast<const uint32*>(pos) != kFreedMarker32) {
-        return pos;
-      }
-      pos += 4;
-      break;
-
-    case 3:
-      if (*pos != 0 && *pos != kFreedMarker8)
-        return pos;
-      pos += 1;
-      // Now have alignment of 4.
-      if (*reinterpret_cast<const uint32*>(pos) != 0 &&
-          *reinterpret_cast<const uint32*>(pos) != kFreedMarker32) {
-        return pos;
-      }
-      pos += 4;
-      break;
-
-    case 5:
-      if (*pos != 0 && *pos != kFreedMarker8)
-        return pos;
-      pos += 1;
-    case 6:
-      if (*reinterpret_cast<const uint16*>(pos) != 0 &&
-          *reinterpret_cast<const uint16*>(pos) != kFreedMarker16) {
-        return pos;
-      }
-      pos += 2;
-      break;
-
-    case 7:
-      if (*pos != 0 && *pos != kFreedMarker8)
-        return pos;
-      pos += 1;
-
-    case 0:
-    default:
-      // Do nothing, as we're already 8 byte aligned.
-      break;
-  }
-
-  // Handle the 8-byte aligned bytes as much as we can.
-  while (pos < end) {
-    if (*reinterpret_cast<const uint64*>(pos) != 0 &&
-        *reinterpret_cast<const uint64*>(pos) != kFreedMarker64) {
-      return pos;
-    }
-    pos += 8;
-  }
-
-  return pos;
-}
-
-}  // namespace
-
 bool Shadow::ScanRightForBracketingBlockEnd(
     size_t initial_nesting_depth, size_t cursor, size_t* location) const {
   DCHECK_NE(static_cast<size_t*>(NULL), location);
@@ -786,15 +759,12 @@ bool Shadow::ScanRightForBracketingBlockEnd(
   if (ShadowMarkerHelper::IsBlockStart(*pos))
     --nesting_depth;
   while (pos < shadow_end) {
-    // Skips past as many addressable and freed bytes as possible.
-    pos = ScanRightForPotentialHeaderBytes(pos, shadow_end);
+    // Skip directly to the next block marker, as nothing else affects the
+    // nesting depth.
+    pos = ScanRightForBlockMarker(pos, shadow_end);
     if (pos == shadow_end)
       return false;
 
-    // When the above loop exits early then somewhere in the next 8 bytes
-    // there's non-addressable data that isn't 'freed'. Look byte by byte to
-    // see what's up.
-
     if (ShadowMarkerHelper::IsBlockEnd(*pos)) {
       if (nesting_depth == 0) {
         *location = pos - shadow_;
@@ -845,13 +815,14 @@ bool Shadow::BlockInfoFromShadowImpl(
 
   // Find the beginning of the body (end of the left redzone).
   ++left;
-  while (left < right && shadow_[left] == kHeapLeftPaddingMarker)
-    ++left;
+  left = ScanRightForMismatch(shadow_ + left, shadow_ + right,
+                              kHeapLeftPaddingMarker) - shadow_;
 
   // Find the beginning of the right redzone (end of the body).
   --right;
-  while (right > left && shadow_[right - 1] == kHeapRightPaddingMarker)
-    --right;
+  const uint8* body_end = ScanLeftForMismatch(shadow_ + left, shadow_ + right,
+                                              kHeapRightPaddingMarker);
+  right = body_end == nullptr ? left : body_end - shadow_ + 1;
 
   // Calculate the body location and size.
   uint8* body = reinterpret_cast<uint8*>(left * kShadowRatio);
@@ -890,24 +861,39 @@ void ShadowWalker::Reset() {
   // Walk to the beginning of the first non-nested block, or to the end
   // of the range, whichever comes first.
   nesting_depth_ = -1;
-  for (cursor_ = lower_bound_; cursor_ != upper_bound_;
-       cursor_ += kShadowRatio) {
-    uint8 marker = shadow_->GetShadowMarkerForAddress(cursor_);
-    if (ShadowMarkerHelper::IsBlockStart(marker) &&
-        !ShadowMarkerHelper::IsNestedBlockStart(marker)) {
+  const uint8* shadow_begin = shadow_->GetShadowMemoryForAddress(lower_bound_);
+  const uint8* shadow_end = shadow_->GetShadowMemoryForAddress(upper_bound_);
+  const uint8* pos = shadow_begin;
+  while (true) {
+    pos = ScanRightForBlockMarker(pos, shadow_end);
+    if (pos == shadow_end)
+      break;
+    if (ShadowMarkerHelper::IsBlockStart(*pos) &&
+        !ShadowMarkerHelper::IsNestedBlockStart(*pos)) {
       break;
     }
+    ++pos;
   }
 
-  shadow_cursor_ = shadow_->GetShadowMemoryForAddress(cursor_);
+  cursor_ = lower_bound_ + (pos - shadow_begin) * kShadowRatio;
+  shadow_cursor_ = pos;
 }
 
 bool ShadowWalker::Next(BlockInfo* info) {
   DCHECK_NE(static_cast<BlockInfo*>(NULL), info);
 
+  const uint8* shadow_end = shadow_->GetShadowMemoryForAddress(upper_bound_);
+
   // Iterate until a reportable block is encountered, or the slab is exhausted.
   for (; cursor_ != upper_bound_; cursor_ += kShadowRatio) {
-    uint8 marker = shadow_->GetShadowMarkerForAddress(cursor_);
+    // Skip directly to the next block marker, as nothing else affects the
+    // walk.
+    const uint8* shadow_cursor = shadow_->GetShadowMemoryForAddress(cursor_);
+    const uint8* pos = ScanRightForBlockMarker(shadow_cursor, shadow_end);
+    cursor_ += (pos - shadow_cursor) * kShadowRatio;
+    if (cursor_ == upper_bound_)
+      break;
+    uint8 marker = *pos;
 
     // Update the nesting depth when block end markers are encountered.
     if (ShadowMarkerHelper::IsBlockEnd(marker)) {
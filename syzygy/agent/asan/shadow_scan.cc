@@ -0,0 +1,185 @@
+// Copyright 2015 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "syzygy/agent/asan/shadow_scan.h"
+
+#include <emmintrin.h>
+#include <intrin.h>
+
+#include "base/logging.h"
+#include "syzygy/common/align.h"
+
+namespace agent {
+namespace asan {
+
+namespace {
+
+// The number of shadow bytes examined at once.
+static const size_t kVectorSize = sizeof(__m128i);
+
+// Block start markers are of the form 110x0xxx, and block end markers are of
+// the form 11x1010x. This mirrors ShadowMarkerHelper::IsBlockStart and
+// ShadowMarkerHelper::IsBlockEnd.
+static const uint8 kBlockStartMask = 0xD0;
+static const uint8 kBlockStartValue = 0xC0;
+static const uint8 kBlockEndMask = 0xDE;
+static const uint8 kBlockEndValue = 0xD4;
+
+// Matches block start and block end markers.
+class BlockMarkerMatcher {
+ public:
+  BlockMarkerMatcher()
+      : start_mask_(_mm_set1_epi8(static_cast<char>(kBlockStartMask))),
+        start_value_(_mm_set1_epi8(static_cast<char>(kBlockStartValue))),
+        end_mask_(_mm_set1_epi8(static_cast<char>(kBlockEndMask))),
+        end_value_(_mm_set1_epi8(static_cast<char>(kBlockEndValue))) {
+  }
+
+  bool Matches(uint8 marker) const {
+    return (marker & kBlockStartMask) == kBlockStartValue ||
+        (marker & kBlockEndMask) == kBlockEndValue;
+  }
+
+  // @returns a mask with bit i set if byte i of @p markers matches.
+  int Matches(__m128i markers) const {
+    __m128i starts = _mm_cmpeq_epi8(_mm_and_si128(markers, start_mask_),
+                                    start_value_);
+    __m128i ends = _mm_cmpeq_epi8(_mm_and_si128(markers, end_mask_),
+                                  end_value_);
+    return _mm_movemask_epi8(_mm_or_si128(starts, ends));
+  }
+
+ private:
+  __m128i start_mask_;
+  __m128i start_value_;
+  __m128i end_mask_;
+  __m128i end_value_;
+};
+
+// Matches markers that differ from a given marker.
+class MismatchMatcher {
+ public:
+  explicit MismatchMatcher(uint8 marker)
+      : marker_(marker), markers_(_mm_set1_epi8(static_cast<char>(marker))) {
+  }
+
+  bool Matches(uint8 marker) const { return marker != marker_; }
+
+  // @returns a mask with bit i set if byte i of @p markers matches.
+  int Matches(__m128i markers) const {
+    return _mm_movemask_epi8(_mm_cmpeq_epi8(markers, markers_)) ^ 0xFFFF;
+  }
+
+ private:
+  uint8 marker_;
+  __m128i markers_;
+};
+
+template <typename Matcher>
+const uint8* ScanRight(const uint8* begin,
+                       const uint8* end,
+                       const Matcher& matcher) {
+  DCHECK_NE(static_cast<const uint8*>(nullptr), begin);
+  DCHECK_LE(begin, end);
+
+  // Examine the leading bytes one at a time until the cursor is aligned.
+  const uint8* pos = begin;
+  for (; pos < end && !::common::IsAligned(pos, kVectorSize); ++pos) {
+    if (matcher.Matches(*pos))
+      return pos;
+  }
+
+  // Examine as many aligned vectors as possible.
+  const uint8* vector_end = ::common::AlignDown(end, kVectorSize);
+  for (; pos < vector_end; pos += kVectorSize) {
+    int mask = matcher.Matches(
+        _mm_load_si128(reinterpret_cast<const __m128i*>(pos)));
+    if (mask != 0) {
+      unsigned long index = 0;
+      _BitScanForward(&index, mask);
+      return pos + index;
+    }
+  }
+
+  // Examine the trailing bytes.
+  for (; pos < end; ++pos) {
+    if (matcher.Matches(*pos))
+      return pos;
+  }
+
+  return end;
+}
+
+template <typename Matcher>
+const uint8* ScanLeft(const uint8* begin,
+                      const uint8* end,
+                      const Matcher& matcher) {
+  DCHECK_NE(static_cast<const uint8*>(nullptr), begin);
+  DCHECK_LE(begin, end);
+
+  // Examine the trailing bytes one at a time until the cursor is aligned.
+  const uint8* pos = end;
+  while (pos > begin && !::common::IsAligned(pos, kVectorSize)) {
+    --pos;
+    if (matcher.Matches(*pos))
+      return pos;
+  }
+
+  // Examine as many aligned vectors as possible.
+  const uint8* vector_begin = ::common::AlignUp(begin, kVectorSize);
+  while (pos > vector_begin) {
+    pos -= kVectorSize;
+    int mask = matcher.Matches(
+        _mm_load_si128(reinterpret_cast<const __m128i*>(pos)));
+    if (mask != 0) {
+      unsigned long index = 0;
+      _BitScanReverse(&index, mask);
+      return pos + index;
+    }
+  }
+
+  // Examine the leading bytes.
+  while (pos > begin) {
+    --pos;
+    if (matcher.Matches(*pos))
+      return pos;
+  }
+
+  return nullptr;
+}
+
+}  // namespace
+
+const uint8* ScanRightForBlockMarker(const uint8* begin, const uint8* end) {
+  return ScanRight(begin, end, BlockMarkerMatcher());
+}
+
+const uint8* ScanLeftForBlockMarker(const uint8* begin, const uint8* end) {
+  return ScanLeft(begin, end, BlockMarkerMatcher());
+}
+
+const uint8* ScanRightForMismatch(const uint8* begin,
+                                  const uint8* end,
+                                  uint8 marker) {
+  return ScanRight(begin, end, MismatchMatcher(marker));
+}
+
+const uint8* ScanLeftForMismatch(const uint8* begin,
+                                 const uint8* end,
+                                 uint8 marker) {
+  return ScanLeft(begin, end, MismatchMatcher(marker));
+}
+
+}  // namespace asan
+}  // namespace agent
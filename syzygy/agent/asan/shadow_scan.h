@@ -0,0 +1,68 @@
+// Copyright 2015 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// Declares kernels for scanning ranges of shadow memory. These are used by
+// Shadow and ShadowWalker to skip over the long runs of shadow bytes that are
+// of no interest to them, and examine 16 shadow bytes at a time using SSE2.
+
+#ifndef SYZYGY_AGENT_ASAN_SHADOW_SCAN_H_
+#define SYZYGY_AGENT_ASAN_SHADOW_SCAN_H_
+
+#include "base/basictypes.h"
+
+namespace agent {
+namespace asan {
+
+// Finds the first block start or block end marker in a range of shadow
+// memory. These are the markers for which ShadowMarkerHelper::IsBlockStart or
+// ShadowMarkerHelper::IsBlockEnd returns true.
+// @param begin The beginning of the range to scan.
+// @param end The end of the range to scan.
+// @returns a pointer to the first block marker in [begin, end), or @p end if
+//     there is none.
+const uint8* ScanRightForBlockMarker(const uint8* begin, const uint8* end);
+
+// Finds the last block start or block end marker in a range of shadow memory.
+// @param begin The beginning of the range to scan.
+// @param end The end of the range to scan.
+// @returns a pointer to the last block marker in [begin, end), or nullptr if
+//     there is none.
+const uint8* ScanLeftForBlockMarker(const uint8* begin, const uint8* end);
+
+// Finds the first byte in a range of shadow memory that differs from a given
+// marker.
+// @param begin The beginning of the range to scan.
+// @param end The end of the range to scan.
+// @param marker The expected value of the shadow bytes.
+// @returns a pointer to the first byte in [begin, end) that differs from
+//     @p marker, or @p end if there is none.
+const uint8* ScanRightForMismatch(const uint8* begin,
+                                  const uint8* end,
+                                  uint8 marker);
+
+// Finds the last byte in a range of shadow memory that differs from a given
+// marker.
+// @param begin The beginning of the range to scan.
+// @param end The end of the range to scan.
+// @param marker The expected value of the shadow bytes.
+// @returns a pointer to the last byte in [begin, end) that differs from
+//     @p marker, or nullptr if there is none.
+const uint8* ScanLeftForMismatch(const uint8* begin,
+                                 const uint8* end,
+                                 uint8 marker);
+
+}  // namespace asan
+}  // namespace agent
+
+#endif  // SYZYGY_AGENT_ASAN_SHADOW_SCAN_H_
@@ -0,0 +1,121 @@
+// Copyright 2015 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "syzygy/agent/asan/shadow_scan.h"
+
+#include "gtest/gtest.h"
+#include "syzygy/agent/asan/shadow_marker.h"
+
+namespace agent {
+namespace asan {
+
+namespace {
+
+// Enough bytes to cover every alignment of a range with respect to the
+// vector size, with a few whole vectors in between.
+static const size_t kBufferSize = 96;
+
+bool IsBlockMarker(uint8 marker) {
+  return ShadowMarkerHelper::IsBlockStart(marker) ||
+      ShadowMarkerHelper::IsBlockEnd(marker);
+}
+
+class ShadowScanTest : public testing::Test {
+ public:
+  virtual void SetUp() override {
+    ::memset(buffer_, 0, sizeof(buffer_));
+  }
+
+  __declspec(align(16)) uint8 buffer_[kBufferSize];
+};
+
+}  // namespace
+
+TEST_F(ShadowScanTest, MatchesBlockMarkers) {
+  // Every possible marker value is classified the same way as by
+  // ShadowMarkerHelper.
+  for (size_t i = 0; i < 256; ++i) {
+    uint8 marker = static_cast<uint8>(i);
+    buffer_[17] = marker;
+    const uint8* expected_right =
+        IsBlockMarker(marker) ? buffer_ + 17 : buffer_ + kBufferSize;
+    const uint8* expected_left = IsBlockMarker(marker) ? buffer_ + 17 : nullptr;
+    EXPECT_EQ(expected_right,
+              ScanRightForBlockMarker(buffer_, buffer_ + kBufferSize));
+    EXPECT_EQ(expected_left,
+              ScanLeftForBlockMarker(buffer_, buffer_ + kBufferSize));
+  }
+}
+
+TEST_F(ShadowScanTest, ScanForBlockMarkersInAllRanges) {
+  for (size_t marker_pos = 0; marker_pos < kBufferSize; ++marker_pos) {
+    ::memset(buffer_, kHeapFreedMarker, sizeof(buffer_));
+    buffer_[marker_pos] = kHeapBlockEndMarker;
+
+    for (size_t begin = 0; begin < kBufferSize; ++begin) {
+      for (size_t end = begin; end <= kBufferSize; ++end) {
+        bool in_range = marker_pos >= begin && marker_pos < end;
+        EXPECT_EQ(in_range ? buffer_ + marker_pos : buffer_ + end,
+                  ScanRightForBlockMarker(buffer_ + begin, buffer_ + end));
+        EXPECT_EQ(in_range ? buffer_ + marker_pos : nullptr,
+                  ScanLeftForBlockMarker(buffer_ + begin, buffer_ + end));
+      }
+    }
+  }
+}
+
+TEST_F(ShadowScanTest, ScanForMismatchInAllRanges) {
+  for (size_t mismatch_pos = 0; mismatch_pos < kBufferSize; ++mismatch_pos) {
+    ::memset(buffer_, kHeapLeftPaddingMarker, sizeof(buffer_));
+    buffer_[mismatch_pos] = kHeapAddressableMarker;
+
+    for (size_t begin = 0; begin < kBufferSize; ++begin) {
+      for (size_t end = begin; end <= kBufferSize; ++end) {
+        bool in_range = mismatch_pos >= begin && mismatch_pos < end;
+        EXPECT_EQ(in_range ? buffer_ + mismatch_pos : buffer_ + end,
+                  ScanRightForMismatch(buffer_ + begin, buffer_ + end,
+                                       kHeapLeftPaddingMarker));
+        EXPECT_EQ(in_range ? buffer_ + mismatch_pos : nullptr,
+                  ScanLeftForMismatch(buffer_ + begin, buffer_ + end,
+                                      kHeapLeftPaddingMarker));
+      }
+    }
+  }
+}
+
+TEST_F(ShadowScanTest, ScanFindsNearestMatch) {
+  buffer_[3] = kHeapBlockStartMarker0;
+  buffer_[40] = kHeapNestedBlockStartMarker0;
+  buffer_[41] = kHeapNestedBlockEndMarker;
+  buffer_[90] = kHeapBlockEndMarker;
+
+  EXPECT_EQ(buffer_ + 3,
+            ScanRightForBlockMarker(buffer_, buffer_ + kBufferSize));
+  EXPECT_EQ(buffer_ + 40,
+            ScanRightForBlockMarker(buffer_ + 4, buffer_ + kBufferSize));
+  EXPECT_EQ(buffer_ + 90,
+            ScanRightForBlockMarker(buffer_ + 42, buffer_ + kBufferSize));
+  EXPECT_EQ(buffer_ + 90,
+            ScanLeftForBlockMarker(buffer_, buffer_ + kBufferSize));
+  EXPECT_EQ(buffer_ + 41, ScanLeftForBlockMarker(buffer_, buffer_ + 90));
+  EXPECT_EQ(buffer_ + 3, ScanLeftForBlockMarker(buffer_, buffer_ + 40));
+
+  EXPECT_EQ(buffer_ + 3, ScanRightForMismatch(buffer_, buffer_ + kBufferSize,
+                                              kHeapAddressableMarker));
+  EXPECT_EQ(buffer_ + 90, ScanLeftForMismatch(buffer_, buffer_ + kBufferSize,
+                                              kHeapAddressableMarker));
+}
+
+}  // namespace asan
+}  // namespace agent
@@ -14,8 +14,11 @@
 
 #include "syzygy/agent/asan/shadow.h"
 
+#include <windows.h>
+
 #include "base/rand_util.h"
 #include "base/memory/scoped_ptr.h"
+#include "base/strings/stringprintf.h"
 #include "gtest/gtest.h"
 #include "syzygy/common/align.h"
 #include "syzygy/testing/metrics.h"
@@ -48,6 +51,43 @@ class ShadowTest : public testing::Test {
   TestShadow test_shadow;
 };
 
+// The byte-wise implementations of PoisonAllocatedBlock and Unpoison that
+// the wide store implementations are measured against.
+void ReferencePoisonAllocatedBlock(const BlockInfo& info, uint8* shadow) {
+  uintptr_t index = reinterpret_cast<uintptr_t>(info.header) / kShadowRatio;
+  size_t left_redzone_bytes = info.TotalHeaderSize() / kShadowRatio;
+  size_t body_bytes = (info.body_size + kShadowRatio - 1) / kShadowRatio;
+  size_t block_bytes = info.block_size / kShadowRatio;
+  size_t right_redzone_bytes = block_bytes - left_redzone_bytes - body_bytes;
+
+  uint8 body_size_mod = info.body_size % kShadowRatio;
+  uint8 header_marker = ShadowMarkerHelper::BuildBlockStart(
+      true, info.header->is_nested, body_size_mod);
+  uint8 trailer_marker = ShadowMarkerHelper::BuildBlockEnd(
+      true, info.header->is_nested);
+
+  uint8* cursor = shadow + index;
+  ::memset(cursor, header_marker, 1);
+  ::memset(cursor + 1, kHeapLeftPaddingMarker, left_redzone_bytes - 1);
+  cursor += left_redzone_bytes;
+  ::memset(cursor, kHeapAddressableMarker, body_bytes);
+  cursor += body_bytes;
+  if (body_size_mod > 0)
+    cursor[-1] = body_size_mod;
+  ::memset(cursor, kHeapRightPaddingMarker, right_redzone_bytes - 1);
+  ::memset(cursor + right_redzone_bytes - 1, trailer_marker, 1);
+}
+
+void ReferenceUnpoison(const void* addr, size_t size, uint8* shadow) {
+  uintptr_t index = reinterpret_cast<uintptr_t>(addr);
+  uint8 remainder = size & (kShadowRatio - 1);
+  index >>= kShadowRatioLog;
+  size >>= kShadowRatioLog;
+  ::memset(shadow + index, kHeapAddressableMarker, size);
+  if (remainder != 0)
+    shadow[index + size] = remainder;
+}
+
 }  // namespace
 
 TEST_F(ShadowTest, PoisonUnpoisonAccess) {
@@ -526,6 +566,82 @@ TEST_F(ShadowTest, MarkAsFreedPerfTest) {
   testing::EmitMetric("Syzygy.Asan.Shadow.MarkAsFreed", tnet);
 }
 
+TEST_F(ShadowTest, PoisonAllocatedBlockMatchesReference) {
+  std::vector<uint8> expected_shadow;
+  for (size_t body_size = 0; body_size < 300; ++body_size) {
+    for (size_t nested = 0; nested < 2; ++nested) {
+      BlockLayout layout = {};
+      ASSERT_TRUE(BlockPlanLayout(kShadowRatio, kShadowRatio, body_size,
+                                  body_size % 40, body_size % 24, &layout));
+      scoped_ptr<uint8[]> data(new uint8[layout.block_size]);
+      BlockInfo info = {};
+      BlockInitialize(layout, data.get(), nested != 0, &info);
+
+      const uint8* block_shadow =
+          test_shadow.GetShadowMemoryForAddress(info.header);
+      size_t block_shadow_size = layout.block_size / kShadowRatio;
+
+      ReferencePoisonAllocatedBlock(info, test_shadow.shadow_);
+      expected_shadow.assign(block_shadow, block_shadow + block_shadow_size);
+      test_shadow.Unpoison(info.header, layout.block_size);
+
+      test_shadow.PoisonAllocatedBlock(info);
+      EXPECT_EQ(0, ::memcmp(expected_shadow.data(), block_shadow,
+                            block_shadow_size));
+
+      test_shadow.Unpoison(info.header, layout.block_size);
+      for (size_t i = 0; i < block_shadow_size; ++i)
+        EXPECT_EQ(kHeapAddressableMarker, block_shadow[i]);
+    }
+  }
+}
+
+TEST_F(ShadowTest, AllocationSizePerfTest) {
+  static const size_t kBodySizes[] = {
+      8, 16, 32, 64, 128, 256, 512, 1024, 4096, 16384, 65536 };
+  static const size_t kIterations = 10000;
+
+  for (size_t i = 0; i < arraysize(kBodySizes); ++i) {
+    BlockLayout layout = {};
+    ASSERT_TRUE(BlockPlanLayout(kShadowRatio, kShadowRatio, kBodySizes[i],
+                                0, 0, &layout));
+    scoped_ptr<uint8[]> data(new uint8[layout.block_size]);
+    BlockInfo info = {};
+    BlockInitialize(layout, data.get(), false, &info);
+
+    // Time an allocation followed by a free and the eventual reuse of the
+    // memory, using the wide store implementations.
+    uint64 tnet = 0;
+    for (size_t j = 0; j < kIterations; ++j) {
+      uint64 t0 = ::__rdtsc();
+      test_shadow.PoisonAllocatedBlock(info);
+      test_shadow.MarkAsFreed(info.body, info.body_size);
+      test_shadow.Unpoison(info.header, info.block_size);
+      uint64 t1 = ::__rdtsc();
+      tnet += t1 - t0;
+    }
+    testing::EmitMetric(
+        base::StringPrintf("Syzygy.Asan.Shadow.AllocFree.%d",
+                           static_cast<int>(kBodySizes[i])),
+        tnet);
+
+    // The same, using the byte-wise implementations.
+    tnet = 0;
+    for (size_t j = 0; j < kIterations; ++j) {
+      uint64 t0 = ::__rdtsc();
+      ReferencePoisonAllocatedBlock(info, test_shadow.shadow_);
+      test_shadow.MarkAsFreed(info.body, info.body_size);
+      ReferenceUnpoison(info.header, info.block_size, test_shadow.shadow_);
+      uint64 t1 = ::__rdtsc();
+      tnet += t1 - t0;
+    }
+    testing::EmitMetric(
+        base::StringPrintf("Syzygy.Asan.Shadow.AllocFreeReference.%d",
+                           static_cast<int>(kBodySizes[i])),
+        tnet);
+  }
+}
+
 TEST_F(ShadowTest, PageBits) {
   // Set an individual page.
   const uint8* addr = reinterpret_cast<const uint8*>(16 * 4096);
@@ -728,5 +844,91 @@ TEST_F(ShadowWalkerTest, WalksNestedBlocks) {
   delete [] data;
 }
 
+namespace {
+
+// A fixture for benchmarks over a large synthetic shadow, held in caller
+// provided memory.
+class ShadowPerfTest : public testing::Test {
+ public:
+  // The shadow covers 2GB of memory.
+  static const size_t kShadowLength = 256 * 1024 * 1024;
+
+  ShadowPerfTest() : memory_(nullptr) { }
+
+  virtual void SetUp() override {
+    memory_ = ::VirtualAlloc(nullptr, kShadowLength, MEM_COMMIT,
+                             PAGE_READWRITE);
+    ASSERT_NE(static_cast<void*>(nullptr), memory_);
+  }
+
+  virtual void TearDown() override {
+    if (memory_ != nullptr)
+      ASSERT_TRUE(::VirtualFree(memory_, 0, MEM_RELEASE));
+  }
+
+  void* memory_;
+};
+
+}  // namespace
+
+TEST_F(ShadowPerfTest, IsCleanPerfTest) {
+  Shadow shadow(memory_, kShadowLength);
+
+  // The shadow must cover its own memory in order to poison it.
+  ASSERT_LE(reinterpret_cast<uintptr_t>(memory_) + kShadowLength,
+            shadow.memory_size());
+  shadow.SetUp();
+
+  uint64 tnet = 0;
+  for (size_t i = 0; i < 10; ++i) {
+    uint64 t0 = ::__rdtsc();
+    EXPECT_TRUE(shadow.IsClean());
+    uint64 t1 = ::__rdtsc();
+    tnet += t1 - t0;
+  }
+  testing::EmitMetric("Syzygy.Asan.Shadow.IsClean", tnet);
+
+  shadow.TearDown();
+}
+
+TEST_F(ShadowPerfTest, ShadowWalkerPerfTest) {
+  Shadow shadow(memory_, kShadowLength);
+
+  // Lay out a 4KB block in every page of the simulated memory, with a 7 byte
+  // body in the last shadow byte before the right redzone.
+  static const size_t kBlockSize = 4096;
+  static const size_t kBlockShadowSize = kBlockSize >> kShadowRatioLog;
+  uint8 block_shadow[kBlockShadowSize] = {};
+  block_shadow[0] = kHeapBlockStartMarker7;
+  ::memset(block_shadow + 1, kHeapLeftPaddingMarker, 3);
+  ::memset(block_shadow + kBlockShadowSize - 8, kHeapRightPaddingMarker, 7);
+  block_shadow[kBlockShadowSize - 1] = kHeapBlockEndMarker;
+
+  uint8* shadow_memory = reinterpret_cast<uint8*>(memory_);
+  const size_t kFirstBlock = Shadow::kAddressLowerBound >> kShadowRatioLog;
+  for (size_t i = kFirstBlock; i < kShadowLength; i += kBlockShadowSize)
+    ::memcpy(shadow_memory + i, block_shadow, kBlockShadowSize);
+  const size_t kBlockCount =
+      (shadow.memory_size() - Shadow::kAddressLowerBound) / kBlockSize;
+
+  const uint8* lower_bound =
+      reinterpret_cast<const uint8*>(Shadow::kAddressLowerBound);
+  const uint8* upper_bound = lower_bound + kBlockCount * kBlockSize;
+
+  uint64 tnet = 0;
+  for (size_t i = 0; i < 10; ++i) {
+    size_t block_count = 0;
+    BlockInfo info = {};
+    uint64 t0 = ::__rdtsc();
+    ShadowWalker walker(&shadow, false, lower_bound, upper_bound);
+    while (walker.Next(&info))
+      ++block_count;
+    uint64 t1 = ::__rdtsc();
+    tnet += t1 - t0;
+    EXPECT_EQ(kBlockCount, block_count);
+  }
+  testing::EmitMetric("Syzygy.Asan.ShadowWalker.Next", tnet);
+}
+
 }  // namespace asan
 }  // namespace agent
@@ -28,6 +28,12 @@ namespace asan {
 
 namespace {
 
+// The initial number of slots in a known stacks table.
+const size_t kInitialStackTableSize = 256;
+
+// The initial number of slots in the frame trie.
+const size_t kInitialFrameTrieSize = 1024;
+
 // Gives us access to the first frame of a stack capture as link-list pointer.
 common::StackCapture** GetFirstFrameAsLink(
     common::StackCapture* stack_capture) {
@@ -38,6 +44,16 @@ common::StackCapture** GetFirstFrameAsLink(
   return link;
 }
 
+// Gives us access to the innermost frame trie node of a stack capture that
+// was saved while the frame trie was enabled.
+const StackCaptureCache::FrameTrie::Node* GetFrameTrieNode(
+    const common::StackCapture* stack_capture) {
+  DCHECK_NE(static_cast<common::StackCapture*>(nullptr), stack_capture);
+  DCHECK_EQ(1u, stack_capture->num_frames());
+  return reinterpret_cast<const StackCaptureCache::FrameTrie::Node*>(
+      stack_capture->frames()[0]);
+}
+
 }  // namespace
 
 size_t StackCaptureCache::compression_reporting_period_ =
@@ -50,6 +66,15 @@ StackCaptureCache::CachePage::~CachePage() {
   DCHECK_EQ(static_cast<CachePage*>(nullptr), next_page_);
 }
 
+uint8* StackCaptureCache::CachePage::GetNextChunk(size_t size) {
+  if (bytes_used_ + size > kDataSize)
+    return nullptr;
+
+  uint8* chunk = data_ + bytes_used_;
+  bytes_used_ += size;
+  return chunk;
+}
+
 common::StackCapture* StackCaptureCache::CachePage::GetNextStackCapture(
     size_t max_num_frames, size_t metadata_size) {
   metadata_size = ::common::AlignUp(metadata_size, sizeof(void*));
@@ -98,20 +123,354 @@ bool StackCaptureCache::CachePage::ReturnStackCapture(
   return ReturnStackCapture(stack_capture, 0);
 }
 
+StackCaptureCache::FrameTrie::FrameTrie(StackCaptureCache* cache)
+    : cache_(cache),
+      slots_(kInitialFrameTrieSize, nullptr),
+      size_(0),
+      free_nodes_(nullptr),
+      chunk_next_(nullptr),
+      chunk_end_(nullptr) {
+  DCHECK_NE(static_cast<StackCaptureCache*>(nullptr), cache);
+}
+
+StackCaptureCache::FrameTrie::~FrameTrie() {
+  // The nodes live in the cache pages, which are cleaned up by the cache.
+}
+
+const StackCaptureCache::FrameTrie::Node*
+StackCaptureCache::FrameTrie::Insert(const void* const* frames,
+                                     size_t num_frames) {
+  DCHECK_NE(static_cast<const void* const*>(nullptr), frames);
+  DCHECK_LT(0u, num_frames);
+  DCHECK_GE(common::StackCapture::kMaxNumFrames, num_frames);
+
+  base::AutoLock auto_lock(lock_);
+
+  // Walk the runs of frames from the outermost one inwards, finding or
+  // inserting the node for each of them.
+  Node* caller = nullptr;
+  size_t end = num_frames;
+  while (end > 0) {
+    size_t begin = end > kFramesPerNode ? end - kFramesPerNode : 0;
+    const void* const* run = frames + begin;
+    size_t run_size = end - begin;
+
+    size_t slot = FindSlot(caller, run, run_size);
+    Node* node = slots_[slot];
+    if (node == nullptr) {
+      // Keep the load factor at or below one half.
+      if (2 * (size_ + 1) > slots_.size()) {
+        Grow();
+        slot = FindSlot(caller, run, run_size);
+      }
+
+      node = AllocateNode();
+      node->caller = caller;
+      node->ref_count = 0;
+      node->num_frames = static_cast<uint8>(run_size);
+      node->depth = static_cast<uint8>(num_frames - begin);
+      ::memcpy(node->frames, run, run_size * sizeof(*run));
+      slots_[slot] = node;
+      ++size_;
+
+      // The new node refers to its caller.
+      if (caller != nullptr)
+        ++caller->ref_count;
+    }
+
+    caller = node;
+    end = begin;
+  }
+
+  // The stack capture refers to the innermost node.
+  ++caller->ref_count;
+  return caller;
+}
+
+void StackCaptureCache::FrameTrie::Release(const Node* node) {
+  DCHECK_NE(static_cast<const Node*>(nullptr), node);
+
+  base::AutoLock auto_lock(lock_);
+
+  // Recycle nodes for as long as they become unreferenced. Each recycled node
+  // drops its reference to its caller.
+  Node* current = const_cast<Node*>(node);
+  while (current != nullptr) {
+    DCHECK_LT(0u, current->ref_count);
+    if (--current->ref_count != 0)
+      break;
+
+    Node* caller = current->caller;
+    EraseNode(current);
+    current->caller = free_nodes_;
+    free_nodes_ = current;
+    current = caller;
+  }
+}
+
+// static
+size_t StackCaptureCache::FrameTrie::GetFrames(const Node* node,
+                                               void** frames,
+                                               size_t max_num_frames) {
+  DCHECK_NE(static_cast<void**>(nullptr), frames);
+
+  size_t num_frames = 0;
+  for (; node != nullptr && num_frames < max_num_frames; node = node->caller) {
+    size_t count = std::min<size_t>(node->num_frames,
+                                    max_num_frames - num_frames);
+    ::memcpy(frames + num_frames, node->frames, count * sizeof(*frames));
+    num_frames += count;
+  }
+  return num_frames;
+}
+
+size_t StackCaptureCache::FrameTrie::num_nodes() const {
+  base::AutoLock auto_lock(lock_);
+  return size_;
+}
+
+// static
+size_t StackCaptureCache::FrameTrie::Hash(const Node* caller,
+                                          const void* const* frames,
+                                          size_t num_frames) {
+  // FNV-1a over the caller and the frames.
+  size_t hash = 2166136261u;
+  hash = (hash ^ reinterpret_cast<size_t>(caller)) * 16777619u;
+  for (size_t i = 0; i < num_frames; ++i)
+    hash = (hash ^ reinterpret_cast<size_t>(frames[i])) * 16777619u;
+  hash = (hash ^ num_frames) * 16777619u;
+  return hash ^ (hash >> 16);
+}
+
+size_t StackCaptureCache::FrameTrie::FindSlot(const Node* caller,
+                                              const void* const* frames,
+                                              size_t num_frames) const {
+  size_t mask = slots_.size() - 1;
+  size_t index = Hash(caller, frames, num_frames) & mask;
+  while (true) {
+    const Node* node = slots_[index];
+    if (node == nullptr)
+      return index;
+    if (node->caller == caller && node->num_frames == num_frames &&
+        ::memcmp(node->frames, frames, num_frames * sizeof(*frames)) == 0) {
+      return index;
+    }
+    index = (index + 1) & mask;
+  }
+}
+
+void StackCaptureCache::FrameTrie::EraseNode(Node* node) {
+  DCHECK_NE(static_cast<Node*>(nullptr), node);
+
+  size_t hole = FindSlot(node->caller, node->frames, node->num_frames);
+  DCHECK_EQ(node, slots_[hole]);
+
+  // Move later members of the probe sequence back into the hole, so that no
+  // tombstones are needed.
+  size_t mask = slots_.size() - 1;
+  size_t index = hole;
+  while (true) {
+    index = (index + 1) & mask;
+    Node* next = slots_[index];
+    if (next == nullptr)
+      break;
+
+    // The node can be moved into the hole if its home slot is not cyclically
+    // within (hole, index].
+    size_t home = Hash(next->caller, next->frames, next->num_frames) & mask;
+    if (((index - home) & mask) >= ((index - hole) & mask)) {
+      slots_[hole] = next;
+      hole = index;
+    }
+  }
+  slots_[hole] = nullptr;
+  --size_;
+}
+
+void StackCaptureCache::FrameTrie::Grow() {
+  std::vector<Node*> old_slots(2 * slots_.size(), nullptr);
+  old_slots.swap(slots_);
+
+  size_t mask = slots_.size() - 1;
+  for (size_t i = 0; i < old_slots.size(); ++i) {
+    Node* node = old_slots[i];
+    if (node == nullptr)
+      continue;
+    size_t index = Hash(node->caller, node->frames, node->num_frames) & mask;
+    while (slots_[index] != nullptr)
+      index = (index + 1) & mask;
+    slots_[index] = node;
+  }
+}
+
+StackCaptureCache::FrameTrie::Node*
+StackCaptureCache::FrameTrie::AllocateNode() {
+  if (free_nodes_ != nullptr) {
+    Node* node = free_nodes_;
+    free_nodes_ = node->caller;
+    return node;
+  }
+
+  if (chunk_next_ == nullptr ||
+      static_cast<size_t>(chunk_end_ - chunk_next_) < sizeof(Node)) {
+    if (chunk_next_ != nullptr)
+      cache_->ReclaimUnusedBytes(chunk_next_, chunk_end_);
+    cache_->GetThreadChunk(sizeof(Node), &chunk_next_, &chunk_end_);
+  }
+
+  Node* node = reinterpret_cast<Node*>(chunk_next_);
+  chunk_next_ += sizeof(Node);
+  return node;
+}
+
+StackCaptureCache::StackTable::StackTable() : slots_(0), size_(0) {
+  base::subtle::Release_Store(
+      &slots_, reinterpret_cast<base::subtle::AtomicWord>(
+          AllocateSlots(kInitialStackTableSize)));
+}
+
+StackCaptureCache::StackTable::~StackTable() {
+  ::operator delete(slots());
+  for (size_t i = 0; i < retired_slots_.size(); ++i)
+    ::operator delete(retired_slots_[i]);
+}
+
+common::StackCapture* StackCaptureCache::StackTable::Find(
+    StackId stack_id) const {
+  const Slots* slots = this->slots();
+  size_t index = HomeSlot(slots, stack_id);
+  for (size_t i = 0; i <= slots->mask; ++i) {
+    common::StackCapture* stack_capture =
+        reinterpret_cast<common::StackCapture*>(
+            base::subtle::Acquire_Load(&slots->slot[index]));
+    if (stack_capture == nullptr)
+      return nullptr;
+    if (stack_capture->stack_id() == stack_id)
+      return stack_capture;
+    index = (index + 1) & slots->mask;
+  }
+  return nullptr;
+}
+
+void StackCaptureCache::StackTable::Insert(
+    common::StackCapture* stack_capture) {
+  DCHECK_NE(static_cast<common::StackCapture*>(nullptr), stack_capture);
+
+  // Keep the load factor at or below one half.
+  if (2 * (size_ + 1) > slots()->mask + 1)
+    Grow();
+
+  Slots* slots = this->slots();
+  size_t index = HomeSlot(slots, stack_capture->stack_id());
+  while (base::subtle::NoBarrier_Load(&slots->slot[index]) != 0)
+    index = (index + 1) & slots->mask;
+
+  // The stack capture is fully initialized by now, so publish it with release
+  // semantics.
+  base::subtle::Release_Store(
+      &slots->slot[index],
+      reinterpret_cast<base::subtle::AtomicWord>(stack_capture));
+  ++size_;
+}
+
+void StackCaptureCache::StackTable::Erase(
+    common::StackCapture* stack_capture) {
+  DCHECK_NE(static_cast<common::StackCapture*>(nullptr), stack_capture);
+
+  Slots* slots = this->slots();
+  base::subtle::AtomicWord value =
+      reinterpret_cast<base::subtle::AtomicWord>(stack_capture);
+  size_t hole = HomeSlot(slots, stack_capture->stack_id());
+  while (base::subtle::NoBarrier_Load(&slots->slot[hole]) != value) {
+    DCHECK_NE(0, base::subtle::NoBarrier_Load(&slots->slot[hole]));
+    hole = (hole + 1) & slots->mask;
+  }
+
+  // Move later members of the probe sequence back into the hole, so that no
+  // tombstones are needed. Each stack capture is copied to its new slot before
+  // its old slot is overwritten, so a concurrent lookup sees it at least once
+  // unless it is racing past both slots, in which case its caller retries
+  // under the lock.
+  size_t index = hole;
+  while (true) {
+    index = (index + 1) & slots->mask;
+    base::subtle::AtomicWord next =
+        base::subtle::NoBarrier_Load(&slots->slot[index]);
+    if (next == 0)
+      break;
+
+    // The stack capture can be moved into the hole if its home slot is not
+    // cyclically within (hole, index].
+    size_t home = HomeSlot(
+        slots, reinterpret_cast<common::StackCapture*>(next)->stack_id());
+    if (((index - home) & slots->mask) >= ((index - hole) & slots->mask)) {
+      base::subtle::Release_Store(&slots->slot[hole], next);
+      hole = index;
+    }
+  }
+  base::subtle::Release_Store(&slots->slot[hole], 0);
+  --size_;
+}
+
+bool StackCaptureCache::StackTable::Contains(
+    const common::StackCapture* stack_capture) const {
+  DCHECK_NE(static_cast<common::StackCapture*>(nullptr), stack_capture);
+  return Find(stack_capture->stack_id()) == stack_capture;
+}
+
+// static
+StackCaptureCache::StackTable::Slots*
+StackCaptureCache::StackTable::AllocateSlots(size_t count) {
+  DCHECK_LT(0u, count);
+  DCHECK_EQ(0u, count & (count - 1));
+
+  size_t size = sizeof(Slots) + (count - 1) * sizeof(base::subtle::AtomicWord);
+  Slots* slots = reinterpret_cast<Slots*>(::operator new(size));
+  ::memset(slots, 0, size);
+  slots->mask = count - 1;
+  return slots;
+}
+
+// static
+size_t StackCaptureCache::StackTable::HomeSlot(const Slots* slots,
+                                               StackId stack_id) {
+  // The low bits of the ID select the shard, so mix the bits before masking.
+  size_t hash = stack_id;
+  hash ^= hash >> 16;
+  hash *= 0x85EBCA6B;
+  hash ^= hash >> 13;
+  return hash & slots->mask;
+}
+
+void StackCaptureCache::StackTable::Grow() {
+  Slots* old_slots = slots();
+  Slots* new_slots = AllocateSlots(2 * (old_slots->mask + 1));
+
+  for (size_t i = 0; i <= old_slots->mask; ++i) {
+    base::subtle::AtomicWord value =
+        base::subtle::NoBarrier_Load(&old_slots->slot[i]);
+    if (value == 0)
+      continue;
+    size_t index = HomeSlot(
+        new_slots, reinterpret_cast<common::StackCapture*>(value)->stack_id());
+    while (new_slots->slot[index] != 0)
+      index = (index + 1) & new_slots->mask;
+    new_slots->slot[index] = value;
+  }
+
+  // Concurrent lookups may still be reading the old slots.
+  retired_slots_.push_back(old_slots);
+  base::subtle::Release_Store(
+      &slots_, reinterpret_cast<base::subtle::AtomicWord>(new_slots));
+}
+
 StackCaptureCache::StackCaptureCache(
     AsanLogger* logger, MemoryNotifierInterface* memory_notifier)
     : logger_(logger),
       memory_notifier_(memory_notifier),
       max_num_frames_(common::StackCapture::kMaxNumFrames),
       current_page_(nullptr) {
-  DCHECK_NE(static_cast<AsanLogger*>(nullptr), logger);
-  DCHECK_NE(static_cast<MemoryNotifierInterface*>(nullptr), memory_notifier);
-
-  AllocateCachePage();
-
-  ::memset(&statistics_, 0, sizeof(statistics_));
-  ::memset(reclaimed_, 0, sizeof(reclaimed_));
-  statistics_.size = sizeof(CachePage);
+  Initialize();
 }
 
 StackCaptureCache::StackCaptureCache(
@@ -121,19 +480,31 @@ StackCaptureCache::StackCaptureCache(
       memory_notifier_(memory_notifier),
       max_num_frames_(0),
       current_page_(nullptr) {
-  DCHECK_NE(static_cast<AsanLogger*>(nullptr), logger);
-  DCHECK_NE(static_cast<MemoryNotifierInterface*>(nullptr), memory_notifier);
   DCHECK_LT(0u, max_num_frames);
   max_num_frames_ = static_cast<uint8>(
       std::min(max_num_frames, common::StackCapture::kMaxNumFrames));
+  Initialize();
+}
 
-  AllocateCachePage();
-  ::memset(&statistics_, 0, sizeof(statistics_));
-  ::memset(reclaimed_, 0, sizeof(reclaimed_));
-  statistics_.size = sizeof(CachePage);
+StackCaptureCache::StackCaptureCache(
+    AsanLogger* logger, MemoryNotifierInterface* memory_notifier,
+    size_t max_num_frames, FrameStorage frame_storage)
+    : logger_(logger),
+      memory_notifier_(memory_notifier),
+      max_num_frames_(0),
+      current_page_(nullptr),
+      frame_trie_(frame_storage == kFrameTrieStorage ? new FrameTrie(this)
+                                                     : nullptr) {
+  DCHECK_LT(0u, max_num_frames);
+  max_num_frames_ = static_cast<uint8>(
+      std::min(max_num_frames, common::StackCapture::kMaxNumFrames));
+  Initialize();
 }
 
 StackCaptureCache::~StackCaptureCache() {
+  ::TlsFree(thread_chunk_next_tls_);
+  ::TlsFree(thread_chunk_end_tls_);
+
   // Clean up the linked list of cache pages.
   while (current_page_ != nullptr) {
     CachePage* page = current_page_;
@@ -156,6 +527,15 @@ const common::StackCapture* StackCaptureCache::SaveStackTrace(
   DCHECK_NE(num_frames, 0U);
   DCHECK_NE(static_cast<CachePage*>(nullptr), current_page_);
 
+  // In the common case the stack trace is already cached and referenced, and
+  // can be shared without taking any locks. This is skipped when reporting
+  // statistics, as they are only kept consistent under the locks.
+  if (compression_reporting_period_ == 0) {
+    common::StackCapture* stack_trace = TryAddRefKnownStack(stack_id);
+    if (stack_trace != nullptr)
+      return stack_trace;
+  }
+
   bool already_cached = false;
   common::StackCapture* stack_trace = nullptr;
   bool saturated = false;
@@ -166,30 +546,34 @@ const common::StackCapture* StackCaptureCache::SaveStackTrace(
     // bucket.
     base::AutoLock auto_lock(known_stacks_locks_[known_stack_shard]);
 
-    // Check if the stack capture is already in the cache map.
-    common::StackCapture capture;
-    capture.set_stack_id(stack_id);
-    StackSet::iterator result = known_stacks_[known_stack_shard].find(&capture);
+    // Check if the stack capture is already in the cache. Under the lock this
+    // is authoritative, and everything in the table is referenced.
+    stack_trace = known_stacks_[known_stack_shard]->Find(stack_id);
 
     // If this capture has not already been cached then we have to initialize
-    // the data.
-    if (result == known_stacks_[known_stack_shard].end()) {
-      stack_trace = GetStackCapture(num_frames);
-      DCHECK_NE(static_cast<common::StackCapture*>(nullptr), stack_trace);
-      stack_trace->InitFromBuffer(stack_id, frames, num_frames);
-      std::pair<StackSet::iterator, bool> it =
-          known_stacks_[known_stack_shard].insert(stack_trace);
-      DCHECK(it.second);
+    // the data, and take the first reference before publishing it.
+    if (stack_trace == nullptr) {
+      if (frame_trie_.get() != nullptr) {
+        // The frames go in the trie, and the stack capture only holds a
+        // pointer to the innermost node.
+        const void* node = frame_trie_->Insert(frames, num_frames);
+        stack_trace = GetStackCapture(1);
+        DCHECK_NE(static_cast<common::StackCapture*>(nullptr), stack_trace);
+        stack_trace->InitFromBuffer(stack_id, &node, 1);
+      } else {
+        stack_trace = GetStackCapture(num_frames);
+        DCHECK_NE(static_cast<common::StackCapture*>(nullptr), stack_trace);
+        stack_trace->InitFromBuffer(stack_id, frames, num_frames);
+      }
       DCHECK(stack_trace->HasNoRefs());
-    } else {
-      already_cached = true;
-      stack_trace = *result;
-    }
-    // Increment the reference count for this stack trace.
-    if (!stack_trace->RefCountIsSaturated()) {
       stack_trace->AddRef();
+      known_stacks_[known_stack_shard]->Insert(stack_trace);
     } else {
-      saturated = true;
+      already_cached = true;
+      // Increment the reference count for this stack trace.
+      saturated = stack_trace->RefCountIsSaturated();
+      bool added = stack_trace->TryAddRef();
+      DCHECK(added);
     }
   }
   DCHECK_NE(static_cast<common::StackCapture*>(nullptr), stack_trace);
@@ -242,26 +626,90 @@ void StackCaptureCache::ReleaseStackTrace(
     const common::StackCapture* stack_capture) {
   DCHECK_NE(static_cast<common::StackCapture*>(nullptr), stack_capture);
 
-  size_t known_stack_shard = stack_capture->stack_id() % kKnownStacksSharding;
+  // We own the stack so its fine to remove the const.
+  common::StackCapture* stack = const_cast<common::StackCapture*>(
+      stack_capture);
+
+  // Unless this is the last reference, it can be dropped without taking any
+  // locks.
+  if (compression_reporting_period_ == 0 && stack->TryRemoveRef())
+    return;
+
+  ReleaseStackTraceLocked(stack);
+}
+
+size_t StackCaptureCache::GetNumFrames(
+    const common::StackCapture* stack_capture) const {
+  DCHECK_NE(static_cast<common::StackCapture*>(nullptr), stack_capture);
+  if (frame_trie_.get() != nullptr)
+    return GetFrameTrieNode(stack_capture)->depth;
+  return stack_capture->num_frames();
+}
+
+size_t StackCaptureCache::GetFrames(const common::StackCapture* stack_capture,
+                                    void** frames,
+                                    size_t max_num_frames) const {
+  DCHECK_NE(static_cast<common::StackCapture*>(nullptr), stack_capture);
+  DCHECK_NE(static_cast<void**>(nullptr), frames);
+
+  if (frame_trie_.get() != nullptr) {
+    return FrameTrie::GetFrames(GetFrameTrieNode(stack_capture), frames,
+                                max_num_frames);
+  }
+
+  size_t num_frames = std::min(stack_capture->num_frames(), max_num_frames);
+  ::memcpy(frames, stack_capture->frames(), num_frames * sizeof(*frames));
+  return num_frames;
+}
+
+common::StackCapture* StackCaptureCache::TryAddRefKnownStack(
+    StackId stack_id) {
+  size_t known_stack_shard = stack_id % kKnownStacksSharding;
+  common::StackCapture* stack_trace =
+      known_stacks_[known_stack_shard]->Find(stack_id);
+  if (stack_trace == nullptr)
+    return nullptr;
+
+  // The stack capture may have been released and reused for another stack
+  // trace since it was found. Referenced stack captures are never reused, so
+  // once we hold a reference its ID is stable and can be checked again.
+  if (!stack_trace->TryAddRef())
+    return nullptr;
+  if (stack_trace->stack_id() != stack_id) {
+    ReleaseStackTrace(stack_trace);
+    return nullptr;
+  }
+
+  return stack_trace;
+}
+
+void StackCaptureCache::ReleaseStackTraceLocked(common::StackCapture* stack) {
+  DCHECK_NE(static_cast<common::StackCapture*>(nullptr), stack);
+
+  // We still hold a reference, so the frames are still around.
+  size_t num_frames = GetNumFrames(stack);
+  size_t known_stack_shard = stack->stack_id() % kKnownStacksSharding;
   bool add_to_reclaimed_list = false;
-  common::StackCapture* stack = nullptr;
   {
     base::AutoLock auto_lock(known_stacks_locks_[known_stack_shard]);
+    DCHECK(known_stacks_[known_stack_shard]->Contains(stack));
+
+    // Drop our reference. Lock-free savers may concurrently add references
+    // as long as the stack capture is referenced, so the last reference is
+    // only released once no one else holds one.
+    while (!stack->TryRemoveRef()) {
+      if (stack->TryRemoveLastRef()) {
+        add_to_reclaimed_list = true;
+        break;
+      }
+    }
 
-    // We own the stack so its fine to remove the const. We double check this
-    // is the case in debug builds with the DCHECK.
-    stack = const_cast<common::StackCapture*>(stack_capture);
-    DCHECK(known_stacks_[known_stack_shard].find(stack) !=
-        known_stacks_[known_stack_shard].end());
-
-    stack->RemoveRef();
-
-    if (stack->HasNoRefs()) {
-      add_to_reclaimed_list = true;
+    if (add_to_reclaimed_list) {
       // Remove this from the known stacks as we're going to reclaim it and
       // overwrite part of its data as we insert into the reclaimed_ list.
-      size_t num_erased = known_stacks_[known_stack_shard].erase(stack);
-      DCHECK_EQ(num_erased, 1u);
+      known_stacks_[known_stack_shard]->Erase(stack);
+      if (frame_trie_.get() != nullptr)
+        frame_trie_->Release(GetFrameTrieNode(stack));
     }
   }
 
@@ -270,12 +718,12 @@ void StackCaptureCache::ReleaseStackTrace(
     base::AutoLock stats_lock(stats_lock_);
     DCHECK_LT(0u, statistics_.references);
     --statistics_.references;
-    statistics_.frames_stored -= stack->num_frames();
+    statistics_.frames_stored -= num_frames;
     if (add_to_reclaimed_list) {
       --statistics_.cached;
       ++statistics_.unreferenced;
       // The frames in this stack capture are no longer alive.
-      statistics_.frames_alive -= stack->num_frames();
+      statistics_.frames_alive -= num_frames;
     }
   }
 
@@ -286,6 +734,19 @@ void StackCaptureCache::ReleaseStackTrace(
     AddStackCaptureToReclaimedList(stack);
 }
 
+void StackCaptureCache::ReleaseThreadChunk() {
+  uint8* chunk_next =
+      reinterpret_cast<uint8*>(::TlsGetValue(thread_chunk_next_tls_));
+  if (chunk_next == nullptr)
+    return;
+  uint8* chunk_end =
+      reinterpret_cast<uint8*>(::TlsGetValue(thread_chunk_end_tls_));
+
+  ReclaimUnusedBytes(chunk_next, chunk_end);
+  ::TlsSetValue(thread_chunk_next_tls_, nullptr);
+  ::TlsSetValue(thread_chunk_end_tls_, nullptr);
+}
+
 bool StackCaptureCache::StackCapturePointerIsValid(
     const common::StackCapture* stack_capture) {
   // All stack captures must have pointer alignment at least.
@@ -303,10 +764,12 @@ bool StackCaptureCache::StackCapturePointerIsValid(
 
     // If the proposed stack capture lands within a page we then check to
     // ensure that it is also internally consistent. This can still fail
-    // but is somewhat unlikely.
+    // but is somewhat unlikely. The unused tail of a thread chunk is zeroed,
+    // and so has no frames.
     static const size_t kMinSize = common::StackCapture::GetSize(1);
     if (stack_capture_addr >= page->data() &&
         stack_capture_addr + kMinSize <= page_end &&
+        stack_capture->max_num_frames() != 0 &&
         stack_capture_addr + stack_capture->Size() <= page_end &&
         stack_capture->num_frames() <= stack_capture->max_num_frames() &&
         stack_capture->max_num_frames() <=
@@ -329,6 +792,25 @@ void StackCaptureCache::LogStatistics()  {
   LogStatisticsImpl(statistics);
 }
 
+void StackCaptureCache::Initialize() {
+  DCHECK_NE(static_cast<AsanLogger*>(nullptr), logger_);
+  DCHECK_NE(static_cast<MemoryNotifierInterface*>(nullptr), memory_notifier_);
+
+  for (size_t i = 0; i < kKnownStacksSharding; ++i)
+    known_stacks_[i].reset(new StackTable());
+
+  thread_chunk_next_tls_ = ::TlsAlloc();
+  CHECK_NE(TLS_OUT_OF_INDEXES, thread_chunk_next_tls_);
+  thread_chunk_end_tls_ = ::TlsAlloc();
+  CHECK_NE(TLS_OUT_OF_INDEXES, thread_chunk_end_tls_);
+
+  AllocateCachePage();
+
+  ::memset(&statistics_, 0, sizeof(statistics_));
+  ::memset(reclaimed_, 0, sizeof(reclaimed_));
+  statistics_.size = sizeof(CachePage);
+}
+
 void StackCaptureCache::AllocateCachePage() {
   static_assert(sizeof(CachePage) % (64 * 1024) == 0,
                 "kCachePageSize should be a multiple of the system allocation "
@@ -424,53 +906,93 @@ common::StackCapture* StackCaptureCache::GetStackCapture(size_t num_frames) {
     return stack_capture;
   }
 
-  common::StackCapture* unused_stack_capture = nullptr;
+  // We didn't find a reusable stack capture. Carve one out of this thread's
+  // chunk of a cache page, which doesn't require any locks.
+  size_t size = common::StackCapture::GetSize(num_frames);
+  uint8* chunk_next =
+      reinterpret_cast<uint8*>(::TlsGetValue(thread_chunk_next_tls_));
+  uint8* chunk_end =
+      reinterpret_cast<uint8*>(::TlsGetValue(thread_chunk_end_tls_));
+  if (chunk_next == nullptr ||
+      static_cast<size_t>(chunk_end - chunk_next) < size) {
+    // Stuff whatever is left of the chunk into the reclaimed_ structure for
+    // later use, and get a new chunk.
+    if (chunk_next != nullptr)
+      ReclaimUnusedBytes(chunk_next, chunk_end);
+    GetThreadChunk(size, &chunk_next, &chunk_end);
+    ::TlsSetValue(thread_chunk_end_tls_, chunk_end);
+  }
+
+  stack_capture = new(chunk_next) common::StackCapture(num_frames);
+  ::TlsSetValue(thread_chunk_next_tls_, chunk_next + size);
+
+  return stack_capture;
+}
+
+void StackCaptureCache::GetThreadChunk(size_t min_size,
+                                       uint8** chunk_begin,
+                                       uint8** chunk_end) {
+  DCHECK_LE(min_size, kThreadChunkSize);
+  DCHECK_NE(static_cast<uint8**>(nullptr), chunk_begin);
+  DCHECK_NE(static_cast<uint8**>(nullptr), chunk_end);
+
+  uint8* unused_begin = nullptr;
+  uint8* unused_end = nullptr;
+  uint8* chunk = nullptr;
+  size_t chunk_size = 0;
   {
     base::AutoLock current_page_lock(current_page_lock_);
 
-    // We didn't find a reusable stack capture. Go to the cache page.
-    stack_capture = current_page_->GetNextStackCapture(num_frames);
+    chunk_size = std::min(kThreadChunkSize, current_page_->bytes_left());
+    if (chunk_size < min_size) {
+      // We don't have enough room on the current page. The remaining bytes
+      // will be turned into one more maximally sized stack capture.
+      unused_begin = current_page_->GetNextChunk(chunk_size);
+      unused_end = unused_begin + chunk_size;
+
+      // Allocate a new page (that links to the current page) and use it to
+      // allocate the chunk.
+      AllocateCachePage();
+      chunk_size = kThreadChunkSize;
+    }
 
-    if (stack_capture != nullptr)
-      return stack_capture;
+    chunk = current_page_->GetNextChunk(chunk_size);
+    DCHECK_NE(static_cast<uint8*>(nullptr), chunk);
+  }
 
-    // If the allocation failed we don't have enough room on the current page.
-
-    // Use the remaining bytes to create one more maximally sized stack
-    // capture. We will stuff this into the reclaimed_ structure for later
-    // use.
-    size_t bytes_left = current_page_->bytes_left();
-    size_t max_num_frames = common::StackCapture::GetMaxNumFrames(bytes_left);
-    if (max_num_frames > 0) {
-      DCHECK_LT(max_num_frames, num_frames);
-      DCHECK_LE(common::StackCapture::GetSize(max_num_frames), bytes_left);
-      unused_stack_capture =
-          current_page_->GetNextStackCapture(max_num_frames);
-      DCHECK_NE(static_cast<common::StackCapture*>(nullptr),
-                unused_stack_capture);
-    }
+  if (unused_begin != nullptr) {
+    ReclaimUnusedBytes(unused_begin, unused_end);
 
-    // Allocate a new page (that links to the current page) and use it to
-    // allocate a new stack capture.
-    current_page_ = new CachePage(current_page_);
-    CHECK_NE(static_cast<CachePage*>(nullptr), current_page_);
+    // Update the statistics.
+    base::AutoLock stats_lock(stats_lock_);
     statistics_.size += sizeof(CachePage);
-    stack_capture = current_page_->GetNextStackCapture(num_frames);
   }
 
-  if (unused_stack_capture != nullptr) {
-    // We're creating an unreferenced stack capture.
-    AddStackCaptureToReclaimedList(unused_stack_capture);
-  }
+  *chunk_begin = chunk;
+  *chunk_end = chunk + chunk_size;
+}
+
+void StackCaptureCache::ReclaimUnusedBytes(uint8* begin, uint8* end) {
+  DCHECK_LE(begin, end);
+
+  size_t bytes_left = end - begin;
+  size_t max_num_frames = std::min(
+      common::StackCapture::GetMaxNumFrames(bytes_left),
+      common::StackCapture::kMaxNumFrames);
+  if (max_num_frames == 0)
+    return;
+
+  // We're creating an unreferenced stack capture.
+  DCHECK_LE(common::StackCapture::GetSize(max_num_frames), bytes_left);
+  common::StackCapture* unused_stack_capture =
+      new(begin) common::StackCapture(max_num_frames);
+  AddStackCaptureToReclaimedList(unused_stack_capture);
 
   // Update the statistics.
   if (compression_reporting_period_ != 0) {
     base::AutoLock stats_lock(stats_lock_);
     ++statistics_.unreferenced;
   }
-
-  DCHECK_NE(static_cast<common::StackCapture*>(nullptr), stack_capture);
-  return stack_capture;
 }
 
 namespace {
@@ -15,6 +15,12 @@
 #ifndef SYZYGY_AGENT_ASAN_STACK_CAPTURE_CACHE_H_
 #define SYZYGY_AGENT_ASAN_STACK_CAPTURE_CACHE_H_
 
+#include <windows.h>
+
+#include <vector>
+
+#include "base/atomicops.h"
+#include "base/memory/scoped_ptr.h"
 #include "base/synchronization/lock.h"
 #include "syzygy/agent/asan/shadow.h"
 #include "syzygy/agent/common/stack_capture.h"
@@ -28,6 +34,21 @@ class AsanLogger;
 class MemoryNotifierInterface;
 
 // A class which manages a thread-safe cache of unique stack traces, by ID.
+//
+// Saving a stack trace that is already in the cache, and releasing a stack
+// trace that remains referenced, are lock-free: they look the stack up in a
+// concurrently readable hash table and atomically adjust its reference count.
+// Only inserting a new stack trace and releasing the last reference to one go
+// through the per-shard locks. New stack captures are carved out of per-thread
+// chunks of the cache pages, so that threads don't contend for the current
+// page. When compression reporting is enabled every operation takes the locked
+// path, so that the statistics remain exact.
+//
+// Optionally the frames of the cached stack traces can be stored in a prefix
+// tree rooted at their outermost frames, so that stack traces sharing callers
+// share storage for them. In this mode the stack captures handed out by the
+// cache hold a reference to their innermost node rather than their frames, and
+// must be expanded with GetFrames.
 class StackCaptureCache {
  public:
   // The size of a page of stack captures, in bytes. This should be in the
@@ -36,11 +57,26 @@ class StackCaptureCache {
   // incremental growth is not too large.
   static const size_t kCachePageSize = 1024 * 1024;
 
+  // The size of the chunks of a cache page that are handed out to individual
+  // threads, in bytes. This is enough for 64 maximally sized stack captures.
+  static const size_t kThreadChunkSize = 16 * 1024;
+
   // The type used to uniquely identify a stack.
   typedef common::StackCapture::StackId StackId;
 
-  // Forward declaration.
+  // The ways in which the frames of the cached stack traces can be stored.
+  // This is fixed for the lifetime of a cache.
+  enum FrameStorage {
+    // Each stack capture holds its own frames.
+    kFlatFrameStorage,
+    // The frames are held in a prefix tree shared between the stack captures.
+    kFrameTrieStorage,
+  };
+
+  // Forward declarations.
   class CachePage;
+  class FrameTrie;
+  class StackTable;
 
   // TODO(chrisha): Plumb a command-line parameter through to control the
   //     max depth of stack traces in the StackCaptureCache. This should get us
@@ -56,6 +92,12 @@ class StackCaptureCache {
   StackCaptureCache(AsanLogger* logger,
                     MemoryNotifierInterface* memory_notifier,
                     size_t max_num_frames);
+  // @param frame_storage The way in which the frames of the stack traces are
+  //     stored.
+  StackCaptureCache(AsanLogger* logger,
+                    MemoryNotifierInterface* memory_notifier,
+                    size_t max_num_frames,
+                    FrameStorage frame_storage);
 
   // Destroys a stack capture cache.
   ~StackCaptureCache();
@@ -73,6 +115,9 @@ class StackCaptureCache {
     max_num_frames_ = max_num_frames;
   }
 
+  // @returns true if the frames of stack traces are stored in a prefix tree.
+  bool frame_trie_enabled() const { return frame_trie_.get() != nullptr; }
+
   // @returns the default compression reporting period value.
   static size_t GetDefaultCompressionReportingPeriod() {
     return ::common::kDefaultReportingPeriod;
@@ -111,6 +156,25 @@ class StackCaptureCache {
   // @param stack_capture The stack capture to be released.
   void ReleaseStackTrace(const common::StackCapture* stack_capture);
 
+  // Returns the unused part of the calling thread's chunk of a cache page to
+  // the cache, so that other threads can use it. This must be called when a
+  // thread exits, or the unused part of its chunk is lost.
+  void ReleaseThreadChunk();
+
+  // @param stack_capture A referenced stack capture returned by this cache.
+  // @returns the number of frames in the stack trace.
+  size_t GetNumFrames(const common::StackCapture* stack_capture) const;
+
+  // Copies the frames of a stack trace, innermost first. This works in either
+  // storage mode, and is how the frames of cached stack traces should be read.
+  // @param stack_capture A referenced stack capture returned by this cache.
+  // @param frames The array that will receive the frames.
+  // @param max_num_frames The size of @p frames.
+  // @returns the number of frames copied.
+  size_t GetFrames(const common::StackCapture* stack_capture,
+                   void** frames,
+                   size_t max_num_frames) const;
+
   // Logs the current stack capture cache statistics. This method is thread
   // safe.
   void LogStatistics();
@@ -122,12 +186,6 @@ class StackCaptureCache {
   bool StackCapturePointerIsValid(const common::StackCapture* stack_capture);
 
  protected:
-  // The container type in which we store the cached stacks. This enforces
-  // uniqueness based on their hash value, nothing more.
-  typedef base::hash_set<common::StackCapture*,
-                         common::StackCapture::HashCompare,
-                         common::StackCapture::HashCompare> StackSet;
-
   // Used for shuttling around statistics about this cache.
   struct Statistics {
     // The total number of stacks currently in the cache.
@@ -172,9 +230,25 @@ class StackCaptureCache {
     // @}
   };
 
-  // Allocates a CachePage.
+  // Sets up the state shared by the constructors.
+  void Initialize();
+
+  // Allocates a CachePage. Must be called under current_page_lock_, or from
+  // the constructor.
   void AllocateCachePage();
 
+  // Looks up an already cached stack trace and adds a reference to it, without
+  // taking any locks.
+  // @param stack_id The ID of the stack trace to look up.
+  // @returns the stack capture, or nullptr if it could not be found. A stack
+  //     trace that is concurrently being inserted or removed may be missed.
+  common::StackCapture* TryAddRefKnownStack(StackId stack_id);
+
+  // Implementation of ReleaseStackTrace, once the reference count is known to
+  // need adjusting under the lock.
+  // @param stack The stack capture to be released.
+  void ReleaseStackTraceLocked(common::StackCapture* stack);
+
   // Gets the current cache statistics. This must be called under lock_.
   // @param statistics Will be populated with current cache statistics.
   void GetStatisticsUnlocked(Statistics* statistics) const;
@@ -183,11 +257,24 @@ class StackCaptureCache {
   // @param report The statistics to be reported.
   void LogStatisticsImpl(const Statistics& statistics) const;
 
-  // Grabs a temporary StackCapture from reclaimed_ or the current CachePage.
-  // Must be called under lock_. Takes care of updating frames_dead.
+  // Grabs a temporary StackCapture from reclaimed_ or from the calling
+  // thread's chunk of a CachePage. Takes care of updating frames_dead.
   // @param num_frames The minimum number of frames that are required.
   common::StackCapture* GetStackCapture(size_t num_frames);
 
+  // Hands out a new chunk of the current CachePage to the calling thread, or to
+  // the frame trie, allocating a new page if necessary.
+  // @param min_size The minimum size of the chunk.
+  // @param chunk_begin Will receive the beginning of the chunk.
+  // @param chunk_end Will receive the end of the chunk.
+  void GetThreadChunk(size_t min_size, uint8** chunk_begin, uint8** chunk_end);
+
+  // Turns unused bytes of a CachePage into one maximally sized stack capture,
+  // and links it into the reclaimed_ list.
+  // @param begin The beginning of the unused bytes.
+  // @param end The end of the unused bytes.
+  void ReclaimUnusedBytes(uint8* begin, uint8* end);
+
   // Links a stack capture into the reclaimed_ list. Meant to be called by
   // ReturnStackCapture only. Must be called under lock_. Takes care of
   // updating frames_dead (on behalf of ReturnStackCapture).
@@ -208,23 +295,35 @@ class StackCaptureCache {
   // The memory notifier that is informed of allocations made by the cache.
   MemoryNotifierInterface* memory_notifier_;
 
-  // Locks to protect the known stacks sets from concurrent access.
+  // Locks to serialize updates to the known stacks tables, and the transitions
+  // of their stack captures to and from being unreferenced.
   mutable base::Lock known_stacks_locks_[kKnownStacksSharding];
 
   // The max depth of the stack traces to allocate. This can change, but it
   // doesn't really make sense to do so.
   size_t max_num_frames_;
 
-  // The sets of known stacks. Accessed under known_stacks_locks_.
-  StackSet known_stacks_[kKnownStacksSharding];
+  // The tables of known stacks. Updated under known_stacks_locks_, but may be
+  // read without it.
+  scoped_ptr<StackTable> known_stacks_[kKnownStacksSharding];
 
   // A lock protecting access to current_page_.
   base::Lock current_page_lock_;
 
-  // The current page from which new stack captures are allocated.
+  // The current page from which thread chunks are allocated.
   // Accessed under current_page_lock_.
   CachePage* current_page_;
 
+  // The TLS slots holding the calling thread's allocation cursor and the end
+  // of its current chunk.
+  DWORD thread_chunk_next_tls_;
+  DWORD thread_chunk_end_tls_;
+
+  // The prefix tree holding the frames of the cached stack traces, if they
+  // are stored that way. This is set at construction and never changes, so it
+  // can be read without synchronization.
+  const scoped_ptr<FrameTrie> frame_trie_;
+
   // A lock protecting access to statistics_.
   mutable base::Lock stats_lock_;
 
@@ -252,6 +351,13 @@ class StackCaptureCache::CachePage {
 
   ~CachePage();
 
+  // Reserves a run of bytes from this cache page, which will later be carved
+  // into stack captures.
+  // @param size The number of bytes to reserve.
+  // @returns a pointer to the reserved bytes, or nullptr if the page doesn't
+  //     have enough bytes left.
+  uint8* GetNextChunk(size_t size);
+
   // Allocates a stack capture from this cache page if possible.
   // @param max_num_frames The maximum number of frames the object needs to be
   //     able to store.
@@ -317,6 +423,176 @@ COMPILE_ASSERT(sizeof(StackCaptureCache::CachePage) ==
 COMPILE_ASSERT(StackCaptureCache::kCachePageSize % 4096 == 0,
                kCachePageSize_should_be_a_multiple_of_the_page_size);
 
+// A prefix tree of stack frames, rooted at the outermost frames of the stack
+// traces. Each node holds a run of up to kFramesPerNode consecutive frames and
+// links to the node holding the frames of their callers. Runs are aligned to
+// the outermost end of the stack traces, so stack traces with a common suffix
+// of callers share the nodes for it. Nodes are interned in a hash table keyed
+// by their caller and frames, which makes inserting a stack trace O(depth).
+// Nodes are reference counted by the stack captures and callee nodes that
+// refer to them, and recycled once unreferenced. This class is thread safe.
+class StackCaptureCache::FrameTrie {
+ public:
+  // The maximum number of frames held by a node.
+  static const size_t kFramesPerNode = 8;
+
+  struct Node {
+    // The node holding the calling frames, or nullptr for an outermost node.
+    // This also links free nodes.
+    Node* caller;
+    // The number of stack captures and callee nodes referring to this node.
+    uint32 ref_count;
+    // The number of frames in this node.
+    uint8 num_frames;
+    // The number of frames in this node and all of its callers.
+    uint8 depth;
+    // The frames in this node, innermost first.
+    const void* frames[kFramesPerNode];
+  };
+
+  // @param cache The cache from whose pages nodes are allocated.
+  explicit FrameTrie(StackCaptureCache* cache);
+  ~FrameTrie();
+
+  // Finds or inserts the nodes holding a stack trace, and adds a reference to
+  // the innermost one.
+  // @param frames The frames of the stack trace, innermost first.
+  // @param num_frames The number of frames. Must be at least one.
+  // @returns the innermost node.
+  const Node* Insert(const void* const* frames, size_t num_frames);
+
+  // Releases a reference to a node returned by Insert, recycling any nodes
+  // that become unreferenced.
+  // @param node The node to release.
+  void Release(const Node* node);
+
+  // Copies the frames of a stack trace, innermost first.
+  // @param node The innermost node of the stack trace.
+  // @param frames The array that will receive the frames.
+  // @param max_num_frames The size of @p frames.
+  // @returns the number of frames copied.
+  static size_t GetFrames(const Node* node,
+                          void** frames,
+                          size_t max_num_frames);
+
+  // @returns the number of nodes in use.
+  size_t num_nodes() const;
+
+ protected:
+  // @returns the hash of a node with the given contents.
+  static size_t Hash(const Node* caller,
+                     const void* const* frames,
+                     size_t num_frames);
+
+  // Finds the slot holding a node with the given contents, or the empty slot
+  // where it would be inserted. Must be called under lock_.
+  size_t FindSlot(const Node* caller,
+                  const void* const* frames,
+                  size_t num_frames) const;
+
+  // Removes a node from the table. Must be called under lock_.
+  void EraseNode(Node* node);
+
+  // Doubles the size of the table. Must be called under lock_.
+  void Grow();
+
+  // Allocates an uninitialized node. Must be called under lock_.
+  Node* AllocateNode();
+
+  // The cache from whose pages nodes are allocated.
+  StackCaptureCache* cache_;
+
+  // Protects all of the following.
+  mutable base::Lock lock_;
+
+  // The interned nodes, in an open-addressed table whose size is a power of
+  // two. Empty slots are nullptr.
+  std::vector<Node*> slots_;
+
+  // The number of nodes in slots_.
+  size_t size_;
+
+  // Recycled nodes, linked through their caller field.
+  Node* free_nodes_;
+
+  // The chunk of a cache page from which new nodes are carved.
+  uint8* chunk_next_;
+  uint8* chunk_end_;
+
+ private:
+  DISALLOW_COPY_AND_ASSIGN(FrameTrie);
+};
+
+// An open-addressed hash table of the stack captures in a known stacks shard.
+// Lookups may run concurrently with updates, but updates must be serialized by
+// the caller. A concurrent lookup may return a stack capture that has since
+// been removed, or miss one that is being moved, so callers must validate what
+// they find and confirm misses under the lock. Slot arrays that have been
+// outgrown are kept alive until the table is destroyed, as concurrent lookups
+// may still be reading them.
+class StackCaptureCache::StackTable {
+ public:
+  StackTable();
+  ~StackTable();
+
+  // Looks up a stack capture by ID. This may be called without holding the
+  // lock that serializes updates.
+  // @param stack_id The ID to look up.
+  // @returns the stack capture with the given ID, or nullptr if none is found.
+  common::StackCapture* Find(StackId stack_id) const;
+
+  // Inserts a stack capture whose ID is not yet in the table.
+  // @param stack_capture The stack capture to insert.
+  void Insert(common::StackCapture* stack_capture);
+
+  // Removes a stack capture from the table.
+  // @param stack_capture The stack capture to remove.
+  void Erase(common::StackCapture* stack_capture);
+
+  // @returns true if @p stack_capture is in the table.
+  bool Contains(const common::StackCapture* stack_capture) const;
+
+  // @returns the number of stack captures in the table.
+  size_t size() const { return size_; }
+
+ protected:
+  // An array of slots. Each slot holds a pointer to a stack capture, or zero
+  // if it is empty.
+  struct Slots {
+    // The number of slots minus one. The number of slots is a power of two.
+    size_t mask;
+    base::subtle::AtomicWord slot[1];
+  };
+
+  // Allocates a zeroed array of slots.
+  // @param count The number of slots. Must be a power of two.
+  static Slots* AllocateSlots(size_t count);
+
+  // @returns the preferred slot of the given ID in @p slots.
+  static size_t HomeSlot(const Slots* slots, StackId stack_id);
+
+  // @returns the current slots.
+  Slots* slots() const {
+    return reinterpret_cast<Slots*>(base::subtle::Acquire_Load(&slots_));
+  }
+
+  // Doubles the number of slots.
+  void Grow();
+
+  // The current slots. This is a Slots* that is published with release
+  // semantics.
+  base::subtle::AtomicWord slots_;
+
+  // The number of stack captures in the table.
+  size_t size_;
+
+  // Outgrown slot arrays.
+  std::vector<Slots*> retired_slots_;
+
+ private:
+  DISALLOW_COPY_AND_ASSIGN(StackTable);
+};
+
 }  // namespace asan
 }  // namespace agent
 
@@ -15,9 +15,13 @@
 #include "syzygy/agent/asan/stack_capture_cache.h"
 
 #include "base/memory/scoped_ptr.h"
+#include "base/memory/scoped_vector.h"
+#include "base/strings/stringprintf.h"
+#include "base/threading/simple_thread.h"
 #include "gtest/gtest.h"
 #include "syzygy/agent/asan/logger.h"
 #include "syzygy/agent/asan/memory_notifiers/null_memory_notifier.h"
+#include "syzygy/testing/metrics.h"
 
 namespace agent {
 namespace asan {
@@ -36,6 +40,10 @@ class TestStackCaptureCache : public StackCaptureCache {
   TestStackCaptureCache(AsanLogger* logger, size_t max_num_frames)
       : StackCaptureCache(logger, &null_memory_notifier, max_num_frames) {
   }
+  TestStackCaptureCache(AsanLogger* logger, FrameStorage frame_storage)
+      : StackCaptureCache(logger, &null_memory_notifier,
+                          StackCapture::kMaxNumFrames, frame_storage) {
+  }
 
   using StackCaptureCache::Statistics;
 
@@ -47,6 +55,30 @@ class TestStackCaptureCache : public StackCaptureCache {
 
   CachePage* current_page() { return current_page_; }
 
+  // @returns the number of bytes handed out from the cache pages.
+  size_t GetBytesUsed() {
+    base::AutoLock auto_lock(current_page_lock_);
+    size_t bytes_used = 0;
+    for (CachePage* page = current_page_; page != nullptr;
+         page = page->next_page_) {
+      bytes_used += page->bytes_used();
+    }
+    return bytes_used;
+  }
+
+  // @returns the number of nodes in the frame trie.
+  size_t GetFrameTrieSize() { return frame_trie_->num_nodes(); }
+
+  // @returns the total number of stack captures in the known stacks tables.
+  size_t GetKnownStacksSize() {
+    size_t size = 0;
+    for (size_t i = 0; i < kKnownStacksSharding; ++i) {
+      base::AutoLock auto_lock(known_stacks_locks_[i]);
+      size += known_stacks_[i]->size();
+    }
+    return size;
+  }
+
  private:
   using StackCaptureCache::current_page_;
 };
@@ -60,6 +92,96 @@ class StackCaptureCacheTest : public testing::Test {
   }
 };
 
+// Repeatedly saves and releases stack traces, keeping a few of them referenced
+// at any time. Half of the stack traces are shared with the other threads, and
+// half are private to this thread.
+class SaveReleaseRunner : public base::DelegateSimpleThread::Delegate {
+ public:
+  static const size_t kHeldStacks = 8;
+  static const size_t kStacksPerThread = 64;
+
+  SaveReleaseRunner(StackCaptureCache* cache,
+                    size_t thread_index,
+                    size_t iterations)
+      : cache_(cache), thread_index_(thread_index), iterations_(iterations),
+        errors_(0) {
+  }
+
+  void Run() override {
+    const StackCapture* held[kHeldStacks] = {};
+    void* frames[StackCapture::kMaxNumFrames] = {};
+
+    for (size_t i = 0; i < iterations_; ++i) {
+      size_t slot = i % kHeldStacks;
+      if (held[slot] != nullptr)
+        cache_->ReleaseStackTrace(held[slot]);
+
+      // Every other stack trace is shared with the other threads.
+      StackCapture::StackId stack_id = (i * 7919) % kStacksPerThread + 1;
+      if (i % 2 == 1)
+        stack_id += (thread_index_ + 1) * kStacksPerThread;
+      size_t num_frames = 1 + stack_id % 24;
+
+      // The outermost frames are shared by stack traces of the same length.
+      frames[0] = reinterpret_cast<void*>(stack_id);
+      for (size_t j = 1; j < num_frames; ++j)
+        frames[j] = reinterpret_cast<void*>(num_frames * 64 + j);
+
+      held[slot] = cache_->SaveStackTrace(stack_id, frames, num_frames);
+      void* saved_frames[StackCapture::kMaxNumFrames] = {};
+      if (held[slot]->stack_id() != stack_id ||
+          cache_->GetNumFrames(held[slot]) != num_frames ||
+          cache_->GetFrames(held[slot], saved_frames,
+                            arraysize(saved_frames)) != num_frames ||
+          saved_frames[num_frames - 1] != frames[num_frames - 1]) {
+        ++errors_;
+      }
+    }
+
+    for (size_t i = 0; i < kHeldStacks; ++i) {
+      if (held[i] != nullptr)
+        cache_->ReleaseStackTrace(held[i]);
+    }
+  }
+
+  size_t errors() const { return errors_; }
+
+ private:
+  StackCaptureCache* cache_;
+  size_t thread_index_;
+  size_t iterations_;
+  size_t errors_;
+};
+
+// Runs SaveReleaseRunners on @p num_threads threads concurrently.
+// @returns the number of cycles it took for all of them to finish.
+uint64 RunSaveReleaseThreads(StackCaptureCache* cache,
+                             size_t num_threads,
+                             size_t iterations,
+                             size_t* errors) {
+  ScopedVector<SaveReleaseRunner> runners;
+  ScopedVector<base::DelegateSimpleThread> threads;
+  for (size_t i = 0; i < num_threads; ++i) {
+    runners.push_back(new SaveReleaseRunner(cache, i, iterations));
+    threads.push_back(new base::DelegateSimpleThread(
+        runners.back(),
+        base::StringPrintf("SaveReleaseRunner%d", static_cast<int>(i))));
+  }
+
+  uint64 t0 = ::__rdtsc();
+  for (size_t i = 0; i < num_threads; ++i)
+    threads[i]->Start();
+  for (size_t i = 0; i < num_threads; ++i)
+    threads[i]->Join();
+  uint64 t1 = ::__rdtsc();
+
+  *errors = 0;
+  for (size_t i = 0; i < num_threads; ++i)
+    *errors += runners[i]->errors();
+
+  return t1 - t0;
+}
+
 }  // namespace
 
 TEST_F(StackCaptureCacheTest, CachePageTest) {
@@ -197,6 +319,33 @@ TEST_F(StackCaptureCacheTest, ReclaimedStackCapture) {
   EXPECT_EQ(s1, s3);
 }
 
+TEST_F(StackCaptureCacheTest, ReleaseThreadChunk) {
+  AsanLogger logger;
+  TestStackCaptureCache cache(&logger);
+
+  // Releasing the chunk of a thread that doesn't have one is harmless.
+  cache.ReleaseThreadChunk();
+
+  // This carves the stack capture out of a new chunk for this thread.
+  StackCapture stack_capture;
+  stack_capture.InitFromStack();
+  const StackCapture* s1 = cache.SaveStackTrace(stack_capture);
+  ASSERT_TRUE(s1 != NULL);
+  size_t bytes_used = cache.GetBytesUsed();
+
+  // Return the rest of the chunk, as a thread does when it exits.
+  cache.ReleaseThreadChunk();
+
+  // The next stack capture should be reclaimed from the returned bytes rather
+  // than from a new chunk.
+  stack_capture.InitFromStack();
+  const StackCapture* s2 = cache.SaveStackTrace(stack_capture);
+  ASSERT_TRUE(s2 != NULL);
+  EXPECT_EQ(reinterpret_cast<const uint8*>(s1) + s1->Size(),
+            reinterpret_cast<const uint8*>(s2));
+  EXPECT_EQ(bytes_used, cache.GetBytesUsed());
+}
+
 TEST_F(StackCaptureCacheTest, Statistics) {
   AsanLogger logger;
   TestStackCaptureCache cache(&logger);
@@ -359,5 +508,145 @@ TEST_F(StackCaptureCacheTest, StackCapturePointerIsValid) {
       reinterpret_cast<const StackCapture*>(NULL)));
 }
 
+TEST_F(StackCaptureCacheTest, ConcurrentSaveAndRelease) {
+  AsanLogger logger;
+  TestStackCaptureCache cache(&logger);
+
+  size_t errors = 0;
+  RunSaveReleaseThreads(&cache, 8, 100000, &errors);
+  EXPECT_EQ(0u, errors);
+
+  // Every reference has been released, so every stack capture should have
+  // been removed from the cache.
+  EXPECT_EQ(0u, cache.GetKnownStacksSize());
+}
+
+TEST_F(StackCaptureCacheTest, ContentionPerfTest) {
+  static const size_t kThreadCounts[] = { 1, 2, 4, 8 };
+  static const size_t kIterations = 1000000;
+
+  for (size_t i = 0; i < arraysize(kThreadCounts); ++i) {
+    AsanLogger logger;
+    TestStackCaptureCache cache(&logger);
+
+    size_t errors = 0;
+    uint64 tnet = RunSaveReleaseThreads(&cache, kThreadCounts[i], kIterations,
+                                        &errors);
+    EXPECT_EQ(0u, errors);
+    EXPECT_EQ(0u, cache.GetKnownStacksSize());
+
+    testing::EmitMetric(
+        base::StringPrintf("Syzygy.Asan.StackCaptureCache.SaveRelease.%d",
+                           static_cast<int>(kThreadCounts[i])),
+        tnet);
+  }
+}
+
+TEST_F(StackCaptureCacheTest, FrameTrie) {
+  AsanLogger logger;
+  EXPECT_FALSE(TestStackCaptureCache(&logger).frame_trie_enabled());
+  EXPECT_FALSE(TestStackCaptureCache(
+      &logger, StackCaptureCache::kFlatFrameStorage).frame_trie_enabled());
+  TestStackCaptureCache cache(&logger, StackCaptureCache::kFrameTrieStorage);
+  EXPECT_TRUE(cache.frame_trie_enabled());
+
+  // Two stack traces that share their outermost 20 frames.
+  void* frames1[30] = {};
+  void* frames2[25] = {};
+  for (size_t i = 0; i < arraysize(frames1); ++i)
+    frames1[i] = reinterpret_cast<void*>(0x1000 + i);
+  for (size_t i = 0; i < arraysize(frames2); ++i)
+    frames2[i] = reinterpret_cast<void*>(0x2000 + i);
+  for (size_t i = 0; i < 20; ++i) {
+    frames1[arraysize(frames1) - 1 - i] = reinterpret_cast<void*>(0x3000 + i);
+    frames2[arraysize(frames2) - 1 - i] = reinterpret_cast<void*>(0x3000 + i);
+  }
+
+  const StackCapture* s1 =
+      cache.SaveStackTrace(1, frames1, arraysize(frames1));
+  ASSERT_TRUE(s1 != NULL);
+  EXPECT_EQ(1u, s1->stack_id());
+  EXPECT_EQ(arraysize(frames1), cache.GetNumFrames(s1));
+  // 30 frames are held in runs of 8, 8, 8 and 6.
+  EXPECT_EQ(4u, cache.GetFrameTrieSize());
+
+  // The second stack trace shares the two outermost runs.
+  const StackCapture* s2 =
+      cache.SaveStackTrace(2, frames2, arraysize(frames2));
+  ASSERT_TRUE(s2 != NULL);
+  EXPECT_NE(s1, s2);
+  EXPECT_EQ(arraysize(frames2), cache.GetNumFrames(s2));
+  EXPECT_EQ(6u, cache.GetFrameTrieSize());
+
+  // Saving a stack trace again gets the same stack capture.
+  EXPECT_EQ(s1, cache.SaveStackTrace(1, frames1, arraysize(frames1)));
+  EXPECT_EQ(6u, cache.GetFrameTrieSize());
+
+  // The frames are expanded as they were saved.
+  void* frames[StackCapture::kMaxNumFrames] = {};
+  EXPECT_EQ(arraysize(frames1),
+            cache.GetFrames(s1, frames, arraysize(frames)));
+  EXPECT_EQ(0, ::memcmp(frames1, frames, sizeof(frames1)));
+  EXPECT_EQ(arraysize(frames2),
+            cache.GetFrames(s2, frames, arraysize(frames)));
+  EXPECT_EQ(0, ::memcmp(frames2, frames, sizeof(frames2)));
+
+  // Expansion can be truncated.
+  EXPECT_EQ(10u, cache.GetFrames(s2, frames, 10));
+  EXPECT_EQ(0, ::memcmp(frames2, frames, 10 * sizeof(void*)));
+
+  // Releasing the stack traces recycles the nodes that are no longer shared.
+  cache.ReleaseStackTrace(s1);
+  EXPECT_EQ(6u, cache.GetFrameTrieSize());
+  cache.ReleaseStackTrace(s1);
+  EXPECT_EQ(4u, cache.GetFrameTrieSize());
+  cache.ReleaseStackTrace(s2);
+  EXPECT_EQ(0u, cache.GetFrameTrieSize());
+}
+
+TEST_F(StackCaptureCacheTest, FrameTrieConcurrentSaveAndRelease) {
+  AsanLogger logger;
+  TestStackCaptureCache cache(&logger, StackCaptureCache::kFrameTrieStorage);
+
+  size_t errors = 0;
+  RunSaveReleaseThreads(&cache, 8, 100000, &errors);
+  EXPECT_EQ(0u, errors);
+  EXPECT_EQ(0u, cache.GetKnownStacksSize());
+  EXPECT_EQ(0u, cache.GetFrameTrieSize());
+}
+
+TEST_F(StackCaptureCacheTest, FrameTrieMemoryUsage) {
+  // Many stack traces that only differ in their innermost frames, as is
+  // typical of allocations made from a common call tree.
+  static const size_t kNumStacks = 4096;
+  static const size_t kNumUniqueFrames = 14;
+  void* frames[StackCapture::kMaxNumFrames] = {};
+  for (size_t i = 0; i < arraysize(frames); ++i)
+    frames[i] = reinterpret_cast<void*>(0x10000 + i);
+
+  size_t bytes_used[2] = {};
+  for (size_t mode = 0; mode < 2; ++mode) {
+    AsanLogger logger;
+    TestStackCaptureCache cache(
+        &logger, mode == 1 ? StackCaptureCache::kFrameTrieStorage
+                           : StackCaptureCache::kFlatFrameStorage);
+    size_t initial_bytes_used = cache.GetBytesUsed();
+
+    for (size_t i = 0; i < kNumStacks; ++i) {
+      for (size_t j = 0; j < kNumUniqueFrames; ++j)
+        frames[j] = reinterpret_cast<void*>(i * kNumUniqueFrames + j);
+      ASSERT_TRUE(cache.SaveStackTrace(i + 1, frames, arraysize(frames)) !=
+                      NULL);
+    }
+    bytes_used[mode] = cache.GetBytesUsed() - initial_bytes_used;
+  }
+
+  EXPECT_LT(2 * bytes_used[1], bytes_used[0]);
+  testing::EmitMetric("Syzygy.Asan.StackCaptureCache.FlatBytes",
+                      static_cast<uint64>(bytes_used[0]));
+  testing::EmitMetric("Syzygy.Asan.StackCaptureCache.FrameTrieBytes",
+                      static_cast<uint64>(bytes_used[1]));
+}
+
 }  // namespace asan
 }  // namespace agent
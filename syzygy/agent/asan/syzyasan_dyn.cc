@@ -115,9 +115,12 @@ BOOL WINAPI DllMain(HMODULE instance, DWORD reason, LPVOID reserved) {
       break;
     }
 
-    case DLL_THREAD_DETACH:
-      // Nothing to do here.
+    case DLL_THREAD_DETACH: {
+      agent::asan::AsanRuntime* runtime = agent::asan::AsanRuntime::runtime();
+      DCHECK_NE(static_cast<agent::asan::AsanRuntime*>(nullptr), runtime);
+      runtime->OnThreadExit();
       break;
+    }
 
     case DLL_PROCESS_DETACH: {
       base::CommandLine::Reset();
@@ -35,6 +35,7 @@
 #include "syzygy/common/logging.h"
 #include "syzygy/common/path_util.h"
 #include "syzygy/trace/client/client_utils.h"
+#include "syzygy/trace/common/compact_encoding.h"
 #include "syzygy/trace/protocol/call_trace_defs.h"
 
 using agent::client::Client;
@@ -175,8 +176,10 @@ class Client::ThreadLocalData {
     return segment.header != NULL;
   }
 
-  // Allocates a new enter event.
-  TraceEnterEventData* AllocateEnterEvent();
+  // Logs an enter event to the current batch record, starting a new one if
+  // need be.
+  // @returns true on success, false if no buffer space could be had.
+  bool LogEnterEvent(RetAddr retaddr, FuncAddr function);
 
   // Flushes the current trace file segment.
   bool FlushSegment();
@@ -190,7 +193,10 @@ class Client::ThreadLocalData {
 
   // The current batch record we're extending, if any.
   // This will point into the associated trace file segment's buffer.
-  TraceBatchEnterData* batch;
+  TraceBatchEnterCompactData* batch;
+
+  // The encoding state left by the last call appended to batch.
+  trace::common::CompactCallState call_state;
 };
 
 Client::Client() {
@@ -362,11 +368,7 @@ void Client::LogEvent_FunctionEntry(EntryFrame *entry_frame,
   //     this event to the buffer in order to guarantee precision.
 
   // Capture the basic call info and timestamp.
-  TraceEnterEventData* enter = data->AllocateEnterEvent();
-  if (enter != NULL) {
-    enter->retaddr = entry_frame->retaddr;
-    enter->function = function;
-  }
+  data->LogEnterEvent(entry_frame->retaddr, function);
 }
 
 Client::ThreadLocalData* Client::GetThreadData() {
@@ -402,53 +404,64 @@ void Client::FreeThreadData() {
 }
 
 Client::ThreadLocalData::ThreadLocalData(Client* c) : client(c), batch(NULL) {
+  ::memset(&call_state, 0, sizeof(call_state));
 }
 
-TraceEnterEventData* Client::ThreadLocalData::AllocateEnterEvent() {
+bool Client::ThreadLocalData::LogEnterEvent(RetAddr retaddr,
+                                            FuncAddr function) {
+  uint8 encoded_call[trace::common::kMaxCompactCallLength];
+
   // Do we have a batch record that we can grow?
-  if (batch != NULL && segment.CanAllocateRaw(sizeof(TraceEnterEventData))) {
-    TraceEnterEventData* enter =
-        reinterpret_cast<TraceEnterEventData*>(segment.write_ptr);
-    // The order of operations from here is pretty important. The issue is that
-    // threads can be terminated at any point, and this happens as a matter of
-    // fact at process exit, for any other threads than the one calling
-    // ExitProcess. We want our shared memory buffers to be in a self-consistent
-    // state at all times, so we proceed here by:
-    // - allocating and initializing a new record first.
-    // - then update the bookkeeping for the enclosures from the outermost,
-    //   inward. E.g. first we grow the file segment, then the record enclosure,
-    //   and lastly update the record itself.
-
-    // Initialize the new record.
-    memset(enter, 0, sizeof(*enter));
-
-    // Update the file segment size.
-    segment.write_ptr += sizeof(TraceEnterEventData);
-    segment.header->segment_length += sizeof(TraceEnterEventData);
-
-    // Extend the record enclosure.
-    RecordPrefix* prefix = trace::client::GetRecordPrefix(batch);
-    prefix->size += sizeof(TraceEnterEventData);
-
-    // And lastly update the inner counter.
-    DCHECK(enter == batch->calls + batch->num_calls);
-    batch->num_calls += 1;
-
-    return enter;
+  if (batch != NULL) {
+    trace::common::CompactCallState state = call_state;
+    size_t length = trace::common::EncodeCompactCall(retaddr, function,
+                                                     &state, encoded_call);
+    if (segment.CanAllocateRaw(length)) {
+      // The order of operations from here is pretty important. The issue is
+      // that threads can be terminated at any point, and this happens as a
+      // matter of fact at process exit, for any other threads than the one
+      // calling ExitProcess. We want our shared memory buffers to be in a
+      // self-consistent state at all times, so we proceed here by:
+      // - writing the encoded call first.
+      // - then update the bookkeeping for the enclosures from the outermost,
+      //   inward. E.g. first we grow the file segment, then the record
+      //   enclosure, and lastly update the record itself.
+      ::memcpy(segment.write_ptr, encoded_call, length);
+
+      // Update the file segment size.
+      segment.write_ptr += length;
+      segment.header->segment_length += length;
+
+      // Extend the record enclosure.
+      RecordPrefix* prefix = trace::client::GetRecordPrefix(batch);
+      prefix->size += length;
+
+      // And lastly update the inner counter.
+      batch->num_calls += 1;
+      call_state = state;
+
+      return true;
+    }
   }
 
+  // The first call of a batch is relative to nothing.
+  ::memset(&call_state, 0, sizeof(call_state));
+  size_t length = trace::common::EncodeCompactCall(retaddr, function,
+                                                   &call_state, encoded_call);
+  size_t record_size = sizeof(TraceBatchEnterCompactData) + length;
+
   // Do we need to scarf a new buffer?
-  if (batch != NULL || !segment.CanAllocate(sizeof(TraceBatchEnterData))) {
-    if (!client->session_.ExchangeBuffer(&segment)) {
-      return NULL;
-    }
+  if (batch != NULL || !segment.CanAllocate(record_size)) {
+    if (!client->session_.ExchangeBuffer(&segment))
+      return false;
   }
 
-  batch = segment.AllocateTraceRecord<TraceBatchEnterData>();
+  batch = segment.AllocateTraceRecord<TraceBatchEnterCompactData>(record_size);
   batch->thread_id = segment.header->thread_id;
+  ::memcpy(batch + 1, encoded_call, length);
   batch->num_calls = 1;
 
-  return &batch->calls[0];
+  return true;
 }
 
 bool Client::ThreadLocalData::FlushSegment() {
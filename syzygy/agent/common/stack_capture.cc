@@ -14,6 +14,8 @@
 
 #include "syzygy/agent/common/stack_capture.h"
 
+#include <intrin.h>
+
 #include <algorithm>
 
 #include "base/logging.h"
@@ -83,6 +85,44 @@ void StackCapture::RemoveRef() {
   --ref_count_;
 }
 
+bool StackCapture::TryAddRef() {
+  volatile short* ref_count = reinterpret_cast<volatile short*>(&ref_count_);
+  while (true) {
+    RefCount old_count = *ref_count;
+    if (old_count == kMaxRefCount)
+      return true;
+    if (old_count == 0)
+      return false;
+    RefCount new_count = old_count + 1;
+    if (_InterlockedCompareExchange16(ref_count, new_count, old_count) ==
+            static_cast<short>(old_count)) {
+      return true;
+    }
+  }
+}
+
+bool StackCapture::TryRemoveRef() {
+  volatile short* ref_count = reinterpret_cast<volatile short*>(&ref_count_);
+  while (true) {
+    RefCount old_count = *ref_count;
+    DCHECK_LT(0u, old_count);
+    if (old_count == kMaxRefCount)
+      return true;
+    if (old_count <= 1)
+      return false;
+    RefCount new_count = old_count - 1;
+    if (_InterlockedCompareExchange16(ref_count, new_count, old_count) ==
+            static_cast<short>(old_count)) {
+      return true;
+    }
+  }
+}
+
+bool StackCapture::TryRemoveLastRef() {
+  volatile short* ref_count = reinterpret_cast<volatile short*>(&ref_count_);
+  return _InterlockedCompareExchange16(ref_count, 0, 1) == 1;
+}
+
 // static
 void StackCapture::Init() {
   bottom_frames_to_skip_ = ::common::kDefaultBottomFramesToSkip;
@@ -89,6 +89,28 @@ class StackCapture {
   // Decrements the reference count of this stack capture.
   void RemoveRef();
 
+  // @name Atomic reference counting.
+  // These may be called concurrently with each other on a stack capture that
+  // is shared between threads. AddRef and RemoveRef may not.
+  // @{
+  // Increments the reference count, but only if the stack capture is already
+  // referenced. This never revives an unreferenced stack capture.
+  // @returns true if a reference was added or the reference count is
+  //     saturated, false if the stack capture is unreferenced.
+  bool TryAddRef();
+
+  // Decrements the reference count, but only if this does not release the
+  // last reference.
+  // @returns true if a reference was removed or the reference count is
+  //     saturated, false if this is the last reference.
+  bool TryRemoveRef();
+
+  // Releases the last reference to this stack capture.
+  // @returns true if the reference count went from one to zero, false if the
+  //     reference count was not one.
+  bool TryRemoveLastRef();
+  // @}
+
   // @returns true if the reference count is saturated, false otherwise. A
   //     saturated reference count means that further calls to AddRef and
   //     RemoveRef will be nops, and HasNoRefs will always return false.
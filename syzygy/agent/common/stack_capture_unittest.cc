@@ -96,5 +96,35 @@ TEST_F(StackCaptureTest, RestrictedFrameCount) {
   EXPECT_EQ(5u, capture.max_num_frames());
 }
 
+TEST_F(StackCaptureTest, AtomicRefCounting) {
+  StackCapture capture;
+
+  // An unreferenced stack capture can't be revived.
+  EXPECT_FALSE(capture.TryAddRef());
+  EXPECT_TRUE(capture.HasNoRefs());
+
+  capture.AddRef();
+  EXPECT_TRUE(capture.TryAddRef());
+  EXPECT_EQ(2u, capture.ref_count());
+
+  // The last reference can only be released explicitly.
+  EXPECT_TRUE(capture.TryRemoveRef());
+  EXPECT_EQ(1u, capture.ref_count());
+  EXPECT_FALSE(capture.TryRemoveRef());
+  EXPECT_EQ(1u, capture.ref_count());
+  EXPECT_TRUE(capture.TryRemoveLastRef());
+  EXPECT_TRUE(capture.HasNoRefs());
+  EXPECT_FALSE(capture.TryRemoveLastRef());
+
+  // Saturated reference counts stay saturated.
+  capture.AddRef();
+  while (!capture.RefCountIsSaturated())
+    EXPECT_TRUE(capture.TryAddRef());
+  EXPECT_TRUE(capture.TryAddRef());
+  EXPECT_TRUE(capture.TryRemoveRef());
+  EXPECT_FALSE(capture.TryRemoveLastRef());
+  EXPECT_EQ(StackCapture::kMaxRefCount, capture.ref_count());
+}
+
 }  // namespace common
 }  // namespace agent
@@ -59,6 +59,8 @@ class TestRpcSession : public trace::client::RpcSession {
     segment->write_ptr = reinterpret_cast<uint8*>(segment->header + 1);
     segment->header->thread_id = ::GetCurrentThreadId();
     segment->header->segment_length = 0;
+    segment->header->compression = TraceFileSegmentHeader::kCompressionNone;
+    segment->header->uncompressed_length = 0;
     return true;
   }
 
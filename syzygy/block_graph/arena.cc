@@ -0,0 +1,66 @@
+// Copyright 2015 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "syzygy/block_graph/arena.h"
+
+#include "syzygy/common/align.h"
+
+namespace block_graph {
+
+namespace {
+
+// Allocations larger than this are given a chunk of their own, so as not to
+// waste the remainder of the current chunk.
+const size_t kMaxSharedAllocationSize = Arena::kChunkSize / 4;
+
+}  // namespace
+
+const size_t Arena::kAlignment;
+const size_t Arena::kChunkSize;
+
+Arena::Arena() : current_(NULL), end_(NULL), bytes_reserved_(0) {
+}
+
+Arena::~Arena() {
+  for (size_t i = 0; i < chunks_.size(); ++i)
+    delete [] chunks_[i];
+}
+
+void* Arena::Allocate(size_t size) {
+  size = common::AlignUp(size, kAlignment);
+
+  if (size > kMaxSharedAllocationSize)
+    return AllocateChunk(size);
+
+  if (static_cast<size_t>(end_ - current_) < size) {
+    current_ = AllocateChunk(kChunkSize);
+    end_ = current_ + kChunkSize;
+  }
+
+  void* allocation = current_;
+  current_ += size;
+  DCHECK_LE(current_, end_);
+  return allocation;
+}
+
+uint8* Arena::AllocateChunk(size_t size) {
+  // The heap returns memory suitably aligned for any fundamental type.
+  uint8* chunk = new uint8[size];
+  DCHECK(common::IsAligned(chunk, kAlignment));
+  chunks_.push_back(chunk);
+  bytes_reserved_ += size;
+  return chunk;
+}
+
+}  // namespace block_graph
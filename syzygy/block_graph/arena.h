@@ -0,0 +1,144 @@
+// Copyright 2015 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// Declares a bump allocator used to back short-lived object graphs, such as
+// basic-block subgraphs, and an STL allocator drawing from it.
+
+#ifndef SYZYGY_BLOCK_GRAPH_ARENA_H_
+#define SYZYGY_BLOCK_GRAPH_ARENA_H_
+
+#include <limits>
+#include <new>
+#include <utility>
+#include <vector>
+
+#include "base/basictypes.h"
+#include "base/logging.h"
+
+namespace block_graph {
+
+// A bump allocator. Allocations are carved out of large chunks of memory, and
+// individual allocations are never freed. All of the memory is released at
+// once when the arena is destroyed. This is not thread-safe.
+class Arena {
+ public:
+  // The alignment of all allocations.
+  static const size_t kAlignment = 8;
+  // The size of the chunks from which allocations are carved.
+  static const size_t kChunkSize = 16 * 1024;
+
+  Arena();
+  ~Arena();
+
+  // Allocates memory from the arena.
+  // @param size the number of bytes to allocate.
+  // @returns a pointer to the allocated memory, aligned to kAlignment.
+  void* Allocate(size_t size);
+
+  // @returns the total number of bytes allocated by the arena from the heap.
+  size_t bytes_reserved() const { return bytes_reserved_; }
+
+ private:
+  // Allocates a new chunk of at least @p size bytes.
+  // @returns a pointer to the new chunk.
+  uint8* AllocateChunk(size_t size);
+
+  // The chunks owned by this arena.
+  std::vector<uint8*> chunks_;
+
+  // The unused range of the current chunk.
+  uint8* current_;
+  uint8* end_;
+
+  size_t bytes_reserved_;
+
+  DISALLOW_COPY_AND_ASSIGN(Arena);
+};
+
+// An STL allocator drawing from an Arena. A default constructed allocator
+// isn't bound to an arena and falls back to the heap, so that containers using
+// this allocator may still be used on their own. Containers may only exchange
+// elements (via splice or swap) if their allocators compare equal.
+// @tparam T the type of the allocated objects.
+template <typename T>
+class ArenaAllocator {
+ public:
+  typedef T value_type;
+  typedef T* pointer;
+  typedef const T* const_pointer;
+  typedef T& reference;
+  typedef const T& const_reference;
+  typedef size_t size_type;
+  typedef ptrdiff_t difference_type;
+
+  template <typename U>
+  struct rebind {
+    typedef ArenaAllocator<U> other;
+  };
+
+  ArenaAllocator() : arena_(NULL) { }
+  explicit ArenaAllocator(Arena* arena) : arena_(arena) { }
+  template <typename U>
+  ArenaAllocator(const ArenaAllocator<U>& other) : arena_(other.arena()) { }
+
+  pointer address(reference value) const { return &value; }
+  const_pointer address(const_reference value) const { return &value; }
+
+  pointer allocate(size_type count, const void* hint = NULL) {
+    DCHECK_GE(max_size(), count);
+    size_t size = count * sizeof(T);
+    if (arena_ == NULL)
+      return static_cast<pointer>(::operator new(size));
+    return static_cast<pointer>(arena_->Allocate(size));
+  }
+
+  void deallocate(pointer p, size_type count) {
+    // Memory drawn from the arena is released along with the arena.
+    if (arena_ == NULL)
+      ::operator delete(p);
+  }
+
+  size_type max_size() const {
+    return std::numeric_limits<size_type>::max() / sizeof(T);
+  }
+
+  template <typename U, typename... Args>
+  void construct(U* p, Args&&... args) {
+    ::new(static_cast<void*>(p)) U(std::forward<Args>(args)...);
+  }
+
+  template <typename U>
+  void destroy(U* p) {
+    p->~U();
+  }
+
+  Arena* arena() const { return arena_; }
+
+ private:
+  Arena* arena_;
+};
+
+template <typename T, typename U>
+bool operator==(const ArenaAllocator<T>& lhs, const ArenaAllocator<U>& rhs) {
+  return lhs.arena() == rhs.arena();
+}
+
+template <typename T, typename U>
+bool operator!=(const ArenaAllocator<T>& lhs, const ArenaAllocator<U>& rhs) {
+  return lhs.arena() != rhs.arena();
+}
+
+}  // namespace block_graph
+
+#endif  // SYZYGY_BLOCK_GRAPH_ARENA_H_
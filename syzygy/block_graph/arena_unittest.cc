@@ -0,0 +1,119 @@
+// Copyright 2015 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "syzygy/block_graph/arena.h"
+
+#include <intrin.h>
+#include <list>
+
+#include "gtest/gtest.h"
+#include "syzygy/block_graph/basic_block.h"
+#include "syzygy/common/align.h"
+#include "syzygy/testing/metrics.h"
+
+namespace block_graph {
+
+namespace {
+
+typedef ArenaAllocator<Instruction> TestAllocator;
+typedef std::list<Instruction, TestAllocator> TestList;
+
+// Builds @p num_lists lists of @p list_size instructions, the way the
+// basic-block decomposer does, drawing from @p arena if it's not NULL.
+void BuildLists(size_t num_lists, size_t list_size, Arena* arena) {
+  Instruction instruction;
+  for (size_t i = 0; i < num_lists; ++i) {
+    TestList list((TestAllocator(arena)));
+    for (size_t j = 0; j < list_size; ++j)
+      list.push_back(instruction);
+  }
+}
+
+}  // namespace
+
+TEST(ArenaTest, Allocate) {
+  Arena arena;
+  EXPECT_EQ(0U, arena.bytes_reserved());
+
+  // Allocations are aligned and contiguous within a chunk.
+  uint8* previous_end = NULL;
+  for (size_t i = 1; i < 100; ++i) {
+    uint8* allocation = static_cast<uint8*>(arena.Allocate(i));
+    ASSERT_TRUE(allocation != NULL);
+    EXPECT_TRUE(common::IsAligned(allocation, Arena::kAlignment));
+    ::memset(allocation, 0xCC, i);
+    if (previous_end != NULL)
+      EXPECT_EQ(common::AlignUp(previous_end, Arena::kAlignment), allocation);
+    previous_end = allocation + i;
+  }
+  EXPECT_EQ(Arena::kChunkSize, arena.bytes_reserved());
+
+  // Large allocations get a chunk of their own.
+  void* large = arena.Allocate(Arena::kChunkSize * 2);
+  ASSERT_TRUE(large != NULL);
+  ::memset(large, 0xCC, Arena::kChunkSize * 2);
+  EXPECT_EQ(Arena::kChunkSize * 3, arena.bytes_reserved());
+}
+
+TEST(ArenaTest, Allocator) {
+  Arena arena;
+  TestAllocator heap_allocator;
+  TestAllocator arena_allocator(&arena);
+  EXPECT_TRUE(heap_allocator.arena() == NULL);
+  EXPECT_EQ(&arena, arena_allocator.arena());
+  EXPECT_TRUE(heap_allocator != arena_allocator);
+  EXPECT_TRUE(arena_allocator == TestAllocator(&arena));
+
+  // Rebinding preserves the arena.
+  ArenaAllocator<int> rebound(arena_allocator);
+  EXPECT_EQ(&arena, rebound.arena());
+
+  TestList heap_list(heap_allocator);
+  TestList arena_list(arena_allocator);
+  TestList other_arena_list(arena_allocator);
+  for (size_t i = 0; i < 10; ++i) {
+    heap_list.push_back(Instruction());
+    arena_list.push_back(Instruction());
+  }
+  EXPECT_TRUE(heap_list.get_allocator().arena() == NULL);
+  EXPECT_LT(0U, arena.bytes_reserved());
+
+  // Lists sharing an arena can exchange elements.
+  other_arena_list.splice(other_arena_list.end(), arena_list,
+                          arena_list.begin());
+  EXPECT_EQ(9U, arena_list.size());
+  EXPECT_EQ(1U, other_arena_list.size());
+  other_arena_list.swap(arena_list);
+  EXPECT_EQ(1U, arena_list.size());
+  EXPECT_EQ(9U, other_arena_list.size());
+}
+
+TEST(ArenaTest, AllocatorPerfTest) {
+  const size_t kNumLists = 10000;
+  const size_t kListSize = 16;
+
+  uint64 t0 = ::__rdtsc();
+  BuildLists(kNumLists, kListSize, NULL);
+  uint64 t1 = ::__rdtsc();
+  {
+    Arena arena;
+    BuildLists(kNumLists, kListSize, &arena);
+  }
+  uint64 t2 = ::__rdtsc();
+
+  testing::EmitMetric("Syzygy.BlockGraph.Arena.HeapLists", t1 - t0);
+  testing::EmitMetric("Syzygy.BlockGraph.Arena.ArenaLists", t2 - t1);
+}
+
+}  // namespace block_graph
@@ -68,6 +68,7 @@
 
 #include "base/strings/stringprintf.h"
 #include "syzygy/assm/assembler.h"
+#include "syzygy/block_graph/basic_block_subgraph.h"
 #include "syzygy/core/disassembler_util.h"
 
 #include "mnemonics.h"  // NOLINT
@@ -713,7 +714,9 @@ void BasicBlock::MarkAsPadding() {
 BasicCodeBlock::BasicCodeBlock(BasicBlockSubGraph* subgraph,
                                const base::StringPiece& name,
                                BlockId id)
-    : BasicBlock(subgraph, name, id, BASIC_CODE_BLOCK) {
+    : BasicBlock(subgraph, name, id, BASIC_CODE_BLOCK),
+      instructions_(InstructionAllocator(subgraph->arena())),
+      successors_(SuccessorAllocator(subgraph->arena())) {
 }
 
 BasicCodeBlock* BasicCodeBlock::Cast(BasicBlock* basic_block) {
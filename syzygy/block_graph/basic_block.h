@@ -26,6 +26,7 @@
 
 #include "base/strings/string_piece.h"
 #include "syzygy/assm/assembler.h"
+#include "syzygy/block_graph/arena.h"
 #include "syzygy/block_graph/block_graph.h"
 #include "syzygy/block_graph/tags.h"
 #include "syzygy/common/align.h"
@@ -535,9 +536,11 @@ class BasicBlock {
   };
 
   typedef BlockGraph::BlockId BlockId;
-  typedef std::list<Instruction> Instructions;
+  typedef ArenaAllocator<Instruction> InstructionAllocator;
+  typedef std::list<Instruction, InstructionAllocator> Instructions;
   typedef BlockGraph::Size Size;
-  typedef std::list<Successor> Successors;
+  typedef ArenaAllocator<Successor> SuccessorAllocator;
+  typedef std::list<Successor, SuccessorAllocator> Successors;
   typedef BlockGraph::Offset Offset;
 
   // The collection of references this basic block makes to other basic
@@ -684,7 +687,8 @@ class BasicCodeBlock : public BasicBlock {
 
   // The set of non-branching instructions comprising this basic-block.
   // Any branching at the end of the basic-block is represented using the
-  // successors_ member.
+  // successors_ member. This and successors_ draw from the arena of the
+  // subgraph.
   Instructions instructions_;
 
   // The set of (logical) successors to this basic block. There can only be
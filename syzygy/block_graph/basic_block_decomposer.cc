@@ -130,20 +130,19 @@ bool SplitInstructionListAt(Offset offset,
 BasicBlockDecomposer::BasicBlockDecomposer(const BlockGraph::Block* block,
                                            BasicBlockSubGraph* subgraph)
     : block_(block),
-      subgraph_(subgraph),
+      // If no subgraph was provided then use a scratch one.
+      scratch_subgraph_(subgraph == NULL ? new BasicBlockSubGraph() : NULL),
+      subgraph_(subgraph != NULL ? subgraph : scratch_subgraph_.get()),
       current_block_start_(0),
+      current_instructions_(
+          BasicBlock::InstructionAllocator(subgraph_->arena())),
+      current_successors_(BasicBlock::SuccessorAllocator(subgraph_->arena())),
       check_decomposition_results_(true),
       contains_unsupported_instructions_(false) {
   // TODO(rogerm): Once we're certain this is stable for all input binaries
   //     turn on check_decomposition_results_ by default only ifndef NDEBUG.
   DCHECK(block != NULL);
   DCHECK(block->type() == BlockGraph::CODE_BLOCK);
-
-  // If no subgraph was provided then use a scratch one.
-  if (subgraph == NULL) {
-    scratch_subgraph_.reset(new BasicBlockSubGraph());
-    subgraph_ = scratch_subgraph_.get();
-  }
 }
 
 bool BasicBlockDecomposer::Decompose() {
@@ -238,6 +238,10 @@ class BasicBlockDecomposer {
   // The block being disassembled.
   const BlockGraph::Block* const block_;
 
+  // If no explicit subgraph was provided then we need to use one as scratch
+  // space in order to do some work.
+  scoped_ptr<BasicBlockSubGraph> scratch_subgraph_;
+
   // The basic-block sub-graph to which the block will be decomposed.
   BasicBlockSubGraph* subgraph_;
 
@@ -251,7 +255,9 @@ class BasicBlockDecomposer {
   // The start offset of the current basic block during a walk.
   Offset current_block_start_;
 
-  // The list of instructions in the current basic block.
+  // The list of instructions in the current basic block. This and
+  // current_successors_ draw from the arena of subgraph_, so that they may be
+  // swapped with those of its basic blocks.
   BasicBlock::Instructions current_instructions_;
 
   // The set of successors for the current basic block.
@@ -261,10 +267,6 @@ class BasicBlockDecomposer {
   // CHECKed.
   bool check_decomposition_results_;
 
-  // If no explicit subgraph was provided then we need to use one as scratch
-  // space in order to do some work.
-  scoped_ptr<BasicBlockSubGraph> scratch_subgraph_;
-
   // Decomposition failure flags.
   bool contains_unsupported_instructions_;
 };
@@ -16,6 +16,7 @@
 
 #include "syzygy/block_graph/basic_block_decomposer.h"
 
+#include <intrin.h>
 #include <algorithm>
 #include <vector>
 
@@ -30,6 +31,7 @@
 #include "syzygy/core/address.h"
 #include "syzygy/core/serialization.h"
 #include "syzygy/core/unittest_util.h"
+#include "syzygy/testing/metrics.h"
 
 #include "mnemonics.h"  // NOLINT
 
@@ -501,4 +503,25 @@ TEST_F(BasicBlockDecomposerTest, ContainsJECXZ) {
   EXPECT_TRUE(bbd.contains_unsupported_instructions());
 }
 
+TEST_F(BasicBlockDecomposerTest, DecomposePerfTest) {
+  ASSERT_NO_FATAL_FAILURE(InitBlockGraph());
+
+  // Repeatedly decompose the same block, tearing down the subgraph each time
+  // as the transforms do.
+  const size_t kIterations = 10000;
+  uint64 tnet = 0;
+  for (size_t i = 0; i < kIterations; ++i) {
+    uint64 t0 = ::__rdtsc();
+    {
+      BasicBlockSubGraph bbsg;
+      BasicBlockDecomposer bbd(assembly_func_, &bbsg);
+      ASSERT_TRUE(bbd.Decompose());
+    }
+    uint64 t1 = ::__rdtsc();
+    tnet += t1 - t0;
+  }
+  testing::EmitMetric("Syzygy.BlockGraph.BasicBlockDecomposer.Decompose",
+                      tnet / kIterations);
+}
+
 }  // namespace block_graph
@@ -18,8 +18,6 @@
 
 #include <algorithm>
 
-#include "base/memory/scoped_ptr.h"
-
 namespace block_graph {
 
 namespace {
@@ -42,10 +40,11 @@ BasicBlockSubGraph::BasicBlockSubGraph()
 }
 
 BasicBlockSubGraph::~BasicBlockSubGraph() {
-  // Delete all the BB's we've been entrusted with.
+  // Destroy all the BB's we've been entrusted with. Their memory is released
+  // along with the arena.
   BBCollection::iterator it = basic_blocks_.begin();
   for (; it != basic_blocks_.end(); ++it)
-    delete *it;
+    (*it)->~BasicBlock();
 
   // And wipe the collection.
   basic_blocks_.clear();
@@ -75,11 +74,12 @@ block_graph::BasicCodeBlock* BasicBlockSubGraph::AddBasicCodeBlock(
   DCHECK(!name.empty());
 
   BlockId id = next_block_id_++;
-  scoped_ptr<BasicCodeBlock> new_code_block(new BasicCodeBlock(this, name, id));
-  bool inserted = basic_blocks_.insert(new_code_block.get()).second;
+  BasicCodeBlock* new_code_block = new(arena_.Allocate(sizeof(BasicCodeBlock)))
+      BasicCodeBlock(this, name, id);
+  bool inserted = basic_blocks_.insert(new_code_block).second;
   DCHECK(inserted);
 
-  return new_code_block.release();
+  return new_code_block;
 }
 
 block_graph::BasicDataBlock* BasicBlockSubGraph::AddBasicDataBlock(
@@ -89,22 +89,22 @@ block_graph::BasicDataBlock* BasicBlockSubGraph::AddBasicDataBlock(
   DCHECK(!name.empty());
 
   BlockId id = next_block_id_++;
-  scoped_ptr<BasicDataBlock> new_data_block(
-      new BasicDataBlock(this, name, id, data, size));
-  bool inserted = basic_blocks_.insert(new_data_block.get()).second;
+  BasicDataBlock* new_data_block = new(arena_.Allocate(sizeof(BasicDataBlock)))
+      BasicDataBlock(this, name, id, data, size);
+  bool inserted = basic_blocks_.insert(new_data_block).second;
   DCHECK(inserted);
 
-  return new_data_block.release();
+  return new_data_block;
 }
 
 block_graph::BasicEndBlock* BasicBlockSubGraph::AddBasicEndBlock() {
   BlockId id = next_block_id_++;
-  scoped_ptr<BasicEndBlock> new_end_block(
-      new BasicEndBlock(this, id));
-  bool inserted = basic_blocks_.insert(new_end_block.get()).second;
+  BasicEndBlock* new_end_block = new(arena_.Allocate(sizeof(BasicEndBlock)))
+      BasicEndBlock(this, id);
+  bool inserted = basic_blocks_.insert(new_end_block).second;
   DCHECK(inserted);
 
-  return new_end_block.release();
+  return new_end_block;
 }
 
 void BasicBlockSubGraph::Remove(BasicBlock* bb) {
@@ -23,6 +23,7 @@
 
 #include "base/basictypes.h"
 #include "base/strings/string_piece.h"
+#include "syzygy/block_graph/arena.h"
 #include "syzygy/block_graph/basic_block.h"
 #include "syzygy/block_graph/block_graph.h"
 
@@ -35,7 +36,9 @@ namespace block_graph {
 //
 // In manipulating the basic block sub-graph, note that the sub-graph
 // acts as a basic-block factory and retains ownership of all basic-blocks
-// that participate in the composition.
+// that participate in the composition. The basic-blocks, along with their
+// instructions and successors, are allocated from an arena that is released
+// all at once with the sub-graph.
 class BasicBlockSubGraph {
  public:
   typedef block_graph::BasicBlock BasicBlock;
@@ -88,6 +91,8 @@ class BasicBlockSubGraph {
     return block_descriptions_;
   }
   BlockDescriptionList& block_descriptions() { return block_descriptions_; }
+
+  Arena* arena() { return &arena_; }
   // @}
 
   // Initializes and returns a new block description.
@@ -163,6 +168,10 @@ class BasicBlockSubGraph {
   bool HasValidReferrers() const;
   // @}
 
+  // The arena backing the basic blocks of this sub-graph. This must outlive
+  // them.
+  Arena arena_;
+
   // The original block corresponding from which this sub-graph derives. This
   // is optional, and may be NULL.
   const Block* original_block_;
@@ -14,6 +14,7 @@
 
 #include "syzygy/block_graph/block_graph.h"
 
+#include <algorithm>
 #include <limits>
 
 #include "base/logging.h"
@@ -71,42 +72,29 @@ COMPILE_ASSERT(arraysize(kBlockType) == BlockGraph::BLOCK_TYPE_MAX,
 
 // Shift all items in an offset -> item map by 'distance', provided the initial
 // item offset was >= @p offset.
-template<typename ItemType>
+template<typename ItemMap>
 void ShiftOffsetItemMap(BlockGraph::Offset offset,
                         BlockGraph::Offset distance,
-                        std::map<BlockGraph::Offset, ItemType>* items) {
+                        ItemMap* items) {
   DCHECK_GE(offset, 0);
   DCHECK_NE(distance, 0);
   DCHECK(items != NULL);
 
-  typedef std::map<BlockGraph::Offset, ItemType> ItemMap;
+  typedef std::pair<BlockGraph::Offset, typename ItemMap::mapped_type> Item;
 
-  // Get iterators to all of the items that need changing.
-  std::vector<ItemMap::iterator> item_its;
-  ItemMap::iterator item_it = items->lower_bound(offset);
-  while (item_it != items->end()) {
-    item_its.push_back(item_it);
-    ++item_it;
-  }
-
-  // Get the direction and bounds of the iteration. We need to walk through
-  // the iterators in a different order depending on if we're shifting left
-  // or right. This is to ensure that earlier shifts don't land on the values
-  // of later unshifted offsets.
-  int start = 0;
-  int stop = item_its.size();
-  int step = 1;
-  if (distance > 0) {
-    start = stop - 1;
-    stop = -1;
-    step = -1;
-  }
+  // Copy out all of the items that need changing, and remove them. This
+  // ensures that shifted items don't land on the values of unshifted ones,
+  // whatever the direction of the shift.
+  std::vector<Item> shifted_items;
+  typename ItemMap::iterator item_it = items->lower_bound(offset);
+  for (; item_it != items->end(); ++item_it)
+    shifted_items.push_back(Item(item_it->first + distance, item_it->second));
+  items->erase(items->lower_bound(offset), items->end());
 
-  for (int i = start; i != stop; i += step) {
-    item_it = item_its[i];
-    items->insert(std::make_pair(item_it->first + distance,
-                                 item_it->second));
-    items->erase(item_it);
+  // Reinsert them at their new offsets, in order.
+  for (size_t i = 0; i < shifted_items.size(); ++i) {
+    bool inserted = items->insert(shifted_items[i]).second;
+    DCHECK(inserted);
   }
 }
 
@@ -158,21 +146,17 @@ void ShiftReferrers(BlockGraph::Block* self,
   DCHECK_NE(distance, 0);
   DCHECK(referrers != NULL);
 
-  typedef BlockGraph::Block::ReferrerSet ReferrerSet;
+  typedef BlockGraph::Block::Referrer Referrer;
   typedef BlockGraph::Reference Reference;
 
-  ReferrerSet::iterator ref_it = referrers->begin();
-  while (ref_it != referrers->end()) {
-    // We need to keep around the next iterator as 'ref_it' will be invalidated
-    // if we need to update the reference. (It will be deleted and then
-    // recreated.)
-    ReferrerSet::iterator next_ref_it = ref_it;
-    ++next_ref_it;
-
-    BlockGraph::Block* ref_block = ref_it->first;
+  // Iterate over a copy of the referrers, as updating a reference deletes and
+  // then recreates the corresponding referrer.
+  std::vector<Referrer> referrers_copy(referrers->begin(), referrers->end());
+  for (size_t i = 0; i < referrers_copy.size(); ++i) {
+    BlockGraph::Block* ref_block = referrers_copy[i].first;
     // Our own references will have been moved already.
     if (ref_block != self) {
-      BlockGraph::Offset ref_offset = ref_it->second;
+      BlockGraph::Offset ref_offset = referrers_copy[i].second;
 
       Reference ref;
       bool ref_found = ref_block->GetReference(ref_offset, &ref);
@@ -189,8 +173,6 @@ void ShiftReferrers(BlockGraph::Block* self,
         DCHECK(!inserted);
       }
     }
-
-    ref_it = next_ref_it;
   }
 }
 
@@ -1175,6 +1157,47 @@ bool BlockGraph::Block::HasExternalReferrers() const {
 }
 
 bool BlockGraph::Block::SetReference(Offset offset, const Reference& ref) {
+  bool inserted = SetReferenceWithoutReferrer(offset, ref);
+
+  // Record the back-reference.
+  ref.referenced()->referrers_.insert(std::make_pair(this, offset));
+
+  return inserted;
+}
+
+// static
+void BlockGraph::Block::SetReferences(const ReferenceBatch& references) {
+  // Set the references, gathering their back-references keyed by the block
+  // they refer to.
+  typedef std::pair<Block*, Referrer> BackReference;
+  std::vector<BackReference> back_references;
+  back_references.reserve(references.size());
+  ReferenceBatch::const_iterator it = references.begin();
+  for (; it != references.end(); ++it) {
+    Block* block = it->first.first;
+    DCHECK(block != NULL);
+    block->SetReferenceWithoutReferrer(it->first.second, it->second);
+    back_references.push_back(
+        std::make_pair(it->second.referenced(), it->first));
+  }
+
+  // Insert the back-references of each referenced block in a single batch.
+  std::sort(back_references.begin(), back_references.end());
+  std::vector<Referrer> referrers;
+  size_t i = 0;
+  while (i < back_references.size()) {
+    Block* referenced = back_references[i].first;
+    referrers.clear();
+    for (; i < back_references.size() &&
+               back_references[i].first == referenced; ++i) {
+      referrers.push_back(back_references[i].second);
+    }
+    referenced->referrers_.insert(referrers.begin(), referrers.end());
+  }
+}
+
+bool BlockGraph::Block::SetReferenceWithoutReferrer(Offset offset,
+                                                    const Reference& ref) {
   DCHECK(ref.referenced() != NULL);
 
   // Non-code blocks can be referred to by pointers that lie outside of their
@@ -1238,9 +1261,6 @@ bool BlockGraph::Block::SetReference(Offset offset, const Reference& ref) {
     DCHECK(inserted);
   }
 
-  // Record the back-reference.
-  ref.referenced()->referrers_.insert(std::make_pair(this, offset));
-
   return inserted;
 }
 
@@ -1271,25 +1291,24 @@ bool BlockGraph::Block::RemoveReference(Offset offset) {
 }
 
 bool BlockGraph::Block::RemoveAllReferences() {
-  ReferenceMap::iterator it = references_.begin();
-  while (it != references_.end()) {
-    ReferenceMap::iterator to_remove = it;
-    ++it;
-
+  ReferenceMap::const_iterator it = references_.begin();
+  for (; it != references_.end(); ++it) {
     // TODO(rogerm): As an optimization, we don't need to drop intra-block
     //     references when disconnecting from the block_graph. Consider having
     //     BlockGraph::RemoveBlockByIterator() check that the block has no
     //     external referrers before calling this function and erasing the
     //     block.
 
-    // Unregister this reference from the referred block then erase it.
-    BlockGraph::Block* referenced = to_remove->second.referenced();
-    Referrer referrer(this, to_remove->first);
+    // Unregister this reference from the referred block.
+    BlockGraph::Block* referenced = it->second.referenced();
+    Referrer referrer(this, it->first);
     size_t removed = referenced->referrers_.erase(referrer);
     DCHECK_EQ(1U, removed);
-    references_.erase(to_remove);
   }
 
+  // Then erase all of the references at once.
+  references_.clear();
+
   return true;
 }
 
@@ -15,48 +15,80 @@
 {
   'variables': {
     'chromium_code': 1,
+    'block_graph_lib_sources': [
+      'arena.cc',
+      'arena.h',
+      'basic_block.cc',
+      'basic_block.h',
+      'basic_block_assembler.cc',
+      'basic_block_assembler.h',
+      'basic_block_decomposer.cc',
+      'basic_block_decomposer.h',
+      'basic_block_subgraph.cc',
+      'basic_block_subgraph.h',
+      'block_builder.cc',
+      'block_builder.h',
+      'block_graph.cc',
+      'block_graph.h',
+      'block_graph_serializer.cc',
+      'block_graph_serializer.h',
+      'block_hash.cc',
+      'block_hash.h',
+      'block_util.cc',
+      'block_util.h',
+      'filter_util.cc',
+      'filter_util.h',
+      'filterable.cc',
+      'filterable.h',
+      'hot_patching_metadata.h',
+      'iterate.cc',
+      'iterate.h',
+      'ordered_block_graph.cc',
+      'ordered_block_graph.h',
+      'ordered_block_graph_internal.h',
+      'orderer.cc',
+      'orderer.h',
+      'tags.h',
+      'transform.cc',
+      'transform.h',
+      'transform_policy.h',
+      'typed_block.h',
+      'typed_block_internal.h',
+    ],
+    'block_graph_unittest_lib_sources': [
+      'basic_block_assembly_func.asm',
+      'basic_block_test_util.cc',
+      'basic_block_test_util.h',
+      'unittest_util.cc',
+      'unittest_util.h',
+    ],
+    'block_graph_unittests_sources': [
+      'arena_unittest.cc',
+      'basic_block_assembler_unittest.cc',
+      'basic_block_decomposer_unittest.cc',
+      'basic_block_unittest.cc',
+      'basic_block_subgraph_unittest.cc',
+      'block_graph_serializer_unittest.cc',
+      'block_builder_unittest.cc',
+      'block_graph_unittest.cc',
+      'block_hash_unittest.cc',
+      'block_util_unittest.cc',
+      'filter_util_unittest.cc',
+      'filterable_unittest.cc',
+      'iterate_unittest.cc',
+      'ordered_block_graph_unittest.cc',
+      'orderer_unittest.cc',
+      'transform_unittest.cc',
+      'typed_block_unittest.cc',
+      '<(src)/base/test/run_all_unittests.cc',
+    ],
   },
   'targets': [
     {
       'target_name': 'block_graph_lib',
       'type': 'static_library',
       'sources': [
-        'basic_block.cc',
-        'basic_block.h',
-        'basic_block_assembler.cc',
-        'basic_block_assembler.h',
-        'basic_block_decomposer.cc',
-        'basic_block_decomposer.h',
-        'basic_block_subgraph.cc',
-        'basic_block_subgraph.h',
-        'block_builder.cc',
-        'block_builder.h',
-        'block_graph.cc',
-        'block_graph.h',
-        'block_graph_serializer.cc',
-        'block_graph_serializer.h',
-        'block_hash.cc',
-        'block_hash.h',
-        'block_util.cc',
-        'block_util.h',
-        'filter_util.cc',
-        'filter_util.h',
-        'filterable.cc',
-        'filterable.h',
-        'hot_patching_metadata.h',
-        'iterate.cc',
-        'iterate.h',
-        'ordered_block_graph.cc',
-        'ordered_block_graph.h',
-        'ordered_block_graph_internal.h',
-        'orderer.cc',
-        'orderer.h',
-        'tags.h',
-        'transform.cc',
-        'transform.h',
-        'transform_policy.h',
-        'typed_block.h',
-        'typed_block_internal.h',
+        '<@(block_graph_lib_sources)',
       ],
       'dependencies': [
         '<(src)/base/base.gyp:base',
@@ -69,11 +101,7 @@
       'type': 'static_library',
       'includes': ['../build/masm.gypi'],
       'sources': [
-        'basic_block_assembly_func.asm',
-        'basic_block_test_util.cc',
-        'basic_block_test_util.h',
-        'unittest_util.cc',
-        'unittest_util.h',
+        '<@(block_graph_unittest_lib_sources)',
       ],
       'dependencies': [
         'block_graph_lib',
@@ -87,23 +115,7 @@
       'target_name': 'block_graph_unittests',
       'type': 'executable',
       'sources': [
-        'basic_block_assembler_unittest.cc',
-        'basic_block_decomposer_unittest.cc',
-        'basic_block_unittest.cc',
-        'basic_block_subgraph_unittest.cc',
-        'block_graph_serializer_unittest.cc',
-        'block_builder_unittest.cc',
-        'block_graph_unittest.cc',
-        'block_hash_unittest.cc',
-        'block_util_unittest.cc',
-        'filter_util_unittest.cc',
-        'filterable_unittest.cc',
-        'iterate_unittest.cc',
-        'ordered_block_graph_unittest.cc',
-        'orderer_unittest.cc',
-        'transform_unittest.cc',
-        'typed_block_unittest.cc',
-        '<(src)/base/test/run_all_unittests.cc',
+        '<@(block_graph_unittests_sources)',
       ],
       'dependencies': [
         'block_graph_lib',
@@ -114,6 +126,67 @@
         '<(src)/syzygy/common/common.gyp:common_lib',
         '<(src)/syzygy/core/core.gyp:core_lib',
         '<(src)/syzygy/core/core.gyp:core_unittest_utils',
+        '<(src)/syzygy/testing/testing.gyp:testing_lib',
+        '<(src)/testing/gmock.gyp:gmock',
+        '<(src)/testing/gtest.gyp:gtest',
+      ],
+    },
+    # The following targets build the library and its unittests a second time,
+    # with flat storage for block references, referrers and labels (see
+    # block_graph_flat_storage in syzygy.gypi), so that both configurations
+    # are tested. The define changes the layout of BlockGraph::Block, so
+    # everything linked into these unittests must be built with it.
+    {
+      'target_name': 'block_graph_flat_storage_lib',
+      'type': 'static_library',
+      'sources': [
+        '<@(block_graph_lib_sources)',
+      ],
+      'defines': [
+        'SYZYGY_BLOCK_GRAPH_FLAT_STORAGE',
+      ],
+      'direct_dependent_settings': {
+        'defines': [
+          'SYZYGY_BLOCK_GRAPH_FLAT_STORAGE',
+        ],
+      },
+      'dependencies': [
+        '<(src)/base/base.gyp:base',
+        '<(src)/syzygy/common/common.gyp:common_lib',
+        '<(src)/syzygy/core/core.gyp:core_lib',
+      ],
+    },
+    {
+      'target_name': 'block_graph_flat_storage_unittest_lib',
+      'type': 'static_library',
+      'includes': ['../build/masm.gypi'],
+      'sources': [
+        '<@(block_graph_unittest_lib_sources)',
+      ],
+      'dependencies': [
+        'block_graph_flat_storage_lib',
+        '<(src)/base/base.gyp:base',
+        '<(src)/syzygy/common/common.gyp:common_lib',
+        '<(src)/syzygy/core/core.gyp:core_lib',
+        '<(src)/testing/gtest.gyp:gtest',
+      ],
+    },
+    {
+      'target_name': 'block_graph_flat_storage_unittests',
+      'type': 'executable',
+      'sources': [
+        '<@(block_graph_unittests_sources)',
+      ],
+      'dependencies': [
+        'block_graph_flat_storage_lib',
+        'block_graph_flat_storage_unittest_lib',
+        '<(src)/base/base.gyp:base',
+        '<(src)/base/base.gyp:test_support_base',
+        '<(src)/syzygy/assm/assm.gyp:assm_unittest_utils',
+        '<(src)/syzygy/common/common.gyp:common_lib',
+        '<(src)/syzygy/core/core.gyp:core_lib',
+        '<(src)/syzygy/core/core.gyp:core_unittest_utils',
+        '<(src)/syzygy/testing/testing.gyp:testing_lib',
         '<(src)/testing/gmock.gyp:gmock',
         '<(src)/testing/gtest.gyp:gtest',
       ],
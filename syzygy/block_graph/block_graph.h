@@ -36,6 +36,7 @@
 #include "syzygy/common/align.h"
 #include "syzygy/core/address.h"
 #include "syzygy/core/address_space.h"
+#include "syzygy/core/flat_map.h"
 #include "syzygy/core/string_table.h"
 
 namespace block_graph {
@@ -558,11 +559,30 @@ class BlockGraph::Block {
   // This is keyed on block and source offset (not destination offset),
   // to allow one to easily locate and remove the backreferences on change or
   // deletion.
+  //
+  // The referrers, references and labels of a block are stored in trees by
+  // default. When building with SYZYGY_BLOCK_GRAPH_FLAT_STORAGE they are
+  // stored in sorted vectors instead, which iterate in the same order but
+  // where any insertion or removal invalidates all iterators to the mutated
+  // container. Code that mutates the graph while iterating over one of these
+  // containers should iterate over a copy.
   typedef std::pair<Block*, Offset> Referrer;
+#if defined(SYZYGY_BLOCK_GRAPH_FLAT_STORAGE)
+  typedef core::FlatSet<Referrer> ReferrerSet;
+#else
   typedef std::set<Referrer> ReferrerSet;
+#endif
+
+  // A batch of references to set, each keyed by the block and offset it
+  // originates from. See SetReferences.
+  typedef std::vector<std::pair<Referrer, Reference> > ReferenceBatch;
 
   // Map of references that this block makes to other blocks.
+#if defined(SYZYGY_BLOCK_GRAPH_FLAT_STORAGE)
+  typedef core::FlatMap<Offset, Reference> ReferenceMap;
+#else
   typedef std::map<Offset, Reference> ReferenceMap;
+#endif
 
   // Represents a range of data in this block.
   typedef core::AddressRange<Offset, Size> DataRange;
@@ -585,7 +605,11 @@ class BlockGraph::Block {
   // within the block. Note that, while possible, it is NOT guaranteed that
   // all basic blocks are marked with a label. Basic block decomposition should
   // disassemble from the code labels to discover all basic blocks.
+#if defined(SYZYGY_BLOCK_GRAPH_FLAT_STORAGE)
+  typedef core::FlatMap<Offset, Label> LabelMap;
+#else
   typedef std::map<Offset, Label> LabelMap;
+#endif
 
   ~Block();
 
@@ -768,6 +792,16 @@ class BlockGraph::Block {
   // @returns true iff this inserts a new reference.
   bool SetReference(Offset offset, const Reference& ref);
 
+  // Sets a batch of references, originating from any number of blocks. This
+  // is equivalent to calling SetReference for each of them in turn, but the
+  // back-references are inserted into each referenced block all at once.
+  // With flat storage this avoids an insertion linear in the number of
+  // referrers per reference, which makes setting the references of a whole
+  // image quadratic.
+  // @param references the references to set. No two of them may originate
+  //     from the same block and offset.
+  static void SetReferences(const ReferenceBatch& references);
+
   // Retrieve the reference at @p offset if one exists.
   // @param reference on success returns the reference @p offset.
   // @returns true iff there was a reference at @p offset.
@@ -855,6 +889,11 @@ class BlockGraph::Block {
   // data buffer will not have been initialized in any way.
   uint8* AllocateRawData(size_t size);
 
+  // Sets the reference at @p offset to @p ref, like SetReference, but leaves
+  // it to the caller to record the back-reference in @p ref.referenced().
+  // @returns true iff this inserts a new reference.
+  bool SetReferenceWithoutReferrer(Offset offset, const Reference& ref);
+
   BlockId id_;
   BlockType type_;
   Size size_;
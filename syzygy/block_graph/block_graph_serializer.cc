@@ -14,6 +14,11 @@
 
 #include "syzygy/block_graph/block_graph_serializer.h"
 
+#include <algorithm>
+#include <iterator>
+#include <map>
+#include <vector>
+
 #include "base/strings/stringprintf.h"
 
 namespace block_graph {
@@ -31,30 +36,14 @@ using core::OutArchive;
 // Version 3: Added image_format_ block-graph property.
 // Version 4: Deprecated old decomposer attributes.
 // Version 5: Added new Block attributes: padding_before and alignment_offset.
-static const uint32 kSerializedBlockGraphVersion = 5;
+// Version 6: Columnar layout with a string table.
+static const uint32 kSerializedBlockGraphVersion = 6;
 
 // Some constants for use in dealing with backwards compatibility.
 static const uint32 kMinSupportedSerializedBlockGraphVersion = 2;
 static const uint32 kImageFormatPropertyBlockGraphVersion = 3;
 static const uint32 kPaddingBeforePropertyBlockGraphVersion = 5;
-
-// Potentially saves a string, depending on whether or not OMIT_STRINGS is
-// enabled.
-bool MaybeSaveString(const BlockGraphSerializer& bgs,
-                     const std::string& value,
-                     OutArchive* out_archive) {
-  DCHECK(out_archive != NULL);
-
-  if (bgs.has_attributes(BlockGraphSerializer::OMIT_STRINGS))
-    return true;
-
-  if (!out_archive->Save(value)) {
-    LOG(ERROR) << "Unable to save string \"" << value << "\".";
-    return false;
-  }
-
-  return true;
-}
+static const uint32 kColumnarBlockGraphVersion = 6;
 
 // Potentially loads a string, depending on whether or not OMIT_STRINGS is
 // enabled.
@@ -79,8 +68,187 @@ bool ValidAttributes(uint32 attributes, uint32 attributes_max) {
   return (attributes & ~(attributes_max - 1)) == 0;
 }
 
+// Accumulates a column of values in memory. Integers are stored 7 bits per
+// byte, least significant bits first, with the high bit of each byte set if
+// more bytes follow. Signed integers are zigzag encoded first, so that values
+// of small magnitude have short encodings.
+class ColumnWriter {
+ public:
+  void WriteByte(uint8 value) { data_.push_back(value); }
+
+  void WriteUint32(uint32 value) {
+    while (value >= 0x80) {
+      data_.push_back(static_cast<uint8>(value | 0x80));
+      value >>= 7;
+    }
+    data_.push_back(static_cast<uint8>(value));
+  }
+
+  void WriteInt32(int32 value) {
+    WriteUint32((static_cast<uint32>(value) << 1) ^
+                static_cast<uint32>(value >> 31));
+  }
+
+  void WriteBytes(size_t size, const uint8* data) {
+    data_.insert(data_.end(), data, data + size);
+  }
+
+  const std::vector<uint8>& data() const { return data_; }
+
+ private:
+  std::vector<uint8> data_;
+};
+
+// Decodes a column written by ColumnWriter.
+class ColumnReader {
+ public:
+  ColumnReader() : cursor_(0) { }
+
+  // @returns the underlying column, to be filled in before reading.
+  std::vector<uint8>* mutable_data() { return &data_; }
+
+  bool ReadByte(uint8* value) {
+    DCHECK(value != NULL);
+    if (cursor_ >= data_.size())
+      return false;
+    *value = data_[cursor_++];
+    return true;
+  }
+
+  bool ReadUint32(uint32* value) {
+    DCHECK(value != NULL);
+    uint32 result = 0;
+    for (uint32 shift = 0; shift < 32; shift += 7) {
+      uint8 byte = 0;
+      if (!ReadByte(&byte))
+        return false;
+      result |= static_cast<uint32>(byte & 0x7F) << shift;
+      if ((byte & 0x80) == 0) {
+        *value = result;
+        return true;
+      }
+    }
+    return false;
+  }
+
+  bool ReadInt32(int32* value) {
+    DCHECK(value != NULL);
+    uint32 uvalue = 0;
+    if (!ReadUint32(&uvalue))
+      return false;
+    *value = static_cast<int32>((uvalue >> 1) ^ (0 - (uvalue & 1)));
+    return true;
+  }
+
+  bool ReadBytes(size_t size, uint8* data) {
+    DCHECK(data != NULL);
+    if (size > data_.size() - cursor_)
+      return false;
+    ::memcpy(data, &data_[cursor_], size);
+    cursor_ += size;
+    return true;
+  }
+
+  // @returns true if all of the column has been read.
+  bool AtEnd() const { return cursor_ == data_.size(); }
+
+ private:
+  std::vector<uint8> data_;
+  size_t cursor_;
+};
+
+// Assigns ids to strings in order of first use, and writes each distinct
+// string once.
+class StringTableWriter {
+ public:
+  uint32 Intern(const std::string& value) {
+    std::pair<StringIdMap::iterator, bool> result = ids_.insert(
+        std::make_pair(value, static_cast<uint32>(ids_.size())));
+    if (result.second) {
+      column_.WriteUint32(value.size());
+      column_.WriteBytes(value.size(),
+                         reinterpret_cast<const uint8*>(value.data()));
+    }
+    return result.first->second;
+  }
+
+  const std::vector<uint8>& data() const { return column_.data(); }
+
+ private:
+  typedef std::map<std::string, uint32> StringIdMap;
+  StringIdMap ids_;
+  ColumnWriter column_;
+};
+
+// Saves a column as a length-prefixed blob, with a single write.
+bool SaveColumn(const std::vector<uint8>& column, OutArchive* out_archive) {
+  DCHECK(out_archive != NULL);
+  if (!out_archive->Save(static_cast<uint32>(column.size())))
+    return false;
+  if (column.empty())
+    return true;
+  return out_archive->out_stream()->Write(column.size(), &column[0]);
+}
+
+// Loads a column saved by SaveColumn. The size of the column comes from the
+// stream and can't be trusted, and streams can't tell how many bytes they have
+// left. The column is therefore read in chunks, and only grows as bytes are
+// actually read: a corrupt size fails at the end of the stream rather than
+// with a huge allocation.
+bool LoadColumn(InArchive* in_archive, std::vector<uint8>* column) {
+  DCHECK(in_archive != NULL);
+  DCHECK(column != NULL);
+  static const size_t kChunkSize = 1024 * 1024;
+
+  uint32 size = 0;
+  if (!in_archive->Load(&size))
+    return false;
+  column->clear();
+  while (column->size() < size) {
+    size_t offset = column->size();
+    size_t chunk_size = std::min(kChunkSize, size - offset);
+    column->resize(offset + chunk_size);
+    if (!in_archive->in_stream()->Read(chunk_size, &column->at(offset)))
+      return false;
+  }
+  return true;
+}
+
+// Decodes a string table written by StringTableWriter.
+bool LoadStringTable(ColumnReader* column, std::vector<std::string>* strings) {
+  DCHECK(column != NULL);
+  DCHECK(strings != NULL);
+  while (!column->AtEnd()) {
+    uint32 size = 0;
+    if (!column->ReadUint32(&size))
+      return false;
+    std::string value(size, '\0');
+    if (size > 0 &&
+        !column->ReadBytes(size, reinterpret_cast<uint8*>(&value[0]))) {
+      return false;
+    }
+    strings->push_back(value);
+  }
+  return true;
+}
+
+// Reads a string id from @p column and looks it up in @p strings.
+bool ReadString(const std::vector<std::string>& strings,
+                ColumnReader* column,
+                std::string* value) {
+  DCHECK(column != NULL);
+  DCHECK(value != NULL);
+  uint32 id = 0;
+  if (!column->ReadUint32(&id) || id >= strings.size())
+    return false;
+  *value = strings[id];
+  return true;
+}
+
 }  // namespace
 
+const uint32 BlockGraphSerializer::kVersion = kSerializedBlockGraphVersion;
+
 bool BlockGraphSerializer::Save(const BlockGraph& block_graph,
                                 core::OutArchive* out_archive) const {
   CHECK(out_archive != NULL);
@@ -94,27 +262,18 @@ bool BlockGraphSerializer::Save(const BlockGraph& block_graph,
     return false;
   }
 
-  // TODO(etienneb): We should serialize the string table in the block graph,
-  //    and encode string ids instead of the raw strings.
-
   // This function takes care of outputting a meaningful log message on
   // failure.
   if (!SaveBlockGraphProperties(block_graph, out_archive))
     return false;
 
-  // Save the blocks, except for their references. We do that in a second pass
-  // so that when loading the referenced blocks will exist.
-  if (!SaveBlocks(block_graph, out_archive)) {
+  // Save the blocks and their references. The referrers are implicitly saved
+  // by this.
+  if (!SaveColumns(block_graph, out_archive)) {
     LOG(ERROR) << "Unable to save blocks.";
     return false;
   }
 
-  // Save all of the references. The referrers are implicitly saved by this.
-  if (!SaveBlockGraphReferences(block_graph, out_archive)) {
-    LOG(ERROR) << "Unable to save block graph references.";
-    return false;
-  }
-
   return true;
 }
 
@@ -157,6 +316,14 @@ bool BlockGraphSerializer::Load(BlockGraph* block_graph,
   if (!LoadBlockGraphProperties(version, block_graph, in_archive))
     return false;
 
+  if (version >= kColumnarBlockGraphVersion) {
+    if (!LoadColumns(block_graph, in_archive)) {
+      LOG(ERROR) << "Unable to load blocks.";
+      return false;
+    }
+    return true;
+  }
+
   // Load the blocks, except for their references.
   if (!LoadBlocks(version, block_graph, in_archive)) {
     LOG(ERROR) << "Unable to load blocks.";
@@ -224,27 +391,463 @@ bool BlockGraphSerializer::LoadBlockGraphProperties(
   return true;
 }
 
-bool BlockGraphSerializer::SaveBlocks(const BlockGraph& block_graph,
-                                      OutArchive* out_archive) const {
+bool BlockGraphSerializer::SaveColumns(const BlockGraph& block_graph,
+                                       OutArchive* out_archive) const {
   DCHECK(out_archive != NULL);
 
-  if (!out_archive->Save(block_graph.blocks().size())) {
-    LOG(ERROR) << "Unable to save block count.";
-    return false;
-  }
+  COMPILE_ASSERT(BlockGraph::REFERENCE_TYPE_MAX < 16,
+                 reference_type_requires_more_than_one_nibble);
+  COMPILE_ASSERT(BlockGraph::Reference::kMaximumSize < 16,
+                 reference_size_requires_more_than_one_nibble);
+
+  StringTableWriter strings;
+  ColumnWriter blocks;
+  ColumnWriter labels;
+  ColumnWriter references;
+  ColumnWriter data;
 
-  // Output the basic block properties first.
+  // The save block data callback writes to its own blob.
+  std::vector<uint8> callback_data;
+  core::ScopedOutStreamPtr callback_stream(
+      core::CreateByteOutStream(std::back_inserter(callback_data)));
+  OutArchive callback_archive(callback_stream.get());
+
+  bool save_strings = !has_attributes(OMIT_STRINGS);
+  bool save_labels = !has_attributes(OMIT_LABELS);
+
+  blocks.WriteUint32(block_graph.blocks().size());
+
+  // Blocks are visited in order of increasing id, so ids are saved as deltas.
+  BlockGraph::BlockId previous_id = 0;
   BlockGraph::BlockMap::const_iterator it = block_graph.blocks_.begin();
   for (; it != block_graph.blocks_.end(); ++it) {
-    BlockGraph::BlockId block_id = it->first;
     const BlockGraph::Block& block = it->second;
-    if (!out_archive->Save(block_id) ||
-        !SaveBlockProperties(block, out_archive) ||
-        !SaveBlockLabels(block, out_archive) ||
-        !SaveBlockData(block, out_archive)) {
-      LOG(ERROR) << "Unable to save block with id " << block_id << ".";
+    DCHECK_LE(previous_id, block.id());
+    blocks.WriteUint32(block.id() - previous_id);
+    previous_id = block.id();
+
+    blocks.WriteByte(static_cast<uint8>(block.type()));
+    blocks.WriteUint32(block.size());
+    blocks.WriteUint32(block.alignment());
+    blocks.WriteInt32(block.alignment_offset());
+    blocks.WriteUint32(block.padding_before());
+
+    // Source ranges are saved relative to the end of the previous range.
+    const BlockGraph::Block::SourceRanges::RangePairs& range_pairs =
+        block.source_ranges().range_pairs();
+    blocks.WriteUint32(range_pairs.size());
+    BlockGraph::Offset data_end = 0;
+    uint32 src_end = 0;
+    for (size_t i = 0; i < range_pairs.size(); ++i) {
+      const BlockGraph::Block::DataRange& data_range = range_pairs[i].first;
+      const BlockGraph::Block::SourceRange& src_range = range_pairs[i].second;
+      blocks.WriteInt32(data_range.start() - data_end);
+      blocks.WriteUint32(data_range.size());
+      blocks.WriteInt32(
+          static_cast<int32>(src_range.start().value() - src_end));
+      blocks.WriteUint32(src_range.size());
+      data_end = data_range.end();
+      src_end = src_range.end().value();
+    }
+
+    blocks.WriteUint32(block.addr().value());
+    blocks.WriteInt32(static_cast<int32>(block.section()));
+    blocks.WriteUint32(block.attributes());
+    if (save_strings) {
+      blocks.WriteUint32(strings.Intern(block.name()));
+      blocks.WriteUint32(strings.Intern(block.compiland_name()));
+    }
+
+    // Determine whether or not the data is to be saved.
+    blocks.WriteUint32(block.data_size());
+    bool output_data = false;
+    if (block.data_size() > 0) {
+      switch (data_mode_) {
+        default:
+          NOTREACHED();
+
+        case OUTPUT_NO_DATA: {
+          output_data = false;
+          break;
+        }
+
+        case OUTPUT_OWNED_DATA: {
+          blocks.WriteByte(block.owns_data());
+          output_data = block.owns_data();
+          break;
+        }
+
+        case OUTPUT_ALL_DATA: {
+          output_data = true;
+          break;
+        }
+      }
+    }
+    if (output_data)
+      data.WriteBytes(block.data_size(), block.data());
+
+    if (save_block_data_callback_.get() != NULL) {
+      bool data_already_saved = output_data || block.data_size() == 0;
+      if (!save_block_data_callback_->Run(data_already_saved, block,
+                                          &callback_archive)) {
+        LOG(ERROR) << "Block data callback failed for block with id "
+                   << block.id() << ".";
+        return false;
+      }
+    }
+
+    if (save_labels) {
+      COMPILE_ASSERT(BlockGraph::LABEL_ATTRIBUTES_MAX <= (1 << 16),
+                     label_attributes_require_more_than_16_bits);
+
+      labels.WriteUint32(block.labels().size());
+      BlockGraph::Offset previous_offset = 0;
+      BlockGraph::Block::LabelMap::const_iterator label_it =
+          block.labels().begin();
+      for (; label_it != block.labels().end(); ++label_it) {
+        labels.WriteInt32(label_it->first - previous_offset);
+        previous_offset = label_it->first;
+        labels.WriteUint32(label_it->second.attributes());
+        if (save_strings)
+          labels.WriteUint32(strings.Intern(label_it->second.name()));
+      }
+    }
+
+    // Most references are to blocks with nearby ids, and have an identical
+    // offset and base, so they are saved relative to those.
+    references.WriteUint32(block.references().size());
+    BlockGraph::Offset previous_offset = 0;
+    BlockGraph::Block::ReferenceMap::const_iterator ref_it =
+        block.references().begin();
+    for (; ref_it != block.references().end(); ++ref_it) {
+      const BlockGraph::Reference& ref = ref_it->second;
+      DCHECK(ref.referenced() != NULL);
+      references.WriteInt32(ref_it->first - previous_offset);
+      previous_offset = ref_it->first;
+      references.WriteByte((static_cast<uint8>(ref.type()) << 4) |
+                           static_cast<uint8>(ref.size()));
+      references.WriteInt32(
+          static_cast<int32>(ref.referenced()->id() - block.id()));
+      references.WriteInt32(ref.offset());
+      references.WriteInt32(ref.base() - ref.offset());
+    }
+  }
+
+  if (!callback_archive.Flush()) {
+    LOG(ERROR) << "Unable to flush block data callback output.";
+    return false;
+  }
+
+  if (!SaveColumn(strings.data(), out_archive) ||
+      !SaveColumn(blocks.data(), out_archive) ||
+      !SaveColumn(labels.data(), out_archive) ||
+      !SaveColumn(references.data(), out_archive) ||
+      !SaveColumn(data.data(), out_archive) ||
+      !SaveColumn(callback_data, out_archive)) {
+    LOG(ERROR) << "Unable to save block graph columns.";
+    return false;
+  }
+
+  return true;
+}
+
+bool BlockGraphSerializer::LoadColumns(BlockGraph* block_graph,
+                                       InArchive* in_archive) const {
+  DCHECK(block_graph != NULL);
+  DCHECK(in_archive != NULL);
+
+  DCHECK_EQ(0u, block_graph->blocks_.size());
+
+  ColumnReader string_column;
+  ColumnReader blocks;
+  ColumnReader labels;
+  ColumnReader references;
+  ColumnReader data;
+  std::vector<uint8> callback_data;
+  if (!LoadColumn(in_archive, string_column.mutable_data()) ||
+      !LoadColumn(in_archive, blocks.mutable_data()) ||
+      !LoadColumn(in_archive, labels.mutable_data()) ||
+      !LoadColumn(in_archive, references.mutable_data()) ||
+      !LoadColumn(in_archive, data.mutable_data()) ||
+      !LoadColumn(in_archive, &callback_data)) {
+    LOG(ERROR) << "Unable to load block graph columns.";
+    return false;
+  }
+
+  std::vector<std::string> strings;
+  if (!LoadStringTable(&string_column, &strings)) {
+    LOG(ERROR) << "Unable to load string table.";
+    return false;
+  }
+
+  core::ScopedInStreamPtr callback_stream(
+      core::CreateByteInStream(callback_data.begin(), callback_data.end()));
+  InArchive callback_archive(callback_stream.get());
+
+  bool load_strings = !has_attributes(OMIT_STRINGS);
+  bool load_labels = !has_attributes(OMIT_LABELS);
+
+  uint32 count = 0;
+  if (!blocks.ReadUint32(&count)) {
+    LOG(ERROR) << "Unable to load block count.";
+    return false;
+  }
+
+  // All of the blocks are created before any references are, as references
+  // may be to blocks that follow the referring block.
+  BlockGraph::BlockId id = 0;
+  for (uint32 i = 0; i < count; ++i) {
+    uint32 id_delta = 0;
+    if (!blocks.ReadUint32(&id_delta)) {
+      LOG(ERROR) << "Unable to load id for block " << i << " of " << count
+                 << ".";
+      return false;
+    }
+    id += id_delta;
+
+    std::pair<BlockGraph::BlockMap::iterator, bool> result =
+        block_graph->blocks_.insert(
+            std::make_pair(id, BlockGraph::Block(block_graph)));
+    if (!result.second) {
+      LOG(ERROR) << "Unable to insert block with id " << id << ".";
+      return false;
+    }
+    BlockGraph::Block* block = &result.first->second;
+    block->id_ = id;
+
+    uint8 type = 0;
+    uint32 size = 0;
+    uint32 alignment = 0;
+    int32 alignment_offset = 0;
+    uint32 padding_before = 0;
+    uint32 range_count = 0;
+    if (!blocks.ReadByte(&type) ||
+        !blocks.ReadUint32(&size) ||
+        !blocks.ReadUint32(&alignment) ||
+        !blocks.ReadInt32(&alignment_offset) ||
+        !blocks.ReadUint32(&padding_before) ||
+        !blocks.ReadUint32(&range_count)) {
+      LOG(ERROR) << "Unable to load properties for block with id " << id
+                 << ".";
+      return false;
+    }
+
+    BlockGraph::Offset data_end = 0;
+    uint32 src_end = 0;
+    for (uint32 j = 0; j < range_count; ++j) {
+      int32 data_delta = 0;
+      uint32 data_size = 0;
+      int32 src_delta = 0;
+      uint32 src_size = 0;
+      if (!blocks.ReadInt32(&data_delta) ||
+          !blocks.ReadUint32(&data_size) ||
+          !blocks.ReadInt32(&src_delta) ||
+          !blocks.ReadUint32(&src_size)) {
+        LOG(ERROR) << "Unable to load source range " << j << " of "
+                   << range_count << " for block with id " << id << ".";
+        return false;
+      }
+      BlockGraph::Block::DataRange data_range(data_end + data_delta,
+                                              data_size);
+      BlockGraph::Block::SourceRange src_range(
+          RelativeAddress(src_end + src_delta), src_size);
+      if (!block->source_ranges_.Push(data_range, src_range)) {
+        LOG(ERROR) << "Invalid source range " << j << " of " << range_count
+                   << " for block with id " << id << ".";
+        return false;
+      }
+      data_end = data_range.end();
+      src_end = src_range.end().value();
+    }
+
+    uint32 addr = 0;
+    int32 section = 0;
+    uint32 attributes = 0;
+    std::string name;
+    std::string compiland_name;
+    uint32 data_size = 0;
+    if (!blocks.ReadUint32(&addr) ||
+        !blocks.ReadInt32(&section) ||
+        !blocks.ReadUint32(&attributes) ||
+        (load_strings && (!ReadString(strings, &blocks, &name) ||
+                          !ReadString(strings, &blocks, &compiland_name))) ||
+        !blocks.ReadUint32(&data_size)) {
+      LOG(ERROR) << "Unable to load properties for block with id " << id
+                 << ".";
+      return false;
+    }
+
+    if (type > BlockGraph::BLOCK_TYPE_MAX ||
+        !ValidAttributes(attributes, BlockGraph::BLOCK_ATTRIBUTES_MAX)) {
+      LOG(ERROR) << "Invalid block type (" << static_cast<uint32>(type)
+                 << ") and/or attributes ("
+                 << base::StringPrintf("%04X", attributes)
+                 << ") for block with id " << id << ".";
+      return false;
+    }
+
+    block->type_ = static_cast<BlockGraph::BlockType>(type);
+    block->size_ = size;
+    block->alignment_ = alignment;
+    block->alignment_offset_ = alignment_offset;
+    block->padding_before_ = padding_before;
+    block->addr_ = RelativeAddress(addr);
+    block->section_ = static_cast<BlockGraph::SectionId>(section);
+    block->attributes_ = attributes;
+    block->set_name(name);
+    block->set_compiland_name(compiland_name);
+
+    if (load_labels) {
+      uint32 label_count = 0;
+      if (!labels.ReadUint32(&label_count)) {
+        LOG(ERROR) << "Unable to load label count for block with id " << id
+                   << ".";
+        return false;
+      }
+
+      BlockGraph::Offset offset = 0;
+      for (uint32 j = 0; j < label_count; ++j) {
+        int32 offset_delta = 0;
+        uint32 label_attributes = 0;
+        std::string label_name;
+        if (!labels.ReadInt32(&offset_delta) ||
+            !labels.ReadUint32(&label_attributes) ||
+            (load_strings && !ReadString(strings, &labels, &label_name))) {
+          LOG(ERROR) << "Unable to load label " << j << " of " << label_count
+                     << " for block with id " << id << ".";
+          return false;
+        }
+        offset += offset_delta;
+
+        if (!ValidAttributes(label_attributes,
+                             BlockGraph::LABEL_ATTRIBUTES_MAX)) {
+          LOG(ERROR) << "Invalid attributes ("
+                     << base::StringPrintf("%04X", label_attributes)
+                     << ") for block with id " << id << ".";
+          return false;
+        }
+
+        BlockGraph::Label label(label_name, label_attributes);
+        if (!block->SetLabel(offset, label)) {
+          LOG(ERROR) << "Duplicate label at offset " << offset
+                     << " of block with id " << id << ".";
+          return false;
+        }
+      }
+    }
+
+    // This indicates whether or not the data was saved in the data column.
+    bool data_in_column = false;
+    if (data_size > 0) {
+      switch (data_mode_) {
+        default:
+          NOTREACHED();
+
+        case OUTPUT_NO_DATA: {
+          data_in_column = false;
+          break;
+        }
+
+        case OUTPUT_OWNED_DATA: {
+          uint8 owns_data = 0;
+          if (!blocks.ReadByte(&owns_data)) {
+            LOG(ERROR) << "Unable to load 'owns_data' field of block with id "
+                       << id << ".";
+            return false;
+          }
+          data_in_column = owns_data != 0;
+          break;
+        }
+
+        case OUTPUT_ALL_DATA: {
+          data_in_column = true;
+          break;
+        }
+      }
+    }
+
+    if (data_in_column) {
+      block->AllocateData(data_size);
+      DCHECK_EQ(data_size, block->data_size());
+      if (!data.ReadBytes(data_size, block->GetMutableData())) {
+        LOG(ERROR) << "Unable to read data for block with id " << id << ".";
+        return false;
+      }
+    }
+
+    bool callback_needs_to_set_data = !data_in_column && data_size > 0;
+    if (!InvokeLoadBlockDataCallback(callback_needs_to_set_data, data_size,
+                                     block, &callback_archive)) {
+      LOG(ERROR) << "Unable to load data for block with id " << id << ".";
+      return false;
+    }
+  }
+  DCHECK_EQ(count, block_graph->blocks_.size());
+
+  // Now wire up the references.
+  BlockGraph::BlockMap::iterator it = block_graph->blocks_mutable().begin();
+  for (; it != block_graph->blocks_mutable().end(); ++it) {
+    BlockGraph::Block* block = &it->second;
+
+    uint32 ref_count = 0;
+    if (!references.ReadUint32(&ref_count)) {
+      LOG(ERROR) << "Unable to load reference count for block with id "
+                 << block->id() << ".";
       return false;
     }
+
+    BlockGraph::Offset offset = 0;
+    for (uint32 j = 0; j < ref_count; ++j) {
+      int32 offset_delta = 0;
+      uint8 type_size = 0;
+      int32 id_delta = 0;
+      int32 ref_offset = 0;
+      int32 base_delta = 0;
+      if (!references.ReadInt32(&offset_delta) ||
+          !references.ReadByte(&type_size) ||
+          !references.ReadInt32(&id_delta) ||
+          !references.ReadInt32(&ref_offset) ||
+          !references.ReadInt32(&base_delta)) {
+        LOG(ERROR) << "Unable to load reference " << j << " of " << ref_count
+                   << " for block with id " << block->id() << ".";
+        return false;
+      }
+      offset += offset_delta;
+
+      // The type and size are each stored as a nibble of one byte.
+      uint8 type = (type_size >> 4) & 0xF;
+      uint8 size = type_size & 0xF;
+      if (type >= BlockGraph::REFERENCE_TYPE_MAX ||
+          size > BlockGraph::Reference::kMaximumSize) {
+        LOG(ERROR) << "Invalid reference type (" << static_cast<uint32>(type)
+                   << ") and/or size (" << static_cast<uint32>(size) << ").";
+        return false;
+      }
+
+      BlockGraph::BlockId referenced_id = block->id() + id_delta;
+      BlockGraph::Block* referenced = block_graph->GetBlockById(referenced_id);
+      if (referenced == NULL) {
+        LOG(ERROR) << "Unable to find referenced block with id "
+                   << referenced_id << ".";
+        return false;
+      }
+
+      BlockGraph::Reference ref(static_cast<BlockGraph::ReferenceType>(type),
+                                size, referenced, ref_offset,
+                                ref_offset + base_delta);
+      if (!block->SetReference(offset, ref)) {
+        LOG(ERROR) << "Unable to create block reference at offset " << offset
+                   << " of block with id " << block->id() << ".";
+        return false;
+      }
+    }
+  }
+
+  // Every column should have been entirely consumed.
+  if (!blocks.AtEnd() || !labels.AtEnd() || !references.AtEnd() ||
+      !data.AtEnd()) {
+    LOG(ERROR) << "Unexpected trailing data in block graph columns.";
+    return false;
   }
 
   return true;
@@ -295,22 +898,6 @@ bool BlockGraphSerializer::LoadBlocks(uint32 version,
   return true;
 }
 
-bool BlockGraphSerializer::SaveBlockGraphReferences(
-    const BlockGraph& block_graph, OutArchive* out_archive) const {
-  DCHECK(out_archive != NULL);
-
-  BlockGraph::BlockMap::const_iterator it = block_graph.blocks().begin();
-  for (; it != block_graph.blocks().end(); ++it) {
-    if (!SaveBlockReferences(it->second, out_archive)) {
-      LOG(ERROR) << "Unable to save references for block with id "
-                 << it->second.id() << ".";
-      return false;
-    }
-  }
-
-  return true;
-}
-
 bool BlockGraphSerializer::LoadBlockGraphReferences(
     BlockGraph* block_graph, InArchive* in_archive) const {
   DCHECK(block_graph != NULL);
@@ -328,33 +915,6 @@ bool BlockGraphSerializer::LoadBlockGraphReferences(
   return true;
 }
 
-bool BlockGraphSerializer::SaveBlockProperties(const BlockGraph::Block& block,
-                                               OutArchive* out_archive) const {
-  DCHECK(out_archive != NULL);
-
-  uint8 type = static_cast<uint8>(block.type());
-
-  // We use a signed integer for saving the section ID, as -1 is used to
-  // indicate 'no section'.
-  if (!out_archive->Save(type) ||
-      !SaveUint32(block.size(), out_archive) ||
-      !SaveUint32(block.alignment(), out_archive) ||
-      !SaveInt32(block.alignment_offset(), out_archive) ||
-      !SaveUint32(block.padding_before(), out_archive) ||
-      !out_archive->Save(block.source_ranges()) ||
-      !out_archive->Save(block.addr()) ||
-      !SaveInt32(static_cast<uint32>(block.section()), out_archive) ||
-      !out_archive->Save(block.attributes()) ||
-      !MaybeSaveString(*this, block.name(), out_archive) ||
-      !MaybeSaveString(*this, block.compiland_name(), out_archive)) {
-    LOG(ERROR) << "Unable to save properties for block with id "
-               << block.id() << ".";
-    return false;
-  }
-
-  return true;
-}
-
 bool BlockGraphSerializer::LoadBlockPropertiesImpl(uint32 version,
                                                    BlockGraph::Block* block,
                                                    InArchive* in_archive)
@@ -436,41 +996,6 @@ bool BlockGraphSerializer::LoadBlockProperties(uint32 version,
   return true;
 }
 
-bool BlockGraphSerializer::SaveBlockLabels(const BlockGraph::Block& block,
-                                           OutArchive* out_archive) const {
-  DCHECK(out_archive != NULL);
-
-  if (has_attributes(BlockGraphSerializer::OMIT_LABELS))
-    return true;
-
-  uint32 count = block.labels().size();
-  if (!SaveUint32(count, out_archive)) {
-    LOG(ERROR) << "Unable to save label count.";
-    return false;
-  }
-
-  BlockGraph::Block::LabelMap::const_iterator label_iter =
-      block.labels().begin();
-  for (; label_iter != block.labels().end(); ++label_iter) {
-    COMPILE_ASSERT(BlockGraph::LABEL_ATTRIBUTES_MAX <= (1 << 16),
-                   label_attributes_require_more_than_16_bits);
-
-    int32 offset = label_iter->first;
-    const BlockGraph::Label& label = label_iter->second;
-    uint16 attributes = static_cast<uint16>(label.attributes());
-
-    if (!SaveInt32(offset, out_archive) || !out_archive->Save(attributes) ||
-        !MaybeSaveString(*this, label.name(), out_archive)) {
-      LOG(ERROR) << "Unable to save label at offset "
-                 << label_iter->first << " of block with id "
-                 << block.id() << ".";
-      return false;
-    }
-  }
-
-  return true;
-}
-
 bool BlockGraphSerializer::LoadBlockLabels(BlockGraph::Block* block,
                                            InArchive* in_archive) const {
   DCHECK(block != NULL);
@@ -516,73 +1041,6 @@ bool BlockGraphSerializer::LoadBlockLabels(BlockGraph::Block* block,
   return true;
 }
 
-bool BlockGraphSerializer::SaveBlockData(const BlockGraph::Block& block,
-                                         OutArchive* out_archive) const {
-  DCHECK(out_archive != NULL);
-
-  // We always output the data size.
-  uint32 data_size = block.data_size();
-  if (!SaveUint32(data_size, out_archive)) {
-    LOG(ERROR) << "Unable to save block data size for block with id "
-               << block.id() << ".";
-    return false;
-  }
-
-  bool output_data = false;
-
-  if (block.data_size() > 0) {
-    switch (data_mode_) {
-      default:
-        NOTREACHED();
-
-      case OUTPUT_NO_DATA: {
-        output_data = false;
-        break;
-      }
-
-      case OUTPUT_OWNED_DATA: {
-        uint8 owns_data = block.owns_data();
-        if (!out_archive->Save(owns_data)) {
-          LOG(ERROR) << "Unable to save 'owns_data' field of block with id "
-                     << block.id() << ".";
-          return false;
-        }
-
-        output_data = block.owns_data();
-        break;
-      }
-
-      case OUTPUT_ALL_DATA: {
-        output_data = true;
-        break;
-      }
-    }
-  }
-
-  // Save the data if we need to.
-  if (output_data) {
-    DCHECK_LT(0u, block.data_size());
-    if (!out_archive->out_stream()->Write(block.data_size(), block.data())) {
-      LOG(ERROR) << "Unable to save data for block with id "
-                 << block.id() << ".";
-      return false;
-    }
-  }
-
-  // No callback? Then do nothing!
-  if (save_block_data_callback_.get() == NULL)
-    return true;
-
-  // Invoke the callback.
-  bool data_already_saved = output_data || block.data_size() == 0;
-  if (!save_block_data_callback_->Run(data_already_saved,
-                                      block, out_archive)) {
-    return false;
-  }
-
-  return true;
-}
-
 bool BlockGraphSerializer::LoadBlockData(BlockGraph::Block* block,
                                          InArchive* in_archive) const {
   DCHECK(block != NULL);
@@ -648,6 +1106,18 @@ bool BlockGraphSerializer::LoadBlockData(BlockGraph::Block* block,
     }
   }
 
+  return InvokeLoadBlockDataCallback(callback_needs_to_set_data, data_size,
+                                     block, in_archive);
+}
+
+bool BlockGraphSerializer::InvokeLoadBlockDataCallback(
+    bool callback_needs_to_set_data,
+    uint32 data_size,
+    BlockGraph::Block* block,
+    InArchive* in_archive) const {
+  DCHECK(block != NULL);
+  DCHECK(in_archive != NULL);
+
   if (callback_needs_to_set_data) {
     // If we didn't explicitly load the data, then we expect the callback to
     // do it. We make sure there is one.
@@ -681,31 +1151,6 @@ bool BlockGraphSerializer::LoadBlockData(BlockGraph::Block* block,
   return true;
 }
 
-bool BlockGraphSerializer::SaveBlockReferences(const BlockGraph::Block& block,
-                                               OutArchive* out_archive) const {
-  // Output the number of references for this block.
-  if (!out_archive->Save(block.references().size())) {
-    LOG(ERROR) << "Unable to save reference count for block with id "
-               << block.id() << ".";
-    return false;
-  }
-
-  // Output the references as (offset, reference) pairs.
-  BlockGraph::Block::ReferenceMap::const_iterator it =
-      block.references().begin();
-  for (; it != block.references().end(); ++it) {
-    int32 offset = it->first;
-    if (!SaveInt32(offset, out_archive) ||
-        !SaveReference(it->second, out_archive)) {
-      LOG(ERROR) << "Unable to save (offset, reference) pair at offset "
-                 << offset << " of block with id " << block.id() << ".";
-      return false;
-    }
-  }
-
-  return true;
-}
-
 bool BlockGraphSerializer::LoadBlockReferences(BlockGraph* block_graph,
                                                BlockGraph::Block* block,
                                                InArchive* in_archive) const {
@@ -744,34 +1189,6 @@ bool BlockGraphSerializer::LoadBlockReferences(BlockGraph* block_graph,
   return true;
 }
 
-bool BlockGraphSerializer::SaveReference(const BlockGraph::Reference& ref,
-                                         OutArchive* out_archive) const {
-  DCHECK(ref.referenced() != NULL);
-  DCHECK(out_archive != NULL);
-
-  COMPILE_ASSERT(BlockGraph::REFERENCE_TYPE_MAX < 16,
-                 reference_type_requires_more_than_one_nibble);
-  COMPILE_ASSERT(BlockGraph::Reference::kMaximumSize < 16,
-                 reference_size_requires_more_than_one_nibble);
-
-  // The type and size are each stored as a nibble of one byte.
-  uint8 type_size = (static_cast<uint8>(ref.type()) << 4) |
-      static_cast<uint8>(ref.size());
-  int32 offset = ref.offset();
-  // Most often the offset and the base are identical, so we actually save
-  // the base as a difference from the offset to encourage smaller values.
-  int32 base_delta = ref.base() - ref.offset();
-
-  if (!out_archive->Save(type_size) ||
-      !out_archive->Save(ref.referenced()->id()) ||
-      !SaveInt32(offset, out_archive) || !SaveInt32(base_delta, out_archive)) {
-    LOG(ERROR) << "Unable to write reference properties.";
-    return false;
-  }
-
-  return true;
-}
-
 bool BlockGraphSerializer::LoadReference(BlockGraph* block_graph,
                                          BlockGraph::Reference* ref,
                                          InArchive* in_archive) const {
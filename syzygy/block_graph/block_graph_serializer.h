@@ -32,6 +32,10 @@ class BlockGraphSerializer {
   typedef core::OutArchive OutArchive;
   typedef core::RelativeAddress RelativeAddress;
 
+  // The version of the serialization format. It is incremented by any change
+  // to the format, including backwards compatible ones.
+  static const uint32 kVersion;
+
   // An enumeration that governs the mode of data serialization.
   enum DataMode {
     // In this mode no block data is serialized. The data will be recovered from
@@ -211,44 +215,53 @@ class BlockGraphSerializer {
   bool LoadBlockGraphProperties(uint32 version,
                                 BlockGraph* block_graph,
                                 InArchive* in_archive) const;
+  // @}
+
+  // @{
+  // Since version 6 the blocks are saved as a sequence of columns: a string
+  // table, a block table, a label table, a reference table, a blob of block
+  // data and a blob of data written by the save block data callback. Each
+  // column is written with a single write, and holds delta and
+  // variable-length encoded values.
+  bool SaveColumns(const BlockGraph& block_graph,
+                   OutArchive* out_archive) const;
+  bool LoadColumns(BlockGraph* block_graph, InArchive* in_archive) const;
+  // @}
 
-  bool SaveBlocks(const BlockGraph& block_graph, OutArchive* out_archive) const;
+  // @{
+  // Older versions of the block-graph saved the blocks one at a time. These
+  // are used to load them.
   bool LoadBlocks(uint32 version,
                   BlockGraph* block_graph,
                   InArchive* in_archive) const;
-
-  bool SaveBlockGraphReferences(const BlockGraph& block_graph,
-                                OutArchive* out_archive) const;
   bool LoadBlockGraphReferences(BlockGraph* block_graph,
                                 InArchive* in_archive) const;
-
-  bool SaveBlockProperties(const BlockGraph::Block& block,
-                           OutArchive* out_archive) const;
   bool LoadBlockProperties(uint32 version,
                            BlockGraph::Block* block,
                            InArchive* in_archive) const;
-
-  bool SaveBlockLabels(const BlockGraph::Block& block,
-                       OutArchive* out_archive) const;
   bool LoadBlockLabels(BlockGraph::Block* block, InArchive* in_archive) const;
-
-  bool SaveBlockData(const BlockGraph::Block& block,
-                     OutArchive* out_archive) const;
   bool LoadBlockData(BlockGraph::Block* block, InArchive* in_archive) const;
-
-  bool SaveBlockReferences(const BlockGraph::Block& block,
-                           OutArchive* out_archive) const;
   bool LoadBlockReferences(BlockGraph* block_graph,
                            BlockGraph::Block* block,
                            InArchive* in_archive) const;
-
-  bool SaveReference(const BlockGraph::Reference& ref,
-                     OutArchive* out_archive) const;
   bool LoadReference(BlockGraph* block_graph,
                      BlockGraph::Reference* ref,
                      InArchive* in_archive) const;
   // @}
 
+  // Invokes the load block data callback, if any, for a block whose data is
+  // either already set or is to be set by the callback.
+  // @param callback_needs_to_set_data true if the callback must set the data.
+  // @param data_size the size of the data at serialization time.
+  // @param block the block being loaded.
+  // @param in_archive the archive holding the data written by the save block
+  //     data callback.
+  // @returns true on success, false otherwise.
+  bool InvokeLoadBlockDataCallback(bool callback_needs_to_set_data,
+                                   uint32 data_size,
+                                   BlockGraph::Block* block,
+                                   InArchive* in_archive) const;
+
   // @{
   // Utility functions for loading and saving integer values with a simple
   // variable-length encoding.
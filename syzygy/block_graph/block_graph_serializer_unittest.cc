@@ -523,6 +523,46 @@ TEST_F(BlockGraphSerializerTest, RoundTripAllData) {
       eNoBlockDataCallbacks, 0));
 }
 
+TEST_F(BlockGraphSerializerTest, RoundTripOmitStringsAndLabels) {
+  ASSERT_NO_FATAL_FAILURE(TestRoundTrip(
+      BlockGraphSerializer::OUTPUT_ALL_DATA,
+      BlockGraphSerializer::OMIT_STRINGS | BlockGraphSerializer::OMIT_LABELS,
+      eNoBlockDataCallbacks, 0));
+}
+
+TEST_F(BlockGraphSerializerTest, FailsToLoadTruncatedStream) {
+  InitBlockGraph();
+  InitOutArchive();
+  s_.set_data_mode(BlockGraphSerializer::OUTPUT_ALL_DATA);
+  ASSERT_TRUE(s_.Save(bg_, oa_.get()));
+
+  // Drop the tail of the last column.
+  ASSERT_LT(1u, v_.size());
+  v_.resize(v_.size() - 1);
+
+  InitInArchive();
+  BlockGraph bg;
+  ASSERT_FALSE(s_.Load(&bg, ia_.get()));
+}
+
+TEST_F(BlockGraphSerializerTest, FailsToLoadColumnWithImplausibleSize) {
+  InitBlockGraph();
+  InitOutArchive();
+  s_.set_data_mode(BlockGraphSerializer::OUTPUT_ALL_DATA);
+  ASSERT_TRUE(s_.Save(bg_, oa_.get()));
+
+  // The stream ends with the size of the empty block data callback column.
+  // Make it claim far more bytes than the stream holds.
+  ASSERT_LT(4u, v_.size());
+  uint32* size = reinterpret_cast<uint32*>(&v_[v_.size() - 4]);
+  ASSERT_EQ(0u, *size);
+  *size = 0xFFFFFFF0;
+
+  InitInArchive();
+  BlockGraph bg;
+  ASSERT_FALSE(s_.Load(&bg, ia_.get()));
+}
+
 // TODO(chrisha): Do a heck of a lot more testing of protected member functions.
 
 }  // namespace block_graph
@@ -14,11 +14,14 @@
 
 #include "syzygy/block_graph/block_graph.h"
 
+#include "base/strings/stringprintf.h"
+#include "base/time/time.h"
 #include "gmock/gmock.h"
 #include "gtest/gtest.h"
 #include "syzygy/block_graph/typed_block.h"
 #include "syzygy/block_graph/unittest_util.h"
 #include "syzygy/core/unittest_util.h"
+#include "syzygy/testing/metrics.h"
 
 namespace block_graph {
 
@@ -33,6 +36,14 @@ using core::ScopedOutStreamPtr;
 
 const size_t kPtrSize = sizeof(core::RelativeAddress);
 
+// The name under which the block storage mode is reported in metrics. These
+// unittests are built with both storage modes.
+#if defined(SYZYGY_BLOCK_GRAPH_FLAT_STORAGE)
+const char kBlockStorageName[] = "FlatStorage";
+#else
+const char kBlockStorageName[] = "TreeStorage";
+#endif
+
 TEST(SectionTest, CreationAndProperties) {
   BlockGraph::Section section(0, "foo", 1);
   ASSERT_EQ(0, section.id());
@@ -828,6 +839,130 @@ TEST_F(BlockTest, RemoveAllReferences) {
   EXPECT_EQ(0U, block2->referrers().size());
 }
 
+TEST_F(BlockTest, SetReferences) {
+  BlockGraph::Block* block1 = image_.AddBlock(
+      BlockGraph::DATA_BLOCK, 40, "Block1");
+  BlockGraph::Block* block2 = image_.AddBlock(
+      BlockGraph::DATA_BLOCK, 40, "Block2");
+  ASSERT_TRUE(block1 != NULL);
+  ASSERT_TRUE(block2 != NULL);
+
+  // Start with a reference that the batch replaces.
+  EXPECT_TRUE(block1->SetReference(
+      0, BlockGraph::Reference(BlockGraph::ABSOLUTE_REF, 4, block2, 0, 0)));
+
+  // Set references in both directions, out of order.
+  BlockGraph::Reference ref1(BlockGraph::ABSOLUTE_REF, 4, block1, 8, 8);
+  BlockGraph::Reference ref2(BlockGraph::ABSOLUTE_REF, 4, block2, 4, 4);
+  BlockGraph::Block::ReferenceBatch batch;
+  batch.push_back(std::make_pair(std::make_pair(block2, 12), ref1));
+  batch.push_back(std::make_pair(std::make_pair(block1, 4), ref2));
+  batch.push_back(std::make_pair(std::make_pair(block2, 0), ref1));
+  batch.push_back(std::make_pair(std::make_pair(block1, 0), ref1));
+  BlockGraph::Block::SetReferences(batch);
+
+  BlockGraph::Block::ReferenceMap expected_references;
+  expected_references.insert(std::make_pair(0, ref1));
+  expected_references.insert(std::make_pair(4, ref2));
+  EXPECT_EQ(expected_references, block1->references());
+  expected_references.clear();
+  expected_references.insert(std::make_pair(0, ref1));
+  expected_references.insert(std::make_pair(12, ref1));
+  EXPECT_EQ(expected_references, block2->references());
+
+  // The back-references match those SetReference would have recorded.
+  BlockGraph::Block::ReferrerSet expected_referrers;
+  expected_referrers.insert(std::make_pair(block1, 0));
+  expected_referrers.insert(std::make_pair(block2, 0));
+  expected_referrers.insert(std::make_pair(block2, 12));
+  EXPECT_THAT(expected_referrers, testing::ContainerEq(block1->referrers()));
+  expected_referrers.clear();
+  expected_referrers.insert(std::make_pair(block1, 4));
+  EXPECT_THAT(expected_referrers, testing::ContainerEq(block2->referrers()));
+}
+
+// Measures the time it takes to populate a block-graph shaped like a
+// decomposed image, and the throughput of iterating over the references,
+// referrers and labels of its blocks.
+TEST(BlockGraphTest, StoragePerfTest) {
+  static const size_t kBlockCount = 20000;
+  static const size_t kReferencesPerBlock = 16;
+  static const size_t kLabelsPerBlock = 4;
+  static const BlockGraph::Size kBlockSize =
+      kReferencesPerBlock * sizeof(uint32);
+
+  BlockGraph block_graph;
+  std::vector<BlockGraph::Block*> blocks;
+  for (size_t i = 0; i < kBlockCount; ++i) {
+    blocks.push_back(block_graph.AddBlock(
+        BlockGraph::CODE_BLOCK, kBlockSize,
+        base::StringPrintf("block%d", static_cast<int>(i))));
+  }
+
+  // Reference blocks all over the graph, as code does.
+  base::Time start = base::Time::Now();
+  BlockGraph::Block::ReferenceBatch batch;
+  for (size_t i = 0; i < kBlockCount; ++i) {
+    for (size_t j = 0; j < kReferencesPerBlock; ++j) {
+      BlockGraph::Block* referenced = blocks[(i * 7919 + j * 104729) %
+                                             kBlockCount];
+      BlockGraph::Offset offset = static_cast<BlockGraph::Offset>(
+          j * sizeof(uint32));
+      batch.push_back(std::make_pair(
+          std::make_pair(blocks[i], offset),
+          BlockGraph::Reference(BlockGraph::ABSOLUTE_REF, sizeof(uint32),
+                                referenced, 0, 0)));
+    }
+    for (size_t j = 0; j < kLabelsPerBlock; ++j) {
+      blocks[i]->SetLabel(
+          static_cast<BlockGraph::Offset>(j * kBlockSize / kLabelsPerBlock),
+          "label", BlockGraph::CODE_LABEL);
+    }
+  }
+  BlockGraph::Block::SetReferences(batch);
+  base::Time populated = base::Time::Now();
+
+  // Walk all of the references, referrers and labels a few times.
+  static const size_t kIterations = 10;
+  size_t items = 0;
+  size_t checksum = 0;
+  for (size_t i = 0; i < kIterations; ++i) {
+    BlockGraph::BlockMap::const_iterator block_it =
+        block_graph.blocks().begin();
+    for (; block_it != block_graph.blocks().end(); ++block_it) {
+      const BlockGraph::Block& block = block_it->second;
+
+      BlockGraph::Block::ReferenceMap::const_iterator ref_it =
+          block.references().begin();
+      for (; ref_it != block.references().end(); ++ref_it, ++items)
+        checksum += ref_it->first + ref_it->second.offset();
+
+      BlockGraph::Block::ReferrerSet::const_iterator referrer_it =
+          block.referrers().begin();
+      for (; referrer_it != block.referrers().end(); ++referrer_it, ++items)
+        checksum += referrer_it->second;
+
+      BlockGraph::Block::LabelMap::const_iterator label_it =
+          block.labels().begin();
+      for (; label_it != block.labels().end(); ++label_it, ++items)
+        checksum += label_it->first;
+    }
+  }
+  base::Time iterated = base::Time::Now();
+  EXPECT_NE(0U, checksum);
+  EXPECT_EQ(kIterations * kBlockCount *
+                (2 * kReferencesPerBlock + kLabelsPerBlock),
+            items);
+
+  std::string prefix = base::StringPrintf("Syzygy.BlockGraph.%s",
+                                          kBlockStorageName);
+  testing::EmitMetric(prefix + ".PopulateSeconds",
+                      (populated - start).InSecondsF());
+  testing::EmitMetric(
+      prefix + ".IterationItemsPerSecond",
+      static_cast<double>(items) / (iterated - populated).InSecondsF());
+}
+
 TEST(BlockGraphTest, BlockTypeToString) {
   for (int type = 0; type < BlockGraph::BLOCK_TYPE_MAX; ++type) {
     BlockGraph::BlockType block_type =
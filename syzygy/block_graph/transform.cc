@@ -14,12 +14,192 @@
 
 #include "syzygy/block_graph/transform.h"
 
+#include <algorithm>
+#include <map>
+#include <set>
+
+#include "base/memory/scoped_vector.h"
+#include "base/synchronization/waitable_event.h"
+#include "base/threading/simple_thread.h"
 #include "syzygy/block_graph/basic_block_decomposer.h"
 #include "syzygy/block_graph/block_builder.h"
 #include "syzygy/block_graph/block_util.h"
 
 namespace block_graph {
 
+namespace {
+
+// The maximal number of blocks that are considered at once by
+// ApplyBasicBlockSubGraphTransformInParallel. This bounds the number of
+// subgraphs that are held in memory.
+const size_t kMaxBlocksInFlight = 1024;
+
+// Decomposes and transforms a single block. This is run on a worker thread,
+// and only reads from the block graph. Completion is signaled so that the
+// items of a layer can be waited on while the pool keeps running.
+class DecomposeAndTransformWorkItem
+    : public base::DelegateSimpleThread::Delegate {
+ public:
+  DecomposeAndTransformWorkItem(
+      BasicBlockSubGraphTransformInterface* transform,
+      const TransformPolicyInterface* policy,
+      BlockGraph* block_graph,
+      BlockGraph::Block* block)
+      : transform_(transform), policy_(policy), block_graph_(block_graph),
+        block_(block), unsupported_instructions_(false), succeeded_(false),
+        done_(true, false) {
+  }
+
+  // @name base::DelegateSimpleThread::Delegate implementation.
+  // @{
+  virtual void Run() override {
+    DecomposeAndTransform();
+    done_.Signal();
+  }
+  // @}
+
+  // Waits until this item has been run.
+  void WaitUntilDone() { done_.Wait(); }
+
+  BlockGraph::Block* block() const { return block_; }
+  BasicBlockSubGraph* subgraph() { return &subgraph_; }
+  bool unsupported_instructions() const { return unsupported_instructions_; }
+  bool succeeded() const { return succeeded_; }
+
+ private:
+  void DecomposeAndTransform() {
+    BasicBlockDecomposer bb_decomposer(block_, &subgraph_);
+    if (!bb_decomposer.Decompose()) {
+      unsupported_instructions_ =
+          bb_decomposer.contains_unsupported_instructions();
+      return;
+    }
+
+    succeeded_ = transform_->TransformBasicBlockSubGraph(
+        policy_, block_graph_, &subgraph_);
+  }
+
+  BasicBlockSubGraphTransformInterface* transform_;
+  const TransformPolicyInterface* policy_;
+  BlockGraph* block_graph_;
+  BlockGraph::Block* block_;
+  BasicBlockSubGraph subgraph_;
+  bool unsupported_instructions_;
+  bool succeeded_;
+  base::WaitableEvent done_;
+
+  DISALLOW_COPY_AND_ASSIGN(DecomposeAndTransformWorkItem);
+};
+
+typedef std::map<const BlockGraph::Block*, size_t> BlockLayerMap;
+
+// Adds the layer of @p other to @p layers, if @p other has already been
+// assigned one.
+void AddNeighbourLayer(const BlockLayerMap& block_layers,
+                       const BlockGraph::Block* other,
+                       std::set<size_t>* layers) {
+  BlockLayerMap::const_iterator it = block_layers.find(other);
+  if (it != block_layers.end())
+    layers->insert(it->second);
+}
+
+// Splits @p blocks in layers, such that no two blocks of a layer refer to one
+// another. Each block goes in the first layer that none of the blocks it is
+// connected to occupy, so that a chain of references alternates between two
+// layers rather than requiring a layer per block.
+void AssignLayers(BlockVector::const_iterator begin,
+                  BlockVector::const_iterator end,
+                  std::vector<BlockVector>* layers) {
+  DCHECK(layers != NULL);
+
+  BlockLayerMap block_layers;
+  for (BlockVector::const_iterator it = begin; it != end; ++it) {
+    BlockGraph::Block* block = *it;
+
+    std::set<size_t> neighbour_layers;
+    BlockGraph::Block::ReferenceMap::const_iterator ref_it =
+        block->references().begin();
+    for (; ref_it != block->references().end(); ++ref_it) {
+      AddNeighbourLayer(block_layers, ref_it->second.referenced(),
+                        &neighbour_layers);
+    }
+
+    BlockGraph::Block::ReferrerSet::const_iterator referrer_it =
+        block->referrers().begin();
+    for (; referrer_it != block->referrers().end(); ++referrer_it)
+      AddNeighbourLayer(block_layers, referrer_it->first, &neighbour_layers);
+
+    size_t layer = 0;
+    while (neighbour_layers.count(layer) != 0)
+      ++layer;
+
+    bool inserted = block_layers.insert(std::make_pair(block, layer)).second;
+    DCHECK(inserted);
+
+    if (layers->size() <= layer)
+      layers->resize(layer + 1);
+    (*layers)[layer].push_back(block);
+  }
+}
+
+// Decomposes and transforms the blocks of @p layer on @p pool, then merges
+// the resulting subgraphs one at a time, in order. This waits for all of the
+// work it hands to @p pool, even on failure.
+bool TransformLayer(BasicBlockSubGraphTransformInterface* transform,
+                    const TransformPolicyInterface* policy,
+                    BlockGraph* block_graph,
+                    const BlockVector& layer,
+                    base::DelegateSimpleThreadPool* pool,
+                    BlockVector* new_blocks) {
+  DCHECK(pool != NULL);
+
+  ScopedVector<DecomposeAndTransformWorkItem> work_items;
+  for (size_t i = 0; i < layer.size(); ++i) {
+    BlockGraph::Block* block = layer[i];
+    DCHECK_EQ(BlockGraph::CODE_BLOCK, block->type());
+    DCHECK(policy->BlockIsSafeToBasicBlockDecompose(block));
+
+    work_items.push_back(new DecomposeAndTransformWorkItem(
+        transform, policy, block_graph, block));
+    pool->AddWork(work_items.back());
+  }
+  for (size_t i = 0; i < work_items.size(); ++i)
+    work_items[i]->WaitUntilDone();
+
+  for (size_t i = 0; i < work_items.size(); ++i) {
+    DecomposeAndTransformWorkItem* work_item = work_items[i];
+
+    // If the failure is due to unsupported instructions then simply mark the
+    // block as undecomposable so it won't be processed again.
+    if (work_item->unsupported_instructions()) {
+      VLOG(1) << "Block contains unsupported instruction(s): "
+              << BlockInfo(work_item->block());
+      work_item->block()->set_attribute(BlockGraph::UNSUPPORTED_INSTRUCTIONS);
+      continue;
+    }
+
+    if (!work_item->succeeded()) {
+      LOG(ERROR) << "Transform \"" << transform->name() << "\" failed for "
+                 << BlockInfo(work_item->block()) << ".";
+      return false;
+    }
+
+    BlockBuilder builder(block_graph);
+    if (!builder.Merge(work_item->subgraph()))
+      return false;
+
+    if (new_blocks != NULL) {
+      new_blocks->insert(new_blocks->end(),
+                         builder.new_blocks().begin(),
+                         builder.new_blocks().end());
+    }
+  }
+
+  return true;
+}
+
+}  // namespace
+
 bool ApplyBlockGraphTransform(BlockGraphTransformInterface* transform,
                               const TransformPolicyInterface* policy,
                               BlockGraph* block_graph,
@@ -162,4 +342,49 @@ bool ApplyBasicBlockSubGraphTransforms(
   return true;
 }
 
+bool ApplyBasicBlockSubGraphTransformInParallel(
+    BasicBlockSubGraphTransformInterface* transform,
+    const TransformPolicyInterface* policy,
+    BlockGraph* block_graph,
+    const BlockVector& blocks,
+    size_t max_workers,
+    BlockVector* new_blocks) {
+  DCHECK(transform != NULL);
+  DCHECK(policy != NULL);
+  DCHECK(block_graph != NULL);
+  DCHECK_LT(0U, max_workers);
+
+  if (new_blocks != NULL)
+    new_blocks->clear();
+
+  // A single pool serves all of the layers. It is only joined once all of the
+  // work has been handed out.
+  base::DelegateSimpleThreadPool pool(
+      "ApplyBasicBlockSubGraphTransformInParallel",
+      static_cast<int>(max_workers));
+  pool.Start();
+
+  bool result = true;
+  BlockVector::const_iterator window_begin = blocks.begin();
+  while (result && window_begin != blocks.end()) {
+    size_t window_size = std::min(
+        kMaxBlocksInFlight,
+        static_cast<size_t>(blocks.end() - window_begin));
+    BlockVector::const_iterator window_end = window_begin + window_size;
+
+    std::vector<BlockVector> layers;
+    AssignLayers(window_begin, window_end, &layers);
+    window_begin = window_end;
+
+    for (size_t i = 0; result && i < layers.size(); ++i) {
+      result = TransformLayer(transform, policy, block_graph, layers[i], &pool,
+                              new_blocks);
+    }
+  }
+
+  pool.JoinAll();
+
+  return result;
+}
+
 }  // namespace block_graph
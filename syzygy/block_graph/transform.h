@@ -138,6 +138,34 @@ bool ApplyBasicBlockSubGraphTransforms(
     BlockGraph::Block* block,
     BlockVector* new_blocks);
 
+// Applies the provided BasicBlockSubGraphTransform to a series of blocks,
+// using up to @p max_workers threads. The blocks are basic-block decomposed
+// and transformed concurrently, while the resulting subgraphs are merged back
+// into the block graph one at a time. Blocks that directly refer to one another
+// are never in flight at the same time. The order in which blocks are merged
+// only depends on @p blocks and on their references, so the resulting block
+// graph does not depend on @p max_workers.
+//
+// @param transform the transform to apply. It is invoked concurrently on
+//     distinct subgraphs, and it must not modify @p block_graph.
+// @param policy The policy object restricting how the transform is applied.
+// @param block_graph the block graph containing the blocks to be transformed.
+// @param blocks the blocks to be transformed. Each block may only appear once.
+// @param max_workers the maximal number of worker threads to use.
+// @param new_blocks On success, the newly created blocks will be returned
+//     here, in the order they were merged. Note that this parameter may be
+//     NULL if you are not interested in retrieving the set of new blocks.
+// @pre each of @p blocks must be a code block.
+// @returns true on success, false otherwise. On failure, some of @p blocks
+//     may already have been transformed.
+bool ApplyBasicBlockSubGraphTransformInParallel(
+    BasicBlockSubGraphTransformInterface* transform,
+    const TransformPolicyInterface* policy,
+    BlockGraph* block_graph,
+    const BlockVector& blocks,
+    size_t max_workers,
+    BlockVector* new_blocks);
+
 }  // namespace block_graph
 
 #endif  // SYZYGY_BLOCK_GRAPH_TRANSFORM_H_
@@ -16,8 +16,13 @@
 
 #include "syzygy/block_graph/transform.h"
 
+#include <map>
+
+#include "base/strings/stringprintf.h"
+#include "base/synchronization/lock.h"
 #include "gmock/gmock.h"
 #include "gtest/gtest.h"
+#include "syzygy/block_graph/basic_block_assembler.h"
 #include "syzygy/block_graph/unittest_util.h"
 
 namespace block_graph {
@@ -153,6 +158,134 @@ class MockBasicBlockSubGraphTransform :
                     BasicBlockSubGraph*));
 };
 
+// A basic-block transform that counts the subgraphs it's applied to. It may be
+// invoked concurrently.
+class CountingBasicBlockSubGraphTransform :
+    public BasicBlockSubGraphTransformInterface {
+ public:
+  CountingBasicBlockSubGraphTransform() : count_(0) { }
+  virtual ~CountingBasicBlockSubGraphTransform() { }
+
+  virtual const char* name() const {
+    return "CountingBasicBlockSubGraphTransform";
+  }
+
+  virtual bool TransformBasicBlockSubGraph(
+      const TransformPolicyInterface* policy,
+      BlockGraph* block_graph,
+      BasicBlockSubGraph* basic_block_subgraph) {
+    base::AutoLock auto_lock(lock_);
+    ++count_;
+    return true;
+  }
+
+  size_t count() const {
+    base::AutoLock auto_lock(lock_);
+    return count_;
+  }
+
+ private:
+  mutable base::Lock lock_;
+  size_t count_;
+};
+
+// A basic-block transform that prepends a nop to each basic code block. It
+// is stateless, so it may be invoked concurrently.
+class NopBasicBlockSubGraphTransform :
+    public BasicBlockSubGraphTransformInterface {
+ public:
+  virtual ~NopBasicBlockSubGraphTransform() { }
+
+  virtual const char* name() const {
+    return "NopBasicBlockSubGraphTransform";
+  }
+
+  virtual bool TransformBasicBlockSubGraph(
+      const TransformPolicyInterface* policy,
+      BlockGraph* block_graph,
+      BasicBlockSubGraph* basic_block_subgraph) {
+    BasicBlockSubGraph::BBCollection::iterator it =
+        basic_block_subgraph->basic_blocks().begin();
+    for (; it != basic_block_subgraph->basic_blocks().end(); ++it) {
+      BasicCodeBlock* bb = BasicCodeBlock::Cast(*it);
+      if (bb == NULL)
+        continue;
+      BasicBlockAssembler assm(bb->instructions().begin(),
+                               &bb->instructions());
+      assm.nop(1);
+    }
+    return true;
+  }
+};
+
+// Adds a data block and @p count code blocks to @p block_graph. The code
+// blocks form a chain of references, each of them referring to the previous
+// one, and the first one referring to the data block. The code blocks are
+// returned in @p code_blocks.
+void AddChainOfCodeBlocks(size_t count,
+                          BlockGraph* block_graph,
+                          BlockVector* code_blocks) {
+  BlockGraph::Block* data_block = block_graph->AddBlock(
+      BlockGraph::DATA_BLOCK, sizeof(kDataBytes), "Data");
+  ASSERT_TRUE(data_block != NULL);
+  data_block->SetData(reinterpret_cast<const uint8*>(&kDataBytes),
+                      sizeof(kDataBytes));
+
+  BlockGraph::Block* referenced = data_block;
+  BlockGraph::Offset offset = kOffsetOfData;
+  for (size_t i = 0; i < count; ++i) {
+    BlockGraph::Block* block = block_graph->AddBlock(
+        BlockGraph::CODE_BLOCK, sizeof(kCodeBytes),
+        base::StringPrintf("Code%d", static_cast<int>(i)));
+    ASSERT_TRUE(block != NULL);
+    ASSERT_TRUE(block->SetLabel(
+        kOffsetOfCode,
+        BlockGraph::Label("Code", BlockGraph::CODE_LABEL)));
+    block->SetData(kCodeBytes, sizeof(kCodeBytes));
+    ASSERT_TRUE(block->SetReference(
+        kOffsetOfReferenceToData,
+        BlockGraph::Reference(BlockGraph::RELATIVE_REF,
+                              BlockGraph::Reference::kMaximumSize,
+                              referenced, offset, offset)));
+    code_blocks->push_back(block);
+
+    referenced = block;
+    offset = kOffsetOfCode;
+  }
+
+  ASSERT_TRUE(data_block->SetReference(
+      kOffsetOfReferenceToCode,
+      BlockGraph::Reference(BlockGraph::RELATIVE_REF,
+                            BlockGraph::Reference::kMaximumSize,
+                            code_blocks->front(), kOffsetOfCode,
+                            kOffsetOfCode)));
+}
+
+// Describes the size, data and references of each block of @p block_graph,
+// keyed by block name.
+void DescribeBlockGraph(const BlockGraph& block_graph,
+                        std::map<std::string, std::string>* description) {
+  BlockGraph::BlockMap::const_iterator it = block_graph.blocks().begin();
+  for (; it != block_graph.blocks().end(); ++it) {
+    const BlockGraph::Block& block = it->second;
+    std::string block_description = base::StringPrintf(
+        "size=%d", static_cast<int>(block.size()));
+    for (size_t i = 0; i < block.data_size(); ++i)
+      base::StringAppendF(&block_description, " %02X", block.data()[i]);
+
+    BlockGraph::Block::ReferenceMap::const_iterator ref_it =
+        block.references().begin();
+    for (; ref_it != block.references().end(); ++ref_it) {
+      base::StringAppendF(&block_description, " [%d]->%s+%d",
+                          ref_it->first,
+                          ref_it->second.referenced()->name().c_str(),
+                          ref_it->second.offset());
+    }
+
+    (*description)[block.name()] = block_description;
+  }
+}
+
 }  // namespace
 
 TEST_F(ApplyBlockGraphTransformTest, NormalTransformSucceeds) {
@@ -296,4 +429,120 @@ TEST_F(ApplyBasicBlockSubGraphTransformTest, VectorTransformSucceeds) {
                                                 &new_blocks));
 }
 
+TEST_F(ApplyBasicBlockSubGraphTransformTest, ParallelTransformSucceeds) {
+  // Create more code blocks. Every other block refers to the previous one
+  // rather than to the data block, so that some blocks must be merged in
+  // order.
+  const size_t kNumCodeBlocks = 16;
+  BlockVector code_blocks;
+  code_blocks.push_back(code_block_);
+  for (size_t i = 1; i < kNumCodeBlocks; ++i) {
+    BlockGraph::Block* block = block_graph_.AddBlock(
+        BlockGraph::CODE_BLOCK, sizeof(kCodeBytes),
+        base::StringPrintf("Code%d", static_cast<int>(i)));
+    ASSERT_TRUE(block != NULL);
+    ASSERT_TRUE(block->SetLabel(
+        kOffsetOfCode,
+        BlockGraph::Label("Code", BlockGraph::CODE_LABEL)));
+    block->SetData(kCodeBytes, sizeof(kCodeBytes));
+
+    BlockGraph::Block* referenced = data_block_;
+    BlockGraph::Offset offset = kOffsetOfData;
+    if (i % 2 == 1) {
+      referenced = code_blocks.back();
+      offset = kOffsetOfCode;
+    }
+    ASSERT_TRUE(block->SetReference(kOffsetOfReferenceToData,
+                                    MakeReference(referenced, offset)));
+    code_blocks.push_back(block);
+  }
+
+  std::map<std::string, std::string> expected_referenced;
+  for (size_t i = 0; i < code_blocks.size(); ++i) {
+    BlockGraph::Reference ref;
+    ASSERT_TRUE(code_blocks[i]->GetReference(kOffsetOfReferenceToData, &ref));
+    expected_referenced[code_blocks[i]->name()] = ref.referenced()->name();
+  }
+
+  CountingBasicBlockSubGraphTransform transform;
+  BlockVector new_blocks;
+  EXPECT_TRUE(ApplyBasicBlockSubGraphTransformInParallel(&transform,
+                                                         &policy_,
+                                                         &block_graph_,
+                                                         code_blocks,
+                                                         4,
+                                                         &new_blocks));
+  code_block_ = NULL;
+
+  EXPECT_EQ(kNumCodeBlocks, transform.count());
+  ASSERT_EQ(kNumCodeBlocks, new_blocks.size());
+  EXPECT_EQ(kNumCodeBlocks + 1, block_graph_.blocks().size());
+
+  // Every new block should refer to the new version of the block its
+  // original referred to.
+  for (size_t i = 0; i < new_blocks.size(); ++i) {
+    const BlockGraph::Block* new_block = new_blocks[i];
+    EXPECT_EQ(new_block, block_graph_.GetBlockById(new_block->id()));
+    EXPECT_EQ(sizeof(kCodeBytes), new_block->size());
+
+    BlockGraph::Reference ref;
+    ASSERT_TRUE(new_block->GetReference(kOffsetOfReferenceToData, &ref));
+    EXPECT_EQ(expected_referenced[new_block->name()],
+              ref.referenced()->name());
+    EXPECT_EQ(ref.referenced(),
+              block_graph_.GetBlockById(ref.referenced()->id()));
+  }
+
+  // The data block should refer to the new version of the first code block.
+  BlockGraph::Reference ref;
+  ASSERT_TRUE(data_block_->GetReference(kOffsetOfReferenceToCode, &ref));
+  EXPECT_EQ("Code", ref.referenced()->name());
+  EXPECT_EQ(ref.referenced(),
+            block_graph_.GetBlockById(ref.referenced()->id()));
+}
+
+TEST_F(ApplyBasicBlockSubGraphTransformTest,
+       ParallelTransformMatchesSerialTransform) {
+  const size_t kNumCodeBlocks = 64;
+
+  // Transform the blocks one at a time.
+  BlockGraph serial_block_graph;
+  BlockVector serial_blocks;
+  ASSERT_NO_FATAL_FAILURE(AddChainOfCodeBlocks(
+      kNumCodeBlocks, &serial_block_graph, &serial_blocks));
+  NopBasicBlockSubGraphTransform transform;
+  size_t serial_new_block_count = 0;
+  for (size_t i = 0; i < serial_blocks.size(); ++i) {
+    BlockVector new_blocks;
+    ASSERT_TRUE(ApplyBasicBlockSubGraphTransform(&transform,
+                                                 &policy_,
+                                                 &serial_block_graph,
+                                                 serial_blocks[i],
+                                                 &new_blocks));
+    serial_new_block_count += new_blocks.size();
+  }
+
+  // Transform the same blocks concurrently.
+  BlockGraph parallel_block_graph;
+  BlockVector parallel_blocks;
+  ASSERT_NO_FATAL_FAILURE(AddChainOfCodeBlocks(
+      kNumCodeBlocks, &parallel_block_graph, &parallel_blocks));
+  BlockVector new_blocks;
+  ASSERT_TRUE(ApplyBasicBlockSubGraphTransformInParallel(&transform,
+                                                         &policy_,
+                                                         &parallel_block_graph,
+                                                         parallel_blocks,
+                                                         4,
+                                                         &new_blocks));
+  EXPECT_EQ(serial_new_block_count, new_blocks.size());
+
+  // Both block graphs should have the same contents.
+  std::map<std::string, std::string> serial_description;
+  std::map<std::string, std::string> parallel_description;
+  DescribeBlockGraph(serial_block_graph, &serial_description);
+  DescribeBlockGraph(parallel_block_graph, &parallel_description);
+  EXPECT_EQ(kNumCodeBlocks + 1, serial_description.size());
+  EXPECT_EQ(serial_description, parallel_description);
+}
+
 }  // namespace block_graph
@@ -168,6 +168,12 @@ const bool kDefaultEnableZebraBlockHeap = false;
 const bool kDefaultEnableAllocationFilter = false;
 const float kDefaultQuarantineFloodFillRate = 0.5f;
 const bool kDefaultPreventDuplicateCorruptionCrashes = false;
+const bool kDefaultEnableThreadCaches = false;
+const bool kDefaultEnableLockFreeQuarantine = false;
+const bool kDefaultEnableSizeClassHeap = false;
+
+// Default values of StackCaptureCache parameters.
+const bool kDefaultEnableStackTrie = false;
 
 // Default values of LargeBlockHeap parameters.
 extern const bool kDefaultEnableLargeBlockHeap = true;
@@ -187,6 +193,7 @@ extern const char kParamAllocationGuardRate[] = "allocation_guard_rate";
 // String names of StackCaptureCache parameters.
 const char kParamReportingPeriod[] = "compression_reporting_period";
 const char kParamBottomFramesToSkip[] = "bottom_frames_to_skip";
+const char kParamEnableStackTrie[] = "enable_stack_trie";
 
 // String names of StackCapture parameters.
 const char kParamMaxNumFrames[] = "max_num_frames";
@@ -214,6 +221,9 @@ const char kParamEnableAllocationFilter[] = "enable_allocation_filter";
 const char kParamQuarantineFloodFillRate[] = "quarantine_flood_fill_rate";
 const char kParamPreventDuplicateCorruptionCrashes[] =
     "prevent_duplicate_corruption_crashes";
+const char kParamEnableThreadCaches[] = "enable_thread_caches";
+const char kParamEnableLockFreeQuarantine[] = "enable_lock_free_quarantine";
+const char kParamEnableSizeClassHeap[] = "enable_size_class_heap";
 
 // String names of LargeBlockHeap parameters.
 const char kParamDisableLargeBlockHeap[] = "disable_large_block_heap";
@@ -299,13 +309,18 @@ void SetDefaultAsanParameters(AsanParameters* asan_parameters) {
       kDefaultQuarantineFloodFillRate;
   asan_parameters->prevent_duplicate_corruption_crashes =
       kDefaultPreventDuplicateCorruptionCrashes;
+  asan_parameters->enable_stack_trie = kDefaultEnableStackTrie;
+  asan_parameters->enable_thread_caches = kDefaultEnableThreadCaches;
+  asan_parameters->enable_lock_free_quarantine =
+      kDefaultEnableLockFreeQuarantine;
+  asan_parameters->enable_size_class_heap = kDefaultEnableSizeClassHeap;
 }
 
 bool InflateAsanParameters(const AsanParameters* pod_params,
                            InflatedAsanParameters* inflated_params) {
   // This must be kept up to date with AsanParameters as it evolves.
   static const size_t kSizeOfAsanParametersByVersion[] =
-      { 40, 44, 48, 52, 52, 52, 56, 56, 56, 56, 60, 60, 60 };
+      { 40, 44, 48, 52, 52, 52, 56, 56, 56, 56, 60, 60, 60, 60, 60, 60, 60 };
   COMPILE_ASSERT(arraysize(kSizeOfAsanParametersByVersion) ==
                      kAsanParametersVersion + 1,
                  kSizeOfAsanParametersByVersion_out_of_date);
@@ -467,6 +482,14 @@ bool ParseAsanParameters(const base::StringPiece16& param_string,
     asan_parameters->enable_feature_randomization = true;
   if (cmd_line.HasSwitch(kParamPreventDuplicateCorruptionCrashes))
     asan_parameters->prevent_duplicate_corruption_crashes = true;
+  if (cmd_line.HasSwitch(kParamEnableStackTrie))
+    asan_parameters->enable_stack_trie = true;
+  if (cmd_line.HasSwitch(kParamEnableThreadCaches))
+    asan_parameters->enable_thread_caches = true;
+  if (cmd_line.HasSwitch(kParamEnableLockFreeQuarantine))
+    asan_parameters->enable_lock_free_quarantine = true;
+  if (cmd_line.HasSwitch(kParamEnableSizeClassHeap))
+    asan_parameters->enable_size_class_heap = true;
 
   return true;
 }
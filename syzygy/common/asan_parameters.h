@@ -37,7 +37,7 @@ namespace common {
 // the StackCaptureCache.
 typedef uint32 AsanStackId;
 
-static const size_t kAsanParametersReserved1Bits = 21;
+static const size_t kAsanParametersReserved1Bits = 17;
 
 // This data structure is injected into an instrumented image in a read-only
 // section. It is initialized by the instrumenter, and will be looked up at
@@ -115,6 +115,21 @@ struct AsanParameters {
       // BlockHeapManager: Indicates if we shouldn't report a crash for the same
       // corrupt block twice.
       unsigned prevent_duplicate_corruption_crashes : 1;
+      // StackCaptureCache: If true, the frames of stack traces are stored in a
+      // prefix tree that shares their common callers.
+      unsigned enable_stack_trie : 1;
+      // BlockHeapManager: If true, each thread hands off its freed blocks to
+      // the quarantine in batches, and keeps a cache of the small blocks that
+      // expire from the quarantine to serve its next allocations.
+      unsigned enable_thread_caches : 1;
+      // BlockHeapManager: If true, the shared quarantine is made of lock-free
+      // queues. Freeing a block then takes no quarantine lock, and trimming
+      // takes one lock per batch of expired blocks.
+      unsigned enable_lock_free_quarantine : 1;
+      // BlockHeapManager: If true, small blocks are allocated from slabs
+      // dedicated to a single size class rather than from the heap they were
+      // requested from.
+      unsigned enable_size_class_heap : 1;
 
       // Add new flags here!
 
@@ -154,13 +169,13 @@ COMPILE_ASSERT_IS_POD_OF_SIZE(AsanParameters, 60);
 // The current version of the Asan parameters structure. This must be updated
 // if any changes are made to the above structure! This is defined in the header
 // file to allow compile time assertions against this version number.
-const uint32 kAsanParametersVersion = 12u;
+const uint32 kAsanParametersVersion = 16u;
 
 // If the number of free bits in the parameters struct changes, then the
 // version has to change as well. This is simply here to make sure that
 // everything changes in lockstep.
-static_assert(kAsanParametersReserved1Bits == 21 &&
-                  kAsanParametersVersion == 12,
+static_assert(kAsanParametersReserved1Bits == 17 &&
+                  kAsanParametersVersion == 16,
               "Version must change if reserved bits changes.");
 
 // The name of the section that will be injected into an instrumented image,
@@ -243,6 +258,11 @@ extern const bool kDefaultEnableZebraBlockHeap;
 extern const bool kDefaultEnableAllocationFilter;
 extern const float kDefaultQuarantineFloodFillRate;
 extern const bool kDefaultPreventDuplicateCorruptionCrashes;
+extern const bool kDefaultEnableThreadCaches;
+extern const bool kDefaultEnableLockFreeQuarantine;
+extern const bool kDefaultEnableSizeClassHeap;
+// Default values of StackCaptureCache parameters.
+extern const bool kDefaultEnableStackTrie;
 // Default values of LargeBlockHeap parameters.
 extern const bool kDefaultEnableLargeBlockHeap;
 extern const size_t kDefaultLargeAllocationThreshold;
@@ -259,6 +279,7 @@ extern const char kParamAllocationGuardRate[];
 // String names of StackCaptureCache parameters.
 extern const char kParamReportingPeriod[];
 extern const char kParamBottomFramesToSkip[];
+extern const char kParamEnableStackTrie[];
 // String names of StackCapture parameters.
 extern const char kParamMaxNumFrames[];
 // String names of AsanRuntime parameters.
@@ -279,6 +300,9 @@ extern const char kParamEnableZebraBlockHeap[];
 extern const char kParamEnableAllocationFilter[];
 extern const char kParamQuarantineFloodFillRate[];
 extern const char kParamPreventDuplicateCorruptionCrashes[];
+extern const char kParamEnableThreadCaches[];
+extern const char kParamEnableLockFreeQuarantine[];
+extern const char kParamEnableSizeClassHeap[];
 // String names of LargeBlockHeap parameters.
 extern const char kParamDisableLargeBlockHeap[];
 extern const char kParamLargeAllocationThreshold[];
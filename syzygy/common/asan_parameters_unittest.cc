@@ -94,6 +94,14 @@ TEST(AsanParametersTest, SetDefaultAsanParameters) {
             static_cast<bool>(aparams.enable_feature_randomization));
   EXPECT_EQ(kDefaultPreventDuplicateCorruptionCrashes,
             static_cast<bool>(aparams.prevent_duplicate_corruption_crashes));
+  EXPECT_EQ(kDefaultEnableStackTrie,
+            static_cast<bool>(aparams.enable_stack_trie));
+  EXPECT_EQ(kDefaultEnableThreadCaches,
+            static_cast<bool>(aparams.enable_thread_caches));
+  EXPECT_EQ(kDefaultEnableLockFreeQuarantine,
+            static_cast<bool>(aparams.enable_lock_free_quarantine));
+  EXPECT_EQ(kDefaultEnableSizeClassHeap,
+            static_cast<bool>(aparams.enable_size_class_heap));
 }
 
 TEST(AsanParametersTest, InflateAsanParametersStackIdsPastEnd) {
@@ -248,6 +256,14 @@ TEST(AsanParametersTest, ParseAsanParametersMinimal) {
             static_cast<bool>(iparams.enable_feature_randomization));
   EXPECT_EQ(kDefaultPreventDuplicateCorruptionCrashes,
             static_cast<bool>(iparams.prevent_duplicate_corruption_crashes));
+  EXPECT_EQ(kDefaultEnableStackTrie,
+            static_cast<bool>(iparams.enable_stack_trie));
+  EXPECT_EQ(kDefaultEnableThreadCaches,
+            static_cast<bool>(iparams.enable_thread_caches));
+  EXPECT_EQ(kDefaultEnableLockFreeQuarantine,
+            static_cast<bool>(iparams.enable_lock_free_quarantine));
+  EXPECT_EQ(kDefaultEnableSizeClassHeap,
+            static_cast<bool>(iparams.enable_size_class_heap));
 }
 
 TEST(AsanParametersTest, ParseAsanParametersMaximal) {
@@ -275,7 +291,11 @@ TEST(AsanParametersTest, ParseAsanParametersMaximal) {
       L"--large_allocation_threshold=4096 "
       L"--quarantine_flood_fill_rate=0.25 "
       L"--enable_feature_randomization "
-      L"--prevent_duplicate_corruption_crashes";
+      L"--prevent_duplicate_corruption_crashes "
+      L"--enable_stack_trie "
+      L"--enable_thread_caches "
+      L"--enable_lock_free_quarantine "
+      L"--enable_size_class_heap";
 
   InflatedAsanParameters iparams;
   SetDefaultAsanParameters(&iparams);
@@ -309,6 +329,10 @@ TEST(AsanParametersTest, ParseAsanParametersMaximal) {
   EXPECT_EQ(true, static_cast<bool>(iparams.enable_feature_randomization));
   EXPECT_EQ(true, static_cast<bool>(
       iparams.prevent_duplicate_corruption_crashes));
+  EXPECT_EQ(true, static_cast<bool>(iparams.enable_stack_trie));
+  EXPECT_EQ(true, static_cast<bool>(iparams.enable_thread_caches));
+  EXPECT_EQ(true, static_cast<bool>(iparams.enable_lock_free_quarantine));
+  EXPECT_EQ(true, static_cast<bool>(iparams.enable_size_class_heap));
 }
 
 }  // namespace common
@@ -34,8 +34,11 @@
         'disassembler_util.h',
         'file_util.cc',
         'file_util.h',
+        'flat_map.h',
         'json_file_writer.cc',
         'json_file_writer.h',
+        'parallel_ranges.cc',
+        'parallel_ranges.h',
         'random_number_generator.cc',
         'random_number_generator.h',
         'section_offset_address.cc',
@@ -81,7 +84,9 @@
         'disassembler_unittest.cc',
         'disassembler_util_unittest.cc',
         'file_util_unittest.cc',
+        'flat_map_unittest.cc',
         'json_file_writer_unittest.cc',
+        'parallel_ranges_unittest.cc',
         'section_offset_address_unittest.cc',
         'serialization_unittest.cc',
         'string_table_unittest.cc',
@@ -0,0 +1,253 @@
+// Copyright 2015 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// Declares FlatMap and FlatSet, drop-in replacements for std::map and std::set
+// storing their elements in a sorted vector. They iterate in the same order
+// and offer the same lookup semantics as their standard counterparts, but use
+// a fraction of the memory and iterate over contiguous memory. The trade-off
+// is that insertions and erasures are linear, and invalidate all iterators.
+// Inserting a range of elements sorts them once and merges them in, so bulk
+// insertions should be done that way rather than element by element.
+
+#ifndef SYZYGY_CORE_FLAT_MAP_H_
+#define SYZYGY_CORE_FLAT_MAP_H_
+
+#include <algorithm>
+#include <functional>
+#include <utility>
+#include <vector>
+
+#include "base/logging.h"
+
+namespace core {
+
+namespace internal {
+
+// Extracts the key of a set element.
+template <typename Value>
+struct IdentityKey {
+  const Value& operator()(const Value& value) const { return value; }
+};
+
+// Extracts the key of a map element.
+template <typename Value>
+struct FirstKey {
+  const typename Value::first_type& operator()(const Value& value) const {
+    return value.first;
+  }
+};
+
+// A vector of elements with unique keys, kept sorted by key.
+// @tparam Key the type of the keys.
+// @tparam Value the type of the elements.
+// @tparam KeyOf a functor extracting the key of an element.
+// @tparam Compare the strict weak ordering of the keys.
+template <typename Key, typename Value, typename KeyOf, typename Compare>
+class FlatTree {
+ public:
+  typedef Key key_type;
+  typedef Value value_type;
+  typedef Compare key_compare;
+  typedef std::vector<Value> Storage;
+  typedef typename Storage::size_type size_type;
+  typedef typename Storage::iterator iterator;
+  typedef typename Storage::const_iterator const_iterator;
+  typedef typename Storage::reverse_iterator reverse_iterator;
+  typedef typename Storage::const_reverse_iterator const_reverse_iterator;
+
+  // @name Iteration.
+  // @{
+  iterator begin() { return storage_.begin(); }
+  const_iterator begin() const { return storage_.begin(); }
+  iterator end() { return storage_.end(); }
+  const_iterator end() const { return storage_.end(); }
+  reverse_iterator rbegin() { return storage_.rbegin(); }
+  const_reverse_iterator rbegin() const { return storage_.rbegin(); }
+  reverse_iterator rend() { return storage_.rend(); }
+  const_reverse_iterator rend() const { return storage_.rend(); }
+  // @}
+
+  // @name Capacity.
+  // @{
+  bool empty() const { return storage_.empty(); }
+  size_type size() const { return storage_.size(); }
+  void reserve(size_type capacity) { storage_.reserve(capacity); }
+  // @}
+
+  // @name Lookup.
+  // @{
+  iterator lower_bound(const Key& key) {
+    return begin() + LowerBoundIndex(key);
+  }
+  const_iterator lower_bound(const Key& key) const {
+    return begin() + LowerBoundIndex(key);
+  }
+  iterator upper_bound(const Key& key) {
+    return begin() + UpperBoundIndex(key);
+  }
+  const_iterator upper_bound(const Key& key) const {
+    return begin() + UpperBoundIndex(key);
+  }
+  iterator find(const Key& key) {
+    size_type index = LowerBoundIndex(key);
+    return IsMatch(index, key) ? begin() + index : end();
+  }
+  const_iterator find(const Key& key) const {
+    size_type index = LowerBoundIndex(key);
+    return IsMatch(index, key) ? begin() + index : end();
+  }
+  size_type count(const Key& key) const {
+    return IsMatch(LowerBoundIndex(key), key) ? 1 : 0;
+  }
+  // @}
+
+  // @name Modifiers. These invalidate all iterators.
+  // @{
+  std::pair<iterator, bool> insert(const Value& value) {
+    const Key& key = KeyOf()(value);
+    size_type index = LowerBoundIndex(key);
+    if (IsMatch(index, key))
+      return std::make_pair(begin() + index, false);
+    return std::make_pair(storage_.insert(begin() + index, value), true);
+  }
+  // Inserts the elements of [first, last) in time linear in the size of the
+  // tree, plus that of sorting the new elements. As with std::map, elements
+  // whose key is already present are ignored, as are all but the first of
+  // the new elements sharing a key.
+  template <typename InputIterator>
+  void insert(InputIterator first, InputIterator last) {
+    size_type old_size = storage_.size();
+    storage_.insert(storage_.end(), first, last);
+    iterator middle = begin() + old_size;
+    // Both of these are stable, so the first element of each run of
+    // equivalent ones is the one to keep.
+    std::stable_sort(middle, end(), ValueLess());
+    std::inplace_merge(begin(), middle, end(), ValueLess());
+    storage_.erase(std::unique(begin(), end(), ValueEquivalent()), end());
+  }
+  iterator erase(const_iterator position) {
+    return storage_.erase(position);
+  }
+  iterator erase(const_iterator first, const_iterator last) {
+    return storage_.erase(first, last);
+  }
+  size_type erase(const Key& key) {
+    size_type index = LowerBoundIndex(key);
+    if (!IsMatch(index, key))
+      return 0;
+    storage_.erase(begin() + index);
+    return 1;
+  }
+  void clear() { storage_.clear(); }
+  void swap(FlatTree& other) { storage_.swap(other.storage_); }
+  // @}
+
+  bool operator==(const FlatTree& other) const {
+    return storage_ == other.storage_;
+  }
+  bool operator!=(const FlatTree& other) const {
+    return storage_ != other.storage_;
+  }
+
+ protected:
+  // Orders elements by key.
+  struct ValueLess {
+    bool operator()(const Value& a, const Value& b) const {
+      return Compare()(KeyOf()(a), KeyOf()(b));
+    }
+  };
+
+  // Tests elements for key equivalence.
+  struct ValueEquivalent {
+    bool operator()(const Value& a, const Value& b) const {
+      return !Compare()(KeyOf()(a), KeyOf()(b)) &&
+          !Compare()(KeyOf()(b), KeyOf()(a));
+    }
+  };
+
+  // @returns the index of the first element whose key isn't less than @p key.
+  size_type LowerBoundIndex(const Key& key) const {
+    size_type first = 0;
+    size_type count = storage_.size();
+    while (count > 0) {
+      size_type step = count / 2;
+      if (Compare()(KeyOf()(storage_[first + step]), key)) {
+        first += step + 1;
+        count -= step + 1;
+      } else {
+        count = step;
+      }
+    }
+    return first;
+  }
+
+  // @returns the index of the first element whose key is greater than @p key.
+  size_type UpperBoundIndex(const Key& key) const {
+    size_type index = LowerBoundIndex(key);
+    return IsMatch(index, key) ? index + 1 : index;
+  }
+
+  // @returns true iff the element at @p index exists and has key @p key.
+  bool IsMatch(size_type index, const Key& key) const {
+    return index < storage_.size() &&
+        !Compare()(key, KeyOf()(storage_[index]));
+  }
+
+  Storage storage_;
+};
+
+}  // namespace internal
+
+// A sorted vector map. Unlike std::map, the keys of the elements are mutable
+// through iterators; they must not be modified in a way that changes their
+// relative order.
+// @tparam Key the type of the keys.
+// @tparam T the type of the mapped values.
+// @tparam Compare the strict weak ordering of the keys.
+template <typename Key, typename T, typename Compare = std::less<Key> >
+class FlatMap
+    : public internal::FlatTree<Key,
+                                std::pair<Key, T>,
+                                internal::FirstKey<std::pair<Key, T> >,
+                                Compare> {
+ public:
+  typedef T mapped_type;
+
+  T& operator[](const Key& key) {
+    return this->insert(std::make_pair(key, T())).first->second;
+  }
+
+  T& at(const Key& key) {
+    typename FlatMap::iterator it = this->find(key);
+    CHECK(it != this->end());
+    return it->second;
+  }
+  const T& at(const Key& key) const {
+    typename FlatMap::const_iterator it = this->find(key);
+    CHECK(it != this->end());
+    return it->second;
+  }
+};
+
+// A sorted vector set.
+// @tparam Key the type of the elements.
+// @tparam Compare the strict weak ordering of the elements.
+template <typename Key, typename Compare = std::less<Key> >
+class FlatSet
+    : public internal::FlatTree<Key, Key, internal::IdentityKey<Key>, Compare> {
+};
+
+}  // namespace core
+
+#endif  // SYZYGY_CORE_FLAT_MAP_H_
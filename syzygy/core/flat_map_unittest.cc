@@ -0,0 +1,177 @@
+// Copyright 2015 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "syzygy/core/flat_map.h"
+
+#include <map>
+#include <set>
+#include <vector>
+
+#include "gtest/gtest.h"
+#include "syzygy/core/random_number_generator.h"
+
+namespace core {
+
+namespace {
+
+typedef FlatMap<int, int> TestMap;
+typedef FlatSet<std::pair<int, int> > TestSet;
+
+// Checks that @p flat holds the same elements as @p expected, in the same
+// order.
+template <typename FlatType, typename StdType>
+void ExpectSameElements(const StdType& expected, const FlatType& flat) {
+  ASSERT_EQ(expected.size(), flat.size());
+  EXPECT_EQ(expected.empty(), flat.empty());
+  std::vector<typename FlatType::value_type> expected_elements(
+      expected.begin(), expected.end());
+  std::vector<typename FlatType::value_type> flat_elements(
+      flat.begin(), flat.end());
+  EXPECT_EQ(expected_elements, flat_elements);
+}
+
+}  // namespace
+
+TEST(FlatMapTest, Empty) {
+  TestMap map;
+  EXPECT_TRUE(map.empty());
+  EXPECT_EQ(0U, map.size());
+  EXPECT_TRUE(map.begin() == map.end());
+  EXPECT_TRUE(map.find(1) == map.end());
+  EXPECT_TRUE(map.lower_bound(1) == map.end());
+  EXPECT_TRUE(map.upper_bound(1) == map.end());
+  EXPECT_EQ(0U, map.count(1));
+  EXPECT_EQ(0U, map.erase(1));
+}
+
+TEST(FlatMapTest, InsertFindAndErase) {
+  TestMap map;
+  EXPECT_TRUE(map.insert(std::make_pair(20, 2)).second);
+  EXPECT_TRUE(map.insert(std::make_pair(10, 1)).second);
+  EXPECT_TRUE(map.insert(std::make_pair(30, 3)).second);
+
+  // Duplicate keys are rejected, and the existing element is returned.
+  std::pair<TestMap::iterator, bool> result =
+      map.insert(std::make_pair(20, 42));
+  EXPECT_FALSE(result.second);
+  EXPECT_EQ(20, result.first->first);
+  EXPECT_EQ(2, result.first->second);
+
+  ASSERT_EQ(3U, map.size());
+  EXPECT_EQ(10, map.begin()->first);
+  EXPECT_EQ(30, map.rbegin()->first);
+
+  EXPECT_EQ(2, map.find(20)->second);
+  EXPECT_TRUE(map.find(25) == map.end());
+  EXPECT_EQ(20, map.lower_bound(15)->first);
+  EXPECT_EQ(20, map.lower_bound(20)->first);
+  EXPECT_EQ(30, map.upper_bound(20)->first);
+  EXPECT_TRUE(map.upper_bound(30) == map.end());
+  EXPECT_EQ(1U, map.count(10));
+  EXPECT_EQ(3, map.at(30));
+
+  map[40] = 4;
+  map[10] = 11;
+  EXPECT_EQ(4U, map.size());
+  EXPECT_EQ(11, map.at(10));
+
+  EXPECT_EQ(1U, map.erase(20));
+  EXPECT_EQ(0U, map.erase(20));
+  TestMap::iterator it = map.erase(map.begin());
+  EXPECT_EQ(30, it->first);
+  map.erase(map.lower_bound(30), map.end());
+  EXPECT_TRUE(map.empty());
+}
+
+TEST(FlatMapTest, Comparison) {
+  TestMap map1;
+  TestMap map2;
+  EXPECT_TRUE(map1 == map2);
+
+  map1[1] = 1;
+  EXPECT_TRUE(map1 != map2);
+  map2[1] = 1;
+  EXPECT_TRUE(map1 == map2);
+
+  map2.clear();
+  map1.swap(map2);
+  EXPECT_TRUE(map1.empty());
+  EXPECT_EQ(1U, map2.size());
+}
+
+TEST(FlatMapTest, MatchesStdMap) {
+  RandomNumberGenerator rng(42);
+  std::map<int, int> expected;
+  TestMap map;
+
+  for (int i = 0; i < 10000; ++i) {
+    int key = static_cast<int>(rng(1000));
+    if (rng(3) == 0) {
+      EXPECT_EQ(expected.erase(key), map.erase(key));
+    } else {
+      EXPECT_EQ(expected.insert(std::make_pair(key, i)).second,
+                map.insert(std::make_pair(key, i)).second);
+    }
+
+    std::map<int, int>::const_iterator expected_it =
+        expected.lower_bound(key);
+    TestMap::const_iterator it = map.lower_bound(key);
+    EXPECT_EQ(expected_it == expected.end(), it == map.end());
+    if (expected_it != expected.end() && it != map.end())
+      EXPECT_EQ(expected_it->first, it->first);
+  }
+
+  ASSERT_NO_FATAL_FAILURE(ExpectSameElements(expected, map));
+}
+
+TEST(FlatMapTest, InsertRangeMatchesStdMap) {
+  RandomNumberGenerator rng(42);
+  std::map<int, int> expected;
+  TestMap map;
+
+  for (int i = 0; i < 100; ++i) {
+    // The batches are unsorted, and contain keys already present in the map
+    // as well as repeated keys.
+    std::vector<std::pair<int, int> > batch;
+    size_t batch_size = rng(50);
+    for (size_t j = 0; j < batch_size; ++j)
+      batch.push_back(std::make_pair(static_cast<int>(rng(1000)),
+                                     static_cast<int>(i * 50 + j)));
+
+    expected.insert(batch.begin(), batch.end());
+    map.insert(batch.begin(), batch.end());
+    ASSERT_NO_FATAL_FAILURE(ExpectSameElements(expected, map));
+  }
+}
+
+TEST(FlatSetTest, MatchesStdSet) {
+  RandomNumberGenerator rng(42);
+  std::set<std::pair<int, int> > expected;
+  TestSet set;
+
+  for (size_t i = 0; i < 10000; ++i) {
+    std::pair<int, int> value(static_cast<int>(rng(10)),
+                              static_cast<int>(rng(100)));
+    if (rng(3) == 0) {
+      EXPECT_EQ(expected.erase(value), set.erase(value));
+    } else {
+      EXPECT_EQ(expected.insert(value).second, set.insert(value).second);
+    }
+    EXPECT_EQ(expected.count(value), set.count(value));
+  }
+
+  ASSERT_NO_FATAL_FAILURE(ExpectSameElements(expected, set));
+}
+
+}  // namespace core
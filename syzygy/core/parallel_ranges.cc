@@ -0,0 +1,81 @@
+// Copyright 2015 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "syzygy/core/parallel_ranges.h"
+
+#include <algorithm>
+
+#include "base/memory/scoped_vector.h"
+#include "base/threading/simple_thread.h"
+
+namespace core {
+
+namespace {
+
+// Processes a range of items on a worker thread.
+class ProcessRangeWorkItem : public base::DelegateSimpleThread::Delegate {
+ public:
+  ProcessRangeWorkItem(const ProcessRangeCallback& process,
+                       size_t begin,
+                       size_t end)
+      : process_(process), begin_(begin), end_(end), succeeded_(false) {
+  }
+
+  // @name base::DelegateSimpleThread::Delegate implementation.
+  // @{
+  virtual void Run() override {
+    succeeded_ = process_.Run(begin_, end_);
+  }
+  // @}
+
+  bool succeeded() const { return succeeded_; }
+
+ private:
+  ProcessRangeCallback process_;
+  size_t begin_;
+  size_t end_;
+  bool succeeded_;
+
+  DISALLOW_COPY_AND_ASSIGN(ProcessRangeWorkItem);
+};
+
+}  // namespace
+
+bool ProcessRangesInParallel(const std::string& name_prefix,
+                             size_t count,
+                             size_t max_workers,
+                             const ProcessRangeCallback& process) {
+  size_t workers = std::min(max_workers, count);
+  if (workers <= 1)
+    return process.Run(0, count);
+
+  ScopedVector<ProcessRangeWorkItem> work_items;
+  base::DelegateSimpleThreadPool pool(name_prefix, static_cast<int>(workers));
+  pool.Start();
+  for (size_t i = 0; i < workers; ++i) {
+    work_items.push_back(new ProcessRangeWorkItem(
+        process, count * i / workers, count * (i + 1) / workers));
+    pool.AddWork(work_items.back());
+  }
+  pool.JoinAll();
+
+  for (size_t i = 0; i < work_items.size(); ++i) {
+    if (!work_items[i]->succeeded())
+      return false;
+  }
+
+  return true;
+}
+
+}  // namespace core
@@ -0,0 +1,47 @@
+// Copyright 2015 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// Declares a helper for splitting work on the items of a sequence between a
+// few worker threads.
+
+#ifndef SYZYGY_CORE_PARALLEL_RANGES_H_
+#define SYZYGY_CORE_PARALLEL_RANGES_H_
+
+#include <string>
+
+#include "base/callback.h"
+
+namespace core {
+
+// A callback processing the items in the range [begin, end) of some sequence.
+// @returns true on success, false otherwise.
+typedef base::Callback<bool(size_t, size_t)> ProcessRangeCallback;
+
+// Invokes @p process on consecutive ranges partitioning [0, @p count), using
+// up to @p max_workers threads. The callback must only read shared state, and
+// must write its results to per-item slots. With a single worker, or a single
+// item, the callback is run once on the calling thread.
+// @param name_prefix the prefix of the names of the worker threads.
+// @param count the number of items.
+// @param max_workers the maximum number of threads to use.
+// @param process the callback to invoke on each range.
+// @returns true iff all of the ranges were processed successfully.
+bool ProcessRangesInParallel(const std::string& name_prefix,
+                             size_t count,
+                             size_t max_workers,
+                             const ProcessRangeCallback& process);
+
+}  // namespace core
+
+#endif  // SYZYGY_CORE_PARALLEL_RANGES_H_
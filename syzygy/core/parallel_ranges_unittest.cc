@@ -0,0 +1,68 @@
+// Copyright 2015 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "syzygy/core/parallel_ranges.h"
+
+#include <vector>
+
+#include "base/bind.h"
+#include "gtest/gtest.h"
+
+namespace core {
+
+namespace {
+
+// Marks the items of a range as visited, failing on @p failing_item.
+bool VisitRange(std::vector<size_t>* visits,
+                size_t failing_item,
+                size_t begin,
+                size_t end) {
+  for (size_t i = begin; i < end; ++i) {
+    ++visits->at(i);
+    if (i == failing_item)
+      return false;
+  }
+  return true;
+}
+
+}  // namespace
+
+TEST(ParallelRangesTest, VisitsEachItemOnce) {
+  static const size_t kCount = 1000;
+  for (size_t max_workers = 1; max_workers <= 8; ++max_workers) {
+    std::vector<size_t> visits(kCount, 0);
+    EXPECT_TRUE(ProcessRangesInParallel(
+        "Test", kCount, max_workers,
+        base::Bind(&VisitRange, &visits, kCount)));
+    EXPECT_EQ(std::vector<size_t>(kCount, 1), visits);
+  }
+}
+
+TEST(ParallelRangesTest, NoItems) {
+  std::vector<size_t> visits;
+  EXPECT_TRUE(ProcessRangesInParallel("Test", 0, 4,
+                                      base::Bind(&VisitRange, &visits, 0u)));
+}
+
+TEST(ParallelRangesTest, FailsIfAnyRangeFails) {
+  static const size_t kCount = 100;
+  for (size_t max_workers = 1; max_workers <= 4; ++max_workers) {
+    std::vector<size_t> visits(kCount, 0);
+    EXPECT_FALSE(ProcessRangesInParallel(
+        "Test", kCount, max_workers,
+        base::Bind(&VisitRange, &visits, kCount - 1)));
+  }
+}
+
+}  // namespace core
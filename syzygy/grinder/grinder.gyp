@@ -52,6 +52,8 @@
       'dependencies': [
         '<(src)/syzygy/application/application.gyp:application_lib',
         '<(src)/syzygy/common/common.gyp:common_lib',
+        '<(src)/syzygy/core/core.gyp:core_lib',
+        '<(src)/syzygy/pdb/pdb.gyp:pdb_lib',
         '<(src)/syzygy/pe/pe.gyp:dia_sdk',
         '<(src)/syzygy/pe/pe.gyp:pe_lib',
         '<(src)/syzygy/trace/parse/parse.gyp:parse_lib',
@@ -87,6 +89,7 @@
         '<(src)/syzygy/test_data/test_data.gyp:basic_block_entry_traces',
         '<(src)/syzygy/test_data/test_data.gyp:coverage_traces',
         '<(src)/syzygy/test_data/test_data.gyp:profile_traces',
+        '<(src)/syzygy/testing/testing.gyp:testing_lib',
         '<(src)/syzygy/trace/service/service.gyp:rpc_service_lib',
         '<(src)/syzygy/version/version.gyp:version_lib',
       ],
@@ -43,6 +43,22 @@ class GrinderInterface : public trace::parser::ParseEventHandlerImpl {
   //     handler.
   virtual void SetParser(Parser* parser) = 0;
 
+  // Creates a shard of this grinder, for consuming trace files in parallel.
+  // Each shard receives the events of a single trace file, possibly on
+  // another thread, and is then merged back with MergeShard. This will only be
+  // called after successful calls to ParseCommandLine and SetParser.
+  // @returns a new shard configured like this grinder, or NULL if this grinder
+  //     doesn't support parallel consumption. The caller owns the shard.
+  virtual GrinderInterface* CreateShard() { return NULL; }
+
+  // Merges the data gathered by a shard into this grinder. This is called on
+  // the thread that created the shards once all trace files are consumed, in
+  // the order the trace files were opened, and prior to Grind.
+  // @param shard a shard returned by CreateShard.
+  // @returns true on success, false otherwise.
+  // @note The implementation should log on failure.
+  virtual bool MergeShard(GrinderInterface* shard) { return false; }
+
   // Performs any computation/aggregation/summarization that needs to be done
   // after having parsed trace files. This will only be called after a
   // successful call to ParseCommandLine and after all parse events have been
@@ -16,6 +16,8 @@
 
 #include "base/logging.h"
 #include "base/files/file_util.h"
+#include "base/memory/scoped_vector.h"
+#include "base/strings/string_number_conversions.h"
 #include "base/strings/string_util.h"
 #include "base/strings/stringprintf.h"
 #include "syzygy/grinder/grinders/coverage_grinder.h"
@@ -48,6 +50,9 @@ const char kUsageFormatStr[] =
     "    'profile' or 'sample'.\n"
     "\n"
     "Optional parameters\n"
+    "  --jobs=<n>\n"
+    "    The number of trace files to parse concurrently. Only 'coverage'\n"
+    "    mode supports more than 1, which is the default.\n"
     "  --output-file=<output file>\n"
     "    The location of output file. If not specified, output is to stdout.\n"
     "coverage mode optional parameters\n"
@@ -72,10 +77,42 @@ const char kUsageFormatStr[] =
     "    only one module may be processed at a time in this mode.\n"
     "\n";
 
+// Creates a shard of a grinder for each trace file, and merges them back into
+// it.
+class GrinderShardFactory
+    : public trace::parser::ParseEventHandlerShardFactory {
+ public:
+  explicit GrinderShardFactory(GrinderInterface* grinder) : grinder_(grinder) {
+    DCHECK(grinder != NULL);
+  }
+
+  // @name ParseEventHandlerShardFactory implementation.
+  // @{
+  virtual trace::parser::ParseEventHandler* CreateShard() override {
+    GrinderInterface* shard = grinder_->CreateShard();
+    if (shard == NULL) {
+      LOG(ERROR) << "Grinder does not support parallel parsing.";
+      return NULL;
+    }
+    shards_.push_back(shard);
+    return shard;
+  }
+  virtual bool ReduceShard(trace::parser::ParseEventHandler* shard) override {
+    return grinder_->MergeShard(static_cast<GrinderInterface*>(shard));
+  }
+  // @}
+
+ private:
+  GrinderInterface* grinder_;
+  ScopedVector<GrinderInterface> shards_;
+
+  DISALLOW_COPY_AND_ASSIGN(GrinderShardFactory);
+};
+
 }  // namespace
 
 GrinderApp::GrinderApp()
-    : application::AppImplBase("Grinder"), mode_(kProfile) {
+    : application::AppImplBase("Grinder"), mode_(kProfile), max_workers_(1) {
 }
 
 void GrinderApp::PrintUsage(const base::FilePath& program,
@@ -144,6 +181,24 @@ bool GrinderApp::ParseCommandLine(const base::CommandLine* command_line) {
     return false;
   }
 
+  if (command_line->HasSwitch("jobs")) {
+    std::string jobs_str = command_line->GetSwitchValueASCII("jobs");
+    unsigned jobs = 0;
+    if (!base::StringToUint(jobs_str, &jobs) || jobs == 0) {
+      PrintUsage(command_line->GetProgram(),
+                 base::StringPrintf("Invalid jobs value: %s.",
+                                    jobs_str.c_str()));
+      return false;
+    }
+    if (jobs > 1 && mode_ != kCoverage) {
+      PrintUsage(command_line->GetProgram(),
+                 base::StringPrintf("Mode %s does not support --jobs.",
+                                    mode.c_str()));
+      return false;
+    }
+    max_workers_ = jobs;
+  }
+
   output_file_ = command_line->GetSwitchValuePath("output-file");
 
   return true;
@@ -182,7 +237,14 @@ int GrinderApp::Run() {
   }
 
   LOG(INFO) << "Parsing trace files.";
-  if (!parser.Consume()) {
+  bool consumed = false;
+  if (max_workers_ > 1) {
+    GrinderShardFactory shard_factory(grinder_.get());
+    consumed = parser.ConsumeInParallel(&shard_factory, max_workers_);
+  } else {
+    consumed = parser.Consume();
+  }
+  if (!consumed) {
     LOG(ERROR) << "Error parsing trace files.";
     return 1;
   }
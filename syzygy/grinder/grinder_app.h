@@ -52,6 +52,8 @@ class GrinderApp : public application::AppImplBase {
   std::vector<base::FilePath> trace_files_;
   base::FilePath output_file_;
   Mode mode_;
+  // The maximum number of trace files consumed concurrently.
+  size_t max_workers_;
   scoped_ptr<GrinderInterface> grinder_;
 };
 
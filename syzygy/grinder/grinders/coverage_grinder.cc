@@ -14,6 +14,8 @@
 
 #include "syzygy/grinder/grinders/coverage_grinder.h"
 
+#include <algorithm>
+
 #include "base/files/file_path.h"
 #include "base/strings/string_util.h"
 #include "syzygy/common/indexed_frequency_data.h"
@@ -37,12 +39,18 @@ using basic_block_util::PdbInfo;
 using basic_block_util::PdbInfoMap;
 using trace::parser::AbsoluteAddress64;
 
+bool VisitRangeAddressLess(const LineInfo::VisitRange& range1,
+                           const LineInfo::VisitRange& range2) {
+  return range1.address < range2.address;
+}
+
 }  // namespace
 
 CoverageGrinder::CoverageGrinder()
     : parser_(NULL),
       event_handler_errored_(false),
-      output_format_(kLcovFormat) {
+      output_format_(kLcovFormat),
+      is_shard_(false) {
 }
 
 CoverageGrinder::~CoverageGrinder() {
@@ -73,6 +81,36 @@ void CoverageGrinder::SetParser(Parser* parser) {
   parser_ = parser;
 }
 
+GrinderInterface* CoverageGrinder::CreateShard() {
+  DCHECK(!is_shard_);
+  CoverageGrinder* shard = new CoverageGrinder();
+  shard->parser_ = parser_;
+  shard->output_format_ = output_format_;
+  shard->is_shard_ = true;
+  return shard;
+}
+
+bool CoverageGrinder::MergeShard(GrinderInterface* shard) {
+  DCHECK(shard != NULL);
+  DCHECK(!is_shard_);
+
+  CoverageGrinder* coverage_shard = static_cast<CoverageGrinder*>(shard);
+  DCHECK(coverage_shard->is_shard_);
+  if (coverage_shard->event_handler_errored_)
+    event_handler_errored_ = true;
+
+  for (size_t i = 0; i < coverage_shard->shard_frequencies_.size(); ++i) {
+    const ModuleFrequencies& module_frequencies =
+        coverage_shard->shard_frequencies_[i];
+    if (!VisitBasicBlocks(module_frequencies.module_info,
+                          module_frequencies.frequencies)) {
+      event_handler_errored_ = true;
+    }
+  }
+
+  return true;
+}
+
 bool CoverageGrinder::Grind() {
   if (event_handler_errored_) {
     LOG(WARNING) << "Failed to handle all basic block frequency data events, "
@@ -156,6 +194,24 @@ void CoverageGrinder::OnIndexedFrequency(
     return;
   }
 
+  std::vector<uint32> frequencies(data->num_entries);
+  for (size_t bb_index = 0; bb_index < data->num_entries; ++bb_index)
+    frequencies[bb_index] = GetFrequency(data, bb_index, 0);
+
+  if (is_shard_) {
+    ModuleFrequencies module_frequencies;
+    module_frequencies.module_info = *module_info;
+    shard_frequencies_.push_back(module_frequencies);
+    shard_frequencies_.back().frequencies.swap(frequencies);
+    return;
+  }
+
+  if (!VisitBasicBlocks(*module_info, frequencies))
+    event_handler_errored_ = true;
+}
+
+bool CoverageGrinder::VisitBasicBlocks(const ModuleInformation& module_info,
+                                       const std::vector<uint32>& frequencies) {
   // TODO(chrisha): Validate that the PE file itself is instrumented as
   //     expected? This isn't strictly necessary but would add another level of
   //     safety checking.
@@ -163,38 +219,44 @@ void CoverageGrinder::OnIndexedFrequency(
   // Get the PDB info. This loads the line information and the basic-block
   // ranges if not already done, otherwise it returns the cached version.
   PdbInfo* pdb_info = NULL;
-  if (!LoadPdbInfo(&pdb_info_cache_, *module_info, &pdb_info)) {
-    event_handler_errored_ = true;
-    return;
-  }
+  if (!LoadPdbInfo(&pdb_info_cache_, module_info, &pdb_info))
+    return false;
 
   DCHECK(pdb_info != NULL);
 
   // Sanity check the contents.
-  if (data->num_entries != pdb_info->bb_ranges.size()) {
+  if (frequencies.size() != pdb_info->bb_ranges.size()) {
     LOG(ERROR) << "Mismatch between trace data BB count and PDB BB count.";
-    event_handler_errored_ = true;
-    return;
+    return false;
   }
 
-  // Run over the BB frequency data and mark non-zero frequency BBs as having
-  // been visited.
-  for (size_t bb_index = 0; bb_index < data->num_entries; ++bb_index) {
-    uint32 bb_freq = GetFrequency(data, bb_index, 0);
+  // Run over the BB frequency data and gather the non-zero frequency BBs.
+  LineInfo::VisitRanges visit_ranges;
+  for (size_t bb_index = 0; bb_index < frequencies.size(); ++bb_index) {
+    uint32 bb_freq = frequencies[bb_index];
 
     if (bb_freq == 0)
       continue;
 
-    // Mark this basic-block as visited.
     const RelativeAddressRange& bb_range = pdb_info->bb_ranges[bb_index];
-    if (!pdb_info->line_info.Visit(bb_range.start(),
-                                   bb_range.size(),
-                                   bb_freq)) {
-      LOG(ERROR) << "Failed to visit BB at " << bb_range << ".";
-      event_handler_errored_ = true;
-      return;
-    }
+    visit_ranges.push_back(LineInfo::VisitRange(bb_range.start(),
+                                                bb_range.size(),
+                                                bb_freq));
+  }
+
+  // Mark all of these basic-blocks as visited in a single pass. The ranges
+  // are normally already sorted by address.
+  if (!std::is_sorted(visit_ranges.begin(), visit_ranges.end(),
+                      VisitRangeAddressLess)) {
+    std::sort(visit_ranges.begin(), visit_ranges.end(),
+              VisitRangeAddressLess);
   }
+  if (!pdb_info->line_info.BatchVisit(visit_ranges)) {
+    LOG(ERROR) << "Failed to visit BBs.";
+    return false;
+  }
+
+  return true;
 }
 
 }  // namespace grinders
@@ -17,6 +17,8 @@
 #ifndef SYZYGY_GRINDER_GRINDERS_COVERAGE_GRINDER_H_
 #define SYZYGY_GRINDER_GRINDERS_COVERAGE_GRINDER_H_
 
+#include <vector>
+
 #include "syzygy/grinder/basic_block_util.h"
 #include "syzygy/grinder/coverage_data.h"
 #include "syzygy/grinder/grinder.h"
@@ -35,6 +37,8 @@ class CoverageGrinder : public GrinderInterface {
   // @{
   virtual bool ParseCommandLine(const base::CommandLine* command_line) override;
   virtual void SetParser(Parser* parser) override;
+  virtual GrinderInterface* CreateShard() override;
+  virtual bool MergeShard(GrinderInterface* shard) override;
   virtual bool Grind() override;
   virtual bool OutputData(FILE* file) override;
   // @}
@@ -61,6 +65,20 @@ class CoverageGrinder : public GrinderInterface {
   const CoverageData& coverage_data() { return coverage_data_; }
 
  protected:
+  // The basic-block frequencies of a module, as reported by one event.
+  struct ModuleFrequencies {
+    basic_block_util::ModuleInformation module_info;
+    std::vector<uint32> frequencies;
+  };
+  typedef std::vector<ModuleFrequencies> ModuleFrequenciesVector;
+
+  // Marks the basic-blocks of a module with a non-zero frequency as visited.
+  // @param module_info the module the frequencies belong to.
+  // @param frequencies the frequency of each basic-block of the module.
+  // @returns true on success, false otherwise.
+  bool VisitBasicBlocks(const basic_block_util::ModuleInformation& module_info,
+                        const std::vector<uint32>& frequencies);
+
   // Stores per-module coverage data, populated during calls to
   // OnIndexedFrequency.
   basic_block_util::PdbInfoMap pdb_info_cache_;
@@ -80,6 +98,12 @@ class CoverageGrinder : public GrinderInterface {
 
   // The output format to use.
   OutputFormat output_format_;
+
+  // True if this grinder is a shard. Shards only record the frequencies they
+  // receive in shard_frequencies_, and leave loading the PDBs and visiting
+  // the basic-blocks to MergeShard, on the thread that owns the shards.
+  bool is_shard_;
+  ModuleFrequenciesVector shard_frequencies_;
 };
 
 }  // namespace grinders
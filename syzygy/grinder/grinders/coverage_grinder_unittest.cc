@@ -14,6 +14,7 @@
 
 #include "syzygy/grinder/grinders/coverage_grinder.h"
 
+#include "base/memory/scoped_vector.h"
 #include "base/win/scoped_com_initializer.h"
 #include "gtest/gtest.h"
 #include "syzygy/core/unittest_util.h"
@@ -29,6 +30,25 @@ class TestCoverageGrinder : public CoverageGrinder {
   using CoverageGrinder::parser_;
 };
 
+// Creates shards of a grinder, and merges them back into it.
+class TestShardFactory : public trace::parser::ParseEventHandlerShardFactory {
+ public:
+  explicit TestShardFactory(GrinderInterface* grinder) : grinder_(grinder) {
+  }
+
+  virtual trace::parser::ParseEventHandler* CreateShard() override {
+    shards_.push_back(grinder_->CreateShard());
+    return shards_.back();
+  }
+  virtual bool ReduceShard(trace::parser::ParseEventHandler* shard) override {
+    return grinder_->MergeShard(static_cast<GrinderInterface*>(shard));
+  }
+
+ private:
+  GrinderInterface* grinder_;
+  ScopedVector<GrinderInterface> shards_;
+};
+
 class CoverageGrinderTest : public testing::PELibUnitTest {
  public:
   typedef testing::PELibUnitTest Super;
@@ -129,5 +149,47 @@ TEST_F(CoverageGrinderTest, GrindAndOutputCacheGrindDataSucceeds) {
   // TODO(chrisha): Validate the output is a valid CacheGrind file.
 }
 
+TEST_F(CoverageGrinderTest, ParallelGrindMatchesSerialGrind) {
+  TestCoverageGrinder serial_grinder;
+  ASSERT_TRUE(serial_grinder.ParseCommandLine(&cmd_line_));
+  trace::parser::Parser serial_parser;
+  ASSERT_TRUE(serial_parser.Init(&serial_grinder));
+  serial_grinder.SetParser(&serial_parser);
+
+  TestCoverageGrinder parallel_grinder;
+  ASSERT_TRUE(parallel_grinder.ParseCommandLine(&cmd_line_));
+  trace::parser::Parser parallel_parser;
+  ASSERT_TRUE(parallel_parser.Init(&parallel_grinder));
+  parallel_grinder.SetParser(&parallel_parser);
+
+  for (size_t i = 0; i < arraysize(testing::kCoverageTraceFiles); ++i) {
+    base::FilePath trace_file =
+        testing::GetExeTestDataRelativePath(testing::kCoverageTraceFiles[i]);
+    ASSERT_TRUE(serial_parser.OpenTraceFile(trace_file));
+    ASSERT_TRUE(parallel_parser.OpenTraceFile(trace_file));
+  }
+
+  ASSERT_TRUE(serial_parser.Consume());
+  ASSERT_TRUE(serial_grinder.Grind());
+
+  TestShardFactory shard_factory(&parallel_grinder);
+  ASSERT_TRUE(parallel_parser.ConsumeInParallel(&shard_factory, 2));
+  ASSERT_TRUE(parallel_grinder.Grind());
+
+  typedef CoverageData::SourceFileCoverageDataMap SourceFileCoverageDataMap;
+  const SourceFileCoverageDataMap& expected =
+      serial_grinder.coverage_data().source_file_coverage_data_map();
+  const SourceFileCoverageDataMap& actual =
+      parallel_grinder.coverage_data().source_file_coverage_data_map();
+  ASSERT_EQ(expected.size(), actual.size());
+  SourceFileCoverageDataMap::const_iterator expected_it = expected.begin();
+  SourceFileCoverageDataMap::const_iterator actual_it = actual.begin();
+  for (; expected_it != expected.end(); ++expected_it, ++actual_it) {
+    EXPECT_EQ(expected_it->first, actual_it->first);
+    EXPECT_EQ(expected_it->second.line_execution_count_map,
+              actual_it->second.line_execution_count_map);
+  }
+}
+
 }  // namespace grinders
 }  // namespace grinder
@@ -237,7 +237,9 @@ bool RollUpToLines(const HeatMap& heat_map, LineInfo* line_info) {
       min_heat = h;
   }
 
-  // Scale the heat values to integers, and update the line info.
+  // Scale the heat values to integers. The heat map is sorted by address, so
+  // the resulting ranges can be visited in a single pass.
+  LineInfo::VisitRanges visit_ranges;
   for (heat_it = heat_map.begin(); heat_it != heat_map.end(); ++heat_it) {
     double d = heat_it->second.heat;
     if (d == 0)
@@ -254,11 +256,15 @@ bool RollUpToLines(const HeatMap& heat_map, LineInfo* line_info) {
         ui = 1;
     }
 
-    // Increment the weight associated with the BB-range in the line info.
-    if (!line_info->Visit(heat_it->first.start(), heat_it->first.size(), ui)) {
-      LOG(ERROR) << "LineInfo::Visit failed.";
-      return false;
-    }
+    visit_ranges.push_back(LineInfo::VisitRange(heat_it->first.start(),
+                                                heat_it->first.size(),
+                                                ui));
+  }
+
+  // Increment the weight associated with the BB-ranges in the line info.
+  if (!line_info->BatchVisit(visit_ranges)) {
+    LOG(ERROR) << "LineInfo::BatchVisit failed.";
+    return false;
   }
 
   return true;
@@ -18,21 +18,45 @@
 #include <algorithm>
 #include <limits>
 
+#include "base/bind.h"
 #include "base/strings/utf_string_conversions.h"
 #include "base/win/scoped_bstr.h"
 #include "base/win/scoped_comptr.h"
+#include "syzygy/common/align.h"
 #include "syzygy/common/com_utils.h"
 #include "syzygy/core/address_space.h"
+#include "syzygy/core/parallel_ranges.h"
+#include "syzygy/pdb/pdb_dbi_stream.h"
+#include "syzygy/pdb/pdb_reader.h"
+#include "syzygy/pdb/pdb_util.h"
+#include "syzygy/pe/cvinfo_ext.h"
 
 namespace grinder {
 
 namespace {
 
+namespace cci = Microsoft_Cci_Pdb;
+
 using base::win::ScopedBstr;
 using base::win::ScopedComPtr;
 
 typedef core::AddressRange<core::RelativeAddress, size_t> RelativeAddressRange;
 typedef std::map<DWORD, const std::string*> SourceFileMap;
+typedef std::vector<IMAGE_SECTION_HEADER> SectionHeaders;
+
+// Maps the offsets of the records of a module's file checksum subsection to
+// the names of their files.
+typedef std::map<size_t, const std::string*> ModuleFileMap;
+
+// A line read from the line subsections of a module stream. The name points
+// into the name table of the PDB.
+struct ModuleLine {
+  const std::string* name;
+  size_t line_number;
+  uint32 rva;
+  size_t size;
+};
+typedef std::vector<ModuleLine> ModuleLines;
 
 bool GetDiaSessionForPdb(const base::FilePath& pdb_path,
                          IDiaDataSource* source,
@@ -121,6 +145,285 @@ const std::string* GetSourceFileName(DWORD source_file_id,
   return source_file_name;
 }
 
+// Loads the name table of a PDB. File checksum records refer to their file
+// names by offset into this table.
+bool LoadNameTable(pdb::PdbFile* pdb_file, pdb::OffsetStringMap* names) {
+  DCHECK(pdb_file != NULL);
+  DCHECK(names != NULL);
+
+  scoped_refptr<pdb::PdbStream> stream;
+  if (!pdb::LoadNamedStreamFromPdbFile("/names", pdb_file, &stream))
+    return false;
+  if (stream.get() == NULL) {
+    LOG(ERROR) << "PDB does not contain a name table.";
+    return false;
+  }
+
+  return pdb::ReadStringTable(stream.get(), "Name table", 0, stream->length(),
+                              names);
+}
+
+// Loads the section headers that module line information is relative to.
+// When the image has been transformed these are the headers of the original
+// image, which are the ones DIA uses when OMAP translation is disabled.
+bool LoadSectionHeaders(const pdb::PdbFile& pdb_file,
+                        const pdb::DbiStream& dbi,
+                        SectionHeaders* section_headers) {
+  DCHECK(section_headers != NULL);
+
+  int16 stream_index = dbi.dbg_header().section_header_origin;
+  if (stream_index < 0)
+    stream_index = dbi.dbg_header().section_header;
+  scoped_refptr<pdb::PdbStream> stream;
+  if (stream_index >= 0)
+    stream = pdb_file.GetStream(stream_index);
+  if (stream.get() == NULL) {
+    LOG(ERROR) << "PDB does not contain a section header stream.";
+    return false;
+  }
+
+  if (stream->length() % sizeof(IMAGE_SECTION_HEADER) != 0 ||
+      !stream->Seek(0) || !stream->Read(section_headers)) {
+    LOG(ERROR) << "Failed to read section header stream.";
+    return false;
+  }
+
+  return true;
+}
+
+// Reads a file checksum subsection of a module stream.
+// @param names the name table of the PDB.
+// @param stream the module stream, positioned at the start of the subsection.
+// @param length the length of the subsection.
+// @param module_files receives the files of the module.
+// @returns true on success, false otherwise.
+bool ReadFileChecksums(const pdb::OffsetStringMap& names,
+                       pdb::PdbStream* stream,
+                       size_t length,
+                       ModuleFileMap* module_files) {
+  DCHECK(stream != NULL);
+  DCHECK(module_files != NULL);
+
+  size_t base = stream->pos();
+  size_t end = base + length;
+  while (stream->pos() < end) {
+    size_t offset = stream->pos() - base;
+    cci::CV_FileCheckSum checksum = {};
+    if (!stream->Read(&checksum, 1)) {
+      LOG(ERROR) << "Unable to read file checksum.";
+      return false;
+    }
+
+    pdb::OffsetStringMap::const_iterator it = names.find(checksum.name);
+    if (it == names.end()) {
+      LOG(ERROR) << "File checksum refers to a name that is not in the name "
+                 << "table.";
+      return false;
+    }
+    module_files->insert(std::make_pair(offset, &it->second));
+
+    // Skip the checksum and align.
+    if (!stream->Seek(common::AlignUp(stream->pos() + checksum.len, 4))) {
+      LOG(ERROR) << "Unable to seek past file checksum.";
+      return false;
+    }
+  }
+
+  return true;
+}
+
+// Reads a line subsection of a module stream. The size of each line is the
+// distance to the next line of its block, or to the end of the code described
+// by the subsection for the last line of a block.
+// @param module_files the files of the module.
+// @param section_headers the section headers the lines are relative to.
+// @param stream the module stream, positioned at the start of the subsection.
+// @param length the length of the subsection.
+// @param lines receives the lines.
+// @returns true on success, false otherwise.
+bool ReadLines(const ModuleFileMap& module_files,
+               const SectionHeaders& section_headers,
+               pdb::PdbStream* stream,
+               size_t length,
+               ModuleLines* lines) {
+  DCHECK(stream != NULL);
+  DCHECK(lines != NULL);
+
+  size_t end = stream->pos() + length;
+  cci::CV_LineSection line_section = {};
+  if (!stream->Read(&line_section, 1)) {
+    LOG(ERROR) << "Unable to read line section.";
+    return false;
+  }
+  if (line_section.sec == 0 || line_section.sec > section_headers.size()) {
+    LOG(ERROR) << "Line section refers to invalid section "
+               << line_section.sec << ".";
+    return false;
+  }
+  uint32 base_rva = section_headers[line_section.sec - 1].VirtualAddress +
+      line_section.off;
+
+  std::vector<cci::CV_Line> cv_lines;
+  while (stream->pos() < end) {
+    cci::CV_SourceFile source_file = {};
+    if (!stream->Read(&source_file, 1) ||
+        !stream->Read(&cv_lines, source_file.count)) {
+      LOG(ERROR) << "Unable to read line records.";
+      return false;
+    }
+
+    // We have no use for the column records.
+    if ((line_section.flags & cci::CV_LINES_HAVE_COLUMNS) != 0 &&
+        !stream->Seek(stream->pos() +
+                      source_file.count * sizeof(cci::CV_Column))) {
+      LOG(ERROR) << "Unable to seek past column records.";
+      return false;
+    }
+
+    ModuleFileMap::const_iterator file_it =
+        module_files.find(source_file.index);
+    if (file_it == module_files.end()) {
+      LOG(ERROR) << "Line records refer to an unknown file checksum.";
+      return false;
+    }
+
+    for (size_t i = 0; i < cv_lines.size(); ++i) {
+      uint32 next_offset = line_section.cod;
+      if (i + 1 < cv_lines.size())
+        next_offset = cv_lines[i + 1].offset;
+      if (next_offset < cv_lines[i].offset) {
+        LOG(ERROR) << "Line records are not sorted by offset.";
+        return false;
+      }
+
+      ModuleLine line = { file_it->second,
+                          cv_lines[i].flags & cci::linenumStart,
+                          base_rva + cv_lines[i].offset,
+                          next_offset - cv_lines[i].offset };
+      lines->push_back(line);
+    }
+  }
+
+  return true;
+}
+
+// Reads the lines of a module from its C13 line subsections, which follow its
+// symbol records in its stream. The file checksum subsection is read first as
+// it may follow the line subsections referring to it.
+bool ReadModuleLines(const pdb::DbiModuleInfo& module_info,
+                     const pdb::OffsetStringMap& names,
+                     const SectionHeaders& section_headers,
+                     pdb::PdbStream* stream,
+                     ModuleLines* lines) {
+  DCHECK(stream != NULL);
+  DCHECK(lines != NULL);
+
+  size_t start = module_info.module_info_base().symbol_bytes;
+  size_t end = start + module_info.module_info_base().lines_bytes;
+  if (end > stream->length()) {
+    LOG(ERROR) << "Line information of module " << module_info.module_name()
+               << " lies beyond the end of its stream.";
+    return false;
+  }
+
+  // The subsections are a back-to-back run of {type, length} prefixed chunks,
+  // each aligned to 4 bytes.
+  typedef std::vector<std::pair<size_t, size_t>> SubsectionVector;
+  SubsectionVector line_subsections;
+  ModuleFileMap module_files;
+  size_t pos = start;
+  while (pos < end) {
+    uint32 type = 0;
+    uint32 length = 0;
+    if (!stream->Seek(pos) || !stream->Read(&type, 1) ||
+        !stream->Read(&length, 1) || stream->pos() > end ||
+        length > end - stream->pos()) {
+      LOG(ERROR) << "Unable to read line subsection header of module "
+                 << module_info.module_name() << ".";
+      return false;
+    }
+
+    if (type == cci::DEBUG_S_LINES) {
+      line_subsections.push_back(std::make_pair(stream->pos(), length));
+    } else if (type == cci::DEBUG_S_FILECHKSMS) {
+      if (!ReadFileChecksums(names, stream, length, &module_files))
+        return false;
+    }
+
+    pos = common::AlignUp(stream->pos() + length, 4);
+  }
+
+  for (size_t i = 0; i < line_subsections.size(); ++i) {
+    if (!stream->Seek(line_subsections[i].first) ||
+        !ReadLines(module_files, section_headers, stream,
+                   line_subsections[i].second, lines)) {
+      LOG(ERROR) << "Unable to read lines of module "
+                 << module_info.module_name() << ".";
+      return false;
+    }
+  }
+
+  return true;
+}
+
+// Reads the lines of a range of modules. This only reads from shared state,
+// so distinct ranges may be read concurrently.
+class ModuleLineReader {
+ public:
+  typedef std::vector<scoped_refptr<pdb::PdbStream>> StreamVector;
+
+  ModuleLineReader(const pdb::DbiStream::DbiModuleVector& modules,
+                   const StreamVector& streams,
+                   const pdb::OffsetStringMap& names,
+                   const SectionHeaders& section_headers,
+                   std::vector<ModuleLines>* module_lines)
+      : modules_(modules),
+        streams_(streams),
+        names_(names),
+        section_headers_(section_headers),
+        module_lines_(module_lines) {
+    DCHECK(module_lines != NULL);
+    DCHECK_EQ(modules.size(), streams.size());
+    DCHECK_EQ(modules.size(), module_lines->size());
+  }
+
+  // Reads the lines of the modules in the range [begin, end).
+  bool ReadModules(size_t begin, size_t end) {
+    for (size_t i = begin; i < end; ++i) {
+      // Modules without line information have no stream.
+      if (streams_[i].get() == NULL)
+        continue;
+      if (!ReadModuleLines(modules_[i], names_, section_headers_,
+                           streams_[i].get(), &(*module_lines_)[i])) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+ private:
+  const pdb::DbiStream::DbiModuleVector& modules_;
+  const StreamVector& streams_;
+  const pdb::OffsetStringMap& names_;
+  const SectionHeaders& section_headers_;
+  std::vector<ModuleLines>* module_lines_;
+
+  DISALLOW_COPY_AND_ASSIGN(ModuleLineReader);
+};
+
+bool ModuleLineAddressLess(const ModuleLine& line1, const ModuleLine& line2) {
+  return line1.rva < line2.rva;
+}
+
+// Adds @p count visits to @p source_line. We use saturation arithmetic here as
+// overflow is a real possibility in long trace files.
+void AddVisits(size_t count, LineInfo::SourceLine* source_line) {
+  DCHECK(source_line != NULL);
+  source_line->visit_count =
+      std::min(source_line->visit_count,
+               std::numeric_limits<uint32>::max() - count) + count;
+}
+
 // Used for comparing the ranges covered by two source lines.
 struct SourceLineAddressComparator {
   bool operator()(const LineInfo::SourceLine& sl1,
@@ -132,6 +435,12 @@ struct SourceLineAddressComparator {
 }  // namespace
 
 bool LineInfo::Init(const base::FilePath& pdb_path) {
+  if (use_dia_)
+    return InitWithDia(pdb_path);
+  return InitWithoutDia(pdb_path);
+}
+
+bool LineInfo::InitWithDia(const base::FilePath& pdb_path) {
   ScopedComPtr<IDiaDataSource> source;
   HRESULT hr = source.CreateInstance(CLSID_DiaSource);
   if (FAILED(hr)) {
@@ -171,7 +480,6 @@ bool LineInfo::Init(const base::FilePath& pdb_path) {
 
   // Iterate over the source line information.
   DWORD old_source_file_id = SIZE_MAX;
-  DWORD old_rva = 0;
   const std::string* source_file_name = NULL;
   while (true) {
     ScopedComPtr<IDiaLineNumber> line_number;
@@ -211,34 +519,134 @@ bool LineInfo::Init(const base::FilePath& pdb_path) {
 
     // We rely on the enumeration returning us lines in order of increasing
     // address, as they are stored originally in the PDB. This is required for
-    // the following zero-length fixing mechanism to work as intended.
-    DCHECK_LE(old_rva, rva);
-    old_rva = rva;
-
-    // Is this a non-zero length? Back up and make any zero-length ranges
-    // with the same start address the same length as us. This makes them
-    // simply look like repeated entries in the array and makes searching for
-    // them with lower_bound/upper_bound work as expected.
-    if (length != 0) {
-      SourceLines::reverse_iterator it = source_lines_.rbegin();
-      for (; it != source_lines_.rend(); ++it) {
-        if (it->size != 0)
-          break;
-        if (it->address.value() != rva) {
-          LOG(ERROR) << "Encountered zero-length line number with "
-                     << "inconsistent address.";
-          return false;
-        }
-        it->size = length;
+    // the zero-length fixing mechanism of AppendSourceLine to work as
+    // intended.
+    if (!AppendSourceLine(source_file_name, line, core::RelativeAddress(rva),
+                          length)) {
+      return false;
+    }
+  }
+
+  return true;
+}
+
+bool LineInfo::InitWithoutDia(const base::FilePath& pdb_path) {
+  pdb::PdbReader pdb_reader;
+  pdb_reader.set_use_memory_mapping(true);
+  pdb::PdbFile pdb_file;
+  if (!pdb_reader.Read(pdb_path, &pdb_file)) {
+    LOG(ERROR) << "Failed to read PDB \"" << pdb_path.value() << "\".";
+    return false;
+  }
+
+  scoped_refptr<pdb::PdbStream> dbi_stream =
+      pdb_file.GetStream(pdb::kDbiStream);
+  pdb::DbiStream dbi;
+  if (dbi_stream.get() == NULL || !dbi.Read(dbi_stream.get())) {
+    LOG(ERROR) << "Failed to read the DBI stream of \"" << pdb_path.value()
+               << "\".";
+    return false;
+  }
+
+  pdb::OffsetStringMap names;
+  std::vector<IMAGE_SECTION_HEADER> section_headers;
+  if (!LoadNameTable(&pdb_file, &names) ||
+      !LoadSectionHeaders(pdb_file, dbi, &section_headers)) {
+    return false;
+  }
+
+  // Get the module streams on this thread, so that the workers only read from
+  // them. Reading distinct streams of a memory mapped PDB is thread safe.
+  const pdb::DbiStream::DbiModuleVector& modules = dbi.modules();
+  std::vector<scoped_refptr<pdb::PdbStream>> module_streams(modules.size());
+  for (size_t i = 0; i < modules.size(); ++i) {
+    const pdb::DbiModuleInfoBase& module_info_base =
+        modules[i].module_info_base();
+    if (module_info_base.stream < 0 || module_info_base.lines_bytes == 0)
+      continue;
+    module_streams[i] = pdb_file.GetStream(module_info_base.stream);
+    if (module_streams[i].get() == NULL) {
+      LOG(ERROR) << "Module " << modules[i].module_name() << " has no "
+                 << "symbol stream.";
+      return false;
+    }
+  }
+
+  std::vector<ModuleLines> module_lines(modules.size());
+  ModuleLineReader module_line_reader(
+      modules, module_streams, names, section_headers, &module_lines);
+  if (!core::ProcessRangesInParallel(
+          "LineInfo", modules.size(), max_workers_,
+          base::Bind(&ModuleLineReader::ReadModules,
+                     base::Unretained(&module_line_reader)))) {
+    return false;
+  }
+
+  // Merge the lines of all the modules in order of increasing address.
+  ModuleLines lines;
+  for (size_t i = 0; i < module_lines.size(); ++i) {
+    lines.insert(lines.end(), module_lines[i].begin(), module_lines[i].end());
+    ModuleLines().swap(module_lines[i]);
+  }
+  std::stable_sort(lines.begin(), lines.end(), ModuleLineAddressLess);
+
+  // Map the names from the name table to the strings of source_files_.
+  typedef std::map<const std::string*, const std::string*> FileNameMap;
+  FileNameMap file_name_map;
+  const std::string* old_name = NULL;
+  const std::string* source_file_name = NULL;
+  source_lines_.reserve(lines.size());
+  for (size_t i = 0; i < lines.size(); ++i) {
+    const ModuleLine& line = lines[i];
+    if (line.name != old_name) {
+      FileNameMap::const_iterator it = file_name_map.find(line.name);
+      if (it != file_name_map.end()) {
+        source_file_name = it->second;
+      } else {
+        source_file_name = &(*source_files_.insert(*line.name).first);
+        file_name_map.insert(std::make_pair(line.name, source_file_name));
       }
+      old_name = line.name;
     }
 
-    source_lines_.push_back(SourceLine(source_file_name,
-                                       line,
-                                       core::RelativeAddress(rva),
-                                       length));
+    if (!AppendSourceLine(source_file_name, line.line_number,
+                          core::RelativeAddress(line.rva), line.size)) {
+      return false;
+    }
+  }
+
+  return true;
+}
+
+bool LineInfo::AppendSourceLine(const std::string* source_file_name,
+                                size_t line_number,
+                                core::RelativeAddress address,
+                                size_t size) {
+  DCHECK(source_file_name != NULL);
+  DCHECK(source_lines_.empty() || source_lines_.back().address <= address);
+
+  // Is this a non-zero length? Back up and make any zero-length ranges
+  // with the same start address the same length as us. This makes them
+  // simply look like repeated entries in the array and makes searching for
+  // them with lower_bound/upper_bound work as expected.
+  if (size != 0) {
+    SourceLines::reverse_iterator it = source_lines_.rbegin();
+    for (; it != source_lines_.rend(); ++it) {
+      if (it->size != 0)
+        break;
+      if (it->address != address) {
+        LOG(ERROR) << "Encountered zero-length line number with "
+                   << "inconsistent address.";
+        return false;
+      }
+      it->size = size;
+    }
   }
 
+  source_lines_.push_back(SourceLine(source_file_name,
+                                     line_number,
+                                     address,
+                                     size));
   return true;
 }
 
@@ -267,12 +675,40 @@ bool LineInfo::Visit(
   RelativeAddressRange visit(address, size);
   for (; it != end_it; ++it) {
     RelativeAddressRange range(it->address, it->size);
-    if (visit.Intersects(range)) {
-      // We use saturation arithmetic here as overflow is a real possibility in
-      // long trace files.
-      it->visit_count =
-          std::min(it->visit_count,
-                   std::numeric_limits<uint32>::max() - count) + count;
+    if (visit.Intersects(range))
+      AddVisits(count, &(*it));
+  }
+
+  return true;
+}
+
+bool LineInfo::BatchVisit(const VisitRanges& ranges) {
+  // The first line that may intersect the current range. Ranges are sorted by
+  // starting address, so a line ending before the start of a range can't
+  // intersect any of the ranges that follow it.
+  SourceLines::iterator first_it = source_lines_.begin();
+  for (size_t i = 0; i < ranges.size(); ++i) {
+    const VisitRange& visit_range = ranges[i];
+    if (i > 0 && visit_range.address < ranges[i - 1].address) {
+      LOG(ERROR) << "Visit ranges are not sorted by address.";
+      return false;
+    }
+
+    // Visiting a range of size zero is a nop.
+    if (visit_range.size == 0)
+      continue;
+
+    for (; first_it != source_lines_.end(); ++first_it) {
+      if (first_it->address + first_it->size > visit_range.address)
+        break;
+    }
+
+    RelativeAddressRange visit(visit_range.address, visit_range.size);
+    SourceLines::iterator it = first_it;
+    for (; it != source_lines_.end() && it->address < visit.end(); ++it) {
+      RelativeAddressRange range(it->address, it->size);
+      if (visit.Intersects(range))
+        AddVisits(visit_range.count, &(*it));
     }
   }
 
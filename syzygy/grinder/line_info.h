@@ -19,6 +19,7 @@
 #define SYZYGY_GRINDER_LINE_INFO_H_
 
 #include "base/files/file_path.h"
+#include "base/logging.h"
 #include "syzygy/core/address.h"
 #include "syzygy/core/address_space.h"
 
@@ -33,15 +34,15 @@ namespace grinder {
 //     visited. We need finer grained bookkeeping to accommodate this (the
 //     LCOV file format can handle it just fine). The MSVC tools do not seem to
 //     make a distinction between partially and fully covered lines.
-//
-// TODO(chrisha): Make a more efficient sorted-collection-based version of
-//     Visit. This can be O(N) rather than O(N log N) and would be useful with
-//     the coverage grinder.
 class LineInfo {
  public:
   struct SourceLine;  // Forward declaration.
+  struct VisitRange;  // Forward declaration.
   typedef std::set<std::string> SourceFileSet;
   typedef std::vector<SourceLine> SourceLines;
+  typedef std::vector<VisitRange> VisitRanges;
+
+  LineInfo() : use_dia_(true), max_workers_(1) { }
 
   // Initializes this LineInfo object with data read from the provided PDB.
   // @param pdb_path the PDB whose line information is to be read.
@@ -55,13 +56,63 @@ class LineInfo {
   // @param the number of times to visit this line.
   bool Visit(core::RelativeAddress address, size_t size, size_t count);
 
+  // Visits the given address ranges. This is equivalent to calling Visit for
+  // each of the ranges, but sweeps the ranges and the lines in a single pass.
+  // This is linear rather than O(N log N) in the number of ranges, and is
+  // much faster when visiting the basic blocks of a whole module.
+  // @param ranges the address ranges to visit, sorted by starting address.
+  //     They may overlap.
+  // @returns true on success, false if the ranges are not sorted.
+  bool BatchVisit(const VisitRanges& ranges);
+
+  // @name Mutators.
+  // @{
+  // Sets whether the line information is read using DIA. Defaults to true.
+  // When false the line subsections of the module streams are parsed
+  // directly, which is a lot faster on large PDBs.
+  // @param use_dia true to use DIA, false to use the native PDB readers.
+  void set_use_dia(bool use_dia) { use_dia_ = use_dia; }
+  // Sets the maximum number of threads used to parse module streams when not
+  // using DIA. Defaults to 1. The resulting line information is the same
+  // regardless of the number of threads.
+  // @param max_workers the maximum number of threads to use.
+  void set_max_workers(size_t max_workers) {
+    DCHECK_LT(0U, max_workers);
+    max_workers_ = max_workers;
+  }
+  // @}
+
   // @name Accessors.
   // @{
   const SourceFileSet& source_files() const { return source_files_; }
   const SourceLines& source_lines() const { return source_lines_; }
+  // @returns true if the line information is read using DIA.
+  bool use_dia() const { return use_dia_; }
+  // @returns the maximum number of threads used to parse module streams.
+  size_t max_workers() const { return max_workers_; }
   // @}
 
  protected:
+  // The implementations of Init using DIA and using the native PDB readers.
+  // @param pdb_path the PDB whose line information is to be read.
+  // @returns true on success, false otherwise.
+  bool InitWithDia(const base::FilePath& pdb_path);
+  bool InitWithoutDia(const base::FilePath& pdb_path);
+
+  // Appends a line to source_lines_. Lines must be appended in order of
+  // increasing address. Zero-length lines are given the length of the line
+  // following them, which must share their address.
+  // @param source_file_name the source file of the line. This must point into
+  //     source_files_.
+  // @param line_number the line number.
+  // @param address the address of the code associated with the line.
+  // @param size the size of the code associated with the line.
+  // @returns true on success, false otherwise.
+  bool AppendSourceLine(const std::string* source_file_name,
+                        size_t line_number,
+                        core::RelativeAddress address,
+                        size_t size);
+
   // Used to store unique file names in a manner such that we can draw stable
   // pointers to them. The SourceLine objects will point to the strings in this
   // set.
@@ -71,6 +122,12 @@ class LineInfo {
   // the order in which we retrieve it from the PDB. This lets us do efficient
   // binary search lookups in Visit.
   SourceLines source_lines_;
+
+  // Indicates whether the line information is read using DIA.
+  bool use_dia_;
+
+  // The maximum number of threads used to parse module streams.
+  size_t max_workers_;
 };
 
 // Describes a single line of source code from some file.
@@ -99,6 +156,20 @@ struct LineInfo::SourceLine {
   uint32 visit_count;
 };
 
+// Describes an address range to visit, and the number of times to visit it.
+struct LineInfo::VisitRange {
+  VisitRange(core::RelativeAddress address, size_t size, size_t count)
+      : address(address), size(size), count(count) {
+  }
+
+  // The starting address of the range.
+  core::RelativeAddress address;
+  // The size of the range. Ranges of size zero visit no lines.
+  size_t size;
+  // The number of times to visit the lines intersecting the range.
+  size_t count;
+};
+
 }  // namespace grinder
 
 #endif  // SYZYGY_GRINDER_LINE_INFO_H_
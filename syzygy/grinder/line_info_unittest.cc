@@ -14,11 +14,15 @@
 
 #include "syzygy/grinder/line_info.h"
 
+#include <tuple>
+
+#include "base/strings/stringprintf.h"
 #include "base/win/scoped_com_initializer.h"
 #include "gmock/gmock.h"
 #include "gtest/gtest.h"
 #include "syzygy/core/unittest_util.h"
 #include "syzygy/pe/unittest_util.h"
+#include "syzygy/testing/metrics.h"
 
 namespace grinder {
 
@@ -98,8 +102,82 @@ void PushBackSourceLine(
       EXPECT_EQ(0u, visited.size()); \
     }
 
+// A source line, identified by the name rather than the address of its file
+// name.
+typedef std::tuple<core::RelativeAddress, size_t, size_t, std::string>
+    SourceLineTuple;
+
+void GetSourceLineTuples(const LineInfo& line_info,
+                         std::vector<SourceLineTuple>* tuples) {
+  DCHECK(tuples != NULL);
+  tuples->clear();
+  for (size_t i = 0; i < line_info.source_lines().size(); ++i) {
+    const LineInfo::SourceLine& line = line_info.source_lines()[i];
+    tuples->push_back(std::make_tuple(
+        line.address, line.size, line.line_number, *line.source_file_name));
+  }
+}
+
+// Reads the line information of the given PDB with and without DIA, and
+// checks that both are the same. Lines sharing an address may be ordered
+// differently, so the lines are compared as sorted sets.
+void InitWithAndWithoutDia(const base::FilePath& pdb_path) {
+  LineInfo dia_line_info;
+  ASSERT_TRUE(dia_line_info.Init(pdb_path));
+
+  LineInfo native_line_info;
+  native_line_info.set_use_dia(false);
+  ASSERT_TRUE(native_line_info.Init(pdb_path));
+
+  EXPECT_THAT(native_line_info.source_files(),
+              ::testing::ContainerEq(dia_line_info.source_files()));
+
+  std::vector<SourceLineTuple> dia_lines;
+  std::vector<SourceLineTuple> native_lines;
+  GetSourceLineTuples(dia_line_info, &dia_lines);
+  GetSourceLineTuples(native_line_info, &native_lines);
+  std::sort(dia_lines.begin(), dia_lines.end());
+  std::sort(native_lines.begin(), native_lines.end());
+  EXPECT_THAT(native_lines, ::testing::ContainerEq(dia_lines));
+}
+
+void RunInitPerfTest(const char* pdb_name,
+                     const base::FilePath& pdb_path,
+                     bool use_dia,
+                     size_t max_workers) {
+  LineInfo line_info;
+  line_info.set_use_dia(use_dia);
+  line_info.set_max_workers(max_workers);
+
+  base::Time start = base::Time::Now();
+  ASSERT_TRUE(line_info.Init(pdb_path));
+  base::Time end = base::Time::Now();
+
+  const char* backend = "Dia";
+  if (!use_dia)
+    backend = max_workers > 1 ? "NativeParallel" : "Native";
+  std::string prefix = base::StringPrintf(
+      "Syzygy.Grinder.LineInfo.%s.%s", pdb_name, backend);
+  testing::EmitMetric(prefix + ".InitSeconds", (end - start).InSecondsF());
+  testing::EmitMetric(
+      prefix + ".LinesPerSecond",
+      static_cast<double>(line_info.source_lines().size()) /
+          (end - start).InSecondsF());
+}
+
 }  // namespace
 
+TEST_F(LineInfoTest, MutatorsAndAccessors) {
+  LineInfo line_info;
+  EXPECT_TRUE(line_info.use_dia());
+  EXPECT_EQ(1u, line_info.max_workers());
+
+  line_info.set_use_dia(false);
+  line_info.set_max_workers(4);
+  EXPECT_FALSE(line_info.use_dia());
+  EXPECT_EQ(4u, line_info.max_workers());
+}
+
 TEST_F(LineInfoTest, InitDynamicPdb) {
   TestLineInfo line_info;
   EXPECT_TRUE(line_info.Init(pdb_path_));
@@ -118,6 +196,49 @@ TEST_F(LineInfoTest, InitStaticPdb) {
   EXPECT_EQ(8379u, line_info.source_lines().size());
 }
 
+TEST_F(LineInfoTest, InitStaticPdbWithoutDia) {
+  TestLineInfo line_info;
+  line_info.set_use_dia(false);
+  EXPECT_TRUE(line_info.Init(static_pdb_path_));
+
+  // These are the same as for InitStaticPdb.
+  EXPECT_EQ(138u, line_info.source_files().size());
+  EXPECT_EQ(8379u, line_info.source_lines().size());
+}
+
+TEST_F(LineInfoTest, InitWithAndWithoutDia) {
+  ASSERT_NO_FATAL_FAILURE(InitWithAndWithoutDia(pdb_path_));
+  ASSERT_NO_FATAL_FAILURE(InitWithAndWithoutDia(static_pdb_path_));
+}
+
+TEST_F(LineInfoTest, InitWithoutDiaInParallel) {
+  LineInfo serial_line_info;
+  serial_line_info.set_use_dia(false);
+  ASSERT_TRUE(serial_line_info.Init(static_pdb_path_));
+
+  LineInfo parallel_line_info;
+  parallel_line_info.set_use_dia(false);
+  parallel_line_info.set_max_workers(4);
+  ASSERT_TRUE(parallel_line_info.Init(static_pdb_path_));
+
+  // The lines are merged in the same order regardless of the number of
+  // workers, so they can be compared directly.
+  std::vector<SourceLineTuple> serial_lines;
+  std::vector<SourceLineTuple> parallel_lines;
+  GetSourceLineTuples(serial_line_info, &serial_lines);
+  GetSourceLineTuples(parallel_line_info, &parallel_lines);
+  EXPECT_THAT(parallel_lines, ::testing::ContainerEq(serial_lines));
+}
+
+TEST_F(LineInfoTest, InitPerfTest) {
+  ASSERT_NO_FATAL_FAILURE(RunInitPerfTest(
+      "CoverageInstrumentedTestDll", static_pdb_path_, true, 1));
+  ASSERT_NO_FATAL_FAILURE(RunInitPerfTest(
+      "CoverageInstrumentedTestDll", static_pdb_path_, false, 1));
+  ASSERT_NO_FATAL_FAILURE(RunInitPerfTest(
+      "CoverageInstrumentedTestDll", static_pdb_path_, false, 4));
+}
+
 TEST_F(LineInfoTest, Visit) {
   TestLineInfo line_info;
 
@@ -212,4 +333,110 @@ TEST_F(LineInfoTest, VisitCounterWorks) {
   EXPECT_EQ(0xffffffff, line_it->visit_count);
 }
 
+TEST_F(LineInfoTest, BatchVisit) {
+  TestLineInfo line_info;
+
+  // Use the same lines as in the Visit test.
+  std::string source_file("foo.cc");
+  PushBackSourceLine(&line_info, &source_file, 1, 4096, 2);
+  PushBackSourceLine(&line_info, &source_file, 2, 4096, 2);
+  PushBackSourceLine(&line_info, &source_file, 3, 4098, 2);
+  PushBackSourceLine(&line_info, &source_file, 5, 4100, 2);
+  PushBackSourceLine(&line_info, &source_file, 6, 4104, 6);
+  PushBackSourceLine(&line_info, &source_file, 7, 4110, 2);
+
+  // Visiting nothing is fine.
+  LineInfo::VisitRanges ranges;
+  EXPECT_TRUE(line_info.BatchVisit(ranges));
+  EXPECT_NO_LINES_VISITED(line_info);
+
+  // Visit a repeated BB, an empty range and a gap.
+  ranges.push_back(LineInfo::VisitRange(core::RelativeAddress(4096), 2, 1));
+  ranges.push_back(LineInfo::VisitRange(core::RelativeAddress(4100), 0, 1));
+  ranges.push_back(LineInfo::VisitRange(core::RelativeAddress(4102), 2, 1));
+  EXPECT_TRUE(line_info.BatchVisit(ranges));
+  EXPECT_LINES_VISITED(line_info, 1, 2);
+
+  // Visit overlapping ranges, the first of which spans a gap.
+  line_info.ResetVisitedLines();
+  ranges.clear();
+  ranges.push_back(LineInfo::VisitRange(core::RelativeAddress(4098), 10, 1));
+  ranges.push_back(LineInfo::VisitRange(core::RelativeAddress(4100), 1, 2));
+  ranges.push_back(LineInfo::VisitRange(core::RelativeAddress(4111), 1, 3));
+  EXPECT_TRUE(line_info.BatchVisit(ranges));
+  EXPECT_LINES_VISITED(line_info, 3, 5, 6, 7);
+  EXPECT_EQ(0u, line_info.source_lines()[1].visit_count);
+  EXPECT_EQ(1u, line_info.source_lines()[2].visit_count);
+  EXPECT_EQ(3u, line_info.source_lines()[3].visit_count);
+  EXPECT_EQ(1u, line_info.source_lines()[4].visit_count);
+  EXPECT_EQ(3u, line_info.source_lines()[5].visit_count);
+
+  // Unsorted ranges are refused.
+  ranges.clear();
+  ranges.push_back(LineInfo::VisitRange(core::RelativeAddress(4104), 2, 1));
+  ranges.push_back(LineInfo::VisitRange(core::RelativeAddress(4096), 2, 1));
+  EXPECT_FALSE(line_info.BatchVisit(ranges));
+}
+
+TEST_F(LineInfoTest, BatchVisitMatchesVisit) {
+  TestLineInfo line_info;
+  ASSERT_TRUE(line_info.Init(static_pdb_path_));
+  ASSERT_FALSE(line_info.source_lines().empty());
+
+  // Visit ranges of varying sizes straddling the lines, with some overlap.
+  LineInfo::VisitRanges ranges;
+  const LineInfo::SourceLines& lines = line_info.source_lines();
+  for (size_t i = 0; i < lines.size(); i += 3) {
+    ranges.push_back(
+        LineInfo::VisitRange(lines[i].address + 1, i % 7, i % 5 + 1));
+  }
+
+  for (size_t i = 0; i < ranges.size(); ++i) {
+    ASSERT_TRUE(line_info.Visit(ranges[i].address, ranges[i].size,
+                                ranges[i].count));
+  }
+  std::vector<uint32> expected_visit_counts;
+  for (size_t i = 0; i < lines.size(); ++i)
+    expected_visit_counts.push_back(lines[i].visit_count);
+
+  line_info.ResetVisitedLines();
+  ASSERT_TRUE(line_info.BatchVisit(ranges));
+  std::vector<uint32> visit_counts;
+  for (size_t i = 0; i < lines.size(); ++i)
+    visit_counts.push_back(lines[i].visit_count);
+
+  EXPECT_THAT(visit_counts, ::testing::ContainerEq(expected_visit_counts));
+}
+
+TEST_F(LineInfoTest, VisitPerfTest) {
+  TestLineInfo line_info;
+  ASSERT_TRUE(line_info.Init(static_pdb_path_));
+
+  // Visit every line a number of times, as the coverage grinder would for
+  // the basic blocks of a module.
+  const size_t kIterations = 100;
+  LineInfo::VisitRanges ranges;
+  const LineInfo::SourceLines& lines = line_info.source_lines();
+  for (size_t i = 0; i < lines.size(); ++i)
+    ranges.push_back(LineInfo::VisitRange(lines[i].address, lines[i].size, 1));
+
+  base::Time start = base::Time::Now();
+  for (size_t i = 0; i < kIterations; ++i) {
+    for (size_t j = 0; j < ranges.size(); ++j) {
+      ASSERT_TRUE(line_info.Visit(ranges[j].address, ranges[j].size,
+                                  ranges[j].count));
+    }
+  }
+  base::Time visited = base::Time::Now();
+  for (size_t i = 0; i < kIterations; ++i)
+    ASSERT_TRUE(line_info.BatchVisit(ranges));
+  base::Time batch_visited = base::Time::Now();
+
+  double range_count = static_cast<double>(kIterations * ranges.size());
+  testing::EmitMetric("Syzygy.Grinder.LineInfo.VisitRangesPerSecond",
+                      range_count / (visited - start).InSecondsF());
+  testing::EmitMetric("Syzygy.Grinder.LineInfo.BatchVisitRangesPerSecond",
+                      range_count / (batch_visited - visited).InSecondsF());
+}
+
 }  // namespace grinder
@@ -73,6 +73,9 @@ static const char kUsageFormatStr[] =
     "    --filter=<path>         The path of the filter to be used in\n"
     "                            applying the instrumentation. Ranges marked\n"
     "                            in the filter will not be instrumented.\n"
+    "    --jobs=<n>              The number of threads to use when\n"
+    "                            decomposing PE images, and when applying\n"
+    "                            the transform in asan mode. Defaults to 1.\n"
     "    --no-augment-pdb        Indicates that the relinker should not\n"
     "                            augment the output PDB with additional.\n"
     "                            metadata.\n"
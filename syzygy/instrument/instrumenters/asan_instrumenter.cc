@@ -73,6 +73,7 @@ bool AsanInstrumenter::InstrumentImpl() {
   asan_transform_->set_remove_redundant_checks(remove_redundant_checks_);
   asan_transform_->set_instrumentation_rate(instrumentation_rate_);
   asan_transform_->set_hot_patching(hot_patching_);
+  asan_transform_->set_max_workers(max_workers_);
 
   // Set up the filter if one was provided.
   if (filter.get()) {
@@ -16,6 +16,7 @@
 
 #include "base/logging.h"
 #include "base/files/file_util.h"
+#include "base/strings/string_number_conversions.h"
 #include "syzygy/application/application.h"
 #include "syzygy/core/file_util.h"
 
@@ -104,6 +105,16 @@ bool InstrumenterWithRelinker::DoCommandLineParse(
   no_augment_pdb_ = command_line->HasSwitch("no-augment-pdb");
   no_strip_strings_ = command_line->HasSwitch("no-strip-strings");
 
+  if (command_line->HasSwitch("jobs")) {
+    std::string jobs_str = command_line->GetSwitchValueASCII("jobs");
+    unsigned jobs = 0;
+    if (!base::StringToUint(jobs_str, &jobs) || jobs == 0) {
+      LOG(ERROR) << "Invalid jobs value: \"" << jobs_str << "\".";
+      return false;
+    }
+    max_workers_ = jobs;
+  }
+
   return true;
 }
 
@@ -206,6 +217,7 @@ bool InstrumenterWithRelinker::CreateRelinker() {
     relinker->set_allow_overwrite(allow_overwrite_);
     relinker->set_augment_pdb(!no_augment_pdb_);
     relinker->set_strip_strings(!no_strip_strings_);
+    relinker->set_max_workers(max_workers_);
   }
 
   DCHECK_EQ(image_format_, relinker_->image_format());
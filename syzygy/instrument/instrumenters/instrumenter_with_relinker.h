@@ -42,7 +42,8 @@ class InstrumenterWithRelinker : public InstrumenterInterface {
         allow_overwrite_(false),
         debug_friendly_(false),
         no_augment_pdb_(false),
-        no_strip_strings_(false) { }
+        no_strip_strings_(false),
+        max_workers_(1) { }
 
   ~InstrumenterWithRelinker() { }
 
@@ -108,6 +109,9 @@ class InstrumenterWithRelinker : public InstrumenterInterface {
   bool debug_friendly_;
   bool no_augment_pdb_;
   bool no_strip_strings_;
+  // The maximal number of threads to use, where the instrumentation supports
+  // it.
+  size_t max_workers_;
   // @}
 
   // This is used to save a pointer to the object returned by the call to
@@ -63,6 +63,7 @@ class TestInstrumenterWithRelinker : public InstrumenterWithRelinker {
   using InstrumenterWithRelinker::allow_overwrite_;
   using InstrumenterWithRelinker::no_augment_pdb_;
   using InstrumenterWithRelinker::no_strip_strings_;
+  using InstrumenterWithRelinker::max_workers_;
 
   TestInstrumenterWithRelinker() {
   }
@@ -195,6 +196,26 @@ TEST_F(InstrumenterWithRelinkerTest, ParseInputImages) {
   EXPECT_FALSE(instrumenter.allow_overwrite_);
   EXPECT_FALSE(instrumenter.no_augment_pdb_);
   EXPECT_FALSE(instrumenter.no_strip_strings_);
+  EXPECT_EQ(1u, instrumenter.max_workers_);
+}
+
+TEST_F(InstrumenterWithRelinkerTest, ParseJobs) {
+  cmd_line_.AppendSwitchPath("input-image", input_pe_image_path_);
+  cmd_line_.AppendSwitchPath("output-image", output_pe_image_path_);
+  cmd_line_.AppendSwitchASCII("jobs", "4");
+
+  TestInstrumenterWithRelinker instrumenter;
+  EXPECT_TRUE(instrumenter.ParseCommandLine(&cmd_line_));
+  EXPECT_EQ(4u, instrumenter.max_workers_);
+}
+
+TEST_F(InstrumenterWithRelinkerTest, ParseInvalidJobsFails) {
+  cmd_line_.AppendSwitchPath("input-image", input_pe_image_path_);
+  cmd_line_.AppendSwitchPath("output-image", output_pe_image_path_);
+  cmd_line_.AppendSwitchASCII("jobs", "0");
+
+  TestInstrumenterWithRelinker instrumenter;
+  EXPECT_FALSE(instrumenter.ParseCommandLine(&cmd_line_));
 }
 
 TEST_F(InstrumenterWithRelinkerTest, InstrumentPE) {
@@ -210,6 +231,21 @@ TEST_F(InstrumenterWithRelinkerTest, InstrumentPE) {
   EXPECT_TRUE(instrumenter.Instrument());
 }
 
+TEST_F(InstrumenterWithRelinkerTest, InstrumentPEPassesJobsToRelinker) {
+  SetUpValidCommandLinePE();
+  cmd_line_.AppendSwitchASCII("jobs", "4");
+
+  TestInstrumenterWithRelinker instrumenter;
+  EXPECT_TRUE(instrumenter.ParseCommandLine(&cmd_line_));
+  EXPECT_CALL(instrumenter.mock_pe_relinker_, Init()).WillOnce(Return(true));
+  EXPECT_CALL(instrumenter.mock_pe_relinker_, Relink()).WillOnce(Return(true));
+  EXPECT_CALL(instrumenter, InstrumentPrepare()).WillOnce(Return(true));
+  EXPECT_CALL(instrumenter, InstrumentImpl()).WillOnce(Return(true));
+
+  EXPECT_TRUE(instrumenter.Instrument());
+  EXPECT_EQ(4u, instrumenter.mock_pe_relinker_.max_workers());
+}
+
 TEST_F(InstrumenterWithRelinkerTest, InstrumentCoff) {
   SetUpValidCommandLineCoff();
 
@@ -28,6 +28,7 @@
 #include "syzygy/block_graph/basic_block_assembler.h"
 #include "syzygy/block_graph/block_builder.h"
 #include "syzygy/block_graph/block_util.h"
+#include "syzygy/block_graph/transform.h"
 #include "syzygy/block_graph/typed_block.h"
 #include "syzygy/common/defs.h"
 #include "syzygy/instrument/transforms/asan_intercepts.h"
@@ -993,6 +994,57 @@ bool PeGetRedirectsForStaticallyLinkedFunctions(
   return true;
 }
 
+// Configures @p bb_transform with the settings of @p asan_transform.
+void ConfigureBasicBlockTransform(const AsanTransform& asan_transform,
+                                  AsanBasicBlockTransform* bb_transform) {
+  DCHECK_NE(static_cast<AsanBasicBlockTransform*>(nullptr), bb_transform);
+  bb_transform->set_debug_friendly(asan_transform.debug_friendly());
+  bb_transform->set_use_liveness_analysis(
+      asan_transform.use_liveness_analysis());
+  bb_transform->set_remove_redundant_checks(
+      asan_transform.remove_redundant_checks());
+  bb_transform->set_filter(asan_transform.filter());
+  bb_transform->set_instrumentation_rate(
+      asan_transform.instrumentation_rate());
+}
+
+// Instruments each subgraph with an AsanBasicBlockTransform of its own, as
+// these hold per-subgraph analysis state. This makes it safe to invoke
+// concurrently on distinct subgraphs.
+class ConcurrentAsanBasicBlockTransform
+    : public block_graph::BasicBlockSubGraphTransformInterface {
+ public:
+  ConcurrentAsanBasicBlockTransform(
+      const AsanTransform* asan_transform,
+      AsanBasicBlockTransform::AsanHookMap* check_access_hooks)
+      : asan_transform_(asan_transform),
+        check_access_hooks_(check_access_hooks) {
+    DCHECK_NE(static_cast<AsanTransform*>(nullptr), asan_transform);
+    DCHECK_NE(static_cast<AsanBasicBlockTransform::AsanHookMap*>(nullptr),
+              check_access_hooks);
+  }
+
+  virtual const char* name() const override {
+    return AsanBasicBlockTransform::kTransformName;
+  }
+
+  virtual bool TransformBasicBlockSubGraph(
+      const TransformPolicyInterface* policy,
+      BlockGraph* block_graph,
+      BasicBlockSubGraph* basic_block_subgraph) override {
+    AsanBasicBlockTransform transform(check_access_hooks_);
+    ConfigureBasicBlockTransform(*asan_transform_, &transform);
+    return transform.TransformBasicBlockSubGraph(policy, block_graph,
+                                                 basic_block_subgraph);
+  }
+
+ private:
+  const AsanTransform* asan_transform_;
+  AsanBasicBlockTransform::AsanHookMap* check_access_hooks_;
+
+  DISALLOW_COPY_AND_ASSIGN(ConcurrentAsanBasicBlockTransform);
+};
+
 }  // namespace
 
 const char AsanBasicBlockTransform::kTransformName[] =
@@ -1257,7 +1309,8 @@ AsanTransform::AsanTransform()
       asan_parameters_block_(nullptr),
       heap_init_block_(nullptr),
       crtheap_block_(nullptr),
-      hot_patching_(false) {
+      hot_patching_(false),
+      max_workers_(1) {
 }
 
 AsanTransform::~AsanTransform() { }
@@ -1337,13 +1390,15 @@ bool AsanTransform::OnBlock(const TransformPolicyInterface* policy,
   if (ShouldSkipBlock(policy, block))
     return true;
 
+  // The blocks are instrumented concurrently once they have all been seen.
+  if (!hot_patching_ && max_workers_ > 1) {
+    pending_blocks_.push_back(block);
+    return true;
+  }
+
   // Use the filter that was passed to us for our child transform.
   AsanBasicBlockTransform transform(&check_access_hooks_ref_);
-  transform.set_debug_friendly(debug_friendly());
-  transform.set_use_liveness_analysis(use_liveness_analysis());
-  transform.set_remove_redundant_checks(remove_redundant_checks());
-  transform.set_filter(filter());
-  transform.set_instrumentation_rate(instrumentation_rate_);
+  ConfigureBasicBlockTransform(*this, &transform);
 
   if (!hot_patching_) {
     if (!ApplyBasicBlockSubGraphTransform(
@@ -1381,6 +1436,15 @@ bool AsanTransform::PostBlockGraphIteration(
   DCHECK(block_graph != NULL);
   DCHECK(header_block != NULL);
 
+  if (!pending_blocks_.empty()) {
+    ConcurrentAsanBasicBlockTransform transform(this, &check_access_hooks_ref_);
+    bool result = block_graph::ApplyBasicBlockSubGraphTransformInParallel(
+        &transform, policy, block_graph, pending_blocks_, max_workers_, NULL);
+    pending_blocks_.clear();
+    if (!result)
+      return false;
+  }
+
   if (block_graph->image_format() == BlockGraph::PE_IMAGE) {
     if (!PeInterceptFunctions(kAsanIntercepts, policy, block_graph,
                               header_block)) {
@@ -1619,7 +1683,7 @@ bool AsanTransform::PeInjectAsanParameters(
   params_block->CopyData(fparams.data().size(), fparams.data().data());
 
   // Wire up any references that are required.
-  static_assert(12 == common::kAsanParametersVersion,
+  static_assert(16 == common::kAsanParametersVersion,
                 "Pointers in the params must be linked up here.");
   block_graph::TypedBlock<common::AsanParameters> params;
   CHECK(params.Init(0, params_block));
@@ -307,6 +307,16 @@ class AsanTransform
     hot_patching_ = hot_patching;
   }
 
+  // The maximal number of threads used to instrument basic blocks. When this
+  // is greater than 1, OnBlock only collects the blocks to instrument, and
+  // they are instrumented concurrently at the start of
+  // PostBlockGraphIteration. This is ignored in hot patching mode.
+  size_t max_workers() const { return max_workers_; }
+  void set_max_workers(size_t max_workers) {
+    DCHECK_LT(0U, max_workers);
+    max_workers_ = max_workers;
+  }
+
   // The name of the DLL that is imported by default if hot patching mode is
   // inactive.
   static const char kSyzyAsanDll[];
@@ -442,6 +452,13 @@ class AsanTransform
   // metadata stream in the PostBlockGraphIteration.
   std::vector<BlockGraph::Block*> hot_patched_blocks_;
 
+  // The maximal number of threads used to instrument basic blocks.
+  size_t max_workers_;
+
+  // When instrumenting concurrently, the blocks collected by OnBlock, in the
+  // order in which they were seen.
+  block_graph::BlockVector pending_blocks_;
+
  private:
   DISALLOW_COPY_AND_ASSIGN(AsanTransform);
 };
@@ -342,6 +342,12 @@ TEST_F(AsanTransformTest, SetRemoveRedundantChecksFlag) {
   EXPECT_FALSE(bb_transform.remove_redundant_checks());
 }
 
+TEST_F(AsanTransformTest, SetMaxWorkers) {
+  EXPECT_EQ(1u, asan_transform_.max_workers());
+  asan_transform_.set_max_workers(4);
+  EXPECT_EQ(4u, asan_transform_.max_workers());
+}
+
 TEST_F(AsanTransformTest, SetUseLivenessFlag) {
   EXPECT_FALSE(asan_transform_.use_liveness_analysis());
   asan_transform_.set_use_liveness_analysis(true);
@@ -1589,9 +1595,10 @@ TEST_F(AsanTransformTest, CoffInterceptFunctions) {
 
 namespace {
 
-void GetImageSizeSubsampledInstrumentation(double rate, size_t* size) {
+void GetInstrumentedImageSize(double rate, size_t max_workers, size_t* size) {
   ASSERT_LE(0.0, rate);
   ASSERT_GE(1.0, rate);
+  ASSERT_LT(0u, max_workers);
   ASSERT_TRUE(size != NULL);
 
   base::FilePath test_dll_path = ::testing::GetOutputRelativePath(
@@ -1611,6 +1618,7 @@ void GetImageSizeSubsampledInstrumentation(double rate, size_t* size) {
 
   AsanTransform tx;
   tx.set_instrumentation_rate(rate);
+  tx.set_max_workers(max_workers);
 
   pe::PETransformPolicy policy;
   ASSERT_TRUE(tx.TransformBlockGraph(&policy, &block_graph, header_block));
@@ -1626,13 +1634,13 @@ void GetImageSizeSubsampledInstrumentation(double rate, size_t* size) {
 
 TEST_F(AsanTransformTest, SubsampledInstrumentationTestDll) {
   size_t rate0 = 0;
-  ASSERT_NO_FATAL_FAILURE(GetImageSizeSubsampledInstrumentation(0.0, &rate0));
+  ASSERT_NO_FATAL_FAILURE(GetInstrumentedImageSize(0.0, 1, &rate0));
 
   size_t rate50 = 0;
-  ASSERT_NO_FATAL_FAILURE(GetImageSizeSubsampledInstrumentation(0.5, &rate50));
+  ASSERT_NO_FATAL_FAILURE(GetInstrumentedImageSize(0.5, 1, &rate50));
 
   size_t rate100 = 0;
-  ASSERT_NO_FATAL_FAILURE(GetImageSizeSubsampledInstrumentation(1.0, &rate100));
+  ASSERT_NO_FATAL_FAILURE(GetInstrumentedImageSize(1.0, 1, &rate100));
 
   size_t size100 = rate100 - rate0;
   size_t size50 = rate50 - rate0;
@@ -1649,6 +1657,16 @@ TEST_F(AsanTransformTest, SubsampledInstrumentationTestDll) {
   EXPECT_GE(60 * size100 / 100, size50);
 }
 
+TEST_F(AsanTransformTest, ParallelInstrumentationTestDll) {
+  size_t serial_size = 0;
+  ASSERT_NO_FATAL_FAILURE(GetInstrumentedImageSize(1.0, 1, &serial_size));
+
+  size_t parallel_size = 0;
+  ASSERT_NO_FATAL_FAILURE(GetInstrumentedImageSize(1.0, 4, &parallel_size));
+
+  EXPECT_EQ(serial_size, parallel_size);
+}
+
 TEST_F(AsanTransformTest, PeInjectAsanParametersNoStackIds) {
   ASSERT_NO_FATAL_FAILURE(DecomposeTestDll());
 
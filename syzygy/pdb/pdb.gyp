@@ -38,8 +38,12 @@
         'pdb_file.h',
         'pdb_file_stream.cc',
         'pdb_file_stream.h',
+        'pdb_mapped_file_stream.cc',
+        'pdb_mapped_file_stream.h',
         'pdb_mutator.cc',
         'pdb_mutator.h',
+        'pdb_overlay_stream.cc',
+        'pdb_overlay_stream.h',
         'pdb_reader.cc',
         'pdb_reader.h',
         'pdb_stream.cc',
@@ -81,7 +85,9 @@
         'pdb_dbi_stream_unittest.cc',
         'pdb_file_stream_unittest.cc',
         'pdb_file_unittest.cc',
+        'pdb_mapped_file_stream_unittest.cc',
         'pdb_mutator_unittest.cc',
+        'pdb_overlay_stream_unittest.cc',
         'pdb_reader_unittest.cc',
         'pdb_stream_unittest.cc',
         'pdb_symbol_record_unittest.cc',
@@ -99,6 +99,19 @@ bool PdbByteStream::ReadBytes(void* dest, size_t count, size_t* bytes_read) {
   return true;
 }
 
+size_t PdbByteStream::ReadDirectRun(size_t count, const uint8** data) {
+  DCHECK(data != NULL);
+
+  // The whole stream is contiguous, so everything that's left can be served.
+  count = std::min(count, bytes_left());
+  if (count == 0)
+    return 0;
+
+  *data = this->data() + pos();
+  Seek(pos() + count);
+  return count;
+}
+
 scoped_refptr<WritablePdbStream> PdbByteStream::GetWritablePdbStream() {
   // This is very not thread-safe! If we want this to be thread-safe, we'll
   // need to be using thread-safe reference counting, and a little smarts here
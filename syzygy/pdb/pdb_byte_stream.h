@@ -37,6 +37,7 @@ class PdbByteStream : public PdbStream {
   // @name PdbStream implementation.
   // @{
   virtual bool ReadBytes(void* dest, size_t count, size_t* bytes_read) override;
+  virtual size_t ReadDirectRun(size_t count, const uint8** data) override;
   virtual scoped_refptr<WritablePdbStream> GetWritablePdbStream() override;
   // @}
 
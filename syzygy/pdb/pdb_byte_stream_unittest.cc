@@ -105,6 +105,22 @@ TEST(PdbByteStreamTest, ReadBytes) {
   EXPECT_EQ(len, total_bytes);
 }
 
+TEST(PdbByteStreamTest, ReadDirectRun) {
+  size_t len = 17;
+  scoped_refptr<TestPdbStream> test_stream(new TestPdbStream(len));
+
+  scoped_refptr<TestPdbByteStream> stream(new TestPdbByteStream);
+  EXPECT_TRUE(stream->Init(test_stream.get()));
+
+  // The whole stream is served as a single run.
+  const uint8* data = NULL;
+  EXPECT_EQ(4U, stream->ReadDirectRun(4, &data));
+  EXPECT_EQ(stream->data(), data);
+  EXPECT_EQ(len - 4, stream->ReadDirectRun(100, &data));
+  EXPECT_EQ(stream->data() + 4, data);
+  EXPECT_EQ(0U, stream->ReadDirectRun(100, &data));
+}
+
 TEST(PdbByteStreamTest, GetWritablePdbStream) {
   scoped_refptr<PdbStream> stream(new PdbByteStream);
   scoped_refptr<WritablePdbStream> writer1 = stream->GetWritablePdbStream();
@@ -29,6 +29,13 @@ TEST(PdbDbiStreamTest, ReadValidDbiStream) {
       testing::GetStreamFromFile(valid_dbi_path);
   DbiStream dbi_stream;
   EXPECT_TRUE(dbi_stream.Read(valid_dbi_stream.get()));
+
+  // Every section contribution belongs to a module.
+  EXPECT_FALSE(dbi_stream.section_contribs().empty());
+  for (size_t i = 0; i < dbi_stream.section_contribs().size(); ++i) {
+    EXPECT_LT(static_cast<size_t>(dbi_stream.section_contribs()[i].module),
+              dbi_stream.modules().size());
+  }
 }
 
 TEST(PdbDbiStreamTest, ReadInvalidDbiStream) {
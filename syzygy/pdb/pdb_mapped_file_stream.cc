@@ -0,0 +1,123 @@
+// Copyright 2015 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "syzygy/pdb/pdb_mapped_file_stream.h"
+
+#include <algorithm>
+
+#include "base/logging.h"
+
+namespace pdb {
+
+PdbMappedFileStream::PdbMappedFileStream(RefCountedMemoryMappedFile* file,
+                                         size_t length,
+                                         const uint32* pages,
+                                         size_t page_size)
+    : PdbStream(length),
+      file_(file),
+      page_size_(page_size) {
+  size_t num_pages = (length + page_size - 1) / page_size;
+  pages_.assign(pages, pages + num_pages);
+
+  // Find the end of the run of physically contiguous pages each page belongs
+  // to, working backwards so that this is linear in the number of pages.
+  run_ends_.resize(num_pages);
+  for (size_t i = num_pages; i > 0; --i) {
+    size_t page_index = i - 1;
+    if (i < num_pages && pages_[i] == pages_[page_index] + 1)
+      run_ends_[page_index] = run_ends_[i];
+    else
+      run_ends_[page_index] = static_cast<uint32>(i);
+  }
+}
+
+PdbMappedFileStream::~PdbMappedFileStream() {
+}
+
+bool PdbMappedFileStream::ReadBytes(void* dest,
+                                    size_t count,
+                                    size_t* bytes_read) {
+  DCHECK(dest != NULL);
+  DCHECK(bytes_read != NULL);
+
+  // Return 0 once we've reached the end of the stream.
+  if (pos() == length()) {
+    *bytes_read = 0;
+    return true;
+  }
+
+  // Don't read beyond the end of the known stream length.
+  count = std::min(count, length() - pos());
+  *bytes_read = count;
+
+  // Copy the stream one run of contiguous pages at a time.
+  while (count > 0) {
+    const uint8* data = NULL;
+    size_t run = GetContiguousRun(pos(), &data);
+    if (run == 0) {
+      LOG(ERROR) << "Stream page lies outside of the mapped file.";
+      return false;
+    }
+
+    size_t chunk_size = std::min(count, run);
+    ::memcpy(dest, data, chunk_size);
+
+    count -= chunk_size;
+    Seek(pos() + chunk_size);
+    dest = reinterpret_cast<uint8*>(dest) + chunk_size;
+  }
+
+  return true;
+}
+
+size_t PdbMappedFileStream::ReadDirectRun(size_t count, const uint8** data) {
+  DCHECK(data != NULL);
+
+  count = std::min(count, bytes_left());
+  if (count == 0)
+    return 0;
+
+  const uint8* run_data = NULL;
+  count = std::min(count, GetContiguousRun(pos(), &run_data));
+  if (count == 0)
+    return 0;
+
+  *data = run_data;
+  Seek(pos() + count);
+  return count;
+}
+
+size_t PdbMappedFileStream::GetContiguousRun(size_t pos,
+                                             const uint8** data) const {
+  DCHECK_LT(pos, length());
+  DCHECK(data != NULL);
+
+  size_t page_index = pos / page_size_;
+  size_t offset = pos % page_size_;
+
+  size_t file_offset = pages_[page_index] * page_size_ + offset;
+  size_t run_length =
+      (run_ends_[page_index] - page_index) * page_size_ - offset;
+  run_length = std::min(run_length, length() - pos);
+
+  if (file_offset > file_->length() ||
+      run_length > file_->length() - file_offset) {
+    return 0;
+  }
+
+  *data = file_->data() + file_offset;
+  return run_length;
+}
+
+}  // namespace pdb
@@ -0,0 +1,119 @@
+// Copyright 2015 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef SYZYGY_PDB_PDB_MAPPED_FILE_STREAM_H_
+#define SYZYGY_PDB_PDB_MAPPED_FILE_STREAM_H_
+
+#include <vector>
+
+#include "base/basictypes.h"
+#include "base/files/file_path.h"
+#include "base/files/memory_mapped_file.h"
+#include "base/memory/ref_counted.h"
+#include "syzygy/pdb/pdb_stream.h"
+
+namespace pdb {
+
+// A reference counted read-only memory mapping of a file. This allows the
+// streams created over a mapped PDB file to outlive the PdbReader that
+// created them.
+class RefCountedMemoryMappedFile
+    : public base::RefCounted<RefCountedMemoryMappedFile> {
+ public:
+  RefCountedMemoryMappedFile() { }
+
+  // Maps the file at @p path.
+  // @param path the path of the file to map.
+  // @returns true on success, false otherwise.
+  bool Initialize(const base::FilePath& path) {
+    return file_.Initialize(path);
+  }
+
+  // @name Accessors.
+  // @{
+  const uint8* data() const { return file_.data(); }
+  size_t length() const { return file_.length(); }
+  // @}
+
+ private:
+  friend base::RefCounted<RefCountedMemoryMappedFile>;
+
+  // We disallow access to the destructor to enforce the use of reference
+  // counting pointers.
+  ~RefCountedMemoryMappedFile() { }
+
+  base::MemoryMappedFile file_;
+
+  DISALLOW_COPY_AND_ASSIGN(RefCountedMemoryMappedFile);
+};
+
+// A PDB stream whose pages are served from a memory mapping of the PDB file.
+// Unlike PdbFileStream this issues no I/O calls once the file is mapped, and
+// runs of physically contiguous pages are read with a single copy, or with no
+// copy at all via ReadDirectRun.
+class PdbMappedFileStream : public PdbStream {
+ public:
+  // Constructor.
+  // @param file the reference counted mapping housing this stream.
+  // @param length the length of this stream.
+  // @param pages the indices of the pages that make up this stream in the file.
+  //     A copy is made of the data so the pointer need not remain valid
+  //     beyond the constructor. The length of this array is implicit in the
+  //     stream length and the page size.
+  // @param page_size the size of the pages, in bytes.
+  PdbMappedFileStream(RefCountedMemoryMappedFile* file,
+                      size_t length,
+                      const uint32* pages,
+                      size_t page_size);
+
+  // @name PdbStream implementation.
+  // @{
+  virtual bool ReadBytes(void* dest, size_t count, size_t* bytes_read) override;
+  virtual size_t ReadDirectRun(size_t count, const uint8** data) override;
+  // @}
+
+ protected:
+  // Protected to enforce reference counted pointers at compile time.
+  virtual ~PdbMappedFileStream();
+
+  // Gets the number of bytes, starting at stream position @p pos, that are
+  // contiguous in the mapped file.
+  // @param pos the stream position. Must be less than the stream length.
+  // @param data receives a pointer to the data at @p pos.
+  // @returns the length of the contiguous run, 0 if the page lies outside of
+  //     the mapped file.
+  size_t GetContiguousRun(size_t pos, const uint8** data) const;
+
+ private:
+  // The mapping of the PDB file. This is reference counted so the streams can
+  // outlive the PdbReader that created them.
+  scoped_refptr<RefCountedMemoryMappedFile> file_;
+
+  // The list of pages in the PDB file that make up this stream.
+  std::vector<uint32> pages_;
+
+  // For each page of the stream, the index one past the last page of the run
+  // of physically contiguous pages it belongs to. This makes finding a run
+  // constant time, rather than linear in its length.
+  std::vector<uint32> run_ends_;
+
+  // The size of pages within the stream.
+  size_t page_size_;
+
+  DISALLOW_COPY_AND_ASSIGN(PdbMappedFileStream);
+};
+
+}  // namespace pdb
+
+#endif  // SYZYGY_PDB_PDB_MAPPED_FILE_STREAM_H_
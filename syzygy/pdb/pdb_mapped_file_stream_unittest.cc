@@ -0,0 +1,135 @@
+// Copyright 2015 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "syzygy/pdb/pdb_mapped_file_stream.h"
+
+#include "gtest/gtest.h"
+#include "syzygy/core/unittest_util.h"
+#include "syzygy/pdb/pdb_data.h"
+#include "syzygy/pdb/unittest_util.h"
+
+namespace pdb {
+
+namespace {
+
+class PdbMappedFileStreamTest : public testing::Test {
+ public:
+  virtual void SetUp() {
+    file_ = new RefCountedMemoryMappedFile();
+    ASSERT_TRUE(file_->Initialize(
+        testing::GetSrcRelativePath(testing::kTestPdbFilePath)));
+  }
+
+ protected:
+  scoped_refptr<RefCountedMemoryMappedFile> file_;
+};
+
+}  // namespace
+
+TEST_F(PdbMappedFileStreamTest, Constructor) {
+  uint32 pages[] = {1, 2, 3};
+  scoped_refptr<PdbMappedFileStream> stream(
+      new PdbMappedFileStream(file_.get(), 10, pages, 8));
+  EXPECT_EQ(10, stream->length());
+}
+
+TEST_F(PdbMappedFileStreamTest, ReadBytes) {
+  // Different sections of the pdb header magic string.
+  char* test_cases[] = {
+    "Mic",
+    "roso",
+    "ft",
+    " C/C+",
+    "+ MS",
+    "F 7.00"
+  };
+
+  // Test that we can read varying sizes of bytes from the header of the
+  // file with varying page sizes.
+  char buffer[8] = {0};
+  for (size_t page_size = 4; page_size <= 32; page_size *= 2) {
+    uint32 pages[] = {0, 1, 2, 3, 4, 5, 6, 7};
+    scoped_refptr<PdbMappedFileStream> stream(new PdbMappedFileStream(
+        file_.get(), sizeof(PdbHeader), pages, page_size));
+
+    for (uint32 j = 0; j < arraysize(test_cases); ++j) {
+      char* test_case = test_cases[j];
+      size_t len = strlen(test_case);
+      size_t bytes_read = 0;
+      EXPECT_TRUE(stream->ReadBytes(&buffer, len, &bytes_read));
+      EXPECT_EQ(0, memcmp(buffer, test_case, len));
+      EXPECT_EQ(len, bytes_read);
+    }
+  }
+}
+
+TEST_F(PdbMappedFileStreamTest, ReadBytesNonContiguousPages) {
+  // Lay out "Micr" "osof" as the pages 1 and 0 of a stream.
+  uint32 pages[] = {1, 0};
+  scoped_refptr<PdbMappedFileStream> stream(
+      new PdbMappedFileStream(file_.get(), 8, pages, 4));
+
+  char buffer[8] = {0};
+  size_t bytes_read = 0;
+  EXPECT_TRUE(stream->ReadBytes(&buffer, 8, &bytes_read));
+  EXPECT_EQ(8U, bytes_read);
+  EXPECT_EQ(0, memcmp(buffer, "osofMicr", 8));
+}
+
+TEST_F(PdbMappedFileStreamTest, ReadDirectRun) {
+  // Pages 0 and 1 are contiguous, page 3 is not.
+  uint32 pages[] = {0, 1, 3};
+  scoped_refptr<PdbMappedFileStream> stream(
+      new PdbMappedFileStream(file_.get(), 11, pages, 4));
+
+  // Runs are limited by the requested count.
+  const uint8* data = NULL;
+  EXPECT_EQ(3U, stream->ReadDirectRun(3, &data));
+  EXPECT_EQ(file_->data(), data);
+  EXPECT_EQ(3U, stream->pos());
+
+  // And by the end of the contiguous pages.
+  EXPECT_EQ(5U, stream->ReadDirectRun(100, &data));
+  EXPECT_EQ(file_->data() + 3, data);
+  EXPECT_EQ(8U, stream->pos());
+
+  // And by the end of the stream.
+  EXPECT_EQ(3U, stream->ReadDirectRun(100, &data));
+  EXPECT_EQ(file_->data() + 12, data);
+  EXPECT_EQ(0U, stream->bytes_left());
+
+  EXPECT_EQ(0U, stream->ReadDirectRun(100, &data));
+}
+
+TEST_F(PdbMappedFileStreamTest, ReadDirectRunFromAnyPage) {
+  // Two runs of contiguous pages, 5-7 and 2-3.
+  uint32 pages[] = {5, 6, 7, 2, 3};
+  scoped_refptr<PdbMappedFileStream> stream(
+      new PdbMappedFileStream(file_.get(), 20, pages, 4));
+
+  // Wherever a read starts, the run extends to the end of the pages that are
+  // contiguous with it.
+  const size_t kExpectedRuns[] = {
+      12, 11, 10, 9, 8, 7, 6, 5, 4, 3, 2, 1, 8, 7, 6, 5, 4, 3, 2, 1 };
+  ASSERT_EQ(stream->length(), arraysize(kExpectedRuns));
+  for (size_t pos = 0; pos < stream->length(); ++pos) {
+    ASSERT_TRUE(stream->Seek(pos));
+    const uint8* data = NULL;
+    EXPECT_EQ(kExpectedRuns[pos], stream->ReadDirectRun(100, &data));
+    size_t page = pages[pos / 4];
+    EXPECT_EQ(file_->data() + page * 4 + pos % 4, data);
+  }
+}
+
+}  // namespace pdb
@@ -0,0 +1,177 @@
+// Copyright 2015 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "syzygy/pdb/pdb_overlay_stream.h"
+
+#include <algorithm>
+
+#include "base/logging.h"
+
+namespace pdb {
+
+PdbOverlayStream::PdbOverlayStream(PdbStream* base)
+    : PdbStream(base->length()), base_(base) {
+  DCHECK(base != NULL);
+}
+
+PdbOverlayStream::~PdbOverlayStream() {
+}
+
+bool PdbOverlayStream::ReadBytes(void* dest,
+                                 size_t count,
+                                 size_t* bytes_read) {
+  DCHECK(dest != NULL);
+  DCHECK(bytes_read != NULL);
+
+  // Don't read beyond the end of the known stream length.
+  count = std::min(count, bytes_left());
+
+  uint8* cursor = reinterpret_cast<uint8*>(dest);
+  size_t read = 0;
+  while (read < count) {
+    size_t offset = pos();
+    size_t next_offset = 0;
+    PatchMap::const_iterator patch = FindPatch(offset, &next_offset);
+    size_t run = 0;
+    if (patch != patches_.end()) {
+      run = std::min(count - read,
+                     patch->first + patch->second.size() - offset);
+      ::memcpy(cursor, &patch->second[offset - patch->first], run);
+    } else {
+      // Anything past the end of the base stream was written by a patch, so
+      // unpatched runs always lie within it.
+      run = std::min(count - read, next_offset - offset);
+      DCHECK_LE(offset + run, base_->length());
+      if (!base_->Seek(offset) || !base_->Read(cursor, run)) {
+        LOG(ERROR) << "Failed to read " << run << " bytes at offset "
+                   << offset << " of overlaid stream.";
+        *bytes_read = read;
+        return false;
+      }
+    }
+
+    cursor += run;
+    read += run;
+    Seek(offset + run);
+  }
+
+  *bytes_read = read;
+  return true;
+}
+
+size_t PdbOverlayStream::ReadDirectRun(size_t count, const uint8** data) {
+  DCHECK(data != NULL);
+
+  count = std::min(count, bytes_left());
+  if (count == 0)
+    return 0;
+
+  size_t offset = pos();
+  size_t next_offset = 0;
+  PatchMap::const_iterator patch = FindPatch(offset, &next_offset);
+  size_t run = 0;
+  if (patch != patches_.end()) {
+    run = std::min(count, patch->first + patch->second.size() - offset);
+    *data = &patch->second[offset - patch->first];
+  } else {
+    // Serve as much as the base stream can hand over directly, stopping at the
+    // next patch.
+    if (!base_->Seek(offset))
+      return 0;
+    run = base_->ReadDirectRun(std::min(count, next_offset - offset), data);
+  }
+
+  Seek(offset + run);
+  return run;
+}
+
+bool PdbOverlayStream::Patch(size_t offset, size_t count, const void* data) {
+  DCHECK(data != NULL || count == 0);
+
+  if (offset > length()) {
+    LOG(ERROR) << "Patch at offset " << offset << " is past the end of a "
+               << length() << " byte stream.";
+    return false;
+  }
+  if (count == 0)
+    return true;
+
+  const uint8* bytes = reinterpret_cast<const uint8*>(data);
+  size_t end = offset + count;
+
+  // Find the first patch that overlaps or touches the new one.
+  PatchMap::iterator first = patches_.upper_bound(offset);
+  if (first != patches_.begin()) {
+    PatchMap::iterator prev = first;
+    --prev;
+    if (prev->first + prev->second.size() >= offset)
+      first = prev;
+  }
+
+  // Find the end of the run of patches that overlap or touch the new one.
+  PatchMap::iterator last = first;
+  while (last != patches_.end() && last->first <= end)
+    ++last;
+
+  if (first == last) {
+    patches_[offset].assign(bytes, bytes + count);
+  } else {
+    // Merge the new bytes with the patches they overlap or touch, into the
+    // first of them.
+    PatchMap::iterator final_patch = last;
+    --final_patch;
+    size_t merged_offset = std::min(offset, first->first);
+    size_t merged_end = std::max(
+        end, final_patch->first + final_patch->second.size());
+
+    std::vector<uint8> merged;
+    PatchMap::iterator it = first;
+    if (first->first == merged_offset) {
+      // Grow the first patch rather than copying it.
+      merged.swap(first->second);
+      ++it;
+    }
+    merged.resize(merged_end - merged_offset);
+    for (; it != last; ++it) {
+      std::copy(it->second.begin(), it->second.end(),
+                merged.begin() + (it->first - merged_offset));
+    }
+    std::copy(bytes, bytes + count, merged.begin() + (offset - merged_offset));
+
+    patches_.erase(first, last);
+    patches_[merged_offset].swap(merged);
+  }
+
+  if (end > length())
+    set_length(end);
+
+  return true;
+}
+
+PdbOverlayStream::PatchMap::const_iterator PdbOverlayStream::FindPatch(
+    size_t offset, size_t* next_offset) const {
+  PatchMap::const_iterator next = patches_.upper_bound(offset);
+  if (next_offset != NULL)
+    *next_offset = next == patches_.end() ? length() : next->first;
+
+  if (next == patches_.begin())
+    return patches_.end();
+  PatchMap::const_iterator patch = next;
+  --patch;
+  if (offset >= patch->first + patch->second.size())
+    return patches_.end();
+  return patch;
+}
+
+}  // namespace pdb
@@ -0,0 +1,78 @@
+// Copyright 2015 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// Declares PdbOverlayStream, a copy-on-write view of a read-only PDB stream.
+// Mutations that only touch a few bytes of a large stream (the DBI header,
+// for instance) record them as patches over the original stream, rather than
+// copying the whole stream into memory to make it writable.
+
+#ifndef SYZYGY_PDB_PDB_OVERLAY_STREAM_H_
+#define SYZYGY_PDB_PDB_OVERLAY_STREAM_H_
+
+#include <map>
+#include <vector>
+
+#include "syzygy/pdb/pdb_stream.h"
+
+namespace pdb {
+
+// A PDB stream that reads through to a base stream, except for the byte
+// ranges that have been patched. The base stream is never modified.
+class PdbOverlayStream : public PdbStream {
+ public:
+  // Constructor.
+  // @param base the stream to read unpatched bytes from.
+  explicit PdbOverlayStream(PdbStream* base);
+
+  // @name PdbStream implementation.
+  // @{
+  virtual bool ReadBytes(void* dest, size_t count, size_t* bytes_read) override;
+  virtual size_t ReadDirectRun(size_t count, const uint8** data) override;
+  virtual bool Patch(size_t offset, size_t count, const void* data) override;
+  // @}
+
+  // @returns the stream this overlays.
+  PdbStream* base() const { return base_.get(); }
+
+  // @returns the number of disjoint patched byte ranges. Overlapping and
+  //     adjacent patches are merged.
+  size_t patch_count() const { return patches_.size(); }
+
+ protected:
+  // This is protected to enforce use of reference counted pointers.
+  virtual ~PdbOverlayStream();
+
+  // Patched bytes, keyed by their offset in the stream.
+  typedef std::map<size_t, std::vector<uint8>> PatchMap;
+
+  // Finds the patch containing @p offset.
+  // @param offset the offset to look up.
+  // @param next_offset receives the offset of the first patch past @p offset,
+  //     or the length of the stream if there is none. May be NULL.
+  // @returns the patch containing @p offset, or patches_.end() if the byte at
+  //     @p offset is unpatched.
+  PatchMap::const_iterator FindPatch(size_t offset, size_t* next_offset) const;
+
+  // The stream being overlaid.
+  scoped_refptr<PdbStream> base_;
+
+  // The patches. These are kept disjoint and non-adjacent.
+  PatchMap patches_;
+
+  DISALLOW_COPY_AND_ASSIGN(PdbOverlayStream);
+};
+
+}  // namespace pdb
+
+#endif  // SYZYGY_PDB_PDB_OVERLAY_STREAM_H_
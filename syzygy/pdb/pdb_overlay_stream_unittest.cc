@@ -0,0 +1,187 @@
+// Copyright 2015 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "syzygy/pdb/pdb_overlay_stream.h"
+
+#include <algorithm>
+
+#include "gtest/gtest.h"
+#include "syzygy/pdb/pdb_byte_stream.h"
+
+namespace pdb {
+
+namespace {
+
+class PdbOverlayStreamTest : public testing::Test {
+ public:
+  virtual void SetUp() override {
+    for (size_t i = 0; i < arraysize(base_data_); ++i)
+      base_data_[i] = static_cast<uint8>(i);
+    base_ = new PdbByteStream();
+    ASSERT_TRUE(base_->Init(base_data_, arraysize(base_data_)));
+    stream_ = new PdbOverlayStream(base_.get());
+
+    expected_.assign(base_data_, base_data_ + arraysize(base_data_));
+  }
+
+  // Patches both the overlay and the expected contents.
+  bool Patch(size_t offset, size_t count, uint8 value) {
+    std::vector<uint8> bytes(count, value);
+    if (!stream_->Patch(offset, count, bytes.data()))
+      return false;
+    if (offset + count > expected_.size())
+      expected_.resize(offset + count);
+    std::copy(bytes.begin(), bytes.end(), expected_.begin() + offset);
+    return true;
+  }
+
+  // Reads the whole overlay, with ReadBytes calls of the given size.
+  void ReadAll(size_t chunk_size, std::vector<uint8>* contents) {
+    ASSERT_TRUE(stream_->Seek(0));
+    contents->resize(stream_->length());
+    size_t offset = 0;
+    while (offset < contents->size()) {
+      size_t bytes_read = 0;
+      size_t count = std::min(chunk_size, contents->size() - offset);
+      ASSERT_TRUE(stream_->ReadBytes(&contents->at(offset), count,
+                                     &bytes_read));
+      ASSERT_EQ(count, bytes_read);
+      offset += bytes_read;
+    }
+  }
+
+ protected:
+  uint8 base_data_[64];
+  scoped_refptr<PdbByteStream> base_;
+  scoped_refptr<PdbOverlayStream> stream_;
+  std::vector<uint8> expected_;
+};
+
+}  // namespace
+
+TEST_F(PdbOverlayStreamTest, Constructor) {
+  EXPECT_EQ(base_.get(), stream_->base());
+  EXPECT_EQ(base_->length(), stream_->length());
+  EXPECT_EQ(0u, stream_->pos());
+  EXPECT_EQ(0u, stream_->patch_count());
+  EXPECT_TRUE(stream_->GetWritablePdbStream() == NULL);
+}
+
+TEST_F(PdbOverlayStreamTest, ReadsThroughWithoutPatches) {
+  std::vector<uint8> contents;
+  ASSERT_NO_FATAL_FAILURE(ReadAll(7, &contents));
+  EXPECT_EQ(expected_, contents);
+
+  // Reading at the end of the stream succeeds, but reads nothing.
+  size_t bytes_read = 1;
+  uint8 byte = 0;
+  EXPECT_TRUE(stream_->ReadBytes(&byte, 1, &bytes_read));
+  EXPECT_EQ(0u, bytes_read);
+}
+
+TEST_F(PdbOverlayStreamTest, PatchDoesNotModifyBase) {
+  EXPECT_TRUE(Patch(10, 4, 0xAA));
+  EXPECT_TRUE(Patch(60, 4, 0xBB));
+  EXPECT_EQ(2u, stream_->patch_count());
+  EXPECT_EQ(arraysize(base_data_), stream_->length());
+
+  std::vector<uint8> contents;
+  for (size_t chunk_size = 1; chunk_size <= 64; ++chunk_size) {
+    ASSERT_NO_FATAL_FAILURE(ReadAll(chunk_size, &contents));
+    EXPECT_EQ(expected_, contents);
+  }
+
+  EXPECT_EQ(0, ::memcmp(base_->data(), base_data_, arraysize(base_data_)));
+}
+
+TEST_F(PdbOverlayStreamTest, PatchLeavesReadPosition) {
+  ASSERT_TRUE(stream_->Seek(5));
+  EXPECT_TRUE(Patch(0, 8, 0xAA));
+  EXPECT_EQ(5u, stream_->pos());
+
+  uint8 byte = 0;
+  EXPECT_TRUE(stream_->Read(&byte, 1));
+  EXPECT_EQ(0xAA, byte);
+}
+
+TEST_F(PdbOverlayStreamTest, PatchesAreMerged) {
+  EXPECT_TRUE(Patch(10, 4, 0xAA));
+  EXPECT_TRUE(Patch(20, 4, 0xBB));
+  EXPECT_TRUE(Patch(30, 4, 0xCC));
+  EXPECT_EQ(3u, stream_->patch_count());
+
+  // Adjacent patches are merged.
+  EXPECT_TRUE(Patch(14, 2, 0xDD));
+  EXPECT_EQ(3u, stream_->patch_count());
+  EXPECT_TRUE(Patch(8, 2, 0xDD));
+  EXPECT_EQ(3u, stream_->patch_count());
+
+  // A patch within another one is merged.
+  EXPECT_TRUE(Patch(11, 1, 0xEE));
+  EXPECT_EQ(3u, stream_->patch_count());
+
+  // A patch spanning several others swallows them.
+  EXPECT_TRUE(Patch(12, 20, 0xFF));
+  EXPECT_EQ(1u, stream_->patch_count());
+
+  std::vector<uint8> contents;
+  ASSERT_NO_FATAL_FAILURE(ReadAll(5, &contents));
+  EXPECT_EQ(expected_, contents);
+}
+
+TEST_F(PdbOverlayStreamTest, PatchExtendsStream) {
+  EXPECT_TRUE(Patch(60, 10, 0xAA));
+  EXPECT_EQ(70u, stream_->length());
+  EXPECT_TRUE(Patch(70, 2, 0xBB));
+  EXPECT_EQ(72u, stream_->length());
+  EXPECT_EQ(1u, stream_->patch_count());
+  EXPECT_EQ(arraysize(base_data_), base_->length());
+
+  std::vector<uint8> contents;
+  ASSERT_NO_FATAL_FAILURE(ReadAll(3, &contents));
+  EXPECT_EQ(expected_, contents);
+}
+
+TEST_F(PdbOverlayStreamTest, PatchFailsPastEnd) {
+  uint8 byte = 0;
+  EXPECT_FALSE(stream_->Patch(65, 1, &byte));
+  EXPECT_EQ(arraysize(base_data_), stream_->length());
+  EXPECT_EQ(0u, stream_->patch_count());
+
+  // Empty patches are fine, as long as they're within the stream.
+  EXPECT_TRUE(stream_->Patch(64, 0, &byte));
+  EXPECT_EQ(0u, stream_->patch_count());
+}
+
+TEST_F(PdbOverlayStreamTest, ReadDirectRun) {
+  EXPECT_TRUE(Patch(16, 8, 0xAA));
+
+  // Unpatched runs come straight from the base stream, and stop at patches.
+  const uint8* data = NULL;
+  EXPECT_EQ(16u, stream_->ReadDirectRun(100, &data));
+  EXPECT_EQ(base_->data(), data);
+
+  // Patched runs come from the patch.
+  EXPECT_EQ(4u, stream_->ReadDirectRun(4, &data));
+  EXPECT_EQ(0xAA, data[0]);
+  EXPECT_EQ(4u, stream_->ReadDirectRun(100, &data));
+  EXPECT_EQ(0xAA, data[3]);
+
+  EXPECT_EQ(40u, stream_->ReadDirectRun(100, &data));
+  EXPECT_EQ(base_->data() + 24, data);
+  EXPECT_EQ(0u, stream_->ReadDirectRun(100, &data));
+  EXPECT_EQ(stream_->length(), stream_->pos());
+}
+
+}  // namespace pdb
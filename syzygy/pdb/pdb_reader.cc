@@ -17,6 +17,7 @@
 #include "base/logging.h"
 #include "base/strings/string_util.h"
 #include "syzygy/pdb/pdb_file_stream.h"
+#include "syzygy/pdb/pdb_mapped_file_stream.h"
 
 namespace pdb {
 
@@ -46,6 +47,21 @@ uint32 GetNumPages(const PdbHeader& header, uint32 num_bytes) {
   return (num_bytes + header.page_size - 1) / header.page_size;
 }
 
+// Creates a stream over the given pages of the PDB file. Exactly one of
+// @p file and @p mapped_file must be non-NULL, and determines the type of the
+// stream.
+PdbStream* CreateStream(RefCountedFILE* file,
+                        RefCountedMemoryMappedFile* mapped_file,
+                        size_t length,
+                        const uint32* pages,
+                        size_t page_size) {
+  DCHECK_NE(file == NULL, mapped_file == NULL);
+
+  if (mapped_file != NULL)
+    return new PdbMappedFileStream(mapped_file, length, pages, page_size);
+  return new PdbFileStream(file, length, pages, page_size);
+}
+
 }  // namespace
 
 bool PdbReader::Read(const base::FilePath& pdb_path, PdbFile* pdb_file) {
@@ -53,18 +69,29 @@ bool PdbReader::Read(const base::FilePath& pdb_path, PdbFile* pdb_file) {
 
   pdb_file->Clear();
 
-  scoped_refptr<RefCountedFILE> file(new RefCountedFILE(
-      base::OpenFile(pdb_path, "rb")));
-  if (!file->file()) {
-    LOG(ERROR) << "Unable to open '" << pdb_path.value() << "'.";
-    return false;
-  }
-
-  // Get the file size.
+  scoped_refptr<RefCountedFILE> file;
+  scoped_refptr<RefCountedMemoryMappedFile> mapped_file;
   uint32 file_size = 0;
-  if (!GetFileSize(file->file(), &file_size)) {
-    LOG(ERROR) << "Unable to determine size of '" << pdb_path.value() << "'.";
-    return false;
+  if (use_memory_mapping_) {
+    mapped_file = new RefCountedMemoryMappedFile();
+    if (!mapped_file->Initialize(pdb_path)) {
+      LOG(ERROR) << "Unable to map '" << pdb_path.value() << "'.";
+      return false;
+    }
+    file_size = static_cast<uint32>(mapped_file->length());
+  } else {
+    file = new RefCountedFILE(base::OpenFile(pdb_path, "rb"));
+    if (!file->file()) {
+      LOG(ERROR) << "Unable to open '" << pdb_path.value() << "'.";
+      return false;
+    }
+
+    // Get the file size.
+    if (!GetFileSize(file->file(), &file_size)) {
+      LOG(ERROR) << "Unable to determine size of '" << pdb_path.value()
+                 << "'.";
+      return false;
+    }
   }
 
   PdbHeader header = { 0 };
@@ -73,8 +100,9 @@ bool PdbReader::Read(const base::FilePath& pdb_path, PdbFile* pdb_file) {
   // is irrelevant as after reading the header we get the actual page size in
   // use by the PDB and from then on use that.
   uint32 header_page = 0;
-  scoped_refptr<PdbFileStream> header_stream(new PdbFileStream(
-      file.get(), sizeof(header), &header_page, kPdbPageSize));
+  scoped_refptr<PdbStream> header_stream(CreateStream(
+      file.get(), mapped_file.get(), sizeof(header), &header_page,
+      kPdbPageSize));
   if (!header_stream->Read(&header, 1)) {
     LOG(ERROR) << "Failed to read PDB file header.";
     return false;
@@ -98,9 +126,10 @@ bool PdbReader::Read(const base::FilePath& pdb_path, PdbFile* pdb_file) {
   // containing that many page pointers from the root pages array.
   int num_dir_pages = static_cast<int>(GetNumPages(header,
                                                    header.directory_size));
-  scoped_refptr<PdbFileStream> dir_page_stream(
-      new PdbFileStream(file.get(), num_dir_pages * sizeof(uint32),
-                        header.root_pages, header.page_size));
+  scoped_refptr<PdbStream> dir_page_stream(
+      CreateStream(file.get(), mapped_file.get(),
+                   num_dir_pages * sizeof(uint32), header.root_pages,
+                   header.page_size));
   scoped_ptr<uint32[]> dir_pages(new uint32[num_dir_pages]);
   if (dir_pages.get() == NULL) {
     LOG(ERROR) << "Failed to allocate directory pages.";
@@ -113,8 +142,9 @@ bool PdbReader::Read(const base::FilePath& pdb_path, PdbFile* pdb_file) {
 
   // Load the actual directory.
   int dir_size = static_cast<int>(header.directory_size / sizeof(uint32));
-  scoped_refptr<PdbFileStream> dir_stream(new PdbFileStream(
-      file.get(), header.directory_size, dir_pages.get(), header.page_size));
+  scoped_refptr<PdbStream> dir_stream(CreateStream(
+      file.get(), mapped_file.get(), header.directory_size, dir_pages.get(),
+      header.page_size));
   std::vector<uint32> directory(dir_size);
   if (!dir_stream->Read(&directory[0], dir_size)) {
     LOG(ERROR) << "Failed to read directory stream.";
@@ -129,8 +159,9 @@ bool PdbReader::Read(const base::FilePath& pdb_path, PdbFile* pdb_file) {
   uint32 page_index = 0;
   for (uint32 stream_index = 0; stream_index < num_streams; ++stream_index) {
     pdb_file->AppendStream(
-        new PdbFileStream(file.get(), stream_lengths[stream_index],
-                          stream_pages + page_index, header.page_size));
+        CreateStream(file.get(), mapped_file.get(),
+                     stream_lengths[stream_index], stream_pages + page_index,
+                     header.page_size));
     page_index += GetNumPages(header, stream_lengths[stream_index]);
   }
 
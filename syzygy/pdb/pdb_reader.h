@@ -23,6 +23,7 @@
 #include "syzygy/pdb/pdb_data.h"
 #include "syzygy/pdb/pdb_file.h"
 #include "syzygy/pdb/pdb_file_stream.h"
+#include "syzygy/pdb/pdb_mapped_file_stream.h"
 #include "syzygy/pdb/pdb_stream.h"
 
 namespace pdb {
@@ -31,7 +32,7 @@ namespace pdb {
 // object with its streams.
 class PdbReader {
  public:
-  PdbReader() { }
+  PdbReader() : use_memory_mapping_(false) { }
 
   // Reads a PDB, populating the given PdbFile object with the streams.
   //
@@ -43,7 +44,20 @@ class PdbReader {
   // @returns true on success, false otherwise.
   bool Read(const base::FilePath& pdb_path, PdbFile* pdb_file);
 
+  // @name Accessors and mutators.
+  // @{
+  // If true, the PDB file is memory mapped and its streams are served as
+  // PdbMappedFileStreams. Otherwise, they are read through a shared FILE as
+  // PdbFileStreams. Defaults to false.
+  bool use_memory_mapping() const { return use_memory_mapping_; }
+  void set_use_memory_mapping(bool use_memory_mapping) {
+    use_memory_mapping_ = use_memory_mapping;
+  }
+  // @}
+
  private:
+  bool use_memory_mapping_;
+
   DISALLOW_COPY_AND_ASSIGN(PdbReader);
 };
 
@@ -14,6 +14,8 @@
 
 #include "syzygy/pdb/pdb_reader.h"
 
+#include <vector>
+
 #include "base/path_service.h"
 #include "gtest/gtest.h"
 #include "syzygy/core/unittest_util.h"
@@ -32,4 +34,39 @@ TEST(PdbReaderTest, Read) {
   EXPECT_EQ(pdb_file.StreamCount(), 168u);
 }
 
+TEST(PdbReaderTest, ReadMemoryMapped) {
+  base::FilePath test_dll_pdb =
+      testing::GetSrcRelativePath(testing::kTestPdbFilePath);
+
+  PdbReader reader;
+  PdbFile pdb_file;
+  EXPECT_TRUE(reader.Read(test_dll_pdb, &pdb_file));
+
+  PdbReader mapped_reader;
+  EXPECT_FALSE(mapped_reader.use_memory_mapping());
+  mapped_reader.set_use_memory_mapping(true);
+  EXPECT_TRUE(mapped_reader.use_memory_mapping());
+  PdbFile mapped_pdb_file;
+  EXPECT_TRUE(mapped_reader.Read(test_dll_pdb, &mapped_pdb_file));
+  ASSERT_EQ(pdb_file.StreamCount(), mapped_pdb_file.StreamCount());
+
+  // Both readers should produce identical streams.
+  for (size_t i = 0; i < pdb_file.StreamCount(); ++i) {
+    scoped_refptr<PdbStream> stream = pdb_file.GetStream(i);
+    scoped_refptr<PdbStream> mapped_stream = mapped_pdb_file.GetStream(i);
+    if (stream.get() == NULL) {
+      EXPECT_TRUE(mapped_stream.get() == NULL);
+      continue;
+    }
+    ASSERT_TRUE(mapped_stream.get() != NULL);
+    ASSERT_EQ(stream->length(), mapped_stream->length());
+
+    std::vector<uint8> data;
+    std::vector<uint8> mapped_data;
+    EXPECT_TRUE(stream->Read(&data, stream->length()));
+    EXPECT_TRUE(mapped_stream->Read(&mapped_data, mapped_stream->length()));
+    EXPECT_EQ(data, mapped_data);
+  }
+}
+
 }  // namespace pdb
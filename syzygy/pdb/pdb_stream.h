@@ -95,6 +95,34 @@ class PdbStream : public base::RefCounted<PdbStream> {
   // @returns true if all @p count bytes are read, false otherwise.
   virtual bool ReadBytes(void* dest, size_t count, size_t* bytes_read) = 0;
 
+  // Gets a pointer to the bytes following the read position, if the stream is
+  // able to serve them from memory without copying, and advances the read
+  // position past them. Fewer than @p count bytes may be served when the
+  // stream isn't contiguous in memory, so callers should call this repeatedly
+  // and fall back to ReadBytes when it returns 0.
+  //
+  // @param count the maximum number of bytes to read.
+  // @param data on success, receives a pointer to the bytes. It remains valid
+  //     until the stream is modified or destroyed.
+  // @returns the number of bytes served, 0 if the stream is unable to serve
+  //     any directly or is at its end.
+  virtual size_t ReadDirectRun(size_t count, const uint8** data) {
+    return 0;
+  }
+
+  // Overwrites @p count bytes at @p offset with @p data, if the underlying
+  // object is able to record patches without a WritablePdbStream (see
+  // PdbOverlayStream). The read position is left unchanged. A patch may extend
+  // the stream, but may not start past its end.
+  //
+  // @param offset the offset of the bytes to overwrite.
+  // @param count the number of bytes to overwrite.
+  // @param data the new bytes.
+  // @returns true on success, false if the stream can't be patched.
+  virtual bool Patch(size_t offset, size_t count, const void* data) {
+    return false;
+  }
+
   // Returns a pointer to a WritablePdbStream if the underlying object supports
   // this interface. If this returns non-NULL, it is up to the user to ensure
   // thread safety; each writer should be used exclusively of any other writer,
@@ -14,13 +14,356 @@
 
 #include "syzygy/pdb/pdb_type_info_stream.h"
 
+#include <string>
+
 #include "base/strings/stringprintf.h"
 #include "syzygy/common/align.h"
+#include "syzygy/pdb/pdb_constants.h"
 #include "syzygy/pdb/pdb_stream.h"
 #include "syzygy/pdb/pdb_util.h"
+#include "third_party/cci/Files/CvInfo.h"
+
+namespace cci = Microsoft_Cci_Pdb;
 
 namespace pdb {
 
+namespace {
+
+// Types referring to other types are followed at most this deep.
+const size_t kMaxTypeDepth = 32;
+
+// The bits of a pointer attribute holding the size of the pointer.
+const size_t kPointerSizeShift = 13;
+const uint32 kPointerSizeMask = 0x3F;
+
+// The property of user defined types whose records are followed by their
+// decorated name. This is missing from CvInfo.h.
+const uint16 kHasUniqueNameProperty = 0x0200;
+
+// The names of a user defined type. The kind of the type is part of them, as
+// a forward reference can only refer to a type of the same kind.
+struct UserDefinedTypeName {
+  uint16 kind;
+  std::string name;
+
+  bool operator<(const UserDefinedTypeName& other) const {
+    if (kind != other.kind)
+      return kind < other.kind;
+    return name < other.name;
+  }
+};
+
+typedef std::map<UserDefinedTypeName, uint32> UserDefinedTypeMap;
+
+size_t GetPrimitiveTypeSize(uint32 type_index) {
+  // The mode bits indicate a pointer to the primitive type.
+  switch ((type_index >> 8) & 0x7) {
+    case cci::CV_TM_DIRECT:
+      break;
+    case cci::CV_TM_NPTR32:
+      return 4;
+    case cci::CV_TM_NPTR64:
+      return 8;
+    case cci::CV_TM_NPTR128:
+      return 16;
+    default:
+      // 16-bit near, far and huge pointers.
+      return 4;
+  }
+
+  switch (type_index & 0xFF) {
+    case cci::T_CHAR:
+    case cci::T_UCHAR:
+    case cci::T_RCHAR:
+    case cci::T_INT1:
+    case cci::T_UINT1:
+    case cci::T_BOOL08:
+      return 1;
+    case cci::T_SHORT:
+    case cci::T_USHORT:
+    case cci::T_WCHAR:
+    case cci::T_INT2:
+    case cci::T_UINT2:
+    case cci::T_BOOL16:
+      return 2;
+    case cci::T_HRESULT:
+    case cci::T_LONG:
+    case cci::T_ULONG:
+    case cci::T_INT4:
+    case cci::T_UINT4:
+    case cci::T_BOOL32:
+    case cci::T_REAL32:
+      return 4;
+    case cci::T_CURRENCY:
+    case cci::T_QUAD:
+    case cci::T_UQUAD:
+    case cci::T_INT8:
+    case cci::T_UINT8:
+    case cci::T_BOOL64:
+    case cci::T_REAL64:
+    case cci::T_CPLX32:
+      return 8;
+    case cci::T_REAL80:
+      return 10;
+    case cci::T_OCT:
+    case cci::T_UOCT:
+    case cci::T_INT16:
+    case cci::T_UINT16:
+    case cci::T_REAL128:
+    case cci::T_CPLX64:
+      return 16;
+    case cci::T_CPLX80:
+      return 20;
+    case cci::T_CPLX128:
+      return 32;
+    default:
+      // This covers void and the types without storage.
+      return 0;
+  }
+}
+
+// Reads a numeric leaf, as found in the type records of aggregates.
+bool ReadNumericLeaf(PdbStream* stream, size_t* value) {
+  DCHECK(stream != NULL);
+  DCHECK(value != NULL);
+
+  uint16 leaf = 0;
+  if (!stream->Read(&leaf, 1))
+    return false;
+
+  // Small values are stored directly in the leaf.
+  if (leaf < cci::LF_NUMERIC) {
+    *value = leaf;
+    return true;
+  }
+
+  switch (leaf) {
+    case cci::LF_CHAR: {
+      int8 data = 0;
+      if (!stream->Read(&data, 1))
+        return false;
+      *value = data;
+      return true;
+    }
+    case cci::LF_SHORT:
+    case cci::LF_USHORT: {
+      uint16 data = 0;
+      if (!stream->Read(&data, 1))
+        return false;
+      *value = data;
+      return true;
+    }
+    case cci::LF_LONG:
+    case cci::LF_ULONG: {
+      uint32 data = 0;
+      if (!stream->Read(&data, 1))
+        return false;
+      *value = data;
+      return true;
+    }
+    case cci::LF_QUADWORD:
+    case cci::LF_UQUADWORD: {
+      uint64 data = 0;
+      if (!stream->Read(&data, 1))
+        return false;
+      *value = static_cast<size_t>(data);
+      return true;
+    }
+    default:
+      LOG(ERROR) << "Unexpected numeric leaf type 0x" << std::hex << leaf
+                 << std::dec << ".";
+      return false;
+  }
+}
+
+// Reads the property and the names of a class, structure, union or enum
+// record. @p unique_name is left empty if the type has no decorated name.
+bool ReadUserDefinedType(PdbStream* stream,
+                         const TypeInfoRecord& record,
+                         uint16* property,
+                         std::string* name,
+                         std::string* unique_name) {
+  DCHECK(stream != NULL);
+  DCHECK(property != NULL);
+  DCHECK(name != NULL);
+  DCHECK(unique_name != NULL);
+
+  if (!stream->Seek(record.start_position))
+    return false;
+
+  uint16 count = 0;
+  if (!stream->Read(&count, 1) || !stream->Read(property, 1))
+    return false;
+
+  size_t size = 0;
+  switch (record.type) {
+    case cci::LF_CLASS:
+    case cci::LF_STRUCTURE: {
+      uint32 types[3] = {};
+      if (!stream->Read(types, arraysize(types)) ||
+          !ReadNumericLeaf(stream, &size)) {
+        return false;
+      }
+      break;
+    }
+
+    case cci::LF_UNION: {
+      uint32 field_type = 0;
+      if (!stream->Read(&field_type, 1) || !ReadNumericLeaf(stream, &size))
+        return false;
+      break;
+    }
+
+    case cci::LF_ENUM: {
+      uint32 types[2] = {};
+      if (!stream->Read(types, arraysize(types)))
+        return false;
+      break;
+    }
+
+    default:
+      NOTREACHED();
+      return false;
+  }
+
+  if (!ReadString(stream, name))
+    return false;
+  unique_name->clear();
+  if ((*property & kHasUniqueNameProperty) != 0 &&
+      !ReadString(stream, unique_name)) {
+    return false;
+  }
+
+  return stream->pos() <= record.start_position + record.len;
+}
+
+bool GetTypeSizeImpl(PdbStream* stream,
+                     const TypeInfoRecordMap& type_info_record_map,
+                     const TypeDefinitionMap* type_definitions,
+                     uint32 type_index,
+                     size_t depth,
+                     size_t* size) {
+  DCHECK(stream != NULL);
+  DCHECK(size != NULL);
+
+  if (type_index < kTpiStreamFirstUserTypeIndex) {
+    *size = GetPrimitiveTypeSize(type_index);
+    return true;
+  }
+
+  if (depth > kMaxTypeDepth) {
+    LOG(ERROR) << "Type 0x" << std::hex << type_index << std::dec
+               << " is nested too deeply.";
+    return false;
+  }
+
+  // Forward references have no size of their own, so look through them to
+  // their definition when it's known.
+  if (type_definitions != NULL) {
+    TypeDefinitionMap::const_iterator definition =
+        type_definitions->find(type_index);
+    if (definition != type_definitions->end()) {
+      return GetTypeSizeImpl(stream, type_info_record_map, type_definitions,
+                             definition->second, depth + 1, size);
+    }
+  }
+
+  TypeInfoRecordMap::const_iterator it = type_info_record_map.find(type_index);
+  if (it == type_info_record_map.end()) {
+    LOG(ERROR) << "Unknown type 0x" << std::hex << type_index << std::dec
+               << ".";
+    return false;
+  }
+
+  if (!stream->Seek(it->second.start_position)) {
+    LOG(ERROR) << "Unable to seek to type 0x" << std::hex << type_index
+               << std::dec << ".";
+    return false;
+  }
+
+  *size = 0;
+  bool read = true;
+  switch (it->second.type) {
+    case cci::LF_MODIFIER: {
+      uint32 modified_type = 0;
+      read = stream->Read(&modified_type, 1);
+      if (!read)
+        break;
+      return GetTypeSizeImpl(stream, type_info_record_map, type_definitions,
+                             modified_type, depth + 1, size);
+    }
+
+    case cci::LF_POINTER: {
+      uint32 pointee_type = 0;
+      uint32 attributes = 0;
+      read = stream->Read(&pointee_type, 1) && stream->Read(&attributes, 1);
+      if (!read)
+        break;
+      // Recent toolchains store the size of the pointer in the attributes.
+      *size = (attributes >> kPointerSizeShift) & kPointerSizeMask;
+      if (*size == 0)
+        *size = (attributes & cci::ptrtype) == cci::CV_PTR_64 ? 8 : 4;
+      break;
+    }
+
+    case cci::LF_ARRAY: {
+      uint32 types[2] = {};
+      read = stream->Read(types, arraysize(types)) &&
+          ReadNumericLeaf(stream, size);
+      break;
+    }
+
+    case cci::LF_CLASS:
+    case cci::LF_STRUCTURE: {
+      uint16 count = 0;
+      uint16 property = 0;
+      uint32 types[3] = {};
+      read = stream->Read(&count, 1) && stream->Read(&property, 1) &&
+          stream->Read(types, arraysize(types));
+      if (read && (property & cci::fwdref) == 0)
+        read = ReadNumericLeaf(stream, size);
+      break;
+    }
+
+    case cci::LF_UNION: {
+      uint16 count = 0;
+      uint16 property = 0;
+      uint32 field_type = 0;
+      read = stream->Read(&count, 1) && stream->Read(&property, 1) &&
+          stream->Read(&field_type, 1);
+      if (read && (property & cci::fwdref) == 0)
+        read = ReadNumericLeaf(stream, size);
+      break;
+    }
+
+    case cci::LF_ENUM: {
+      uint16 count = 0;
+      uint16 property = 0;
+      uint32 underlying_type = 0;
+      read = stream->Read(&count, 1) && stream->Read(&property, 1) &&
+          stream->Read(&underlying_type, 1);
+      if (!read || (property & cci::fwdref) != 0)
+        break;
+      return GetTypeSizeImpl(stream, type_info_record_map, type_definitions,
+                             underlying_type, depth + 1, size);
+    }
+
+    default:
+      // Procedures, argument and field lists and the like have no storage.
+      break;
+  }
+
+  if (!read) {
+    LOG(ERROR) << "Unable to read type 0x" << std::hex << type_index
+               << std::dec << ".";
+    return false;
+  }
+
+  return true;
+}
+
+}  // namespace
+
 bool ReadTypeInfoStream(PdbStream* stream,
                         TypeInfoHeader* type_info_header,
                         TypeInfoRecordMap* type_info_record_map) {
@@ -89,4 +432,99 @@ bool ReadTypeInfoStream(PdbStream* stream,
   return true;
 }
 
+bool GetTypeDefinitions(PdbStream* stream,
+                        const TypeInfoRecordMap& type_info_record_map,
+                        TypeDefinitionMap* type_definitions) {
+  DCHECK(stream != NULL);
+  DCHECK(type_definitions != NULL);
+
+  // The definitions by decorated name and by name. The first definition of a
+  // name wins.
+  UserDefinedTypeMap definitions_by_unique_name;
+  UserDefinedTypeMap definitions_by_name;
+
+  // The forward references, and their names.
+  struct ForwardReference {
+    uint32 type_index;
+    UserDefinedTypeName unique_name;
+    UserDefinedTypeName name;
+  };
+  std::vector<ForwardReference> forward_references;
+
+  TypeInfoRecordMap::const_iterator it = type_info_record_map.begin();
+  for (; it != type_info_record_map.end(); ++it) {
+    const TypeInfoRecord& record = it->second;
+    if (record.type != cci::LF_CLASS && record.type != cci::LF_STRUCTURE &&
+        record.type != cci::LF_UNION && record.type != cci::LF_ENUM) {
+      continue;
+    }
+
+    uint16 property = 0;
+    UserDefinedTypeName name;
+    UserDefinedTypeName unique_name;
+    if (!ReadUserDefinedType(stream, record, &property, &name.name,
+                             &unique_name.name)) {
+      LOG(ERROR) << "Unable to read type 0x" << std::hex << it->first
+                 << std::dec << ".";
+      return false;
+    }
+
+    // Classes and structures can be declared with either keyword.
+    name.kind = record.type == cci::LF_CLASS ?
+        static_cast<uint16>(cci::LF_STRUCTURE) : record.type;
+    unique_name.kind = name.kind;
+
+    if ((property & cci::fwdref) != 0) {
+      ForwardReference forward_reference = { it->first, unique_name, name };
+      forward_references.push_back(forward_reference);
+      continue;
+    }
+
+    if (!unique_name.name.empty())
+      definitions_by_unique_name.insert(std::make_pair(unique_name, it->first));
+    definitions_by_name.insert(std::make_pair(name, it->first));
+  }
+
+  for (size_t i = 0; i < forward_references.size(); ++i) {
+    const ForwardReference& forward_reference = forward_references[i];
+    UserDefinedTypeMap::const_iterator definition =
+        definitions_by_unique_name.end();
+    if (!forward_reference.unique_name.name.empty()) {
+      definition =
+          definitions_by_unique_name.find(forward_reference.unique_name);
+    }
+    if (definition == definitions_by_unique_name.end()) {
+      definition = definitions_by_name.find(forward_reference.name);
+      if (definition == definitions_by_name.end())
+        continue;
+    }
+    (*type_definitions)[forward_reference.type_index] = definition->second;
+  }
+
+  return true;
+}
+
+bool GetTypeSize(PdbStream* stream,
+                 const TypeInfoRecordMap& type_info_record_map,
+                 uint32 type_index,
+                 size_t* size) {
+  DCHECK(stream != NULL);
+  DCHECK(size != NULL);
+
+  return GetTypeSizeImpl(stream, type_info_record_map, NULL, type_index, 0,
+                         size);
+}
+
+bool GetTypeSize(PdbStream* stream,
+                 const TypeInfoRecordMap& type_info_record_map,
+                 const TypeDefinitionMap& type_definitions,
+                 uint32 type_index,
+                 size_t* size) {
+  DCHECK(stream != NULL);
+  DCHECK(size != NULL);
+
+  return GetTypeSizeImpl(stream, type_info_record_map, &type_definitions,
+                         type_index, 0, size);
+}
+
 }  // namespace pdb
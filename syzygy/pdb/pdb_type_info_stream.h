@@ -17,6 +17,7 @@
 #ifndef SYZYGY_PDB_PDB_TYPE_INFO_STREAM_H_
 #define SYZYGY_PDB_PDB_TYPE_INFO_STREAM_H_
 
+#include <map>
 #include <vector>
 
 #include "base/basictypes.h"
@@ -28,11 +29,60 @@ namespace pdb {
 // Forward declarations.
 class PdbStream;
 
+// Maps the indices of forward references to user defined types to the indices
+// of their definitions.
+typedef std::map<uint32, uint32> TypeDefinitionMap;
+
 // Read @p type_info_header and @p type_info_record_map from @p stream.
 bool ReadTypeInfoStream(PdbStream* stream,
                         TypeInfoHeader* type_info_header,
                         TypeInfoRecordMap* type_info_record_map);
 
+// Finds the definitions of the forward references to classes, structures,
+// unions and enums, as a debugger would. These are matched by their decorated
+// names when they have them, and by their names otherwise. Forward references
+// whose definition can't be found are left out.
+// @param stream The type info stream.
+// @param type_info_record_map The records of @p stream, as read by
+//     ReadTypeInfoStream.
+// @param type_definitions Receives the definitions of the forward references.
+// @returns true on success, false if the type records are malformed.
+bool GetTypeDefinitions(PdbStream* stream,
+                        const TypeInfoRecordMap& type_info_record_map,
+                        TypeDefinitionMap* type_definitions);
+
+// Computes the size of the variables of a given type, as a debugger would
+// report it.
+// @param stream The type info stream.
+// @param type_info_record_map The records of @p stream, as read by
+//     ReadTypeInfoStream.
+// @param type_index The index of the type.
+// @param size Receives the size of the type, in bytes. This is zero for types
+//     that have no storage (void, functions) and for forward references.
+// @returns true on success, false if the type records are malformed.
+bool GetTypeSize(PdbStream* stream,
+                 const TypeInfoRecordMap& type_info_record_map,
+                 uint32 type_index,
+                 size_t* size);
+
+// Computes the size of the variables of a given type, as a debugger would
+// report it, looking through forward references to user defined types.
+// @param stream The type info stream.
+// @param type_info_record_map The records of @p stream, as read by
+//     ReadTypeInfoStream.
+// @param type_definitions The definitions of the forward references in
+//     @p stream, as found by GetTypeDefinitions.
+// @param type_index The index of the type.
+// @param size Receives the size of the type, in bytes. This is zero for types
+//     that have no storage (void, functions) and for forward references whose
+//     definition is unknown.
+// @returns true on success, false if the type records are malformed.
+bool GetTypeSize(PdbStream* stream,
+                 const TypeInfoRecordMap& type_info_record_map,
+                 const TypeDefinitionMap& type_definitions,
+                 uint32 type_index,
+                 size_t* size);
+
 }  // namespace pdb
 
 #endif  // SYZYGY_PDB_PDB_TYPE_INFO_STREAM_H_
@@ -14,13 +14,75 @@
 
 #include "syzygy/pdb/pdb_type_info_stream.h"
 
+#include <vector>
+
 #include "base/files/file_util.h"
 #include "gtest/gtest.h"
 #include "syzygy/core/unittest_util.h"
+#include "syzygy/pdb/pdb_byte_stream.h"
+#include "syzygy/pdb/pdb_constants.h"
 #include "syzygy/pdb/unittest_util.h"
+#include "third_party/cci/Files/CvInfo.h"
 
 namespace pdb {
 
+namespace {
+
+namespace cci = Microsoft_Cci_Pdb;
+
+template <typename T>
+void Append(const T& value, std::vector<uint8>* data) {
+  const uint8* bytes = reinterpret_cast<const uint8*>(&value);
+  data->insert(data->end(), bytes, bytes + sizeof(value));
+}
+
+// Starts a type record whose data is appended to @p data by the caller.
+void StartRecord(uint16 type,
+                 const std::vector<uint8>& data,
+                 TypeInfoRecordMap* records) {
+  TypeInfoRecord record = { data.size(), 0, type };
+  uint32 type_index = kTpiStreamFirstUserTypeIndex + records->size();
+  records->insert(std::make_pair(type_index, record));
+}
+
+// Ends the last type record started by StartRecord, setting its length.
+void EndRecord(const std::vector<uint8>& data, TypeInfoRecordMap* records) {
+  TypeInfoRecord& record = records->rbegin()->second;
+  record.len = static_cast<uint16>(data.size() - record.start_position);
+}
+
+void AppendString(const char* value, std::vector<uint8>* data) {
+  data->insert(data->end(), value, value + ::strlen(value) + 1);
+}
+
+// Appends a class or structure record with the given properties and names.
+// @p unique_name may be NULL.
+void AppendStructure(uint16 type,
+                     uint16 property,
+                     uint16 size,
+                     const char* name,
+                     const char* unique_name,
+                     std::vector<uint8>* data,
+                     TypeInfoRecordMap* records) {
+  const uint16 kHasUniqueNameProperty = 0x0200;
+  if (unique_name != NULL)
+    property |= kHasUniqueNameProperty;
+
+  StartRecord(type, *data, records);
+  Append<uint16>(0, data);
+  Append<uint16>(property, data);
+  Append<uint32>(0, data);
+  Append<uint32>(0, data);
+  Append<uint32>(0, data);
+  Append<uint16>(size, data);
+  AppendString(name, data);
+  if (unique_name != NULL)
+    AppendString(unique_name, data);
+  EndRecord(*data, records);
+}
+
+}  // namespace
+
 TEST(PdbTypeInfoStreamTest, ReadValidTypeInfoStream) {
   base::FilePath valid_type_info_path = testing::GetSrcRelativePath(
       testing::kValidPdbTypeInfoStreamPath);
@@ -61,4 +123,198 @@ TEST(PdbTypeInfoStreamTest, ReadInvalidHeaderTypeInfoStream) {
                                   &types_map));
 }
 
+TEST(PdbTypeInfoStreamTest, GetPrimitiveTypeSize) {
+  scoped_refptr<PdbByteStream> stream(new PdbByteStream());
+  TypeInfoRecordMap records;
+
+  size_t size = 0;
+  EXPECT_TRUE(GetTypeSize(stream.get(), records, cci::T_VOID, &size));
+  EXPECT_EQ(0U, size);
+  EXPECT_TRUE(GetTypeSize(stream.get(), records, cci::T_UCHAR, &size));
+  EXPECT_EQ(1U, size);
+  EXPECT_TRUE(GetTypeSize(stream.get(), records, cci::T_WCHAR, &size));
+  EXPECT_EQ(2U, size);
+  EXPECT_TRUE(GetTypeSize(stream.get(), records, cci::T_INT4, &size));
+  EXPECT_EQ(4U, size);
+  EXPECT_TRUE(GetTypeSize(stream.get(), records, cci::T_REAL80, &size));
+  EXPECT_EQ(10U, size);
+  EXPECT_TRUE(GetTypeSize(stream.get(), records, cci::T_32PVOID, &size));
+  EXPECT_EQ(4U, size);
+  EXPECT_TRUE(GetTypeSize(stream.get(), records, cci::T_64PREAL80, &size));
+  EXPECT_EQ(8U, size);
+}
+
+TEST(PdbTypeInfoStreamTest, GetTypeSize) {
+  std::vector<uint8> data;
+  TypeInfoRecordMap records;
+
+  // 0x1000: const int.
+  StartRecord(cci::LF_MODIFIER, data, &records);
+  Append<uint32>(cci::T_INT4, &data);
+  Append<uint16>(1, &data);
+
+  // 0x1001: const int*.
+  StartRecord(cci::LF_POINTER, data, &records);
+  Append<uint32>(0x1000, &data);
+  Append<uint32>(cci::CV_PTR_NEAR32, &data);
+
+  // 0x1002: a 64-bit pointer with an explicit size.
+  StartRecord(cci::LF_POINTER, data, &records);
+  Append<uint32>(cci::T_INT4, &data);
+  Append<uint32>(cci::CV_PTR_64 | (8 << 13), &data);
+
+  // 0x1003: const int[10000].
+  StartRecord(cci::LF_ARRAY, data, &records);
+  Append<uint32>(0x1000, &data);
+  Append<uint32>(cci::T_ULONG, &data);
+  Append<uint16>(cci::LF_ULONG, &data);
+  Append<uint32>(40000, &data);
+
+  // 0x1004: a 12-byte structure.
+  StartRecord(cci::LF_STRUCTURE, data, &records);
+  Append<uint16>(3, &data);
+  Append<uint16>(0, &data);
+  Append<uint32>(0, &data);
+  Append<uint32>(0, &data);
+  Append<uint32>(0, &data);
+  Append<uint16>(12, &data);
+  Append<char>(0, &data);
+
+  // 0x1005: a forward reference to a structure.
+  StartRecord(cci::LF_STRUCTURE, data, &records);
+  Append<uint16>(0, &data);
+  Append<uint16>(cci::fwdref, &data);
+  Append<uint32>(0, &data);
+  Append<uint32>(0, &data);
+  Append<uint32>(0, &data);
+  Append<uint16>(0, &data);
+  Append<char>(0, &data);
+
+  // 0x1006: an enum stored in a byte.
+  StartRecord(cci::LF_ENUM, data, &records);
+  Append<uint16>(2, &data);
+  Append<uint16>(0, &data);
+  Append<uint32>(cci::T_UCHAR, &data);
+  Append<uint32>(0, &data);
+  Append<char>(0, &data);
+
+  // 0x1007: a modifier of a type that doesn't exist.
+  StartRecord(cci::LF_MODIFIER, data, &records);
+  Append<uint32>(0x2000, &data);
+  Append<uint16>(1, &data);
+
+  scoped_refptr<PdbByteStream> stream(new PdbByteStream());
+  ASSERT_TRUE(stream->Init(data.data(), data.size()));
+
+  const size_t kExpectedSizes[] = { 4, 4, 8, 40000, 12, 0, 1 };
+  for (size_t i = 0; i < arraysize(kExpectedSizes); ++i) {
+    size_t size = 0;
+    EXPECT_TRUE(GetTypeSize(stream.get(), records, 0x1000 + i, &size));
+    EXPECT_EQ(kExpectedSizes[i], size);
+  }
+
+  size_t size = 0;
+  EXPECT_FALSE(GetTypeSize(stream.get(), records, 0x1007, &size));
+  EXPECT_FALSE(GetTypeSize(stream.get(), records, 0x1008, &size));
+}
+
+TEST(PdbTypeInfoStreamTest, GetTypeSizeOfForwardReferences) {
+  std::vector<uint8> data;
+  TypeInfoRecordMap records;
+
+  // 0x1000: a forward reference to a structure with a decorated name.
+  AppendStructure(cci::LF_STRUCTURE, cci::fwdref, 0, "Foo", ".?AUFoo@@",
+                  &data, &records);
+  // 0x1001: an unrelated structure of the same name.
+  AppendStructure(cci::LF_STRUCTURE, 0, 4, "Foo", ".?AUFoo@ns@@", &data,
+                  &records);
+  // 0x1002: the definition of 0x1000.
+  AppendStructure(cci::LF_STRUCTURE, 0, 12, "Foo", ".?AUFoo@@", &data,
+                  &records);
+
+  // 0x1003: a forward reference to a class without a decorated name, defined
+  // as a structure.
+  AppendStructure(cci::LF_CLASS, cci::fwdref, 0, "Bar", NULL, &data,
+                  &records);
+  // 0x1004: the definition of 0x1003.
+  AppendStructure(cci::LF_STRUCTURE, 0, 8, "Bar", NULL, &data, &records);
+
+  // 0x1005: a forward reference to a structure that isn't defined.
+  AppendStructure(cci::LF_STRUCTURE, cci::fwdref, 0, "Baz", NULL, &data,
+                  &records);
+
+  // 0x1006: a forward reference to an enum.
+  StartRecord(cci::LF_ENUM, data, &records);
+  Append<uint16>(0, &data);
+  Append<uint16>(cci::fwdref, &data);
+  Append<uint32>(0, &data);
+  Append<uint32>(0, &data);
+  AppendString("Qux", &data);
+  EndRecord(data, &records);
+
+  // 0x1007: the definition of 0x1006, stored in a short.
+  StartRecord(cci::LF_ENUM, data, &records);
+  Append<uint16>(2, &data);
+  Append<uint16>(0, &data);
+  Append<uint32>(cci::T_USHORT, &data);
+  Append<uint32>(0, &data);
+  AppendString("Qux", &data);
+  EndRecord(data, &records);
+
+  // 0x1008: const Foo, referring to the forward reference.
+  StartRecord(cci::LF_MODIFIER, data, &records);
+  Append<uint32>(0x1000, &data);
+  Append<uint16>(1, &data);
+  EndRecord(data, &records);
+
+  scoped_refptr<PdbByteStream> stream(new PdbByteStream());
+  ASSERT_TRUE(stream->Init(data.data(), data.size()));
+
+  TypeDefinitionMap definitions;
+  ASSERT_TRUE(GetTypeDefinitions(stream.get(), records, &definitions));
+  EXPECT_EQ(3U, definitions.size());
+  EXPECT_EQ(0x1002U, definitions[0x1000]);
+  EXPECT_EQ(0x1004U, definitions[0x1003]);
+  EXPECT_EQ(0x1007U, definitions[0x1006]);
+
+  const size_t kExpectedSizes[] = { 12, 4, 12, 8, 8, 0, 2, 2, 12 };
+  for (size_t i = 0; i < arraysize(kExpectedSizes); ++i) {
+    size_t size = 0;
+    EXPECT_TRUE(GetTypeSize(stream.get(), records, definitions, 0x1000 + i,
+                            &size));
+    EXPECT_EQ(kExpectedSizes[i], size);
+  }
+
+  // Without the definitions, forward references have no size.
+  size_t size = 0;
+  EXPECT_TRUE(GetTypeSize(stream.get(), records, 0x1000, &size));
+  EXPECT_EQ(0U, size);
+}
+
+TEST(PdbTypeInfoStreamTest, GetTypeSizeOfValidTypeInfoStream) {
+  base::FilePath valid_type_info_path = testing::GetSrcRelativePath(
+      testing::kValidPdbTypeInfoStreamPath);
+
+  scoped_refptr<pdb::PdbFileStream> valid_type_info_stream =
+      testing::GetStreamFromFile(valid_type_info_path);
+  TypeInfoHeader header;
+  TypeInfoRecordMap types_map;
+  ASSERT_TRUE(ReadTypeInfoStream(valid_type_info_stream.get(),
+                                 &header,
+                                 &types_map));
+
+  TypeDefinitionMap definitions;
+  EXPECT_TRUE(GetTypeDefinitions(valid_type_info_stream.get(), types_map,
+                                 &definitions));
+
+  TypeInfoRecordMap::const_iterator it = types_map.begin();
+  for (; it != types_map.end(); ++it) {
+    size_t size = 0;
+    EXPECT_TRUE(GetTypeSize(valid_type_info_stream.get(), types_map,
+                            it->first, &size));
+    EXPECT_TRUE(GetTypeSize(valid_type_info_stream.get(), types_map,
+                            definitions, it->first, &size));
+  }
+}
+
 }  // namespace pdb
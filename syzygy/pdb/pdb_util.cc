@@ -18,6 +18,7 @@
 
 #include "base/strings/stringprintf.h"
 #include "syzygy/pdb/pdb_byte_stream.h"
+#include "syzygy/pdb/pdb_overlay_stream.h"
 #include "syzygy/pdb/pdb_reader.h"
 #include "syzygy/pdb/pdb_writer.h"
 
@@ -38,16 +39,12 @@ bool SetDbiDbgStream(size_t index_offset,
                      PdbFile* pdb_file) {
   DCHECK(pdb_file != NULL);
 
-  if (!EnsureStreamWritable(kDbiStream, pdb_file)) {
-    LOG(ERROR) << "Failed to make DBI stream writable.";
+  scoped_refptr<PdbStream> dbi_reader(pdb_file->GetStream(kDbiStream));
+  if (dbi_reader.get() == NULL) {
+    LOG(ERROR) << "No DBI stream in PDB.";
     return false;
   }
 
-  scoped_refptr<PdbStream> dbi_reader(pdb_file->GetStream(kDbiStream));
-  scoped_refptr<WritablePdbStream> dbi_writer(
-      dbi_reader->GetWritablePdbStream());
-  DCHECK(dbi_writer.get() != NULL);
-
   // Read the DBI header.
   DbiHeader dbi_header = {};
   if (!dbi_reader->Seek(0) || !dbi_reader->Read(&dbi_header, 1)) {
@@ -76,8 +73,8 @@ bool SetDbiDbgStream(size_t index_offset,
 
   // Update the index in the header if we need to.
   if (new_index != existing_index) {
-    dbi_writer->set_pos(dbi_dbg_offset + index_offset);
-    if (!dbi_writer->Write(new_index)) {
+    if (!PatchStream(kDbiStream, dbi_dbg_offset + index_offset, new_index,
+                     pdb_file)) {
       LOG(ERROR) << "Failed to write stream index at offset " << dbi_dbg_offset
                  << " of DBI DBG header.";
       return false;
@@ -342,64 +339,102 @@ bool SetOmapFromStream(const std::vector<OMAP>& omap_from_list,
                        pdb_file);
 }
 
-bool SetGuid(const GUID& guid, PdbFile* pdb_file) {
+bool PatchStream(uint32 index,
+                 size_t offset,
+                 size_t count,
+                 const void* data,
+                 PdbFile* pdb_file) {
+  DCHECK(data != NULL || count == 0);
   DCHECK(pdb_file != NULL);
 
-  // Make sure the Pdb header and the Dbi streams are writable.
-  if (!EnsureStreamWritable(kPdbHeaderInfoStream, pdb_file)) {
-    LOG(ERROR) << "Failed to make PDB Header Info stream writable.";
+  // Bail if the index is to a non-existent stream.
+  if (index >= pdb_file->StreamCount()) {
+    LOG(ERROR) << "Invalid PDB stream index.";
     return false;
   }
-  if (!EnsureStreamWritable(kDbiStream, pdb_file)) {
-    LOG(ERROR) << "Failed to make DBI Info stream writable.";
+
+  // Get the stream. If it doesn't actually exist, create a new one.
+  scoped_refptr<PdbStream> stream(pdb_file->GetStream(index));
+  if (stream.get() == NULL)
+    stream = new PdbByteStream();
+
+  if (offset > stream->length()) {
+    LOG(ERROR) << "Patch at offset " << offset << " is past the end of PDB "
+               << "stream " << index << ".";
     return false;
   }
 
-  // Get the reader and writer for the header info stream.
-  scoped_refptr<PdbStream> reader(pdb_file->GetStream(kPdbHeaderInfoStream));
-  scoped_refptr<WritablePdbStream> writer(reader->GetWritablePdbStream());
-  DCHECK(writer.get() != NULL);
+  // Write in place if the stream allows it.
+  scoped_refptr<WritablePdbStream> writer(stream->GetWritablePdbStream());
+  if (writer.get() != NULL) {
+    writer->set_pos(offset);
+    if (!writer->Write(count, data)) {
+      LOG(ERROR) << "Failed to write to PDB stream " << index << ".";
+      return false;
+    }
+  } else if (!stream->Patch(offset, count, data)) {
+    // Otherwise, record the patch in an overlay rather than copying the whole
+    // stream to a PdbByteStream.
+    scoped_refptr<PdbOverlayStream> overlay(
+        new PdbOverlayStream(stream.get()));
+    if (!overlay->Patch(offset, count, data)) {
+      LOG(ERROR) << "Failed to patch PDB stream " << index << ".";
+      return false;
+    }
+    stream = overlay.get();
+  }
 
-  // Read the header.
+  // Be sure to replace the stream at this index with the patched one. This is
+  // a no-op if the stream hasn't changed.
+  pdb_file->ReplaceStream(index, stream.get());
+
+  return true;
+}
+
+bool SetGuid(const GUID& guid, PdbFile* pdb_file) {
+  DCHECK(pdb_file != NULL);
+
+  // Read the Pdb header.
+  scoped_refptr<PdbStream> reader(pdb_file->GetStream(kPdbHeaderInfoStream));
+  if (reader.get() == NULL) {
+    LOG(ERROR) << "No PDB Header Info stream in PDB.";
+    return false;
+  }
   PdbInfoHeader70 info_header = {};
   if (!reader->Seek(0) || !reader->Read(&info_header, 1)) {
     LOG(ERROR) << "Failed to read PdbInfoHeader70.";
     return false;
   }
 
-  // Update it.
-  info_header.timestamp = static_cast<uint32>(time(NULL));
-  info_header.pdb_age = 1;  // Reset age to 1, as this is a new generation.
-  info_header.signature = guid;
-
-  // And write it back.
-  writer->set_pos(0);
-  if (!writer->Write(info_header)) {
-    LOG(ERROR) << "Failed to write PdbInfoHeader70.";
-    return false;
-  }
-
-  // Now update the age in the DBI stream to match the age we set above.
+  // Read the Dbi header.
   reader = pdb_file->GetStream(kDbiStream);
   if (reader.get() == NULL) {
     LOG(ERROR) << "No DBI stream in PDB.";
     return false;
   }
-  writer = reader->GetWritablePdbStream();
-
-  DCHECK(writer.get() != NULL);
-
-  // Read the header.
   DbiHeader dbi_header = {};
   if (!reader->Seek(0) || !reader->Read(&dbi_header, 1)) {
     LOG(ERROR) << "Failed to read DbiHeader.";
     return false;
   }
 
+  // Update the Pdb header.
+  info_header.timestamp = static_cast<uint32>(time(NULL));
+  info_header.pdb_age = 1;  // Reset age to 1, as this is a new generation.
+  info_header.signature = guid;
+
+  // And write it back. Both streams are patched rather than rewritten, as the
+  // Dbi stream in particular can be very large.
+  if (!PatchStream(kPdbHeaderInfoStream, 0, info_header, pdb_file)) {
+    LOG(ERROR) << "Failed to write PdbInfoHeader70.";
+    return false;
+  }
+
+  // Now update the age in the DBI stream to match the age we set above.
   dbi_header.age = 1;
-  writer->set_pos(0);
-  if (!writer->Write(dbi_header)) {
-    LOG(ERROR) << "Failed to write DbiHeader";
+  if (!PatchStream(kDbiStream, offsetof(DbiHeader, age), dbi_header.age,
+                   pdb_file)) {
+    LOG(ERROR) << "Failed to write DbiHeader.";
     return false;
   }
 
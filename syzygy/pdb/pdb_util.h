@@ -98,6 +98,37 @@ uint32 GetDbiDbgHeaderOffset(const DbiHeader& dbi_header);
 // @returns true on success, false otherwise.
 bool EnsureStreamWritable(uint32 index, PdbFile* pdb_file);
 
+// Overwrites bytes of a stream in a PdbFile. Writable streams are written in
+// place. Other streams are wrapped in a PdbOverlayStream that records the
+// patch, rather than being copied to memory to make them writable.
+// @param index the index of the stream to patch.
+// @param offset the offset of the bytes to overwrite. This may not be past
+//     the end of the stream, but the patch may extend the stream.
+// @param count the number of bytes to overwrite.
+// @param data the new bytes.
+// @param pdb_file the PdbFile containing the stream.
+// @returns true on success, false otherwise.
+bool PatchStream(uint32 index,
+                 size_t offset,
+                 size_t count,
+                 const void* data,
+                 PdbFile* pdb_file);
+
+// Overwrites a value in a stream in a PdbFile. See PatchStream above.
+// @tparam T the type of the value.
+// @param index the index of the stream to patch.
+// @param offset the offset of the value.
+// @param value the new value.
+// @param pdb_file the PdbFile containing the stream.
+// @returns true on success, false otherwise.
+template <typename T>
+bool PatchStream(uint32 index,
+                 size_t offset,
+                 const T& value,
+                 PdbFile* pdb_file) {
+  return PatchStream(index, offset, sizeof(value), &value, pdb_file);
+}
+
 // Sets the OMAP_TO stream in the in-memory representation of a PDB file,
 // creating one if none exists.
 // @param omap_to_list the list of OMAP_TO entries.
@@ -28,6 +28,7 @@
 #include "syzygy/common/dbghelp_util.h"
 #include "syzygy/core/unittest_util.h"
 #include "syzygy/pdb/pdb_byte_stream.h"
+#include "syzygy/pdb/pdb_overlay_stream.h"
 #include "syzygy/pdb/pdb_reader.h"
 #include "syzygy/pdb/pdb_writer.h"
 #include "syzygy/pdb/unittest_util.h"
@@ -493,6 +494,79 @@ TEST(EnsureStreamWritableTest, FailsWhenNonExistent) {
   EXPECT_FALSE(EnsureStreamWritable(45, &pdb_file));
 }
 
+TEST(PatchStreamTest, WritesInPlaceWhenWritable) {
+  PdbFile pdb_file;
+  scoped_refptr<PdbByteStream> stream = new PdbByteStream();
+  ASSERT_TRUE(stream->Init(reinterpret_cast<const uint8*>(&kSampleDbiHeader),
+                           sizeof(kSampleDbiHeader)));
+  size_t index = pdb_file.AppendStream(stream.get());
+
+  const uint32 kAge = 42;
+  EXPECT_TRUE(PatchStream(index, offsetof(DbiHeader, age), kAge, &pdb_file));
+  EXPECT_EQ(stream.get(), pdb_file.GetStream(index).get());
+
+  DbiHeader dbi_header = {};
+  ::memcpy(&dbi_header, stream->data(), sizeof(dbi_header));
+  EXPECT_EQ(kAge, dbi_header.age);
+  EXPECT_EQ(kSampleDbiHeader.version, dbi_header.version);
+}
+
+TEST(PatchStreamTest, OverlaysReadOnlyStream) {
+  PdbFile pdb_file;
+  scoped_refptr<PdbStream> stream = new TestPdbStream(kSampleDbiHeader);
+  size_t index = pdb_file.AppendStream(stream.get());
+
+  const uint32 kAge = 42;
+  EXPECT_TRUE(PatchStream(index, offsetof(DbiHeader, age), kAge, &pdb_file));
+
+  // The stream is wrapped rather than copied.
+  scoped_refptr<PdbStream> stream2 = pdb_file.GetStream(index);
+  ASSERT_TRUE(stream2.get() != NULL);
+  EXPECT_NE(stream.get(), stream2.get());
+  EXPECT_TRUE(stream2->GetWritablePdbStream() == NULL);
+  EXPECT_EQ(stream.get(),
+            static_cast<PdbOverlayStream*>(stream2.get())->base());
+
+  // Further patches reuse the same overlay.
+  const uint32 kVersion = 12345;
+  EXPECT_TRUE(PatchStream(index, offsetof(DbiHeader, version), kVersion,
+                          &pdb_file));
+  EXPECT_EQ(stream2.get(), pdb_file.GetStream(index).get());
+
+  DbiHeader dbi_header = {};
+  ASSERT_EQ(sizeof(dbi_header), stream2->length());
+  EXPECT_TRUE(stream2->Seek(0));
+  EXPECT_TRUE(stream2->Read(&dbi_header, 1));
+  EXPECT_EQ(kAge, dbi_header.age);
+  EXPECT_EQ(kVersion, dbi_header.version);
+  EXPECT_EQ(kSampleDbiHeader.signature, dbi_header.signature);
+
+  // The original stream is untouched.
+  EXPECT_TRUE(stream->Seek(0));
+  EXPECT_TRUE(stream->Read(&dbi_header, 1));
+  EXPECT_EQ(kSampleDbiHeader.age, dbi_header.age);
+  EXPECT_EQ(kSampleDbiHeader.version, dbi_header.version);
+}
+
+TEST(PatchStreamTest, FailsPastEndOfStream) {
+  PdbFile pdb_file;
+  size_t index = pdb_file.AppendStream(new TestPdbStream(kSampleDbiHeader));
+
+  const uint8 kByte = 6;
+  EXPECT_FALSE(PatchStream(index, sizeof(kSampleDbiHeader) + 1, kByte,
+                           &pdb_file));
+
+  // Appending to the end of the stream is fine.
+  EXPECT_TRUE(PatchStream(index, sizeof(kSampleDbiHeader), kByte, &pdb_file));
+  EXPECT_EQ(sizeof(kSampleDbiHeader) + 1, pdb_file.GetStream(index)->length());
+}
+
+TEST(PatchStreamTest, FailsWhenNonExistent) {
+  PdbFile pdb_file;
+  const uint8 kByte = 6;
+  EXPECT_FALSE(PatchStream(45, 0, kByte, &pdb_file));
+}
+
 TEST(SetGuidTest, FailsWhenStreamsDoNotExist) {
   PdbFile pdb_file;
 
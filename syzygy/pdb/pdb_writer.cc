@@ -14,6 +14,8 @@
 
 #include "syzygy/pdb/pdb_writer.h"
 
+#include <algorithm>
+
 #include "base/logging.h"
 #include "syzygy/pdb/pdb_constants.h"
 #include "syzygy/pdb/pdb_data.h"
@@ -164,6 +166,213 @@ bool AppendPage(const void* data,
   return true;
 }
 
+// Initializes the MSF header of a file.
+bool InitHeader(const std::vector<uint32>& root_directory_pages,
+                size_t directory_size,
+                uint32 page_count,
+                PdbHeader* header) {
+  DCHECK(header != NULL);
+
+  // Make sure the root directory pointers won't overflow.
+  if (root_directory_pages.size() > arraysize(header->root_pages)) {
+    LOG(ERROR) << "Too many root directory pages for header ("
+               << root_directory_pages.size() << " > "
+               << arraysize(header->root_pages) << ").";
+    return false;
+  }
+
+  ::memcpy(header->magic_string, kPdbHeaderMagicString,
+           sizeof(kPdbHeaderMagicString));
+  header->page_size = kPdbPageSize;
+  header->free_page_map = 1;
+  header->num_pages = page_count;
+  header->directory_size = directory_size;
+  header->reserved = 0;
+  ::memcpy(header->root_pages,
+           root_directory_pages.data(),
+           sizeof(root_directory_pages[0]) * root_directory_pages.size());
+
+  return true;
+}
+
+// Gets the number of pages needed to hold @p length bytes.
+uint32 GetPageCount(size_t length) {
+  return (length + kPdbPageSize - 1) / kPdbPageSize;
+}
+
+// Allocates @p count pages at the end of the file, appending their indices to
+// @p pages. This skips over the pages reserved for the free page map in the
+// same way as AppendPage.
+void AllocatePages(uint32 count,
+                   std::vector<uint32>* pages,
+                   uint32* page_count) {
+  DCHECK(pages != NULL);
+  DCHECK(page_count != NULL);
+
+  for (uint32 i = 0; i < count; ++i) {
+    if (((*page_count) % kPdbPageSize) == 1)
+      *page_count += 2;
+    pages->push_back(*page_count);
+    ++(*page_count);
+  }
+}
+
+// Writes an MSF file sequentially, coalescing the writes in a large buffer.
+// The pages reserved for the free page map are filled in as they are reached,
+// so the free page map must be known before any writing is done.
+class SequentialPageWriter {
+ public:
+  SequentialPageWriter(const FreePageBitMap& free, FILE* file)
+      : free_(free), file_(file), offset_(0) {
+    DCHECK(file != NULL);
+    buffer_.reserve(kWriteBufferSize);
+  }
+
+  // Appends data to the file, skipping over free page map pages.
+  // @param data the data to append.
+  // @param length the length of the data.
+  // @returns true on success, false otherwise.
+  bool Append(const uint8* data, size_t length) {
+    DCHECK(data != NULL || length == 0);
+
+    while (length > 0) {
+      if (offset_ % kPdbPageSize == 0 && !WriteFreePageMapPages())
+        return false;
+
+      // Write as much as we can before reaching the next free page map pages.
+      uint32 page = offset_ / kPdbPageSize;
+      uint32 free_page = page - page % kPdbPageSize + 1;
+      if (free_page <= page)
+        free_page += kPdbPageSize;
+      size_t chunk_size = std::min(
+          length, static_cast<size_t>(free_page * kPdbPageSize - offset_));
+      if (!Write(data, chunk_size))
+        return false;
+
+      data += chunk_size;
+      length -= chunk_size;
+    }
+
+    return true;
+  }
+
+  // Appends the contents of a stream to the file, padded with zeros to the
+  // next page boundary. The stream is copied directly from memory where it
+  // allows it.
+  // @param stream the stream to append.
+  // @returns true on success, false otherwise.
+  bool AppendStream(PdbStream* stream) {
+    DCHECK(stream != NULL);
+
+    if (!stream->Seek(0))
+      return false;
+    while (stream->bytes_left() > 0) {
+      const uint8* data = NULL;
+      size_t count = stream->ReadDirectRun(stream->bytes_left(), &data);
+      if (count == 0) {
+        // Fall back to reading the stream through a buffer.
+        copy_buffer_.resize(kWriteBufferSize);
+        count = std::min(stream->bytes_left(), copy_buffer_.size());
+        size_t bytes_read = 0;
+        if (!stream->ReadBytes(copy_buffer_.data(), count, &bytes_read) ||
+            bytes_read != count) {
+          LOG(ERROR) << "Failed to read " << count << " bytes at offset "
+                     << stream->pos() << " of PDB stream.";
+          return false;
+        }
+        data = copy_buffer_.data();
+      }
+
+      if (!Append(data, count))
+        return false;
+    }
+
+    return PadToPage();
+  }
+
+  // Pads the file with zeros to the next page boundary.
+  bool PadToPage() {
+    size_t offset_in_page = offset_ % kPdbPageSize;
+    if (offset_in_page == 0)
+      return true;
+    return Write(kZeroBuffer, kPdbPageSize - offset_in_page);
+  }
+
+  // Writes out any buffered data.
+  bool Flush() {
+    if (buffer_.empty())
+      return true;
+    if (::fwrite(buffer_.data(), 1, buffer_.size(), file_) != buffer_.size()) {
+      LOG(ERROR) << "Failed to write " << buffer_.size() << " bytes.";
+      return false;
+    }
+    buffer_.clear();
+    return true;
+  }
+
+  // @returns the number of bytes written so far, including buffered bytes.
+  size_t offset() const { return offset_; }
+
+ private:
+  // The size of the buffer used to coalesce writes.
+  static const size_t kWriteBufferSize = 256 * kPdbPageSize;
+
+  // Writes data at the current offset, without regard for the free page map
+  // pages.
+  bool Write(const void* data, size_t length) {
+    if (buffer_.size() + length > kWriteBufferSize && !Flush())
+      return false;
+
+    // Large writes bypass the buffer altogether.
+    if (length >= kWriteBufferSize) {
+      if (::fwrite(data, 1, length, file_) != length) {
+        LOG(ERROR) << "Failed to write " << length << " bytes.";
+        return false;
+      }
+    } else {
+      const uint8* bytes = reinterpret_cast<const uint8*>(data);
+      buffer_.insert(buffer_.end(), bytes, bytes + length);
+    }
+
+    offset_ += length;
+    return true;
+  }
+
+  // Writes the two free page map pages if the current page is reserved for
+  // them. The first holds the next page worth of the free page bit map, and
+  // the second is empty. This mirrors AppendPage and WriteFreePageBitMap.
+  bool WriteFreePageMapPages() {
+    DCHECK_EQ(0u, offset_ % kPdbPageSize);
+
+    uint32 page = offset_ / kPdbPageSize;
+    if (page % kPdbPageSize != 1)
+      return true;
+
+    uint8 bit_map_page[kPdbPageSize] = { 0 };
+    const std::vector<uint8>& data = free_.data();
+    size_t data_offset = (page / kPdbPageSize) * kPdbPageSize;
+    if (data_offset < data.size()) {
+      size_t bytes = std::min(data.size() - data_offset,
+                              static_cast<size_t>(kPdbPageSize));
+      ::memcpy(bit_map_page, data.data() + data_offset, bytes);
+
+      // A partial last page of the bit map is padded with ones.
+      ::memset(bit_map_page + bytes, 0xFF, kPdbPageSize - bytes);
+    }
+
+    return Write(bit_map_page, kPdbPageSize) &&
+        Write(kZeroBuffer, kPdbPageSize);
+  }
+
+  const FreePageBitMap& free_;
+  FILE* file_;
+  size_t offset_;
+  std::vector<uint8> buffer_;
+  std::vector<uint8> copy_buffer_;
+
+  DISALLOW_COPY_AND_ASSIGN(SequentialPageWriter);
+};
+
 bool WriteFreePageBitMap(const FreePageBitMap& free, FILE* file) {
   DCHECK(file != NULL);
 
@@ -212,7 +421,7 @@ bool WriteFreePageBitMap(const FreePageBitMap& free, FILE* file) {
 
 }  // namespace
 
-PdbWriter::PdbWriter() {
+PdbWriter::PdbWriter() : streaming_(false) {
 }
 
 PdbWriter::~PdbWriter() {
@@ -225,6 +434,15 @@ bool PdbWriter::Write(const base::FilePath& pdb_path, const PdbFile& pdb_file) {
     return false;
   }
 
+  if (streaming_) {
+    if (!WriteStreaming(pdb_file))
+      return false;
+
+    // On success we want the file to be closed right away.
+    file_.reset();
+    return true;
+  }
+
   // Initialize the directory with stream count and lengths.
   std::vector<uint32> directory;
   directory.push_back(pdb_file.StreamCount());
@@ -321,6 +539,95 @@ bool PdbWriter::Write(const base::FilePath& pdb_path, const PdbFile& pdb_file) {
   return true;
 }
 
+bool PdbWriter::WriteStreaming(const PdbFile& pdb_file) {
+  // Lay out the whole file before writing anything. This starts with the
+  // directory, holding the stream count, lengths and pages.
+  std::vector<uint32> directory;
+  directory.push_back(pdb_file.StreamCount());
+  for (size_t i = 0; i < pdb_file.StreamCount(); ++i) {
+    // Null streams have an implicit zero length.
+    PdbStream* stream = pdb_file.GetStream(i).get();
+    if (stream == NULL)
+      directory.push_back(0);
+    else
+      directory.push_back(stream->length());
+  }
+
+  // The streams follow the same 4 page preamble as in Write.
+  uint32 page_count = 4;
+  size_t stream0_start = directory.size();
+  size_t stream0_end = 0;
+  for (size_t i = 0; i < pdb_file.StreamCount(); ++i) {
+    if (i == 1)
+      stream0_end = directory.size();
+
+    PdbStream* stream = pdb_file.GetStream(i).get();
+    if (stream == NULL || stream->length() == 0)
+      continue;
+    AllocatePages(GetPageCount(stream->length()), &directory, &page_count);
+  }
+  DCHECK_LE(stream0_start, stream0_end);
+
+  // The directory and the root directory follow the streams.
+  size_t directory_size = sizeof(directory[0]) * directory.size();
+  std::vector<uint32> directory_pages;
+  AllocatePages(GetPageCount(directory_size), &directory_pages, &page_count);
+  size_t directory_pages_size =
+      sizeof(directory_pages[0]) * directory_pages.size();
+  std::vector<uint32> root_directory_pages;
+  AllocatePages(GetPageCount(directory_pages_size), &root_directory_pages,
+                &page_count);
+
+  PdbHeader header = { 0 };
+  if (!InitHeader(root_directory_pages, directory_size, page_count, &header)) {
+    LOG(ERROR) << "Failed to write PDB header.";
+    return false;
+  }
+
+  // The free page map is the same as in Write.
+  FreePageBitMap free;
+  free.SetPageCount(page_count);
+  free.SetFree(3);
+  for (size_t i = stream0_start; i < stream0_end; ++i)
+    free.SetFree(directory[i]);
+  free.Finalize();
+
+  // Now write everything in order. The free page map pages are written by
+  // the page writer as they are reached.
+  SequentialPageWriter writer(free, file_.get());
+  if (!writer.Append(reinterpret_cast<const uint8*>(&header),
+                     sizeof(header)) ||
+      !writer.PadToPage() ||
+      !writer.Append(reinterpret_cast<const uint8*>(kZeroBuffer),
+                     kPdbPageSize)) {
+    LOG(ERROR) << "Failed to write preamble.";
+    return false;
+  }
+
+  for (size_t i = 0; i < pdb_file.StreamCount(); ++i) {
+    PdbStream* stream = pdb_file.GetStream(i).get();
+    if (stream == NULL || stream->length() == 0)
+      continue;
+    if (!writer.AppendStream(stream)) {
+      LOG(ERROR) << "Failed to write stream " << i << ".";
+      return false;
+    }
+  }
+
+  if (!writer.Append(reinterpret_cast<const uint8*>(directory.data()),
+                     directory_size) ||
+      !writer.PadToPage() ||
+      !writer.Append(reinterpret_cast<const uint8*>(directory_pages.data()),
+                     directory_pages_size) ||
+      !writer.PadToPage() || !writer.Flush()) {
+    LOG(ERROR) << "Failed to write directory.";
+    return false;
+  }
+  DCHECK_EQ(page_count * kPdbPageSize, writer.offset());
+
+  return true;
+}
+
 bool PdbWriter::AppendStream(PdbStream* stream,
                              std::vector<uint32>* pages_written,
                              uint32* page_count) {
@@ -381,14 +688,8 @@ bool PdbWriter::WriteHeader(const std::vector<uint32>& root_directory_pages,
   VLOG(1) << "Writing MSF Header ...";
 
   PdbHeader header = { 0 };
-
-  // Make sure the root directory pointers won't overflow.
-  if (root_directory_pages.size() > arraysize(header.root_pages)) {
-    LOG(ERROR) << "Too many root directory pages for header ("
-               << root_directory_pages.size() << " > "
-               << arraysize(header.root_pages) << ").";
+  if (!InitHeader(root_directory_pages, directory_size, page_count, &header))
     return false;
-  }
 
   // Seek to the beginning of the file so we can stamp in the header.
   if (::fseek(file_.get(), 0, SEEK_SET) != 0) {
@@ -396,17 +697,6 @@ bool PdbWriter::WriteHeader(const std::vector<uint32>& root_directory_pages,
     return false;
   }
 
-  ::memcpy(header.magic_string, kPdbHeaderMagicString,
-           sizeof(kPdbHeaderMagicString));
-  header.page_size = kPdbPageSize;
-  header.free_page_map = 1;
-  header.num_pages = page_count;
-  header.directory_size = directory_size;
-  header.reserved = 0;
-  ::memcpy(header.root_pages,
-           root_directory_pages.data(),
-           sizeof(root_directory_pages[0]) * root_directory_pages.size());
-
   if (::fwrite(&header, sizeof(header), 1, file_.get()) != 1) {
     LOG(ERROR) << "Failed to write header.";
     return false;
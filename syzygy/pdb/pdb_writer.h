@@ -38,6 +38,17 @@ class PdbWriter {
   // @returns true on success, false otherwise.
   bool Write(const base::FilePath& pdb_path, const PdbFile& pdb_file);
 
+  // @name Accessors and mutators.
+  // @{
+  // If true, the page layout of the whole file is computed up front and the
+  // file is written in a single sequential pass of large writes. Streams that
+  // can be read directly from memory, such as unmodified streams of a memory
+  // mapped PDB, are copied without being materialized. Otherwise, the file is
+  // written a page at a time. Both produce identical files. Defaults to false.
+  bool streaming() const { return streaming_; }
+  void set_streaming(bool streaming) { streaming_ = streaming; }
+  // @}
+
  protected:
   // Append the contents of the stream onto the file handle at the offset. The
   // contents of the file are padded to reach the next page boundary in the
@@ -53,9 +64,16 @@ class PdbWriter {
                    size_t directory_size,
                    uint32 page_count);
 
+  // Writes the given PdbFile to the current file handle in a single
+  // sequential pass. This is used when streaming is enabled.
+  bool WriteStreaming(const PdbFile& pdb_file);
+
   // The current file handle open for writing.
   base::ScopedFILE file_;
 
+  // Indicates whether the file is written in a single sequential pass.
+  bool streaming_;
+
  private:
   DISALLOW_COPY_AND_ASSIGN(PdbWriter);
 };
@@ -22,6 +22,7 @@
 #include "gmock/gmock.h"
 #include "gtest/gtest.h"
 #include "syzygy/core/unittest_util.h"
+#include "syzygy/pdb/pdb_byte_stream.h"
 #include "syzygy/pdb/pdb_constants.h"
 #include "syzygy/pdb/pdb_data.h"
 #include "syzygy/pdb/pdb_reader.h"
@@ -314,4 +315,51 @@ TEST(PdbWriterTest, PdbStrCompatible) {
       EnsurePdbContentsAreIdentical(file, file_read));
 }
 
+TEST(PdbWriterTest, Streaming) {
+  PdbWriter writer;
+  EXPECT_FALSE(writer.streaming());
+  writer.set_streaming(true);
+  EXPECT_TRUE(writer.streaming());
+
+  // Read the test PDB memory mapped, so that its streams are copied directly
+  // from the mapping.
+  PdbFile file;
+  PdbReader reader;
+  reader.set_use_memory_mapping(true);
+  ASSERT_TRUE(reader.Read(
+      testing::GetSrcRelativePath(testing::kTestPdbFilePath), &file));
+
+  // Add an empty stream, an in-memory stream, and enough streams that can't
+  // be read directly for the file to need a second pair of free page map
+  // pages.
+  file.AppendStream(new TestPdbStream(0, 0));
+  scoped_refptr<PdbByteStream> byte_stream(new PdbByteStream());
+  std::vector<uint8> bytes(3 * kPdbPageSize + 17, 0xAB);
+  ASSERT_TRUE(byte_stream->Init(bytes.data(), bytes.size()));
+  file.AppendStream(byte_stream.get());
+  for (size_t i = 0; i < 17; ++i)
+    file.AppendStream(new TestPdbStream(1024 * 1024 + i, file.StreamCount()));
+
+  base::ScopedTempDir temp_dir;
+  ASSERT_TRUE(temp_dir.CreateUniqueTempDir());
+  base::FilePath paged_path = temp_dir.path().AppendASCII("paged.pdb");
+  base::FilePath streamed_path = temp_dir.path().AppendASCII("streamed.pdb");
+  ASSERT_TRUE(PdbWriter().Write(paged_path, file));
+  ASSERT_TRUE(writer.Write(streamed_path, file));
+
+  // Both modes produce the same file.
+  std::string paged_contents;
+  std::string streamed_contents;
+  ASSERT_TRUE(base::ReadFileToString(paged_path, &paged_contents));
+  ASSERT_TRUE(base::ReadFileToString(streamed_path, &streamed_contents));
+  EXPECT_LT(4097u * kPdbPageSize, streamed_contents.size());
+  EXPECT_EQ(paged_contents.size(), streamed_contents.size());
+  EXPECT_TRUE(paged_contents == streamed_contents);
+
+  // And it can be read back.
+  PdbFile file_read;
+  ASSERT_TRUE(PdbReader().Read(streamed_path, &file_read));
+  ASSERT_NO_FATAL_FAILURE(EnsurePdbContentsAreIdentical(file, file_read));
+}
+
 }  // namespace pdb
@@ -48,6 +48,11 @@ const uint16 S_MSTOOLENV_V3 = 0x113D;
 const uint16 S_LPROC32_VS2013 = 0x1146;
 const uint16 S_GPROC32_VS2013 = 0x1147;
 
+// Inline call site symbols, also seen since VS2013. An S_INLINESITE symbol
+// opens a scope like S_BLOCK32 does, which is closed by S_INLINESITE_END.
+const uint16 S_INLINESITE = 0x114D;
+const uint16 S_INLINESITE_END = 0x114E;
+
 }  // namespace Microsoft_Cci_Pdb
 
 // This macro allow the easy construction of switch statements over the symbol
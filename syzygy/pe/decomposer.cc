@@ -14,6 +14,8 @@
 
 #include "syzygy/pe/decomposer.h"
 
+#include <algorithm>
+
 #include "pcrecpp.h"  // NOLINT
 #include "base/bind.h"
 #include "base/strings/string_split.h"
@@ -21,6 +23,7 @@
 #include "base/strings/utf_string_conversions.h"
 #include "base/win/scoped_bstr.h"
 #include "base/win/scoped_comptr.h"
+#include "syzygy/core/parallel_ranges.h"
 #include "syzygy/core/zstream.h"
 #include "syzygy/pdb/omap.h"
 #include "syzygy/pdb/pdb_byte_stream.h"
@@ -29,13 +32,14 @@
 #include "syzygy/pdb/pdb_file.h"
 #include "syzygy/pdb/pdb_reader.h"
 #include "syzygy/pdb/pdb_symbol_record.h"
+#include "syzygy/pdb/pdb_type_info_stream.h"
 #include "syzygy/pdb/pdb_util.h"
+#include "syzygy/pe/cvinfo_ext.h"
 #include "syzygy/pe/dia_util.h"
 #include "syzygy/pe/find.h"
 #include "syzygy/pe/pe_file_parser.h"
 #include "syzygy/pe/pe_utils.h"
 #include "syzygy/pe/serialization.h"
-#include "third_party/cci/Files/CvInfo.h"
 
 namespace cci = Microsoft_Cci_Pdb;
 
@@ -185,6 +189,23 @@ KnownCompilerInfo kKnownCompilerInfos[] = {
   { L"Microsoft (R) LINK", false }
 };
 
+// Determines whether the compiler with the given name is one of those that we
+// whitelist.
+bool IsSupportedCompiler(const wchar_t* compiler_name) {
+  DCHECK_NE(reinterpret_cast<const wchar_t*>(NULL), compiler_name);
+
+  // Check the compiler name against the list of known compilers.
+  for (size_t i = 0; i < arraysize(kKnownCompilerInfos); ++i) {
+    if (::wcscmp(kKnownCompilerInfos[i].compiler_name, compiler_name) == 0) {
+      return kKnownCompilerInfos[i].supported;
+    }
+  }
+
+  // Anything we don't explicitly know about is not supported.
+  VLOG(1) << "Encountered unknown compiler: " << compiler_name;
+  return false;
+}
+
 // Given a compiland, determines whether the compiler used is one of those that
 // we whitelist.
 bool IsBuiltBySupportedCompiler(IDiaSymbol* compiland) {
@@ -210,16 +231,7 @@ bool IsBuiltBySupportedCompiler(IDiaSymbol* compiland) {
   HRESULT hr = compiland_details->get_compilerName(compiler_name.Receive());
   DCHECK_EQ(S_OK, hr);
 
-  // Check the compiler name against the list of known compilers.
-  for (size_t i = 0; i < arraysize(kKnownCompilerInfos); ++i) {
-    if (::wcscmp(kKnownCompilerInfos[i].compiler_name, compiler_name) == 0) {
-      return kKnownCompilerInfos[i].supported;
-    }
-  }
-
-  // Anything we don't explicitly know about is not supported.
-  VLOG(1) << "Encountered unknown compiler: " << compiler_name;
-  return false;
+  return IsSupportedCompiler(compiler_name);
 }
 
 // Adds an intermediate reference to the provided vector. The vector is
@@ -236,26 +248,37 @@ bool AddIntermediateReference(IntermediateReferences* references,
   return true;
 }
 
-// Create a reference as specified. Ignores existing references if they are of
-// the exact same type.
-bool CreateReference(RelativeAddress src_addr,
-                     BlockGraph::Size ref_size,
-                     ReferenceType ref_type,
-                     RelativeAddress base_addr,
-                     RelativeAddress dst_addr,
-                     BlockGraph::AddressSpace* image) {
-  DCHECK_NE(reinterpret_cast<BlockGraph::AddressSpace*>(NULL), image);
+// A reference resolved against the image, ready to be set on its source block.
+struct ResolvedReference {
+  ResolvedReference() : src_block(NULL), src_offset(0) { }
+
+  Block* src_block;
+  Offset src_offset;
+  Reference ref;
+};
+typedef std::vector<ResolvedReference> ResolvedReferences;
+
+// Resolves a reference as specified, without modifying the image. This only
+// reads from @p image, so it may be called concurrently.
+bool ResolveReference(RelativeAddress src_addr,
+                      BlockGraph::Size ref_size,
+                      ReferenceType ref_type,
+                      RelativeAddress base_addr,
+                      RelativeAddress dst_addr,
+                      const BlockGraph::AddressSpace& image,
+                      ResolvedReference* resolved) {
+  DCHECK_NE(reinterpret_cast<ResolvedReference*>(NULL), resolved);
 
   // Get the source block and offset, and ensure that the reference fits
   // within it.
-  Block* src_block = image->GetBlockByAddress(src_addr);
+  Block* src_block = image.GetBlockByAddress(src_addr);
   if (src_block == NULL) {
     LOG(ERROR) << "Unable to find block for reference originating at "
                << src_addr << ".";
     return false;
   }
   RelativeAddress src_block_addr;
-  CHECK(image->GetAddressOf(src_block, &src_block_addr));
+  CHECK(image.GetAddressOf(src_block, &src_block_addr));
   Offset src_block_offset = src_addr - src_block_addr;
   if (src_block_offset + ref_size > src_block->size()) {
     LOG(ERROR) << "Reference originating at " << src_addr
@@ -264,32 +287,95 @@ bool CreateReference(RelativeAddress src_addr,
   }
 
   // Get the destination block and offset.
-  Block* dst_block = image->GetBlockByAddress(base_addr);
+  Block* dst_block = image.GetBlockByAddress(base_addr);
   if (dst_block == NULL) {
     LOG(ERROR) << "Unable to find block for reference pointing at "
                << base_addr << ".";
     return false;
   }
   RelativeAddress dst_block_addr;
-  CHECK(image->GetAddressOf(dst_block, &dst_block_addr));
+  CHECK(image.GetAddressOf(dst_block, &dst_block_addr));
   Offset base = base_addr - dst_block_addr;
   Offset offset = dst_addr - dst_block_addr;
 
-  Reference ref(ref_type, ref_size, dst_block, offset, base);
+  resolved->src_block = src_block;
+  resolved->src_offset = src_block_offset;
+  resolved->ref = Reference(ref_type, ref_size, dst_block, offset, base);
+
+  return true;
+}
+
+// Checks a resolved reference against the existing references of its source
+// block.
+// @param resolved the reference to check.
+// @param is_new is set to true if there is no reference at its source yet, and
+//     to false if there is an identical one.
+// @returns false if there is a conflicting reference at its source.
+bool CheckReference(const ResolvedReference& resolved, bool* is_new) {
+  DCHECK_NE(reinterpret_cast<Block*>(NULL), resolved.src_block);
+  DCHECK_NE(reinterpret_cast<bool*>(NULL), is_new);
+  Block* src_block = resolved.src_block;
 
   // Check if a reference already exists at this offset.
   Block::ReferenceMap::const_iterator ref_it =
-      src_block->references().find(src_block_offset);
-  if (ref_it != src_block->references().end()) {
-    // If an identical reference already exists then we're done.
-    if (ref == ref_it->second)
-      return true;
-    LOG(ERROR) << "Block \"" << src_block->name() << "\" has a conflicting "
-               << "reference at offset " << src_block_offset << ".";
+      src_block->references().find(resolved.src_offset);
+  if (ref_it == src_block->references().end()) {
+    *is_new = true;
+    return true;
+  }
+
+  // If an identical reference already exists then we're done.
+  if (resolved.ref == ref_it->second) {
+    *is_new = false;
+    return true;
+  }
+
+  LOG(ERROR) << "Block \"" << src_block->name() << "\" has a conflicting "
+             << "reference at offset " << resolved.src_offset << ".";
+  return false;
+}
+
+// Sets a resolved reference on its source block. Ignores existing references
+// if they are of the exact same type.
+bool CommitReference(const ResolvedReference& resolved) {
+  bool is_new = false;
+  if (!CheckReference(resolved, &is_new))
     return false;
+
+  if (is_new) {
+    CHECK(resolved.src_block->SetReference(resolved.src_offset,
+                                           resolved.ref));
   }
 
-  CHECK(src_block->SetReference(src_block_offset, ref));
+  return true;
+}
+
+// Orders the entries of a reference batch by their source.
+bool SourceLess(const Block::ReferenceBatch::value_type& a,
+                const Block::ReferenceBatch::value_type& b) {
+  return a.first < b.first;
+}
+
+// Resolves the intermediate references in the range [begin, end) of
+// @p references, storing them in the corresponding slots of @p resolved.
+bool ResolveIntermediateReferences(const IntermediateReferences* references,
+                                   const BlockGraph::AddressSpace* image,
+                                   ResolvedReferences* resolved,
+                                   size_t begin,
+                                   size_t end) {
+  DCHECK_NE(reinterpret_cast<const IntermediateReferences*>(NULL), references);
+  DCHECK_NE(reinterpret_cast<const BlockGraph::AddressSpace*>(NULL), image);
+  DCHECK_NE(reinterpret_cast<ResolvedReferences*>(NULL), resolved);
+  DCHECK_EQ(references->size(), resolved->size());
+
+  for (size_t i = begin; i < end; ++i) {
+    const IntermediateReference& ref = (*references)[i];
+    // This logs verbosely for us.
+    if (!ResolveReference(ref.src_addr, ref.size, ref.type, ref.dst_addr,
+                          ref.dst_addr, *image, &(*resolved)[i])) {
+      return false;
+    }
+  }
 
   return true;
 }
@@ -325,6 +411,65 @@ bool LoadDebugStreams(IDiaSession* dia_session,
   return true;
 }
 
+// Loads the debug stream with the given index in the DBI debug header. These
+// indices are -1 for streams that don't exist.
+template<typename T>
+SearchResult LoadPdbDebugStream(const pdb::PdbFile& pdb_file,
+                                int16 stream_index,
+                                std::vector<T>* list) {
+  DCHECK_NE(reinterpret_cast<std::vector<T>*>(NULL), list);
+
+  if (stream_index < 0)
+    return kSearchFailed;
+  scoped_refptr<pdb::PdbStream> stream = pdb_file.GetStream(stream_index);
+  if (stream.get() == NULL)
+    return kSearchFailed;
+
+  if (stream->length() % sizeof(T) != 0) {
+    LOG(ERROR) << "Debug stream " << stream_index << " has a length that is "
+               << "not a multiple of its record size.";
+    return kSearchErrored;
+  }
+
+  if (!stream->Seek(0) || !stream->Read(list)) {
+    LOG(ERROR) << "Failed to read debug stream " << stream_index << ".";
+    return kSearchErrored;
+  }
+
+  return kSearchSucceeded;
+}
+
+// Loads FIXUP and OMAP_FROM debug streams without DIA.
+bool LoadDebugStreams(const pdb::PdbFile& pdb_file,
+                      const pdb::DbiStream& dbi,
+                      PdbFixups* pdb_fixups,
+                      OMAPs* omap_from) {
+  DCHECK_NE(reinterpret_cast<PdbFixups*>(NULL), pdb_fixups);
+  DCHECK_NE(reinterpret_cast<OMAPs*>(NULL), omap_from);
+
+  // Load the fixups. These must exist.
+  SearchResult search_result = LoadPdbDebugStream(
+      pdb_file, dbi.dbg_header().fixup, pdb_fixups);
+  if (search_result != kSearchSucceeded) {
+    if (search_result == kSearchFailed) {
+      LOG(ERROR) << "PDB file does not contain a FIXUP stream. Module must be "
+                    "linked with '/PROFILE' or '/DEBUGINFO:FIXUP' flag.";
+    }
+    return false;
+  }
+
+  // Load the omap_from table. It is not necessary that one exist.
+  search_result = LoadPdbDebugStream(
+      pdb_file, dbi.dbg_header().omap_from_src, omap_from);
+  if (search_result == kSearchErrored) {
+    LOG(ERROR) << "Error trying to read " << kOmapFromDiaDebugStreamName
+               << " stream.";
+    return false;
+  }
+
+  return true;
+}
+
 bool GetFixupDestinationAndType(const PEFile& image_file,
                                 const pdb::PdbFixup& fixup,
                                 RelativeAddress* dst_addr,
@@ -372,109 +517,189 @@ bool GetFixupDestinationAndType(const PEFile& image_file,
   return true;
 }
 
+// The outcome of resolving a single PDB fixup.
+struct ResolvedFixup {
+  ResolvedFixup() : skipped(true), type(BlockGraph::RELATIVE_REF) { }
+
+  // True if the fixup is deliberately ignored.
+  bool skipped;
+  // The translated address at which the fixup originates.
+  RelativeAddress src_addr;
+  // The type of the fixup.
+  ReferenceType type;
+  // The reference corresponding to the fixup.
+  ResolvedReference reference;
+};
+
+// Resolves PDB fixups (translating them via the provided OMAP information if it
+// is not empty) against the image. Resolving only reads from the image, so
+// disjoint ranges of fixups may be resolved concurrently.
+//
+// @note This deliberately ignores fixup information for the resource section.
+//     This is because chrome.dll gets modified by a manifest tool which
+//     doesn't update the FIXUPs in the corresponding PDB. They are thus out of
+//     sync. Even if they were in sync this doesn't harm us as we have no need
+//     to reach in and modify resource data.
+class FixupResolver {
+ public:
+  FixupResolver(const PEFile& image_file,
+                const PdbFixups& pdb_fixups,
+                const OMAPs& omap_from,
+                const BlockGraph::AddressSpace& image)
+      : image_file_(image_file), pdb_fixups_(pdb_fixups),
+        omap_from_(omap_from), image_(image),
+        rsrc_start_(0xffffffff), rsrc_end_(0xffffffff),
+        resolved_fixups_(pdb_fixups.size()) {
+    // The resource section in Chrome is modified post-link by a tool that adds
+    // a manifest to it. This causes all of the fixups in the resource section
+    // (and anything beyond it) to be invalid. As long as the resource section
+    // is the last section in the image, this is not a problem (we can safely
+    // ignore the .rsrc fixups, which we know how to parse without them).
+    // However, if there is a section after the resource section, things will
+    // have been shifted and potentially crucial fixups will be invalid.
+    const IMAGE_SECTION_HEADER* rsrc_header = image_file.GetSectionHeader(
+        kResourceSectionName);
+    if (rsrc_header != NULL) {
+      rsrc_start_ = RelativeAddress(rsrc_header->VirtualAddress);
+      rsrc_end_ = rsrc_start_ + rsrc_header->Misc.VirtualSize;
+    }
+  }
+
+  // Resolves the fixups in the range [begin, end).
+  // @returns true on success, false otherwise.
+  bool Resolve(size_t begin, size_t end) {
+    DCHECK_LE(begin, end);
+    DCHECK_LE(end, pdb_fixups_.size());
+
+    bool have_omap = !omap_from_.empty();
+    for (size_t i = begin; i < end; ++i) {
+      const pdb::PdbFixup& fixup = pdb_fixups_[i];
+      ResolvedFixup* resolved = &resolved_fixups_[i];
+
+      // Ensure the fixup is valid.
+      if (!fixup.ValidHeader()) {
+        LOG(ERROR) << "Unknown fixup header: "
+                   << base::StringPrintf("0x%08X.", fixup.header);
+        return false;
+      }
+
+      // For now, we skip any offset fixups. We've only seen this in the
+      // context of TLS data access, and we don't mess with TLS structures.
+      if (fixup.is_offset())
+        continue;
+
+      // All fixups we handle should be full size pointers.
+      DCHECK_EQ(Reference::kMaximumSize, fixup.size());
+
+      // Get the original addresses, and map them through OMAP information.
+      // Normally DIA takes care of this for us, but there is no API for
+      // getting DIA to give us FIXUP information, so we have to do it
+      // manually.
+      RelativeAddress src_addr(fixup.rva_location);
+      RelativeAddress base_addr(fixup.rva_base);
+      if (have_omap) {
+        src_addr = pdb::TranslateAddressViaOmap(omap_from_, src_addr);
+        base_addr = pdb::TranslateAddressViaOmap(omap_from_, base_addr);
+      }
+
+      // If the reference originates beyond the .rsrc section then we can't
+      // trust it.
+      if (src_addr >= rsrc_end_) {
+        LOG(ERROR) << "Found fixup originating beyond .rsrc section.";
+        return false;
+      }
+
+      // If the reference originates from a part of the .rsrc section, ignore
+      // it.
+      if (src_addr >= rsrc_start_)
+        continue;
+
+      // Get the relative address/displacement of the fixup. This logs on
+      // failure.
+      RelativeAddress dst_addr;
+      if (!GetFixupDestinationAndType(image_file_, fixup, &dst_addr,
+                                      &resolved->type)) {
+        return false;
+      }
+
+      // Finally, resolve the reference. This logs verbosely for us on
+      // failure.
+      if (!ResolveReference(src_addr, Reference::kMaximumSize, resolved->type,
+                            base_addr, dst_addr, image_,
+                            &resolved->reference)) {
+        return false;
+      }
+
+      resolved->skipped = false;
+      resolved->src_addr = src_addr;
+    }
+
+    return true;
+  }
+
+  // @returns the resolved fixups, in the same order as the PDB fixups.
+  const std::vector<ResolvedFixup>& resolved_fixups() const {
+    return resolved_fixups_;
+  }
+
+ private:
+  const PEFile& image_file_;
+  const PdbFixups& pdb_fixups_;
+  const OMAPs& omap_from_;
+  const BlockGraph::AddressSpace& image_;
+
+  // The range of the resource section.
+  RelativeAddress rsrc_start_;
+  RelativeAddress rsrc_end_;
+
+  std::vector<ResolvedFixup> resolved_fixups_;
+
+  DISALLOW_COPY_AND_ASSIGN(FixupResolver);
+};
+
 // Creates references from the @p pdb_fixups (translating them via the
 // provided @p omap_from information if it is not empty), all while removing the
 // corresponding entries from @p reloc_set. If @p reloc_set is not empty after
 // this then the PDB fixups are out of sync with the image and we are unable to
-// safely decompose.
-//
-// @note This function deliberately ignores fixup information for the resource
-//     section. This is because chrome.dll gets modified by a manifest tool
-//     which doesn't update the FIXUPs in the corresponding PDB. They are thus
-//     out of sync. Even if they were in sync this doesn't harm us as we have no
-//     need to reach in and modify resource data.
+// safely decompose. The fixups are resolved using up to @p max_workers
+// threads, but the references are always created in fixup order.
 bool CreateReferencesFromFixupsImpl(
     const PEFile& image_file,
     const PdbFixups& pdb_fixups,
     const OMAPs& omap_from,
+    size_t max_workers,
     PEFile::RelocSet* reloc_set,
     BlockGraph::AddressSpace* image) {
   DCHECK_NE(reinterpret_cast<PEFile::RelocSet*>(NULL), reloc_set);
   DCHECK_NE(reinterpret_cast<BlockGraph::AddressSpace*>(NULL), image);
 
-  bool have_omap = !omap_from.empty();
-  size_t fixups_used = 0;
-
-  // The resource section in Chrome is modified post-link by a tool that adds a
-  // manifest to it. This causes all of the fixups in the resource section (and
-  // anything beyond it) to be invalid. As long as the resource section is the
-  // last section in the image, this is not a problem (we can safely ignore the
-  // .rsrc fixups, which we know how to parse without them). However, if there
-  // is a section after the resource section, things will have been shifted
-  // and potentially crucial fixups will be invalid.
-  const IMAGE_SECTION_HEADER* rsrc_header = image_file.GetSectionHeader(
-      kResourceSectionName);
-  RelativeAddress rsrc_start(0xffffffff);
-  RelativeAddress rsrc_end(0xffffffff);
-  if (rsrc_header != NULL) {
-    rsrc_start = RelativeAddress(rsrc_header->VirtualAddress);
-    rsrc_end = rsrc_start + rsrc_header->Misc.VirtualSize;
-  }
-
-  // Ensure the fixups are all valid.
-  for (size_t i = 0; i < pdb_fixups.size(); ++i) {
-    if (!pdb_fixups[i].ValidHeader()) {
-      LOG(ERROR) << "Unknown fixup header: "
-                 << base::StringPrintf("0x%08X.", pdb_fixups[i].header);
-      return false;
-    }
-
-    // For now, we skip any offset fixups. We've only seen this in the context
-    // of TLS data access, and we don't mess with TLS structures.
-    if (pdb_fixups[i].is_offset())
-      continue;
-
-    // All fixups we handle should be full size pointers.
-    DCHECK_EQ(Reference::kMaximumSize, pdb_fixups[i].size());
-
-    // Get the original addresses, and map them through OMAP information.
-    // Normally DIA takes care of this for us, but there is no API for
-    // getting DIA to give us FIXUP information, so we have to do it manually.
-    RelativeAddress src_addr(pdb_fixups[i].rva_location);
-    RelativeAddress base_addr(pdb_fixups[i].rva_base);
-    if (have_omap) {
-      src_addr = pdb::TranslateAddressViaOmap(omap_from, src_addr);
-      base_addr = pdb::TranslateAddressViaOmap(omap_from, base_addr);
-    }
-
-    // If the reference originates beyond the .rsrc section then we can't
-    // trust it.
-    if (src_addr >= rsrc_end) {
-      LOG(ERROR) << "Found fixup originating beyond .rsrc section.";
-      return false;
-    }
+  FixupResolver resolver(image_file, pdb_fixups, omap_from, *image);
+  if (!core::ProcessRangesInParallel(
+          "Decomposer", pdb_fixups.size(), max_workers,
+          base::Bind(&FixupResolver::Resolve, base::Unretained(&resolver)))) {
+    return false;
+  }
 
-    // If the reference originates from a part of the .rsrc section, ignore it.
-    if (src_addr >= rsrc_start)
+  for (size_t i = 0; i < resolver.resolved_fixups().size(); ++i) {
+    const ResolvedFixup& fixup = resolver.resolved_fixups()[i];
+    if (fixup.skipped)
       continue;
 
-    // Get the relative address/displacement of the fixup. This logs on failure.
-    RelativeAddress dst_addr;
-    ReferenceType type = BlockGraph::RELATIVE_REF;
-    if (!GetFixupDestinationAndType(image_file, pdb_fixups[i], &dst_addr,
-                                    &type)) {
+    // Create the reference. This logs verbosely for us on failure.
+    if (!CommitReference(fixup.reference))
       return false;
-    }
-
-    // Finally, create the reference. This logs verbosely for us on failure.
-    if (!CreateReference(src_addr, Reference::kMaximumSize, type, base_addr,
-                         dst_addr, image)) {
-      return false;
-    }
 
     // Remove this reference from the relocs.
-    PEFile::RelocSet::iterator reloc_it = reloc_set->find(src_addr);
+    PEFile::RelocSet::iterator reloc_it = reloc_set->find(fixup.src_addr);
     if (reloc_it != reloc_set->end()) {
       // We should only find a reloc if the fixup was of absolute type.
-      if (type != BlockGraph::ABSOLUTE_REF) {
+      if (fixup.type != BlockGraph::ABSOLUTE_REF) {
         LOG(ERROR) << "Found a reloc corresponding to a non-absolute fixup.";
         return false;
       }
 
       reloc_set->erase(reloc_it);
     }
-
-    ++fixups_used;
   }
 
   return true;
@@ -618,6 +843,223 @@ const SymbolType* ParseSymbol(uint16 symbol_length,
   return reinterpret_cast<const SymbolType*>(buffer->data());
 }
 
+// Returns the zero-terminated string at @p offset of a symbol read into
+// @p buffer. The string stops at the end of the symbol if it isn't terminated.
+std::string GetSymbolString(const std::vector<uint8>& buffer, size_t offset) {
+  if (offset >= buffer.size())
+    return std::string();
+  const char* begin = reinterpret_cast<const char*>(buffer.data());
+  const char* end = begin + buffer.size();
+  begin += offset;
+  return std::string(begin, std::find(begin, end, '\0'));
+}
+
+// Parses a symbol ending with a name, like ParseSymbol does. As names are
+// variable length the symbol only needs to hold the fields preceding it, and
+// @p name receives it.
+template<typename SymbolType>
+const SymbolType* ParseNamedSymbol(uint16 symbol_length,
+                                   pdb::PdbStream* stream,
+                                   std::vector<uint8>* buffer,
+                                   std::string* name) {
+  DCHECK_NE(reinterpret_cast<pdb::PdbStream*>(NULL), stream);
+  DCHECK_NE(reinterpret_cast<std::vector<uint8>*>(NULL), buffer);
+  DCHECK_NE(reinterpret_cast<std::string*>(NULL), name);
+
+  buffer->clear();
+
+  if (symbol_length < offsetof(SymbolType, name)) {
+    LOG(ERROR) << "Symbol too small for casting.";
+    return NULL;
+  }
+
+  if (!stream->Read(buffer, symbol_length)) {
+    LOG(ERROR) << "Failed to read symbol.";
+    return NULL;
+  }
+
+  *name = GetSymbolString(*buffer, offsetof(SymbolType, name));
+
+  // Pad the buffer so that the whole structure can be cast onto it.
+  if (buffer->size() < sizeof(SymbolType))
+    buffer->resize(sizeof(SymbolType));
+
+  return reinterpret_cast<const SymbolType*>(buffer->data());
+}
+
+// The fields that all symbols opening a scope start with. These are offsets
+// of symbols in the same stream.
+struct ScopeSymbolHeader {
+  uint32 parent;
+  uint32 end;
+};
+
+bool IsProcSymbol(uint16 symbol_type) {
+  switch (symbol_type) {
+    case cci::S_GPROC32:
+    case cci::S_LPROC32:
+    case cci::S_GPROC32_VS2013:
+    case cci::S_LPROC32_VS2013:
+      return true;
+    default:
+      return false;
+  }
+}
+
+// Returns true if the symbol opens a scope containing the symbols up to its
+// end symbol.
+bool IsScopeSymbol(uint16 symbol_type) {
+  switch (symbol_type) {
+    case cci::S_THUNK32:
+    case cci::S_BLOCK32:
+    case cci::S_WITH32:
+    case cci::S_SEPCODE:
+    case cci::S_INLINESITE:
+      return true;
+    default:
+      return IsProcSymbol(symbol_type);
+  }
+}
+
+// Converts the section and offset of a symbol to an address in the image. The
+// PDB numbers sections starting at index 1. Returns false if the symbol isn't
+// in a section of the image, as is the case for symbols without static
+// storage.
+bool GetSymbolAddress(const ImageLayout& image_layout,
+                      uint16 section,
+                      uint32 offset,
+                      RelativeAddress* addr) {
+  DCHECK_NE(reinterpret_cast<RelativeAddress*>(NULL), addr);
+
+  if (section == 0 || section > image_layout.sections.size())
+    return false;
+
+  *addr = image_layout.sections[section - 1].addr + offset;
+  return true;
+}
+
+// Parses an S_LDATA32 or S_GDATA32 symbol, getting its address, the size of
+// its type and its name. @p addr is set to zero for data without static
+// storage.
+bool ParseDataSymbol(const ImageLayout& image_layout,
+                     pdb::PdbStream* type_info,
+                     const pdb::TypeInfoRecordMap& type_info_records,
+                     const pdb::TypeDefinitionMap& type_definitions,
+                     uint16 symbol_length,
+                     pdb::PdbStream* stream,
+                     std::vector<uint8>* buffer,
+                     RelativeAddress* addr,
+                     size_t* length,
+                     std::string* name) {
+  DCHECK_NE(reinterpret_cast<pdb::PdbStream*>(NULL), type_info);
+  DCHECK_NE(reinterpret_cast<RelativeAddress*>(NULL), addr);
+  DCHECK_NE(reinterpret_cast<size_t*>(NULL), length);
+
+  const cci::DatasSym32* data =
+      ParseNamedSymbol<cci::DatasSym32>(symbol_length, stream, buffer, name);
+  if (data == NULL)
+    return false;
+
+  if (!GetSymbolAddress(image_layout, data->seg, data->off, addr))
+    *addr = RelativeAddress(0);
+
+  // Most class and structure typed data refers to a forward reference, which
+  // is looked through to the definition, as DIA does.
+  if (!pdb::GetTypeSize(type_info, type_info_records, type_definitions,
+                        data->typind, length)) {
+    LOG(ERROR) << "Failed to get the size of data symbol \"" << *name
+               << "\".";
+    return false;
+  }
+
+  return true;
+}
+
+// Gets the symbol stream of a module. Returns NULL if the module has no
+// symbols.
+scoped_refptr<pdb::PdbStream> GetModuleSymbolStream(
+    const pdb::PdbFile& pdb_file, const pdb::DbiModuleInfo& module) {
+  const pdb::DbiModuleInfoBase& info = module.module_info_base();
+  if (info.stream < 0 || info.symbol_bytes == 0)
+    return NULL;
+
+  scoped_refptr<pdb::PdbStream> stream = pdb_file.GetStream(info.stream);
+  if (stream.get() == NULL || !stream->Seek(0))
+    return NULL;
+
+  return stream;
+}
+
+// Gets the compiler name from a compiland details symbol. This stops the visit
+// by returning false as soon as it is found, with @p found set to true.
+bool VisitCompilandDetailsSymbol(std::string* compiler_name,
+                                 bool* found,
+                                 uint16 symbol_length,
+                                 uint16 symbol_type,
+                                 pdb::PdbStream* stream) {
+  DCHECK_NE(reinterpret_cast<std::string*>(NULL), compiler_name);
+  DCHECK_NE(reinterpret_cast<bool*>(NULL), found);
+  DCHECK_NE(reinterpret_cast<pdb::PdbStream*>(NULL), stream);
+
+  size_t name_offset = 0;
+  switch (symbol_type) {
+    case cci::S_COMPILE2:
+      name_offset = offsetof(cci::CompileSym, verSt);
+      break;
+    case cci::S_COMPILE3:
+      name_offset = offsetof(cci::CompileSym2, verSt);
+      break;
+    default:
+      return true;
+  }
+
+  std::vector<uint8> buffer;
+  if (symbol_length < name_offset || !stream->Read(&buffer, symbol_length)) {
+    LOG(ERROR) << "Failed to read compiland details symbol.";
+    return false;
+  }
+
+  *compiler_name = GetSymbolString(buffer, name_offset);
+  *found = true;
+  return false;
+}
+
+// Determines whether a module was built by a compiler that we whitelist,
+// using the first compiland details symbol of its symbol stream.
+bool IsModuleBuiltBySupportedCompiler(const pdb::PdbFile& pdb_file,
+                                      const pdb::DbiModuleInfo& module,
+                                      bool* supported) {
+  DCHECK_NE(reinterpret_cast<bool*>(NULL), supported);
+
+  *supported = false;
+  std::string compiler_name;
+  bool found = false;
+  scoped_refptr<pdb::PdbStream> stream =
+      GetModuleSymbolStream(pdb_file, module);
+  if (stream.get() != NULL) {
+    pdb::VisitSymbolsCallback callback = base::Bind(
+        &VisitCompilandDetailsSymbol,
+        base::Unretained(&compiler_name),
+        base::Unretained(&found));
+    if (!pdb::VisitSymbols(callback, module.module_info_base().symbol_bytes,
+                           true, stream.get()) && !found) {
+      LOG(ERROR) << "Failed to read the symbols of module \""
+                 << module.module_name() << "\".";
+      return false;
+    }
+  }
+
+  // If the module has no compiland details we assume the compiler is not
+  // supported.
+  if (!found) {
+    VLOG(1) << "Compiland has no compiland details: " << module.module_name();
+    return true;
+  }
+
+  *supported = IsSupportedCompiler(base::UTF8ToWide(compiler_name).c_str());
+  return true;
+}
+
 // If the given run of bytes consists of a single value repeated, returns that
 // value. Otherwise, returns -1.
 int RepeatedValue(const uint8* data, size_t size) {
@@ -780,6 +1222,7 @@ void GuessDataBlockAlignments(const PEFile& pe_file,
 // in symbol names but do not see whitespace. Thus, this provides a useful
 // separator that is also human friendly to read.
 const char Decomposer::kLabelNameSep[] = ", ";
+const uint32 Decomposer::kOutputVersion = 0;
 
 // This is by CreateBlocksFromCoffGroups to communicate shared state to
 // VisitLinkerSymbol via the VisitSymbols helper function.
@@ -808,9 +1251,82 @@ struct Decomposer::VisitLinkerSymbolContext {
   DISALLOW_COPY_AND_ASSIGN(VisitLinkerSymbolContext);
 };
 
+struct Decomposer::NativePdb {
+  pdb::PdbFile pdb_file;
+  pdb::DbiStream dbi;
+
+  // Whether each module of the DBI stream was built by a supported compiler.
+  std::vector<bool> supported_compilers;
+
+  // The type info stream, its records and the definitions of its forward
+  // references. These are used to get the size of data symbols.
+  scoped_refptr<pdb::PdbStream> type_info;
+  pdb::TypeInfoRecordMap type_info_records;
+  pdb::TypeDefinitionMap type_definitions;
+};
+
+// This is used by the native symbol parsing to communicate shared state to
+// VisitColdBlockSymbol and VisitModuleSymbol via the VisitSymbols helper
+// function. It keeps track of the scopes that enclose the current symbol.
+struct Decomposer::VisitModuleSymbolContext {
+  // A scope opened by a symbol, and that isn't closed yet.
+  struct Scope {
+    uint16 symbol_type;
+    // The offset of the symbol closing the scope.
+    uint32 end;
+    // The address and length of functions.
+    RelativeAddress addr;
+    size_t length;
+    // This is true for functions without static storage.
+    bool ignored;
+  };
+
+  const NativePdb* native_pdb;
+  std::vector<Scope> scopes;
+  // True while in a function without static storage. None of the symbols
+  // below such a function can be resolved.
+  bool in_ignored_function;
+  // The buffer symbols are read into.
+  std::vector<uint8> buffer;
+
+  explicit VisitModuleSymbolContext(const NativePdb* native_pdb)
+      : native_pdb(native_pdb), in_ignored_function(false) {
+  }
+
+  void OpenScope(uint16 symbol_type,
+                 uint32 end,
+                 RelativeAddress addr,
+                 size_t length,
+                 bool ignored) {
+    Scope scope = { symbol_type, end, addr, length, ignored };
+    scopes.push_back(scope);
+    if (ignored)
+      in_ignored_function = true;
+  }
+
+  // Closes the scopes that end at or before the symbol at @p offset.
+  // @returns true if the scope of a function or thunk was closed.
+  bool CloseScopes(size_t offset) {
+    bool closed_function = false;
+    while (!scopes.empty() && scopes.back().end <= offset) {
+      uint16 symbol_type = scopes.back().symbol_type;
+      if (IsProcSymbol(symbol_type) || symbol_type == cci::S_THUNK32) {
+        closed_function = true;
+        in_ignored_function = false;
+      }
+      scopes.pop_back();
+    }
+    return closed_function;
+  }
+
+ private:
+  DISALLOW_COPY_AND_ASSIGN(VisitModuleSymbolContext);
+};
+
 Decomposer::Decomposer(const PEFile& image_file)
-    : image_file_(image_file), image_layout_(NULL), image_(NULL),
-      current_block_(NULL), current_scope_count_(0) {
+    : image_file_(image_file), max_workers_(1), use_dia_(true),
+      image_layout_(NULL), image_(NULL), current_block_(NULL),
+      current_scope_count_(0) {
 }
 
 bool Decomposer::Decompose(ImageLayout* image_layout) {
@@ -978,24 +1494,78 @@ bool Decomposer::LoadBlockGraphFromPdb(const base::FilePath& pdb_path,
   return true;
 }
 
-bool Decomposer::DecomposeImpl() {
-  // Instantiate and initialize our Debug Interface Access session. This logs
-  // verbosely for us.
-  ScopedComPtr<IDiaDataSource> dia_source;
-  ScopedComPtr<IDiaSession> dia_session;
-  ScopedComPtr<IDiaSymbol> global;
-  if (!InitializeDia(image_file_, pdb_path_, dia_source.Receive(),
-                     dia_session.Receive(), global.Receive())) {
+bool Decomposer::LoadNativePdb(NativePdb* native_pdb) {
+  DCHECK_NE(reinterpret_cast<NativePdb*>(NULL), native_pdb);
+
+  pdb::PdbReader pdb_reader;
+  pdb_reader.set_use_memory_mapping(true);
+  if (!pdb_reader.Read(pdb_path_, &native_pdb->pdb_file)) {
+    LOG(ERROR) << "Failed to load PDB: " << pdb_path_.value();
     return false;
   }
 
-  // Copy the image headers to the layout.
-  CopySectionHeadersToImageLayout(
-      image_file_.nt_headers()->FileHeader.NumberOfSections,
-      image_file_.section_headers(),
-      &(image_layout_->sections));
-
-  // Create the sections in the underlying block-graph.
+  // Read the entire DBI stream into memory before parsing it. This makes
+  // parsing much faster.
+  scoped_refptr<pdb::PdbStream> stream =
+      native_pdb->pdb_file.GetStream(pdb::kDbiStream);
+  scoped_refptr<pdb::PdbByteStream> dbi_stream(new pdb::PdbByteStream());
+  if (stream.get() == NULL || !dbi_stream->Init(stream.get()) ||
+      !native_pdb->dbi.Read(dbi_stream.get())) {
+    LOG(ERROR) << "Unable to parse DBI stream.";
+    return false;
+  }
+
+  native_pdb->type_info = native_pdb->pdb_file.GetStream(pdb::kTpiStream);
+  pdb::TypeInfoHeader type_info_header = {};
+  if (native_pdb->type_info.get() == NULL ||
+      !pdb::ReadTypeInfoStream(native_pdb->type_info.get(), &type_info_header,
+                               &native_pdb->type_info_records) ||
+      !pdb::GetTypeDefinitions(native_pdb->type_info.get(),
+                               native_pdb->type_info_records,
+                               &native_pdb->type_definitions)) {
+    LOG(ERROR) << "Unable to parse type info stream.";
+    return false;
+  }
+
+  const pdb::DbiStream::DbiModuleVector& modules = native_pdb->dbi.modules();
+  native_pdb->supported_compilers.resize(modules.size());
+  for (size_t i = 0; i < modules.size(); ++i) {
+    bool supported = false;
+    if (!IsModuleBuiltBySupportedCompiler(native_pdb->pdb_file, modules[i],
+                                          &supported)) {
+      return false;
+    }
+    native_pdb->supported_compilers[i] = supported;
+  }
+
+  return true;
+}
+
+bool Decomposer::DecomposeImpl() {
+  // Instantiate and initialize our Debug Interface Access session, or read
+  // the PDB streams used in its stead. These log verbosely for us.
+  ScopedComPtr<IDiaDataSource> dia_source;
+  ScopedComPtr<IDiaSession> dia_session;
+  ScopedComPtr<IDiaSymbol> global;
+  scoped_ptr<NativePdb> native_pdb;
+  if (use_dia_) {
+    if (!InitializeDia(image_file_, pdb_path_, dia_source.Receive(),
+                       dia_session.Receive(), global.Receive())) {
+      return false;
+    }
+  } else {
+    native_pdb.reset(new NativePdb());
+    if (!LoadNativePdb(native_pdb.get()))
+      return false;
+  }
+
+  // Copy the image headers to the layout.
+  CopySectionHeadersToImageLayout(
+      image_file_.nt_headers()->FileHeader.NumberOfSections,
+      image_file_.section_headers(),
+      &(image_layout_->sections));
+
+  // Create the sections in the underlying block-graph.
   if (!CopySectionInfoToBlockGraph(image_file_, image_->graph()))
     return false;
 
@@ -1020,11 +1590,17 @@ bool Decomposer::DecomposeImpl() {
     // existing PE parsed blocks, but when they do we expect them to be exact
     // collisions.
     VLOG(1) << "Parsing section contributions.";
-    if (!CreateBlocksFromSectionContribs(dia_session.get()))
+    bool created = use_dia_ ?
+        CreateBlocksFromSectionContribs(dia_session.get()) :
+        CreateBlocksFromSectionContribs(*native_pdb);
+    if (!created)
       return false;
 
     VLOG(1) << "Finding cold blocks.";
-    if (!FindColdBlocksFromCompilands(dia_session.get()))
+    bool found = use_dia_ ?
+        FindColdBlocksFromCompilands(dia_session.get()) :
+        FindColdBlocksFromCompilands(*native_pdb);
+    if (!found)
       return false;
 
     // Flesh out the rest of the image with gap blocks.
@@ -1040,12 +1616,18 @@ bool Decomposer::DecomposeImpl() {
 
   // Parse the fixups and use them to create references.
   VLOG(1) << "Parsing fixups.";
-  if (!CreateReferencesFromFixups(dia_session.get()))
+  bool created = use_dia_ ?
+      CreateReferencesFromFixups(dia_session.get()) :
+      CreateReferencesFromFixups(*native_pdb);
+  if (!created)
     return false;
 
   // Annotate the block-graph with symbol information.
   VLOG(1) << "Parsing symbols.";
-  if (!ProcessSymbols(global.get()))
+  bool processed = use_dia_ ?
+      ProcessSymbols(global.get()) :
+      ProcessSymbols(*native_pdb);
+  if (!processed)
     return false;
 
   // Now, find and label any padding blocks.
@@ -1188,45 +1770,53 @@ bool Decomposer::CreateBlocksFromSectionContribs(IDiaSession* session) {
       return false;
     }
 
-    // Give a name to the block based on the basename of the object file. This
-    // will eventually be replaced by the full symbol name, if one exists for
-    // the block.
-    size_t last_component = compiland_name.find_last_of('\\');
-    size_t extension = compiland_name.find_last_of('.');
-    if (last_component == std::string::npos) {
-      last_component = 0;
-    } else {
-      // We don't want to include the last slash.
-      ++last_component;
+    BlockType block_type =
+        code ? BlockGraph::CODE_BLOCK : BlockGraph::DATA_BLOCK;
+    if (!CreateSectionContribBlock(block_type, RelativeAddress(rva), length,
+                                   compiland_name,
+                                   is_built_by_supported_compiler)) {
+      return false;
     }
-    if (extension < last_component)
-      extension = compiland_name.size();
-    std::string name = compiland_name.substr(last_component,
-                                             extension - last_component);
+  }
 
-    // TODO(chrisha): We see special section contributions with the name
-    //     "* CIL *". These are concatenations of data symbols and can very
-    //     likely be chunked using symbols directly. A cursory visual inspection
-    //     of symbol names hints that these might be related to WPO.
+  return true;
+}
 
-    // Create the block.
-    BlockType block_type =
-        code ? BlockGraph::CODE_BLOCK : BlockGraph::DATA_BLOCK;
-    Block* block = CreateBlockOrFindCoveringPeBlock(
-        block_type, RelativeAddress(rva), length, name);
-    if (block == NULL) {
-      LOG(ERROR) << "Unable to create block for compiland \""
-                 << compiland_name << "\".";
+bool Decomposer::CreateBlocksFromSectionContribs(const NativePdb& native_pdb) {
+  size_t rsrc_id = image_file_.GetSectionIndex(kResourceSectionName);
+  size_t num_sections = image_layout_->sections.size();
+  const pdb::DbiStream::DbiModuleVector& modules = native_pdb.dbi.modules();
+  const pdb::DbiStream::DbiSectionContribVector& section_contribs =
+      native_pdb.dbi.section_contribs();
+
+  for (size_t i = 0; i < section_contribs.size(); ++i) {
+    const pdb::DbiSectionContrib& section_contrib = section_contribs[i];
+
+    // The PDB numbers sections from 1 to n, while we do 0 to n - 1.
+    if (section_contrib.section <= 0 ||
+        static_cast<size_t>(section_contrib.section) > num_sections ||
+        section_contrib.module < 0 ||
+        static_cast<size_t>(section_contrib.module) >= modules.size() ||
+        section_contrib.size < 0) {
+      LOG(ERROR) << "Invalid section contribution " << i << ".";
       return false;
     }
+    size_t section_id = section_contrib.section - 1;
 
-    // Set the block compiland name.
-    block->set_compiland_name(compiland_name);
+    // We don't parse the resource section, as it is parsed by the PEFileParser.
+    if (section_id == rsrc_id)
+      continue;
 
-    // Set the block attributes.
-    block->set_attribute(BlockGraph::SECTION_CONTRIB);
-    if (!is_built_by_supported_compiler)
-      block->set_attribute(BlockGraph::BUILT_BY_UNSUPPORTED_COMPILER);
+    RelativeAddress rva =
+        image_layout_->sections[section_id].addr + section_contrib.offset;
+    BlockType block_type = (section_contrib.flags & IMAGE_SCN_CNT_CODE) != 0 ?
+        BlockGraph::CODE_BLOCK : BlockGraph::DATA_BLOCK;
+    if (!CreateSectionContribBlock(
+            block_type, rva, section_contrib.size,
+            modules[section_contrib.module].module_name(),
+            native_pdb.supported_compilers[section_contrib.module])) {
+      return false;
+    }
   }
 
   return true;
@@ -1317,36 +1907,37 @@ bool Decomposer::FindColdBlocksFromCompilands(IDiaSession* session) {
         return false;
       }
 
-      // Retrieve the function block.
-      Block* func_block = image_->GetBlockByAddress(RelativeAddress(func_rva));
-      if (func_block == NULL) {
-        LOG(ERROR) << "Cannot retrieve parent block.";
-        return false;
-      }
-
-      // Skip blocks within the range of its parent.
-      if (block_rva >= func_rva && block_rva <= func_rva + func_length)
-        continue;
-
-      // A cold block is detected and needs special handling.
-      Block* cold_block = image_->GetBlockByAddress(RelativeAddress(block_rva));
-      if (cold_block == NULL) {
-        LOG(ERROR) << "Cannot retrieve parent block.";
+      if (!AddColdBlock(RelativeAddress(func_rva),
+                        static_cast<size_t>(func_length),
+                        RelativeAddress(block_rva))) {
         return false;
       }
+    }
+  }
 
-      RelativeAddress cold_block_addr;
-      if (!image_->GetAddressOf(cold_block, &cold_block_addr)) {
-        LOG(ERROR) << "Cannot retrieve cold block address.";
-        return false;
-      }
+  return true;
+}
 
-      // Add cold_block as a child of the function block.
-      cold_blocks_[func_block][cold_block_addr] = cold_block;
+bool Decomposer::FindColdBlocksFromCompilands(const NativePdb& native_pdb) {
+  // Cold blocks are found as in the DIA case, from the lexical blocks directly
+  // below the functions of each module.
+  const pdb::DbiStream::DbiModuleVector& modules = native_pdb.dbi.modules();
+  for (size_t i = 0; i < modules.size(); ++i) {
+    scoped_refptr<pdb::PdbStream> stream =
+        GetModuleSymbolStream(native_pdb.pdb_file, modules[i]);
+    if (stream.get() == NULL)
+      continue;
 
-      // Set the parent relation for blocks belonging to the function block.
-      cold_blocks_parent_[func_block] = func_block;
-      cold_blocks_parent_[cold_block] = func_block;
+    VisitModuleSymbolContext context(&native_pdb);
+    pdb::VisitSymbolsCallback callback = base::Bind(
+        &Decomposer::VisitColdBlockSymbol,
+        base::Unretained(this),
+        base::Unretained(&context));
+    if (!pdb::VisitSymbols(callback, modules[i].module_info_base().symbol_bytes,
+                           true, stream.get())) {
+      LOG(ERROR) << "Failed to read the symbols of module \""
+                 << modules[i].module_name() << "\".";
+      return false;
     }
   }
 
@@ -1390,17 +1981,52 @@ bool Decomposer::CreateGapBlocks() {
 
 bool Decomposer::FinalizeIntermediateReferences(
     const IntermediateReferences& references) {
-  for (size_t i = 0; i < references.size(); ++i) {
+  ResolvedReferences resolved(references.size());
+  if (!core::ProcessRangesInParallel(
+          "Decomposer", references.size(), max_workers_,
+          base::Bind(&ResolveIntermediateReferences,
+                     base::Unretained(&references),
+                     base::Unretained(image_),
+                     base::Unretained(&resolved)))) {
+    return false;
+  }
+
+  // Set the new references as a single batch, so that each referenced block
+  // sorts in its new referrers once rather than taking them one at a time.
+  Block::ReferenceBatch batch;
+  batch.reserve(resolved.size());
+  for (size_t i = 0; i < resolved.size(); ++i) {
+    bool is_new = false;
     // This logs verbosely for us.
-    if (!CreateReference(references[i].src_addr,
-                         references[i].size,
-                         references[i].type,
-                         references[i].dst_addr,
-                         references[i].dst_addr,
-                         image_)) {
+    if (!CheckReference(resolved[i], &is_new))
+      return false;
+    if (is_new) {
+      batch.push_back(std::make_pair(
+          Block::Referrer(resolved[i].src_block, resolved[i].src_offset),
+          resolved[i].ref));
+    }
+  }
+
+  // Several intermediate references may resolve to the same source. Sorting
+  // by source brings these together, and also lets each block take its
+  // references in order.
+  std::stable_sort(batch.begin(), batch.end(), &SourceLess);
+  size_t count = 0;
+  for (size_t i = 0; i < batch.size(); ++i) {
+    if (count > 0 && batch[count - 1].first == batch[i].first) {
+      if (batch[count - 1].second == batch[i].second)
+        continue;
+      LOG(ERROR) << "Block \"" << batch[i].first.first->name() << "\" has a "
+                 << "conflicting reference at offset "
+                 << batch[i].first.second << ".";
       return false;
     }
+    batch[count++] = batch[i];
   }
+  batch.erase(batch.begin() + count, batch.end());
+
+  Block::SetReferences(batch);
+
   return true;
 }
 
@@ -1420,7 +2046,33 @@ bool Decomposer::CreateReferencesFromFixups(IDiaSession* session) {
   // corresponding reference data from the relocs. We use this as a kind of
   // double-entry bookkeeping to ensure all is well and right in the world.
   if (!CreateReferencesFromFixupsImpl(image_file_, fixups, omap_from,
-                                      &reloc_set, image_)) {
+                                      max_workers_, &reloc_set, image_)) {
+    return false;
+  }
+
+  if (!reloc_set.empty()) {
+    LOG(ERROR) << "Found reloc entries without matching FIXUP entries.";
+    return false;
+  }
+
+  return true;
+}
+
+bool Decomposer::CreateReferencesFromFixups(const NativePdb& native_pdb) {
+  PEFile::RelocSet reloc_set;
+  if (!image_file_.DecodeRelocs(&reloc_set))
+    return false;
+
+  OMAPs omap_from;
+  PdbFixups fixups;
+  if (!LoadDebugStreams(native_pdb.pdb_file, native_pdb.dbi, &fixups,
+                        &omap_from)) {
+    return false;
+  }
+
+  // This uses the same double-entry bookkeeping as when using DIA.
+  if (!CreateReferencesFromFixupsImpl(image_file_, fixups, omap_from,
+                                      max_workers_, &reloc_set, image_)) {
     return false;
   }
 
@@ -1488,6 +2140,67 @@ bool Decomposer::ProcessSymbols(IDiaSymbol* root) {
   return dia_browser.Browse(root);
 }
 
+bool Decomposer::ProcessSymbols(const NativePdb& native_pdb) {
+  // Start with the symbols of the modules, which hold functions and all the
+  // symbols below them, as well as compiland scope data and labels.
+  const pdb::DbiStream::DbiModuleVector& modules = native_pdb.dbi.modules();
+  for (size_t i = 0; i < modules.size(); ++i) {
+    scoped_refptr<pdb::PdbStream> stream =
+        GetModuleSymbolStream(native_pdb.pdb_file, modules[i]);
+    if (stream.get() == NULL)
+      continue;
+
+    VisitModuleSymbolContext context(&native_pdb);
+    pdb::VisitSymbolsCallback callback = base::Bind(
+        &Decomposer::VisitModuleSymbol,
+        base::Unretained(this),
+        base::Unretained(&context));
+    if (!pdb::VisitSymbols(callback, modules[i].module_info_base().symbol_bytes,
+                           true, stream.get())) {
+      LOG(ERROR) << "Failed to read the symbols of module \""
+                 << modules[i].module_name() << "\".";
+      return false;
+    }
+
+    // Close a function whose end symbol is missing.
+    if (current_block_ != NULL)
+      EndFunctionOrThunkSymbol();
+  }
+
+  // Then visit the global symbol stream twice, for global data followed by
+  // public symbols. This gives labels the same names as when using DIA.
+  int16 symbol_record_stream = native_pdb.dbi.header().symbol_record_stream;
+  scoped_refptr<pdb::PdbStream> stream;
+  if (symbol_record_stream >= 0)
+    stream = native_pdb.pdb_file.GetStream(symbol_record_stream);
+  if (stream.get() == NULL) {
+    LOG(ERROR) << "PDB does not contain a symbol record stream.";
+    return false;
+  }
+
+  pdb::VisitSymbolsCallback on_global_data_symbol = base::Bind(
+      &Decomposer::VisitGlobalDataSymbol,
+      base::Unretained(this),
+      base::Unretained(&native_pdb));
+  if (!stream->Seek(0) ||
+      !pdb::VisitSymbols(on_global_data_symbol, stream->length(), false,
+                         stream.get())) {
+    LOG(ERROR) << "Failed to read global data symbols.";
+    return false;
+  }
+
+  pdb::VisitSymbolsCallback on_public_symbol = base::Bind(
+      &Decomposer::VisitPublicSymbol, base::Unretained(this));
+  if (!stream->Seek(0) ||
+      !pdb::VisitSymbols(on_public_symbol, stream->length(), false,
+                         stream.get())) {
+    LOG(ERROR) << "Failed to read public symbols.";
+    return false;
+  }
+
+  return true;
+}
+
 bool Decomposer::VisitLinkerSymbol(VisitLinkerSymbolContext* context,
                                       uint16 symbol_length,
                                       uint16 symbol_type,
@@ -1570,6 +2283,290 @@ bool Decomposer::VisitLinkerSymbol(VisitLinkerSymbolContext* context,
   return true;
 }
 
+bool Decomposer::VisitColdBlockSymbol(VisitModuleSymbolContext* context,
+                                      uint16 symbol_length,
+                                      uint16 symbol_type,
+                                      pdb::PdbStream* stream) {
+  DCHECK_NE(reinterpret_cast<VisitModuleSymbolContext*>(NULL), context);
+  DCHECK_NE(reinterpret_cast<pdb::PdbStream*>(NULL), stream);
+
+  // The stream is positioned past the length and type of the symbol.
+  context->CloseScopes(stream->pos() - 2 * sizeof(uint16));
+
+  std::string name;
+  if (IsProcSymbol(symbol_type)) {
+    const cci::ProcSym32* proc = ParseNamedSymbol<cci::ProcSym32>(
+        symbol_length, stream, &context->buffer, &name);
+    if (proc == NULL)
+      return false;
+    RelativeAddress addr;
+    bool is_static = GetSymbolAddress(*image_layout_, proc->seg, proc->off,
+                                      &addr);
+    context->OpenScope(symbol_type, proc->end, addr, proc->len, !is_static);
+    return true;
+  }
+
+  if (symbol_type == cci::S_BLOCK32) {
+    const cci::BlockSym32* block = ParseNamedSymbol<cci::BlockSym32>(
+        symbol_length, stream, &context->buffer, &name);
+    if (block == NULL)
+      return false;
+    RelativeAddress block_addr;
+    bool is_static = GetSymbolAddress(*image_layout_, block->seg, block->off,
+                                      &block_addr);
+
+    // Only consider the blocks of functions with static storage.
+    bool is_function_block = false;
+    RelativeAddress func_addr;
+    size_t func_length = 0;
+    if (!context->scopes.empty()) {
+      const VisitModuleSymbolContext::Scope& parent = context->scopes.back();
+      is_function_block = IsProcSymbol(parent.symbol_type) && !parent.ignored;
+      func_addr = parent.addr;
+      func_length = parent.length;
+    }
+    context->OpenScope(symbol_type, block->end, block_addr, block->len, false);
+
+    if (!is_function_block || !is_static)
+      return true;
+    return AddColdBlock(func_addr, func_length, block_addr);
+  }
+
+  if (IsScopeSymbol(symbol_type)) {
+    const ScopeSymbolHeader* header = ParseSymbol<ScopeSymbolHeader>(
+        symbol_length, stream, &context->buffer);
+    if (header == NULL)
+      return false;
+    context->OpenScope(symbol_type, header->end, RelativeAddress(0), 0, false);
+  }
+
+  return true;
+}
+
+bool Decomposer::VisitModuleSymbol(VisitModuleSymbolContext* context,
+                                   uint16 symbol_length,
+                                   uint16 symbol_type,
+                                   pdb::PdbStream* stream) {
+  DCHECK_NE(reinterpret_cast<VisitModuleSymbolContext*>(NULL), context);
+  DCHECK_NE(reinterpret_cast<pdb::PdbStream*>(NULL), stream);
+
+  // The stream is positioned past the length and type of the symbol.
+  if (context->CloseScopes(stream->pos() - 2 * sizeof(uint16)) &&
+      current_block_ != NULL) {
+    EndFunctionOrThunkSymbol();
+  }
+
+  std::string name;
+  RelativeAddress addr;
+  switch (symbol_type) {
+    case cci::S_GPROC32:
+    case cci::S_LPROC32:
+    case cci::S_GPROC32_VS2013:
+    case cci::S_LPROC32_VS2013: {
+      const cci::ProcSym32* proc = ParseNamedSymbol<cci::ProcSym32>(
+          symbol_length, stream, &context->buffer, &name);
+      if (proc == NULL)
+        return false;
+
+      // We only care about functions with static storage. The symbols below
+      // the others are ignored, as we won't be able to resolve them either.
+      bool is_static = GetSymbolAddress(*image_layout_, proc->seg, proc->off,
+                                        &addr);
+      context->OpenScope(symbol_type, proc->end, addr, proc->len, !is_static);
+      if (!is_static)
+        return true;
+
+      BlockGraph::BlockAttributes attributes = 0;
+      if ((proc->flags & cci::CV_PFLAG_NEVER) != 0)
+        attributes |= BlockGraph::NON_RETURN_FUNCTION;
+      if (!ProcessFunctionOrThunkSymbol(addr, proc->len, name, attributes))
+        return false;
+
+      // DIA reports the debug start and end of functions as child symbols.
+      return ProcessScopeSymbol(SymTagFuncDebugStart, addr + proc->dbgStart,
+                                0) &&
+          ProcessScopeSymbol(SymTagFuncDebugEnd, addr + proc->dbgEnd, 0);
+    }
+
+    case cci::S_THUNK32: {
+      const cci::ThunkSym32* thunk = ParseNamedSymbol<cci::ThunkSym32>(
+          symbol_length, stream, &context->buffer, &name);
+      if (thunk == NULL)
+        return false;
+
+      bool is_static = GetSymbolAddress(*image_layout_, thunk->seg, thunk->off,
+                                        &addr);
+      context->OpenScope(symbol_type, thunk->end, addr, thunk->len,
+                         !is_static);
+      if (!is_static)
+        return true;
+
+      return ProcessFunctionOrThunkSymbol(addr, thunk->len, name,
+                                          BlockGraph::THUNK);
+    }
+
+    case cci::S_BLOCK32: {
+      const cci::BlockSym32* block = ParseNamedSymbol<cci::BlockSym32>(
+          symbol_length, stream, &context->buffer, &name);
+      if (block == NULL)
+        return false;
+      context->OpenScope(symbol_type, block->end, RelativeAddress(0), 0,
+                         false);
+
+      // Only the scopes of functions are labeled.
+      if (current_block_ == NULL ||
+          !GetSymbolAddress(*image_layout_, block->seg, block->off, &addr)) {
+        return true;
+      }
+
+      // Scopes outside of the function block, such as cold blocks, are not
+      // labeled.
+      if (!InRangeIncl(addr, current_address_, current_block_->size()) ||
+          !InRangeIncl(addr + block->len, current_address_,
+                       current_block_->size())) {
+        VLOG(1) << "Scope falls outside of current block \""
+                << current_block_->name() << "\".";
+        return true;
+      }
+
+      return ProcessScopeSymbol(SymTagBlock, addr, block->len);
+    }
+
+    case cci::S_WITH32:
+    case cci::S_SEPCODE:
+    case cci::S_INLINESITE: {
+      const ScopeSymbolHeader* header = ParseSymbol<ScopeSymbolHeader>(
+          symbol_length, stream, &context->buffer);
+      if (header == NULL)
+        return false;
+      context->OpenScope(symbol_type, header->end, RelativeAddress(0), 0,
+                         false);
+      return true;
+    }
+
+    case cci::S_FRAMEPROC: {
+      if (current_block_ == NULL)
+        return true;
+
+      const cci::FrameProcSym* frame = ParseSymbol<cci::FrameProcSym>(
+          symbol_length, stream, &context->buffer);
+      if (frame == NULL)
+        return false;
+
+      if ((frame->flags & cci::fHasInlAsm) != 0)
+        current_block_->set_attribute(BlockGraph::HAS_INLINE_ASSEMBLY);
+      if ((frame->flags & (cci::fHasEH | cci::fHasSEH)) != 0)
+        current_block_->set_attribute(BlockGraph::HAS_EXCEPTION_HANDLING);
+      return true;
+    }
+
+    case cci::S_LABEL32: {
+      if (context->in_ignored_function)
+        return true;
+
+      const cci::LabelSym32* label = ParseNamedSymbol<cci::LabelSym32>(
+          symbol_length, stream, &context->buffer, &name);
+      if (label == NULL)
+        return false;
+      if (!GetSymbolAddress(*image_layout_, label->seg, label->off, &addr))
+        return true;
+
+      return ProcessLabelSymbol(addr, name);
+    }
+
+    case cci::S_LDATA32:
+    case cci::S_GDATA32: {
+      if (context->in_ignored_function)
+        return true;
+
+      size_t length = 0;
+      if (!ParseDataSymbol(*image_layout_,
+                           context->native_pdb->type_info.get(),
+                           context->native_pdb->type_info_records,
+                           context->native_pdb->type_definitions,
+                           symbol_length, stream, &context->buffer, &addr,
+                           &length, &name)) {
+        return false;
+      }
+
+      // Symbols with an address of zero are essentially invalid, or don't have
+      // static storage.
+      if (addr == RelativeAddress(0))
+        return true;
+
+      return ProcessDataSymbol(addr, length, name, false);
+    }
+
+    case cci::S_CALLSITEINFO: {
+      if (current_block_ == NULL)
+        return true;
+
+      const cci::CallsiteInfo* call_site = ParseSymbol<cci::CallsiteInfo>(
+          symbol_length, stream, &context->buffer);
+      if (call_site == NULL)
+        return false;
+      if (!GetSymbolAddress(*image_layout_, call_site->ect, call_site->off,
+                            &addr)) {
+        return true;
+      }
+
+      return ProcessCallSiteSymbol(addr);
+    }
+
+    default:
+      return true;
+  }
+}
+
+bool Decomposer::VisitGlobalDataSymbol(const NativePdb* native_pdb,
+                                       uint16 symbol_length,
+                                       uint16 symbol_type,
+                                       pdb::PdbStream* stream) {
+  DCHECK_NE(reinterpret_cast<const NativePdb*>(NULL), native_pdb);
+  DCHECK_NE(reinterpret_cast<pdb::PdbStream*>(NULL), stream);
+
+  if (symbol_type != cci::S_LDATA32 && symbol_type != cci::S_GDATA32)
+    return true;
+
+  std::vector<uint8> buffer;
+  RelativeAddress addr;
+  size_t length = 0;
+  std::string name;
+  if (!ParseDataSymbol(*image_layout_, native_pdb->type_info.get(),
+                       native_pdb->type_info_records,
+                       native_pdb->type_definitions, symbol_length, stream,
+                       &buffer, &addr, &length, &name)) {
+    return false;
+  }
+
+  if (addr == RelativeAddress(0))
+    return true;
+
+  return ProcessDataSymbol(addr, length, name, true);
+}
+
+bool Decomposer::VisitPublicSymbol(uint16 symbol_length,
+                                   uint16 symbol_type,
+                                   pdb::PdbStream* stream) {
+  DCHECK_NE(reinterpret_cast<pdb::PdbStream*>(NULL), stream);
+
+  if (symbol_type != cci::S_PUB32)
+    return true;
+
+  std::vector<uint8> buffer;
+  std::string name;
+  const cci::PubSym32* pub =
+      ParseNamedSymbol<cci::PubSym32>(symbol_length, stream, &buffer, &name);
+  if (pub == NULL)
+    return false;
+
+  RelativeAddress addr;
+  if (!GetSymbolAddress(*image_layout_, pub->seg, pub->off, &addr))
+    return true;
+
+  return ProcessPublicSymbol(addr, name);
+}
+
 DiaBrowser::BrowserDirective Decomposer::OnPushFunctionOrThunkSymbol(
     const DiaBrowser& dia_browser,
     const DiaBrowser::SymTagVector& sym_tags,
@@ -1578,10 +2575,6 @@ DiaBrowser::BrowserDirective Decomposer::OnPushFunctionOrThunkSymbol(
   DCHECK_EQ(sym_tags.size(), symbols.size());
   DiaBrowser::SymbolPtr symbol = symbols.back();
 
-  DCHECK_EQ(reinterpret_cast<Block*>(NULL), current_block_);
-  DCHECK_EQ(current_address_, RelativeAddress(0));
-  DCHECK_EQ(0u, current_scope_count_);
-
   HRESULT hr = E_FAIL;
   DWORD location_type = LocIsNull;
   DWORD rva = 0;
@@ -1601,43 +2594,17 @@ DiaBrowser::BrowserDirective Decomposer::OnPushFunctionOrThunkSymbol(
   if (location_type != LocIsStatic)
     return DiaBrowser::kBrowserTerminatePath;
 
-  RelativeAddress addr(rva);
-  Block* block = image_->GetBlockByAddress(addr);
-  CHECK(block != NULL);
-  RelativeAddress block_addr;
-  CHECK(image_->GetAddressOf(block, &block_addr));
-  DCHECK(InRange(addr, block_addr, block->size()));
-
   std::string name;
   if (!base::WideToUTF8(name_bstr, name_bstr.Length(), &name)) {
     LOG(ERROR) << "Failed to convert function/thunk name to UTF8.";
     return DiaBrowser::kBrowserAbort;
   }
 
-  // We know the function starts in this block but we need to make sure its
-  // end does not extend past the end of the block.
-  if (addr + length > block_addr + block->size()) {
-    LOG(ERROR) << "Got function/thunk \"" << name << "\" that is not contained "
-               << "by section contribution \"" << block->name() << "\".";
-    return DiaBrowser::kBrowserAbort;
-  }
-
-  Offset offset = addr - block_addr;
-  if (!AddLabelToBlock(offset, name, BlockGraph::CODE_LABEL, block))
-    return DiaBrowser::kBrowserAbort;
-
-  // Keep track of the generated block. We will use this when parsing symbols
-  // that belong to this function. This prevents us from having to do repeated
-  // lookups and also allows us to associate labels outside of the block to the
-  // correct block.
-  current_block_ = block;
-  current_address_ = block_addr;
-
-  // Certain properties are not defined on all blocks, so the following calls
-  // may return S_FALSE.
-  BOOL no_return = FALSE;
-  if (symbol->get_noReturn(&no_return) != S_OK)
-    no_return = FALSE;
+  // Certain properties are not defined on all blocks, so the following calls
+  // may return S_FALSE.
+  BOOL no_return = FALSE;
+  if (symbol->get_noReturn(&no_return) != S_OK)
+    no_return = FALSE;
 
   BOOL has_inl_asm = FALSE;
   if (symbol->get_hasInlAsm(&has_inl_asm) != S_OK)
@@ -1651,15 +2618,22 @@ DiaBrowser::BrowserDirective Decomposer::OnPushFunctionOrThunkSymbol(
   if (symbol->get_hasSEH(&has_seh) != S_OK)
     has_seh = FALSE;
 
-  // Set the block attributes.
+  // Get the block attributes.
+  BlockGraph::BlockAttributes attributes = 0;
   if (no_return == TRUE)
-    block->set_attribute(BlockGraph::NON_RETURN_FUNCTION);
+    attributes |= BlockGraph::NON_RETURN_FUNCTION;
   if (has_inl_asm == TRUE)
-    block->set_attribute(BlockGraph::HAS_INLINE_ASSEMBLY);
+    attributes |= BlockGraph::HAS_INLINE_ASSEMBLY;
   if (has_eh || has_seh)
-    block->set_attribute(BlockGraph::HAS_EXCEPTION_HANDLING);
+    attributes |= BlockGraph::HAS_EXCEPTION_HANDLING;
   if (IsSymTag(symbol.get(), SymTagThunk))
-    block->set_attribute(BlockGraph::THUNK);
+    attributes |= BlockGraph::THUNK;
+
+  if (!ProcessFunctionOrThunkSymbol(RelativeAddress(rva),
+                                    static_cast<size_t>(length), name,
+                                    attributes)) {
+    return DiaBrowser::kBrowserAbort;
+  }
 
   return DiaBrowser::kBrowserContinue;
 }
@@ -1668,10 +2642,7 @@ DiaBrowser::BrowserDirective Decomposer::OnPopFunctionOrThunkSymbol(
     const DiaBrowser& dia_browser,
     const DiaBrowser::SymTagVector& sym_tags,
     const DiaBrowser::SymbolPtrVector& symbols) {
-  // Simply clean up the current function block and address.
-  current_block_ = NULL;
-  current_address_ = RelativeAddress(0);
-  current_scope_count_ = 0;
+  EndFunctionOrThunkSymbol();
   return DiaBrowser::kBrowserContinue;
 }
 
@@ -1745,9 +2716,176 @@ DiaBrowser::BrowserDirective Decomposer::OnDataSymbol(
   if (!GetDataSymbolSize(symbol.get(), &length))
     return DiaBrowser::kBrowserAbort;
 
+  std::string name;
+  if (!base::WideToUTF8(name_bstr, name_bstr.Length(), &name)) {
+    LOG(ERROR) << "Failed to convert label name to UTF8.";
+    return DiaBrowser::kBrowserAbort;
+  }
+
+  if (!ProcessDataSymbol(RelativeAddress(rva), length, name,
+                         sym_tags.size() == 1)) {
+    return DiaBrowser::kBrowserAbort;
+  }
+
+  return DiaBrowser::kBrowserContinue;
+}
+
+DiaBrowser::BrowserDirective Decomposer::OnPublicSymbol(
+    const DiaBrowser& dia_browser,
+    const DiaBrowser::SymTagVector& sym_tags,
+    const DiaBrowser::SymbolPtrVector& symbols) {
+  DCHECK(!symbols.empty());
+  DCHECK_EQ(sym_tags.size(), symbols.size());
+  DiaBrowser::SymbolPtr symbol = symbols.back();
+
+  HRESULT hr = E_FAIL;
+  DWORD rva = 0;
+  ScopedBstr name_bstr;
+  if (FAILED(hr = symbol->get_relativeVirtualAddress(&rva)) ||
+      FAILED(hr = symbol->get_name(name_bstr.Receive()))) {
+    LOG(ERROR) << "Failed to get public symbol properties: "
+               << common::LogHr(hr) << ".";
+    return DiaBrowser::kBrowserAbort;
+  }
+
+  std::string name;
+  base::WideToUTF8(name_bstr, name_bstr.Length(), &name);
+
+  if (!ProcessPublicSymbol(RelativeAddress(rva), name))
+    return DiaBrowser::kBrowserAbort;
+
+  return DiaBrowser::kBrowserContinue;
+}
+
+DiaBrowser::BrowserDirective Decomposer::OnLabelSymbol(
+    const DiaBrowser& dia_browser,
+    const DiaBrowser::SymTagVector& sym_tags,
+    const DiaBrowser::SymbolPtrVector& symbols) {
+  DCHECK(!symbols.empty());
+  DCHECK_EQ(sym_tags.size(), symbols.size());
+  DiaBrowser::SymbolPtr symbol = symbols.back();
+
+  HRESULT hr = E_FAIL;
+  DWORD rva = 0;
+  ScopedBstr name_bstr;
+  if (FAILED(hr = symbol->get_relativeVirtualAddress(&rva)) ||
+      FAILED(hr = symbol->get_name(name_bstr.Receive()))) {
+    LOG(ERROR) << "Failed to get label symbol properties: " << common::LogHr(hr)
+               << ".";
+    return DiaBrowser::kBrowserAbort;
+  }
+
+  std::string name;
+  base::WideToUTF8(name_bstr, name_bstr.Length(), &name);
+
+  if (!ProcessLabelSymbol(RelativeAddress(rva), name))
+    return DiaBrowser::kBrowserAbort;
+
+  return DiaBrowser::kBrowserContinue;
+}
+
+DiaBrowser::BrowserDirective Decomposer::OnScopeSymbol(
+    enum SymTagEnum type, DiaBrowser::SymbolPtr symbol) {
+  // We should only get here via the successful exploration of a SymTagFunction,
+  // so current_block_ should be set.
+  DCHECK_NE(reinterpret_cast<Block*>(NULL), current_block_);
+
+  HRESULT hr = E_FAIL;
+  DWORD rva = 0;
+  if (FAILED(hr = symbol->get_relativeVirtualAddress(&rva))) {
+    LOG(ERROR) << "Failed to get scope symbol properties: " << common::LogHr(hr)
+               << ".";
+    return DiaBrowser::kBrowserAbort;
+  }
+
+  // If this is a scope we extract the length, for the corresponding end label.
+  ULONGLONG length = 0;
+  if (type == SymTagBlock && symbol->get_length(&length) != S_OK) {
+    LOG(ERROR) << "Failed to extract code scope length for block \""
+                << current_block_->name() << "\".";
+    return DiaBrowser::kBrowserAbort;
+  }
+
+  if (!ProcessScopeSymbol(type, RelativeAddress(rva),
+                          static_cast<size_t>(length))) {
+    return DiaBrowser::kBrowserAbort;
+  }
+
+  return DiaBrowser::kBrowserContinue;
+}
+
+DiaBrowser::BrowserDirective Decomposer::OnCallSiteSymbol(
+    DiaBrowser::SymbolPtr symbol) {
+  // We should only get here via the successful exploration of a SymTagFunction,
+  // so current_block_ should be set.
+  DCHECK_NE(reinterpret_cast<Block*>(NULL), current_block_);
+
+  HRESULT hr = E_FAIL;
+  DWORD rva = 0;
+  if (FAILED(hr = symbol->get_relativeVirtualAddress(&rva))) {
+    LOG(ERROR) << "Failed to get call site symbol properties: "
+               << common::LogHr(hr) << ".";
+    return DiaBrowser::kBrowserAbort;
+  }
+
+  if (!ProcessCallSiteSymbol(RelativeAddress(rva)))
+    return DiaBrowser::kBrowserAbort;
+
+  return DiaBrowser::kBrowserContinue;
+}
+
+bool Decomposer::ProcessFunctionOrThunkSymbol(
+    RelativeAddress addr,
+    size_t length,
+    const std::string& name,
+    BlockGraph::BlockAttributes attributes) {
+  DCHECK_EQ(reinterpret_cast<Block*>(NULL), current_block_);
+  DCHECK_EQ(current_address_, RelativeAddress(0));
+  DCHECK_EQ(0u, current_scope_count_);
+
+  Block* block = image_->GetBlockByAddress(addr);
+  CHECK(block != NULL);
+  RelativeAddress block_addr;
+  CHECK(image_->GetAddressOf(block, &block_addr));
+  DCHECK(InRange(addr, block_addr, block->size()));
+
+  // We know the function starts in this block but we need to make sure its
+  // end does not extend past the end of the block.
+  if (addr + length > block_addr + block->size()) {
+    LOG(ERROR) << "Got function/thunk \"" << name << "\" that is not contained "
+               << "by section contribution \"" << block->name() << "\".";
+    return false;
+  }
+
+  Offset offset = addr - block_addr;
+  if (!AddLabelToBlock(offset, name, BlockGraph::CODE_LABEL, block))
+    return false;
+
+  // Keep track of the generated block. We will use this when parsing symbols
+  // that belong to this function. This prevents us from having to do repeated
+  // lookups and also allows us to associate labels outside of the block to the
+  // correct block.
+  current_block_ = block;
+  current_address_ = block_addr;
+
+  block->set_attribute(attributes);
+
+  return true;
+}
+
+void Decomposer::EndFunctionOrThunkSymbol() {
+  // Simply clean up the current function block and address.
+  current_block_ = NULL;
+  current_address_ = RelativeAddress(0);
+  current_scope_count_ = 0;
+}
+
+bool Decomposer::ProcessDataSymbol(RelativeAddress addr,
+                                   size_t length,
+                                   const std::string& symbol_name,
+                                   bool is_global) {
   // Reuse the parent function block if we can. This acts as small lookup
   // cache.
-  RelativeAddress addr(rva);
   Block* block = current_block_;
   RelativeAddress block_addr(current_address_);
   if (block == NULL || !InRange(addr, block_addr, block->size())) {
@@ -1757,13 +2895,8 @@ DiaBrowser::BrowserDirective Decomposer::OnDataSymbol(
     DCHECK(InRange(addr, block_addr, block->size()));
   }
 
-  std::string name;
-  if (!base::WideToUTF8(name_bstr, name_bstr.Length(), &name)) {
-    LOG(ERROR) << "Failed to convert label name to UTF8.";
-    return DiaBrowser::kBrowserAbort;
-  }
-
   // Zero-length data symbols mark case/jump tables, or are forward declares.
+  std::string name(symbol_name);
   BlockGraph::LabelAttributes attr = BlockGraph::DATA_LABEL;
   Offset offset = addr - block_addr;
   if (length == 0) {
@@ -1783,7 +2916,7 @@ DiaBrowser::BrowserDirective Decomposer::OnDataSymbol(
       // Zero-length data symbols act as 'forward declares' in some sense. They
       // are always followed by a non-zero length data symbol with the same name
       // and location.
-      return DiaBrowser::kBrowserTerminatePath;
+      return true;
     }
   }
 
@@ -1800,83 +2933,42 @@ DiaBrowser::BrowserDirective Decomposer::OnDataSymbol(
     // on that. Instead, we simply ignore global data symbols that exceed the
     // block size.
     base::StringPiece spname(name);
-    if (sym_tags.size() == 1 && spname.starts_with("_imp_")) {
+    if (is_global && spname.starts_with("_imp_")) {
       VLOG(1) << "Encountered an imported data symbol \"" << name << "\" that "
               << "extends past its parent block \"" << block->name() << "\".";
     } else {
       LOG(ERROR) << "Received data symbol \"" << name << "\" that extends past "
                  << "its parent block \"" << block->name() << "\".";
-      return DiaBrowser::kBrowserAbort;
+      return false;
     }
   }
 
-  if (!AddLabelToBlock(offset, name, attr, block))
-    return DiaBrowser::kBrowserAbort;
-
-  return DiaBrowser::kBrowserContinue;
+  return AddLabelToBlock(offset, name, attr, block);
 }
 
-DiaBrowser::BrowserDirective Decomposer::OnPublicSymbol(
-    const DiaBrowser& dia_browser,
-    const DiaBrowser::SymTagVector& sym_tags,
-    const DiaBrowser::SymbolPtrVector& symbols) {
-  DCHECK(!symbols.empty());
-  DCHECK_EQ(sym_tags.size(), symbols.size());
+bool Decomposer::ProcessPublicSymbol(RelativeAddress addr,
+                                     const std::string& symbol_name) {
   DCHECK_EQ(reinterpret_cast<Block*>(NULL), current_block_);
-  DiaBrowser::SymbolPtr symbol = symbols.back();
 
-  HRESULT hr = E_FAIL;
-  DWORD rva = 0;
-  ScopedBstr name_bstr;
-  if (FAILED(hr = symbol->get_relativeVirtualAddress(&rva)) ||
-      FAILED(hr = symbol->get_name(name_bstr.Receive()))) {
-    LOG(ERROR) << "Failed to get public symbol properties: "
-               << common::LogHr(hr) << ".";
-    return DiaBrowser::kBrowserAbort;
-  }
-
-  RelativeAddress addr(rva);
   Block* block = image_->GetBlockByAddress(addr);
   CHECK(block != NULL);
   RelativeAddress block_addr;
   CHECK(image_->GetAddressOf(block, &block_addr));
   DCHECK(InRange(addr, block_addr, block->size()));
 
-  std::string name;
-  base::WideToUTF8(name_bstr, name_bstr.Length(), &name);
-
   // Public symbol names are mangled. Remove leading '_' as per
   // http://msdn.microsoft.com/en-us/library/00kh39zz(v=vs.80).aspx
-  if (name[0] == '_')
+  std::string name(symbol_name);
+  if (!name.empty() && name[0] == '_')
     name = name.substr(1);
 
   Offset offset = addr - block_addr;
-  if (!AddLabelToBlock(offset, name, BlockGraph::PUBLIC_SYMBOL_LABEL, block))
-    return DiaBrowser::kBrowserAbort;
-
-  return DiaBrowser::kBrowserContinue;
+  return AddLabelToBlock(offset, name, BlockGraph::PUBLIC_SYMBOL_LABEL, block);
 }
 
-DiaBrowser::BrowserDirective Decomposer::OnLabelSymbol(
-    const DiaBrowser& dia_browser,
-    const DiaBrowser::SymTagVector& sym_tags,
-    const DiaBrowser::SymbolPtrVector& symbols) {
-  DCHECK(!symbols.empty());
-  DCHECK_EQ(sym_tags.size(), symbols.size());
-  DiaBrowser::SymbolPtr symbol = symbols.back();
-
-  HRESULT hr = E_FAIL;
-  DWORD rva = 0;
-  ScopedBstr name_bstr;
-  if (FAILED(hr = symbol->get_relativeVirtualAddress(&rva)) ||
-      FAILED(hr = symbol->get_name(name_bstr.Receive()))) {
-    LOG(ERROR) << "Failed to get label symbol properties: " << common::LogHr(hr)
-               << ".";
-    return DiaBrowser::kBrowserAbort;
-  }
-
+bool Decomposer::ProcessLabelSymbol(RelativeAddress addr,
+                                    const std::string& name) {
   // If we have a current_block_ the label should lie within its scope.
-  RelativeAddress addr(rva);
   Block* block = current_block_;
   RelativeAddress block_addr(current_address_);
   if (block != NULL) {
@@ -1915,14 +3007,14 @@ DiaBrowser::BrowserDirective Decomposer::OnLabelSymbol(
       // Update the block address according to the cold block found.
       if (!image_->GetAddressOf(block, &block_addr)) {
         LOG(ERROR) << "Cannot retrieve cold block address.";
-        return DiaBrowser::kBrowserAbort;
+        return false;
       }
     }
 
     if (!InRangeIncl(addr, block_addr, block->size())) {
       LOG(ERROR) << "Label falls outside of current block \""
                  << block->name() << "\".";
-      return DiaBrowser::kBrowserAbort;
+      return false;
     }
   } else {
     // If there is no current block this is a compiland scope label.
@@ -1936,32 +3028,16 @@ DiaBrowser::BrowserDirective Decomposer::OnLabelSymbol(
     //     compiland.
   }
 
-  std::string name;
-  base::WideToUTF8(name_bstr, name_bstr.Length(), &name);
-
   Offset offset = addr - block_addr;
-  if (!AddLabelToBlock(offset, name, BlockGraph::CODE_LABEL, block))
-    return DiaBrowser::kBrowserAbort;
-
-  return DiaBrowser::kBrowserContinue;
+  return AddLabelToBlock(offset, name, BlockGraph::CODE_LABEL, block);
 }
 
-DiaBrowser::BrowserDirective Decomposer::OnScopeSymbol(
-    enum SymTagEnum type, DiaBrowser::SymbolPtr symbol) {
-  // We should only get here via the successful exploration of a SymTagFunction,
-  // so current_block_ should be set.
+bool Decomposer::ProcessScopeSymbol(enum SymTagEnum type,
+                                    RelativeAddress addr,
+                                    size_t length) {
   DCHECK_NE(reinterpret_cast<Block*>(NULL), current_block_);
 
-  HRESULT hr = E_FAIL;
-  DWORD rva = 0;
-  if (FAILED(hr = symbol->get_relativeVirtualAddress(&rva))) {
-    LOG(ERROR) << "Failed to get scope symbol properties: " << common::LogHr(hr)
-               << ".";
-    return DiaBrowser::kBrowserAbort;
-  }
-
   // The label may potentially lay at the first byte past the function.
-  RelativeAddress addr(rva);
   DCHECK_LE(current_address_, addr);
   DCHECK_LE(addr, current_address_ + current_block_->size());
 
@@ -1973,60 +3049,74 @@ DiaBrowser::BrowserDirective Decomposer::OnScopeSymbol(
   // Add the label.
   Offset offset = addr - current_address_;
   if (!AddLabelToBlock(offset, name, attr, current_block_))
-    return DiaBrowser::kBrowserAbort;
+    return false;
 
-  // If this is a scope we extract the length and explicitly add a corresponding
-  // end label.
+  // If this is a scope we explicitly add a corresponding end label.
   if (type == SymTagBlock) {
-    ULONGLONG length = 0;
-    if (symbol->get_length(&length) != S_OK) {
-      LOG(ERROR) << "Failed to extract code scope length for block \""
-                  << current_block_->name() << "\".";
-      return DiaBrowser::kBrowserAbort;
-    }
-    DCHECK_LE(static_cast<size_t>(offset + length), current_block_->size());
+    DCHECK_LE(offset + length, current_block_->size());
     name = base::StringPrintf("<scope-end-%d>", current_scope_count_);
     ++current_scope_count_;
     if (!AddLabelToBlock(offset + length, name,
                          BlockGraph::SCOPE_END_LABEL, current_block_)) {
-      return DiaBrowser::kBrowserAbort;
+      return false;
     }
   }
 
-  return DiaBrowser::kBrowserContinue;
+  return true;
 }
 
-DiaBrowser::BrowserDirective Decomposer::OnCallSiteSymbol(
-    DiaBrowser::SymbolPtr symbol) {
-  // We should only get here via the successful exploration of a SymTagFunction,
-  // so current_block_ should be set.
+bool Decomposer::ProcessCallSiteSymbol(RelativeAddress addr) {
   DCHECK_NE(reinterpret_cast<Block*>(NULL), current_block_);
 
-  HRESULT hr = E_FAIL;
-  DWORD rva = 0;
-  if (FAILED(hr = symbol->get_relativeVirtualAddress(&rva))) {
-    LOG(ERROR) << "Failed to get call site symbol properties: "
-               << common::LogHr(hr) << ".";
-    return DiaBrowser::kBrowserAbort;
-  }
-
-  RelativeAddress addr(rva);
   if (!InRange(addr, current_address_, current_block_->size())) {
     // We see this happen under some build configurations (notably debug
     // component builds of Chrome). As long as the label falls entirely
     // outside of the block it is harmless and can be safely ignored.
     VLOG(1) << "Call site falls outside of current block \""
             << current_block_->name() << "\".";
-    return DiaBrowser::kBrowserContinue;
+    return true;
   }
 
   Offset offset = addr - current_address_;
-  if (!AddLabelToBlock(offset, "<call-site>", BlockGraph::CALL_SITE_LABEL,
-                       current_block_)) {
-    return DiaBrowser::kBrowserAbort;
+  return AddLabelToBlock(offset, "<call-site>", BlockGraph::CALL_SITE_LABEL,
+                         current_block_);
+}
+
+bool Decomposer::AddColdBlock(RelativeAddress func_addr,
+                              size_t func_length,
+                              RelativeAddress block_addr) {
+  // Retrieve the function block.
+  Block* func_block = image_->GetBlockByAddress(func_addr);
+  if (func_block == NULL) {
+    LOG(ERROR) << "Cannot retrieve parent block.";
+    return false;
   }
 
-  return DiaBrowser::kBrowserContinue;
+  // Skip blocks within the range of its parent.
+  if (block_addr >= func_addr && block_addr <= func_addr + func_length)
+    return true;
+
+  // A cold block is detected and needs special handling.
+  Block* cold_block = image_->GetBlockByAddress(block_addr);
+  if (cold_block == NULL) {
+    LOG(ERROR) << "Cannot retrieve parent block.";
+    return false;
+  }
+
+  RelativeAddress cold_block_addr;
+  if (!image_->GetAddressOf(cold_block, &cold_block_addr)) {
+    LOG(ERROR) << "Cannot retrieve cold block address.";
+    return false;
+  }
+
+  // Add cold_block as a child of the function block.
+  cold_blocks_[func_block][cold_block_addr] = cold_block;
+
+  // Set the parent relation for blocks belonging to the function block.
+  cold_blocks_parent_[func_block] = func_block;
+  cold_blocks_parent_[cold_block] = func_block;
+
+  return true;
 }
 
 Block* Decomposer::CreateBlock(BlockType type,
@@ -2124,6 +3214,52 @@ Block* Decomposer::CreateBlockOrFindCoveringPeBlock(
   return CreateBlock(type, addr, size, name);
 }
 
+bool Decomposer::CreateSectionContribBlock(
+    BlockType type,
+    RelativeAddress address,
+    BlockGraph::Size size,
+    const std::string& compiland_name,
+    bool is_built_by_supported_compiler) {
+  // Give a name to the block based on the basename of the object file. This
+  // will eventually be replaced by the full symbol name, if one exists for
+  // the block.
+  size_t last_component = compiland_name.find_last_of('\\');
+  size_t extension = compiland_name.find_last_of('.');
+  if (last_component == std::string::npos) {
+    last_component = 0;
+  } else {
+    // We don't want to include the last slash.
+    ++last_component;
+  }
+  if (extension < last_component)
+    extension = compiland_name.size();
+  std::string name = compiland_name.substr(last_component,
+                                           extension - last_component);
+
+  // TODO(chrisha): We see special section contributions with the name
+  //     "* CIL *". These are concatenations of data symbols and can very
+  //     likely be chunked using symbols directly. A cursory visual inspection
+  //     of symbol names hints that these might be related to WPO.
+
+  // Create the block.
+  Block* block = CreateBlockOrFindCoveringPeBlock(type, address, size, name);
+  if (block == NULL) {
+    LOG(ERROR) << "Unable to create block for compiland \""
+               << compiland_name << "\".";
+    return false;
+  }
+
+  // Set the block compiland name.
+  block->set_compiland_name(compiland_name);
+
+  // Set the block attributes.
+  block->set_attribute(BlockGraph::SECTION_CONTRIB);
+  if (!is_built_by_supported_compiler)
+    block->set_attribute(BlockGraph::BUILT_BY_UNSUPPORTED_COMPILER);
+
+  return true;
+}
+
 bool Decomposer::CreateGapBlock(BlockType block_type,
                                    RelativeAddress address,
                                    BlockGraph::Size size) {
@@ -43,6 +43,12 @@ class Decomposer {
   // associated with a single label.
   static const char kLabelNameSep[];
 
+  // The version of the decompositions produced. This must be incremented by
+  // any change to the decomposer that changes the block-graph or the image
+  // layout it produces for a given image, as it keys the decompositions saved
+  // by DecompositionCache.
+  static const uint32 kOutputVersion;
+
   // Initialize the decomposer for a given image file.
   // @param image_file the image file to decompose. This must outlive the
   //     instance of the decomposer.
@@ -63,6 +69,24 @@ class Decomposer {
   // @param pdb_path the path to the PDB file to be used in decomposing the
   //     image.
   void set_pdb_path(const base::FilePath& pdb_path) { pdb_path_ = pdb_path; }
+  // Sets the maximum number of threads used to resolve references. Defaults
+  // to 1, which decomposes the image serially. References are always added to
+  // the block-graph in the same order, so the decomposition is identical
+  // regardless of the number of threads.
+  // @param max_workers the maximum number of threads to use.
+  void set_max_workers(size_t max_workers) {
+    DCHECK_LT(0U, max_workers);
+    max_workers_ = max_workers;
+  }
+  // Sets whether symbols are read using DIA. Defaults to true. When false the
+  // PDB file is parsed directly, which doesn't require DIA to be installed
+  // and is faster on large images. Both produce the same decomposition,
+  // including the names of blocks and labels. Both visit the compiland
+  // symbols, then the global data symbols, then the public symbols, so a
+  // block is named after the same symbol and the names merged into a label
+  // come in the same order.
+  // @param use_dia true to use DIA, false to use the native PDB readers.
+  void set_use_dia(bool use_dia) { use_dia_ = use_dia; }
   // @}
 
   // @name Accessors
@@ -72,6 +96,10 @@ class Decomposer {
   // decomposition.
   // @returns the PDB path.
   const base::FilePath& pdb_path() const { return pdb_path_; }
+  // @returns the maximum number of threads used to resolve references.
+  size_t max_workers() const { return max_workers_; }
+  // @returns true if symbols are read using DIA.
+  bool use_dia() const { return use_dia_; }
   // @}
 
  protected:
@@ -94,7 +122,14 @@ class Decomposer {
                                     bool* stream_exists);
   // @}
 
-  // @name Decomposition steps, in order.
+  // The PDB streams used when decomposing without DIA.
+  struct NativePdb;
+
+  // Reads the PDB streams used when decomposing without DIA.
+  bool LoadNativePdb(NativePdb* native_pdb);
+
+  // @name Decomposition steps, in order. The steps that read the PDB have an
+  //     overload for DIA and for the native PDB readers.
   // @{
   // Performs the actual decomposition.
   bool DecomposeImpl();
@@ -104,8 +139,10 @@ class Decomposer {
   bool CreateBlocksFromCoffGroups();
   // Processes the SectionContribution table, creating code/data blocks from it.
   bool CreateBlocksFromSectionContribs(IDiaSession* session);
- // Processes the Compiland table and finds cold blocks.
+  bool CreateBlocksFromSectionContribs(const NativePdb& native_pdb);
+  // Processes the Compiland table and finds cold blocks.
   bool FindColdBlocksFromCompilands(IDiaSession* session);
+  bool FindColdBlocksFromCompilands(const NativePdb& native_pdb);
   // Creates gap blocks to flesh out the image. After this has been run all
   // references should be resolvable.
   bool CreateGapBlocks();
@@ -113,11 +150,13 @@ class Decomposer {
   bool FinalizeIntermediateReferences(const IntermediateReferences& references);
   // Creates inter-block references from fixups.
   bool CreateReferencesFromFixups(IDiaSession* session);
+  bool CreateReferencesFromFixups(const NativePdb& native_pdb);
   // Processes symbols from the PDB, setting block names and labels. This
   // step is purely optional and only necessary to provide debug information.
   // This adds names to blocks, adds code labels and their names, and adds
   // more informative names to data labels.
   bool ProcessSymbols(IDiaSymbol* root);
+  bool ProcessSymbols(const NativePdb& native_pdb);
   // @}
 
   // @{
@@ -130,6 +169,27 @@ class Decomposer {
                          pdb::PdbStream* stream);
   // @}
 
+  // @{
+  // @name Callbacks and context structures used when parsing the module and
+  //     global symbol streams without DIA.
+  struct VisitModuleSymbolContext;
+  bool VisitColdBlockSymbol(VisitModuleSymbolContext* context,
+                            uint16 symbol_length,
+                            uint16 symbol_type,
+                            pdb::PdbStream* stream);
+  bool VisitModuleSymbol(VisitModuleSymbolContext* context,
+                         uint16 symbol_length,
+                         uint16 symbol_type,
+                         pdb::PdbStream* stream);
+  bool VisitGlobalDataSymbol(const NativePdb* native_pdb,
+                             uint16 symbol_length,
+                             uint16 symbol_type,
+                             pdb::PdbStream* stream);
+  bool VisitPublicSymbol(uint16 symbol_length,
+                         uint16 symbol_type,
+                         pdb::PdbStream* stream);
+  // @}
+
   // @{
   // @name Callbacks used when parsing DIA symbols. Symbols only need to be
   //     parsed for debug information and can be completely ignored otherwise.
@@ -167,6 +227,38 @@ class Decomposer {
   DiaBrowser::BrowserDirective OnCallSiteSymbol(DiaBrowser::SymbolPtr symbol);
   // @}
 
+  // @name Symbol handlers shared by the DIA and the native symbol parsing.
+  //     These are given the properties of a symbol, and return false on
+  //     error.
+  // @{
+  // Records the block at @p block_addr as a cold block of the function at
+  // @p func_addr if it lies outside of the function.
+  bool AddColdBlock(RelativeAddress func_addr,
+                    size_t func_length,
+                    RelativeAddress block_addr);
+  // Labels a function or thunk, and makes its block the current block until
+  // EndFunctionOrThunkSymbol is called.
+  bool ProcessFunctionOrThunkSymbol(RelativeAddress addr,
+                                    size_t length,
+                                    const std::string& name,
+                                    BlockGraph::BlockAttributes attributes);
+  void EndFunctionOrThunkSymbol();
+  // @p is_global is true if the symbol is in the global scope rather than in
+  // the scope of a compiland or function.
+  bool ProcessDataSymbol(RelativeAddress addr,
+                         size_t length,
+                         const std::string& name,
+                         bool is_global);
+  bool ProcessPublicSymbol(RelativeAddress addr, const std::string& name);
+  bool ProcessLabelSymbol(RelativeAddress addr, const std::string& name);
+  // These must be called between ProcessFunctionOrThunkSymbol and
+  // EndFunctionOrThunkSymbol. @p length is only used by SymTagBlock scopes.
+  bool ProcessScopeSymbol(enum SymTagEnum type,
+                          RelativeAddress addr,
+                          size_t length);
+  bool ProcessCallSiteSymbol(RelativeAddress addr);
+  // @}
+
   // @name Block creation members.
   // @{
   // Creates a new block with the given properties, and attaches the
@@ -182,6 +274,13 @@ class Decomposer {
       RelativeAddress address,
       BlockGraph::Size size,
       const base::StringPiece& name);
+  // Creates the block of a section contribution, named after the object file
+  // of the compiland that contributed it.
+  bool CreateSectionContribBlock(BlockGraph::BlockType type,
+                                 RelativeAddress address,
+                                 BlockGraph::Size size,
+                                 const std::string& compiland_name,
+                                 bool is_built_by_supported_compiler);
   // Creates a gap block of type @p block_type for the given range. For use by
   // CreateSectionGapBlocks.
   bool CreateGapBlock(BlockGraph::BlockType block_type,
@@ -197,6 +296,10 @@ class Decomposer {
   const PEFile& image_file_;
   // The path to corresponding PDB file.
   base::FilePath pdb_path_;
+  // The maximum number of threads used to resolve references.
+  size_t max_workers_;
+  // Whether symbols are read using DIA.
+  bool use_dia_;
 
   // @name Temporaries that are only valid while inside DecomposeImpl.
   //     Prevents us from having to pass these around everywhere.
@@ -217,7 +320,7 @@ class Decomposer {
   ColdBlocksParent cold_blocks_parent_;
   // @}
 
-  // @name Temporaries that are only valid while in DiaBrowser.
+  // @name Temporaries that are only valid while processing symbols.
   // @{
   BlockGraph::Block* current_block_;
   RelativeAddress current_address_;
@@ -14,8 +14,11 @@
 
 #include "syzygy/pe/decomposer.h"
 
+#include "base/memory/scoped_ptr.h"
+#include "base/process/process_metrics.h"
 #include "base/strings/string_split.h"
 #include "base/strings/string_util.h"
+#include "base/strings/stringprintf.h"
 #include "gmock/gmock.h"
 #include "gtest/gtest.h"
 #include "syzygy/block_graph/block_graph_serializer.h"
@@ -29,6 +32,7 @@
 #include "syzygy/pe/pe_relinker.h"
 #include "syzygy/pe/pe_utils.h"
 #include "syzygy/pe/unittest_util.h"
+#include "syzygy/testing/metrics.h"
 
 namespace pe {
 
@@ -69,6 +73,167 @@ class DecomposerTest : public testing::PELibUnitTest {
   base::FilePath temp_dir_;
 };
 
+// Decomposes the given image and emits metrics describing the time and memory
+// it takes, along with the throughput of iterating over the references,
+// referrers and labels of all blocks.
+void RunDecomposePerfTest(const char* image_name,
+                          const base::FilePath& dll_path,
+                          const base::FilePath& pdb_path,
+                          bool use_dia) {
+  PEFile pe_file;
+  ASSERT_TRUE(pe_file.Init(dll_path));
+
+  scoped_ptr<base::ProcessMetrics> process_metrics(
+      base::ProcessMetrics::CreateProcessMetrics(::GetCurrentProcess()));
+  size_t memory_before = process_metrics->GetPagefileUsage();
+
+  Decomposer decomposer(pe_file);
+  BlockGraph block_graph;
+  ImageLayout image_layout(&block_graph);
+  decomposer.set_pdb_path(pdb_path);
+  decomposer.set_use_dia(use_dia);
+  base::Time start = base::Time::Now();
+  ASSERT_TRUE(decomposer.Decompose(&image_layout));
+  base::Time decomposed = base::Time::Now();
+
+  size_t memory_after = process_metrics->GetPagefileUsage();
+
+  // Walk all of the references, referrers and labels a few times.
+  const size_t kIterations = 10;
+  size_t items = 0;
+  size_t checksum = 0;
+  for (size_t i = 0; i < kIterations; ++i) {
+    BlockGraph::BlockMap::const_iterator block_it =
+        block_graph.blocks().begin();
+    for (; block_it != block_graph.blocks().end(); ++block_it) {
+      const BlockGraph::Block& block = block_it->second;
+
+      BlockGraph::Block::ReferenceMap::const_iterator ref_it =
+          block.references().begin();
+      for (; ref_it != block.references().end(); ++ref_it, ++items)
+        checksum += ref_it->first + ref_it->second.offset();
+
+      BlockGraph::Block::ReferrerSet::const_iterator referrer_it =
+          block.referrers().begin();
+      for (; referrer_it != block.referrers().end(); ++referrer_it, ++items)
+        checksum += referrer_it->second;
+
+      BlockGraph::Block::LabelMap::const_iterator label_it =
+          block.labels().begin();
+      for (; label_it != block.labels().end(); ++label_it, ++items)
+        checksum += label_it->first;
+    }
+  }
+  base::Time iterated = base::Time::Now();
+  EXPECT_NE(0U, checksum);
+
+  std::string prefix = base::StringPrintf(
+      "Syzygy.Pe.Decomposer.%s.%s", image_name, use_dia ? "Dia" : "Native");
+  testing::EmitMetric(prefix + ".DecomposeSeconds",
+                      (decomposed - start).InSecondsF());
+  testing::EmitMetric(prefix + ".DecomposeMemoryBytes",
+                      static_cast<int64>(memory_after) -
+                          static_cast<int64>(memory_before));
+  testing::EmitMetric(
+      prefix + ".IterationItemsPerSecond",
+      static_cast<double>(items) / (iterated - decomposed).InSecondsF());
+}
+
+// Decomposes the given image with and without DIA, and checks that both
+// decompositions have the same blocks, references and labels, with the same
+// names.
+void DecomposeWithAndWithoutDia(const base::FilePath& dll_path,
+                                const base::FilePath& pdb_path) {
+  PEFile pe_file;
+  ASSERT_TRUE(pe_file.Init(dll_path));
+
+  Decomposer dia_decomposer(pe_file);
+  dia_decomposer.set_pdb_path(pdb_path);
+  BlockGraph dia_block_graph;
+  ImageLayout dia_image_layout(&dia_block_graph);
+  ASSERT_TRUE(dia_decomposer.Decompose(&dia_image_layout));
+
+  Decomposer native_decomposer(pe_file);
+  native_decomposer.set_pdb_path(pdb_path);
+  native_decomposer.set_use_dia(false);
+  BlockGraph native_block_graph;
+  ImageLayout native_image_layout(&native_block_graph);
+  ASSERT_TRUE(native_decomposer.Decompose(&native_image_layout));
+
+  EXPECT_EQ(dia_image_layout.sections, native_image_layout.sections);
+  ASSERT_EQ(dia_image_layout.blocks.size(), native_image_layout.blocks.size());
+
+  BlockGraph::AddressSpace::RangeMapConstIter dia_it =
+      dia_image_layout.blocks.begin();
+  BlockGraph::AddressSpace::RangeMapConstIter native_it =
+      native_image_layout.blocks.begin();
+  for (; dia_it != dia_image_layout.blocks.end(); ++dia_it, ++native_it) {
+    const BlockGraph::Block* dia_block = dia_it->second;
+    const BlockGraph::Block* native_block = native_it->second;
+    ASSERT_EQ(dia_it->first, native_it->first);
+    EXPECT_EQ(dia_block->type(), native_block->type());
+
+    // Order files and reorderers match blocks by name, so the names must be
+    // the same with both symbol readers.
+    EXPECT_EQ(dia_block->name(), native_block->name());
+    EXPECT_EQ(dia_block->attributes(), native_block->attributes())
+        << "Block \"" << dia_block->name() << "\" has attributes "
+        << BlockGraph::BlockAttributesToString(dia_block->attributes())
+        << " with DIA and "
+        << BlockGraph::BlockAttributesToString(native_block->attributes())
+        << " without.";
+    EXPECT_EQ(dia_block->alignment(), native_block->alignment());
+    EXPECT_EQ(dia_block->compiland_name(), native_block->compiland_name());
+
+    // Compare the references by the address of the blocks they refer to.
+    ASSERT_EQ(dia_block->references().size(),
+              native_block->references().size());
+    BlockGraph::Block::ReferenceMap::const_iterator dia_ref_it =
+        dia_block->references().begin();
+    BlockGraph::Block::ReferenceMap::const_iterator native_ref_it =
+        native_block->references().begin();
+    for (; dia_ref_it != dia_block->references().end();
+         ++dia_ref_it, ++native_ref_it) {
+      const BlockGraph::Reference& dia_ref = dia_ref_it->second;
+      const BlockGraph::Reference& native_ref = native_ref_it->second;
+      EXPECT_EQ(dia_ref_it->first, native_ref_it->first);
+      EXPECT_EQ(dia_ref.type(), native_ref.type());
+      EXPECT_EQ(dia_ref.size(), native_ref.size());
+      EXPECT_EQ(dia_ref.offset(), native_ref.offset());
+      EXPECT_EQ(dia_ref.base(), native_ref.base());
+      EXPECT_EQ(dia_ref.referenced()->addr(), native_ref.referenced()->addr());
+    }
+
+    // Compare the labels by offset, name and attributes. Names that are
+    // merged into a label must also be merged in the same order.
+    ASSERT_EQ(dia_block->labels().size(), native_block->labels().size())
+        << "Block \"" << dia_block->name() << "\" has a different number of "
+        << "labels with and without DIA.";
+    BlockGraph::Block::LabelMap::const_iterator dia_label_it =
+        dia_block->labels().begin();
+    BlockGraph::Block::LabelMap::const_iterator native_label_it =
+        native_block->labels().begin();
+    for (; dia_label_it != dia_block->labels().end();
+         ++dia_label_it, ++native_label_it) {
+      EXPECT_EQ(dia_label_it->first, native_label_it->first);
+      EXPECT_EQ(dia_label_it->second.name(), native_label_it->second.name())
+          << "Label at offset " << dia_label_it->first << " of block \""
+          << dia_block->name() << "\" has a different name with and without "
+          << "DIA.";
+      EXPECT_EQ(dia_label_it->second.attributes(),
+                native_label_it->second.attributes())
+          << "Label at offset " << dia_label_it->first << " of block \""
+          << dia_block->name() << "\" has attributes "
+          << BlockGraph::LabelAttributesToString(
+                 dia_label_it->second.attributes())
+          << " with DIA and "
+          << BlockGraph::LabelAttributesToString(
+                 native_label_it->second.attributes())
+          << " without.";
+    }
+  }
+}
+
 }  // namespace
 
 TEST_F(DecomposerTest, MutatorsAndAccessors) {
@@ -81,9 +246,17 @@ TEST_F(DecomposerTest, MutatorsAndAccessors) {
 
   Decomposer decomposer(image_file);
   EXPECT_TRUE(decomposer.pdb_path().empty());
+  EXPECT_EQ(1U, decomposer.max_workers());
+  EXPECT_TRUE(decomposer.use_dia());
 
   decomposer.set_pdb_path(pdb_path);
   EXPECT_EQ(pdb_path, decomposer.pdb_path());
+
+  decomposer.set_max_workers(4);
+  EXPECT_EQ(4U, decomposer.max_workers());
+
+  decomposer.set_use_dia(false);
+  EXPECT_FALSE(decomposer.use_dia());
 }
 
 TEST_F(DecomposerTest, Decompose) {
@@ -314,6 +487,55 @@ TEST_F(DecomposerTest, Decompose) {
   EXPECT_EQ(8u, coff_group_blocks);
 }
 
+TEST_F(DecomposerTest, DecomposeInParallel) {
+  base::FilePath image_path(testing::GetExeRelativePath(testing::kTestDllName));
+  PEFile image_file;
+  ASSERT_TRUE(image_file.Init(image_path));
+
+  // Decompose the test image serially.
+  Decomposer serial_decomposer(image_file);
+  BlockGraph serial_block_graph;
+  ImageLayout serial_image_layout(&serial_block_graph);
+  ASSERT_TRUE(serial_decomposer.Decompose(&serial_image_layout));
+
+  // Decompose it again using multiple threads.
+  Decomposer parallel_decomposer(image_file);
+  parallel_decomposer.set_max_workers(4);
+  BlockGraph parallel_block_graph;
+  ImageLayout parallel_image_layout(&parallel_block_graph);
+  ASSERT_TRUE(parallel_decomposer.Decompose(&parallel_image_layout));
+
+  // Both decompositions should be identical.
+  block_graph::BlockGraphSerializer bgs;
+  EXPECT_TRUE(::testing::BlockGraphsEqual(serial_block_graph,
+                                          parallel_block_graph,
+                                          bgs));
+  EXPECT_EQ(serial_image_layout.sections, parallel_image_layout.sections);
+  EXPECT_EQ(serial_image_layout.blocks.size(),
+            parallel_image_layout.blocks.size());
+}
+
+TEST_F(DecomposerTest, DecomposeWithoutDia) {
+  ASSERT_NO_FATAL_FAILURE(DecomposeWithAndWithoutDia(
+      testing::GetExeRelativePath(testing::kTestDllName),
+      testing::GetExeRelativePath(testing::kTestDllPdbName)));
+}
+
+TEST_F(DecomposerTest, DecomposeTestDllMSVS2013WithoutDia) {
+  ASSERT_NO_FATAL_FAILURE(DecomposeWithAndWithoutDia(
+      testing::GetSrcRelativePath(
+          L"syzygy\\pe\\test_data\\test_dll_vs2013.dll"),
+      testing::GetSrcRelativePath(
+          L"syzygy\\pe\\test_data\\test_dll_vs2013.dll.pdb")));
+}
+
+TEST_F(DecomposerTest, DecomposeSyzyAsanRtlDllWithPGOWithoutDia) {
+  ASSERT_NO_FATAL_FAILURE(DecomposeWithAndWithoutDia(
+      testing::GetSrcRelativePath(L"syzygy\\pe\\test_data\\syzyasan_rtl.dll"),
+      testing::GetSrcRelativePath(
+          L"syzygy\\pe\\test_data\\syzyasan_rtl.dll.pdb")));
+}
+
 TEST_F(DecomposerTest, DecomposeFailsWithNonexistentPdb) {
   base::FilePath image_path(testing::GetExeRelativePath(testing::kTestDllName));
   PEFile image_file;
@@ -566,6 +788,25 @@ TEST_F(DecomposerTest, DecomposeSyzyAsanRtlDllWithPGO) {
   ASSERT_TRUE(decomposer.Decompose(&image_layout));
 }
 
+TEST_F(DecomposerTest, DecomposePerfTest) {
+  // Both symbol backends are measured, so that they can be compared.
+  for (size_t i = 0; i < 2; ++i) {
+    bool use_dia = i == 0;
+    ASSERT_NO_FATAL_FAILURE(RunDecomposePerfTest(
+        "TestDll",
+        testing::GetExeRelativePath(testing::kTestDllName),
+        testing::GetExeRelativePath(testing::kTestDllPdbName),
+        use_dia));
+    ASSERT_NO_FATAL_FAILURE(RunDecomposePerfTest(
+        "SyzyAsanRtl",
+        testing::GetSrcRelativePath(
+            L"syzygy\\pe\\test_data\\syzyasan_rtl.dll"),
+        testing::GetSrcRelativePath(
+            L"syzygy\\pe\\test_data\\syzyasan_rtl.dll.pdb"),
+        use_dia));
+  }
+}
+
 namespace {
 
 void GetNtHeadersBlock(const BlockGraph::Block* dos_header_block,
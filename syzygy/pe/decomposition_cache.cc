@@ -0,0 +1,207 @@
+// Copyright 2015 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "syzygy/pe/decomposition_cache.h"
+
+#include "base/files/file_util.h"
+#include "base/files/scoped_file.h"
+#include "base/strings/stringprintf.h"
+#include "syzygy/block_graph/block_graph_serializer.h"
+#include "syzygy/core/serialization.h"
+#include "syzygy/pe/decomposer.h"
+#include "syzygy/pe/pdb_info.h"
+#include "syzygy/pe/serialization.h"
+
+namespace pe {
+
+namespace {
+
+// The version of the cache entry format. This must be incremented whenever
+// the format of the entries changes. Changes to the output of the decomposer
+// are tracked by Decomposer::kOutputVersion, and changes to the serialization
+// of block-graphs by BlockGraphSerializer::kVersion. All three versions are
+// part of the key of an entry.
+const uint32 kDecompositionCacheVersion = 1;
+
+// Writes the versions an entry depends on.
+bool SaveVersions(core::OutArchive* out_archive) {
+  DCHECK_NE(reinterpret_cast<core::OutArchive*>(NULL), out_archive);
+  return out_archive->Save(kDecompositionCacheVersion) &&
+      out_archive->Save(Decomposer::kOutputVersion) &&
+      out_archive->Save(block_graph::BlockGraphSerializer::kVersion);
+}
+
+// Reads the versions an entry depends on.
+// @returns true iff they match those of this toolchain.
+bool LoadAndCheckVersions(core::InArchive* in_archive) {
+  DCHECK_NE(reinterpret_cast<core::InArchive*>(NULL), in_archive);
+  uint32 cache_version = 0;
+  uint32 decomposer_version = 0;
+  uint32 serializer_version = 0;
+  return in_archive->Load(&cache_version) &&
+      cache_version == kDecompositionCacheVersion &&
+      in_archive->Load(&decomposer_version) &&
+      decomposer_version == Decomposer::kOutputVersion &&
+      in_archive->Load(&serializer_version) &&
+      serializer_version == block_graph::BlockGraphSerializer::kVersion;
+}
+
+// Builds the name of the cache entry for the given image. The name embeds the
+// full key, so that distinct images never share an entry.
+bool GetEntryName(const PEFile& pe_file, base::FilePath* entry_name) {
+  DCHECK_NE(reinterpret_cast<base::FilePath*>(NULL), entry_name);
+
+  PdbInfo pdb_info;
+  if (!pdb_info.Init(pe_file)) {
+    LOG(ERROR) << "Unable to get PDB information for image \""
+               << pe_file.path().value() << "\".";
+    return false;
+  }
+
+  PEFile::Signature signature;
+  pe_file.GetSignature(&signature);
+
+  const GUID& guid = pdb_info.signature();
+  *entry_name = base::FilePath(base::StringPrintf(
+      L"%ls-%08X-%08X-%08X-%08X-"
+      L"%08X%04X%04X%02X%02X%02X%02X%02X%02X%02X%02X-%X-v%u.%u.%u%ls",
+      pe_file.path().BaseName().value().c_str(),
+      signature.base_address.value(),
+      signature.module_size,
+      signature.module_checksum,
+      signature.module_time_date_stamp,
+      guid.Data1, guid.Data2, guid.Data3,
+      guid.Data4[0], guid.Data4[1], guid.Data4[2], guid.Data4[3],
+      guid.Data4[4], guid.Data4[5], guid.Data4[6], guid.Data4[7],
+      pdb_info.pdb_age(),
+      kDecompositionCacheVersion,
+      Decomposer::kOutputVersion,
+      block_graph::BlockGraphSerializer::kVersion,
+      DecompositionCache::kEntryExtension));
+
+  return true;
+}
+
+}  // namespace
+
+const char DecompositionCache::kCacheDirEnvVar[] =
+    "SYZYGY_DECOMPOSITION_CACHE_DIR";
+const wchar_t DecompositionCache::kEntryExtension[] = L".decomposition";
+
+DecompositionCache::DecompositionCache(const base::FilePath& cache_dir)
+    : cache_dir_(cache_dir) {
+  DCHECK(!cache_dir.empty());
+}
+
+bool DecompositionCache::GetEntryPath(const PEFile& pe_file,
+                                      base::FilePath* entry_path) const {
+  DCHECK_NE(reinterpret_cast<base::FilePath*>(NULL), entry_path);
+
+  base::FilePath entry_name;
+  if (!GetEntryName(pe_file, &entry_name))
+    return false;
+
+  *entry_path = cache_dir_.Append(entry_name);
+  return true;
+}
+
+bool DecompositionCache::Load(const PEFile& pe_file,
+                              ImageLayout* image_layout,
+                              bool* entry_exists) const {
+  DCHECK_NE(reinterpret_cast<ImageLayout*>(NULL), image_layout);
+  DCHECK_NE(reinterpret_cast<bool*>(NULL), entry_exists);
+  DCHECK(image_layout->blocks.graph()->blocks().empty());
+
+  *entry_exists = false;
+
+  base::FilePath entry_path;
+  if (!GetEntryPath(pe_file, &entry_path))
+    return false;
+
+  base::ScopedFILE in_file(base::OpenFile(entry_path, "rb"));
+  if (in_file.get() == NULL)
+    return false;
+
+  core::FileInStream in_stream(in_file.get());
+  core::NativeBinaryInArchive in_archive(&in_stream);
+
+  // Entries from other versions of the toolchain are ignored, and will be
+  // replaced.
+  if (!LoadAndCheckVersions(&in_archive)) {
+    LOG(INFO) << "Ignoring stale decomposition cache entry \""
+              << entry_path.value() << "\".";
+    return false;
+  }
+
+  // From here on the block-graph is modified, so a failure can't be recovered
+  // from.
+  *entry_exists = true;
+  LOG(INFO) << "Loading decomposition from cache: " << entry_path.value();
+  if (!LoadBlockGraphAndImageLayout(pe_file, NULL, image_layout,
+                                    &in_archive)) {
+    LOG(ERROR) << "Failed to load decomposition cache entry \""
+               << entry_path.value() << "\".";
+    return false;
+  }
+
+  return true;
+}
+
+bool DecompositionCache::Save(const PEFile& pe_file,
+                              const ImageLayout& image_layout) const {
+  base::FilePath entry_path;
+  if (!GetEntryPath(pe_file, &entry_path))
+    return false;
+
+  if (!base::CreateDirectory(cache_dir_)) {
+    LOG(ERROR) << "Unable to create decomposition cache directory \""
+               << cache_dir_.value() << "\".";
+    return false;
+  }
+
+  // Write the entry to a temporary file, which is then moved into place. This
+  // ensures that concurrent readers never see a partially written entry.
+  base::FilePath temp_path;
+  if (!base::CreateTemporaryFileInDir(cache_dir_, &temp_path)) {
+    LOG(ERROR) << "Unable to create temporary file in \""
+               << cache_dir_.value() << "\".";
+    return false;
+  }
+
+  bool written = false;
+  {
+    base::ScopedFILE out_file(base::OpenFile(temp_path, "wb"));
+    if (out_file.get() != NULL) {
+      core::FileOutStream out_stream(out_file.get());
+      core::NativeBinaryOutArchive out_archive(&out_stream);
+      written = SaveVersions(&out_archive) &&
+          SaveBlockGraphAndImageLayout(pe_file, 0, image_layout,
+                                       &out_archive) &&
+          out_archive.Flush();
+    }
+  }
+
+  if (!written || !base::Move(temp_path, entry_path)) {
+    LOG(ERROR) << "Unable to write decomposition cache entry \""
+               << entry_path.value() << "\".";
+    base::DeleteFile(temp_path, false);
+    return false;
+  }
+
+  LOG(INFO) << "Saved decomposition to cache: " << entry_path.value();
+
+  return true;
+}
+
+}  // namespace pe
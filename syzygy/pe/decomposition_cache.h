@@ -0,0 +1,88 @@
+// Copyright 2015 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// Declares DecompositionCache, a persistent on-disk cache of PE image
+// decompositions. This allows tools that repeatedly process the same input
+// image to skip decomposing it.
+
+#ifndef SYZYGY_PE_DECOMPOSITION_CACHE_H_
+#define SYZYGY_PE_DECOMPOSITION_CACHE_H_
+
+#include "base/files/file_path.h"
+#include "syzygy/pe/image_layout.h"
+#include "syzygy/pe/pe_file.h"
+
+namespace pe {
+
+// A directory of serialized decompositions. Each entry is keyed by the
+// signature of the image (base address, size, checksum and time-date stamp)
+// and by the GUID and age of its PDB, so an entry is never used for a
+// different build of the image. Entries are also keyed by the versions of the
+// decomposer output and of the block-graph serialization format, so that they
+// are never used by a toolchain that would decompose the image differently.
+// Entries don't store the block data; it is read from the image itself when
+// the entry is loaded.
+class DecompositionCache {
+ public:
+  // The name of the environment variable that may be used to specify a cache
+  // directory to tools that don't otherwise expose one.
+  static const char kCacheDirEnvVar[];
+
+  // The extension of cache entries.
+  static const wchar_t kEntryExtension[];
+
+  // Constructor.
+  // @param cache_dir the directory holding the cache entries. It is created on
+  //     demand.
+  explicit DecompositionCache(const base::FilePath& cache_dir);
+
+  // Gets the path of the cache entry for the given image.
+  // @param pe_file the image whose decomposition is cached.
+  // @param entry_path receives the path of the cache entry.
+  // @returns true on success, false otherwise.
+  bool GetEntryPath(const PEFile& pe_file, base::FilePath* entry_path) const;
+
+  // Loads the cached decomposition of the given image.
+  // @param pe_file the image whose decomposition is to be loaded.
+  // @param image_layout the image layout to populate. Its block-graph must be
+  //     empty.
+  // @param entry_exists is set to true if a usable entry for @p pe_file
+  //     exists, false otherwise.
+  // @returns true on success, false otherwise. If this returns false with
+  //     @p entry_exists set to true then the entry is corrupt and
+  //     @p image_layout may have been partially populated. Saving a new
+  //     decomposition replaces the corrupt entry.
+  bool Load(const PEFile& pe_file,
+            ImageLayout* image_layout,
+            bool* entry_exists) const;
+
+  // Saves the decomposition of the given image to the cache, replacing any
+  // existing entry.
+  // @param pe_file the image that was decomposed.
+  // @param image_layout the decomposition of @p pe_file.
+  // @returns true on success, false otherwise.
+  bool Save(const PEFile& pe_file, const ImageLayout& image_layout) const;
+
+  // @returns the directory holding the cache entries.
+  const base::FilePath& cache_dir() const { return cache_dir_; }
+
+ private:
+  base::FilePath cache_dir_;
+
+  DISALLOW_COPY_AND_ASSIGN(DecompositionCache);
+};
+
+}  // namespace pe
+
+#endif  // SYZYGY_PE_DECOMPOSITION_CACHE_H_
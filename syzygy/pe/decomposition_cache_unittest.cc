@@ -0,0 +1,137 @@
+// Copyright 2015 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "syzygy/pe/decomposition_cache.h"
+
+#include "base/files/file_util.h"
+#include "base/strings/string_util.h"
+#include "base/strings/stringprintf.h"
+#include "gtest/gtest.h"
+#include "syzygy/block_graph/block_graph_serializer.h"
+#include "syzygy/block_graph/unittest_util.h"
+#include "syzygy/core/unittest_util.h"
+#include "syzygy/pe/decomposer.h"
+#include "syzygy/pe/unittest_util.h"
+
+namespace pe {
+
+namespace {
+
+using block_graph::BlockGraph;
+
+class DecompositionCacheTest : public testing::PELibUnitTest {
+  typedef testing::PELibUnitTest Super;
+
+ public:
+  virtual void SetUp() override {
+    Super::SetUp();
+
+    ASSERT_NO_FATAL_FAILURE(CreateTemporaryDir(&temp_dir_));
+    cache_dir_ = temp_dir_.Append(L"cache");
+
+    ASSERT_TRUE(pe_file_.Init(
+        testing::GetExeRelativePath(testing::kTestDllName)));
+  }
+
+  base::FilePath temp_dir_;
+  base::FilePath cache_dir_;
+  PEFile pe_file_;
+};
+
+}  // namespace
+
+TEST_F(DecompositionCacheTest, GetEntryPath) {
+  DecompositionCache cache(cache_dir_);
+  EXPECT_EQ(cache_dir_, cache.cache_dir());
+
+  base::FilePath entry_path;
+  ASSERT_TRUE(cache.GetEntryPath(pe_file_, &entry_path));
+  EXPECT_EQ(cache_dir_, entry_path.DirName());
+  EXPECT_EQ(DecompositionCache::kEntryExtension, entry_path.Extension());
+
+  // The entry is specific to the decomposer and serializer versions.
+  std::wstring versions = base::StringPrintf(
+      L".%u.%u%ls", Decomposer::kOutputVersion,
+      block_graph::BlockGraphSerializer::kVersion,
+      DecompositionCache::kEntryExtension);
+  EXPECT_TRUE(EndsWith(entry_path.value(), versions, true));
+
+  // A different image maps to a different entry.
+  PEFile other_pe_file;
+  ASSERT_TRUE(other_pe_file.Init(
+      testing::GetExeRelativePath(testing::kNoExportsDllName)));
+  base::FilePath other_entry_path;
+  ASSERT_TRUE(cache.GetEntryPath(other_pe_file, &other_entry_path));
+  EXPECT_NE(entry_path, other_entry_path);
+}
+
+TEST_F(DecompositionCacheTest, LoadMissingEntry) {
+  DecompositionCache cache(cache_dir_);
+
+  BlockGraph block_graph;
+  ImageLayout image_layout(&block_graph);
+  bool entry_exists = true;
+  EXPECT_FALSE(cache.Load(pe_file_, &image_layout, &entry_exists));
+  EXPECT_FALSE(entry_exists);
+  EXPECT_TRUE(block_graph.blocks().empty());
+}
+
+TEST_F(DecompositionCacheTest, IgnoresStaleEntry) {
+  DecompositionCache cache(cache_dir_);
+
+  base::FilePath entry_path;
+  ASSERT_TRUE(cache.GetEntryPath(pe_file_, &entry_path));
+  ASSERT_TRUE(base::CreateDirectory(cache_dir_));
+  const char kStaleEntry[] = "\xFF\xFF\xFF\xFF";
+  ASSERT_EQ(static_cast<int>(sizeof(kStaleEntry)),
+            base::WriteFile(entry_path, kStaleEntry, sizeof(kStaleEntry)));
+
+  BlockGraph block_graph;
+  ImageLayout image_layout(&block_graph);
+  bool entry_exists = true;
+  EXPECT_FALSE(cache.Load(pe_file_, &image_layout, &entry_exists));
+  EXPECT_FALSE(entry_exists);
+  EXPECT_TRUE(block_graph.blocks().empty());
+}
+
+TEST_F(DecompositionCacheTest, SaveAndLoad) {
+  DecompositionCache cache(cache_dir_);
+
+  Decomposer decomposer(pe_file_);
+  BlockGraph block_graph;
+  ImageLayout image_layout(&block_graph);
+  ASSERT_TRUE(decomposer.Decompose(&image_layout));
+
+  ASSERT_TRUE(cache.Save(pe_file_, image_layout));
+  base::FilePath entry_path;
+  ASSERT_TRUE(cache.GetEntryPath(pe_file_, &entry_path));
+  EXPECT_TRUE(base::PathExists(entry_path));
+
+  BlockGraph cached_block_graph;
+  ImageLayout cached_image_layout(&cached_block_graph);
+  bool entry_exists = false;
+  ASSERT_TRUE(cache.Load(pe_file_, &cached_image_layout, &entry_exists));
+  EXPECT_TRUE(entry_exists);
+
+  block_graph::BlockGraphSerializer bgs;
+  EXPECT_TRUE(::testing::BlockGraphsEqual(block_graph, cached_block_graph,
+                                          bgs));
+  EXPECT_EQ(image_layout.sections, cached_image_layout.sections);
+  EXPECT_EQ(image_layout.blocks.size(), cached_image_layout.blocks.size());
+
+  // Saving again replaces the existing entry.
+  EXPECT_TRUE(cache.Save(pe_file_, image_layout));
+}
+
+}  // namespace pe
@@ -79,6 +79,8 @@
         'dia_util_internal.h',
         'decomposer.cc',
         'decomposer.h',
+        'decomposition_cache.cc',
+        'decomposition_cache.h',
         'dos_stub.asm',
         'dos_stub.cc',
         'dos_stub.h',
@@ -218,6 +220,7 @@
         'decompose_app_unittest.cc',
         'decompose_image_to_text_unittest.cc',
         'decomposer_unittest.cc',
+        'decomposition_cache_unittest.cc',
         'dia_browser_unittest.cc',
         'dia_util_unittest.cc',
         'find_unittest.cc',
@@ -14,13 +14,17 @@
 
 #include "syzygy/pe/pe_relinker.h"
 
+#include "base/environment.h"
 #include "base/files/file_util.h"
+#include "base/memory/scoped_ptr.h"
+#include "base/strings/utf_string_conversions.h"
 #include "syzygy/pdb/pdb_byte_stream.h"
 #include "syzygy/pdb/pdb_file.h"
 #include "syzygy/pdb/pdb_reader.h"
 #include "syzygy/pdb/pdb_util.h"
 #include "syzygy/pdb/pdb_writer.h"
 #include "syzygy/pe/decomposer.h"
+#include "syzygy/pe/decomposition_cache.h"
 #include "syzygy/pe/metadata.h"
 #include "syzygy/pe/pdb_info.h"
 #include "syzygy/pe/pe_file_writer.h"
@@ -46,31 +50,74 @@ using pdb::PdbMutatorInterface;
 using pdb::PdbStream;
 using pdb::WritablePdbStream;
 
-// Decomposes the module enclosed by the given PE file.
+// Removes all blocks and sections from @p block_graph.
+void ClearBlockGraph(BlockGraph* block_graph) {
+  DCHECK(block_graph != NULL);
+
+  // Disconnect all of the blocks first, so that they can be removed in any
+  // order.
+  BlockGraph::BlockMap& blocks = block_graph->blocks_mutable();
+  BlockGraph::BlockMap::iterator it = blocks.begin();
+  for (; it != blocks.end(); ++it)
+    it->second.RemoveAllReferences();
+  blocks.clear();
+
+  block_graph->sections_mutable().clear();
+}
+
+// Decomposes the module enclosed by the given PE file. If @p cache_dir is not
+// empty the decomposition is looked up in, or added to, the decomposition cache
+// in that directory. A cache entry that fails to load is treated as a miss,
+// and is replaced. The decomposer uses up to @p max_workers threads.
 bool Decompose(const PEFile& pe_file,
                const base::FilePath& pdb_path,
+               const base::FilePath& cache_dir,
+               size_t max_workers,
                ImageLayout* image_layout,
                BlockGraph::Block** dos_header_block) {
   DCHECK(image_layout != NULL);
   DCHECK(dos_header_block != NULL);
 
-  LOG(INFO) << "Decomposing module: " << pe_file.path().value();
-
   BlockGraph* block_graph = image_layout->blocks.graph();
-  ImageLayout orig_image_layout(block_graph);
+  scoped_ptr<ImageLayout> orig_image_layout(new ImageLayout(block_graph));
+
+  // Look for a previous decomposition of the input image.
+  scoped_ptr<DecompositionCache> cache;
+  bool cached = false;
+  if (!cache_dir.empty()) {
+    cache.reset(new DecompositionCache(cache_dir));
+    bool entry_exists = false;
+    cached = cache->Load(pe_file, orig_image_layout.get(), &entry_exists);
+    if (!cached && entry_exists) {
+      // The entry is corrupt, and may have left a partial decomposition
+      // behind. Throw it away and decompose the image from scratch.
+      LOG(WARNING) << "Unable to load the cached decomposition, ignoring it.";
+      ClearBlockGraph(block_graph);
+      orig_image_layout.reset(new ImageLayout(block_graph));
+    }
+  }
 
-  // Decompose the input image.
-  Decomposer decomposer(pe_file);
-  decomposer.set_pdb_path(pdb_path);
-  if (!decomposer.Decompose(&orig_image_layout)) {
-    LOG(ERROR) << "Unable to decompose module: " << pe_file.path().value();
-    return false;
+  if (!cached) {
+    LOG(INFO) << "Decomposing module: " << pe_file.path().value();
+
+    // Decompose the input image.
+    Decomposer decomposer(pe_file);
+    decomposer.set_pdb_path(pdb_path);
+    decomposer.set_max_workers(max_workers);
+    if (!decomposer.Decompose(orig_image_layout.get())) {
+      LOG(ERROR) << "Unable to decompose module: " << pe_file.path().value();
+      return false;
+    }
+
+    // A failure to update the cache only costs time in later runs.
+    if (cache.get() != NULL && !cache->Save(pe_file, *orig_image_layout))
+      LOG(WARNING) << "Unable to cache the decomposition.";
   }
 
   // Make a copy of the image layout without padding. We don't want to carry
   // the padding through the toolchain.
   LOG(INFO) << "Removing padding blocks.";
-  if (!pe::CopyImageLayoutWithoutPadding(orig_image_layout, image_layout)) {
+  if (!pe::CopyImageLayoutWithoutPadding(*orig_image_layout, image_layout)) {
     LOG(ERROR) << "Failed to remove padding blocks.";
     return false;
   }
@@ -108,7 +155,8 @@ PERelinker::PERelinker(const PETransformPolicy* pe_transform_policy)
       pe_transform_policy_(pe_transform_policy),
       add_metadata_(true), augment_pdb_(true),
       compress_pdb_(false), strip_strings_(false),
-      padding_(0), code_alignment_(1), output_guid_(GUID_NULL) {
+      padding_(0), code_alignment_(1), max_workers_(1),
+      output_guid_(GUID_NULL) {
   DCHECK(pe_transform_policy != NULL);
 }
 
@@ -152,9 +200,23 @@ bool PERelinker::Init() {
     return false;
   }
 
+  // Tools that don't expose the decomposition cache may still have it enabled
+  // via the environment.
+  if (decomposition_cache_dir_.empty()) {
+    scoped_ptr<base::Environment> env(base::Environment::Create());
+    std::string cache_dir;
+    if (env->GetVar(DecompositionCache::kCacheDirEnvVar, &cache_dir) &&
+        !cache_dir.empty()) {
+      decomposition_cache_dir_ = base::FilePath(base::UTF8ToWide(cache_dir));
+    }
+  }
+  if (!decomposition_cache_dir_.empty()) {
+    LOG(INFO) << "Decomposition cache: " << decomposition_cache_dir_.value();
+  }
+
   // Decompose the image.
-  if (!Decompose(input_pe_file_, input_pdb_path_, &input_image_layout_,
-                 &headers_block_)) {
+  if (!Decompose(input_pe_file_, input_pdb_path_, decomposition_cache_dir_,
+                 max_workers_, &input_image_layout_, &headers_block_)) {
     return false;
   }
 
@@ -203,9 +265,12 @@ bool PERelinker::Relink() {
 
   // From here on down we are processing the PDB file.
 
-  // Read the PDB file.
+  // Read the PDB file. It is memory mapped so that the streams left
+  // untouched by the mutators can be copied straight from the mapping when
+  // writing the new PDB.
   LOG(INFO) << "Reading PDB file: " << input_pdb_path_.value();
   pdb::PdbReader pdb_reader;
+  pdb_reader.set_use_memory_mapping(true);
   PdbFile pdb_file;
   if (!pdb_reader.Read(input_pdb_path_, &pdb_file)) {
     LOG(ERROR) << "Unable to read PDB file: " << input_pdb_path_.value();
@@ -228,6 +293,7 @@ bool PERelinker::Relink() {
   // Write the PDB file.
   LOG(INFO) << "Writing the PDB.";
   pdb::PdbWriter pdb_writer;
+  pdb_writer.set_streaming(true);
   if (!pdb_writer.Write(output_pdb_path_, pdb_file)) {
     LOG(ERROR) << "Failed to write PDB file \"" << output_pdb_path_.value()
                << "\".";
@@ -121,6 +121,10 @@ class PERelinker : public PECoffRelinker {
   bool strip_strings() const { return strip_strings_; }
   size_t padding() const { return padding_; }
   size_t code_alignment() const { return code_alignment_; }
+  size_t max_workers() const { return max_workers_; }
+  const base::FilePath& decomposition_cache_dir() const {
+    return decomposition_cache_dir_;
+  }
   // @}
 
   // @name Mutators for controlling relinker behaviour.
@@ -149,6 +153,18 @@ class PERelinker : public PECoffRelinker {
   void set_code_alignment(size_t alignment) {
     code_alignment_ = alignment;
   }
+  // Sets the maximum number of threads the decomposer uses to resolve
+  // references. See Decomposer::set_max_workers.
+  void set_max_workers(size_t max_workers) {
+    DCHECK_LT(0U, max_workers);
+    max_workers_ = max_workers;
+  }
+  // Sets the directory of the decomposition cache. If this is not set, the
+  // directory named by the DecompositionCache::kCacheDirEnvVar environment
+  // variable is used, if any.
+  void set_decomposition_cache_dir(const base::FilePath& cache_dir) {
+    decomposition_cache_dir_ = cache_dir;
+  }
   // @}
 
   // @see RelinkerInterface::AppendPdbMutator()
@@ -214,6 +230,12 @@ class PERelinker : public PECoffRelinker {
   size_t padding_;
   // Minimal code block alignment.
   size_t code_alignment_;
+  // The maximum number of threads used to decompose the input image. Defaults
+  // to 1.
+  size_t max_workers_;
+  // The directory holding cached decompositions of input images. If empty, the
+  // input image is always decomposed.
+  base::FilePath decomposition_cache_dir_;
 
   // The vectors of user supplied transforms, orderers and mutators to be
   // applied.
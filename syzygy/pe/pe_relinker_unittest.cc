@@ -24,6 +24,7 @@
 #include "syzygy/pdb/pdb_file.h"
 #include "syzygy/pdb/pdb_reader.h"
 #include "syzygy/pdb/pdb_util.h"
+#include "syzygy/pe/decomposition_cache.h"
 #include "syzygy/pe/find.h"
 #include "syzygy/pe/metadata.h"
 #include "syzygy/pe/pdb_info.h"
@@ -162,6 +163,16 @@ TEST_F(PERelinkerTest, Properties) {
   EXPECT_EQ(10u, relinker.code_alignment());
   relinker.set_code_alignment(1);
   EXPECT_EQ(1u, relinker.code_alignment());
+
+  EXPECT_EQ(1u, relinker.max_workers());
+  relinker.set_max_workers(4);
+  EXPECT_EQ(4u, relinker.max_workers());
+  relinker.set_max_workers(1);
+  EXPECT_EQ(1u, relinker.max_workers());
+
+  EXPECT_EQ(base::FilePath(), relinker.decomposition_cache_dir());
+  relinker.set_decomposition_cache_dir(dummy_path);
+  EXPECT_EQ(dummy_path, relinker.decomposition_cache_dir());
 }
 
 TEST_F(PERelinkerTest, AppendPdbMutators) {
@@ -212,6 +223,73 @@ TEST_F(PERelinkerTest, InitSucceeds) {
   EXPECT_TRUE(relinker.Init());
 }
 
+TEST_F(PERelinkerTest, InitPopulatesDecompositionCache) {
+  base::FilePath cache_dir = temp_dir_.Append(L"cache");
+
+  // The first run decomposes the image and populates the cache.
+  TestPERelinker relinker1(&policy_);
+  relinker1.set_input_path(input_dll_);
+  relinker1.set_output_path(temp_dll_);
+  relinker1.set_decomposition_cache_dir(cache_dir);
+  EXPECT_TRUE(relinker1.Init());
+  EXPECT_FALSE(base::IsDirectoryEmpty(cache_dir));
+
+  // The second run loads the decomposition from the cache, and should end up
+  // with the same block-graph.
+  TestPERelinker relinker2(&policy_);
+  relinker2.set_input_path(input_dll_);
+  relinker2.set_output_path(temp_dll_);
+  relinker2.set_decomposition_cache_dir(cache_dir);
+  EXPECT_TRUE(relinker2.Init());
+  EXPECT_EQ(relinker1.block_graph().blocks().size(),
+            relinker2.block_graph().blocks().size());
+  EXPECT_EQ(relinker1.block_graph().sections(),
+            relinker2.block_graph().sections());
+  EXPECT_TRUE(relinker2.Relink());
+}
+
+TEST_F(PERelinkerTest, InitReplacesCorruptDecompositionCacheEntry) {
+  base::FilePath cache_dir = temp_dir_.Append(L"cache");
+
+  TestPERelinker relinker1(&policy_);
+  relinker1.set_input_path(input_dll_);
+  relinker1.set_output_path(temp_dll_);
+  relinker1.set_decomposition_cache_dir(cache_dir);
+  EXPECT_TRUE(relinker1.Init());
+
+  // Truncate the entry. Its version header is left intact, so it is found
+  // but fails to load.
+  DecompositionCache cache(cache_dir);
+  base::FilePath entry_path;
+  ASSERT_TRUE(cache.GetEntryPath(relinker1.input_pe_file(), &entry_path));
+  std::string entry;
+  ASSERT_TRUE(base::ReadFileToString(entry_path, &entry));
+  std::string truncated_entry(entry, 0, entry.size() / 2);
+  ASSERT_EQ(static_cast<int>(truncated_entry.size()),
+            base::WriteFile(entry_path, truncated_entry.data(),
+                            truncated_entry.size()));
+
+  // The corrupt entry is ignored, and replaced by a new decomposition.
+  TestPERelinker relinker2(&policy_);
+  relinker2.set_input_path(input_dll_);
+  relinker2.set_output_path(temp_dll_);
+  relinker2.set_decomposition_cache_dir(cache_dir);
+  EXPECT_TRUE(relinker2.Init());
+  EXPECT_EQ(relinker1.block_graph().blocks().size(),
+            relinker2.block_graph().blocks().size());
+  EXPECT_EQ(relinker1.block_graph().sections(),
+            relinker2.block_graph().sections());
+  EXPECT_TRUE(relinker2.Relink());
+
+  // The replacement entry is usable.
+  BlockGraph block_graph;
+  ImageLayout image_layout(&block_graph);
+  bool entry_exists = false;
+  EXPECT_TRUE(cache.Load(relinker1.input_pe_file(), &image_layout,
+                         &entry_exists));
+  EXPECT_TRUE(entry_exists);
+}
+
 TEST_F(PERelinkerTest, IntermediateAccessors) {
   TestPERelinker relinker(&policy_);
 
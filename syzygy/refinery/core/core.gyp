@@ -26,6 +26,7 @@
         'addressed_data.cc',
         'addressed_data.h',
         'bit_source.h',
+        'interval_index.h',
       ],
     },
   ],
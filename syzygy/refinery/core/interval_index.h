@@ -0,0 +1,367 @@
+// Copyright 2015 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// Declares IntervalIndex, an index of values keyed by address range that
+// answers intersection and spanning queries in O(log n + k).
+
+#ifndef SYZYGY_REFINERY_CORE_INTERVAL_INDEX_H_
+#define SYZYGY_REFINERY_CORE_INTERVAL_INDEX_H_
+
+#include <stdint.h>
+
+#include <algorithm>
+#include <vector>
+
+#include "base/logging.h"
+#include "base/macros.h"
+#include "syzygy/refinery/core/address.h"
+
+namespace refinery {
+
+// An index of values keyed by address range. Ranges may overlap and the same
+// range may be associated with several values.
+// The index is a randomized balanced binary search tree (treap) ordered by
+// range start, where each node is augmented with the maximal end address of
+// its subtree. This allows pruning the subtrees that can't contain matches.
+// Matching values are always returned in order of increasing start address,
+// and in insertion order for ranges that share a start address.
+// @tparam ValueType the type of the indexed values. It must be copyable and
+//     equality comparable.
+template <typename ValueType>
+class IntervalIndex {
+ public:
+  IntervalIndex();
+  ~IntervalIndex();
+
+  // Inserts @p value under @p range.
+  // @pre @p range must be valid.
+  // @param range the range associated with @p value.
+  // @param value the value to insert.
+  void Insert(const AddressRange& range, const ValueType& value);
+
+  // Removes a single entry.
+  // @pre @p range must be valid.
+  // @param range the range @p value was inserted under.
+  // @param value the value to remove.
+  // @returns true on success, false if there is no such entry.
+  bool Remove(const AddressRange& range, const ValueType& value);
+
+  // Gets the values whose range intersects @p range.
+  // @pre @p range must be valid.
+  // @param range the range to intersect.
+  // @param values receives the matching values. Matches are appended.
+  void GetIntersecting(const AddressRange& range,
+                       std::vector<ValueType>* values) const;
+
+  // Gets the values whose range fully spans @p range.
+  // @pre @p range must be valid.
+  // @param range the range to span.
+  // @param values receives the matching values. Matches are appended.
+  void GetSpanning(const AddressRange& range,
+                   std::vector<ValueType>* values) const;
+
+  // @returns the number of entries in the index.
+  size_t size() const { return size_; }
+
+ private:
+  struct Node;
+
+  // Helpers for maintaining the tree. Each returns the new root of the
+  // subtree it operates on.
+  Node* InsertImpl(Node* root, Node* node);
+  Node* RemoveImpl(Node* root,
+                   const AddressRange& range,
+                   const ValueType& value,
+                   bool* removed);
+  static Node* Merge(Node* left, Node* right);
+  static Node* RotateLeft(Node* node);
+  static Node* RotateRight(Node* node);
+  static void UpdateMaxEnd(Node* node);
+  static void DeleteTree(Node* node);
+
+  // Helpers for the queries.
+  static void CollectIntersecting(const Node* node,
+                                  Address start,
+                                  Address end,
+                                  std::vector<ValueType>* values);
+  static void CollectSpanning(const Node* node,
+                              Address start,
+                              Address end,
+                              std::vector<ValueType>* values);
+
+  // @returns a new pseudo-random node priority.
+  uint32_t NextPriority();
+
+  Node* root_;
+  size_t size_;
+
+  // The state of the xorshift generator used for node priorities. The
+  // sequence is deterministic, which keeps the tree shape reproducible.
+  uint32_t priority_state_;
+
+  DISALLOW_COPY_AND_ASSIGN(IntervalIndex);
+};
+
+template <typename ValueType>
+struct IntervalIndex<ValueType>::Node {
+  Node(const AddressRange& range, const ValueType& value, uint32_t priority)
+      : range(range),
+        value(value),
+        max_end(range.end()),
+        priority(priority),
+        left(nullptr),
+        right(nullptr) {}
+
+  AddressRange range;
+  ValueType value;
+  // The maximal end address over this node's subtree.
+  Address max_end;
+  // The heap priority of this node. Parents have higher priority.
+  uint32_t priority;
+  Node* left;
+  Node* right;
+};
+
+template <typename ValueType>
+IntervalIndex<ValueType>::IntervalIndex()
+    : root_(nullptr), size_(0U), priority_state_(2463534242U) {
+}
+
+template <typename ValueType>
+IntervalIndex<ValueType>::~IntervalIndex() {
+  DeleteTree(root_);
+}
+
+template <typename ValueType>
+void IntervalIndex<ValueType>::Insert(const AddressRange& range,
+                                      const ValueType& value) {
+  DCHECK(range.IsValid());
+
+  root_ = InsertImpl(root_, new Node(range, value, NextPriority()));
+  ++size_;
+}
+
+template <typename ValueType>
+bool IntervalIndex<ValueType>::Remove(const AddressRange& range,
+                                      const ValueType& value) {
+  DCHECK(range.IsValid());
+
+  bool removed = false;
+  root_ = RemoveImpl(root_, range, value, &removed);
+  if (removed) {
+    DCHECK_LT(0U, size_);
+    --size_;
+  }
+  return removed;
+}
+
+template <typename ValueType>
+void IntervalIndex<ValueType>::GetIntersecting(
+    const AddressRange& range, std::vector<ValueType>* values) const {
+  DCHECK(range.IsValid());
+  DCHECK(values != nullptr);
+
+  CollectIntersecting(root_, range.start(), range.end(), values);
+}
+
+template <typename ValueType>
+void IntervalIndex<ValueType>::GetSpanning(
+    const AddressRange& range, std::vector<ValueType>* values) const {
+  DCHECK(range.IsValid());
+  DCHECK(values != nullptr);
+
+  CollectSpanning(root_, range.start(), range.end(), values);
+}
+
+template <typename ValueType>
+typename IntervalIndex<ValueType>::Node* IntervalIndex<ValueType>::InsertImpl(
+    Node* root, Node* node) {
+  DCHECK(node != nullptr);
+
+  if (root == nullptr)
+    return node;
+
+  // Ties go to the right, which preserves insertion order for an in-order
+  // traversal.
+  if (node->range.start() < root->range.start()) {
+    root->left = InsertImpl(root->left, node);
+    if (root->left->priority > root->priority)
+      return RotateRight(root);
+  } else {
+    root->right = InsertImpl(root->right, node);
+    if (root->right->priority > root->priority)
+      return RotateLeft(root);
+  }
+
+  UpdateMaxEnd(root);
+  return root;
+}
+
+template <typename ValueType>
+typename IntervalIndex<ValueType>::Node* IntervalIndex<ValueType>::RemoveImpl(
+    Node* root,
+    const AddressRange& range,
+    const ValueType& value,
+    bool* removed) {
+  DCHECK(removed != nullptr);
+
+  if (root == nullptr)
+    return nullptr;
+
+  if (range.start() < root->range.start()) {
+    root->left = RemoveImpl(root->left, range, value, removed);
+  } else if (root->range.start() < range.start()) {
+    root->right = RemoveImpl(root->right, range, value, removed);
+  } else if (root->range == range && root->value == value) {
+    Node* merged = Merge(root->left, root->right);
+    delete root;
+    *removed = true;
+    return merged;
+  } else {
+    // Entries sharing a start address may lie on either side after
+    // rotations.
+    root->left = RemoveImpl(root->left, range, value, removed);
+    if (!*removed)
+      root->right = RemoveImpl(root->right, range, value, removed);
+  }
+
+  UpdateMaxEnd(root);
+  return root;
+}
+
+template <typename ValueType>
+typename IntervalIndex<ValueType>::Node* IntervalIndex<ValueType>::Merge(
+    Node* left, Node* right) {
+  if (left == nullptr)
+    return right;
+  if (right == nullptr)
+    return left;
+
+  if (left->priority > right->priority) {
+    left->right = Merge(left->right, right);
+    UpdateMaxEnd(left);
+    return left;
+  }
+
+  right->left = Merge(left, right->left);
+  UpdateMaxEnd(right);
+  return right;
+}
+
+template <typename ValueType>
+typename IntervalIndex<ValueType>::Node* IntervalIndex<ValueType>::RotateLeft(
+    Node* node) {
+  DCHECK(node != nullptr);
+  DCHECK(node->right != nullptr);
+
+  Node* pivot = node->right;
+  node->right = pivot->left;
+  pivot->left = node;
+
+  UpdateMaxEnd(node);
+  UpdateMaxEnd(pivot);
+  return pivot;
+}
+
+template <typename ValueType>
+typename IntervalIndex<ValueType>::Node* IntervalIndex<ValueType>::RotateRight(
+    Node* node) {
+  DCHECK(node != nullptr);
+  DCHECK(node->left != nullptr);
+
+  Node* pivot = node->left;
+  node->left = pivot->right;
+  pivot->right = node;
+
+  UpdateMaxEnd(node);
+  UpdateMaxEnd(pivot);
+  return pivot;
+}
+
+template <typename ValueType>
+void IntervalIndex<ValueType>::UpdateMaxEnd(Node* node) {
+  DCHECK(node != nullptr);
+
+  node->max_end = node->range.end();
+  if (node->left != nullptr)
+    node->max_end = std::max(node->max_end, node->left->max_end);
+  if (node->right != nullptr)
+    node->max_end = std::max(node->max_end, node->right->max_end);
+}
+
+template <typename ValueType>
+void IntervalIndex<ValueType>::DeleteTree(Node* node) {
+  if (node == nullptr)
+    return;
+
+  DeleteTree(node->left);
+  DeleteTree(node->right);
+  delete node;
+}
+
+template <typename ValueType>
+void IntervalIndex<ValueType>::CollectIntersecting(
+    const Node* node,
+    Address start,
+    Address end,
+    std::vector<ValueType>* values) {
+  // No range in this subtree reaches past |start|.
+  if (node == nullptr || node->max_end <= start)
+    return;
+
+  CollectIntersecting(node->left, start, end, values);
+
+  // This node and its right subtree start at or past |end|.
+  if (node->range.start() >= end)
+    return;
+
+  if (node->range.end() > start)
+    values->push_back(node->value);
+
+  CollectIntersecting(node->right, start, end, values);
+}
+
+template <typename ValueType>
+void IntervalIndex<ValueType>::CollectSpanning(
+    const Node* node,
+    Address start,
+    Address end,
+    std::vector<ValueType>* values) {
+  // No range in this subtree reaches |end|.
+  if (node == nullptr || node->max_end < end)
+    return;
+
+  CollectSpanning(node->left, start, end, values);
+
+  // This node and its right subtree start past |start|.
+  if (node->range.start() > start)
+    return;
+
+  if (node->range.end() >= end)
+    values->push_back(node->value);
+
+  CollectSpanning(node->right, start, end, values);
+}
+
+template <typename ValueType>
+uint32_t IntervalIndex<ValueType>::NextPriority() {
+  priority_state_ ^= priority_state_ << 13;
+  priority_state_ ^= priority_state_ >> 17;
+  priority_state_ ^= priority_state_ << 5;
+  return priority_state_;
+}
+
+}  // namespace refinery
+
+#endif  // SYZYGY_REFINERY_CORE_INTERVAL_INDEX_H_
@@ -0,0 +1,177 @@
+// Copyright 2015 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "syzygy/refinery/core/interval_index.h"
+
+#include <algorithm>
+#include <vector>
+
+#include "gtest/gtest.h"
+
+namespace refinery {
+
+namespace {
+
+typedef IntervalIndex<int> TestIndex;
+
+// A brute force reference for the index queries.
+struct Entry {
+  AddressRange range;
+  int value;
+};
+
+void BruteForceIntersecting(const std::vector<Entry>& entries,
+                            const AddressRange& range,
+                            std::vector<int>* values) {
+  for (const Entry& entry : entries) {
+    if (entry.range.Intersects(range))
+      values->push_back(entry.value);
+  }
+}
+
+void BruteForceSpanning(const std::vector<Entry>& entries,
+                        const AddressRange& range,
+                        std::vector<int>* values) {
+  for (const Entry& entry : entries) {
+    if (entry.range.Spans(range))
+      values->push_back(entry.value);
+  }
+}
+
+}  // namespace
+
+TEST(IntervalIndexTest, Empty) {
+  TestIndex index;
+  EXPECT_EQ(0U, index.size());
+
+  std::vector<int> values;
+  index.GetIntersecting(AddressRange(0ULL, 100U), &values);
+  EXPECT_TRUE(values.empty());
+  index.GetSpanning(AddressRange(10ULL, 1U), &values);
+  EXPECT_TRUE(values.empty());
+
+  EXPECT_FALSE(index.Remove(AddressRange(10ULL, 1U), 1));
+}
+
+TEST(IntervalIndexTest, IntersectingAndSpanning) {
+  TestIndex index;
+  index.Insert(AddressRange(80ULL, 16U), 1);
+  index.Insert(AddressRange(75ULL, 25U), 2);
+  index.Insert(AddressRange(80ULL, 16U), 3);
+  index.Insert(AddressRange(120ULL, 8U), 4);
+  EXPECT_EQ(4U, index.size());
+
+  // Results come in start order, then insertion order.
+  std::vector<int> values;
+  index.GetIntersecting(AddressRange(78ULL, 4U), &values);
+  EXPECT_EQ(std::vector<int>({2, 1, 3}), values);
+
+  values.clear();
+  index.GetIntersecting(AddressRange(96ULL, 30U), &values);
+  EXPECT_EQ(std::vector<int>({2, 4}), values);
+
+  // Contiguous ranges don't intersect.
+  values.clear();
+  index.GetIntersecting(AddressRange(100ULL, 20U), &values);
+  EXPECT_TRUE(values.empty());
+
+  values.clear();
+  index.GetSpanning(AddressRange(82ULL, 4U), &values);
+  EXPECT_EQ(std::vector<int>({2, 1, 3}), values);
+
+  values.clear();
+  index.GetSpanning(AddressRange(76ULL, 20U), &values);
+  EXPECT_EQ(std::vector<int>({2}), values);
+
+  values.clear();
+  index.GetSpanning(AddressRange(90ULL, 40U), &values);
+  EXPECT_TRUE(values.empty());
+}
+
+TEST(IntervalIndexTest, Remove) {
+  TestIndex index;
+  index.Insert(AddressRange(80ULL, 16U), 1);
+  index.Insert(AddressRange(80ULL, 16U), 2);
+  index.Insert(AddressRange(80ULL, 8U), 3);
+
+  // The value and the range must both match.
+  EXPECT_FALSE(index.Remove(AddressRange(80ULL, 16U), 3));
+  EXPECT_FALSE(index.Remove(AddressRange(81ULL, 16U), 1));
+
+  EXPECT_TRUE(index.Remove(AddressRange(80ULL, 16U), 1));
+  EXPECT_FALSE(index.Remove(AddressRange(80ULL, 16U), 1));
+  EXPECT_EQ(2U, index.size());
+
+  std::vector<int> values;
+  index.GetIntersecting(AddressRange(80ULL, 1U), &values);
+  EXPECT_EQ(std::vector<int>({2, 3}), values);
+
+  EXPECT_TRUE(index.Remove(AddressRange(80ULL, 8U), 3));
+  EXPECT_TRUE(index.Remove(AddressRange(80ULL, 16U), 2));
+  EXPECT_EQ(0U, index.size());
+}
+
+TEST(IntervalIndexTest, MatchesBruteForce) {
+  TestIndex index;
+  std::vector<Entry> entries;
+
+  // Create a deterministic set of overlapping and nested ranges.
+  uint32_t seed = 42;
+  for (int i = 0; i < 2000; ++i) {
+    seed = seed * 1103515245U + 12345U;
+    Address addr = (seed >> 8) % 10000;
+    seed = seed * 1103515245U + 12345U;
+    Size size = 1 + (seed >> 8) % ((i % 10 == 0) ? 2000 : 50);
+
+    Entry entry = { AddressRange(addr, size), i };
+    entries.push_back(entry);
+    index.Insert(entry.range, entry.value);
+  }
+
+  // Remove every third entry.
+  std::vector<Entry> remaining;
+  for (size_t i = 0; i < entries.size(); ++i) {
+    if (i % 3 == 0) {
+      ASSERT_TRUE(index.Remove(entries[i].range, entries[i].value));
+    } else {
+      remaining.push_back(entries[i]);
+    }
+  }
+  ASSERT_EQ(remaining.size(), index.size());
+
+  for (Address addr = 0; addr < 12000; addr += 97) {
+    for (Size size = 1; size < 300; size += 71) {
+      AddressRange range(addr, size);
+
+      std::vector<int> expected;
+      std::vector<int> actual;
+      BruteForceIntersecting(remaining, range, &expected);
+      index.GetIntersecting(range, &actual);
+      // The index returns matches in start order, so compare sorted values.
+      std::sort(expected.begin(), expected.end());
+      std::sort(actual.begin(), actual.end());
+      ASSERT_EQ(expected, actual);
+
+      expected.clear();
+      actual.clear();
+      BruteForceSpanning(remaining, range, &expected);
+      index.GetSpanning(range, &actual);
+      std::sort(expected.begin(), expected.end());
+      std::sort(actual.begin(), actual.end());
+      ASSERT_EQ(expected, actual);
+    }
+  }
+}
+
+}  // namespace refinery
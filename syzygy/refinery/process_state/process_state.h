@@ -24,6 +24,7 @@
 #include "base/memory/ref_counted.h"
 #include "syzygy/refinery/core/address.h"
 #include "syzygy/refinery/core/bit_source.h"
+#include "syzygy/refinery/core/interval_index.h"
 #include "syzygy/refinery/process_state/record_traits.h"
 #include "syzygy/refinery/process_state/refinery.pb.h"
 
@@ -171,6 +172,10 @@ class ProcessState::Layer : public ProcessState::LayerBase {
 
  private:
   std::multimap<Address, RecordPtr> records_;
+
+  // An index of the records by range, used to answer range queries without
+  // walking all of |records_|.
+  IntervalIndex<RecordPtr> index_;
 };
 
 template <typename RecordType>
@@ -255,6 +260,7 @@ void ProcessState::Layer<RecordType>::CreateRecord(
 
   RecordPtr new_record = new Record<RecordType>(range);
   records_.insert(std::make_pair(range.addr(), new_record));
+  index_.Insert(range, new_record);
 
   record->swap(new_record);
 }
@@ -279,17 +285,7 @@ void ProcessState::Layer<RecordType>::GetRecordsSpanning(
   DCHECK(records != nullptr);
 
   records->clear();
-
-  for (const auto& entry : records_) {
-    AddressRange record_range = entry.second->range();
-    DCHECK(record_range.IsValid());
-    if (record_range.Spans(range))
-      records->push_back(entry.second);
-
-    if (record_range.start() > range.start())
-      // Records that start after the range, or any after, cannot span it.
-      return;
-  }
+  index_.GetSpanning(range, records);
 }
 
 template <typename RecordType>
@@ -299,13 +295,7 @@ void ProcessState::Layer<RecordType>::GetRecordsIntersecting(
   DCHECK(records != nullptr);
 
   records->clear();
-
-  for (const auto& entry : records_) {
-    AddressRange record_range = entry.second->range();
-    DCHECK(record_range.IsValid());
-    if (record_range.Intersects(range))
-      records->push_back(entry.second);
-  }
+  index_.GetIntersecting(range, records);
 }
 
 template <typename RecordType>
@@ -317,6 +307,8 @@ bool ProcessState::Layer<RecordType>::RemoveRecord(const RecordPtr& record) {
   auto matches = records_.equal_range(record->range().addr());
   for (auto it = matches.first; it != matches.second; ++it) {
     if (it->second.get() == record.get()) {
+      bool removed = index_.Remove(record->range(), record);
+      DCHECK(removed);
       records_.erase(it);
       return true;
     }
@@ -14,12 +14,18 @@
 
 #include "syzygy/refinery/process_state/process_state.h"
 
+#include <intrin.h>
+
 #include <limits>
 
 #include "base/strings/string_piece.h"
 #include "gtest/gtest.h"
+#include "syzygy/refinery/unittest_util.h"
+#include "syzygy/refinery/analyzers/memory_analyzer.h"
+#include "syzygy/refinery/minidump/minidump.h"
 #include "syzygy/refinery/process_state/process_state_util.h"
 #include "syzygy/refinery/process_state/refinery.pb.h"
+#include "syzygy/testing/metrics.h"
 
 namespace refinery {
 
@@ -389,4 +395,58 @@ TEST(ProcessStateTest, GetAll) {
   ASSERT_EQ('0', retrieved);
 }
 
+TEST(ProcessStateTest, GetRecordsPerfTest) {
+  Minidump minidump;
+  ASSERT_TRUE(
+      minidump.Open(testing::TestMinidumps::GetNotepadLarger64Dump()));
+
+  ProcessState report;
+  MemoryAnalyzer analyzer;
+  ASSERT_EQ(Analyzer::ANALYSIS_COMPLETE, analyzer.Analyze(minidump, &report));
+
+  BytesLayerPtr bytes_layer;
+  ASSERT_TRUE(report.FindLayer(&bytes_layer));
+  ASSERT_LT(0U, bytes_layer->size());
+
+  // Carve the memory regions into small overlapping records, to approximate
+  // the density of a typed block layer.
+  scoped_refptr<ProcessState::Layer<TypedBlock>> typed_layer;
+  report.FindOrCreateLayer(&typed_layer);
+  const Size kBlockSize = 16U;
+  std::vector<AddressRange> query_ranges;
+  for (BytesRecordPtr bytes_record : *bytes_layer) {
+    AddressRange range = bytes_record->range();
+    scoped_refptr<ProcessState::Record<TypedBlock>> typed_record;
+    for (Size offset = 0; offset + kBlockSize <= range.size();
+         offset += kBlockSize / 2) {
+      AddressRange block_range(range.start() + offset, kBlockSize);
+      typed_layer->CreateRecord(block_range, &typed_record);
+      query_ranges.push_back(AddressRange(block_range.start() + 1, 4U));
+    }
+  }
+  ASSERT_LT(0U, typed_layer->size());
+
+  std::vector<scoped_refptr<ProcessState::Record<TypedBlock>>> records;
+  uint64_t intersecting_time = 0;
+  uint64_t spanning_time = 0;
+  for (size_t i = 0; i < 10; ++i) {
+    uint64_t t0 = ::__rdtsc();
+    for (const AddressRange& range : query_ranges)
+      typed_layer->GetRecordsIntersecting(range, &records);
+    uint64_t t1 = ::__rdtsc();
+    for (const AddressRange& range : query_ranges)
+      typed_layer->GetRecordsSpanning(range, &records);
+    uint64_t t2 = ::__rdtsc();
+
+    intersecting_time += t1 - t0;
+    spanning_time += t2 - t1;
+  }
+
+  testing::EmitMetric(
+      "Syzygy.Refinery.ProcessState.GetRecordsIntersecting",
+      intersecting_time);
+  testing::EmitMetric("Syzygy.Refinery.ProcessState.GetRecordsSpanning",
+                      spanning_time);
+}
+
 }  // namespace refinery
@@ -52,6 +52,7 @@
         'analyzers/unloaded_module_analyzer_unittest.cc',
         'core/address_unittest.cc',
         'core/addressed_data_unittest.cc',
+        'core/interval_index_unittest.cc',
         'process_state/process_state_unittest.cc',
         'minidump/minidump_unittest.cc',
         'types/type_unittest.cc',
@@ -70,6 +71,7 @@
         'validators/validators.gyp:validators_lib',
         '<(src)/base/base.gyp:base',
         '<(src)/base/base.gyp:test_support_base',
+        '<(src)/syzygy/testing/testing.gyp:testing_lib',
         '<(src)/testing/gtest.gyp:gtest',
        ],
     },
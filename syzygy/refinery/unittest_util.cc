@@ -39,6 +39,11 @@ const base::FilePath TestMinidumps::GetNotepad64Dump() {
       L"syzygy\\refinery\\test_data\\notepad-small-64bit.dmp");
 }
 
+const base::FilePath TestMinidumps::GetNotepadLarger64Dump() {
+  return GetSrcRelativePath(
+      L"syzygy\\refinery\\test_data\\notepad-larger-64bit.dmp");
+}
+
 namespace {
 
 using MemorySpecification = MinidumpSpecification::MemorySpecification;
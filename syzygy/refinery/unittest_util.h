@@ -35,6 +35,8 @@ class TestMinidumps {
   static const base::FilePath GetNotepad32Dump();
   // @returns the path to a 64 bit notepad dump file.
   static const base::FilePath GetNotepad64Dump();
+  // @returns the path to a larger 64 bit notepad dump file.
+  static const base::FilePath GetNotepadLarger64Dump();
 };
 
 // A MinidumpSpecification is used to describe and generate synthetic minidumps.
@@ -236,6 +236,8 @@ void TraceFileSegment::WriteSegmentHeader(SessionHandle session_handle) {
   header = reinterpret_cast<TraceFileSegmentHeader*>(prefix + 1);
   header->thread_id = ::GetCurrentThreadId();
   header->segment_length = 0;
+  header->compression = TraceFileSegmentHeader::kCompressionNone;
+  header->uncompressed_length = 0;
 
   write_ptr = reinterpret_cast<uint8*>(header + 1);
 }
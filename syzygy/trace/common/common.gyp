@@ -35,6 +35,10 @@
       'sources': [
         'clock.cc',
         'clock.h',
+        'compact_encoding.cc',
+        'compact_encoding.h',
+        'segment_compression.cc',
+        'segment_compression.h',
         'service.cc',
         'service.h',
         'service_util.cc',
@@ -43,6 +47,7 @@
       'dependencies': [
         '<(src)/base/base.gyp:base',
         '<(src)/syzygy/common/common.gyp:common_lib',
+        '<(src)/third_party/zlib/zlib.gyp:zlib',
       ],
     },
     {
@@ -50,6 +55,8 @@
       'type': 'executable',
       'sources': [
         'clock_unittest.cc',
+        'compact_encoding_unittest.cc',
+        'segment_compression_unittest.cc',
         'service_unittest.cc',
         'service_util_unittest.cc',
         '<(src)/base/test/run_all_unittests.cc',
@@ -0,0 +1,68 @@
+// Copyright 2015 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "syzygy/trace/common/compact_encoding.h"
+
+#include "base/logging.h"
+
+namespace trace {
+namespace common {
+
+bool ReadVarint32(const uint8** cursor, const uint8* end, uint32* value) {
+  DCHECK(cursor != NULL);
+  DCHECK(value != NULL);
+
+  uint32 result = 0;
+  for (size_t i = 0; i < kMaxVarint32Length; ++i) {
+    if (*cursor == end)
+      return false;
+    uint8 byte = *(*cursor)++;
+    // The last byte only holds the top 4 bits.
+    if (i == kMaxVarint32Length - 1 && byte > 0x0F)
+      return false;
+    result |= static_cast<uint32>(byte & 0x7F) << (7 * i);
+    if ((byte & 0x80) == 0) {
+      *value = result;
+      return true;
+    }
+  }
+
+  NOTREACHED();
+  return false;
+}
+
+bool DecodeCompactCall(const uint8** cursor,
+                       const uint8* end,
+                       CompactCallState* state,
+                       TraceEnterEventData* call) {
+  DCHECK(cursor != NULL);
+  DCHECK(state != NULL);
+  DCHECK(call != NULL);
+
+  uint32 function_delta = 0;
+  uint32 retaddr_delta = 0;
+  if (!ReadVarint32(cursor, end, &function_delta) ||
+      !ReadVarint32(cursor, end, &retaddr_delta)) {
+    return false;
+  }
+
+  state->function += static_cast<uint32>(ZigZagDecode32(function_delta));
+  state->retaddr += static_cast<uint32>(ZigZagDecode32(retaddr_delta));
+  call->function = reinterpret_cast<FuncAddr>(state->function);
+  call->retaddr = reinterpret_cast<RetAddr>(state->retaddr);
+  return true;
+}
+
+}  // namespace common
+}  // namespace trace
@@ -0,0 +1,120 @@
+// Copyright 2015 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// Declares the variable length encoding used by compact trace records. Values
+// are written as little-endian base 128 varints, and signed deltas are first
+// zigzag encoded so that small negative values stay small.
+//
+// A compact call is the delta of its function address with that of the
+// previous call, followed by the delta of its return address with that of the
+// previous call. Consecutive calls on a thread tend to stay within a module,
+// so these typically take 2 or 3 bytes each instead of 4.
+
+#ifndef SYZYGY_TRACE_COMMON_COMPACT_ENCODING_H_
+#define SYZYGY_TRACE_COMMON_COMPACT_ENCODING_H_
+
+#include "base/basictypes.h"
+#include "syzygy/trace/protocol/call_trace_defs.h"
+
+namespace trace {
+namespace common {
+
+// The maximum length of an encoded 32-bit value.
+const size_t kMaxVarint32Length = 5;
+
+// The maximum length of an encoded call.
+const size_t kMaxCompactCallLength = 2 * kMaxVarint32Length;
+
+// The state carried from one compact call to the next. This must be zero
+// initialized at the start of each record.
+struct CompactCallState {
+  uint32 function;
+  uint32 retaddr;
+};
+
+// @returns the zigzag encoding of @p value.
+inline uint32 ZigZagEncode32(int32 value) {
+  return (static_cast<uint32>(value) << 1) ^ static_cast<uint32>(value >> 31);
+}
+
+// @returns the value whose zigzag encoding is @p value.
+inline int32 ZigZagDecode32(uint32 value) {
+  return static_cast<int32>(value >> 1) ^ -static_cast<int32>(value & 1);
+}
+
+// Writes a varint.
+// @param value The value to write.
+// @param output The buffer receiving the varint. This must have room for
+//     kMaxVarint32Length bytes.
+// @returns the number of bytes written.
+inline size_t WriteVarint32(uint32 value, uint8* output) {
+  size_t length = 0;
+  while (value >= 0x80) {
+    output[length++] = static_cast<uint8>(value | 0x80);
+    value >>= 7;
+  }
+  output[length++] = static_cast<uint8>(value);
+  return length;
+}
+
+// Reads a varint.
+// @param cursor The position to read from. This is advanced past the varint
+//     on success.
+// @param end The end of the readable data.
+// @param value Receives the value.
+// @returns true on success, false if the varint is truncated or too long.
+bool ReadVarint32(const uint8** cursor, const uint8* end, uint32* value);
+
+// Encodes a call.
+// @param retaddr The return address of the call.
+// @param function The function called.
+// @param state The state left by the previous call of the record. This is
+//     updated to account for this call.
+// @param output The buffer receiving the encoded call. This must have room
+//     for kMaxCompactCallLength bytes.
+// @returns the number of bytes written.
+inline size_t EncodeCompactCall(RetAddr retaddr,
+                                FuncAddr function,
+                                CompactCallState* state,
+                                uint8* output) {
+  uint32 function_value = reinterpret_cast<uint32>(function);
+  uint32 retaddr_value = reinterpret_cast<uint32>(retaddr);
+  size_t length = WriteVarint32(
+      ZigZagEncode32(static_cast<int32>(function_value - state->function)),
+      output);
+  length += WriteVarint32(
+      ZigZagEncode32(static_cast<int32>(retaddr_value - state->retaddr)),
+      output + length);
+  state->function = function_value;
+  state->retaddr = retaddr_value;
+  return length;
+}
+
+// Decodes a call.
+// @param cursor The position to read from. This is advanced past the call
+//     on success.
+// @param end The end of the readable data.
+// @param state The state left by the previous call of the record. This is
+//     updated to account for this call.
+// @param call Receives the call.
+// @returns true on success, false if the call is truncated or malformed.
+bool DecodeCompactCall(const uint8** cursor,
+                       const uint8* end,
+                       CompactCallState* state,
+                       TraceEnterEventData* call);
+
+}  // namespace common
+}  // namespace trace
+
+#endif  // SYZYGY_TRACE_COMMON_COMPACT_ENCODING_H_
@@ -0,0 +1,124 @@
+// Copyright 2015 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "syzygy/trace/common/compact_encoding.h"
+
+#include <vector>
+
+#include "gtest/gtest.h"
+
+namespace trace {
+namespace common {
+
+TEST(CompactEncodingTest, ZigZag) {
+  EXPECT_EQ(0u, ZigZagEncode32(0));
+  EXPECT_EQ(1u, ZigZagEncode32(-1));
+  EXPECT_EQ(2u, ZigZagEncode32(1));
+  EXPECT_EQ(3u, ZigZagEncode32(-2));
+  EXPECT_EQ(0xFFFFFFFEu, ZigZagEncode32(0x7FFFFFFF));
+  EXPECT_EQ(0xFFFFFFFFu, ZigZagEncode32(-0x7FFFFFFF - 1));
+
+  const int32 kValues[] = { 0, 1, -1, 63, -64, 64, 1000000, -1000000,
+                            0x7FFFFFFF, -0x7FFFFFFF - 1 };
+  for (size_t i = 0; i < arraysize(kValues); ++i)
+    EXPECT_EQ(kValues[i], ZigZagDecode32(ZigZagEncode32(kValues[i])));
+}
+
+TEST(CompactEncodingTest, Varint) {
+  const uint32 kValues[] = { 0, 1, 0x7F, 0x80, 0x3FFF, 0x4000, 0x1FFFFF,
+                             0x200000, 0xFFFFFFF, 0x10000000, 0xFFFFFFFF };
+  const size_t kLengths[] = { 1, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5 };
+  COMPILE_ASSERT(arraysize(kValues) == arraysize(kLengths),
+                 lengths_do_not_match_values);
+
+  for (size_t i = 0; i < arraysize(kValues); ++i) {
+    uint8 buffer[kMaxVarint32Length] = {};
+    size_t length = WriteVarint32(kValues[i], buffer);
+    EXPECT_EQ(kLengths[i], length);
+
+    const uint8* cursor = buffer;
+    uint32 value = 0;
+    EXPECT_TRUE(ReadVarint32(&cursor, buffer + length, &value));
+    EXPECT_EQ(kValues[i], value);
+    EXPECT_EQ(buffer + length, cursor);
+
+    // A truncated varint is refused.
+    cursor = buffer;
+    EXPECT_FALSE(ReadVarint32(&cursor, buffer + length - 1, &value));
+  }
+}
+
+TEST(CompactEncodingTest, VarintTooLong) {
+  // Six bytes worth of data.
+  const uint8 kTooLong[] = { 0x80, 0x80, 0x80, 0x80, 0x80, 0x01 };
+  const uint8* cursor = kTooLong;
+  uint32 value = 0;
+  EXPECT_FALSE(ReadVarint32(&cursor, kTooLong + sizeof(kTooLong), &value));
+
+  // Five bytes, but more than 32 bits.
+  const uint8 kTooLarge[] = { 0xFF, 0xFF, 0xFF, 0xFF, 0x1F };
+  cursor = kTooLarge;
+  EXPECT_FALSE(ReadVarint32(&cursor, kTooLarge + sizeof(kTooLarge), &value));
+}
+
+TEST(CompactEncodingTest, Calls) {
+  // Calls hopping around two modules, as well as the extremes of the address
+  // space.
+  const uint32 kCalls[][2] = {
+      { 0x10001000, 0x10002345 },
+      { 0x10001040, 0x10002350 },
+      { 0x10000F00, 0x10002360 },
+      { 0x70001000, 0x10002370 },
+      { 0x70001010, 0x70002000 },
+      { 0x10001000, 0x70002010 },
+      { 0xFFFFFFFF, 0x00000000 },
+      { 0x00000000, 0xFFFFFFFF },
+  };
+
+  CompactCallState state = {};
+  std::vector<uint8> encoded;
+  size_t nearby_length = 0;
+  for (size_t i = 0; i < arraysize(kCalls); ++i) {
+    uint8 buffer[kMaxCompactCallLength] = {};
+    size_t length = EncodeCompactCall(
+        reinterpret_cast<RetAddr>(kCalls[i][1]),
+        reinterpret_cast<FuncAddr>(kCalls[i][0]), &state, buffer);
+    EXPECT_GE(kMaxCompactCallLength, length);
+    encoded.insert(encoded.end(), buffer, buffer + length);
+    if (i == 1 || i == 2)
+      nearby_length += length;
+  }
+
+  // The second and third calls are close to the ones before them, so they
+  // take a lot less room than uncompressed calls.
+  EXPECT_GE(sizeof(TraceEnterEventData), nearby_length);
+
+  ::memset(&state, 0, sizeof(state));
+  const uint8* cursor = encoded.data();
+  const uint8* end = cursor + encoded.size();
+  for (size_t i = 0; i < arraysize(kCalls); ++i) {
+    TraceEnterEventData call = {};
+    ASSERT_TRUE(DecodeCompactCall(&cursor, end, &state, &call));
+    EXPECT_EQ(kCalls[i][0], reinterpret_cast<uint32>(call.function));
+    EXPECT_EQ(kCalls[i][1], reinterpret_cast<uint32>(call.retaddr));
+  }
+  EXPECT_EQ(end, cursor);
+
+  // There is no more data to decode.
+  TraceEnterEventData call = {};
+  EXPECT_FALSE(DecodeCompactCall(&cursor, end, &state, &call));
+}
+
+}  // namespace common
+}  // namespace trace
@@ -0,0 +1,357 @@
+// Copyright 2015 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "syzygy/trace/common/segment_compression.h"
+
+#include <algorithm>
+#include <vector>
+
+#include "base/logging.h"
+#include "third_party/zlib/zlib.h"
+
+namespace trace {
+namespace common {
+
+const size_t kLzMinMatchLength = 4;
+
+namespace {
+
+// The number of bits of the hash used to find match candidates.
+const size_t kLzHashBits = 12;
+
+// The largest offset that fits in a sequence.
+const size_t kLzMaxOffset = 0xFFFF;
+
+// The value of a token nibble that is followed by a length extension.
+const size_t kLzNibbleMax = 15;
+
+// Lengths are never allowed to grow past this while decoding.
+const size_t kLzMaxLength = 0x7FFFFFFF;
+
+// The most bytes a byte of LZ compressed data can decompress to. This is
+// reached by the extension bytes of a match length.
+const uint64 kLzMaxRatio = 255;
+
+// The most bytes a byte of deflated data can decompress to.
+const uint64 kZlibMaxRatio = 1032;
+
+const char* kCompressionNames[] = { "none", "lz", "zlib" };
+COMPILE_ASSERT(arraysize(kCompressionNames) ==
+                   TraceFileSegmentHeader::kCompressionMax,
+               compression_names_out_of_sync);
+
+uint32 Load32(const uint8* data) {
+  uint32 value = 0;
+  ::memcpy(&value, data, sizeof(value));
+  return value;
+}
+
+size_t LzHash(uint32 value) {
+  return (value * 2654435761U) >> (32 - kLzHashBits);
+}
+
+// Writes the extension bytes of a length whose token nibble is saturated.
+bool WriteLengthExtension(size_t length, uint8** cursor, uint8* end) {
+  DCHECK(cursor != NULL);
+
+  for (; length >= 255; length -= 255) {
+    if (*cursor == end)
+      return false;
+    *(*cursor)++ = 255;
+  }
+  if (*cursor == end)
+    return false;
+  *(*cursor)++ = static_cast<uint8>(length);
+  return true;
+}
+
+// Reads the extension bytes of a length whose token nibble is saturated, and
+// adds them to @p length.
+bool ReadLengthExtension(const uint8** cursor,
+                         const uint8* end,
+                         size_t* length) {
+  DCHECK(cursor != NULL);
+  DCHECK(length != NULL);
+
+  while (true) {
+    if (*cursor == end || *length > kLzMaxLength)
+      return false;
+    uint8 value = *(*cursor)++;
+    *length += value;
+    if (value != 255)
+      return true;
+  }
+}
+
+// Writes a sequence. A @p match_length of zero writes the final sequence,
+// which only holds literals.
+bool WriteLzSequence(const uint8* literals,
+                     size_t literal_length,
+                     size_t offset,
+                     size_t match_length,
+                     uint8** cursor,
+                     uint8* end) {
+  DCHECK(cursor != NULL);
+  DCHECK(match_length == 0 || match_length >= kLzMinMatchLength);
+  DCHECK_GE(kLzMaxOffset, offset);
+
+  if (*cursor == end)
+    return false;
+  uint8* token = (*cursor)++;
+  *token = static_cast<uint8>(std::min(literal_length, kLzNibbleMax) << 4);
+  if (literal_length >= kLzNibbleMax &&
+      !WriteLengthExtension(literal_length - kLzNibbleMax, cursor, end)) {
+    return false;
+  }
+  if (static_cast<size_t>(end - *cursor) < literal_length)
+    return false;
+  ::memcpy(*cursor, literals, literal_length);
+  *cursor += literal_length;
+
+  if (match_length == 0)
+    return true;
+
+  if (end - *cursor < 2)
+    return false;
+  *(*cursor)++ = static_cast<uint8>(offset);
+  *(*cursor)++ = static_cast<uint8>(offset >> 8);
+
+  match_length -= kLzMinMatchLength;
+  *token |= static_cast<uint8>(std::min(match_length, kLzNibbleMax));
+  if (match_length >= kLzNibbleMax &&
+      !WriteLengthExtension(match_length - kLzNibbleMax, cursor, end)) {
+    return false;
+  }
+
+  return true;
+}
+
+bool LzCompress(const uint8* data,
+                size_t length,
+                uint8* output,
+                size_t output_size,
+                size_t* output_length) {
+  uint8* cursor = output;
+  uint8* end = output + output_size;
+  size_t anchor = 0;
+
+  if (length >= kLzMinMatchLength) {
+    // The most recent position at which each hashed 4-byte value was seen.
+    std::vector<uint32> table(1 << kLzHashBits, 0);
+    size_t last_position = length - kLzMinMatchLength;
+    size_t position = 0;
+    while (position <= last_position) {
+      uint32 value = Load32(data + position);
+      size_t hash = LzHash(value);
+      size_t candidate = table[hash];
+      table[hash] = static_cast<uint32>(position);
+
+      if (candidate >= position || position - candidate > kLzMaxOffset ||
+          Load32(data + candidate) != value) {
+        // Skip ahead faster the longer we go without finding a match, so
+        // that incompressible data is given up on quickly.
+        position += 1 + ((position - anchor) >> 6);
+        continue;
+      }
+
+      size_t match_length = kLzMinMatchLength;
+      while (position + match_length < length &&
+             data[candidate + match_length] == data[position + match_length]) {
+        ++match_length;
+      }
+
+      if (!WriteLzSequence(data + anchor, position - anchor,
+                           position - candidate, match_length, &cursor,
+                           end)) {
+        return false;
+      }
+      position += match_length;
+      anchor = position;
+    }
+  }
+
+  if (!WriteLzSequence(data + anchor, length - anchor, 0, 0, &cursor, end))
+    return false;
+
+  *output_length = cursor - output;
+  return true;
+}
+
+bool LzDecompress(const uint8* data,
+                  size_t length,
+                  uint8* output,
+                  size_t output_length) {
+  const uint8* cursor = data;
+  const uint8* end = data + length;
+  uint8* output_cursor = output;
+  uint8* output_end = output + output_length;
+
+  while (true) {
+    if (cursor == end)
+      return false;
+    uint8 token = *cursor++;
+
+    size_t literal_length = token >> 4;
+    if (literal_length == kLzNibbleMax &&
+        !ReadLengthExtension(&cursor, end, &literal_length)) {
+      return false;
+    }
+    if (literal_length > static_cast<size_t>(end - cursor) ||
+        literal_length > static_cast<size_t>(output_end - output_cursor)) {
+      return false;
+    }
+    ::memcpy(output_cursor, cursor, literal_length);
+    cursor += literal_length;
+    output_cursor += literal_length;
+
+    // Only the final sequence has no match.
+    if (cursor == end)
+      break;
+
+    if (end - cursor < 2)
+      return false;
+    size_t offset = cursor[0] | (cursor[1] << 8);
+    cursor += 2;
+    if (offset == 0 || offset > static_cast<size_t>(output_cursor - output))
+      return false;
+
+    size_t match_length = token & 0xF;
+    if (match_length == kLzNibbleMax &&
+        !ReadLengthExtension(&cursor, end, &match_length)) {
+      return false;
+    }
+    match_length += kLzMinMatchLength;
+    if (match_length > static_cast<size_t>(output_end - output_cursor))
+      return false;
+
+    // The match may overlap the data being produced, so this must be copied
+    // a byte at a time.
+    const uint8* match = output_cursor - offset;
+    for (size_t i = 0; i < match_length; ++i)
+      output_cursor[i] = match[i];
+    output_cursor += match_length;
+  }
+
+  return output_cursor == output_end;
+}
+
+bool ZlibCompress(const uint8* data,
+                  size_t length,
+                  uint8* output,
+                  size_t output_size,
+                  size_t* output_length) {
+  uLongf compressed_length = output_size;
+  if (::compress2(output, &compressed_length, data, length, Z_BEST_SPEED) !=
+          Z_OK) {
+    return false;
+  }
+  *output_length = compressed_length;
+  return true;
+}
+
+bool ZlibDecompress(const uint8* data,
+                    size_t length,
+                    uint8* output,
+                    size_t output_length) {
+  uLongf decompressed_length = output_length;
+  if (::uncompress(output, &decompressed_length, data, length) != Z_OK)
+    return false;
+  return decompressed_length == output_length;
+}
+
+}  // namespace
+
+bool ParseSegmentCompression(const std::string& name,
+                             SegmentCompression* compression) {
+  DCHECK(compression != NULL);
+
+  for (size_t i = 0; i < arraysize(kCompressionNames); ++i) {
+    if (name == kCompressionNames[i]) {
+      *compression = static_cast<SegmentCompression>(i);
+      return true;
+    }
+  }
+  return false;
+}
+
+const char* GetSegmentCompressionName(SegmentCompression compression) {
+  DCHECK_GT(TraceFileSegmentHeader::kCompressionMax, compression);
+  return kCompressionNames[compression];
+}
+
+bool CompressSegment(SegmentCompression compression,
+                     const uint8* data,
+                     size_t length,
+                     uint8* output,
+                     size_t output_size,
+                     size_t* output_length) {
+  DCHECK(data != NULL || length == 0);
+  DCHECK(output != NULL);
+  DCHECK(output_length != NULL);
+
+  switch (compression) {
+    case TraceFileSegmentHeader::kCompressionLz:
+      return LzCompress(data, length, output, output_size, output_length);
+    case TraceFileSegmentHeader::kCompressionZlib:
+      return ZlibCompress(data, length, output, output_size, output_length);
+    default:
+      NOTREACHED() << "Invalid segment compression: " << compression << ".";
+      return false;
+  }
+}
+
+uint64 GetMaxDecompressedLength(SegmentCompression compression,
+                                size_t length) {
+  switch (compression) {
+    case TraceFileSegmentHeader::kCompressionLz:
+      return kLzMaxRatio * length;
+    case TraceFileSegmentHeader::kCompressionZlib:
+      return kZlibMaxRatio * length;
+    default:
+      return 0;
+  }
+}
+
+bool DecompressSegment(SegmentCompression compression,
+                       const uint8* data,
+                       size_t length,
+                       uint8* output,
+                       size_t output_length) {
+  DCHECK(data != NULL || length == 0);
+  DCHECK(output != NULL);
+
+  bool decompressed = false;
+  switch (compression) {
+    case TraceFileSegmentHeader::kCompressionLz:
+      decompressed = LzDecompress(data, length, output, output_length);
+      break;
+    case TraceFileSegmentHeader::kCompressionZlib:
+      decompressed = ZlibDecompress(data, length, output, output_length);
+      break;
+    default:
+      LOG(ERROR) << "Unrecognized segment compression: " << compression << ".";
+      return false;
+  }
+
+  if (!decompressed) {
+    LOG(ERROR) << "Corrupt " << GetSegmentCompressionName(compression)
+               << " compressed segment.";
+    return false;
+  }
+
+  return true;
+}
+
+}  // namespace common
+}  // namespace trace
@@ -0,0 +1,100 @@
+// Copyright 2015 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// Declares the codecs used to compress the data of trace file segments. These
+// are one-shot codecs: a segment is always compressed and decompressed as a
+// whole, and the decompressed length is recorded in its header.
+//
+// The LZ codec is a simple LZ77 variant that trades compression ratio for
+// speed. Its output is a series of sequences, each made of a token byte, an
+// optional literal length extension, the literals, then a 16-bit little-endian
+// match offset and an optional match length extension. The high nibble of the
+// token is the literal length and the low nibble is the match length minus
+// kLzMinMatchLength; a nibble of 15 is followed by extension bytes that are
+// summed until one of them is not 255. The last sequence has no match, and
+// ends the stream.
+
+#ifndef SYZYGY_TRACE_COMMON_SEGMENT_COMPRESSION_H_
+#define SYZYGY_TRACE_COMMON_SEGMENT_COMPRESSION_H_
+
+#include <string>
+
+#include "base/basictypes.h"
+#include "syzygy/trace/protocol/call_trace_defs.h"
+
+namespace trace {
+namespace common {
+
+typedef TraceFileSegmentHeader::Compression SegmentCompression;
+
+// The shortest match emitted by the LZ codec.
+extern const size_t kLzMinMatchLength;
+
+// Parses the name of a segment compression mode. The recognized names are
+// "none", "lz" and "zlib".
+// @param name The name to parse.
+// @param compression Receives the compression mode.
+// @returns true on success, false if @p name is not recognized.
+bool ParseSegmentCompression(const std::string& name,
+                             SegmentCompression* compression);
+
+// @returns the name of the given segment compression mode.
+const char* GetSegmentCompressionName(SegmentCompression compression);
+
+// Compresses segment data.
+// @param compression The compression to apply. This may not be
+//     kCompressionNone.
+// @param data The data to compress.
+// @param length The length of @p data.
+// @param output The buffer receiving the compressed data.
+// @param output_size The size of @p output.
+// @param output_length Receives the length of the compressed data.
+// @returns true on success, false if the compressed data does not fit in
+//     @p output. Callers typically use this to detect incompressible data, so
+//     this does not log.
+bool CompressSegment(SegmentCompression compression,
+                     const uint8* data,
+                     size_t length,
+                     uint8* output,
+                     size_t output_size,
+                     size_t* output_length);
+
+// Bounds the length that compressed segment data may decompress to. Readers
+// use this to reject corrupt segment headers before allocating the output of
+// DecompressSegment.
+// @param compression The compression that was applied to the data.
+// @param length The length of the compressed data.
+// @returns the largest length that @p length bytes compressed with
+//     @p compression can decompress to, or 0 if @p compression is not
+//     recognized.
+uint64 GetMaxDecompressedLength(SegmentCompression compression, size_t length);
+
+// Decompresses segment data.
+// @param compression The compression that was applied to the data.
+// @param data The compressed data.
+// @param length The length of @p data.
+// @param output The buffer receiving the decompressed data.
+// @param output_length The length of the decompressed data. This must match
+//     the length of the data that was originally compressed.
+// @returns true on success, false if the data is corrupt.
+bool DecompressSegment(SegmentCompression compression,
+                       const uint8* data,
+                       size_t length,
+                       uint8* output,
+                       size_t output_length);
+
+}  // namespace common
+}  // namespace trace
+
+#endif  // SYZYGY_TRACE_COMMON_SEGMENT_COMPRESSION_H_
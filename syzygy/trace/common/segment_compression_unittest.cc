@@ -0,0 +1,203 @@
+// Copyright 2015 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "syzygy/trace/common/segment_compression.h"
+
+#include <stdlib.h>
+
+#include <vector>
+
+#include "gtest/gtest.h"
+
+namespace trace {
+namespace common {
+
+namespace {
+
+const SegmentCompression kCompressions[] = {
+    TraceFileSegmentHeader::kCompressionLz,
+    TraceFileSegmentHeader::kCompressionZlib,
+};
+
+// Generates data that looks somewhat like a trace segment: fixed size records
+// with slowly changing fields, sprinkled with noise.
+void GenerateSegmentData(size_t length, std::vector<uint8>* data) {
+  ASSERT_TRUE(data != NULL);
+  data->resize(length);
+  for (size_t i = 0; i < length; ++i) {
+    size_t record = i / 24;
+    size_t offset = i % 24;
+    if (offset < 8)
+      (*data)[i] = static_cast<uint8>(record >> (offset % 4));
+    else if (offset < 12)
+      (*data)[i] = static_cast<uint8>(::rand());
+    else
+      (*data)[i] = static_cast<uint8>(0x10 + offset);
+  }
+}
+
+void GenerateRandomData(size_t length, std::vector<uint8>* data) {
+  ASSERT_TRUE(data != NULL);
+  data->resize(length);
+  for (size_t i = 0; i < length; ++i)
+    (*data)[i] = static_cast<uint8>(::rand());
+}
+
+// Compresses then decompresses @p data, and checks that it survived.
+void RoundTrip(SegmentCompression compression,
+               const std::vector<uint8>& data,
+               size_t* compressed_length) {
+  ASSERT_TRUE(compressed_length != NULL);
+
+  // Leave room for incompressible data.
+  std::vector<uint8> compressed(2 * data.size() + 64);
+  ASSERT_TRUE(CompressSegment(compression, data.data(), data.size(),
+                              compressed.data(), compressed.size(),
+                              compressed_length));
+  ASSERT_GE(compressed.size(), *compressed_length);
+
+  // Use one extra byte so that the output buffer is never empty.
+  std::vector<uint8> decompressed(data.size() + 1);
+  ASSERT_TRUE(DecompressSegment(compression, compressed.data(),
+                                *compressed_length, decompressed.data(),
+                                data.size()));
+  EXPECT_EQ(0, ::memcmp(data.data(), decompressed.data(), data.size()));
+}
+
+}  // namespace
+
+TEST(SegmentCompressionTest, ParseAndName) {
+  SegmentCompression compression = TraceFileSegmentHeader::kCompressionNone;
+  EXPECT_TRUE(ParseSegmentCompression("lz", &compression));
+  EXPECT_EQ(TraceFileSegmentHeader::kCompressionLz, compression);
+  EXPECT_TRUE(ParseSegmentCompression("zlib", &compression));
+  EXPECT_EQ(TraceFileSegmentHeader::kCompressionZlib, compression);
+  EXPECT_TRUE(ParseSegmentCompression("none", &compression));
+  EXPECT_EQ(TraceFileSegmentHeader::kCompressionNone, compression);
+  EXPECT_FALSE(ParseSegmentCompression("lzma", &compression));
+  EXPECT_FALSE(ParseSegmentCompression("", &compression));
+
+  for (size_t i = 0; i < TraceFileSegmentHeader::kCompressionMax; ++i) {
+    SegmentCompression expected = static_cast<SegmentCompression>(i);
+    EXPECT_TRUE(ParseSegmentCompression(GetSegmentCompressionName(expected),
+                                        &compression));
+    EXPECT_EQ(expected, compression);
+  }
+}
+
+TEST(SegmentCompressionTest, RoundTripsVariousLengths) {
+  const size_t kLengths[] = { 0, 1, kLzMinMatchLength - 1, kLzMinMatchLength,
+                              17, 255, 1000, 70000, 1024 * 1024 };
+  for (size_t i = 0; i < arraysize(kCompressions); ++i) {
+    for (size_t j = 0; j < arraysize(kLengths); ++j) {
+      std::vector<uint8> data;
+      GenerateSegmentData(kLengths[j], &data);
+      size_t compressed_length = 0;
+      ASSERT_NO_FATAL_FAILURE(RoundTrip(kCompressions[i], data,
+                                        &compressed_length));
+    }
+  }
+}
+
+TEST(SegmentCompressionTest, CompressesRedundantData) {
+  std::vector<uint8> zeros(64 * 1024, 0);
+  std::vector<uint8> segment;
+  GenerateSegmentData(64 * 1024, &segment);
+
+  for (size_t i = 0; i < arraysize(kCompressions); ++i) {
+    size_t compressed_length = 0;
+    ASSERT_NO_FATAL_FAILURE(RoundTrip(kCompressions[i], zeros,
+                                      &compressed_length));
+    EXPECT_GT(zeros.size() / 50, compressed_length);
+
+    ASSERT_NO_FATAL_FAILURE(RoundTrip(kCompressions[i], segment,
+                                      &compressed_length));
+    EXPECT_GT(segment.size() / 2, compressed_length);
+  }
+}
+
+TEST(SegmentCompressionTest, MaxDecompressedLength) {
+  // Runs of zeros are about as compressible as data gets.
+  std::vector<uint8> zeros(1024 * 1024, 0);
+  for (size_t i = 0; i < arraysize(kCompressions); ++i) {
+    size_t compressed_length = 0;
+    ASSERT_NO_FATAL_FAILURE(RoundTrip(kCompressions[i], zeros,
+                                      &compressed_length));
+    EXPECT_LE(zeros.size(),
+              GetMaxDecompressedLength(kCompressions[i], compressed_length));
+  }
+
+  EXPECT_EQ(0u, GetMaxDecompressedLength(
+      TraceFileSegmentHeader::kCompressionMax, 1000));
+}
+
+TEST(SegmentCompressionTest, RoundTripsRandomData) {
+  std::vector<uint8> data;
+  GenerateRandomData(64 * 1024, &data);
+  for (size_t i = 0; i < arraysize(kCompressions); ++i) {
+    size_t compressed_length = 0;
+    ASSERT_NO_FATAL_FAILURE(RoundTrip(kCompressions[i], data,
+                                      &compressed_length));
+  }
+}
+
+TEST(SegmentCompressionTest, FailsWhenOutputIsTooSmall) {
+  std::vector<uint8> data;
+  GenerateRandomData(4096, &data);
+  for (size_t i = 0; i < arraysize(kCompressions); ++i) {
+    // Random data doesn't compress, so it can't fit in a smaller buffer.
+    std::vector<uint8> compressed(data.size() - 1);
+    size_t compressed_length = 0;
+    EXPECT_FALSE(CompressSegment(kCompressions[i], data.data(), data.size(),
+                                 compressed.data(), compressed.size(),
+                                 &compressed_length));
+  }
+}
+
+TEST(SegmentCompressionTest, RejectsCorruptData) {
+  std::vector<uint8> data;
+  GenerateSegmentData(4096, &data);
+
+  for (size_t i = 0; i < arraysize(kCompressions); ++i) {
+    std::vector<uint8> compressed(2 * data.size());
+    size_t compressed_length = 0;
+    ASSERT_TRUE(CompressSegment(kCompressions[i], data.data(), data.size(),
+                                compressed.data(), compressed.size(),
+                                &compressed_length));
+    std::vector<uint8> decompressed(data.size());
+
+    // A wrong decompressed length is detected.
+    EXPECT_FALSE(DecompressSegment(kCompressions[i], compressed.data(),
+                                   compressed_length, decompressed.data(),
+                                   data.size() - 1));
+
+    // So is truncated data.
+    EXPECT_FALSE(DecompressSegment(kCompressions[i], compressed.data(),
+                                   compressed_length / 2, decompressed.data(),
+                                   data.size()));
+
+    // Flipping bytes may or may not be detected, but must never read or
+    // write out of bounds.
+    for (size_t j = 0; j < 100; ++j) {
+      std::vector<uint8> corrupt(compressed.begin(),
+                                 compressed.begin() + compressed_length);
+      corrupt[::rand() % corrupt.size()] ^= 1 + ::rand() % 255;
+      DecompressSegment(kCompressions[i], corrupt.data(), corrupt.size(),
+                        decompressed.data(), decompressed.size());
+    }
+  }
+}
+
+}  // namespace common
+}  // namespace trace
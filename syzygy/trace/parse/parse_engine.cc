@@ -19,9 +19,13 @@
 #include <wmistr.h>  // NOLINT
 #include <evntrace.h>
 
+#include <algorithm>
+#include <vector>
+
 #include "base/logging.h"
 #include "syzygy/common/buffer_parser.h"
 #include "syzygy/common/com_utils.h"
+#include "syzygy/trace/common/compact_encoding.h"
 #include "syzygy/trace/parse/parser.h"
 
 namespace trace {
@@ -31,6 +35,7 @@ using ::common::BinaryBufferReader;
 
 ParseEngine::ParseEngine(const char* name, bool fail_on_module_conflict)
     : event_handler_(NULL),
+      module_information_owner_(NULL),
       error_occurred_(false),
       fail_on_module_conflict_(fail_on_module_conflict) {
   DCHECK(name != NULL);
@@ -59,8 +64,29 @@ void ParseEngine::set_event_handler(ParseEventHandler* event_handler) {
   event_handler_ = event_handler;
 }
 
+bool ParseEngine::ConsumeAllEventsInParallel(
+    ParseEventHandlerShardFactory* shard_factory,
+    size_t max_workers) {
+  LOG(ERROR) << "The " << name_ << " parse engine does not support parallel "
+             << "consumption.";
+  return false;
+}
+
+void ParseEngine::ShareModuleInformation(ParseEngine* owner) {
+  DCHECK(owner != NULL);
+  DCHECK(owner != this);
+  DCHECK(module_information_owner_ == NULL);
+  DCHECK(processes_.empty());
+
+  module_information_owner_ = owner;
+}
+
 const ModuleInformation* ParseEngine::GetModuleInformation(
     uint32 process_id, AbsoluteAddress64 addr) const {
+  if (module_information_owner_ != NULL)
+    return module_information_owner_->GetModuleInformation(process_id, addr);
+
+  base::AutoLock auto_lock(processes_lock_);
   ProcessMap::const_iterator processes_it = processes_.find(process_id);
   if (processes_it == processes_.end())
     return NULL;
@@ -77,6 +103,11 @@ const ModuleInformation* ParseEngine::GetModuleInformation(
 
 bool ParseEngine::AddModuleInformation(DWORD process_id,
                                        const ModuleInformation& module_info) {
+  if (module_information_owner_ != NULL) {
+    return module_information_owner_->AddModuleInformation(process_id,
+                                                           module_info);
+  }
+
   // Avoid doing needless work.
   if (module_info.module_size == 0)
     return true;
@@ -86,6 +117,7 @@ bool ParseEngine::AddModuleInformation(DWORD process_id,
   if (module_info.path.empty())
     return true;
 
+  base::AutoLock auto_lock(processes_lock_);
   ModuleSpace& module_space = processes_[process_id];
   AbsoluteAddress64 addr(module_info.base_address.value());
   ModuleSpace::Range range(addr, module_info.module_size);
@@ -137,6 +169,11 @@ bool ParseEngine::AddModuleInformation(DWORD process_id,
 
 bool ParseEngine::RemoveModuleInformation(
     DWORD process_id, const ModuleInformation& module_info) {
+  if (module_information_owner_ != NULL) {
+    return module_information_owner_->RemoveModuleInformation(process_id,
+                                                              module_info);
+  }
+
   // Avoid doing needless work.
   if (module_info.module_size == 0)
     return true;
@@ -146,6 +183,7 @@ bool ParseEngine::RemoveModuleInformation(
   if (module_info.path.empty())
     return true;
 
+  base::AutoLock auto_lock(processes_lock_);
   ModuleSpace& module_space = processes_[process_id];
   AbsoluteAddress64 addr(module_info.base_address.value());
   ModuleSpace::Range range(addr, module_info.module_size);
@@ -178,6 +216,10 @@ bool ParseEngine::RemoveModuleInformation(
 }
 
 bool ParseEngine::RemoveProcessInformation(DWORD process_id) {
+  if (module_information_owner_ != NULL)
+    return module_information_owner_->RemoveProcessInformation(process_id);
+
+  base::AutoLock auto_lock(processes_lock_);
   ProcessMap::iterator proc_iter = processes_.find(process_id);
   if (proc_iter == processes_.end()) {
     LOG(ERROR) << "Unknown process id: " << process_id << ".";
@@ -215,6 +257,10 @@ bool ParseEngine::DispatchEvent(EVENT_TRACE* event) {
       success = DispatchBatchEnterEvent(event);
       break;
 
+    case TRACE_BATCH_ENTER_COMPACT:
+      success = DispatchBatchEnterCompactEvent(event);
+      break;
+
     case TRACE_PROCESS_ATTACH_EVENT:
     case TRACE_PROCESS_DETACH_EVENT:
     case TRACE_THREAD_ATTACH_EVENT:
@@ -356,6 +402,56 @@ bool ParseEngine::DispatchBatchEnterEvent(EVENT_TRACE* event) {
   return true;
 }
 
+bool ParseEngine::DispatchBatchEnterCompactEvent(EVENT_TRACE* event) {
+  DCHECK_NE(static_cast<EVENT_TRACE*>(nullptr), event);
+  DCHECK_NE(static_cast<ParseEventHandler*>(nullptr), event_handler_);
+  DCHECK(!error_occurred_);
+
+  BinaryBufferReader reader(event->MofData, event->MofLength);
+  const TraceBatchEnterCompactData* data = NULL;
+  if (!reader.Read(&data)) {
+    LOG(ERROR) << "Short or empty compact batch event.";
+    return false;
+  }
+
+  // Each call takes at least two bytes, which bounds the size of the
+  // expanded record before it is allocated.
+  const uint8* cursor = reinterpret_cast<const uint8*>(data + 1);
+  const uint8* end = cursor + reader.RemainingBytes();
+  if (data->num_calls > static_cast<size_t>(end - cursor) / 2) {
+    LOG(ERROR) << "Short compact batch event data. Expected "
+               << data->num_calls << " entries but batch record was only "
+               << event->MofLength << " bytes.";
+    return false;
+  }
+
+  // Expand the calls to a TraceBatchEnterData.
+  size_t num_slots = std::max(data->num_calls, 1U);
+  std::vector<uint8> buffer(FIELD_OFFSET(TraceBatchEnterData, calls) +
+                            num_slots * sizeof(TraceEnterEventData));
+  TraceBatchEnterData* batch =
+      reinterpret_cast<TraceBatchEnterData*>(buffer.data());
+  batch->thread_id = data->thread_id;
+  batch->num_calls = data->num_calls;
+
+  trace::common::CompactCallState state = {};
+  for (size_t i = 0; i < data->num_calls; ++i) {
+    if (!trace::common::DecodeCompactCall(&cursor, end, &state,
+                                          &batch->calls[i])) {
+      LOG(ERROR) << "Malformed call " << i << " of " << data->num_calls
+                 << " in compact batch event.";
+      return false;
+    }
+  }
+
+  base::Time time(base::Time::FromFileTime(
+      reinterpret_cast<FILETIME&>(event->Header.TimeStamp)));
+  DWORD process_id = event->Header.ProcessId;
+  DWORD thread_id = data->thread_id;
+  event_handler_->OnBatchFunctionEntry(time, process_id, thread_id, batch);
+  return true;
+}
+
 bool ParseEngine::DispatchProcessEndedEvent(EVENT_TRACE* event) {
   DCHECK_NE(static_cast<EVENT_TRACE*>(nullptr), event);
   DCHECK_NE(static_cast<ParseEventHandler*>(nullptr), event_handler_);
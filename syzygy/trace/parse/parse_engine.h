@@ -21,6 +21,7 @@
 #include <set>
 #include <string>
 
+#include "base/synchronization/lock.h"
 #include "syzygy/pe/pe_file.h"
 #include "syzygy/trace/parse/parser.h"
 
@@ -64,6 +65,17 @@ class ParseEngine {
   // @returns true on success.
   virtual bool ConsumeAllEvents() = 0;
 
+  // Consume all events across all currently open trace files, in parallel.
+  // See Parser::ConsumeInParallel for details. The default implementation
+  // fails, as not all parse engines support parallel consumption.
+  //
+  // @param shard_factory the factory creating and reducing the shards.
+  // @param max_workers the maximal number of worker threads to use.
+  // @returns true on success.
+  virtual bool ConsumeAllEventsInParallel(
+      ParseEventHandlerShardFactory* shard_factory,
+      size_t max_workers);
+
   // Close all currently open trace files.
   //
   // @returns true on success.
@@ -79,6 +91,16 @@ class ParseEngine {
   const ModuleInformation* GetModuleInformation(uint32 process_id,
                                                 AbsoluteAddress64 addr) const;
 
+  // Makes this engine track modules in the process map of @p owner rather
+  // than in its own. This is used by the worker engines consuming trace files
+  // in parallel on behalf of @p owner. The process map is guarded by a lock,
+  // but the module information of a given process must only be updated by
+  // one engine at a time.
+  //
+  // @param owner the engine owning the process map. It must outlive this
+  //     engine.
+  void ShareModuleInformation(ParseEngine* owner);
+
  protected:
   // Used to store module information about each observed process.
   typedef std::map<uint32, ModuleSpace> ProcessMap;
@@ -152,6 +174,17 @@ class ParseEngine {
   //     true.
   bool DispatchBatchEnterEvent(EVENT_TRACE* event);
 
+  // Parses and dispatches compact batch function entry events. These are
+  // expanded and handed to the event handler as regular batch function entry
+  // events. Called from DispatchEvent().
+  //
+  // @param event The event to dispatch.
+  //
+  // @returns true if the event was successfully dispatched, false otherwise.
+  //     If an error occurred, the error_occurred_ flag will be set to
+  //     true.
+  bool DispatchBatchEnterCompactEvent(EVENT_TRACE* event);
+
   // Parses and dispatches a process ended event. Called from DispatchEvent().
   //
   // @param event The event to dispatch.
@@ -248,6 +281,13 @@ class ParseEngine {
   // For each process, we store its point of view of the world.
   ProcessMap processes_;
 
+  // Guards |processes_|, which may be shared with worker engines.
+  mutable base::Lock processes_lock_;
+
+  // If non-NULL, the engine whose process map is used instead of
+  // |processes_|.
+  ParseEngine* module_information_owner_;
+
   // Flag indicating whether or not an error has occurred in parsing the trace
   // event stream.
   bool error_occurred_;
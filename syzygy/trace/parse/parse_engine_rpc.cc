@@ -16,10 +16,17 @@
 
 #include "syzygy/trace/parse/parse_engine_rpc.h"
 
+#include <algorithm>
+#include <map>
+
 #include "base/logging.h"
 #include "base/files/file_util.h"
+#include "base/memory/scoped_vector.h"
+#include "base/threading/simple_thread.h"
+#include "base/win/scoped_handle.h"
 #include "syzygy/common/align.h"
 #include "syzygy/common/com_utils.h"
+#include "syzygy/trace/common/segment_compression.h"
 #include "syzygy/trace/parse/parse_utils.h"
 
 using common::AlignUp;
@@ -28,7 +35,247 @@ using common::AlignUp64;
 namespace trace {
 namespace parser {
 
-ParseEngineRpc::ParseEngineRpc() : ParseEngine("RPC", true) {
+namespace {
+
+// A copy-on-write mapping of a trace file, accessed through a sliding view.
+// Only a window of the file is mapped at any time, so that trace files larger
+// than the address space can be consumed.
+class MappedTraceFile {
+ public:
+  MappedTraceFile()
+      : size_(0), view_(NULL), view_offset_(0), view_size_(0),
+        granularity_(0) {
+  }
+
+  ~MappedTraceFile() {
+    Unmap();
+  }
+
+  // Opens and maps the file at @p path.
+  // @param path the path of the trace file.
+  // @returns true on success, false otherwise.
+  bool Open(const base::FilePath& path);
+
+  // Ensures that a range of the file is mapped. This invalidates the pointers
+  // previously returned if the view must be moved.
+  // @param offset the offset of the range in the file.
+  // @param length the length of the range. Must be non-zero.
+  // @returns a pointer to the range, NULL on failure.
+  uint8* MapRange(uint64 offset, size_t length);
+
+  // @returns the size of the file.
+  uint64 size() const { return size_; }
+
+ private:
+  void Unmap();
+
+  // The size of the view we try to map. This is large enough to amortize the
+  // cost of remapping, while leaving room in a 32-bit address space.
+  static const size_t kViewSize = 64 * 1024 * 1024;
+
+  base::win::ScopedHandle file_;
+  base::win::ScopedHandle mapping_;
+  uint64 size_;
+
+  // The currently mapped view, and the range of the file it covers.
+  uint8* view_;
+  uint64 view_offset_;
+  size_t view_size_;
+
+  // Views must start on a multiple of the allocation granularity.
+  size_t granularity_;
+
+  DISALLOW_COPY_AND_ASSIGN(MappedTraceFile);
+};
+
+bool MappedTraceFile::Open(const base::FilePath& path) {
+  // The segments are consumed front to back, so hint the cache manager to
+  // read ahead aggressively.
+  file_.Set(::CreateFile(path.value().c_str(), GENERIC_READ, FILE_SHARE_READ,
+                         NULL, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN,
+                         NULL));
+  if (!file_.IsValid()) {
+    DWORD error = ::GetLastError();
+    LOG(ERROR) << "Unable to open '" << path.value() << "': "
+               << ::common::LogWe(error) << ".";
+    return false;
+  }
+
+  LARGE_INTEGER size = {};
+  if (!::GetFileSizeEx(file_.Get(), &size)) {
+    DWORD error = ::GetLastError();
+    LOG(ERROR) << "Unable to get the size of '" << path.value() << "': "
+               << ::common::LogWe(error) << ".";
+    return false;
+  }
+  size_ = size.QuadPart;
+
+  // Empty files can't be mapped, but there's nothing to consume anyway.
+  if (size_ == 0)
+    return true;
+
+  // A copy-on-write mapping allows handing out writable pointers into the
+  // file without the ability to modify it.
+  mapping_.Set(::CreateFileMapping(file_.Get(), NULL, PAGE_WRITECOPY, 0, 0,
+                                   NULL));
+  if (!mapping_.IsValid()) {
+    DWORD error = ::GetLastError();
+    LOG(ERROR) << "Unable to map '" << path.value() << "': "
+               << ::common::LogWe(error) << ".";
+    return false;
+  }
+
+  SYSTEM_INFO system_info = {};
+  ::GetSystemInfo(&system_info);
+  granularity_ = system_info.dwAllocationGranularity;
+
+  return true;
+}
+
+uint8* MappedTraceFile::MapRange(uint64 offset, size_t length) {
+  DCHECK_LT(0U, length);
+  DCHECK_LE(offset + length, size_);
+
+  // Reuse the current view if it covers the range.
+  if (view_ != NULL && offset >= view_offset_ &&
+      offset + length <= view_offset_ + view_size_) {
+    return view_ + (offset - view_offset_);
+  }
+
+  Unmap();
+
+  uint64 view_offset = offset - offset % granularity_;
+  uint64 view_end = std::max<uint64>(offset + length, view_offset + kViewSize);
+  view_end = std::min(view_end, size_);
+  size_t view_size = static_cast<size_t>(view_end - view_offset);
+
+  void* view = ::MapViewOfFile(mapping_.Get(), FILE_MAP_COPY,
+                               static_cast<DWORD>(view_offset >> 32),
+                               static_cast<DWORD>(view_offset),
+                               view_size);
+  if (view == NULL) {
+    DWORD error = ::GetLastError();
+    LOG(ERROR) << "Unable to map view of trace file at offset " << view_offset
+               << ": " << ::common::LogWe(error) << ".";
+    return NULL;
+  }
+
+  view_ = reinterpret_cast<uint8*>(view);
+  view_offset_ = view_offset;
+  view_size_ = view_size;
+
+  return view_ + (offset - view_offset_);
+}
+
+void MappedTraceFile::Unmap() {
+  if (view_ == NULL)
+    return;
+
+  if (!::UnmapViewOfFile(view_)) {
+    DWORD error = ::GetLastError();
+    LOG(ERROR) << "Failed to unmap view of trace file: "
+               << ::common::LogWe(error) << ".";
+  }
+
+  view_ = NULL;
+  view_offset_ = 0;
+  view_size_ = 0;
+}
+
+// Reads the id of the process that generated a trace file.
+bool ReadTraceFileProcessId(const base::FilePath& trace_file_path,
+                            uint32* process_id) {
+  DCHECK(process_id != NULL);
+
+  base::ScopedFILE trace_file(base::OpenFile(trace_file_path, "rb"));
+  if (!trace_file.get()) {
+    DWORD error = ::GetLastError();
+    LOG(ERROR) << "Unable to open '" << trace_file_path.value() << "': "
+               << ::common::LogWe(error) << ".";
+    return false;
+  }
+
+  TraceFileHeader file_header = {};
+  if (::fread(&file_header, sizeof(file_header), 1, trace_file.get()) != 1) {
+    LOG(ERROR) << "Failed to read trace file header.";
+    return false;
+  }
+
+  if (0 != ::memcmp(&file_header.signature,
+                    &TraceFileHeader::kSignatureValue,
+                    sizeof(file_header.signature))) {
+    LOG(ERROR) << "Not a valid RPC call-trace file.";
+    return false;
+  }
+
+  *process_id = file_header.process_id;
+  return true;
+}
+
+// Consumes a sequence of trace files on a worker thread, each with its own
+// worker engine and handler shard.
+class TraceFileConsumer : public base::DelegateSimpleThread::Delegate {
+ public:
+  // @param owner the engine on whose behalf the trace files are consumed.
+  // @param use_memory_mapping whether to memory map the trace files.
+  TraceFileConsumer(ParseEngine* owner, bool use_memory_mapping)
+      : owner_(owner),
+        use_memory_mapping_(use_memory_mapping),
+        succeeded_(false) {
+    DCHECK(owner != NULL);
+  }
+
+  // Adds a trace file to consume.
+  // @param trace_file_path the path of the trace file.
+  // @param shard the handler shard receiving the events of the trace file.
+  void AddTraceFile(const base::FilePath& trace_file_path,
+                    ParseEventHandler* shard) {
+    DCHECK(shard != NULL);
+    trace_files_.push_back(std::make_pair(trace_file_path, shard));
+  }
+
+  // @name base::DelegateSimpleThread::Delegate implementation.
+  // @{
+  virtual void Run() override {
+    for (size_t i = 0; i < trace_files_.size(); ++i) {
+      ParseEngineRpc engine;
+      engine.ShareModuleInformation(owner_);
+      engine.set_use_memory_mapping(use_memory_mapping_);
+      engine.set_event_handler(trace_files_[i].second);
+
+      if (!engine.OpenTraceFile(trace_files_[i].first) ||
+          !engine.ConsumeAllEvents() ||
+          engine.error_occurred()) {
+        LOG(ERROR) << "Failed to consume '" << trace_files_[i].first.value()
+                   << "'.";
+        return;
+      }
+    }
+
+    succeeded_ = true;
+  }
+  // @}
+
+  // @returns true if all trace files were consumed successfully.
+  // @note This is only valid once Run has returned.
+  bool succeeded() const { return succeeded_; }
+
+ private:
+  typedef std::vector<std::pair<base::FilePath, ParseEventHandler*>>
+      TraceFiles;
+
+  ParseEngine* owner_;
+  bool use_memory_mapping_;
+  TraceFiles trace_files_;
+  bool succeeded_;
+
+  DISALLOW_COPY_AND_ASSIGN(TraceFileConsumer);
+};
+
+}  // namespace
+
+ParseEngineRpc::ParseEngineRpc()
+    : ParseEngine("RPC", true), use_memory_mapping_(false) {
 }
 
 ParseEngineRpc::~ParseEngineRpc() {
@@ -81,6 +328,67 @@ bool ParseEngineRpc::ConsumeAllEvents() {
   return true;
 }
 
+bool ParseEngineRpc::ConsumeAllEventsInParallel(
+    ParseEventHandlerShardFactory* shard_factory,
+    size_t max_workers) {
+  DCHECK(shard_factory != NULL);
+  DCHECK_LT(0U, max_workers);
+
+  // Each trace file normally comes from a distinct process. Trace files from
+  // a same process (i.e., process id reuse) update the same module space, so
+  // they are consumed in order by a single worker.
+  ScopedVector<TraceFileConsumer> consumers;
+  std::map<uint32, TraceFileConsumer*> consumers_by_process_id;
+  std::vector<ParseEventHandler*> shards;
+  TraceFileIter it = trace_file_set_.begin();
+  for (; it != trace_file_set_.end(); ++it) {
+    uint32 process_id = 0;
+    if (!ReadTraceFileProcessId(*it, &process_id))
+      return false;
+
+    ParseEventHandler* shard = shard_factory->CreateShard();
+    if (shard == NULL) {
+      LOG(ERROR) << "Failed to create handler shard.";
+      return false;
+    }
+    shards.push_back(shard);
+
+    TraceFileConsumer*& consumer = consumers_by_process_id[process_id];
+    if (consumer == NULL) {
+      consumer = new TraceFileConsumer(this, use_memory_mapping_);
+      consumers.push_back(consumer);
+    }
+    consumer->AddTraceFile(*it, shard);
+  }
+
+  if (!consumers.empty()) {
+    base::DelegateSimpleThreadPool pool(
+        "ParseEngineRpc",
+        static_cast<int>(std::min(max_workers, consumers.size())));
+    pool.Start();
+    for (size_t i = 0; i < consumers.size(); ++i)
+      pool.AddWork(consumers[i]);
+    pool.JoinAll();
+  }
+
+  for (size_t i = 0; i < consumers.size(); ++i) {
+    if (!consumers[i]->succeeded()) {
+      set_error_occurred(true);
+      return false;
+    }
+  }
+
+  // Reduce the shards on this thread, in trace file order.
+  for (size_t i = 0; i < shards.size(); ++i) {
+    if (!shard_factory->ReduceShard(shards[i])) {
+      LOG(ERROR) << "Failed to reduce handler shard.";
+      return false;
+    }
+  }
+
+  return true;
+}
+
 bool ParseEngineRpc::ConsumeTraceFile(const base::FilePath& trace_file_path) {
   DCHECK(!trace_file_path.empty());
 
@@ -176,8 +484,14 @@ bool ParseEngineRpc::ConsumeTraceFile(const base::FilePath& trace_file_path) {
   // Consume the body of the trace file.
   uint64 next_segment = AlignUp64(file_header->header_size,
                                   file_header->block_size);
+  if (use_memory_mapping_) {
+    trace_file.reset();
+    return ConsumeMappedSegments(trace_file_path, *file_header, next_segment);
+  }
+
   scoped_ptr<uint8> buffer;
   size_t buffer_size = 0;
+  std::vector<uint8> decompression_buffer;
   while (true) {
     if (::_fseeki64(trace_file.get(), next_segment, SEEK_SET) != 0) {
       LOG(ERROR) << "Failed to seek segment boundary " << next_segment << ".";
@@ -227,10 +541,8 @@ bool ParseEngineRpc::ConsumeTraceFile(const base::FilePath& trace_file_path) {
       return false;
     }
 
-    if (!ConsumeSegmentEvents(*file_header,
-                              segment_header,
-                              buffer.get(),
-                              segment_header.segment_length)) {
+    if (!ConsumeSegment(*file_header, segment_header, buffer.get(),
+                        &decompression_buffer)) {
       return false;
     }
 
@@ -243,6 +555,120 @@ bool ParseEngineRpc::ConsumeTraceFile(const base::FilePath& trace_file_path) {
   return true;
 }
 
+bool ParseEngineRpc::ConsumeMappedSegments(
+    const base::FilePath& trace_file_path,
+    const TraceFileHeader& file_header,
+    uint64 next_segment) {
+  DCHECK(!trace_file_path.empty());
+
+  MappedTraceFile mapped_file;
+  if (!mapped_file.Open(trace_file_path))
+    return false;
+
+  const size_t kSegmentHeaderSize =
+      sizeof(RecordPrefix) + sizeof(TraceFileSegmentHeader);
+
+  std::vector<uint8> decompression_buffer;
+
+  // As in the buffered path, running out of data at a segment boundary marks
+  // the end of the trace file.
+  while (next_segment + sizeof(RecordPrefix) <= mapped_file.size()) {
+    if (next_segment + kSegmentHeaderSize > mapped_file.size()) {
+      LOG(ERROR) << "Failed to read segment header.";
+      return false;
+    }
+
+    const uint8* headers = mapped_file.MapRange(next_segment,
+                                                kSegmentHeaderSize);
+    if (headers == NULL)
+      return false;
+
+    const RecordPrefix* segment_prefix =
+        reinterpret_cast<const RecordPrefix*>(headers);
+    if (segment_prefix->type != TraceFileSegmentHeader::kTypeId ||
+        segment_prefix->size != sizeof(TraceFileSegmentHeader) ||
+        segment_prefix->version.hi != TRACE_VERSION_HI ||
+        segment_prefix->version.lo != TRACE_VERSION_LO) {
+      LOG(ERROR) << "Unrecognized record prefix for segment header.";
+      return false;
+    }
+
+    // Copy the segment header, as mapping the segment data may move the view.
+    TraceFileSegmentHeader segment_header =
+        *reinterpret_cast<const TraceFileSegmentHeader*>(segment_prefix + 1);
+
+    uint64 segment_start = next_segment + kSegmentHeaderSize;
+    if (segment_start + segment_header.segment_length > mapped_file.size()) {
+      LOG(ERROR) << "Failed to read segment.";
+      return false;
+    }
+
+    if (segment_header.segment_length > 0) {
+      uint8* segment = mapped_file.MapRange(segment_start,
+                                            segment_header.segment_length);
+      if (segment == NULL)
+        return false;
+
+      if (!ConsumeSegment(file_header, segment_header, segment,
+                          &decompression_buffer)) {
+        return false;
+      }
+    }
+
+    next_segment = AlignUp64(segment_start + segment_header.segment_length,
+                             file_header.block_size);
+  }
+
+  return true;
+}
+
+bool ParseEngineRpc::ConsumeSegment(
+    const TraceFileHeader& file_header,
+    const TraceFileSegmentHeader& segment_header,
+    uint8* segment,
+    std::vector<uint8>* decompression_buffer) {
+  DCHECK(segment != NULL);
+  DCHECK(decompression_buffer != NULL);
+
+  if (segment_header.compression == TraceFileSegmentHeader::kCompressionNone) {
+    return ConsumeSegmentEvents(file_header, segment_header, segment,
+                                segment_header.segment_length);
+  }
+
+  // An empty segment is never compressed.
+  if (segment_header.uncompressed_length == 0) {
+    LOG(ERROR) << "Invalid compressed segment length.";
+    return false;
+  }
+
+  // The length comes from the trace file, so check that it is plausible
+  // before allocating that much.
+  if (segment_header.uncompressed_length >
+          trace::common::GetMaxDecompressedLength(
+              static_cast<trace::common::SegmentCompression>(
+                  segment_header.compression),
+              segment_header.segment_length)) {
+    LOG(ERROR) << "Invalid uncompressed segment length.";
+    return false;
+  }
+
+  decompression_buffer->resize(segment_header.uncompressed_length);
+  if (!trace::common::DecompressSegment(
+          static_cast<trace::common::SegmentCompression>(
+              segment_header.compression),
+          segment,
+          segment_header.segment_length,
+          decompression_buffer->data(),
+          decompression_buffer->size())) {
+    LOG(ERROR) << "Failed to decompress segment.";
+    return false;
+  }
+
+  return ConsumeSegmentEvents(file_header, segment_header,
+                              decompression_buffer->data(),
+                              decompression_buffer->size());
+}
+
 bool ParseEngineRpc::ConsumeSegmentEvents(
     const TraceFileHeader& file_header,
     const TraceFileSegmentHeader& segment_header,
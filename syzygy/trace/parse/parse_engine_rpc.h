@@ -36,9 +36,23 @@ class ParseEngineRpc : public ParseEngine {
       const base::FilePath& trace_file_path) override;
   virtual bool OpenTraceFile(const base::FilePath& trace_file_path) override;
   virtual bool ConsumeAllEvents() override;
+  virtual bool ConsumeAllEventsInParallel(
+      ParseEventHandlerShardFactory* shard_factory,
+      size_t max_workers) override;
   virtual bool CloseAllTraceFiles() override;
   // @}
 
+  // @name Accessors and mutators.
+  // @{
+  // If true, the body of each trace file is memory mapped and events are
+  // dispatched directly out of the mapped segments. Otherwise, each segment
+  // is read into an intermediate buffer. Defaults to false.
+  bool use_memory_mapping() const { return use_memory_mapping_; }
+  void set_use_memory_mapping(bool use_memory_mapping) {
+    use_memory_mapping_ = use_memory_mapping;
+  }
+  // @}
+
  private:
   // A set of trace file paths.
   typedef std::vector<base::FilePath> TraceFileSet;
@@ -53,6 +67,31 @@ class ParseEngineRpc : public ParseEngine {
   // @returns true on success
   bool ConsumeTraceFile(const base::FilePath& trace_file_path);
 
+  // Dispatches all of the events contained in the segments of the given trace
+  // file by mapping it into memory.
+  //
+  // @param trace_file_path the path of the trace file.
+  // @param file_header the header information describing the trace file.
+  // @param next_segment the file offset of the first segment.
+  // @returns true on success.
+  bool ConsumeMappedSegments(const base::FilePath& trace_file_path,
+                             const TraceFileHeader& file_header,
+                             uint64 next_segment);
+
+  // Dispatches all of the events in the given segment, decompressing it
+  // first if need be.
+  //
+  // @param file_header the header information describing the trace file.
+  // @param segment_header the header information describing the segment.
+  // @param segment the segment data, as stored in the trace file.
+  // @param decompression_buffer a scratch buffer used to hold the
+  //     decompressed segment data. This is reused across calls.
+  // @returns true on success.
+  bool ConsumeSegment(const TraceFileHeader& file_header,
+                      const TraceFileSegmentHeader& segment_header,
+                      uint8* segment,
+                      std::vector<uint8>* decompression_buffer);
+
   // Dispatches all of the events in the given segment buffer.
   //
   // @param file_header the header information describing the trace file.
@@ -68,6 +107,9 @@ class ParseEngineRpc : public ParseEngine {
   // The set of trace files to consume when ConsumeAllEvents() is called.
   TraceFileSet trace_file_set_;
 
+  // Indicates whether trace files should be memory mapped.
+  bool use_memory_mapping_;
+
   DISALLOW_COPY_AND_ASSIGN(ParseEngineRpc);
 };
 
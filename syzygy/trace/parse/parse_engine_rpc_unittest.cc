@@ -28,6 +28,7 @@
 #include "base/memory/scoped_vector.h"
 #include "base/strings/stringprintf.h"
 #include "base/strings/utf_string_conversions.h"
+#include "base/sys_info.h"
 #include "base/threading/simple_thread.h"
 #include "base/win/event_trace_consumer.h"
 #include "base/win/event_trace_controller.h"
@@ -35,17 +36,22 @@
 #include "base/win/windows_version.h"
 #include "gmock/gmock.h"
 #include "gtest/gtest.h"
+#include "syzygy/common/align.h"
 #include "syzygy/pe/unittest_util.h"
+#include "syzygy/testing/metrics.h"
 #include "syzygy/trace/common/unittest_util.h"
 #include "syzygy/trace/parse/parser.h"
 #include "syzygy/trace/service/process_info.h"
+#include "syzygy/trace/service/trace_file_writer.h"
 
 namespace trace {
 namespace service {
 namespace {
 
 using ::trace::parser::Parser;
+using ::trace::parser::ParseEventHandler;
 using ::trace::parser::ParseEventHandlerImpl;
+using ::trace::parser::ParseEventHandlerShardFactory;
 
 static const uint32 kConstantInThisModule = 0;
 
@@ -475,6 +481,155 @@ class IndirectFunctionThread : public base::DelegateSimpleThread::Delegate {
 // through hoops to copy-initialize arrays of them.
 typedef ScopedVector<IndirectFunctionThread> IndirectFunctionThreads;
 
+// Counts the function entry events it receives.
+class CountingParseEventHandler : public ParseEventHandlerImpl {
+ public:
+  CountingParseEventHandler() : function_entries_(0), checksum_(0) {
+  }
+
+  virtual void OnFunctionEntry(base::Time time,
+                               DWORD process_id,
+                               DWORD thread_id,
+                               const TraceEnterExitEventData* data) override {
+    ++function_entries_;
+    checksum_ += reinterpret_cast<uint32>(data->function);
+  }
+
+  size_t function_entries() const { return function_entries_; }
+  uint32 checksum() const { return checksum_; }
+
+ private:
+  size_t function_entries_;
+  uint32 checksum_;
+};
+
+// Creates counting handler shards, and sums their counts.
+class CountingShardFactory : public ParseEventHandlerShardFactory {
+ public:
+  CountingShardFactory() : function_entries_(0), checksum_(0) {
+  }
+
+  virtual ParseEventHandler* CreateShard() override {
+    CountingParseEventHandler* shard = new CountingParseEventHandler();
+    shards_.push_back(shard);
+    return shard;
+  }
+
+  virtual bool ReduceShard(ParseEventHandler* shard) override {
+    CountingParseEventHandler* counting_shard =
+        static_cast<CountingParseEventHandler*>(shard);
+    function_entries_ += counting_shard->function_entries();
+    checksum_ += counting_shard->checksum();
+    return true;
+  }
+
+  size_t num_shards() const { return shards_.size(); }
+  size_t function_entries() const { return function_entries_; }
+  uint32 checksum() const { return checksum_; }
+
+ private:
+  ScopedVector<CountingParseEventHandler> shards_;
+  size_t function_entries_;
+  uint32 checksum_;
+};
+
+// Consumes trace files that are synthesized directly, without going through
+// the call trace service.
+class ParseEngineRpcSyntheticTest : public testing::PELibUnitTest {
+ public:
+  typedef testing::PELibUnitTest Super;
+
+  virtual void SetUp() override {
+    Super::SetUp();
+    ASSERT_NO_FATAL_FAILURE(CreateTemporaryDir(&temp_dir_));
+    trace_file_path_ = temp_dir_.Append(L"trace-synthetic.bin");
+    compression_ = TraceFileSegmentHeader::kCompressionNone;
+  }
+
+  // Writes a trace file made of @p num_segments segments, each holding
+  // @p events_per_segment function entry events.
+  void WriteTraceFile(size_t num_segments, size_t events_per_segment) {
+    ASSERT_NO_FATAL_FAILURE(WriteProcessTraceFile(
+        trace_file_path_, ::GetCurrentProcessId(), num_segments,
+        events_per_segment));
+  }
+
+  // Writes a trace file at @p path, attributed to the process @p process_id.
+  void WriteProcessTraceFile(const base::FilePath& path,
+                             uint32 process_id,
+                             size_t num_segments,
+                             size_t events_per_segment) {
+    TraceFileWriter writer;
+    writer.set_compression(compression_);
+    ASSERT_TRUE(writer.Open(path));
+
+    ProcessInfo process_info;
+    ASSERT_TRUE(process_info.Initialize(::GetCurrentProcessId()));
+    process_info.process_id = process_id;
+    ASSERT_TRUE(writer.WriteHeader(process_info));
+
+    const size_t kHeaderSize =
+        sizeof(RecordPrefix) + sizeof(TraceFileSegmentHeader);
+    const size_t kEventSize =
+        sizeof(RecordPrefix) + sizeof(TraceEnterEventData);
+    std::vector<uint8> buffer(::common::AlignUp(
+        kHeaderSize + events_per_segment * kEventSize, writer.block_size()));
+
+    for (size_t i = 0; i < num_segments; ++i) {
+      ::memset(buffer.data(), 0, buffer.size());
+
+      RecordPrefix* prefix = reinterpret_cast<RecordPrefix*>(buffer.data());
+      prefix->type = TraceFileSegmentHeader::kTypeId;
+      prefix->size = sizeof(TraceFileSegmentHeader);
+      prefix->version.hi = TRACE_VERSION_HI;
+      prefix->version.lo = TRACE_VERSION_LO;
+
+      TraceFileSegmentHeader* header =
+          reinterpret_cast<TraceFileSegmentHeader*>(prefix + 1);
+      header->thread_id = ::GetCurrentThreadId();
+      header->segment_length = events_per_segment * kEventSize;
+
+      uint8* event = reinterpret_cast<uint8*>(header + 1);
+      for (size_t j = 0; j < events_per_segment; ++j) {
+        RecordPrefix* event_prefix = reinterpret_cast<RecordPrefix*>(event);
+        event_prefix->type = TRACE_ENTER_EVENT;
+        event_prefix->size = sizeof(TraceEnterEventData);
+        event_prefix->timestamp = i * events_per_segment + j;
+
+        TraceEnterEventData* data =
+            reinterpret_cast<TraceEnterEventData*>(event_prefix + 1);
+        data->function = reinterpret_cast<FuncAddr>(j);
+
+        event += kEventSize;
+      }
+
+      ASSERT_TRUE(writer.WriteRecord(buffer.data(), buffer.size()));
+    }
+
+    ASSERT_TRUE(writer.Close());
+  }
+
+  // Consumes the trace file with a ParseEngineRpc.
+  void ConsumeTraceFile(bool use_memory_mapping,
+                        CountingParseEventHandler* handler) {
+    trace::parser::ParseEngineRpc engine;
+    engine.set_use_memory_mapping(use_memory_mapping);
+    engine.set_event_handler(handler);
+    ASSERT_TRUE(engine.IsRecognizedTraceFile(trace_file_path_));
+    ASSERT_TRUE(engine.OpenTraceFile(trace_file_path_));
+    ASSERT_TRUE(engine.ConsumeAllEvents());
+    ASSERT_FALSE(engine.error_occurred());
+    ASSERT_TRUE(engine.CloseAllTraceFiles());
+  }
+
+ protected:
+  base::FilePath temp_dir_;
+  base::FilePath trace_file_path_;
+
+  // The compression applied to the segments of the trace files written.
+  trace::common::SegmentCompression compression_;
+};
+
 }  // namespace
 
 TEST_F(ParseEngineRpcTest, LoadUnload) {
@@ -802,5 +957,163 @@ TEST_F(ParseEngineRpcTest, MultiThreadWithStopCallTrace) {
   ASSERT_EQ(77, entered_addresses_.count(IndirectFunctionB));
 }
 
+TEST_F(ParseEngineRpcSyntheticTest, MemoryMappedMatchesBuffered) {
+  const size_t kNumSegments = 16;
+  const size_t kEventsPerSegment = 1000;
+  ASSERT_NO_FATAL_FAILURE(WriteTraceFile(kNumSegments, kEventsPerSegment));
+
+  CountingParseEventHandler buffered_handler;
+  ASSERT_NO_FATAL_FAILURE(ConsumeTraceFile(false, &buffered_handler));
+  EXPECT_EQ(kNumSegments * kEventsPerSegment,
+            buffered_handler.function_entries());
+
+  CountingParseEventHandler mapped_handler;
+  ASSERT_NO_FATAL_FAILURE(ConsumeTraceFile(true, &mapped_handler));
+  EXPECT_EQ(buffered_handler.function_entries(),
+            mapped_handler.function_entries());
+  EXPECT_EQ(buffered_handler.checksum(), mapped_handler.checksum());
+}
+
+TEST_F(ParseEngineRpcSyntheticTest, CompressedSegments) {
+  const size_t kNumSegments = 16;
+  const size_t kEventsPerSegment = 1000;
+  ASSERT_NO_FATAL_FAILURE(WriteTraceFile(kNumSegments, kEventsPerSegment));
+  int64 uncompressed_file_size = 0;
+  ASSERT_TRUE(base::GetFileSize(trace_file_path_, &uncompressed_file_size));
+
+  CountingParseEventHandler expected_handler;
+  ASSERT_NO_FATAL_FAILURE(ConsumeTraceFile(false, &expected_handler));
+
+  const trace::common::SegmentCompression kCompressions[] = {
+      TraceFileSegmentHeader::kCompressionLz,
+      TraceFileSegmentHeader::kCompressionZlib,
+  };
+  for (size_t i = 0; i < arraysize(kCompressions); ++i) {
+    compression_ = kCompressions[i];
+    ASSERT_NO_FATAL_FAILURE(WriteTraceFile(kNumSegments, kEventsPerSegment));
+    int64 file_size = 0;
+    ASSERT_TRUE(base::GetFileSize(trace_file_path_, &file_size));
+    EXPECT_GT(uncompressed_file_size * 3 / 4, file_size);
+
+    // Both the buffered and the memory mapped paths decompress the segments.
+    for (size_t j = 0; j < 2; ++j) {
+      CountingParseEventHandler handler;
+      ASSERT_NO_FATAL_FAILURE(ConsumeTraceFile(j == 1, &handler));
+      EXPECT_EQ(expected_handler.function_entries(),
+                handler.function_entries());
+      EXPECT_EQ(expected_handler.checksum(), handler.checksum());
+    }
+  }
+}
+
+TEST_F(ParseEngineRpcSyntheticTest, ConsumeInParallel) {
+  // Trace files of distinct processes, plus a reused process id.
+  const uint32 kProcessIds[] = { 1000, 1004, 1008, 1012, 1000 };
+  const size_t kNumSegments = 4;
+  const size_t kEventsPerSegment = 1000;
+
+  CountingParseEventHandler serial_handler;
+  Parser serial_parser;
+  ASSERT_TRUE(serial_parser.Init(&serial_handler));
+
+  ParseEventHandlerImpl unused_handler;
+  Parser parallel_parser;
+  ASSERT_TRUE(parallel_parser.Init(&unused_handler));
+
+  for (size_t i = 0; i < arraysize(kProcessIds); ++i) {
+    base::FilePath path = temp_dir_.Append(
+        base::StringPrintf(L"trace-%d.bin", static_cast<int>(i)));
+    ASSERT_NO_FATAL_FAILURE(WriteProcessTraceFile(
+        path, kProcessIds[i], kNumSegments, kEventsPerSegment * (i + 1)));
+    ASSERT_TRUE(serial_parser.OpenTraceFile(path));
+    ASSERT_TRUE(parallel_parser.OpenTraceFile(path));
+  }
+
+  ASSERT_TRUE(serial_parser.Consume());
+
+  CountingShardFactory shard_factory;
+  ASSERT_TRUE(parallel_parser.ConsumeInParallel(&shard_factory, 4));
+  EXPECT_EQ(arraysize(kProcessIds), shard_factory.num_shards());
+  EXPECT_EQ(serial_handler.function_entries(),
+            shard_factory.function_entries());
+  EXPECT_EQ(serial_handler.checksum(), shard_factory.checksum());
+
+  // The module information of every process should be available.
+  trace::service::ProcessInfo process_info;
+  ASSERT_TRUE(process_info.Initialize(::GetCurrentProcessId()));
+  for (size_t i = 0; i < arraysize(kProcessIds); ++i) {
+    EXPECT_TRUE(parallel_parser.GetModuleInformation(
+        kProcessIds[i], process_info.exe_base_address) != NULL);
+  }
+}
+
+TEST_F(ParseEngineRpcSyntheticTest, ConsumeInParallelPerfTest) {
+  const size_t kNumTraceFiles = 16;
+  const size_t kNumSegments = 16;
+  const size_t kEventsPerSegment = 32 * 1024;
+
+  CountingParseEventHandler serial_handler;
+  Parser serial_parser;
+  ASSERT_TRUE(serial_parser.Init(&serial_handler));
+
+  ParseEventHandlerImpl unused_handler;
+  Parser parallel_parser;
+  ASSERT_TRUE(parallel_parser.Init(&unused_handler));
+
+  for (size_t i = 0; i < kNumTraceFiles; ++i) {
+    base::FilePath path = temp_dir_.Append(
+        base::StringPrintf(L"trace-%d.bin", static_cast<int>(i)));
+    ASSERT_NO_FATAL_FAILURE(WriteProcessTraceFile(
+        path, 1000 + 4 * i, kNumSegments, kEventsPerSegment));
+    ASSERT_TRUE(serial_parser.OpenTraceFile(path));
+    ASSERT_TRUE(parallel_parser.OpenTraceFile(path));
+  }
+
+  base::Time start = base::Time::Now();
+  ASSERT_TRUE(serial_parser.Consume());
+  base::Time serial_end = base::Time::Now();
+
+  CountingShardFactory shard_factory;
+  ASSERT_TRUE(parallel_parser.ConsumeInParallel(
+      &shard_factory, base::SysInfo::NumberOfProcessors()));
+  base::Time parallel_end = base::Time::Now();
+
+  ASSERT_EQ(serial_handler.function_entries(),
+            shard_factory.function_entries());
+
+  testing::EmitMetric("Syzygy.Trace.Parse.Parser.Consume",
+                      (serial_end - start).InSecondsF());
+  testing::EmitMetric("Syzygy.Trace.Parse.Parser.ConsumeInParallel",
+                      (parallel_end - serial_end).InSecondsF());
+}
+
+TEST_F(ParseEngineRpcSyntheticTest, ConsumePerfTest) {
+  // This generates a trace file of roughly 100MB.
+  const size_t kNumSegments = 128;
+  const size_t kEventsPerSegment = 32 * 1024;
+  ASSERT_NO_FATAL_FAILURE(WriteTraceFile(kNumSegments, kEventsPerSegment));
+
+  int64 file_size = 0;
+  ASSERT_TRUE(base::GetFileSize(trace_file_path_, &file_size));
+
+  const char* kModes[] = { "Buffered", "MemoryMapped" };
+  for (size_t i = 0; i < arraysize(kModes); ++i) {
+    CountingParseEventHandler handler;
+    base::Time start = base::Time::Now();
+    ASSERT_NO_FATAL_FAILURE(ConsumeTraceFile(i == 1, &handler));
+    double seconds = (base::Time::Now() - start).InSecondsF();
+    ASSERT_EQ(kNumSegments * kEventsPerSegment, handler.function_entries());
+
+    if (seconds <= 0)
+      continue;
+    std::string prefix = base::StringPrintf(
+        "Syzygy.Trace.Parse.ParseEngineRpc.%s", kModes[i]);
+    testing::EmitMetric(prefix + ".EventsPerSecond",
+                        handler.function_entries() / seconds);
+    testing::EmitMetric(prefix + ".MegabytesPerSecond",
+                        file_size / (1024.0 * 1024.0) / seconds);
+  }
+}
+
 }  // namespace service
 }  // namespace trace
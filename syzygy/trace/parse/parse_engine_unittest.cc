@@ -26,6 +26,7 @@
 #include "gmock/gmock.h"
 #include "gtest/gtest.h"
 #include "syzygy/common/indexed_frequency_data.h"
+#include "syzygy/trace/common/compact_encoding.h"
 #include "syzygy/trace/parse/parser.h"
 
 namespace {
@@ -123,7 +124,9 @@ class ParseEngineUnitTest
                             const TraceBatchEnterData* data) override {
     ASSERT_EQ(process_id, kProcessId);
     ASSERT_EQ(thread_id, kThreadId);
-    ASSERT_TRUE(reinterpret_cast<const void*>(data) == expected_data);
+    // Compact batches are expanded to a buffer of the parse engine's.
+    if (expected_data != NULL)
+      ASSERT_TRUE(reinterpret_cast<const void*>(data) == expected_data);
     for (size_t i = 0; i < data->num_calls; ++i) {
       function_entries.insert(data->calls[i].function);
     }
@@ -491,6 +494,65 @@ TEST_F(ParseEngineUnitTest, BatchFunctionEntry) {
   ASSERT_TRUE(error_occurred());
 }
 
+TEST_F(ParseEngineUnitTest, BatchFunctionEntryCompact) {
+  FuncAddr kFunctions[] = { &TestFunc1, &TestFunc2, &TestFunc1, &TestFunc2 };
+
+  // Encode the calls, with return addresses on either side of the functions.
+  std::vector<uint8> raw_data(sizeof(TraceBatchEnterCompactData));
+  trace::common::CompactCallState state = {};
+  for (size_t i = 0; i < arraysize(kFunctions); ++i) {
+    uint8 encoded_call[trace::common::kMaxCompactCallLength];
+    RetAddr retaddr = reinterpret_cast<const uint8*>(kFunctions[i]) +
+        (i % 2 == 0 ? 0x40 : -0x40);
+    size_t length = trace::common::EncodeCompactCall(retaddr, kFunctions[i],
+                                                     &state, encoded_call);
+    raw_data.insert(raw_data.end(), encoded_call, encoded_call + length);
+  }
+  TraceBatchEnterCompactData* event_data =
+      reinterpret_cast<TraceBatchEnterCompactData*>(raw_data.data());
+  event_data->thread_id = kThreadId;
+  event_data->num_calls = arraysize(kFunctions);
+  expected_data = NULL;
+
+  // Calls are smaller than their uncompressed counterparts.
+  EXPECT_GT(arraysize(kFunctions) * sizeof(TraceEnterEventData),
+            raw_data.size() - sizeof(TraceBatchEnterCompactData));
+
+  ASSERT_NO_FATAL_FAILURE(DispatchEventData(
+      TRACE_BATCH_ENTER_COMPACT, raw_data.data(), raw_data.size()));
+  ASSERT_FALSE(error_occurred());
+  ASSERT_EQ(4, function_entries.size());
+  ASSERT_EQ(2, function_entries.count(&TestFunc1));
+  ASSERT_EQ(2, function_entries.count(&TestFunc2));
+
+  // Trailing bytes of a call that was being appended are ignored.
+  raw_data.push_back(0x80);
+  ASSERT_NO_FATAL_FAILURE(DispatchEventData(
+      TRACE_BATCH_ENTER_COMPACT, raw_data.data(), raw_data.size()));
+  ASSERT_FALSE(error_occurred());
+  ASSERT_EQ(8, function_entries.size());
+  raw_data.pop_back();
+
+  // Check for short event header.
+  ASSERT_NO_FATAL_FAILURE(DispatchEventData(
+      TRACE_BATCH_ENTER_COMPACT, raw_data.data(),
+      FIELD_OFFSET(TraceBatchEnterCompactData, num_calls)));
+  ASSERT_TRUE(error_occurred());
+
+  // Check for short event tail.
+  set_error_occurred(false);
+  ASSERT_NO_FATAL_FAILURE(DispatchEventData(
+      TRACE_BATCH_ENTER_COMPACT, raw_data.data(), raw_data.size() - 1));
+  ASSERT_TRUE(error_occurred());
+
+  // Check for a call count that the data can't possibly hold.
+  set_error_occurred(false);
+  event_data->num_calls = 0x7FFFFFFF;
+  ASSERT_NO_FATAL_FAILURE(DispatchEventData(
+      TRACE_BATCH_ENTER_COMPACT, raw_data.data(), raw_data.size()));
+  ASSERT_TRUE(error_occurred());
+}
+
 TEST_F(ParseEngineUnitTest, ProcessAttachIncomplete) {
   TraceModuleData incomplete(kModuleData);
   incomplete.module_base_addr = NULL;
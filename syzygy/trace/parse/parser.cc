@@ -96,6 +96,20 @@ bool Parser::Consume() {
   return active_parse_engine_->ConsumeAllEvents();
 }
 
+bool Parser::ConsumeInParallel(ParseEventHandlerShardFactory* shard_factory,
+                               size_t max_workers) {
+  DCHECK(shard_factory != NULL);
+  DCHECK_LT(0U, max_workers);
+
+  if (active_parse_engine_ == NULL) {
+    LOG(ERROR) << "No open trace files to consume.";
+    return false;
+  }
+
+  return active_parse_engine_->ConsumeAllEventsInParallel(shard_factory,
+                                                          max_workers);
+}
+
 const ModuleInformation* Parser::GetModuleInformation(
     uint32 process_id, AbsoluteAddress64 addr) const {
   DCHECK(active_parse_engine_ != NULL);
@@ -56,6 +56,7 @@ typedef core::AddressSpace<AbsoluteAddress64,
 // Forward declarations.
 class ParseEngine;
 class ParseEventHandler;
+class ParseEventHandlerShardFactory;
 
 // A facade class that manages the various call trace parser engines which
 // Syzygy supports and presents a single interface that selects the most
@@ -92,6 +93,20 @@ class Parser {
   // Consume all events across all currently open trace files.
   bool Consume();
 
+  // Consume all events across all currently open trace files, parsing up to
+  // @p max_workers trace files concurrently. The events of each trace file
+  // are dispatched to their own handler shard, created by @p shard_factory,
+  // and the shards are reduced in the order the trace files were opened once
+  // all of them have been consumed. The event handler given to Init does not
+  // receive any events. GetModuleInformation may be called concurrently from
+  // the shards.
+  //
+  // @param shard_factory the factory creating and reducing the shards.
+  // @param max_workers the maximal number of worker threads to use.
+  // @returns true on success, false otherwise.
+  bool ConsumeInParallel(ParseEventHandlerShardFactory* shard_factory,
+                         size_t max_workers);
+
   // Given an address and a process id, returns the module in memory at that
   // address. Returns NULL if no such module exists.
   const ModuleInformation* GetModuleInformation(uint32 process_id,
@@ -232,6 +247,29 @@ class ParseEventHandler {
       const TraceComment* data) = 0;
 };
 
+// Implemented by clients of Parser that support consuming trace files in
+// parallel. Each trace file is dispatched to its own handler shard on a worker
+// thread, and the shards are then reduced into the final result.
+class ParseEventHandlerShardFactory {
+ public:
+  virtual ~ParseEventHandlerShardFactory() { }
+
+  // Creates a handler shard. This is called once per trace file, on the
+  // thread invoking Parser::ConsumeInParallel. The shard remains owned by the
+  // factory.
+  //
+  // @returns the new shard, or NULL on failure.
+  virtual ParseEventHandler* CreateShard() = 0;
+
+  // Reduces a shard into the final result. This is called on the thread
+  // invoking Parser::ConsumeInParallel once all trace files have been
+  // consumed, in the order the trace files were opened.
+  //
+  // @param shard a shard returned by CreateShard.
+  // @returns true on success, false otherwise.
+  virtual bool ReduceShard(ParseEventHandler* shard) = 0;
+};
+
 // A default implementation of the ParseEventHandler interface. Provides
 // empty implementations of all function so that clients only need to override
 // the events they are interested in.
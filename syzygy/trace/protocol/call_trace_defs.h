@@ -66,7 +66,7 @@ extern const char kSyzygyRpcSessionMandatoryEnvVar[];
 // This must be bumped anytime the file format is changed.
 enum {
   TRACE_VERSION_HI = 1,
-  TRACE_VERSION_LO = 4,
+  TRACE_VERSION_LO = 6,
 };
 
 enum TraceEventType {
@@ -92,6 +92,7 @@ enum TraceEventType {
   TRACE_STACK_TRACE,
   TRACE_DETAILED_FUNCTION_CALL,
   TRACE_COMMENT,
+  TRACE_BATCH_ENTER_COMPACT,
 };
 
 // All traces are emitted at this trace level.
@@ -234,19 +235,40 @@ COMPILE_ASSERT_IS_POD(TraceFileHeader);
 // segment has a length, which on-disk is rounded up to the block_size, as
 // recorded in the TraceFileHeader. Within a call trace segment, there are one
 // or more records, each prefixed with a RecordPrefix, which describes the
-// length and type of the data to follow.
+// length and type of the data to follow. The trace service may compress the
+// records of a segment when committing it to disk, in which case they must be
+// decompressed before being parsed.
 struct TraceFileSegmentHeader {
   // Type identifiers used for these headers.
   enum { kTypeId = TRACE_PAGE_HEADER };
 
+  // The ways in which the data of a segment may be compressed.
+  enum Compression {
+    kCompressionNone = 0,
+    // A fast byte-oriented LZ77 codec. See trace/common/segment_compression.h.
+    kCompressionLz = 1,
+    // A zlib deflate stream, compressed for speed.
+    kCompressionZlib = 2,
+    kCompressionMax,
+  };
+
   // The identity of the thread that is reporting in this segment
   // of the trace file.
   uint32 thread_id;
 
   // The number of data bytes in this segment of the trace file. This
   // value does not include the size of the record prefix nor the size
-  // of the segment header.
+  // of the segment header. For a compressed segment this is the size of the
+  // compressed data.
   uint32 segment_length;
+
+  // The compression applied to the data of this segment. This is one of the
+  // Compression values. Clients always write uncompressed segments.
+  uint32 compression;
+
+  // The number of data bytes in this segment once decompressed. This is only
+  // meaningful if compression is not kCompressionNone.
+  uint32 uncompressed_length;
 };
 COMPILE_ASSERT_IS_POD(TraceFileSegmentHeader);
 
@@ -310,6 +332,26 @@ struct TraceBatchEnterData {
 };
 COMPILE_ASSERT_IS_POD(TraceBatchEnterData);
 
+// The structure traced for batch entry traces by clients that use the compact
+// encoding. This carries the same information as a TraceBatchEnterData, but
+// each call is stored relative to the previous call of the batch, as described
+// in trace/common/compact_encoding.h. The parse engine expands these back to
+// TraceBatchEnterData records.
+struct TraceBatchEnterCompactData {
+  enum { kTypeId = TRACE_BATCH_ENTER_COMPACT };
+
+  // The thread ID from which these traces originate. See TraceBatchEnterData.
+  DWORD thread_id;
+
+  // Number of function entries.
+  uint32 num_calls;
+
+  // The encoded calls follow, as many bytes as the enclosing record's size
+  // allows for. Any bytes past the last of the num_calls calls belong to a
+  // call that was being appended when the client thread was terminated.
+};
+COMPILE_ASSERT_IS_POD(TraceBatchEnterCompactData);
+
 enum InvocationInfoFlags {
   // If this bit is set in InvocationInfo flags, the caller is a dynamic
   // symbol id, and caller_offset is the offset of the return site, relative to
@@ -0,0 +1,129 @@
+// Copyright 2015 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// This file implements the trace::service::BufferRing class. This is the
+// bounded queue described by Dmitry Vyukov, where each cell's sequence number
+// is advanced by a full lap of the ring every time it is used.
+
+#include "syzygy/trace/service/buffer_ring.h"
+
+#include "base/logging.h"
+
+namespace trace {
+namespace service {
+
+namespace {
+
+using base::subtle::Atomic32;
+
+// Computes the signed distance between two positions, taking wrap-around into
+// account.
+Atomic32 Distance(Atomic32 from, Atomic32 to) {
+  return static_cast<Atomic32>(static_cast<uint32>(to) -
+                               static_cast<uint32>(from));
+}
+
+}  // namespace
+
+BufferRing::BufferRing(size_t capacity)
+    : cells_(new Cell[capacity]),
+      mask_(capacity - 1),
+      push_position_(0),
+      pop_position_(0) {
+  DCHECK_LT(0u, capacity);
+  DCHECK_EQ(0u, capacity & mask_);
+
+  for (size_t i = 0; i < capacity; ++i) {
+    cells_[i].sequence = static_cast<Atomic32>(i);
+    cells_[i].buffer = NULL;
+  }
+}
+
+BufferRing::~BufferRing() {
+}
+
+bool BufferRing::Push(Buffer* buffer) {
+  DCHECK(buffer != NULL);
+
+  Cell* cell = NULL;
+  Atomic32 position = base::subtle::NoBarrier_Load(&push_position_);
+  while (true) {
+    cell = &cells_[position & mask_];
+    Atomic32 sequence = base::subtle::Acquire_Load(&cell->sequence);
+    Atomic32 distance = Distance(position, sequence);
+    if (distance == 0) {
+      // The cell is free, try to claim it.
+      Atomic32 previous = base::subtle::NoBarrier_CompareAndSwap(
+          &push_position_, position, position + 1);
+      if (previous == position)
+        break;
+      position = previous;
+    } else if (distance < 0) {
+      // The cell still holds the buffer pushed a lap ago, the ring is full.
+      return false;
+    } else {
+      // Another producer claimed the cell, catch up.
+      position = base::subtle::NoBarrier_Load(&push_position_);
+    }
+  }
+
+  // Publish the buffer to the consumers.
+  cell->buffer = buffer;
+  base::subtle::Release_Store(&cell->sequence, position + 1);
+  return true;
+}
+
+bool BufferRing::Pop(Buffer** buffer) {
+  DCHECK(buffer != NULL);
+
+  Cell* cell = NULL;
+  Atomic32 position = base::subtle::NoBarrier_Load(&pop_position_);
+  while (true) {
+    cell = &cells_[position & mask_];
+    Atomic32 sequence = base::subtle::Acquire_Load(&cell->sequence);
+    Atomic32 distance = Distance(position + 1, sequence);
+    if (distance == 0) {
+      // The cell holds a buffer, try to claim it.
+      Atomic32 previous = base::subtle::NoBarrier_CompareAndSwap(
+          &pop_position_, position, position + 1);
+      if (previous == position)
+        break;
+      position = previous;
+    } else if (distance < 0) {
+      // The cell hasn't been pushed to yet, the ring is empty.
+      return false;
+    } else {
+      // Another consumer claimed the cell, catch up.
+      position = base::subtle::NoBarrier_Load(&pop_position_);
+    }
+  }
+
+  // Hand the cell back to the producers for the next lap.
+  *buffer = cell->buffer;
+  base::subtle::Release_Store(&cell->sequence,
+                              position + static_cast<Atomic32>(mask_) + 1);
+  return true;
+}
+
+size_t BufferRing::size() const {
+  Atomic32 pop_position = base::subtle::Acquire_Load(&pop_position_);
+  Atomic32 push_position = base::subtle::Acquire_Load(&push_position_);
+  Atomic32 distance = Distance(pop_position, push_position);
+  if (distance < 0)
+    return 0;
+  return static_cast<size_t>(distance);
+}
+
+}  // namespace service
+}  // namespace trace
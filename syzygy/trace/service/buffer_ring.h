@@ -0,0 +1,85 @@
+// Copyright 2015 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// This file declares the trace::service::BufferRing class, a bounded
+// lock-free queue of buffers that can be pushed and popped concurrently by
+// any number of threads.
+
+#ifndef SYZYGY_TRACE_SERVICE_BUFFER_RING_H_
+#define SYZYGY_TRACE_SERVICE_BUFFER_RING_H_
+
+#include "base/atomicops.h"
+#include "base/basictypes.h"
+#include "base/memory/scoped_ptr.h"
+
+namespace trace {
+namespace service {
+
+// Forward declaration.
+struct Buffer;
+
+// A bounded multi-producer multi-consumer FIFO of buffers. Each slot of the
+// ring carries a sequence number that tells producers and consumers whose
+// turn it is to use it, so that neither needs a lock. Pushing to a full ring
+// and popping from an empty one fail rather than block.
+class BufferRing {
+ public:
+  // Constructor.
+  // @param capacity The maximum number of buffers held by the ring. This
+  //     must be a power of two.
+  explicit BufferRing(size_t capacity);
+  ~BufferRing();
+
+  // Adds a buffer to the ring.
+  // @param buffer The buffer to add.
+  // @returns true on success, false if the ring is full.
+  bool Push(Buffer* buffer);
+
+  // Removes the oldest buffer from the ring.
+  // @param buffer Receives the buffer.
+  // @returns true on success, false if the ring is empty.
+  bool Pop(Buffer** buffer);
+
+  // @returns the number of buffers in the ring. This is only exact if no
+  //     other thread is using the ring.
+  size_t size() const;
+
+  // @returns the maximum number of buffers held by the ring.
+  size_t capacity() const { return mask_ + 1; }
+
+ private:
+  // A slot of the ring.
+  struct Cell {
+    // The position that the next push (if equal to it) or pop (if one less
+    // than it) of this cell must have.
+    volatile base::subtle::Atomic32 sequence;
+    Buffer* buffer;
+  };
+
+  scoped_ptr<Cell[]> cells_;
+  const size_t mask_;
+
+  // The positions of the next push and pop. These are kept apart so that
+  // producers and consumers don't contend for the same cache line.
+  volatile base::subtle::Atomic32 push_position_;
+  uint8 padding_[64 - sizeof(base::subtle::Atomic32)];
+  volatile base::subtle::Atomic32 pop_position_;
+
+  DISALLOW_COPY_AND_ASSIGN(BufferRing);
+};
+
+}  // namespace service
+}  // namespace trace
+
+#endif  // SYZYGY_TRACE_SERVICE_BUFFER_RING_H_
@@ -0,0 +1,155 @@
+// Copyright 2015 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "syzygy/trace/service/buffer_ring.h"
+
+#include <algorithm>
+#include <vector>
+
+#include "base/memory/scoped_vector.h"
+#include "base/threading/simple_thread.h"
+#include "gtest/gtest.h"
+#include "syzygy/trace/service/buffer_pool.h"
+
+namespace trace {
+namespace service {
+
+namespace {
+
+// Moves buffers from one ring to another, counting how often it got to move
+// each of them.
+class BufferMover : public base::DelegateSimpleThread::Delegate {
+ public:
+  BufferMover(BufferRing* from, BufferRing* to, Buffer* buffers,
+              size_t buffer_count, size_t iterations)
+      : from_(from), to_(to), buffers_(buffers), iterations_(iterations),
+        moves_(buffer_count, 0) {
+  }
+
+  void Run() override {
+    for (size_t i = 0; i < iterations_; ++i) {
+      Buffer* buffer = NULL;
+      if (!from_->Pop(&buffer))
+        continue;
+      ++moves_[buffer - buffers_];
+      // The destination has room for all of the buffers.
+      EXPECT_TRUE(to_->Push(buffer));
+      std::swap(from_, to_);
+    }
+  }
+
+  const std::vector<size_t>& moves() const { return moves_; }
+
+ private:
+  BufferRing* from_;
+  BufferRing* to_;
+  Buffer* buffers_;
+  size_t iterations_;
+  std::vector<size_t> moves_;
+
+  DISALLOW_COPY_AND_ASSIGN(BufferMover);
+};
+
+}  // namespace
+
+TEST(BufferRingTest, PushPop) {
+  Buffer buffers[4] = {};
+  BufferRing ring(4);
+  EXPECT_EQ(4u, ring.capacity());
+  EXPECT_EQ(0u, ring.size());
+
+  Buffer* buffer = NULL;
+  EXPECT_FALSE(ring.Pop(&buffer));
+
+  for (size_t i = 0; i < arraysize(buffers); ++i) {
+    EXPECT_TRUE(ring.Push(&buffers[i]));
+    EXPECT_EQ(i + 1, ring.size());
+  }
+  EXPECT_FALSE(ring.Push(&buffers[0]));
+
+  // Buffers come out in the order they went in.
+  for (size_t i = 0; i < arraysize(buffers); ++i) {
+    EXPECT_TRUE(ring.Pop(&buffer));
+    EXPECT_EQ(&buffers[i], buffer);
+  }
+  EXPECT_FALSE(ring.Pop(&buffer));
+  EXPECT_EQ(0u, ring.size());
+}
+
+TEST(BufferRingTest, WrapsAround) {
+  Buffer buffers[3] = {};
+  BufferRing ring(2);
+
+  Buffer* buffer = NULL;
+  for (size_t i = 0; i < 100; ++i) {
+    EXPECT_TRUE(ring.Push(&buffers[i % 3]));
+    EXPECT_TRUE(ring.Push(&buffers[(i + 1) % 3]));
+    EXPECT_FALSE(ring.Push(&buffers[(i + 2) % 3]));
+    EXPECT_EQ(2u, ring.size());
+
+    EXPECT_TRUE(ring.Pop(&buffer));
+    EXPECT_EQ(&buffers[i % 3], buffer);
+    EXPECT_TRUE(ring.Pop(&buffer));
+    EXPECT_EQ(&buffers[(i + 1) % 3], buffer);
+    EXPECT_EQ(0u, ring.size());
+  }
+}
+
+TEST(BufferRingTest, ConcurrentPushPop) {
+  static const size_t kBufferCount = 64;
+  static const size_t kThreadCount = 4;
+  static const size_t kIterations = 100000;
+
+  std::vector<Buffer> buffers(kBufferCount);
+  BufferRing ring1(kBufferCount);
+  BufferRing ring2(kBufferCount);
+  for (size_t i = 0; i < kBufferCount; ++i)
+    EXPECT_TRUE(ring1.Push(&buffers[i]));
+
+  // Have the threads move the buffers back and forth between the rings.
+  ScopedVector<BufferMover> movers;
+  ScopedVector<base::DelegateSimpleThread> threads;
+  for (size_t i = 0; i < kThreadCount; ++i) {
+    BufferRing* from = i % 2 == 0 ? &ring1 : &ring2;
+    BufferRing* to = i % 2 == 0 ? &ring2 : &ring1;
+    movers.push_back(new BufferMover(from, to, &buffers[0], kBufferCount,
+                                     kIterations));
+    threads.push_back(new base::DelegateSimpleThread(movers.back(), "mover"));
+  }
+  for (size_t i = 0; i < kThreadCount; ++i)
+    threads[i]->Start();
+  for (size_t i = 0; i < kThreadCount; ++i)
+    threads[i]->Join();
+
+  // No buffer was lost or duplicated.
+  EXPECT_EQ(kBufferCount, ring1.size() + ring2.size());
+  std::vector<size_t> seen(kBufferCount, 0);
+  Buffer* buffer = NULL;
+  while (ring1.Pop(&buffer))
+    ++seen[buffer - &buffers[0]];
+  while (ring2.Pop(&buffer))
+    ++seen[buffer - &buffers[0]];
+  for (size_t i = 0; i < kBufferCount; ++i)
+    EXPECT_EQ(1u, seen[i]);
+
+  size_t total_moves = 0;
+  for (size_t i = 0; i < kThreadCount; ++i) {
+    for (size_t j = 0; j < kBufferCount; ++j)
+      total_moves += movers[i]->moves()[j];
+  }
+  EXPECT_LT(0u, total_moves);
+}
+
+}  // namespace service
+}  // namespace trace
@@ -24,6 +24,8 @@
         'buffer_consumer.h',
         'buffer_pool.cc',
         'buffer_pool.h',
+        'buffer_ring.cc',
+        'buffer_ring.h',
         'mapped_buffer.cc',
         'mapped_buffer.h',
         'process_info.cc',
@@ -51,6 +53,7 @@
       'target_name': 'rpc_service_unittests',
       'type': 'executable',
       'sources': [
+        'buffer_ring_unittest.cc',
         'mapped_buffer_unittest.cc',
         'process_info_unittest.cc',
         'service_unittest.cc',
@@ -69,6 +72,7 @@
         '<(src)/syzygy/trace/service/service.gyp:rpc_service_lib',
         '<(src)/syzygy/pe/pe.gyp:pe_lib',
         '<(src)/syzygy/pe/pe.gyp:pe_unittest_utils',
+        '<(src)/syzygy/testing/testing.gyp:testing_lib',
         '<(src)/testing/gtest.gyp:gtest',
         '<(src)/testing/gmock.gyp:gmock',
       ],
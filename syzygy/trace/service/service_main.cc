@@ -31,6 +31,7 @@
 #include "base/threading/thread.h"
 #include "syzygy/common/com_utils.h"
 #include "syzygy/common/rpc/helpers.h"
+#include "syzygy/trace/common/segment_compression.h"
 #include "syzygy/trace/common/service_util.h"
 #include "syzygy/trace/protocol/call_trace_defs.h"
 #include "syzygy/trace/service/service.h"
@@ -85,6 +86,9 @@ const char kUsage[] =
     "  --help             Show this help message.\n"
     "  --trace-dir=PATH   The directory in which to write the trace files.\n"
     "  --buffer-size=NUM  The size (in bytes) of each buffer to allocate.\n"
+    "  --compression=none|lz|zlib\n"
+    "                     Compress the trace file segments (none by default).\n"
+    "                     lz is the fastest, zlib compresses the most.\n"
     "  --num-incremental-buffers=NUM\n"
     "                     The number of buffers by which to grow the buffer\n"
     "                     pool each time the client exhausts its available\n"
@@ -187,6 +191,19 @@ bool RunService(const base::CommandLine* cmd_line,
   if (!session_trace_file_writer_factory.SetTraceFileDirectory(trace_directory))
     return false;
 
+  // Set up the trace file compression.
+  std::string compression_str(cmd_line->GetSwitchValueASCII("compression"));
+  if (!compression_str.empty()) {
+    trace::common::SegmentCompression compression =
+        TraceFileSegmentHeader::kCompressionNone;
+    if (!trace::common::ParseSegmentCompression(compression_str,
+                                                &compression)) {
+      LOG(ERROR) << "Unrecognized compression: " << compression_str << ".";
+      return false;
+    }
+    session_trace_file_writer_factory.set_compression(compression);
+  }
+
   // Setup the buffer size.
   std::wstring buffer_size_str(cmd_line->GetSwitchValueNative("buffer-size"));
   if (!buffer_size_str.empty()) {
@@ -15,10 +15,11 @@
 // This file implements the trace::service::Session class, which manages
 // the trace file and buffers for a given client of the call trace service.
 //
-// TODO(rogerm): Reduce the scope over which the session lock is held. The
-//     RPC machinery ensures that calls to a given session are serialized, so
-//     we only have to protect the parts that might interact with the writer
-//     thread.
+// Handing out, returning and recycling buffers of the common size don't take
+// the session lock. The available buffers are kept in a lock-free ring and the
+// buffer state counts are updated atomically. Close() excludes the lock-free
+// paths by raising is_closing_ and waiting for lock_free_users_ to drain,
+// after which the buffers in use can't change state under its feet.
 
 #include "syzygy/trace/service/session.h"
 
@@ -54,14 +55,18 @@ std::ostream& operator << (std::ostream& stream, const Buffer::ID& buffer_id) {
 
 Session::Session(Service* call_trace_service)
     : call_trace_service_(call_trace_service),
-      is_closing_(false),
+      available_ring_(kAvailableRingCapacity),
+      is_closing_(0),
+      lock_free_users_(0),
+      recycle_waiters_(0),
       buffer_consumer_(NULL),
       buffer_requests_waiting_for_recycle_(0),
       buffer_is_available_(&lock_),
       buffer_id_(0),
       input_error_already_logged_(false) {
   DCHECK(call_trace_service != NULL);
-  ::memset(buffer_state_counts_, 0, sizeof(buffer_state_counts_));
+  for (size_t i = 0; i < arraysize(buffer_state_counts_); ++i)
+    buffer_state_counts_[i] = 0;
 
   call_trace_service->AddOneActiveSession();
 }
@@ -70,16 +75,18 @@ Session::~Session() {
   // We expect all of the buffers to be available, and none of them to be
   // outstanding.
   DCHECK(call_trace_service_ != NULL);
-  DCHECK_EQ(buffers_available_.size(),
-            buffer_state_counts_[Buffer::kAvailable]);
-  DCHECK_EQ(buffers_.size(), buffer_state_counts_[Buffer::kAvailable]);
-  DCHECK_EQ(0u, buffer_state_counts_[Buffer::kInUse]);
-  DCHECK_EQ(0u, buffer_state_counts_[Buffer::kPendingWrite]);
+  DCHECK(BufferBookkeepingIsConsistent());
+  DCHECK_EQ(buffers_.size(), GetBufferStateCount(Buffer::kAvailable));
+  DCHECK_EQ(0u, GetBufferStateCount(Buffer::kInUse));
+  DCHECK_EQ(0u, GetBufferStateCount(Buffer::kPendingWrite));
 
   // Not strictly necessary, but let's make sure nothing refers to the
   // client buffers before we delete the underlying memory.
   buffers_.clear();
   buffers_available_.clear();
+  Buffer* buffer = NULL;
+  while (available_ring_.Pop(&buffer)) {
+  }
 
   // The session owns all of its shared memory buffers using raw pointers
   // inserted into the shared_memory_buffers_ list.
@@ -120,10 +127,16 @@ bool Session::Close() {
     return true;
 
   // Otherwise the session is being asked to close for the first time.
-  is_closing_ = true;
+  base::subtle::NoBarrier_Store(&is_closing_, 1);
+  base::subtle::MemoryBarrier();
+
+  // Wait for the threads that didn't see the session closing to be done
+  // with their buffers. They never wait on the lock, so this can't deadlock.
+  while (base::subtle::Acquire_Load(&lock_free_users_) != 0)
+    ::Sleep(0);
 
   // We'll reserve space for the worst case scenario buffer count.
-  buffers.reserve(buffer_state_counts_[Buffer::kInUse] + 1);
+  buffers.reserve(GetBufferStateCount(Buffer::kInUse) + 1);
 
   // Schedule any outstanding buffers for flushing.
   for (BufferMap::iterator it = buffers_.begin(); it != buffers_.end(); ++it) {
@@ -187,6 +200,13 @@ bool Session::GetBuffer(size_t minimum_size, Buffer** out_buffer) {
   DCHECK(out_buffer != NULL);
 
   *out_buffer = NULL;
+
+  // Ordinary buffer requests are usually satisfied without the lock.
+  if (minimum_size <= call_trace_service_->buffer_size_in_bytes() &&
+      GetAvailableBufferLockFree(out_buffer)) {
+    return true;
+  }
+
   base::AutoLock lock(lock_);
 
   // Once we're closing we should not hand out any more buffers.
@@ -212,16 +232,16 @@ bool Session::ReturnBuffer(Buffer* buffer) {
   DCHECK(buffer != NULL);
   DCHECK(buffer->session == this);
 
-  {
-    base::AutoLock lock(lock_);
-
-    // If we're in the middle of closing, we ignore any ReturnBuffer requests
-    // as we've already manually pushed them out for writing.
-    if (is_closing_)
-      return true;
-
+  // If we're in the middle of closing, we ignore any ReturnBuffer requests
+  // as we've already manually pushed them out for writing. Close() waits for
+  // the state change to be done if it didn't see the session closing.
+  base::subtle::Barrier_AtomicIncrement(&lock_free_users_, 1);
+  bool is_closing = base::subtle::NoBarrier_Load(&is_closing_) != 0;
+  if (!is_closing)
     ChangeBufferState(Buffer::kPendingWrite, buffer);
-  }
+  base::subtle::Barrier_AtomicIncrement(&lock_free_users_, -1);
+  if (is_closing)
+    return true;
 
   // Hand the buffer over to the consumer.
   if (!buffer_consumer_->ConsumeBuffer(buffer)) {
@@ -249,23 +269,12 @@ bool Session::RecycleBuffer(Buffer* buffer) {
     return true;
   }
 
-  base::AutoLock lock(lock_);
-
+  // When the session is closing and all outstanding buffers have been
+  // recycled it becomes safe to destroy it. When we start closing we refuse
+  // to hand out further buffers so this must eventually happen, unless the
+  // write queue hangs. The destructor checks the bookkeeping.
   ChangeBufferState(Buffer::kAvailable, buffer);
-  buffers_available_.push_front(buffer);
-  buffer_is_available_.Signal();
-
-  // If the session is closing and all outstanding buffers have been recycled
-  // then it's safe to destroy this session.
-  if (is_closing_ && buffer_state_counts_[Buffer::kInUse] == 0 &&
-      buffer_state_counts_[Buffer::kPendingWrite] == 0) {
-    // If all buffers have been recycled, then all the buffers we own must be
-    // available. When we start closing we refuse to hand out further buffers
-    // so this must eventually happen, unless the write queue hangs.
-    DCHECK_EQ(buffers_.size(), buffer_state_counts_[Buffer::kAvailable]);
-    DCHECK_EQ(buffers_available_.size(),
-              buffer_state_counts_[Buffer::kAvailable]);
-  }
+  MakeBufferAvailable(buffer);
 
   return true;
 }
@@ -273,7 +282,6 @@ bool Session::RecycleBuffer(Buffer* buffer) {
 void Session::ChangeBufferState(BufferState new_state, Buffer* buffer) {
   DCHECK(buffer != NULL);
   DCHECK(buffer->session == this);
-  lock_.AssertAcquired();
 
   BufferState old_state = buffer->state;
 
@@ -281,10 +289,69 @@ void Session::ChangeBufferState(BufferState new_state, Buffer* buffer) {
   DCHECK_EQ(static_cast<int>(new_state),
             (static_cast<int>(old_state) + 1) % Buffer::kBufferStateMax);
 
-  // Apply the state change.
+  // Apply the state change. The buffer is owned by the caller so only the
+  // counts need to be updated atomically.
   buffer->state = new_state;
-  buffer_state_counts_[old_state]--;
-  buffer_state_counts_[new_state]++;
+  base::subtle::Barrier_AtomicIncrement(&buffer_state_counts_[new_state], 1);
+  base::subtle::Barrier_AtomicIncrement(&buffer_state_counts_[old_state], -1);
+}
+
+bool Session::GetAvailableBufferLockFree(Buffer** buffer) {
+  DCHECK(buffer != NULL);
+
+  // Register as a lock-free user before looking at is_closing_, so that
+  // Close() either waits for us or we see it.
+  bool got_buffer = false;
+  base::subtle::Barrier_AtomicIncrement(&lock_free_users_, 1);
+  if (base::subtle::NoBarrier_Load(&is_closing_) == 0 &&
+      available_ring_.Pop(buffer)) {
+    ChangeBufferState(Buffer::kInUse, *buffer);
+    got_buffer = true;
+  }
+  base::subtle::Barrier_AtomicIncrement(&lock_free_users_, -1);
+
+  return got_buffer;
+}
+
+void Session::MakeBufferAvailable(Buffer* buffer) {
+  DCHECK(buffer != NULL);
+  DCHECK_EQ(Buffer::kAvailable, buffer->state);
+
+  if (available_ring_.Push(buffer)) {
+    // A waiting request registers itself before checking the ring one last
+    // time, so either it sees this buffer or we see it.
+    base::subtle::MemoryBarrier();
+    if (base::subtle::NoBarrier_Load(&recycle_waiters_) == 0)
+      return;
+    base::AutoLock lock(lock_);
+    buffer_is_available_.Signal();
+    return;
+  }
+
+  // The ring is full, fall back to the locked queue.
+  base::AutoLock lock(lock_);
+  buffers_available_.push_front(buffer);
+  buffer_is_available_.Signal();
+}
+
+bool Session::PopAvailableBuffer(Buffer** buffer) {
+  DCHECK(buffer != NULL);
+  lock_.AssertAcquired();
+
+  if (available_ring_.Pop(buffer))
+    return true;
+  if (buffers_available_.empty())
+    return false;
+
+  *buffer = buffers_available_.front();
+  buffers_available_.pop_front();
+  return true;
+}
+
+size_t Session::GetBufferStateCount(BufferState state) const {
+  DCHECK_LT(state, Buffer::kBufferStateMax);
+  return static_cast<size_t>(
+      base::subtle::Acquire_Load(&buffer_state_counts_[state]));
 }
 
 bool Session::InitializeProcessInfo(ProcessId process_id,
@@ -396,12 +463,14 @@ bool Session::AllocateBuffers(size_t num_buffers, size_t buffer_size) {
     buf->state = Buffer::kAvailable;
     CHECK(buffers_.insert(std::make_pair(buffer_id, buf)).second);
 
-    buffer_state_counts_[Buffer::kAvailable]++;
-    buffers_available_.push_back(buf);
+    base::subtle::Barrier_AtomicIncrement(
+        &buffer_state_counts_[Buffer::kAvailable], 1);
+    if (!available_ring_.Push(buf))
+      buffers_available_.push_back(buf);
     buffer_is_available_.Signal();
   }
 
-  DCHECK(BufferBookkeepingIsConsistent());
+  DCHECK(BufferPoolsAreConsistent());
 
   return true;
 }
@@ -426,9 +495,10 @@ bool Session::AllocateBufferForImmediateUse(size_t minimum_size,
   // Update the bookkeeping.
   buffer->state = Buffer::kInUse;
   CHECK(buffers_.insert(std::make_pair(buffer_id, buffer)).second);
-  buffer_state_counts_[Buffer::kInUse]++;
+  base::subtle::Barrier_AtomicIncrement(&buffer_state_counts_[Buffer::kInUse],
+                                        1);
 
-  DCHECK(BufferBookkeepingIsConsistent());
+  DCHECK(BufferPoolsAreConsistent());
 
   *out_buffer = buffer;
 
@@ -460,13 +530,15 @@ bool Session::GetNextBufferUnlocked(Buffer** out_buffer) {
   // We have to be careful that we don't pile up arbitrary many threads waiting
   // for a finite number of buffers that will be recycled. Hence, we count the
   // number of requests applying back-pressure.
-  while (buffers_available_.empty()) {
+  Buffer* buffer = NULL;
+  while (!PopAvailableBuffer(&buffer)) {
     // Figure out how many buffers we can force to be recycled according to our
     // threshold and the number of write-pending buffers.
     size_t buffers_force_recyclable = 0;
-    if (buffer_state_counts_[Buffer::kPendingWrite] >
+    size_t buffers_pending_write = GetBufferStateCount(Buffer::kPendingWrite);
+    if (buffers_pending_write >
         call_trace_service_->max_buffers_pending_write()) {
-      buffers_force_recyclable = buffer_state_counts_[Buffer::kPendingWrite] -
+      buffers_force_recyclable = buffers_pending_write -
           call_trace_service_->max_buffers_pending_write();
     }
 
@@ -476,8 +548,14 @@ bool Session::GetNextBufferUnlocked(Buffer** out_buffer) {
     // satisfied by an allocation.
     if (buffer_requests_waiting_for_recycle_ < buffers_force_recyclable) {
       ++buffer_requests_waiting_for_recycle_;
-      OnWaitingForBufferToBeRecycled();  // Unittest hook.
-      buffer_is_available_.Wait();
+      // Buffers are recycled without the lock, so register as a waiter and
+      // look at the ring once more before waiting. See MakeBufferAvailable.
+      base::subtle::Barrier_AtomicIncrement(&recycle_waiters_, 1);
+      if (available_ring_.size() == 0) {
+        OnWaitingForBufferToBeRecycled();  // Unittest hook.
+        buffer_is_available_.Wait();
+      }
+      base::subtle::Barrier_AtomicIncrement(&recycle_waiters_, -1);
       --buffer_requests_waiting_for_recycle_;
     } else {
       // Otherwise, force an allocation.
@@ -487,10 +565,8 @@ bool Session::GetNextBufferUnlocked(Buffer** out_buffer) {
       }
     }
   }
-  DCHECK(!buffers_available_.empty());
+  DCHECK(buffer != NULL);
 
-  Buffer* buffer = buffers_available_.front();
-  buffers_available_.pop_front();
   ChangeBufferState(Buffer::kInUse, buffer);
 
   *out_buffer = buffer;
@@ -536,8 +612,9 @@ bool Session::DestroySingletonBuffer(Buffer* buffer) {
   CHECK_EQ(1u, buffers_.erase(Buffer::GetID(*buffer)));
 
   // Remove the buffer from our buffer statistics.
-  buffer_state_counts_[Buffer::kPendingWrite]--;
-  DCHECK(BufferBookkeepingIsConsistent());
+  base::subtle::Barrier_AtomicIncrement(
+      &buffer_state_counts_[Buffer::kPendingWrite], -1);
+  DCHECK(BufferPoolsAreConsistent());
 
   // Finally, delete the pool. This will clean up the buffer.
   delete pool;
@@ -566,13 +643,12 @@ bool Session::CreateProcessEndedEvent(Buffer** buffer) {
       sizeof(TraceFileSegmentHeader) + sizeof(RecordPrefix);
 
   // Ensure that a free buffer exists.
-  if (buffers_available_.empty()) {
+  if (available_ring_.size() == 0 && buffers_available_.empty()) {
     if (!AllocateBuffers(1, kBufferSize)) {
       LOG(ERROR) << "Unable to allocate buffer for process ended event.";
       return false;
     }
   }
-  DCHECK(!buffers_available_.empty());
 
   // Get a buffer for the event.
   if (!GetNextBufferUnlocked(buffer) || *buffer == NULL) {
@@ -607,6 +683,8 @@ bool Session::CreateProcessEndedEvent(Buffer** buffer) {
       reinterpret_cast<TraceFileSegmentHeader*>(segment_prefix + 1);
   segment_header->thread_id = 0;
   segment_header->segment_length = sizeof(RecordPrefix);
+  segment_header->compression = TraceFileSegmentHeader::kCompressionNone;
+  segment_header->uncompressed_length = 0;
 
   RecordPrefix* event_prefix =
       reinterpret_cast<RecordPrefix*>(segment_header + 1);
@@ -620,18 +698,29 @@ bool Session::CreateProcessEndedEvent(Buffer** buffer) {
 }
 
 bool Session::BufferBookkeepingIsConsistent() const {
-  lock_.AssertAcquired();
-
-  size_t buffer_states_ = buffer_state_counts_[Buffer::kAvailable] +
-      buffer_state_counts_[Buffer::kInUse] +
-      buffer_state_counts_[Buffer::kPendingWrite];
+  size_t buffer_states_ = GetBufferStateCount(Buffer::kAvailable) +
+      GetBufferStateCount(Buffer::kInUse) +
+      GetBufferStateCount(Buffer::kPendingWrite);
   if (buffer_states_ != buffers_.size())
     return false;
 
-  if (buffers_available_.size() != buffer_state_counts_[Buffer::kAvailable])
+  if (available_ring_.size() + buffers_available_.size() !=
+      GetBufferStateCount(Buffer::kAvailable)) {
     return false;
+  }
   return true;
 }
 
+bool Session::BufferPoolsAreConsistent() const {
+  lock_.AssertAcquired();
+
+  size_t pool_buffers = 0;
+  SharedMemoryBufferCollection::const_iterator it =
+      shared_memory_buffers_.begin();
+  for (; it != shared_memory_buffers_.end(); ++it)
+    pool_buffers += (*it)->end() - (*it)->begin();
+  return pool_buffers == buffers_.size();
+}
+
 }  // namespace service
 }  // namespace trace
@@ -21,6 +21,7 @@
 #include <list>
 #include <map>
 
+#include "base/atomicops.h"
 #include "base/basictypes.h"
 #include "base/files/file_path.h"
 #include "base/memory/ref_counted.h"
@@ -31,6 +32,7 @@
 #include "base/win/scoped_handle.h"
 #include "syzygy/trace/service/buffer_consumer.h"
 #include "syzygy/trace/service/buffer_pool.h"
+#include "syzygy/trace/service/buffer_ring.h"
 #include "syzygy/trace/service/process_info.h"
 
 namespace trace {
@@ -43,6 +45,11 @@ class Service;
 // Note that this class it not internally thread safe.  It is expected
 // that the CallTraceService will ensure that access to a given instance
 // of this class is synchronized.
+//
+// The buffers available to the clients are kept in a lock-free ring, so that
+// handing out a buffer, returning it and recycling it once it has been written
+// don't take the session lock. The lock is only taken when the ring is empty
+// or full, to apply back-pressure or to allocate more buffers.
 class Session : public base::RefCountedThreadSafe<Session> {
  public:
   typedef base::ProcessId ProcessId;
@@ -148,6 +155,34 @@ class Session : public base::RefCountedThreadSafe<Session> {
   typedef Buffer::BufferState BufferState;
   typedef std::list<BufferPool*> SharedMemoryBufferCollection;
 
+  // The number of available buffers that can be held by available_ring_.
+  // Any further buffers are kept in buffers_available_.
+  static const size_t kAvailableRingCapacity = 1024;
+
+  // Tries to get an available buffer for a client without acquiring the lock.
+  // @param buffer will be populated with a pointer to the buffer to be provided
+  //     to the client.
+  // @returns true on success, false if no buffer is readily available or if
+  //     the session is closing.
+  bool GetAvailableBufferLockFree(Buffer** buffer);
+
+  // Makes a buffer available to the clients, and wakes up a request waiting
+  // for a buffer to be recycled if there is one.
+  // @param buffer the buffer to make available. It must already be in the
+  //     available state.
+  // @pre Not under lock_.
+  void MakeBufferAvailable(Buffer* buffer);
+
+  // Takes a buffer from the available ones, looking in available_ring_ then
+  // in buffers_available_.
+  // @param buffer will be populated with a pointer to the buffer.
+  // @returns true on success, false if there is no available buffer.
+  // @pre Under lock_.
+  bool PopAvailableBuffer(Buffer** buffer);
+
+  // @returns the number of buffers in the given state.
+  size_t GetBufferStateCount(BufferState state) const;
+
   // Allocates num_buffers shared client buffers, each of size
   // buffer_size and adds them to the free list.
   // @param num_nuffers the number of buffers to allocate.
@@ -196,11 +231,11 @@ class Session : public base::RefCountedThreadSafe<Session> {
   bool DestroySingletonBuffer(Buffer* buffer);
 
   // Transitions the buffer to the given state. This only updates the buffer's
-  // internal state and buffer_state_counts_, but not buffers_available_.
+  // internal state and buffer_state_counts_, but not the available buffers.
   // DCHECKs on any attempted invalid state changes.
   // @param new_state the new state to be applied to the buffer.
   // @param buffer the buffer to have its state changed.
-  // @pre Under lock_.
+  // @pre The caller owns @p buffer.
   void ChangeBufferState(BufferState new_state, Buffer* buffer);
 
   // Gets (creating if needed) a buffer and populates it with a
@@ -211,10 +246,19 @@ class Session : public base::RefCountedThreadSafe<Session> {
   // @pre Under lock_.
   bool CreateProcessEndedEvent(Buffer** buffer);
 
-  // Returns true if the buffer book-keeping is self-consistent.
-  // @pre Under lock_.
+  // Returns true if the buffer book-keeping is self-consistent. Buffers are
+  // handed out, returned and recycled without the lock, which briefly leaves
+  // the state counts and the available buffers out of step, so this can't be
+  // checked while other threads use the session.
+  // @pre No other thread is using the session.
   bool BufferBookkeepingIsConsistent() const;
 
+  // Returns true if the buffer map holds exactly the buffers of the buffer
+  // pools. Both only change under the lock, so unlike
+  // BufferBookkeepingIsConsistent this holds whenever the lock is held.
+  // @pre Under lock_.
+  bool BufferPoolsAreConsistent() const;
+
   // The call trace service this session lives in.  We do not own this
   // object.
   Service* const call_trace_service_;
@@ -229,19 +273,34 @@ class Session : public base::RefCountedThreadSafe<Session> {
   typedef std::map<Buffer::ID, Buffer*> BufferMap;
   BufferMap buffers_;  // Under lock_.
 
-  // State summary.
-  size_t buffer_state_counts_[Buffer::kBufferStateMax];  // Under lock_.
+  // State summary. These are updated atomically.
+  volatile base::subtle::Atomic32 buffer_state_counts_[Buffer::kBufferStateMax];
 
   // The consumer responsible for processing this sessions buffers. The
   // lifetime of this object is managed by the call trace service.
   scoped_refptr<BufferConsumer> buffer_consumer_;
 
   // Buffers available to give to the clients.
+  BufferRing available_ring_;
+
+  // Buffers available to give to the clients that didn't fit in
+  // available_ring_.
   typedef std::deque<Buffer*> BufferQueue;
   BufferQueue buffers_available_;  // Under lock_.
 
-  // Tracks whether this session is in the process of shutting down.
-  bool is_closing_;  // Under lock_.
+  // Tracks whether this session is in the process of shutting down. This is
+  // only written under lock_, but is also read by the lock-free paths.
+  volatile base::subtle::Atomic32 is_closing_;
+
+  // The number of threads currently handing out or returning a buffer
+  // without holding lock_. Close() waits for them to be done before
+  // flushing the buffers in use.
+  volatile base::subtle::Atomic32 lock_free_users_;
+
+  // The number of requests waiting on buffer_is_available_. This mirrors
+  // buffer_requests_waiting_for_recycle_, but can be read without the lock
+  // when a buffer is recycled.
+  volatile base::subtle::Atomic32 recycle_waiters_;
 
   // This is used to count the number of GetNextBuffer requests that are
   // currently applying back-pressure. There can only be as many of them as
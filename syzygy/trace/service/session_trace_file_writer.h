@@ -54,6 +54,12 @@ class SessionTraceFileWriter : public BufferConsumer {
   virtual size_t block_size() const override;
   // @}
 
+  // Sets the compression applied to the segments written to the trace file.
+  // This must be called before Open.
+  void set_compression(trace::common::SegmentCompression compression) {
+    writer_.set_compression(compression);
+  }
+
  protected:
   // Commit a trace buffer to disk. This will be called on message_loop_.
   void WriteBuffer(Session* session, Buffer* buffer);
@@ -23,6 +23,7 @@
 #include "base/files/file_path.h"
 #include "base/synchronization/lock.h"
 #include "base/win/scoped_handle.h"
+#include "syzygy/trace/common/segment_compression.h"
 #include "syzygy/trace/service/buffer_consumer.h"
 
 // Forward declaration.
@@ -53,6 +54,13 @@ class SessionTraceFileWriterFactory : public BufferConsumerFactory {
   // file writers will output trace files.
   bool SetTraceFileDirectory(const base::FilePath& path);
 
+  // Sets the compression applied to the segments of the trace files written
+  // by all subsequently created trace file writers. Defaults to
+  // kCompressionNone.
+  void set_compression(trace::common::SegmentCompression compression) {
+    compression_ = compression;
+  }
+
   // Get the message loop the trace file writers should use for IO.
   base::MessageLoop* message_loop() { return message_loop_; }
 
@@ -63,6 +71,9 @@ class SessionTraceFileWriterFactory : public BufferConsumerFactory {
   // The directory into which trace file writers will write.
   base::FilePath trace_file_directory_;
 
+  // The compression used by trace file writers.
+  trace::common::SegmentCompression compression_;
+
   // The set of currently active buffer consumer objects. Protected by lock_.
   std::set<scoped_refptr<BufferConsumer>> active_consumers_;
 
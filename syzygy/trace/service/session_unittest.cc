@@ -21,10 +21,13 @@
 #include "base/files/file_util.h"
 #include "base/files/scoped_temp_dir.h"
 #include "base/memory/scoped_ptr.h"
+#include "base/memory/scoped_vector.h"
 #include "base/strings/stringprintf.h"
 #include "base/strings/utf_string_conversions.h"
+#include "base/threading/simple_thread.h"
 #include "base/threading/thread.h"
 #include "gtest/gtest.h"
+#include "syzygy/testing/metrics.h"
 #include "syzygy/trace/protocol/call_trace_defs.h"
 #include "syzygy/trace/service/service.h"
 #include "syzygy/trace/service/service_rpc_impl.h"
@@ -263,6 +266,51 @@ class TestSession : public Session {
 
 typedef scoped_refptr<TestSession> TestSessionPtr;
 
+// A buffer consumer that recycles the buffers as soon as they are returned.
+// This leaves only the cost of handing the buffers back and forth.
+class RecyclingBufferConsumer : public BufferConsumer {
+ public:
+  bool Open(Session* session) override { return true; }
+  bool Close(Session* session) override { return true; }
+  bool ConsumeBuffer(Buffer* buffer) override {
+    return buffer->session->RecycleBuffer(buffer);
+  }
+  size_t block_size() const override { return 1024; }
+
+ protected:
+  ~RecyclingBufferConsumer() override { }
+};
+
+// A synthetic client that repeatedly gets a buffer from a session and
+// returns it.
+class SyntheticClient : public base::DelegateSimpleThread::Delegate {
+ public:
+  SyntheticClient(Session* session, size_t iterations)
+      : session_(session), iterations_(iterations), errors_(0) {
+  }
+
+  void Run() override {
+    for (size_t i = 0; i < iterations_; ++i) {
+      Buffer* buffer = NULL;
+      if (!session_->GetNextBuffer(&buffer) || buffer == NULL) {
+        ++errors_;
+        continue;
+      }
+      if (!session_->ReturnBuffer(buffer))
+        ++errors_;
+    }
+  }
+
+  size_t errors() const { return errors_; }
+
+ private:
+  Session* session_;
+  size_t iterations_;
+  size_t errors_;
+
+  DISALLOW_COPY_AND_ASSIGN(SyntheticClient);
+};
+
 class TestService : public Service {
  public:
   explicit TestService(BufferConsumerFactory* factory)
@@ -575,5 +623,42 @@ TEST_F(SessionTest, LargeBufferRequestAvoidsBackPressure) {
   ASSERT_EQ(buffer3, session->last_singleton_buffer_destroyed_);
 }
 
+// Measures the throughput of the buffer hand-off between a session and many
+// concurrent clients.
+TEST_F(SessionTest, BufferHandOffPerfTest) {
+  static const size_t kThreadCounts[] = { 1, 2, 4, 8 };
+  static const size_t kIterations = 100000;
+
+  for (size_t i = 0; i < arraysize(kThreadCounts); ++i) {
+    TestSessionPtr session(new TestSession(&call_trace_service_));
+    ASSERT_TRUE(session->Init(::GetCurrentProcessId()));
+    session->set_buffer_consumer(new RecyclingBufferConsumer());
+
+    ScopedVector<SyntheticClient> clients;
+    ScopedVector<base::DelegateSimpleThread> threads;
+    for (size_t j = 0; j < kThreadCounts[i]; ++j) {
+      clients.push_back(new SyntheticClient(session.get(), kIterations));
+      threads.push_back(new base::DelegateSimpleThread(
+          clients.back(),
+          base::StringPrintf("SyntheticClient%d", static_cast<int>(j))));
+    }
+
+    uint64 t0 = ::__rdtsc();
+    for (size_t j = 0; j < threads.size(); ++j)
+      threads[j]->Start();
+    for (size_t j = 0; j < threads.size(); ++j)
+      threads[j]->Join();
+    uint64 t1 = ::__rdtsc();
+
+    for (size_t j = 0; j < clients.size(); ++j)
+      EXPECT_EQ(0u, clients[j]->errors());
+
+    testing::EmitMetric(
+        base::StringPrintf("Syzygy.Trace.Service.Session.BufferHandOff.%d",
+                           static_cast<int>(kThreadCounts[i])),
+        t1 - t0);
+  }
+}
+
 }  // namespace service
 }  // namespace trace
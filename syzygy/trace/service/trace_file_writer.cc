@@ -28,6 +28,10 @@ namespace service {
 
 namespace {
 
+// The length of the headers at the start of each record.
+const size_t kHeaderLength =
+    sizeof(RecordPrefix) + sizeof(TraceFileSegmentHeader);
+
 bool OpenTraceFile(const base::FilePath& file_path,
                    base::win::ScopedHandle* file_handle) {
   DCHECK(!file_path.empty());
@@ -83,7 +87,9 @@ bool GetBlockSize(const base::FilePath& path, size_t* block_size) {
 
 }  // namespace
 
-TraceFileWriter::TraceFileWriter() : block_size_(0) {
+TraceFileWriter::TraceFileWriter()
+    : block_size_(0),
+      compression_(TraceFileSegmentHeader::kCompressionNone) {
 }
 
 TraceFileWriter::~TraceFileWriter() {
@@ -196,9 +202,6 @@ bool TraceFileWriter::WriteHeader(const ProcessInfo& process_info) {
 bool TraceFileWriter::WriteRecord(const void* data, size_t length) {
   DCHECK(data != NULL);
 
-  const size_t kHeaderLength =
-      sizeof(RecordPrefix) + sizeof(TraceFileSegmentHeader);
-
   if (length < kHeaderLength) {
     LOG(ERROR) << "Dropped buffer: too short.";
     return false;
@@ -225,6 +228,12 @@ bool TraceFileWriter::WriteRecord(const void* data, size_t length) {
     return true;
   }
 
+  // Only the writer compresses segments.
+  if (header->compression != TraceFileSegmentHeader::kCompressionNone) {
+    LOG(ERROR) << "Dropped buffer: unexpected segment compression.";
+    return false;
+  }
+
   // Figure out the total size that we'll write to disk.
   size_t bytes_to_write = ::common::AlignUp(kHeaderLength + segment_length,
                                             block_size_);
@@ -236,12 +245,18 @@ bool TraceFileWriter::WriteRecord(const void* data, size_t length) {
     return false;
   }
 
+  // Compress the segment if asked to. Incompressible segments are written as
+  // is.
+  const void* bytes = record;
+  if (compression_ != TraceFileSegmentHeader::kCompressionNone)
+    CompressRecord(segment_length, &bytes, &bytes_to_write);
+
   // Commit the buffer to disk.
   // TODO(rogerm): Use overlapped I/O.
   DCHECK_LT(0u, bytes_to_write);
   DWORD bytes_written = 0;
   if (!::WriteFile(handle_.Get(),
-                   record,
+                   bytes,
                    bytes_to_write,
                    &bytes_written,
                    NULL) ||
@@ -255,6 +270,51 @@ bool TraceFileWriter::WriteRecord(const void* data, size_t length) {
   return true;
 }
 
+bool TraceFileWriter::CompressRecord(size_t segment_length,
+                                     const void** data,
+                                     size_t* bytes_to_write) {
+  DCHECK(data != NULL);
+  DCHECK(bytes_to_write != NULL);
+  DCHECK_NE(TraceFileSegmentHeader::kCompressionNone, compression_);
+
+  // Compression only pays off if it saves at least a block.
+  if (*bytes_to_write < kHeaderLength + block_size_)
+    return false;
+  size_t max_compressed_length = *bytes_to_write - block_size_ - kHeaderLength;
+
+  compressed_buffer_.resize(*bytes_to_write + block_size_);
+  uint8* compressed_record = ::common::AlignUp(compressed_buffer_.data(),
+                                               block_size_);
+  const uint8* record = reinterpret_cast<const uint8*>(*data);
+  size_t compressed_length = 0;
+  if (!trace::common::CompressSegment(compression_,
+                                      record + kHeaderLength,
+                                      segment_length,
+                                      compressed_record + kHeaderLength,
+                                      max_compressed_length,
+                                      &compressed_length)) {
+    return false;
+  }
+
+  // Copy the headers and describe the compressed segment. The padding up to
+  // the next block is zeroed rather than leaking a previous record.
+  ::memcpy(compressed_record, record, kHeaderLength);
+  TraceFileSegmentHeader* header = reinterpret_cast<TraceFileSegmentHeader*>(
+      compressed_record + sizeof(RecordPrefix));
+  header->segment_length = compressed_length;
+  header->compression = compression_;
+  header->uncompressed_length = segment_length;
+
+  size_t compressed_bytes = ::common::AlignUp(
+      kHeaderLength + compressed_length, block_size_);
+  ::memset(compressed_record + kHeaderLength + compressed_length, 0,
+           compressed_bytes - kHeaderLength - compressed_length);
+
+  *data = compressed_record;
+  *bytes_to_write = compressed_bytes;
+  return true;
+}
+
 bool TraceFileWriter::Close() {
   if (::CloseHandle(handle_.Take()) == 0) {
     DWORD error = ::GetLastError();
@@ -39,8 +39,11 @@
 #ifndef SYZYGY_TRACE_SERVICE_TRACE_FILE_WRITER_H_
 #define SYZYGY_TRACE_SERVICE_TRACE_FILE_WRITER_H_
 
+#include <vector>
+
 #include "base/files/file_path.h"
 #include "base/win/scoped_handle.h"
+#include "syzygy/trace/common/segment_compression.h"
 #include "syzygy/trace/service/process_info.h"
 
 namespace trace {
@@ -76,9 +79,10 @@ class TraceFileWriter {
   // @returns true on success, false otherwise.
   bool WriteHeader(const ProcessInfo& process_info);
 
-  // Writes a record of data to disk.
+  // Writes a record of data to disk. If a compression mode is set the segment
+  // data is compressed on the way, unless that wouldn't save any disk space.
   // @param data The record to be written. This must contain a RecordPrefix.
-  //     This currently only supports records that contain a
+  //     This currently only supports records that contain an uncompressed
   //     TraceFileSegmenHeader.
   // @param length The maximum length of continuous data that may be
   //     contained in the record. The actual length is stored in the header, but
@@ -100,7 +104,31 @@ class TraceFileWriter {
   // @note This is only valid after Open has returned successfully.
   size_t block_size() const { return block_size_; }
 
+  // @name Accessors and mutators.
+  // @{
+  // The compression applied to the segments written by WriteRecord. Defaults
+  // to kCompressionNone.
+  trace::common::SegmentCompression compression() const {
+    return compression_;
+  }
+  void set_compression(trace::common::SegmentCompression compression) {
+    compression_ = compression;
+  }
+  // @}
+
  protected:
+  // Compresses the segment of a record into compressed_buffer_.
+  // @param segment_length The length of the segment data of the record.
+  // @param data On input, the record to compress. On success, receives the
+  //     compressed record, which is block aligned.
+  // @param bytes_to_write On input, the number of bytes needed to write the
+  //     record uncompressed. On success, receives the number of bytes needed
+  //     to write the compressed record.
+  // @returns true on success, false if compression wouldn't save a block.
+  bool CompressRecord(size_t segment_length,
+                      const void** data,
+                      size_t* bytes_to_write);
+
   // The path to the trace file being written.
   base::FilePath path_;
 
@@ -110,6 +138,14 @@ class TraceFileWriter {
   // The block size being used by the trace file writer.
   size_t block_size_;
 
+  // The compression applied to the segments.
+  trace::common::SegmentCompression compression_;
+
+  // Holds the most recently compressed record. This is over-allocated by a
+  // block so that the record can be block aligned, as unbuffered writes
+  // require.
+  std::vector<uint8> compressed_buffer_;
+
  private:
   DISALLOW_COPY_AND_ASSIGN(TraceFileWriter);
 };
@@ -180,5 +180,71 @@ TEST_F(TraceFileWriterTest, WriteRecordSucceeds) {
   EXPECT_EQ(0, trace_file_size % w.block_size());
 }
 
+TEST_F(TraceFileWriterTest, WriteRecordFailsCompressed) {
+  TestTraceFileWriter w;
+  ASSERT_TRUE(w.Open(trace_path));
+
+  ProcessInfo pi;
+  ASSERT_TRUE(pi.Initialize(::GetCurrentProcessId()));
+  ASSERT_TRUE(w.WriteHeader(pi));
+
+  std::vector<uint8> data;
+  data.resize(sizeof(RecordPrefix) + sizeof(TraceFileSegmentHeader) + 1);
+  RecordPrefix* record = reinterpret_cast<RecordPrefix*>(data.data());
+  TraceFileSegmentHeader* header = reinterpret_cast<TraceFileSegmentHeader*>(
+      record + 1);
+  record->size = sizeof(TraceFileSegmentHeader);
+  record->type = TraceFileSegmentHeader::kTypeId;
+  record->version.hi = TRACE_VERSION_HI;
+  record->version.lo = TRACE_VERSION_LO;
+  header->segment_length = 1;
+  header->compression = TraceFileSegmentHeader::kCompressionLz;
+
+  data.resize(::common::AlignUp(data.size(), w.block_size()));
+  EXPECT_FALSE(w.WriteRecord(data.data(), data.size()));
+}
+
+TEST_F(TraceFileWriterTest, WriteRecordCompresses) {
+  ProcessInfo pi;
+  ASSERT_TRUE(pi.Initialize(::GetCurrentProcessId()));
+
+  // Get the size of a trace file holding only a header.
+  base::FilePath header_path = temp_dir.AppendASCII("header.dat");
+  TestTraceFileWriter header_writer;
+  ASSERT_TRUE(header_writer.Open(header_path));
+  ASSERT_TRUE(header_writer.WriteHeader(pi));
+  ASSERT_TRUE(header_writer.Close());
+  int64 header_size = 0;
+  ASSERT_TRUE(base::GetFileSize(header_path, &header_size));
+
+  TestTraceFileWriter w;
+  w.set_compression(TraceFileSegmentHeader::kCompressionLz);
+  ASSERT_TRUE(w.Open(trace_path));
+  ASSERT_TRUE(w.WriteHeader(pi));
+
+  // A segment spanning many blocks of zeros.
+  std::vector<uint8> data(16 * w.block_size());
+  RecordPrefix* record = reinterpret_cast<RecordPrefix*>(data.data());
+  TraceFileSegmentHeader* header = reinterpret_cast<TraceFileSegmentHeader*>(
+      record + 1);
+  record->size = sizeof(TraceFileSegmentHeader);
+  record->type = TraceFileSegmentHeader::kTypeId;
+  record->version.hi = TRACE_VERSION_HI;
+  record->version.lo = TRACE_VERSION_LO;
+  header->segment_length =
+      data.size() - sizeof(RecordPrefix) - sizeof(TraceFileSegmentHeader);
+  EXPECT_TRUE(w.WriteRecord(data.data(), data.size()));
+  ASSERT_TRUE(w.Close());
+
+  // The segment compressed down to a single block.
+  int64 trace_file_size = 0;
+  ASSERT_TRUE(base::GetFileSize(trace_path, &trace_file_size));
+  EXPECT_EQ(header_size + static_cast<int64>(w.block_size()),
+            trace_file_size);
+
+  // The caller's record is left untouched.
+  EXPECT_EQ(TraceFileSegmentHeader::kCompressionNone, header->compression);
+}
+
 }  // namespace service
 }  // namespace trace